@@ -0,0 +1,57 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_AFFINITY_H
+#define _FR_AFFINITY_H
+/**
+ * $Id$
+ *
+ * @file include/affinity.h
+ * @brief CPU sets, NUMA topology, and pinning threads to CPUs.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(affinity_h, "$Id$")
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR_CPU_SET_MAX		(1024)		//!< CPUs numbered at or above this are ignored.
+
+/** A set of CPUs, independent of the OS cpu_set_t
+ *
+ */
+typedef struct fr_cpu_set_t {
+	uint64_t	bits[FR_CPU_SET_MAX / 64];
+} fr_cpu_set_t;
+
+int	fr_cpu_set_parse(fr_cpu_set_t *set, char const *str) CC_HINT(nonnull(1));
+bool	fr_cpu_set_isset(fr_cpu_set_t const *set, int cpu) CC_HINT(nonnull);
+int	fr_cpu_set_count(fr_cpu_set_t const *set) CC_HINT(nonnull);
+int	fr_cpu_set_nth(fr_cpu_set_t const *set, int n) CC_HINT(nonnull);
+
+int	fr_cpu_node(int cpu);
+int	fr_cpu_current(void);
+int	fr_cpu_pin(int cpu);
+int	fr_cpu_set_pin(fr_cpu_set_t const *set) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_AFFINITY_H */
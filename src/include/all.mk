@@ -37,6 +37,8 @@ HEADERS	= \
 	stats.h \
 	sysutmp.h \
 	token.h \
+	trie.h \
+	affinity.h \
 	udpfromto.h \
 	base64.h \
 	map.h \
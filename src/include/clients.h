@@ -65,6 +65,7 @@ typedef struct radclient {
 	fr_stats_t		coa;			//!< Change of Authorization stats.
 	fr_stats_t		dsc;			//!< Disconnect-Request stats.
 #  endif
+	fr_stats_latency_t	*latency;		//!< Time taken to respond to the client.
 #endif
 
 	struct timeval		response_window;	//!< How long the client has to respond.
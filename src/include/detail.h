@@ -44,6 +44,58 @@ typedef enum detail_entry_state_t {
 	STATE_REPLIED
 } detail_entry_state_t;
 
+typedef struct detail_replay detail_replay_t;
+
+/*
+ *	Binary detail files are a sequence of records, each of which
+ *	is a fixed size header followed by the RADIUS packet.  All
+ *	integers are in network byte order.
+ *
+ *	 0  magic		"FRD1"
+ *	 4  CRC-32C		of everything from the length to the end of the packet
+ *	 8  done		set to 1 by the reader when "track = yes", not in the CRC
+ *	 9  reserved		3 bytes
+ *	12  length		of the packet
+ *	16  timestamp		seconds
+ *	20  timestamp		microseconds
+ *	24  address family	4 or 6
+ *	25  reserved
+ *	26  source port
+ *	28  source address	16 bytes, IPv4 addresses use the first 4
+ *	44  packet
+ */
+#define DETAIL_BINARY_MAGIC		"FRD1"
+#define DETAIL_BINARY_HDR_LEN		(44)
+#define DETAIL_BINARY_DONE_OFFSET	(8)
+
+/*
+ *	Attributes which are encrypted (e.g. Tunnel-Password) are
+ *	re-encoded with this secret, as the client's shared secret
+ *	isn't stored.
+ */
+#define DETAIL_BINARY_SECRET		"detail"
+
+/** A record from a binary detail file
+ *
+ */
+typedef struct detail_binary_t {
+	bool			done;		//!< Marked as done by a previous reader.
+	struct timeval		timestamp;	//!< When the packet was received.
+	fr_ipaddr_t		src_ipaddr;	//!< Where the packet came from.
+	uint16_t		src_port;
+	uint8_t const		*data;		//!< The RADIUS packet.
+	size_t			data_len;
+} detail_binary_t;
+
+void		detail_binary_header(uint8_t out[DETAIL_BINARY_HDR_LEN], struct timeval const *timestamp,
+				     RADIUS_PACKET const *packet, uint8_t const *data, size_t data_len);
+
+ssize_t		detail_binary_decode(detail_binary_t *out, uint8_t const *in, size_t inlen);
+
+size_t		detail_binary_next(uint8_t const *in, size_t inlen);
+
+bool		detail_binary_is(uint8_t const *in, size_t inlen);
+
 typedef struct listen_detail_t {
 	fr_event_timer_t	*ev;	/* has to be first entry (ugh) */
 	char const 	*name;			//!< Identifier used in log messages
@@ -69,6 +121,10 @@ typedef struct listen_detail_t {
 	off_t		timestamp_offset;
 	bool		done_entry;		//!< Are we done reading this entry?
 	bool		track;			//!< Do we track progress through the file?
+	bool		use_mmap;		//!< Replay the work file through a memory mapping.
+	uint32_t	max_outstanding;	//!< How many packets may be in flight when replaying.
+	uint32_t	parse_threads;		//!< How many threads parse the work file when replaying.
+	detail_replay_t	*replay;		//!< State of the replay reader, owned by its thread.
 
 	uint32_t	load_factor; /* 1..100 */
 	uint32_t	poll_interval;
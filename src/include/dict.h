@@ -68,6 +68,16 @@ typedef struct attr_flags {
 	uint8_t			type_size;			//!< For TLV2 and root attributes.
 } fr_dict_attr_flags_t;
 
+/** Pre-computed RADIUS header for simple attributes
+ *
+ * Filled in when the attribute is added to the dictionary.  hdr_len is
+ * zero for attributes which have to go through the full encoder.
+ */
+typedef struct attr_encode {
+	uint8_t			hdr[8];				//!< Attribute header, including the VSA header.
+	uint8_t			hdr_len;			//!< 2 for RFC attributes, 8 for VSAs, or 0.
+} fr_dict_attr_encode_t;
+
 extern const FR_NAME_NUMBER dict_attr_types[];
 extern const size_t dict_attr_sizes[PW_TYPE_MAX + 1][2];
 
@@ -89,6 +99,7 @@ struct dict_attr {
 	unsigned int		depth;				//!< Depth of nesting for this attribute.
 
 	fr_dict_attr_flags_t	flags;				//!< Flags.
+	fr_dict_attr_encode_t	encode;				//!< RADIUS encoder fast path.
 	char			name[1];			//!< Attribute name.
 };
 
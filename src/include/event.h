@@ -107,6 +107,7 @@ bool		fr_event_loop_exiting(fr_event_list_t *el);
 int		fr_event_loop(fr_event_list_t *el);
 
 fr_event_list_t	*fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status, void *status_ctx);
+int		fr_event_list_timer_wheel(fr_event_list_t *el, uint32_t resolution) CC_HINT(nonnull);
 
 #ifdef __cplusplus
 }
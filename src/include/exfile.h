@@ -47,6 +47,13 @@ int		exfile_close(exfile_t *lf, REQUEST *request, int fd);
 
 int		exfile_unlock(exfile_t *lf, REQUEST *request, int fd);
 
+int		exfile_buffer_init(exfile_t *ef, struct timeval const *interval, size_t max_bytes, bool sync);
+
+int		exfile_append(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions, gid_t gid,
+			      void const *data, size_t len);
+
+size_t		exfile_flush(exfile_t *ef);
+
 #ifdef __cplusplus
 }
 #endif
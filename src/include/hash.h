@@ -31,12 +31,26 @@ extern "C" {
 
 /*
  *	Fast hash, which isn't too bad.  Don't use for cryptography,
- *	just for hashing internal data.
+ *	just for hashing internal data.  The output is randomised
+ *	per process.
  */
 uint32_t fr_hash(void const *, size_t);
 uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash);
 uint32_t fr_hash_string(char const *p);
 
+/*
+ *	Slower, but gives the same output on every run.
+ */
+uint32_t fr_hash_fnv(void const *data, size_t size);
+uint32_t fr_hash_fnv_update(void const *data, size_t size, uint32_t hash);
+uint32_t fr_hash_fnv_string(char const *p);
+
+/*
+ *	Checksums, for data which is written to disk.
+ */
+uint32_t fr_crc32c(void const *data, size_t size);
+uint32_t fr_crc32c_update(void const *data, size_t size, uint32_t crc);
+
 typedef struct fr_hash_table_t fr_hash_table_t;
 typedef void (*fr_hash_table_free_t)(void *);
 typedef uint32_t (*fr_hash_table_hash_t)(void const *);
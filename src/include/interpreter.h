@@ -134,6 +134,10 @@ typedef struct {
 
 	map_proc_inst_t		*proc_inst;	//!< Instantiation data for #UNLANG_TYPE_MAP.
 	bool			done_pass2;
+
+#ifdef WITH_STATS
+	fr_stats_latency_t	*latency;	//!< Time spent in the section.  Top level sections only.
+#endif
 } unlang_group_t;
 
 /** A call to a module method
@@ -227,6 +231,11 @@ typedef struct {
 	bool			top_frame;
 	unlang_t		*instruction;
 
+#ifdef WITH_STATS
+	fr_stats_latency_t	*latency;	//!< Section being timed.  Top frames only.
+	struct timeval		start;		//!< When the section or module call started.
+#endif
+
 	union {
 		unlang_stack_entry_modcall_t	modcall;
 		unlang_stack_entry_foreach_t	foreach;
@@ -76,6 +76,8 @@ RCSIDH(libradius_h, "$Id$")
 #include <freeradius-devel/conf.h>
 #include <freeradius-devel/radpaths.h>
 #include <freeradius-devel/rbtree.h>
+#include <freeradius-devel/trie.h>
+#include <freeradius-devel/affinity.h>
 #include <freeradius-devel/fr_log.h>
 #include <freeradius-devel/version.h>
 
@@ -226,6 +228,9 @@ ssize_t		fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *sr
 
 int		fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret);
 
+int		fr_radius_verify_batch(RADIUS_PACKET *packets[], RADIUS_PACKET *originals[], char const *secrets[],
+				       size_t const secret_lens[], int rcodes[], int num);
+
 int		fr_radius_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret);
 
 int		fr_radius_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original, char const *secret);
@@ -258,6 +263,8 @@ ssize_t		fr_radius_encode_value_hton(uint8_t *out, size_t outlen, VALUE_PAIR con
 
 int		fr_radius_encode_pair(uint8_t *out, size_t outlen, vp_cursor_t *cursor, void *encoder_ctx);
 
+ssize_t		fr_radius_encode_pair_plan(uint8_t *out, size_t outlen, VALUE_PAIR const *vp);
+
 /*
  *	radius_decode.c
  */
@@ -282,6 +289,20 @@ ssize_t		fr_radius_decode_pair(TALLOC_CTX *ctx,  vp_cursor_t *cursor, fr_dict_at
 				      uint8_t const *data, size_t data_len,
 				      void *decoder_ctx);
 
+typedef struct fr_radius_index fr_radius_index_t;
+
+fr_radius_index_t *fr_radius_index_afrom_packet(TALLOC_CTX *ctx, RADIUS_PACKET *packet,
+						RADIUS_PACKET const *original, char const *secret);
+
+int		fr_radius_index_decode(fr_radius_index_t *idx, fr_dict_attr_t const *da);
+
+VALUE_PAIR	*fr_radius_index_pair_find(fr_radius_index_t *idx, fr_dict_attr_t const *da, int8_t tag);
+
+int		fr_radius_index_decode_all(fr_radius_index_t *idx);
+
+int		fr_radius_decode_only(RADIUS_PACKET *packet, RADIUS_PACKET const *original, char const *secret,
+				      fr_dict_attr_t const **da, int num);
+
 /*
  *	cursor.c
  */
@@ -26,6 +26,7 @@
 RCSIDH(listen_h, "$Id$")
 
 #include <freeradius-devel/pcap.h>
+#include <freeradius-devel/udp.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -156,6 +157,8 @@ typedef struct listen_socket_t {
 
 	rbtree_t		*dup_tree;	//!< only for auth packets
 
+	udp_mmsg_t		*mmsg;		//!< buffers for reading packets in batches.
+
 #ifdef WITH_TCP
 	/* for a proxy connecting to home servers */
 	time_t			last_packet;
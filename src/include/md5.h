@@ -86,6 +86,22 @@ void	fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t
 /* md5.c */
 void	fr_md5_calc(uint8_t *out, uint8_t const *in, size_t inlen);
 
+/* md5_mb.c */
+#define FR_MD5_MB_LANES		(16)	//!< Messages hashed in parallel.
+#define FR_MD5_MB_SEGMENTS	(3)	//!< Maximum number of segments in one message.
+
+/** One message for the multi-buffer MD5 functions
+ *
+ * The message is the concatenation of its segments.  Unused segments
+ * have a length of zero.
+ */
+typedef struct fr_md5_mb_in {
+	uint8_t const	*data[FR_MD5_MB_SEGMENTS];	//!< Segments of the message.
+	size_t		len[FR_MD5_MB_SEGMENTS];	//!< Length of each segment.
+} fr_md5_mb_in_t;
+
+void	fr_md5_mb_calc(uint8_t out[][MD5_DIGEST_LENGTH], fr_md5_mb_in_t const in[], int num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -133,6 +133,8 @@ typedef struct main_config {
 	uint32_t	cleanup_delay;			//!< How long before cleaning up cached responses.
 	uint32_t	continuation_timeout;		//!< How long to wait before cleaning up state entries.
 	uint32_t	max_requests;
+	uint32_t	timer_resolution;		//!< Tick of the request timer wheel, in milliseconds.
+							//!< 0 means use a heap, with exact timers.
 	bool		drop_requests;			//!< Administratively disable request processing.
 
 	char const	*log_file;
@@ -422,6 +424,21 @@ size_t		rad_filename_escape(UNUSED REQUEST *request, char *out, size_t outlen,
 ssize_t		rad_filename_unescape(char *out, size_t outlen, char const *in, size_t inlen);
 void		talloc_const_free(void const *ptr);
 char		*rad_ajoin(TALLOC_CTX *ctx, char const **argv, int argc, char c);
+/** Memory used by requests allocated in talloc pools
+ *
+ */
+typedef struct request_pool_stats_t {
+	uint64_t	requests;			//!< Number of request pools freed.
+	uint64_t	samples;			//!< Number of those which were measured.
+	uint64_t	blocks;				//!< Average number of talloc chunks per request.
+	uint64_t	bytes;				//!< Average number of bytes per request.
+	size_t		pool_size;			//!< Size of the pool for new requests.
+} request_pool_stats_t;
+
+TALLOC_CTX	*request_pool_alloc(char const *name);
+void		request_pool_account(TALLOC_CTX *ctx);
+void		request_pool_stats(request_pool_stats_t *stats);
+
 REQUEST		*request_alloc(TALLOC_CTX *ctx);
 REQUEST		*request_alloc_fake(REQUEST *oldreq);
 REQUEST		*request_alloc_coa(REQUEST *request);
@@ -279,6 +279,10 @@ struct rs {
 
 	VALUE_PAIR 		*filter_request_vps;	//!< Sorted filter vps.
 	VALUE_PAIR 		*filter_response_vps;	//!< Sorted filter vps.
+
+	fr_dict_attr_t const	**decode_da;		//!< If we're not printing packets, only decode
+							//!< the attributes we list, link or filter on.
+	int			decode_da_num;		//!< Number of decode fr_dict_attr_ts.
 	PW_CODE			filter_request_code;	//!< Filter request packets by code.
 	PW_CODE			filter_response_code;	//!< Filter response packets by code.
 
@@ -146,6 +146,8 @@ typedef struct home_server {
 	fr_stats_t		stats;
 
 	fr_stats_ema_t  	ema;
+
+	fr_stats_latency_t	*latency;		//!< Time taken by the home server to respond.
 #endif
 } home_server_t;
 
@@ -31,6 +31,17 @@ extern "C" {
 #endif
 
 typedef struct fr_state_tree_t fr_state_tree_t;
+
+/** Statistics for one shard of a state tree
+ *
+ */
+typedef struct fr_state_shard_stats {
+	uint32_t	tracked;	//!< Number of entries in the shard.
+	uint64_t	timed_out;	//!< Number of entries cleaned up due to timeout.
+	uint64_t	locked;		//!< Number of times the shard was locked.
+	uint64_t	contended;	//!< Number of times the shard was already locked by another thread.
+} fr_state_shard_stats_t;
+
 extern fr_state_tree_t *global_state;
 
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint32_t timeout);
@@ -47,6 +58,9 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state);
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state);
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state);
 
+uint32_t fr_state_num_shards(fr_state_tree_t *state);
+int fr_state_shard_stats(fr_state_shard_stats_t *stats, fr_state_tree_t *state, uint32_t shard);
+
 #ifdef __cplusplus
 }
 #endif
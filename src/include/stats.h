@@ -61,42 +61,92 @@ typedef struct fr_stats_ema_t {
 	uint32_t	ema1, ema10;
 } fr_stats_ema_t;
 
-extern fr_stats_t	radius_auth_stats;
+/*
+ *	Latency histogram.  Values under 8us get a bucket each, after
+ *	that each power of two is split into 8 linear buckets, so the
+ *	bucket a value falls in is never more than 12.5% wider than the
+ *	value.  Values above ~70 minutes are counted in the last bucket.
+ */
+#define FR_STATS_HIST_SUB_BITS	(3)
+#define FR_STATS_HIST_SUB	(1 << FR_STATS_HIST_SUB_BITS)
+#define FR_STATS_HIST_BUCKETS	((32 - FR_STATS_HIST_SUB_BITS + 1) * FR_STATS_HIST_SUB)
+
+typedef struct fr_stats_hist_t {
+	fr_uint_t	count;				//!< Number of values recorded.
+	uint64_t	total_usec;			//!< Sum of the values, for the mean.
+	uint32_t	max_usec;			//!< Largest value recorded.
+	fr_uint_t	bucket[FR_STATS_HIST_BUCKETS];	//!< Number of values in each bucket.
+} fr_stats_hist_t;
+
+/*
+ *	A histogram, for timing virtual server sections, module calls,
+ *	clients and home servers.  Each thread records into its own copy.
+ */
+typedef struct fr_stats_latency fr_stats_latency_t;
+
+typedef int (*fr_stats_latency_walk_t)(char const *name, fr_stats_hist_t const *hist, void *ctx);
+
+/** The global statistics, as kept by one thread
+ *
+ * Every thread which updates the global statistics gets its own
+ * copy, so that the counters bumped for every packet aren't shared
+ * between CPUs.  The copies are summed by radius_stats_sum() when
+ * something wants to read them, into a fr_stats_shard_t owned by the
+ * reader.
+ */
+typedef struct fr_stats_shard {
+	fr_stats_t		auth;
 #ifdef WITH_ACCOUNTING
-extern fr_stats_t	radius_acct_stats;
+	fr_stats_t		acct;
 #endif
 #ifdef WITH_COA
-extern fr_stats_t	radius_coa_stats;
-extern fr_stats_t	radius_dsc_stats;
+	fr_stats_t		coa;
+	fr_stats_t		dsc;
 #endif
 #ifdef WITH_PROXY
-extern fr_stats_t	proxy_auth_stats;
+	fr_stats_t		proxy_auth;
 #ifdef WITH_ACCOUNTING
-extern fr_stats_t	proxy_acct_stats;
+	fr_stats_t		proxy_acct;
 #endif
 #ifdef WITH_COA
-extern fr_stats_t	proxy_coa_stats;
-extern fr_stats_t	proxy_dsc_stats;
+	fr_stats_t		proxy_coa;
+	fr_stats_t		proxy_dsc;
 #endif
 #endif
+	bool			in_use;		//!< Whether a thread owns this shard.
+	struct fr_stats_shard	*next;		//!< Next in the list of all shards.
+} CC_HINT(aligned(64)) fr_stats_shard_t;
 
 void radius_stats_init(int flag);
+fr_stats_shard_t *radius_stats_shard(void);
+void radius_stats_sum(fr_stats_shard_t *out);
 void request_stats_final(REQUEST *request);
 void request_stats_reply(REQUEST *request);
 void radius_stats_ema(fr_stats_ema_t *ema,
 		      struct timeval *start, struct timeval *end);
 void fr_stats_bins(fr_stats_t *stats, struct timeval *start, struct timeval *end);
+void fr_stats_add(fr_stats_t *out, fr_stats_t const *in);
+void fr_stats_hist_add(fr_stats_hist_t *hist, struct timeval *start, struct timeval *end);
+void fr_stats_hist_merge(fr_stats_hist_t *out, fr_stats_hist_t const *in);
+uint32_t fr_stats_hist_percentile(fr_stats_hist_t const *hist, double percentile);
+fr_stats_latency_t *fr_stats_latency_register(char const *name);
+fr_stats_latency_t *fr_stats_latency_alloc(TALLOC_CTX *ctx);
+void fr_stats_latency_add(fr_stats_latency_t const *lat, struct timeval *start, struct timeval *end);
+void fr_stats_latency_sum(fr_stats_hist_t *out, fr_stats_latency_t const *lat);
+int fr_stats_latency_walk(fr_stats_latency_walk_t callback, void *ctx);
 int fr_snmp_process(REQUEST *request);
 int fr_snmp_init(void);
 
 
-#define FR_STATS_INC(_x, _y) radius_ ## _x ## _stats._y++;if (listener) listener->stats._y++;if (client) client->_x._y++;
+#define FR_STATS_INC(_x, _y) radius_stats_shard()->_x._y++;if (listener) listener->stats._y++;if (client) client->_x._y++;
 #define FR_STATS_TYPE_INC(_x) _x++
 
 #else  /* WITH_STATS */
 #define request_stats_init(_x)
 #define request_stats_final(_x)
 #define fr_stats_bins(_x, _y, _z)
+#define fr_stats_hist_add(_x, _y, _z)
+#define fr_stats_latency_add(_x, _y, _z)
 
 #define FR_STATS_INC(_x, _y)
 #define FR_STATS_TYPE_INC(_x)
@@ -0,0 +1,59 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_TRIE_H
+#define _FR_TRIE_H
+/**
+ * $Id$
+ *
+ * @file include/trie.h
+ * @brief Path compressed binary tries, for longest prefix matching.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSIDH(trie_h, "$Id$")
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_trie_t fr_trie_t;
+
+/** Decide whether a candidate prefix is acceptable for a lookup
+ *
+ * @param[in] uctx	passed to fr_trie_match().
+ * @param[in] data	stored against the candidate prefix.
+ * @return
+ *	- true to return this data.
+ *	- false to continue with the next shortest prefix.
+ */
+typedef bool (*fr_trie_match_t)(void *uctx, void const *data);
+
+fr_trie_t	*fr_trie_create(TALLOC_CTX *ctx, size_t max_bits);
+int		fr_trie_insert(fr_trie_t *ft, void const *key, size_t bits, void *data) CC_HINT(nonnull);
+void		*fr_trie_find(fr_trie_t *ft, void const *key, size_t bits) CC_HINT(nonnull);
+void		*fr_trie_match(fr_trie_t *ft, void const *key, size_t bits,
+			       fr_trie_match_t match, void *uctx) CC_HINT(nonnull(1,2));
+void		*fr_trie_remove(fr_trie_t *ft, void const *key, size_t bits) CC_HINT(nonnull);
+uint32_t	fr_trie_num_elements(fr_trie_t *ft) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_TRIE_H */
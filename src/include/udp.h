@@ -39,6 +39,24 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+#define UDP_MMSG_MAX		(64)	//!< Most packets read by one call.
+
+/** One packet for udp_recv_mmsg()
+ *
+ */
+typedef struct udp_mmsg_t {
+	uint8_t		*data;			//!< The packet.
+	size_t		data_len;		//!< Size of the buffer, updated to the length of the packet.
+
+	fr_ipaddr_t	src_ipaddr;
+	uint16_t	src_port;
+	fr_ipaddr_t	dst_ipaddr;
+	uint16_t	dst_port;
+	int		if_index;
+
+	struct timeval	when;			//!< When the packet was received.
+} udp_mmsg_t;
+
 ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t dst_port);
@@ -52,6 +70,9 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
 		 struct timeval *when);
 
+int udp_recv_mmsg(int sockfd, udp_mmsg_t *packets, int num, int flags,
+		  fr_ipaddr_t const *ipaddr, uint16_t port);
+
 #ifdef __cplusplus
 }
 #endif
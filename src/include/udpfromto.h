@@ -41,6 +41,8 @@ int sendfromto(int s, void *buf, size_t len, int flags,
 	       struct sockaddr *from, socklen_t fromlen,
 	       struct sockaddr *to, socklen_t tolen,
 	       int if_index);
+void udpfromto_recv_cmsg(struct msghdr *msgh, struct sockaddr *to, socklen_t *to_len,
+			 int *if_index, struct timeval *when);
 #endif
 
 #ifdef __cplusplus
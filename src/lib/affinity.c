@@ -0,0 +1,321 @@
+/*
+ * affinity.c	CPU sets, NUMA topology, and pinning threads to CPUs.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ *  Copyright 2017  The FreeRADIUS server project
+ */
+
+/*
+ *	We don't link against libnuma.  The kernel allocates pages on
+ *	the node of the CPU which first touches them, so a thread
+ *	which is pinned before it allocates anything gets node local
+ *	memory for free.  All we need from the topology is which node
+ *	a CPU is on, and Linux exports that in sysfs.
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <ctype.h>
+
+#ifdef __linux__
+#  include <sched.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
+#define FR_NUMA_NODE_MAX	(64)
+
+static int8_t	cpu_node[FR_CPU_SET_MAX];	//!< NUMA node of each CPU, or -1.
+
+#ifdef HAVE_PTHREAD_H
+static pthread_once_t cpu_node_once = PTHREAD_ONCE_INIT;
+#else
+static bool	cpu_node_done;
+#endif
+
+/** Add one CPU to a set
+ *
+ */
+static inline void cpu_set_add(fr_cpu_set_t *set, int cpu)
+{
+	set->bits[cpu >> 6] |= ((uint64_t) 1) << (cpu & 0x3f);
+}
+
+/** Parse a Linux style CPU list, e.g. "0-3,8,10-11"
+ *
+ * @param[out] set	to write the CPUs to.  It is cleared first.
+ * @param[in] str	the list.  NULL or "" is the empty set.
+ * @return
+ *	- The number of CPUs in the set on success.
+ *	- -1 on parse error.
+ */
+int fr_cpu_set_parse(fr_cpu_set_t *set, char const *str)
+{
+	char const	*p = str;
+	char		*end;
+	unsigned long	first, last, cpu;
+
+	memset(set, 0, sizeof(*set));
+
+	if (!p) return 0;
+
+	while (isspace((int) *p)) p++;
+
+	while (*p) {
+		if (!isdigit((int) *p)) {
+			fr_strerror_printf("Invalid CPU list \"%s\": Unexpected text at \"%s\"", str, p);
+			return -1;
+		}
+
+		first = last = strtoul(p, &end, 10);
+		p = end;
+
+		if (*p == '-') {
+			p++;
+			if (!isdigit((int) *p)) {
+				fr_strerror_printf("Invalid CPU list \"%s\": Range has no end", str);
+				return -1;
+			}
+
+			last = strtoul(p, &end, 10);
+			p = end;
+		}
+
+		if ((last < first) || (last >= FR_CPU_SET_MAX)) {
+			fr_strerror_printf("Invalid CPU list \"%s\": CPUs must be in ascending order, "
+					   "and less than %d", str, FR_CPU_SET_MAX);
+			return -1;
+		}
+
+		for (cpu = first; cpu <= last; cpu++) cpu_set_add(set, cpu);
+
+		while (isspace((int) *p)) p++;
+		if (*p == ',') p++;
+		while (isspace((int) *p)) p++;
+	}
+
+	return fr_cpu_set_count(set);
+}
+
+/** Check whether a CPU is in a set
+ *
+ */
+bool fr_cpu_set_isset(fr_cpu_set_t const *set, int cpu)
+{
+	if ((cpu < 0) || (cpu >= FR_CPU_SET_MAX)) return false;
+
+	return ((set->bits[cpu >> 6] >> (cpu & 0x3f)) & 0x01) != 0;
+}
+
+/** Return the number of CPUs in a set
+ *
+ */
+int fr_cpu_set_count(fr_cpu_set_t const *set)
+{
+	size_t	i;
+	int	count = 0;
+
+	for (i = 0; i < sizeof(set->bits) / sizeof(set->bits[0]); i++) {
+		uint64_t bits = set->bits[i];
+
+		while (bits) {
+			bits &= bits - 1;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/** Return the n'th CPU of a set, wrapping around at the end
+ *
+ * Used to hand out CPUs to threads round-robin.
+ *
+ * @param[in] set	of CPUs.
+ * @param[in] n		index of the CPU, from 0.
+ * @return
+ *	- The CPU number.
+ *	- -1 if the set is empty.
+ */
+int fr_cpu_set_nth(fr_cpu_set_t const *set, int n)
+{
+	int cpu, count;
+
+	count = fr_cpu_set_count(set);
+	if (!count) return -1;
+
+	n %= count;
+	for (cpu = 0; cpu < FR_CPU_SET_MAX; cpu++) {
+		if (!fr_cpu_set_isset(set, cpu)) continue;
+		if (n-- == 0) return cpu;
+	}
+
+	return -1;
+}
+
+/** Read the NUMA topology from sysfs
+ *
+ */
+static void cpu_node_init(void)
+{
+	int node, cpu;
+
+	memset(cpu_node, -1, sizeof(cpu_node));
+
+	for (node = 0; node < FR_NUMA_NODE_MAX; node++) {
+		char		path[64], buffer[1024];
+		FILE		*fp;
+		fr_cpu_set_t	set;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+		fp = fopen(path, "r");
+		if (!fp) continue;	/* nodes may be sparse */
+
+		if (!fgets(buffer, sizeof(buffer), fp)) {
+			fclose(fp);
+			continue;
+		}
+		fclose(fp);
+
+		buffer[strcspn(buffer, "\r\n")] = '\0';
+		if (fr_cpu_set_parse(&set, buffer) <= 0) continue;
+
+		for (cpu = 0; cpu < FR_CPU_SET_MAX; cpu++) {
+			if (fr_cpu_set_isset(&set, cpu)) cpu_node[cpu] = node;
+		}
+	}
+}
+
+/** Return the NUMA node a CPU belongs to
+ *
+ * The topology is read once, the first time this is called.
+ *
+ * @param[in] cpu	to look up.
+ * @return
+ *	- The node number.
+ *	- -1 if the topology is unknown.
+ */
+int fr_cpu_node(int cpu)
+{
+	if ((cpu < 0) || (cpu >= FR_CPU_SET_MAX)) return -1;
+
+#ifdef HAVE_PTHREAD_H
+	(void) pthread_once(&cpu_node_once, cpu_node_init);
+#else
+	if (!cpu_node_done) {
+		cpu_node_init();
+		cpu_node_done = true;
+	}
+#endif
+
+	return cpu_node[cpu];
+}
+
+/** Return the CPU the calling thread is running on
+ *
+ * @return
+ *	- The CPU number.
+ *	- -1 if the platform can't tell us.
+ */
+int fr_cpu_current(void)
+{
+#ifdef __linux__
+	return sched_getcpu();
+#else
+	return -1;
+#endif
+}
+
+/** Bind the calling thread to a single CPU
+ *
+ * This should be done before the thread allocates memory which it
+ * uses heavily, so that the memory is on the same node as the CPU.
+ *
+ * @param[in] cpu	to run on.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_cpu_pin(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t	cs;
+	int		rcode;
+
+	if ((cpu < 0) || (cpu >= CPU_SETSIZE)) {
+		fr_strerror_printf("Invalid CPU %d", cpu);
+		return -1;
+	}
+
+	CPU_ZERO(&cs);
+	CPU_SET(cpu, &cs);
+
+	rcode = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+	if (rcode != 0) {
+		fr_strerror_printf("Failed binding thread to CPU %d: %s", cpu, fr_syserror(rcode));
+		return -1;
+	}
+
+	return 0;
+#else
+	fr_strerror_printf("Binding threads to CPU %d is not supported on this platform", cpu);
+	return -1;
+#endif
+}
+
+/** Bind the calling thread to the CPUs in a set
+ *
+ * The thread may still move between those CPUs.  Threads it creates
+ * afterwards start with the same binding.
+ *
+ * @param[in] set	of CPUs to run on.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_cpu_set_pin(fr_cpu_set_t const *set)
+{
+#ifdef __linux__
+	cpu_set_t	cs;
+	int		cpu, rcode;
+
+	CPU_ZERO(&cs);
+	for (cpu = 0; (cpu < FR_CPU_SET_MAX) && (cpu < CPU_SETSIZE); cpu++) {
+		if (fr_cpu_set_isset(set, cpu)) CPU_SET(cpu, &cs);
+	}
+
+	if (CPU_COUNT(&cs) == 0) {
+		fr_strerror_printf("No usable CPUs in set");
+		return -1;
+	}
+
+	rcode = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+	if (rcode != 0) {
+		fr_strerror_printf("Failed binding thread to CPUs: %s", fr_syserror(rcode));
+		return -1;
+	}
+
+	return 0;
+#else
+	fr_strerror_printf("Binding threads to CPUs is not supported on this platform");
+	return -1;
+#endif
+}
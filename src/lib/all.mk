@@ -20,6 +20,7 @@ SOURCES		:= cbuff.c \
 		   missing.c \
 		   md4.c \
 		   md5.c \
+		   md5_mb.c \
 		   net.c \
 		   pair.c \
 		   pair_cursor.c \
@@ -30,6 +31,8 @@ SOURCES		:= cbuff.c \
 		   radius_encode.c \
 		   radius_decode.c \
 		   rbtree.c \
+		   trie.c \
+		   affinity.c \
 		   regex.c \
 		   sha1.c \
 		   snprintf.c \
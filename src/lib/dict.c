@@ -218,14 +218,9 @@ const bool fr_dict_attr_allowed_chars[UINT8_MAX] = {
 #  define INTERNAL_IF_NULL(_dict) if (!_dict) _dict = fr_dict_internal
 #endif
 
-/** Empty callback for hash table initialization
+/** Free an entry which has been removed from one of the dictionary's hash tables
  *
  */
-static int hash_null_callback(UNUSED void *ctx, UNUSED void *data)
-{
-	return 0;
-}
-
 static void hash_pool_free(void *to_free)
 {
 	talloc_free(to_free);
@@ -668,6 +663,75 @@ static fr_dict_attr_t *fr_dict_attr_alloc(TALLOC_CTX *ctx,
 	return da;
 }
 
+/** Pre-compute the RADIUS header for simple attributes
+ *
+ * Flat RFC attributes, and VSAs from vendors which use the standard
+ * one octet type and length fields, always have the same header.  The
+ * encoder copies the header and writes the value straight after it,
+ * instead of building a TLV stack for every attribute.
+ *
+ * Anything with tags, encryption, fragmentation, or a value which
+ * isn't a simple copy of the data, is left for the full encoder.
+ *
+ * @param[in] da	to build the header for.
+ * @param[in] parent	of the attribute.
+ */
+static void dict_attr_encode_init(fr_dict_attr_t *da, fr_dict_attr_t const *parent)
+{
+	uint32_t vendorpec;
+
+	memset(&da->encode, 0, sizeof(da->encode));
+
+	if (da->flags.internal || da->flags.has_tag || da->flags.array || da->flags.concat ||
+	    (da->flags.encrypt != FLAG_ENCRYPT_NONE)) return;
+
+	switch (da->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+		if (da->flags.length) return;	/* truncated by the full encoder */
+		break;
+
+	case PW_TYPE_IPV4_ADDR:
+	case PW_TYPE_IPV6_ADDR:
+	case PW_TYPE_IFID:
+	case PW_TYPE_ETHERNET:
+	case PW_TYPE_BYTE:
+	case PW_TYPE_SHORT:
+	case PW_TYPE_INTEGER:
+	case PW_TYPE_INTEGER64:
+	case PW_TYPE_DATE:
+	case PW_TYPE_SIGNED:
+		break;
+
+	default:
+		return;
+	}
+
+	if (parent->flags.is_root) {
+		if ((da->attr == 0) || (da->attr > 255) || (da->attr == PW_MESSAGE_AUTHENTICATOR)) return;
+
+		da->encode.hdr[0] = da->attr;
+		da->encode.hdr[1] = 2;
+		da->encode.hdr_len = 2;
+		return;
+	}
+
+	if ((parent->type != PW_TYPE_VENDOR) || (parent->flags.type_size != 1) || (parent->flags.length != 1) ||
+	    (parent->attr == VENDORPEC_WIMAX) || (da->attr > 255)) return;
+
+	if (!parent->parent || (parent->parent->type != PW_TYPE_VSA) ||
+	    !parent->parent->parent || !parent->parent->parent->flags.is_root) return;
+
+	vendorpec = htonl(parent->attr);
+
+	da->encode.hdr[0] = PW_VENDOR_SPECIFIC;
+	da->encode.hdr[1] = 8;
+	memcpy(da->encode.hdr + 2, &vendorpec, sizeof(vendorpec));
+	da->encode.hdr[6] = da->attr;
+	da->encode.hdr[7] = 2;
+	da->encode.hdr_len = 8;
+}
+
 /** Add an attribute to the dictionary
  *
  * @todo we need to check length of none vendor attributes.
@@ -1337,6 +1401,8 @@ int fr_dict_attr_add(fr_dict_t *dict, fr_dict_attr_t const *parent,
 		if (fr_dict_attr_child_add(mutable, n) < 0) return -1;
 	}
 
+	dict_attr_encode_init(n, parent);
+
 	return 0;
 }
 
@@ -1808,7 +1874,7 @@ static int dict_read_process_named_attribute(fr_dict_t *dict, fr_dict_attr_t con
 		}
 	}
 
-	hash = fr_hash_string(normalized);
+	hash = fr_hash_fnv_string(normalized);
 	attr = hash;
 
 	/*
@@ -2630,18 +2696,6 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 		}
 	}
 
-	/*
-	 *	Walk over all of the hash tables to ensure they're
-	 *	initialized.  We do this because the threads may perform
-	 *	lookups, and we don't want multi-threaded re-ordering
-	 *	of the table entries.  That would be bad.
-	 */
-	fr_hash_table_walk(dict->vendors_by_name, hash_null_callback, NULL);
-	fr_hash_table_walk(dict->vendors_by_num, hash_null_callback, NULL);
-
-	fr_hash_table_walk(dict->values_by_da, hash_null_callback, NULL);
-	fr_hash_table_walk(dict->values_by_name, hash_null_callback, NULL);
-
 	if (out) *out = dict;
 
 	return 0;
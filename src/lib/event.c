@@ -46,8 +46,41 @@ struct fr_event_timer_t {
 
 	fr_event_timer_t	**parent;		//!< Previous timer.
 	int			heap;			//!< Where to store opaque heap data.
+
+	fr_event_timer_t	*next;			//!< Next timer in the same wheel slot.
+	fr_event_timer_t	**prev;			//!< Whatever points to us in the wheel slot.
+	int			slot;			//!< Which wheel slot we're in.
 };
 
+#define FR_EVENT_WHEEL_BITS	(6)
+#define FR_EVENT_WHEEL_SLOTS	(1 << FR_EVENT_WHEEL_BITS)
+#define FR_EVENT_WHEEL_MASK	(FR_EVENT_WHEEL_SLOTS - 1)
+#define FR_EVENT_WHEEL_LEVELS	(6)
+#define FR_EVENT_WHEEL_EXPIRED	(-1)
+
+/** A hierarchical timer wheel
+ *
+ * Level 0 has one slot per tick.  Each slot of level N covers all
+ * of level N - 1.  A timer goes in the lowest level which can hold
+ * it, and is moved down a level (cascaded) when the wheel reaches
+ * its slot, until it lands on the expired list.
+ *
+ * Slots are only visited when the bitmap for their level says they
+ * hold something, so idle periods cost nothing.
+ */
+typedef struct fr_event_wheel_t {
+	uint64_t		resolution;		//!< Microseconds per tick.
+	uint64_t		now;			//!< Current tick.  Every timer due at or before
+							//!< this tick is on the expired list.
+	int			num_timers;		//!< Number of timers in the wheel.
+
+	uint64_t		pending[FR_EVENT_WHEEL_LEVELS];	//!< Which slots hold timers.
+	fr_event_timer_t	*slots[FR_EVENT_WHEEL_LEVELS][FR_EVENT_WHEEL_SLOTS];
+
+	fr_event_timer_t	*expired;		//!< Timers which are due, in the order they became due.
+	fr_event_timer_t	**expired_tail;		//!< Where to add the next expired timer.
+} fr_event_wheel_t;
+
 /** A file descriptor event
  *
  */
@@ -75,6 +108,7 @@ typedef struct fr_event_fd_t {
  */
 struct fr_event_list_t {
 	fr_heap_t		*times;			//!< of timer events to be executed.
+	fr_event_wheel_t	*wheel;			//!< Used instead of the heap, if set.
 	rbtree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 
 	int			exit;
@@ -139,6 +173,279 @@ static int fr_event_fd_cmp(void const *a, void const *b)
 	return 0;
 }
 
+/** Return the index of the lowest bit set
+ *
+ */
+static inline int fr_event_wheel_ffs(uint64_t bits)
+{
+	int i = 0;
+
+	if ((bits & 0xffffffff) == 0) { bits >>= 32; i += 32; }
+	if ((bits & 0xffff) == 0) { bits >>= 16; i += 16; }
+	if ((bits & 0xff) == 0) { bits >>= 8; i += 8; }
+	if ((bits & 0x0f) == 0) { bits >>= 4; i += 4; }
+	if ((bits & 0x03) == 0) { bits >>= 2; i += 2; }
+	if ((bits & 0x01) == 0) i += 1;
+
+	return i;
+}
+
+/** Put a timer into the correct slot of the wheel, or onto the expired list
+ *
+ */
+static void fr_event_wheel_insert(fr_event_wheel_t *w, fr_event_timer_t *ev)
+{
+	uint64_t		expire, delta;
+	int			level, shift, slot;
+	fr_event_timer_t	**head;
+
+	/*
+	 *	Round up, so that timers never fire early.
+	 */
+	expire = ((((uint64_t) ev->when.tv_sec) * USEC) + ev->when.tv_usec + w->resolution - 1) / w->resolution;
+
+	if (expire <= w->now) {
+		ev->slot = FR_EVENT_WHEEL_EXPIRED;
+		ev->next = NULL;
+		ev->prev = w->expired_tail;
+		*w->expired_tail = ev;
+		w->expired_tail = &ev->next;
+		return;
+	}
+
+	delta = expire - w->now;
+	for (level = 0; level < (FR_EVENT_WHEEL_LEVELS - 1); level++) {
+		if (delta < (((uint64_t) 1) << ((level + 1) * FR_EVENT_WHEEL_BITS))) break;
+	}
+	shift = level * FR_EVENT_WHEEL_BITS;
+
+	/*
+	 *	Too far in the future for the wheel.  Park it in the
+	 *	top level slot which will be visited last.  When that
+	 *	happens, it's put back in, and goes further down.
+	 */
+	if (delta >= (((uint64_t) 1) << (FR_EVENT_WHEEL_LEVELS * FR_EVENT_WHEEL_BITS))) {
+		slot = (w->now >> shift) & FR_EVENT_WHEEL_MASK;
+	} else {
+		slot = (expire >> shift) & FR_EVENT_WHEEL_MASK;
+	}
+
+	head = &w->slots[level][slot];
+	ev->slot = (level * FR_EVENT_WHEEL_SLOTS) + slot;
+	ev->next = *head;
+	ev->prev = head;
+	if (*head) (*head)->prev = &ev->next;
+	*head = ev;
+
+	w->pending[level] |= ((uint64_t) 1) << slot;
+}
+
+/** Remove a timer from the wheel
+ *
+ */
+static void fr_event_wheel_extract(fr_event_wheel_t *w, fr_event_timer_t *ev)
+{
+	*ev->prev = ev->next;
+	if (ev->next) {
+		ev->next->prev = ev->prev;
+
+	} else if (ev->slot == FR_EVENT_WHEEL_EXPIRED) {
+		w->expired_tail = ev->prev;
+	}
+
+	if (ev->slot != FR_EVENT_WHEEL_EXPIRED) {
+		int level = ev->slot / FR_EVENT_WHEEL_SLOTS;
+		int slot = ev->slot & FR_EVENT_WHEEL_MASK;
+
+		if (!w->slots[level][slot]) w->pending[level] &= ~(((uint64_t) 1) << slot);
+	}
+
+	ev->next = NULL;
+	ev->prev = NULL;
+}
+
+/** Return the next tick at which the wheel has a slot to visit
+ *
+ * For level 0 this is when the timers in the slot are due.  For
+ * higher levels it's when the timers need to be cascaded, which is
+ * no later than when they are due.
+ *
+ * @return
+ *	- The tick.
+ *	- UINT64_MAX if the wheel is empty.
+ */
+static uint64_t fr_event_wheel_next(fr_event_wheel_t *w)
+{
+	int		level;
+	uint64_t	next = UINT64_MAX;
+
+	for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+		int		shift = level * FR_EVENT_WHEEL_BITS;
+		uint64_t	bits = w->pending[level];
+		uint64_t	tick;
+		int		pos;
+
+		if (!bits) continue;
+
+		/*
+		 *	Rotate the bitmap so that bit 0 is the slot
+		 *	after the current one.  The current slot is
+		 *	the last one to be visited.
+		 */
+		pos = ((w->now >> shift) + 1) & FR_EVENT_WHEEL_MASK;
+		if (pos) bits = (bits >> pos) | (bits << (FR_EVENT_WHEEL_SLOTS - pos));
+
+		tick = ((w->now >> shift) + fr_event_wheel_ffs(bits) + 1) << shift;
+		if (tick < next) next = tick;
+	}
+
+	return next;
+}
+
+/** Move the wheel forward, putting all timers due at or before a time onto the expired list
+ *
+ * The slots are moved in bulk, so many timers becoming due at once
+ * costs no more than one.
+ *
+ * @param[in] w		the timer wheel.
+ * @param[in] when	to move the wheel to.
+ * @return the first expired timer, or NULL for none.
+ */
+static fr_event_timer_t *fr_event_wheel_advance(fr_event_wheel_t *w, struct timeval const *when)
+{
+	uint64_t target;
+
+	target = ((((uint64_t) when->tv_sec) * USEC) + when->tv_usec) / w->resolution;
+
+	while (target > w->now) {
+		int		level;
+		uint64_t	next;
+
+		next = fr_event_wheel_next(w);
+		if (next > target) {
+			w->now = target;
+			break;
+		}
+		w->now = next;
+
+		/*
+		 *	Visit the slots we've reached, from the top
+		 *	down, so that cascaded timers are moved all the
+		 *	way to where they belong.  Each slot is taken
+		 *	off the wheel before its timers are put back
+		 *	in, so that a timer which goes back into the
+		 *	same slot waits for the next time around.
+		 */
+		for (level = FR_EVENT_WHEEL_LEVELS - 1; level >= 0; level--) {
+			int			shift = level * FR_EVENT_WHEEL_BITS;
+			int			slot;
+			fr_event_timer_t	*ev, *list;
+
+			if ((w->now & ((((uint64_t) 1) << shift) - 1)) != 0) continue;
+
+			slot = (w->now >> shift) & FR_EVENT_WHEEL_MASK;
+			list = w->slots[level][slot];
+			if (!list) continue;
+
+			w->slots[level][slot] = NULL;
+			w->pending[level] &= ~(((uint64_t) 1) << slot);
+
+			while ((ev = list) != NULL) {
+				list = ev->next;
+				fr_event_wheel_insert(w, ev);
+			}
+		}
+	}
+
+	return w->expired;
+}
+
+/** Return any timer from the wheel
+ *
+ */
+static fr_event_timer_t *fr_event_wheel_any(fr_event_wheel_t *w)
+{
+	int level;
+
+	if (w->expired) return w->expired;
+
+	for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+		if (!w->pending[level]) continue;
+
+		return w->slots[level][fr_event_wheel_ffs(w->pending[level])];
+	}
+
+	return NULL;
+}
+
+/** Add a timer to the event list
+ *
+ */
+static int fr_event_timer_add(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (el->wheel) {
+		fr_event_wheel_insert(el->wheel, ev);
+		el->wheel->num_timers++;
+		return 1;
+	}
+
+	return fr_heap_insert(el->times, ev);
+}
+
+/** Remove a timer from the event list
+ *
+ */
+static int fr_event_timer_extract(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (el->wheel) {
+		if (!ev->prev) return 0;
+
+		fr_event_wheel_extract(el->wheel, ev);
+		el->wheel->num_timers--;
+		return 1;
+	}
+
+	return fr_heap_extract(el->times, ev);
+}
+
+/** Return when the event list next needs to run timers
+ *
+ * @param[in] el	to check.
+ * @param[out] when	the time.  For a timer wheel this may be before the
+ *			first timer is due.
+ * @return
+ *	- 0 if there are no timers.
+ *	- 1 if when was set.
+ */
+static int fr_event_timer_first(fr_event_list_t *el, struct timeval *when)
+{
+	fr_event_timer_t *ev;
+
+	if (el->wheel) {
+		uint64_t next;
+
+		if (el->wheel->expired) {
+			when->tv_sec = 0;
+			when->tv_usec = 0;
+			return 1;
+		}
+
+		next = fr_event_wheel_next(el->wheel);
+		if (next == UINT64_MAX) return 0;
+
+		next *= el->wheel->resolution;
+		when->tv_sec = next / USEC;
+		when->tv_usec = next % USEC;
+		return 1;
+	}
+
+	ev = fr_heap_peek(el->times);
+	if (!ev) return 0;
+
+	*when = ev->when;
+	return 1;
+}
+
 /** Return the number of file descriptors is_registered with this event loop
  *
  */
@@ -158,6 +465,8 @@ int fr_event_list_num_elements(fr_event_list_t *el)
 {
 	if (!el) return -1;
 
+	if (el->wheel) return el->wheel->num_timers;
+
 	return fr_heap_num_elements(el->times);
 }
 
@@ -440,7 +749,7 @@ int fr_event_timer_delete(fr_event_list_t *el, fr_event_timer_t **parent)
 	}
 	*parent = NULL;
 
-	ret = fr_heap_extract(el->times, ev);
+	ret = fr_event_timer_extract(el, ev);
 
 	/*
 	 *	Events MUST be in the heap
@@ -510,7 +819,7 @@ int fr_event_timer_insert(fr_event_list_t *el, fr_event_callback_t callback, voi
 		ev = *parent;
 #endif
 
-		ret = fr_heap_extract(el->times, ev);
+		ret = fr_event_timer_extract(el, ev);
 		if (!fr_cond_assert(ret == 1)) return -1;	/* events MUST be in the heap */
 
 		memset(ev, 0, sizeof(*ev));
@@ -524,7 +833,7 @@ int fr_event_timer_insert(fr_event_list_t *el, fr_event_callback_t callback, voi
 	ev->when = *when;
 	ev->parent = parent;
 
-	if (!fr_heap_insert(el->times, ev)) {
+	if (!fr_event_timer_add(el, ev)) {
 		fr_strerror_printf("Failed inserting event into heap");
 		talloc_free(ev);
 		return -1;
@@ -590,12 +899,26 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 
 	if (!el) return 0;
 
-	if (fr_heap_num_elements(el->times) == 0) {
+	if (fr_event_list_num_elements(el) == 0) {
 		when->tv_sec = 0;
 		when->tv_usec = 0;
 		return 0;
 	}
 
+	/*
+	 *	Move everything which is due onto the expired list,
+	 *	and run them one by one.
+	 */
+	if (el->wheel) {
+		ev = fr_event_wheel_advance(el->wheel, when);
+		if (!ev) {
+			(void) fr_event_timer_first(el, when);
+			return 0;
+		}
+
+		goto run;
+	}
+
 	ev = fr_heap_peek(el->times);
 	if (!ev) {
 		when->tv_sec = 0;
@@ -613,6 +936,8 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 		return 0;
 	}
 
+run:
+
 	callback = ev->callback;
 	memcpy(&ctx, &ev->ctx, sizeof(ctx));
 
@@ -653,19 +978,16 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 	wake = &when;
 
 	if (wait) {
-		if (fr_heap_num_elements(el->times) > 0) {
-			fr_event_timer_t *ev;
-
-			ev = fr_heap_peek(el->times);
-			if (!fr_cond_assert(ev)) return -1;
+		struct timeval first;
 
+		if (fr_event_timer_first(el, &first)) {
 			gettimeofday(&el->now, NULL);
 
 			/*
 			 *	Next event is in the future, get the time
 			 *	between now and that event.
 			 */
-			if (fr_timeval_cmp(&ev->when, &el->now) > 0) fr_timeval_subtract(&when, &ev->when, &el->now);
+			if (fr_timeval_cmp(&first, &el->now) > 0) fr_timeval_subtract(&when, &first, &el->now);
 		} else {
 			wake = NULL;
 		}
@@ -765,7 +1087,7 @@ void fr_event_service(fr_event_list_t *el)
 		if (ev->do_delete) fr_event_fd_delete(el, ev->fd);
 	}
 
-	if (fr_heap_num_elements(el->times) > 0) {
+	if (fr_event_list_num_elements(el) > 0) {
 		struct timeval when;
 
 		do {
@@ -829,6 +1151,12 @@ static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t *ev;
 
+	if (el->wheel) {
+		while ((ev = fr_event_wheel_any(el->wheel)) != NULL) {
+			fr_event_timer_delete(el, &ev);
+		}
+	}
+
 	while ((ev = fr_heap_peek(el->times)) != NULL) {
 		fr_event_timer_delete(el, &ev);
 	}
@@ -878,6 +1206,55 @@ fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status,
 	return el;
 }
 
+/** Use a hierarchical timer wheel for the timer events of an event list
+ *
+ * Inserting and deleting a timer is O(1), instead of O(log n) for
+ * the default heap.  The price is precision.  Timers fire at the end
+ * of the tick they fall in, so may be up to one tick late, and timers
+ * due in the same tick fire in no particular order.
+ *
+ * This suits event lists holding many timers which are mostly
+ * deleted before they fire, such as the per-request timers.
+ *
+ * @param[in] el		to change.  It must not have any timers.
+ * @param[in] resolution	of the wheel, i.e. microseconds per tick.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_event_list_timer_wheel(fr_event_list_t *el, uint32_t resolution)
+{
+	fr_event_wheel_t	*w;
+	struct timeval		now;
+
+	if (!resolution) {
+		fr_strerror_printf("Invalid arguments: resolution must be greater than zero");
+		return -1;
+	}
+
+	if (fr_event_list_num_elements(el) != 0) {
+		fr_strerror_printf("Cannot change the timer backend while there are timers");
+		return -1;
+	}
+
+	w = talloc_zero(el, fr_event_wheel_t);
+	if (!w) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	gettimeofday(&now, NULL);
+
+	w->resolution = resolution;
+	w->now = ((((uint64_t) now.tv_sec) * USEC) + now.tv_usec) / resolution;
+	w->expired_tail = &w->expired;
+
+	talloc_free(el->wheel);
+	el->wheel = w;
+
+	return 0;
+}
+
 #ifdef TESTING
 
 /*
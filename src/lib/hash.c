@@ -18,15 +18,22 @@
  * @file lib/hash.c
  * @brief Resizable hash tables.
  *
- *  The weird "reverse" function is based on an idea from
- *  "Split-Ordered Lists - Lock-free Resizable Hash Tables", with
- *  modifications so that they're not lock-free. :(
+ *  The tables use open addressing with linear probing.  Each slot has
+ *  a one byte control word holding part of the hash, so a lookup
+ *  usually touches the control bytes, and then a single entry.
  *
- *  However, the split-order idea allows a fast & easy splitting of the
- *  hash bucket chain when the hash table is resized.  Without it, we'd
- *  have to check & update the pointers for every node in the buck chain,
- *  rather than being able to move 1/2 of the entries in the chain with
- *  one update.
+ *  Resizing is incremental.  When the table gets too full, a new slot
+ *  array is allocated, and each subsequent insert moves a few entries
+ *  from the old array to the new one.  Until that's done, lookups check
+ *  both arrays.
+ *
+ *  A walk may be looking at either array, so they're never resized while
+ *  one is in progress.  If the table gets too full during a walk, new
+ *  entries go into a separate overflow array instead, and the table is
+ *  resized once the walk has finished.
+ *
+ *  Lookups never modify the table, so multiple threads may search a
+ *  table concurrently, so long as nothing is inserting or deleting.
  *
  * @copyright 2005,2006  The FreeRADIUS server project
  */
@@ -34,239 +41,248 @@ RCSID("$Id$")
 
 #include <freeradius-devel/libradius.h>
 
+#include <fcntl.h>
+#include <sys/time.h>
+
 /*
- *	A reasonable number of buckets to start off with.
- *	Should be a power of two.
+ *	A reasonable number of slots to start off with.
+ *	Must be a power of two.
  */
 #define FR_HASH_NUM_BUCKETS (64)
 
+/*
+ *	Control bytes.  A full slot holds the top 7 bits of the
+ *	entry's hash, so most mismatches are rejected without
+ *	touching the entry, or calling the comparison function.
+ */
+#define SLOT_EMPTY	(0x80)
+#define SLOT_DELETED	(0xfe)
+#define SLOT_FULL(_c)	(((_c) & 0x80) == 0)
+#define SLOT_TAG(_key)	((uint8_t) ((_key) >> 25))
+
+/*
+ *	Number of slots of the old table which are moved to the new
+ *	table on every insert, while the table is being resized.
+ */
+#define MIGRATE_STEP	(8)
+
 typedef struct fr_hash_entry_t {
-	struct fr_hash_entry_t *next;
-	uint32_t	reversed;
 	uint32_t	key;
 	void const 	*data;
 } fr_hash_entry_t;
 
+typedef struct fr_hash_slots_t {
+	uint8_t		*ctrl;		//!< One control byte per slot.
+	fr_hash_entry_t	*entry;		//!< The slots themselves.
+	uint32_t	num_slots;	//!< Power of 2.
+	uint32_t	mask;
+	uint32_t	used;		//!< Full slots.
+	uint32_t	deleted;	//!< Deleted slots, which still lengthen probes.
+} fr_hash_slots_t;
 
 struct fr_hash_table_t {
 	int			num_elements;
-	int			num_buckets; /* power of 2 */
-	int			next_grow;
-	int			mask;
 
 	fr_hash_table_free_t	free;
 	fr_hash_table_hash_t	hash;
 	fr_hash_table_cmp_t	cmp;
 
-	fr_hash_entry_t	null;
+	fr_hash_slots_t		cur;		//!< Where new entries go.
+	fr_hash_slots_t		old;		//!< Being drained into "cur", if ctrl != NULL.
+	uint32_t		migrate;	//!< Next slot of "old" to move.
+	fr_hash_slots_t		overflow;	//!< Entries inserted while a walk stopped us
+						//!< resizing, if ctrl != NULL.  Never walked.
 
-	fr_hash_entry_t	**buckets;
+	int			walking;	//!< Don't move entries while a walk is in progress.
 };
 
-#ifdef TESTING
-static int grow = 0;
-#endif
-
-/*
- * perl -e 'foreach $i (0..255) {$r = 0; foreach $j (0 .. 7 ) { if (($i & ( 1<< $j)) != 0) { $r |= (1 << (7 - $j));}} print $r, ", ";if (($i & 7) == 7) {print "\n";}}'
- */
-static const uint8_t reversed_byte[256] = {
-	0,  128, 64, 192, 32, 160, 96,  224,
-	16, 144, 80, 208, 48, 176, 112, 240,
-	8,  136, 72, 200, 40, 168, 104, 232,
-	24, 152, 88, 216, 56, 184, 120, 248,
-	4,  132, 68, 196, 36, 164, 100, 228,
-	20, 148, 84, 212, 52, 180, 116, 244,
-	12, 140, 76, 204, 44, 172, 108, 236,
-	28, 156, 92, 220, 60, 188, 124, 252,
-	2,  130, 66, 194, 34, 162, 98,  226,
-	18, 146, 82, 210, 50, 178, 114, 242,
-	10, 138, 74, 202, 42, 170, 106, 234,
-	26, 154, 90, 218, 58, 186, 122, 250,
-	6,  134, 70, 198, 38, 166, 102, 230,
-	22, 150, 86, 214, 54, 182, 118, 246,
-	14, 142, 78, 206, 46, 174, 110, 238,
-	30, 158, 94, 222, 62, 190, 126, 254,
-	1,  129, 65, 193, 33, 161, 97,  225,
-	17, 145, 81, 209, 49, 177, 113, 241,
-	9,  137, 73, 201, 41, 169, 105, 233,
-	25, 153, 89, 217, 57, 185, 121, 249,
-	5,  133, 69, 197, 37, 165, 101, 229,
-	21, 149, 85, 213, 53, 181, 117, 245,
-	13, 141, 77, 205, 45, 173, 109, 237,
-	29, 157, 93, 221, 61, 189, 125, 253,
-	3,  131, 67, 195, 35, 163, 99,  227,
-	19, 147, 83, 211, 51, 179, 115, 243,
-	11, 139, 75, 203, 43, 171, 107, 235,
-	27, 155, 91, 219, 59, 187, 123, 251,
-	7,  135, 71, 199, 39, 167, 103, 231,
-	23, 151, 87, 215, 55, 183, 119, 247,
-	15, 143, 79, 207, 47, 175, 111, 239,
-	31, 159, 95, 223, 63, 191, 127, 255
-};
+static int slots_alloc(fr_hash_table_t *ht, fr_hash_slots_t *s, uint32_t num_slots)
+{
+	s->ctrl = talloc_array(ht, uint8_t, num_slots);
+	s->entry = talloc_array(ht, fr_hash_entry_t, num_slots);
+	if (!s->ctrl || !s->entry) {
+		TALLOC_FREE(s->ctrl);
+		TALLOC_FREE(s->entry);
+		return -1;
+	}
 
+	memset(s->ctrl, SLOT_EMPTY, num_slots);
+	s->num_slots = num_slots;
+	s->mask = num_slots - 1;
+	s->used = 0;
+	s->deleted = 0;
 
-/*
- * perl -e 'foreach $i (0..255) {$r = 0;foreach $j (0 .. 7) { $r = $i & (1 << (7 - $j)); last if ($r)} print $i & ~($r), ", ";if (($i & 7) == 7) {print "\n";}}'
- */
-static uint8_t parent_byte[256] = {
-	0, 0, 0, 1, 0, 1, 2, 3,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	32, 33, 34, 35, 36, 37, 38, 39,
-	40, 41, 42, 43, 44, 45, 46, 47,
-	48, 49, 50, 51, 52, 53, 54, 55,
-	56, 57, 58, 59, 60, 61, 62, 63,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	32, 33, 34, 35, 36, 37, 38, 39,
-	40, 41, 42, 43, 44, 45, 46, 47,
-	48, 49, 50, 51, 52, 53, 54, 55,
-	56, 57, 58, 59, 60, 61, 62, 63,
-	64, 65, 66, 67, 68, 69, 70, 71,
-	72, 73, 74, 75, 76, 77, 78, 79,
-	80, 81, 82, 83, 84, 85, 86, 87,
-	88, 89, 90, 91, 92, 93, 94, 95,
-	96, 97, 98, 99, 100, 101, 102, 103,
-	104, 105, 106, 107, 108, 109, 110, 111,
-	112, 113, 114, 115, 116, 117, 118, 119,
-	120, 121, 122, 123, 124, 125, 126, 127
-};
-
+	return 0;
+}
 
-/*
- *	Reverse a key.
- */
-static uint32_t reverse(uint32_t key)
+static void slots_free(fr_hash_slots_t *s)
 {
-	return ((reversed_byte[key & 0xff] << 24) |
-		(reversed_byte[(key >> 8) & 0xff] << 16) |
-		(reversed_byte[(key >> 16) & 0xff] << 8) |
-		(reversed_byte[(key >> 24) & 0xff]));
+	talloc_free(s->ctrl);
+	talloc_free(s->entry);
+	memset(s, 0, sizeof(*s));
 }
 
 /*
- *	Take the parent by discarding the highest bit that is set.
+ *	Find the slot holding an entry.  We probe linearly from the
+ *	home slot until we hit an empty one.
  */
-static uint32_t parent_of(uint32_t key)
+static int32_t slots_find(fr_hash_table_t *ht, fr_hash_slots_t *s, uint32_t key, void const *data)
 {
-	if (key > 0x00ffffff)
-		return (key & 0x00ffffff) | (parent_byte[key >> 24] << 24);
+	uint32_t	i;
+	uint8_t		tag = SLOT_TAG(key);
 
-	if (key > 0x0000ffff)
-		return (key & 0x0000ffff) | (parent_byte[key >> 16] << 16);
+	if (!s->ctrl) return -1;
 
-	if (key > 0x000000ff)
-		return (key & 0x000000ff) | (parent_byte[key >> 8] << 8);
+	for (i = key & s->mask; s->ctrl[i] != SLOT_EMPTY; i = (i + 1) & s->mask) {
+		if (s->ctrl[i] != tag) continue;
+		if (s->entry[i].key != key) continue;
+		if (ht->cmp && (ht->cmp(data, s->entry[i].data) != 0)) continue;
 
-	return parent_byte[key];
-}
+		return i;
+	}
 
+	return -1;
+}
 
-static fr_hash_entry_t *list_find(fr_hash_table_t *ht,
-				    fr_hash_entry_t *head,
-				    uint32_t reversed,
-				    void const *data)
+/*
+ *	Put an entry into the first free slot.  The caller has
+ *	already checked it's not a duplicate.
+ */
+static void slots_insert(fr_hash_slots_t *s, uint32_t key, void const *data)
 {
-	fr_hash_entry_t *cur;
+	uint32_t i;
 
-	for (cur = head; cur != &ht->null; cur = cur->next) {
-		if (cur->reversed == reversed) {
-			if (ht->cmp) {
-				int cmp = ht->cmp(data, cur->data);
-				if (cmp > 0) break;
-				if (cmp < 0) continue;
-			}
-			return cur;
-		}
-		if (cur->reversed > reversed) break;
-	}
+	for (i = key & s->mask; SLOT_FULL(s->ctrl[i]); i = (i + 1) & s->mask);
 
-	return NULL;
+	if (s->ctrl[i] == SLOT_DELETED) s->deleted--;
+	s->ctrl[i] = SLOT_TAG(key);
+	s->entry[i].key = key;
+	s->entry[i].data = data;
+	s->used++;
 }
 
-
 /*
- *	Inserts a new entry into the list, in order.
+ *	Insert an entry into the overflow array, which isn't walked, so
+ *	it can be rebuilt at twice the size whenever it gets too full.
  */
-static int list_insert(fr_hash_table_t *ht,
-		       fr_hash_entry_t **head, fr_hash_entry_t *node)
+static int slots_overflow_insert(fr_hash_table_t *ht, uint32_t key, void const *data)
 {
-	fr_hash_entry_t **last, *cur;
+	fr_hash_slots_t	*s = &ht->overflow, bigger;
+	uint32_t	i;
 
-	last = head;
+	if (!s->ctrl) {
+		if (slots_alloc(ht, s, FR_HASH_NUM_BUCKETS) < 0) return -1;
 
-	for (cur = *head; cur != &ht->null; cur = cur->next) {
-		if (cur->reversed > node->reversed) break;
-		last = &(cur->next);
+	} else if ((s->used + s->deleted + 1) > (s->num_slots - (s->num_slots >> 3))) {
+		if (slots_alloc(ht, &bigger, s->num_slots << 1) < 0) return -1;
 
-		if (cur->reversed == node->reversed) {
-			if (ht->cmp) {
-				int cmp = ht->cmp(node->data, cur->data);
-				if (cmp > 0) break;
-				if (cmp < 0) continue;
-			}
-			return 0;
+		for (i = 0; i < s->num_slots; i++) {
+			if (SLOT_FULL(s->ctrl[i])) slots_insert(&bigger, s->entry[i].key, s->entry[i].data);
 		}
+		slots_free(s);
+		*s = bigger;
 	}
 
-	node->next = *last;
-	*last = node;
+	slots_insert(s, key, data);
 
-	return 1;
+	return 0;
 }
 
+/*
+ *	Remove an entry.  If the next slot is empty, no probe
+ *	sequence runs through this one, so it can be emptied, too.
+ */
+static void slots_delete(fr_hash_slots_t *s, uint32_t i)
+{
+	s->used--;
+
+	if (s->ctrl[(i + 1) & s->mask] == SLOT_EMPTY) {
+		s->ctrl[i] = SLOT_EMPTY;
+		return;
+	}
+
+	s->ctrl[i] = SLOT_DELETED;
+	s->deleted++;
+}
 
 /*
- *	Delete an entry from the list.
+ *	Move some entries from the old table to the new one.
+ *
+ *	Moved entries are deleted from the old table, so no entry is
+ *	ever in both.
  */
-static int list_delete(fr_hash_table_t *ht,
-		       fr_hash_entry_t **head, fr_hash_entry_t *node)
+static void fr_hash_table_migrate(fr_hash_table_t *ht, uint32_t count)
 {
-	fr_hash_entry_t **last, *cur;
+	fr_hash_slots_t *old = &ht->old;
 
-	last = head;
+	while (count-- && (ht->migrate < old->num_slots)) {
+		uint32_t i = ht->migrate++;
 
-	for (cur = *head; cur != &ht->null; cur = cur->next) {
-		if (cur == node) break;
-		last = &(cur->next);
+		if (!SLOT_FULL(old->ctrl[i])) continue;
+
+		slots_insert(&ht->cur, old->entry[i].key, old->entry[i].data);
+		old->ctrl[i] = SLOT_DELETED;
+		old->used--;
 	}
 
-	*last = node->next;
-	return 1;
+	if (ht->migrate == old->num_slots) slots_free(old);
 }
 
-
-static int _fr_hash_table_free(fr_hash_table_t *ht)
+/*
+ *	Start a resize.  New entries go into a fresh table, and the
+ *	old entries are moved across a few at a time by subsequent
+ *	inserts, so no single insert pays for a full rehash.
+ */
+static int fr_hash_table_grow(fr_hash_table_t *ht)
 {
-	int i;
-	fr_hash_entry_t *node, *next;
+	uint32_t	num_slots = ht->cur.num_slots;
+	fr_hash_slots_t	cur;
+
+	/*
+	 *	Finish any previous resize.  This only happens if
+	 *	the table filled faster than we drained it.
+	 */
+	if (ht->old.ctrl) fr_hash_table_migrate(ht, ht->old.num_slots);
 
 	/*
-	 *	Walk over the buckets, freeing them all.
+	 *	Aim for a load factor of 1/2.  If most of the slots
+	 *	were deleted ones, we just rebuild at the same size.
 	 */
-	for (i = 0; i < ht->num_buckets; i++) {
-		if (ht->buckets[i]) for (node = ht->buckets[i];
-					 node != &ht->null;
-					 node = next) {
-			next = node->next;
-			if (!node->data) continue; /* dummy entry */
-
-			talloc_free(node);
+	while (num_slots < ((uint32_t) ht->num_elements + 1) * 2) num_slots <<= 1;
+
+	if (slots_alloc(ht, &cur, num_slots) < 0) return -1;
+
+	ht->old = ht->cur;
+	ht->cur = cur;
+	ht->migrate = 0;
+
+	/*
+	 *	The new table has room for everything, so entries
+	 *	which overflowed during a walk go straight into it.
+	 */
+	if (ht->overflow.ctrl) {
+		uint32_t i;
+
+		for (i = 0; i < ht->overflow.num_slots; i++) {
+			if (SLOT_FULL(ht->overflow.ctrl[i])) {
+				slots_insert(&ht->cur, ht->overflow.entry[i].key, ht->overflow.entry[i].data);
+			}
 		}
+		slots_free(&ht->overflow);
 	}
-	talloc_free(ht->buckets);
+
+#ifdef TESTING
+	fprintf(stderr, "GROW TO %u\n", num_slots);
+#endif
+
+	return 0;
+}
+
+static int _fr_hash_table_free(fr_hash_table_t *ht)
+{
+	slots_free(&ht->cur);
+	slots_free(&ht->old);
+	slots_free(&ht->overflow);
 
 	return 0;
 }
@@ -274,7 +290,8 @@ static int _fr_hash_table_free(fr_hash_table_t *ht)
 /*
  *	Create the table.
  *
- *	Memory usage in bytes is (20/3) * number of entries.
+ *	Memory usage in bytes is between 34 and 68 times the number
+ *	of entries, on 64-bit systems.
  */
 fr_hash_table_t *fr_hash_table_create(TALLOC_CTX *ctx,
 				      fr_hash_table_hash_t hashNode,
@@ -293,191 +310,102 @@ fr_hash_table_t *fr_hash_table_create(TALLOC_CTX *ctx,
 	ht->free = freeNode;
 	ht->hash = hashNode;
 	ht->cmp = cmpNode;
-	ht->num_buckets = FR_HASH_NUM_BUCKETS;
-	ht->mask = ht->num_buckets - 1;
 
-	/*
-	 *	Have a default load factor of 2.5.  In practice this
-	 *	means that the average load will hit 3 before the
-	 *	table grows.
-	 */
-	ht->next_grow = (ht->num_buckets << 1) + (ht->num_buckets >> 1);
-
-	ht->buckets = talloc_zero_array(NULL, fr_hash_entry_t *, ht->num_buckets);
-	if (!ht->buckets) {
+	if (slots_alloc(ht, &ht->cur, FR_HASH_NUM_BUCKETS) < 0) {
 		talloc_free(ht);
 		return NULL;
 	}
 
-	ht->null.reversed = ~0;
-	ht->null.key = ~0;
-	ht->null.next = &ht->null;
-	ht->buckets[0] = &ht->null;
-
 	return ht;
 }
 
-
 /*
- *	If the current bucket is uninitialized, initialize it
- *	by recursively copying information from the parent.
- *
- *	We may have a situation where entry E is a parent to 2 other
- *	entries E' and E".  If we split E into E and E', then the
- *	nodes meant for E" end up in E or E', either of which is
- *	wrong.  To solve that problem, we walk down the whole chain,
- *	inserting the elements into the correct place.
+ *	Find an entry in either table.
  */
-static void fr_hash_table_fixup(fr_hash_table_t *ht, uint32_t entry)
+static fr_hash_entry_t *fr_hash_table_find(fr_hash_table_t *ht, uint32_t key, void const *data,
+					   fr_hash_slots_t **s, int32_t *slot)
 {
-	uint32_t parent_entry;
-	fr_hash_entry_t **last, *cur;
-	uint32_t this;
-
-	parent_entry = parent_of(entry);
+	int32_t i;
 
-	/* parent_entry == entry if and only if entry == 0 */
-
-	if (!ht->buckets[parent_entry]) {
-		fr_hash_table_fixup(ht, parent_entry);
+	i = slots_find(ht, &ht->cur, key, data);
+	if (i >= 0) {
+		*s = &ht->cur;
+		*slot = i;
+		return &ht->cur.entry[i];
 	}
 
-	/*
-	 *	Keep walking down cur, trying to find entries that
-	 *	don't belong here any more.  There may be multiple
-	 *	ones, so we can't have a naive algorithm...
-	 */
-	last = &ht->buckets[parent_entry];
-	this = parent_entry;
-
-	for (cur = *last; cur != &ht->null; cur = cur->next) {
-		uint32_t real_entry;
-
-		real_entry = cur->key & ht->mask;
-		if (real_entry != this) { /* ht->buckets[real_entry] == NULL */
-			*last = &ht->null;
-			ht->buckets[real_entry] = cur;
-			this = real_entry;
-		}
-
-		last = &(cur->next);
+	i = slots_find(ht, &ht->old, key, data);
+	if (i >= 0) {
+		*s = &ht->old;
+		*slot = i;
+		return &ht->old.entry[i];
 	}
 
-	/*
-	 *	We may NOT have initialized this bucket, so do it now.
-	 */
-	if (!ht->buckets[entry]) ht->buckets[entry] = &ht->null;
-}
-
-/*
- *	This should be a power of two.  Changing it to 4 doesn't seem
- *	to make any difference.
- */
-#define GROW_FACTOR (2)
-
-/*
- *	Grow the hash table.
- */
-static void fr_hash_table_grow(fr_hash_table_t *ht)
-{
-	fr_hash_entry_t **buckets;
-
-	buckets = talloc_zero_array(NULL, fr_hash_entry_t *, GROW_FACTOR * ht->num_buckets);
-	if (!buckets) return;
-
-	memcpy(buckets, ht->buckets, sizeof(*buckets) * ht->num_buckets);
-	talloc_free(ht->buckets); /* Free the old buckets */
+	i = slots_find(ht, &ht->overflow, key, data);
+	if (i >= 0) {
+		*s = &ht->overflow;
+		*slot = i;
+		return &ht->overflow.entry[i];
+	}
 
-	ht->buckets = buckets;
-	ht->num_buckets *= GROW_FACTOR;
-	ht->next_grow *= GROW_FACTOR;
-	ht->mask = ht->num_buckets - 1;
-#ifdef TESTING
-	grow = 1;
-	fprintf(stderr, "GROW TO %d\n", ht->num_buckets);
-#endif
+	return NULL;
 }
 
-
 /*
  *	Insert data.
  */
 int fr_hash_table_insert(fr_hash_table_t *ht, void const *data)
 {
-	uint32_t key;
-	uint32_t entry;
-	uint32_t reversed;
-	fr_hash_entry_t *node;
+	uint32_t	key;
+	fr_hash_slots_t	*s;
+	int32_t		slot;
 
 	if (!ht || !data) return 0;
 
 	key = ht->hash(data);
-	entry = key & ht->mask;
-	reversed = reverse(key);
 
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
+	/* already in the table, can't insert it */
+	if (fr_hash_table_find(ht, key, data, &s, &slot)) return 0;
 
 	/*
-	 *	If we try to do our own memory allocation here, the
-	 *	speedup is only ~15% or so, which isn't worth it.
+	 *	Keep the load factor (including deleted slots) under
+	 *	7/8.  A walk may be looking at the slot arrays, so we
+	 *	can't resize under it.  Instead, the entry goes into
+	 *	the overflow array, and the walk resizes the table
+	 *	when it finishes.
 	 */
-	node = talloc_zero(NULL, fr_hash_entry_t);
-	if (!node) return 0;
+	if ((ht->cur.used + ht->cur.deleted + 1) > (ht->cur.num_slots - (ht->cur.num_slots >> 3))) {
+		if (ht->walking) {
+			if (slots_overflow_insert(ht, key, data) < 0) return 0;
+			ht->num_elements++;
 
-	node->next = &ht->null;
-	node->reversed = reversed;
-	node->key = key;
-	node->data = data;
+			return 1;
+		}
 
-	/* already in the table, can't insert it */
-	if (!list_insert(ht, &ht->buckets[entry], node)) {
-		talloc_free(node);
-		return 0;
+		if (fr_hash_table_grow(ht) < 0) return 0;
 	}
 
-	/*
-	 *	Check the load factor, and grow the table if
-	 *	necessary.
-	 */
+	slots_insert(&ht->cur, key, data);
 	ht->num_elements++;
-	if (ht->num_elements >= ht->next_grow) fr_hash_table_grow(ht);
 
-	return 1;
-}
+	if (ht->old.ctrl && !ht->walking) fr_hash_table_migrate(ht, MIGRATE_STEP);
 
-
-/*
- *	Internal find a node routine.
- */
-static fr_hash_entry_t *fr_hash_table_find(fr_hash_table_t *ht, void const *data)
-{
-	uint32_t key;
-	uint32_t entry;
-	uint32_t reversed;
-
-	if (!ht) return NULL;
-
-	key = ht->hash(data);
-	entry = key & ht->mask;
-	reversed = reverse(key);
-
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
-
-	return list_find(ht, ht->buckets[entry], reversed, data);
+	return 1;
 }
 
-
 /*
  *	Replace old data with new data, OR insert if there is no old.
  */
 int fr_hash_table_replace(fr_hash_table_t *ht, void const *data)
 {
-	fr_hash_entry_t *node;
-	void *tofree;
+	fr_hash_entry_t	*node;
+	fr_hash_slots_t	*s;
+	int32_t		slot;
+	void		*tofree;
 
 	if (!ht || !data) return 0;
 
-	node = fr_hash_table_find(ht, data);
+	node = fr_hash_table_find(ht, ht->hash(data), data, &s, &slot);
 	if (!node) return fr_hash_table_insert(ht, data);
 
 	if (ht->free) {
@@ -489,16 +417,19 @@ int fr_hash_table_replace(fr_hash_table_t *ht, void const *data)
 	return 1;
 }
 
-
 /*
  *	Find data from a template
  */
 void *fr_hash_table_finddata(fr_hash_table_t *ht, void const *data)
 {
-	fr_hash_entry_t *node;
-	void *out;
+	fr_hash_entry_t	*node;
+	fr_hash_slots_t	*s;
+	int32_t		slot;
+	void		*out;
+
+	if (!ht) return NULL;
 
-	node = fr_hash_table_find(ht, data);
+	node = fr_hash_table_find(ht, ht->hash(data), data, &s, &slot);
 	if (!node) return NULL;
 
 	memcpy(&out, &node->data, sizeof(out));
@@ -506,35 +437,25 @@ void *fr_hash_table_finddata(fr_hash_table_t *ht, void const *data)
 	return out;
 }
 
-
-
 /*
  *	Yank an entry from the hash table, without freeing the data.
  */
 void *fr_hash_table_yank(fr_hash_table_t *ht, void const *data)
 {
-	uint32_t key;
-	uint32_t entry;
-	uint32_t reversed;
-	void *old;
-	fr_hash_entry_t *node;
+	fr_hash_entry_t	*node;
+	fr_hash_slots_t	*s;
+	int32_t		slot;
+	void		*old;
 
 	if (!ht) return NULL;
 
-	key = ht->hash(data);
-	entry = key & ht->mask;
-	reversed = reverse(key);
-
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
-
-	node = list_find(ht, ht->buckets[entry], reversed, data);
+	node = fr_hash_table_find(ht, ht->hash(data), data, &s, &slot);
 	if (!node) return NULL;
 
-	list_delete(ht, &ht->buckets[entry], node);
-	ht->num_elements--;
-
 	memcpy(&old, &node->data, sizeof(old));
-	talloc_free(node);
+
+	slots_delete(s, slot);
+	ht->num_elements--;
 
 	return old;
 }
@@ -555,38 +476,35 @@ int fr_hash_table_delete(fr_hash_table_t *ht, void const *data)
 	return 1;
 }
 
+static void slots_free_data(fr_hash_table_t *ht, fr_hash_slots_t *s)
+{
+	uint32_t i;
+
+	for (i = 0; i < s->num_slots; i++) {
+		void *tofree;
+
+		if (!SLOT_FULL(s->ctrl[i])) continue;
+
+		memcpy(&tofree, &s->entry[i].data, sizeof(tofree));
+		ht->free(tofree);
+	}
+}
 
 /*
  *	Free a hash table
  */
 void fr_hash_table_free(fr_hash_table_t *ht)
 {
-	int i;
-	fr_hash_entry_t *node, *next;
-
 	if (!ht) return;
 
-	/*
-	 *	Walk over the buckets, freeing them all.
-	 */
 	if (ht->free) {
-		for (i = 0; i < ht->num_buckets; i++) {
-			if (ht->buckets[i]) for (node = ht->buckets[i];
-						 node != &ht->null;
-						 node = next) {
-				void *tofree;
-
-				next = node->next;
-				if (!node->data) continue; /* dummy entry */
-
-				memcpy(&tofree, &node->data, sizeof(tofree));
-				ht->free(tofree);
-			}
-		}
+		slots_free_data(ht, &ht->old);
+		slots_free_data(ht, &ht->cur);
+		slots_free_data(ht, &ht->overflow);
 	}
 
 	/*
-	 *	Also frees nodes and buckets
+	 *	Also frees the slots
 	 */
 	talloc_free(ht);
 }
@@ -602,129 +520,277 @@ int fr_hash_table_num_elements(fr_hash_table_t *ht)
 	return ht->num_elements;
 }
 
+static int slots_walk(fr_hash_slots_t *s, fr_hash_table_walk_t callback, void *context)
+{
+	int32_t i;
+
+	for (i = s->num_slots - 1; i >= 0; i--) {
+		void *arg;
+		int rcode;
+
+		if (!SLOT_FULL(s->ctrl[i])) continue;
+
+		memcpy(&arg, &s->entry[i].data, sizeof(arg));
+		rcode = callback(context, arg);
+		if (rcode != 0) return rcode;
+	}
+
+	return 0;
+}
 
 /*
  *	Walk over the nodes, allowing deletes & inserts to happen.
+ *
+ *	Entries inserted by the callback may, or may not be visited.
+ *	If they filled the table, it's resized once the outermost
+ *	walk has finished.
  */
 int fr_hash_table_walk(fr_hash_table_t *ht,
 		       fr_hash_table_walk_t callback,
 		       void *context)
 {
-	int i, rcode;
+	int rcode = 0;
 
 	if (!ht || !callback) return 0;
 
-	for (i = ht->num_buckets - 1; i >= 0; i--) {
-		fr_hash_entry_t *node, *next;
+	ht->walking++;
+	if (ht->old.ctrl) rcode = slots_walk(&ht->old, callback, context);
+	if (rcode == 0) rcode = slots_walk(&ht->cur, callback, context);
+	ht->walking--;
 
-		/*
-		 *	Ensure that the current bucket is filled.
-		 */
-		if (!ht->buckets[i]) fr_hash_table_fixup(ht, i);
+	if (!ht->walking && ht->overflow.ctrl) (void) fr_hash_table_grow(ht);
 
-		for (node = ht->buckets[i]; node != &ht->null; node = next) {
-			void *arg;
+	return rcode;
+}
 
-			next = node->next;
 
-			memcpy(&arg, &node->data, sizeof(arg));
-			rcode = callback(context, arg);
+#ifdef TESTING
+/*
+ *	Show what the hash table is doing.
+ */
+int fr_hash_table_info(fr_hash_table_t *ht)
+{
+	uint32_t	i, probe, total = 0, longest = 0;
+	fr_hash_slots_t	*s;
 
-			if (rcode != 0) return rcode;
-		}
+	if (!ht) return 0;
+
+	s = &ht->cur;
+
+	for (i = 0; i < s->num_slots; i++) {
+		if (!SLOT_FULL(s->ctrl[i])) continue;
+
+		probe = (i - (s->entry[i].key & s->mask)) & s->mask;
+		total += probe;
+		if (probe > longest) longest = probe;
 	}
 
+	printf("HASH TABLE %p\tslots: %u\t(%u deleted)\n", ht,
+	       s->num_slots, s->deleted);
+	printf("\tnum entries %d\t(%u still in old table)\n",
+	       ht->num_elements, ht->old.used);
+	printf("\tlongest probe %u\taverage probe %f\n\n",
+	       longest, s->used ? (float) total / (float) s->used : 0);
+
 	return 0;
 }
+#endif
 
 
-#ifdef TESTING
 /*
- *	Show what the hash table is doing.
+ *	The hash functions below are used for hash tables, where the
+ *	values only need to be consistent within one process.  They
+ *	work on a word at a time, and are keyed with a random seed
+ *	chosen at startup, so that an attacker who controls the data
+ *	being hashed (e.g. User-Name) can't pick values which all land
+ *	in the same bucket.
+ *
+ *	The mixing function is the "wyhash" design by Wang Yi, which
+ *	is public domain.  Where the compiler has a 128-bit integer
+ *	type we use it for the 64x64 multiply, otherwise we build the
+ *	product from 32-bit halves.  Both give the same result.
  */
-int fr_hash_table_info(fr_hash_table_t *ht)
+static uint64_t hash_seed;
+
+static const uint64_t hash_secret[4] = {
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+	0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+/** Pick the per-process hash seed
+ *
+ * Runs before main(), so every thread sees the same seed, and no
+ * hash table can be populated before it's set.
+ */
+static void CC_HINT(constructor) hash_seed_init(void)
 {
-	int i, a, collisions, uninitialized;
-	int array[256];
+	int		fd;
+	uint64_t	seed = 0;
 
-	if (!ht) return 0;
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0) {
+		if (read(fd, &seed, sizeof(seed)) != sizeof(seed)) seed = 0;
+		close(fd);
+	}
 
-	uninitialized = collisions = 0;
-	memset(array, 0, sizeof(array));
+	if (!seed) {
+		struct timeval now;
 
-	for (i = 0; i < ht->num_buckets; i++) {
-		uint32_t key;
-		int load;
-		fr_hash_entry_t *node, *next;
+		gettimeofday(&now, NULL);
+		seed = ((uint64_t) now.tv_sec << 32) ^ now.tv_usec ^ ((uint64_t) getpid() << 16);
+	}
 
-		/*
-		 *	If we haven't inserted or looked up an entry
-		 *	in a bucket, it's uninitialized.
-		 */
-		if (!ht->buckets[i]) {
-			uninitialized++;
-			continue;
-		}
+	hash_seed = seed;
+}
 
-		load = 0;
-		key = ~0;
-		for (node = ht->buckets[i]; node != &ht->null; node = next) {
-			if (node->reversed == key) {
-				collisions++;
-			} else {
-				key = node->reversed;
-			}
-			next = node->next;
-			load++;
-		}
+static inline void hash_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *a;
+
+	r *= *b;
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b, hi, lo;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), c = t < rl;
+
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+}
 
-		if (load > 255) load = 255;
-		array[load]++;
-	}
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+	hash_mum(&a, &b);
+	return a ^ b;
+}
 
-	printf("HASH TABLE %p\tbuckets: %d\t(%d uninitialized)\n", ht,
-		ht->num_buckets, uninitialized);
-	printf("\tnum entries %d\thash collisions %d\n",
-		ht->num_elements, collisions);
+static inline uint64_t hash_r8(uint8_t const *p)
+{
+	uint64_t v;
 
-	a = 0;
-	for (i = 1; i < 256; i++) {
-		if (!array[i]) continue;
-		printf("%d\t%d\n", i, array[i]);
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
 
-		/*
-		 *	Since the entries are ordered, the lookup cost
-		 *	for any one element in a chain is (on average)
-		 *	the cost of walking half of the chain.
-		 */
-		if (i > 1) {
-			a += array[i] * i;
+static inline uint64_t hash_r4(uint8_t const *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t hash_r3(uint8_t const *p, size_t k)
+{
+	return (((uint64_t) p[0]) << 16) | (((uint64_t) p[k >> 1]) << 8) | p[k - 1];
+}
+
+static uint32_t hash_words(void const *data, size_t size, uint64_t seed)
+{
+	uint8_t const	*p = data;
+	uint64_t	a, b, h;
+	size_t		i = size;
+
+	seed ^= hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+
+	if (size <= 16) {
+		if (size >= 4) {
+			a = (hash_r4(p) << 32) | hash_r4(p + ((size >> 3) << 2));
+			b = (hash_r4(p + size - 4) << 32) | hash_r4(p + size - 4 - ((size >> 3) << 2));
+		} else if (size > 0) {
+			a = hash_r3(p, size);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+
+			do {
+				seed = hash_mix(hash_r8(p) ^ hash_secret[1], hash_r8(p + 8) ^ seed);
+				see1 = hash_mix(hash_r8(p + 16) ^ hash_secret[2], hash_r8(p + 24) ^ see1);
+				see2 = hash_mix(hash_r8(p + 32) ^ hash_secret[3], hash_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+
+		while (i > 16) {
+			seed = hash_mix(hash_r8(p) ^ hash_secret[1], hash_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
 		}
+
+		a = hash_r8(p + i - 16);
+		b = hash_r8(p + i - 8);
 	}
-	a /= 2;
-	a += array[1];
 
-	printf("\texpected lookup cost = %d/%d or %f\n\n",
-	       ht->num_elements, a,
-	       (float) ht->num_elements / (float) a);
+	a ^= hash_secret[1];
+	b ^= seed;
+	hash_mum(&a, &b);
+	h = hash_mix(a ^ hash_secret[0] ^ size, b ^ hash_secret[1]);
 
-	return 0;
+	return (uint32_t) (h ^ (h >> 32));
+}
+
+/** Hash a buffer
+ *
+ * @param[in] data	to hash.
+ * @param[in] size	of the data.
+ * @return a 32-bit hash, which is only consistent within this process.
+ */
+uint32_t fr_hash(void const *data, size_t size)
+{
+	return hash_words(data, size, hash_seed);
+}
+
+/** Continue hashing data
+ *
+ * @param[in] data	to hash.
+ * @param[in] size	of the data.
+ * @param[in] hash	the result of a previous call to fr_hash(), or fr_hash_update().
+ * @return a 32-bit hash, which is only consistent within this process.
+ */
+uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash)
+{
+	return hash_words(data, size, hash_seed ^ ((uint64_t) hash << 32) ^ hash);
 }
-#endif
 
+/** Hash a C string
+ *
+ * @param[in] p		string to hash.
+ * @return a 32-bit hash, which is only consistent within this process.
+ */
+uint32_t fr_hash_string(char const *p)
+{
+	return hash_words(p, strlen(p), hash_seed);
+}
 
 #define FNV_MAGIC_INIT (0x811c9dc5)
 #define FNV_MAGIC_PRIME (0x01000193)
 
 /*
- *	A fast hash function.  For details, see:
+ *	The FNV hash.  For details, see:
  *
  *	http://www.isthe.com/chongo/tech/comp/fnv/
  *
  *	Which also includes public domain source.  We've re-written
  *	it here for our purposes.
+ *
+ *	It's slower than fr_hash(), and isn't seeded, so it shouldn't
+ *	be used for hash tables holding user-supplied data.  But it
+ *	gives the same value on every run, and every platform, so it's
+ *	used where the hash is visible outside of the server, e.g. for
+ *	picking a home server, or numbering attributes.
  */
-uint32_t fr_hash(void const *data, size_t size)
+uint32_t fr_hash_fnv(void const *data, size_t size)
 {
 	uint8_t const *p = data;
 	uint8_t const *q = p + size;
@@ -744,12 +810,6 @@ uint32_t fr_hash(void const *data, size_t size)
 		 *	Multiple by 32-bit magic FNV prime, mod 2^32
 		 */
 		hash *= FNV_MAGIC_PRIME;
-#if 0
-		/*
-		 *	Potential optimization.
-		 */
-		hash += (hash<<1) + (hash<<4) + (hash<<7) + (hash<<8) + (hash<<24);
-#endif
     }
 
     return hash;
@@ -758,7 +818,7 @@ uint32_t fr_hash(void const *data, size_t size)
 /*
  *	Continue hashing data.
  */
-uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash)
+uint32_t fr_hash_fnv_update(void const *data, size_t size, uint32_t hash)
 {
 	uint8_t const *p = data;
 	uint8_t const *q = p + size;
@@ -775,7 +835,7 @@ uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash)
 /*
  *	Hash a C string, so we loop over it once.
  */
-uint32_t fr_hash_string(char const *p)
+uint32_t fr_hash_fnv_string(char const *p)
 {
 	uint32_t      hash = FNV_MAGIC_INIT;
 
@@ -787,6 +847,147 @@ uint32_t fr_hash_string(char const *p)
 	return hash;
 }
 
+/*
+ *	CRC-32C (Castagnoli), for checksums which are written to disk.
+ *	It gives the same value everywhere, and catches far more
+ *	errors than a hash.  Recent x86 CPUs have an instruction for
+ *	it, which we use when it's there.
+ */
+static uint32_t const crc32c_table[256] = {
+	0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4,
+	0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+	0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+	0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+	0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b,
+	0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+	0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54,
+	0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+	0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+	0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+	0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5,
+	0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+	0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45,
+	0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+	0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+	0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+	0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48,
+	0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+	0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687,
+	0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+	0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+	0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+	0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8,
+	0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+	0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096,
+	0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+	0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+	0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+	0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9,
+	0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+	0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36,
+	0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+	0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+	0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+	0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043,
+	0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+	0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3,
+	0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+	0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+	0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+	0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652,
+	0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+	0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d,
+	0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+	0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+	0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+	0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2,
+	0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+	0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530,
+	0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+	0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+	0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+	0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f,
+	0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+	0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90,
+	0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+	0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+	0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+	0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321,
+	0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+	0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81,
+	0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+	0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+	0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
+};
+
+static uint32_t crc32c_sw(uint8_t const *p, size_t size, uint32_t crc)
+{
+	while (size--) crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  define CRC32C_HW
+static bool crc32c_have_hw;
+
+/** Check for the CRC32 instruction
+ *
+ * Runs before main(), so that no thread can see it half done.
+ */
+static void CC_HINT(constructor) crc32c_init(void)
+{
+	__builtin_cpu_init();
+	crc32c_have_hw = __builtin_cpu_supports("sse4.2");
+}
+
+static __attribute__ ((target ("sse4.2"))) uint32_t crc32c_hw(uint8_t const *p, size_t size, uint32_t crc)
+{
+	uint64_t crc64 = crc;
+
+	while (size >= sizeof(uint64_t)) {
+		uint64_t word;
+
+		memcpy(&word, p, sizeof(word));
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+		p += sizeof(word);
+		size -= sizeof(word);
+	}
+
+	crc = crc64;
+	while (size--) crc = __builtin_ia32_crc32qi(crc, *p++);
+
+	return crc;
+}
+#endif
+
+/** Continue a CRC-32C
+ *
+ * @param[in] data	to checksum.
+ * @param[in] size	of the data.
+ * @param[in] crc	the result of a previous call to fr_crc32c(), or fr_crc32c_update().
+ * @return the CRC-32C of everything checksummed so far.
+ */
+uint32_t fr_crc32c_update(void const *data, size_t size, uint32_t crc)
+{
+#ifdef CRC32C_HW
+	if (crc32c_have_hw) return ~crc32c_hw(data, size, ~crc);
+#endif
+
+	return ~crc32c_sw(data, size, ~crc);
+}
+
+/** Calculate the CRC-32C of a buffer
+ *
+ * @param[in] data	to checksum.
+ * @param[in] size	of the data.
+ * @return the CRC-32C.
+ */
+uint32_t fr_crc32c(void const *data, size_t size)
+{
+	return fr_crc32c_update(data, size, 0);
+}
+
 
 #ifdef TESTING
 /*
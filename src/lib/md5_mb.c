@@ -0,0 +1,381 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file md5_mb.c
+ * @brief Multi-buffer MD5, hashing several independent messages at once.
+ *
+ * MD5 can't be made faster for one message, as each step depends on
+ * the previous one.  But the messages in a batch are independent, so
+ * we run one message per SIMD lane, with the same instructions operating
+ * on all lanes at once.
+ *
+ * The lanes use the GCC / clang vector extensions rather than
+ * intrinsics.  The compiler turns them into whatever the target has:
+ * one AVX-512 register, two AVX2 registers, four SSE2 registers, or
+ * plain scalar code.  On x86_64 Linux we also ask GCC for AVX2 and
+ * AVX-512 clones of the transform, and the dynamic linker picks the
+ * best one for the CPU we're running on.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+
+#ifdef __GNUC__
+#  define MD5_MB_VECTOR
+#endif
+
+#ifdef MD5_MB_VECTOR
+#  if defined(__x86_64__) && defined(__linux__) && !defined(__clang__) && (__GNUC__ >= 6)
+#    define MD5_MB_CLONES __attribute__ ((target_clones("avx512f", "avx2", "default")))
+#  else
+#    define MD5_MB_CLONES
+#  endif
+
+typedef uint32_t md5_vec_t __attribute__ ((vector_size (FR_MD5_MB_LANES * sizeof(uint32_t))));
+
+#define MD5_MB_BLOCK_LENGTH	(64)
+
+/** Where one lane is in its message
+ *
+ */
+typedef struct md5_mb_lane {
+	fr_md5_mb_in_t const	*in;			//!< The segments being hashed.
+	int			seg;			//!< Current segment.
+	size_t			offset;			//!< Offset into the current segment.
+	uint64_t		bits;			//!< Total length of the message, in bits.
+	bool			padded;			//!< Whether we've written the 0x80 terminator.
+	bool			done;			//!< Whether we've written the length.
+	uint8_t			block[MD5_MB_BLOCK_LENGTH];	//!< Blocks which span segments, or padding.
+} md5_mb_lane_t;
+
+static const uint8_t md5_mb_zero[MD5_MB_BLOCK_LENGTH];
+
+/** Return the next block of a lane's message, with MD5 padding
+ *
+ * Blocks which are entirely within one segment are hashed in place.
+ * Everything else is copied into the lane's block buffer.
+ *
+ * @param[in] lane to return the next block for.
+ * @return
+ *	- The next 64 byte block.
+ *	- NULL if the message has been completely hashed.
+ */
+static uint8_t const *md5_mb_next_block(md5_mb_lane_t *lane)
+{
+	fr_md5_mb_in_t const	*in = lane->in;
+	size_t			used = 0;
+
+	if (lane->done) return NULL;
+
+	while ((lane->seg < FR_MD5_MB_SEGMENTS) && (lane->offset == in->len[lane->seg])) {
+		lane->seg++;
+		lane->offset = 0;
+	}
+
+	if ((lane->seg < FR_MD5_MB_SEGMENTS) && ((in->len[lane->seg] - lane->offset) >= MD5_MB_BLOCK_LENGTH)) {
+		uint8_t const *p = in->data[lane->seg] + lane->offset;
+
+		lane->offset += MD5_MB_BLOCK_LENGTH;
+		return p;
+	}
+
+	while ((used < MD5_MB_BLOCK_LENGTH) && (lane->seg < FR_MD5_MB_SEGMENTS)) {
+		size_t len = in->len[lane->seg] - lane->offset;
+
+		if (len > (MD5_MB_BLOCK_LENGTH - used)) len = MD5_MB_BLOCK_LENGTH - used;
+
+		if (len) memcpy(lane->block + used, in->data[lane->seg] + lane->offset, len);
+		used += len;
+		lane->offset += len;
+
+		if (lane->offset == in->len[lane->seg]) {
+			lane->seg++;
+			lane->offset = 0;
+		}
+	}
+	if (used == MD5_MB_BLOCK_LENGTH) return lane->block;
+
+	/*
+	 *	The message is finished, so pad it.  If there's no
+	 *	room for the length, it goes in the block after this
+	 *	one.
+	 */
+	if (!lane->padded) {
+		lane->block[used++] = 0x80;
+		lane->padded = true;
+	}
+
+	if (used > (MD5_MB_BLOCK_LENGTH - 8)) {
+		memset(lane->block + used, 0, MD5_MB_BLOCK_LENGTH - used);
+		return lane->block;
+	}
+
+	memset(lane->block + used, 0, (MD5_MB_BLOCK_LENGTH - 8) - used);
+	lane->block[56] = lane->bits;
+	lane->block[57] = lane->bits >> 8;
+	lane->block[58] = lane->bits >> 16;
+	lane->block[59] = lane->bits >> 24;
+	lane->block[60] = lane->bits >> 32;
+	lane->block[61] = lane->bits >> 40;
+	lane->block[62] = lane->bits >> 48;
+	lane->block[63] = lane->bits >> 56;
+	lane->done = true;
+
+	return lane->block;
+}
+
+/* The four core functions - F1 is optimized somewhat */
+#define F1(x, y, z) (z ^ (x & (y ^ z)))
+#define F2(x, y, z) F1(z, x, y)
+#define F3(x, y, z) (x ^ y ^ z)
+#define F4(x, y, z) (y ^ (x | ~z))
+
+/* This is the central step in the MD5 algorithm. */
+#define MD5STEP(f, w, x, y, z, data, s) \
+	(w += f(x, y, z) + data, w = (w << s) | (w >> (32 - s)), w += x)
+
+/** MD5 block transform for all lanes at once
+ *
+ * @param[in,out] state of each lane.
+ * @param[in] m the message words of each lane.
+ */
+static inline void md5_mb_transform(md5_vec_t state[4], md5_vec_t const m[16])
+{
+	md5_vec_t a, b, c, d;
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+
+	MD5STEP(F1, a, b, c, d, m[0] + 0xd76aa478, 7);
+	MD5STEP(F1, d, a, b, c, m[1] + 0xe8c7b756, 12);
+	MD5STEP(F1, c, d, a, b, m[2] + 0x242070db, 17);
+	MD5STEP(F1, b, c, d, a, m[3] + 0xc1bdceee, 22);
+	MD5STEP(F1, a, b, c, d, m[4] + 0xf57c0faf, 7);
+	MD5STEP(F1, d, a, b, c, m[5] + 0x4787c62a, 12);
+	MD5STEP(F1, c, d, a, b, m[6] + 0xa8304613, 17);
+	MD5STEP(F1, b, c, d, a, m[7] + 0xfd469501, 22);
+	MD5STEP(F1, a, b, c, d, m[8] + 0x698098d8, 7);
+	MD5STEP(F1, d, a, b, c, m[9] + 0x8b44f7af, 12);
+	MD5STEP(F1, c, d, a, b, m[10] + 0xffff5bb1, 17);
+	MD5STEP(F1, b, c, d, a, m[11] + 0x895cd7be, 22);
+	MD5STEP(F1, a, b, c, d, m[12] + 0x6b901122, 7);
+	MD5STEP(F1, d, a, b, c, m[13] + 0xfd987193, 12);
+	MD5STEP(F1, c, d, a, b, m[14] + 0xa679438e, 17);
+	MD5STEP(F1, b, c, d, a, m[15] + 0x49b40821, 22);
+
+	MD5STEP(F2, a, b, c, d, m[1] + 0xf61e2562, 5);
+	MD5STEP(F2, d, a, b, c, m[6] + 0xc040b340, 9);
+	MD5STEP(F2, c, d, a, b, m[11] + 0x265e5a51, 14);
+	MD5STEP(F2, b, c, d, a, m[0] + 0xe9b6c7aa, 20);
+	MD5STEP(F2, a, b, c, d, m[5] + 0xd62f105d, 5);
+	MD5STEP(F2, d, a, b, c, m[10] + 0x02441453, 9);
+	MD5STEP(F2, c, d, a, b, m[15] + 0xd8a1e681, 14);
+	MD5STEP(F2, b, c, d, a, m[4] + 0xe7d3fbc8, 20);
+	MD5STEP(F2, a, b, c, d, m[9] + 0x21e1cde6, 5);
+	MD5STEP(F2, d, a, b, c, m[14] + 0xc33707d6, 9);
+	MD5STEP(F2, c, d, a, b, m[3] + 0xf4d50d87, 14);
+	MD5STEP(F2, b, c, d, a, m[8] + 0x455a14ed, 20);
+	MD5STEP(F2, a, b, c, d, m[13] + 0xa9e3e905, 5);
+	MD5STEP(F2, d, a, b, c, m[2] + 0xfcefa3f8, 9);
+	MD5STEP(F2, c, d, a, b, m[7] + 0x676f02d9, 14);
+	MD5STEP(F2, b, c, d, a, m[12] + 0x8d2a4c8a, 20);
+
+	MD5STEP(F3, a, b, c, d, m[5] + 0xfffa3942, 4);
+	MD5STEP(F3, d, a, b, c, m[8] + 0x8771f681, 11);
+	MD5STEP(F3, c, d, a, b, m[11] + 0x6d9d6122, 16);
+	MD5STEP(F3, b, c, d, a, m[14] + 0xfde5380c, 23);
+	MD5STEP(F3, a, b, c, d, m[1] + 0xa4beea44, 4);
+	MD5STEP(F3, d, a, b, c, m[4] + 0x4bdecfa9, 11);
+	MD5STEP(F3, c, d, a, b, m[7] + 0xf6bb4b60, 16);
+	MD5STEP(F3, b, c, d, a, m[10] + 0xbebfbc70, 23);
+	MD5STEP(F3, a, b, c, d, m[13] + 0x289b7ec6, 4);
+	MD5STEP(F3, d, a, b, c, m[0] + 0xeaa127fa, 11);
+	MD5STEP(F3, c, d, a, b, m[3] + 0xd4ef3085, 16);
+	MD5STEP(F3, b, c, d, a, m[6] + 0x04881d05, 23);
+	MD5STEP(F3, a, b, c, d, m[9] + 0xd9d4d039, 4);
+	MD5STEP(F3, d, a, b, c, m[12] + 0xe6db99e5, 11);
+	MD5STEP(F3, c, d, a, b, m[15] + 0x1fa27cf8, 16);
+	MD5STEP(F3, b, c, d, a, m[2] + 0xc4ac5665, 23);
+
+	MD5STEP(F4, a, b, c, d, m[0] + 0xf4292244, 6);
+	MD5STEP(F4, d, a, b, c, m[7] + 0x432aff97, 10);
+	MD5STEP(F4, c, d, a, b, m[14] + 0xab9423a7, 15);
+	MD5STEP(F4, b, c, d, a, m[5] + 0xfc93a039, 21);
+	MD5STEP(F4, a, b, c, d, m[12] + 0x655b59c3, 6);
+	MD5STEP(F4, d, a, b, c, m[3] + 0x8f0ccc92, 10);
+	MD5STEP(F4, c, d, a, b, m[10] + 0xffeff47d, 15);
+	MD5STEP(F4, b, c, d, a, m[1] + 0x85845dd1, 21);
+	MD5STEP(F4, a, b, c, d, m[8] + 0x6fa87e4f, 6);
+	MD5STEP(F4, d, a, b, c, m[15] + 0xfe2ce6e0, 10);
+	MD5STEP(F4, c, d, a, b, m[6] + 0xa3014314, 15);
+	MD5STEP(F4, b, c, d, a, m[13] + 0x4e0811a1, 21);
+	MD5STEP(F4, a, b, c, d, m[4] + 0xf7537e82, 6);
+	MD5STEP(F4, d, a, b, c, m[11] + 0xbd3af235, 10);
+	MD5STEP(F4, c, d, a, b, m[2] + 0x2ad7d2bb, 15);
+	MD5STEP(F4, b, c, d, a, m[9] + 0xeb86d391, 21);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+/** Hash up to FR_MD5_MB_LANES messages, one per lane
+ *
+ * Messages of different lengths are fine.  Lanes which have finished
+ * keep their state while the others carry on.
+ */
+MD5_MB_CLONES
+static void md5_mb_calc_lanes(uint8_t out[][MD5_DIGEST_LENGTH], fr_md5_mb_in_t const in[], int num)
+{
+	md5_mb_lane_t	lanes[FR_MD5_MB_LANES];
+	md5_vec_t	state[4];
+	int		i, j;
+
+	for (i = 0; i < FR_MD5_MB_LANES; i++) {
+		state[0][i] = 0x67452301;
+		state[1][i] = 0xefcdab89;
+		state[2][i] = 0x98badcfe;
+		state[3][i] = 0x10325476;
+	}
+
+	for (i = 0; i < num; i++) {
+		lanes[i].in = &in[i];
+		lanes[i].seg = 0;
+		lanes[i].offset = 0;
+		lanes[i].padded = false;
+		lanes[i].done = false;
+
+		lanes[i].bits = 0;
+		for (j = 0; j < FR_MD5_MB_SEGMENTS; j++) lanes[i].bits += in[i].len[j];
+		lanes[i].bits <<= 3;
+	}
+
+	for (;;) {
+		uint32_t	words[16][FR_MD5_MB_LANES];
+		uint32_t	active[FR_MD5_MB_LANES];
+		md5_vec_t	m[16], mask, saved[4];
+		bool		live = false;
+
+		/*
+		 *	Transpose the next block of each message, so
+		 *	that word N of every message is in one vector.
+		 */
+		for (i = 0; i < FR_MD5_MB_LANES; i++) {
+			uint8_t const *p = NULL;
+
+			if (i < num) p = md5_mb_next_block(&lanes[i]);
+			if (p) {
+				live = true;
+				active[i] = 0xffffffff;
+			} else {
+				p = md5_mb_zero;
+				active[i] = 0;
+			}
+
+			for (j = 0; j < 16; j++) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+				memcpy(&words[j][i], p + (j * 4), sizeof(words[j][i]));
+#else
+				words[j][i] = ((uint32_t) p[j * 4]) | (((uint32_t) p[(j * 4) + 1]) << 8) |
+					      (((uint32_t) p[(j * 4) + 2]) << 16) | (((uint32_t) p[(j * 4) + 3]) << 24);
+#endif
+			}
+		}
+		if (!live) break;
+
+		memcpy(m, words, sizeof(m));
+		memcpy(&mask, active, sizeof(mask));
+		memcpy(saved, state, sizeof(saved));
+
+		md5_mb_transform(state, m);
+
+		for (i = 0; i < 4; i++) state[i] = (state[i] & mask) | (saved[i] & ~mask);
+	}
+
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < 4; j++) {
+			uint32_t s = state[j][i];
+
+			out[i][(j * 4)] = s;
+			out[i][(j * 4) + 1] = s >> 8;
+			out[i][(j * 4) + 2] = s >> 16;
+			out[i][(j * 4) + 3] = s >> 24;
+		}
+	}
+}
+#endif	/* MD5_MB_VECTOR */
+
+/** Hash one message with the normal MD5 functions
+ *
+ */
+static void md5_mb_calc_one(uint8_t out[MD5_DIGEST_LENGTH], fr_md5_mb_in_t const *in)
+{
+	FR_MD5_CTX	ctx;
+	int		i;
+
+	fr_md5_init(&ctx);
+	for (i = 0; i < FR_MD5_MB_SEGMENTS; i++) {
+		if (in->len[i]) fr_md5_update(&ctx, in->data[i], in->len[i]);
+	}
+	fr_md5_final(out, &ctx);
+}
+
+/** Calculate the MD5 hashes of a batch of messages
+ *
+ * Each message is the concatenation of up to FR_MD5_MB_SEGMENTS
+ * segments, so that callers can hash a packet and a shared secret
+ * (or an HMAC pad and a packet) without copying them together first.
+ *
+ * Messages are hashed FR_MD5_MB_LANES at a time.  Lanes run in
+ * lockstep, so the batch takes as long as its longest message.  It
+ * works best when the messages are of similar lengths, as received
+ * RADIUS packets usually are.
+ *
+ * @param[out] out Where to write the MD5 digest of each message.
+ * @param[in] in Messages to hash.
+ * @param[in] num Number of messages.
+ */
+void fr_md5_mb_calc(uint8_t out[][MD5_DIGEST_LENGTH], fr_md5_mb_in_t const in[], int num)
+{
+	while (num > 0) {
+		int batch = (num > FR_MD5_MB_LANES) ? FR_MD5_MB_LANES : num;
+
+#ifdef MD5_MB_VECTOR
+		if (batch > 1) {
+			md5_mb_calc_lanes(out, in, batch);
+		} else
+#endif
+		{
+			int i;
+
+			for (i = 0; i < batch; i++) md5_mb_calc_one(out[i], &in[i]);
+		}
+
+		out += batch;
+		in += batch;
+		num -= batch;
+	}
+}
@@ -27,6 +27,16 @@ RCSID("$Id$")
 
 #include <ctype.h>
 
+/*
+ *	The destructor only poisons the VALUE_PAIR, to catch use after
+ *	free.  Release builds don't set it, so that freeing a request
+ *	full of attributes doesn't call a function for each one.
+ */
+#if !defined(NDEBUG) || defined(TALLOC_DEBUG)
+#  define PAIR_DESTRUCTOR
+#endif
+
+#ifdef PAIR_DESTRUCTOR
 /** Free a VALUE_PAIR
  *
  * @note Do not call directly, use talloc_free instead.
@@ -45,6 +55,7 @@ static int _fr_pair_free(NDEBUG_UNUSED VALUE_PAIR *vp)
 #endif
 	return 0;
 }
+#endif
 
 
 static VALUE_PAIR *fr_pair_alloc(TALLOC_CTX *ctx)
@@ -61,7 +72,9 @@ static VALUE_PAIR *fr_pair_alloc(TALLOC_CTX *ctx)
 	vp->tag = TAG_ANY;
 	vp->type = VT_NONE;
 
+#ifdef PAIR_DESTRUCTOR
 	talloc_set_destructor(vp, _fr_pair_free);
+#endif
 
 	return vp;
 }
@@ -1326,6 +1326,322 @@ int fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const
 	return 0;
 }
 
+/** Find the Message-Authenticator in a packet, for fr_radius_verify_batch()
+ *
+ * @param[in] packet to search.
+ * @param[out] ma where to write a pointer to the Message-Authenticator, or NULL if there isn't one.
+ * @return
+ *	- 0 if the packet can be verified in a batch.
+ *	- -1 if it needs fr_radius_verify().
+ */
+static int verify_batch_ma_find(RADIUS_PACKET *packet, uint8_t **ma)
+{
+	uint8_t	*ptr, *end;
+
+	*ma = NULL;
+
+	ptr = packet->data + RADIUS_HDR_LEN;
+	end = packet->data + packet->data_len;
+	while (ptr < end) {
+		if (((end - ptr) < 2) || (ptr[1] < 2)) return -1;
+
+		if (ptr[0] == PW_MESSAGE_AUTHENTICATOR) {
+			if (*ma || (ptr[1] != (AUTH_VECTOR_LEN + 2))) return -1;
+			*ma = ptr;
+		}
+
+		ptr += ptr[1];
+	}
+
+	return 0;
+}
+
+/** Verify up to FR_MD5_MB_LANES packets
+ *
+ */
+static int verify_batch(RADIUS_PACKET *packets[], RADIUS_PACKET *originals[], char const *secrets[],
+			size_t const secret_lens[], int rcodes[], int num)
+{
+	uint8_t		*ma[FR_MD5_MB_LANES];
+	uint8_t		msg_auth_vector[FR_MD5_MB_LANES][AUTH_VECTOR_LEN];
+	uint8_t		pad[FR_MD5_MB_LANES][64];
+	uint8_t		inner[FR_MD5_MB_LANES][MD5_DIGEST_LENGTH];
+	uint8_t		digest[FR_MD5_MB_LANES][MD5_DIGEST_LENGTH];
+	fr_md5_mb_in_t	in[FR_MD5_MB_LANES];
+	int		idx[FR_MD5_MB_LANES];
+	bool		batched[FR_MD5_MB_LANES];
+	int		i, j, n, ok = 0;
+	char		buffer[INET6_ADDRSTRLEN];
+
+	/*
+	 *	Weed out the packets which need something unusual,
+	 *	and let fr_radius_verify() deal with those.
+	 */
+	for (i = 0; i < num; i++) {
+		RADIUS_PACKET	*packet = packets[i];
+		RADIUS_PACKET	*original = originals ? originals[i] : NULL;
+
+		rcodes[i] = 0;
+		batched[i] = false;
+
+		if (!packet || !packet->data) {
+			rcodes[i] = -1;
+			continue;
+		}
+
+		if (secret_lens[i] > sizeof(pad[i])) goto single;
+		if (verify_batch_ma_find(packet, &ma[i]) < 0) goto single;
+
+		switch (packet->code) {
+		case PW_CODE_ACCESS_REQUEST:
+		case PW_CODE_STATUS_SERVER:
+		case PW_CODE_COA_REQUEST:
+		case PW_CODE_DISCONNECT_REQUEST:
+		case PW_CODE_ACCOUNTING_REQUEST:
+			batched[i] = true;
+			continue;
+
+		case PW_CODE_ACCESS_ACCEPT:
+		case PW_CODE_ACCESS_REJECT:
+		case PW_CODE_ACCESS_CHALLENGE:
+		case PW_CODE_ACCOUNTING_RESPONSE:
+		case PW_CODE_DISCONNECT_ACK:
+		case PW_CODE_DISCONNECT_NAK:
+		case PW_CODE_COA_ACK:
+		case PW_CODE_COA_NAK:
+			if (!original) break;
+			batched[i] = true;
+			continue;
+
+		default:
+			break;
+		}
+
+	single:
+		rcodes[i] = fr_radius_verify(packet, original, secrets[i]);
+	}
+
+	/*
+	 *	The Message-Authenticators, which are HMAC-MD5 over
+	 *	the packet with the attribute zeroed, and the
+	 *	Authenticator set the same way fr_radius_verify() does.
+	 */
+	for (i = 0, n = 0; i < num; i++) {
+		RADIUS_PACKET	*packet = packets[i];
+		RADIUS_PACKET	*original = originals ? originals[i] : NULL;
+
+		if (!batched[i] || !ma[i]) continue;
+
+		memcpy(msg_auth_vector[i], &ma[i][2], AUTH_VECTOR_LEN);
+		memset(&ma[i][2], 0, AUTH_VECTOR_LEN);
+
+		switch (packet->code) {
+		default:
+			break;
+
+		case PW_CODE_ACCOUNTING_RESPONSE:
+			if (original->code == PW_CODE_STATUS_SERVER) {
+				memcpy(packet->data + 4, original->vector, AUTH_VECTOR_LEN);
+				break;
+			}
+			/* FALL-THROUGH */
+
+		case PW_CODE_ACCOUNTING_REQUEST:
+		case PW_CODE_DISCONNECT_REQUEST:
+		case PW_CODE_COA_REQUEST:
+			memset(packet->data + 4, 0, AUTH_VECTOR_LEN);
+			break;
+
+		case PW_CODE_ACCESS_ACCEPT:
+		case PW_CODE_ACCESS_REJECT:
+		case PW_CODE_ACCESS_CHALLENGE:
+		case PW_CODE_DISCONNECT_ACK:
+		case PW_CODE_DISCONNECT_NAK:
+		case PW_CODE_COA_ACK:
+		case PW_CODE_COA_NAK:
+			memcpy(packet->data + 4, original->vector, AUTH_VECTOR_LEN);
+			break;
+		}
+
+		memset(pad[i], 0, sizeof(pad[i]));
+		memcpy(pad[i], secrets[i], secret_lens[i]);
+		for (j = 0; j < (int) sizeof(pad[i]); j++) pad[i][j] ^= 0x36;
+
+		memset(&in[n], 0, sizeof(in[n]));
+		in[n].data[0] = pad[i];
+		in[n].len[0] = sizeof(pad[i]);
+		in[n].data[1] = packet->data;
+		in[n].len[1] = packet->data_len;
+		idx[n++] = i;
+	}
+
+	if (n > 0) {
+		fr_md5_mb_calc(inner, in, n);
+
+		/*
+		 *	Turn the inner pads into outer pads.
+		 */
+		for (j = 0; j < n; j++) {
+			int k;
+
+			i = idx[j];
+			for (k = 0; k < (int) sizeof(pad[i]); k++) pad[i][k] ^= (0x36 ^ 0x5c);
+
+			in[j].data[1] = inner[j];
+			in[j].len[1] = sizeof(inner[j]);
+		}
+
+		fr_md5_mb_calc(digest, in, n);
+
+		for (j = 0; j < n; j++) {
+			RADIUS_PACKET *packet;
+
+			i = idx[j];
+			packet = packets[i];
+
+			/*
+			 *	Reinitialize Authenticators.
+			 */
+			memcpy(&ma[i][2], msg_auth_vector[i], AUTH_VECTOR_LEN);
+			memcpy(packet->data + 4, packet->vector, AUTH_VECTOR_LEN);
+
+			if (fr_radius_digest_cmp(digest[j], msg_auth_vector[i], AUTH_VECTOR_LEN) != 0) {
+				fr_strerror_printf("Received packet from %s with invalid Message-Authenticator!  "
+						   "(Shared secret is incorrect.)",
+						   inet_ntop(packet->src_ipaddr.af,
+							     &packet->src_ipaddr.ipaddr,
+							     buffer, sizeof(buffer)));
+				rcodes[i] = -1;
+				batched[i] = false;
+			}
+		}
+	}
+
+	/*
+	 *	The Request or Response Authenticators, which are
+	 *	MD5(packet + secret).
+	 */
+	for (i = 0, n = 0; i < num; i++) {
+		RADIUS_PACKET	*packet = packets[i];
+
+		if (!batched[i]) continue;
+
+		switch (packet->code) {
+		default:
+			continue;
+
+		case PW_CODE_COA_REQUEST:
+		case PW_CODE_DISCONNECT_REQUEST:
+		case PW_CODE_ACCOUNTING_REQUEST:
+			memset(packet->data + 4, 0, AUTH_VECTOR_LEN);
+			break;
+
+		case PW_CODE_ACCESS_ACCEPT:
+		case PW_CODE_ACCESS_REJECT:
+		case PW_CODE_ACCESS_CHALLENGE:
+		case PW_CODE_ACCOUNTING_RESPONSE:
+		case PW_CODE_DISCONNECT_ACK:
+		case PW_CODE_DISCONNECT_NAK:
+		case PW_CODE_COA_ACK:
+		case PW_CODE_COA_NAK:
+			memcpy(packet->data + 4, originals[i]->vector, AUTH_VECTOR_LEN);
+			break;
+		}
+
+		memset(&in[n], 0, sizeof(in[n]));
+		in[n].data[0] = packet->data;
+		in[n].len[0] = packet->data_len;
+		in[n].data[1] = (uint8_t const *) secrets[i];
+		in[n].len[1] = secret_lens[i];
+		idx[n++] = i;
+	}
+
+	if (n > 0) {
+		fr_md5_mb_calc(digest, in, n);
+
+		for (j = 0; j < n; j++) {
+			RADIUS_PACKET *packet;
+
+			i = idx[j];
+			packet = packets[i];
+
+			memcpy(packet->data + 4, packet->vector, AUTH_VECTOR_LEN);
+
+			if (fr_radius_digest_cmp(digest[j], packet->vector, AUTH_VECTOR_LEN) == 0) continue;
+
+			if (!originals || !originals[i]) {
+				fr_strerror_printf("Received %s packet "
+						   "from client %s with invalid Request-Authenticator!  "
+						   "(Shared secret is incorrect.)",
+						   fr_packet_codes[packet->code],
+						   inet_ntop(packet->src_ipaddr.af,
+							     &packet->src_ipaddr.ipaddr,
+							     buffer, sizeof(buffer)));
+			} else {
+				fr_strerror_printf("Received %s packet "
+						   "from home server %s port %d with invalid Response-Authenticator!  "
+						   "(Shared secret is incorrect.)",
+						   fr_packet_codes[packet->code],
+						   inet_ntop(packet->src_ipaddr.af,
+							     &packet->src_ipaddr.ipaddr,
+							     buffer, sizeof(buffer)),
+						   packet->src_port);
+			}
+			rcodes[i] = -1;
+		}
+	}
+
+	for (i = 0; i < num; i++) if (rcodes[i] == 0) ok++;
+
+	return ok;
+}
+
+/** Verify the Authenticators (and Message-Authenticators if present) of a batch of packets
+ *
+ * Does the same checks as fr_radius_verify(), but the MD5 operations
+ * for the batch are done together, with fr_md5_mb_calc().  This is
+ * meant for the receive path, where a batch of packets is read from
+ * a socket at once with udp_recv_mmsg().
+ *
+ * Packets which need anything unusual, such as more than one
+ * Message-Authenticator or a shared secret longer than an MD5 block,
+ * are passed to fr_radius_verify() individually.
+ *
+ * @note Unlike fr_radius_verify(), the Request Authenticator of
+ *	accounting packets is restored after the check.
+ *
+ * @param[in] packets to verify.
+ * @param[in] originals the request each packet is a reply to.  May be NULL
+ *	if all of the packets are requests.
+ * @param[in] secrets the shared secret for each packet.
+ * @param[in] secret_lens the length of each shared secret.
+ * @param[out] rcodes the result for each packet.  0 if the packet is OK,
+ *	-1 if it isn't, as with fr_radius_verify().
+ * @param[in] num the number of packets.
+ * @return the number of packets which are OK.  fr_strerror() describes
+ *	the last failure.
+ */
+int fr_radius_verify_batch(RADIUS_PACKET *packets[], RADIUS_PACKET *originals[], char const *secrets[],
+			   size_t const secret_lens[], int rcodes[], int num)
+{
+	int ok = 0;
+
+	while (num > 0) {
+		int batch = (num > FR_MD5_MB_LANES) ? FR_MD5_MB_LANES : num;
+
+		ok += verify_batch(packets, originals, secrets, secret_lens, rcodes, batch);
+
+		packets += batch;
+		if (originals) originals += batch;
+		secrets += batch;
+		secret_lens += batch;
+		rcodes += batch;
+		num -= batch;
+	}
+
+	return ok;
+}
+
 /** Encode a packet
  *
  */
@@ -1405,6 +1721,20 @@ int fr_radius_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 
 		room = ((uint8_t *)data) + sizeof(data) - ptr;
 
+		/*
+		 *	Simple attributes, whose headers were built
+		 *	when the dictionary was loaded.
+		 */
+		if (vp->da->encode.hdr_len) {
+			len = fr_radius_encode_pair_plan(ptr, room, vp);
+			if (len > 0) {
+				fr_pair_cursor_next(&cursor);
+				ptr += len;
+				total_length += len;
+				continue;
+			}
+		}
+
 		/*
 		 *	Ignore non-wire attributes, but allow extended
 		 *	attributes.
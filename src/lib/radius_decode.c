@@ -1482,3 +1482,283 @@ ssize_t fr_radius_decode_pair(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dict_attr
 
 	return 2 + rcode;
 }
+
+/** An index of the attributes in a RADIUS packet
+ *
+ * Building the index is one pass over the attribute headers, and
+ * allocates nothing other than the index itself.  The attributes
+ * are then decoded into VALUE_PAIRs only when something asks for
+ * them.  Programs which look at a few attributes out of a large
+ * packet, such as radsniff when it's filtering or counting, can then
+ * skip decoding most of the packet.
+ *
+ * The server doesn't use it.  Policies and modules walk
+ * request->packet->vps directly, so every attribute has to be
+ * decoded before a request is processed.
+ *
+ * Attributes are indexed by their top-level attribute number.  When
+ * an attribute is touched, all of the top-level attributes with the
+ * same number are decoded, so that multi-valued attributes, VSAs
+ * and extended attributes come out exactly as fr_radius_decode()
+ * would produce them.
+ *
+ * The VALUE_PAIRs still own copies of their data.  Pair values are
+ * talloc buffers which are freed and replaced all over the server,
+ * so they can't point into the packet.
+ */
+typedef struct fr_radius_index_entry {
+	uint16_t		offset;			//!< Of the attribute from the start of the packet.
+	uint16_t		next;			//!< Ordinal + 1 of the next attribute with the same number.
+} fr_radius_index_entry_t;
+
+struct fr_radius_index {
+	RADIUS_PACKET		*packet;		//!< Which the index refers to.
+	fr_radius_ctx_t		decoder_ctx;		//!< Passed to fr_radius_decode_pair().
+
+	uint32_t		num_vps;		//!< Number of VALUE_PAIRs decoded so far.
+
+	uint8_t			decoded[256 / 8];	//!< Bitmap of attribute numbers which have been decoded.
+	uint16_t		first[256];		//!< Ordinal + 1 of the first attribute with each number.
+
+	int			num;			//!< Number of attributes in the packet.
+	fr_radius_index_entry_t	attr[];			//!< One entry per attribute, in packet order.
+};
+
+/** Index the attributes in a packet, without decoding any of them
+ *
+ * The index must not outlive the packet, or the original.
+ *
+ * @param[in] ctx	to allocate the index in.
+ * @param[in] packet	to index.  Decoded pairs are added to packet->vps.
+ * @param[in] original	request, if packet is a reply.  May be NULL.
+ * @param[in] secret	shared with the other end, for decoding encrypted attributes.
+ * @return
+ *	- The new index on success.
+ *	- NULL on error (malformed packet, or out of memory).
+ */
+fr_radius_index_t *fr_radius_index_afrom_packet(TALLOC_CTX *ctx, RADIUS_PACKET *packet,
+						RADIUS_PACKET const *original, char const *secret)
+{
+	int			num, i;
+	uint8_t const		*p, *end;
+	uint16_t		last[256];
+	fr_radius_index_t	*idx;
+
+	if (!packet->data || (packet->data_len < RADIUS_HDR_LEN)) {
+		fr_strerror_printf("Packet is too short to index");
+		return NULL;
+	}
+
+	/*
+	 *	fr_radius_ok() has already checked the attribute
+	 *	headers, but the caller may not have called it.
+	 */
+	end = packet->data + packet->data_len;
+	num = 0;
+	for (p = packet->data + RADIUS_HDR_LEN; p < end; p += p[1]) {
+		if (((end - p) < 2) || (p[1] < 2) || (p[1] > (end - p))) {
+			fr_strerror_printf("Malformed attribute at offset %zu", (size_t) (p - packet->data));
+			return NULL;
+		}
+		num++;
+	}
+
+	idx = talloc_zero_size(ctx, sizeof(*idx) + (num * sizeof(idx->attr[0])));
+	if (!idx) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+	talloc_set_name_const(idx, "fr_radius_index_t");
+
+	idx->packet = packet;
+	idx->decoder_ctx.packet = packet;
+	idx->decoder_ctx.original = original;
+	idx->decoder_ctx.secret = secret;
+	idx->num = num;
+
+	i = 0;
+	for (p = packet->data + RADIUS_HDR_LEN; p < end; p += p[1]) {
+		idx->attr[i].offset = p - packet->data;
+
+		if (!idx->first[p[0]]) {
+			idx->first[p[0]] = i + 1;
+		} else {
+			idx->attr[last[p[0]] - 1].next = i + 1;
+		}
+		last[p[0]] = i + 1;
+		i++;
+	}
+
+	return idx;
+}
+
+/** Find the top-level attribute number which holds a given attribute
+ *
+ * @return
+ *	- The attribute number.
+ *	- -1 if the attribute can't be in a RADIUS packet.
+ */
+static int index_attr_num(fr_dict_attr_t const *da)
+{
+	while (da->parent && !da->parent->flags.is_root) da = da->parent;
+
+	if (!da->parent || (da->attr > 255)) return -1;
+
+	return da->attr;
+}
+
+/** Decode all of the attributes with a particular top-level number
+ *
+ * @param[in] idx	of the packet.
+ * @param[in] attr	top-level attribute number.
+ * @return
+ *	- 0 on success, or if the packet doesn't contain the attribute.
+ *	- -1 on decoding error.
+ */
+static int index_decode_num(fr_radius_index_t *idx, uint8_t attr)
+{
+	RADIUS_PACKET	*packet = idx->packet;
+	uint8_t const	*data = packet->data;
+	size_t		end = 0;
+	int		i;
+	VALUE_PAIR	*head = NULL;
+	vp_cursor_t	cursor, out;
+
+	if (idx->decoded[attr >> 3] & (1 << (attr & 0x07))) return 0;
+	idx->decoded[attr >> 3] |= (1 << (attr & 0x07));
+
+	if (!idx->first[attr]) return 0;
+
+	fr_pair_cursor_init(&cursor, &head);
+
+	for (i = idx->first[attr]; i != 0; i = idx->attr[i - 1].next) {
+		size_t		offset = idx->attr[i - 1].offset;
+		ssize_t		my_len;
+
+		/*
+		 *	Already consumed by a concat attribute, or by
+		 *	an extended attribute with the "more" flag
+		 *	set.  Those are always the same attribute
+		 *	number as the one which consumed them.
+		 */
+		if (offset < end) continue;
+
+		my_len = fr_radius_decode_pair(packet, &cursor, fr_dict_root(fr_dict_internal),
+					       data + offset, packet->data_len - offset, &idx->decoder_ctx);
+		if (my_len < 0) {
+			fr_pair_list_free(&head);
+			return -1;
+		}
+		end = offset + my_len;
+
+		while (fr_pair_cursor_next(&cursor)) idx->num_vps++;
+
+		/*
+		 *	Same limit as fr_radius_decode(), as VSAs may
+		 *	decode to many more pairs than there are
+		 *	attributes in the packet.
+		 */
+		if ((fr_max_attributes > 0) && (idx->num_vps > fr_max_attributes)) {
+			fr_strerror_printf("Too many attributes in packet (received %u, max %u are allowed)",
+					   idx->num_vps, fr_max_attributes);
+			fr_pair_list_free(&head);
+			return -1;
+		}
+	}
+
+	fr_pair_cursor_init(&out, &packet->vps);
+	fr_pair_cursor_last(&out);
+	fr_pair_cursor_merge(&out, head);
+
+	return 0;
+}
+
+/** Make sure an attribute has been decoded into packet->vps
+ *
+ * Pairs are appended to packet->vps in the order in which they are
+ * first touched, not in packet order.
+ *
+ * @param[in] idx	of the packet.
+ * @param[in] da	to decode.  May be any attribute, including VSAs and TLVs.
+ * @return
+ *	- 0 on success, or if the packet doesn't contain the attribute.
+ *	- -1 on decoding error.
+ */
+int fr_radius_index_decode(fr_radius_index_t *idx, fr_dict_attr_t const *da)
+{
+	int attr;
+
+	attr = index_attr_num(da);
+	if (attr < 0) return 0;
+
+	return index_decode_num(idx, attr);
+}
+
+/** Decode an attribute on first use, and return the first matching pair
+ *
+ * @param[in] idx	of the packet.
+ * @param[in] da	to find.
+ * @param[in] tag	to match, or TAG_ANY.
+ * @return
+ *	- The first matching pair.
+ *	- NULL if the packet doesn't contain the attribute, or on decoding error.
+ */
+VALUE_PAIR *fr_radius_index_pair_find(fr_radius_index_t *idx, fr_dict_attr_t const *da, int8_t tag)
+{
+	if (fr_radius_index_decode(idx, da) < 0) return NULL;
+
+	return fr_pair_find_by_da(idx->packet->vps, da, tag);
+}
+
+/** Decode everything which hasn't already been decoded
+ *
+ * @param[in] idx	of the packet.
+ * @return
+ *	- 0 on success.
+ *	- -1 on decoding error.
+ */
+int fr_radius_index_decode_all(fr_radius_index_t *idx)
+{
+	int i;
+
+	for (i = 0; i < idx->num; i++) {
+		if (index_decode_num(idx, idx->packet->data[idx->attr[i].offset]) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Decode only some of the attributes in a packet
+ *
+ * For callers which know up front which attributes they need.
+ * Attributes which aren't in the list are left undecoded.
+ *
+ * @param[in] packet	to decode.
+ * @param[in] original	request, if packet is a reply.  May be NULL.
+ * @param[in] secret	shared with the other end, for decoding encrypted attributes.
+ * @param[in] da	array of attributes to decode.
+ * @param[in] num	number of entries in the array.
+ * @return
+ *	- 0 on success.
+ *	- -1 on decoding error.
+ */
+int fr_radius_decode_only(RADIUS_PACKET *packet, RADIUS_PACKET const *original, char const *secret,
+			  fr_dict_attr_t const **da, int num)
+{
+	int			i, rcode = 0;
+	fr_radius_index_t	*idx;
+
+	idx = fr_radius_index_afrom_packet(NULL, packet, original, secret);
+	if (!idx) return -1;
+
+	for (i = 0; i < num; i++) {
+		rcode = fr_radius_index_decode(idx, da[i]);
+		if (rcode < 0) break;
+	}
+
+	talloc_free(idx);
+
+	fr_rand_seed(packet->data, RADIUS_HDR_LEN);
+
+	return rcode;
+}
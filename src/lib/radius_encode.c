@@ -1560,6 +1560,101 @@ static int encode_rfc_hdr(uint8_t *out, size_t outlen, fr_dict_attr_t const **tl
 	return encode_rfc_hdr_internal(out, outlen, tlv_stack, depth, cursor, encoder_ctx);
 }
 
+/** Encode a simple attribute using the header built when the dictionary was loaded
+ *
+ * Flat RFC attributes and VSAs don't need the TLV stack.  We copy the
+ * pre-built header, and write the value straight after it.
+ *
+ * @param[out] out	Where to write the attribute.
+ * @param[in] outlen	Space available in the output buffer.
+ * @param[in] vp	to encode.
+ * @return
+ *	- >0 the number of bytes written.
+ *	- 0 if the attribute has to go through fr_radius_encode_pair(),
+ *	  either because there's no pre-built header, or because it
+ *	  doesn't fit.
+ */
+ssize_t fr_radius_encode_pair_plan(uint8_t *out, size_t outlen, VALUE_PAIR const *vp)
+{
+	fr_dict_attr_t const	*da = vp->da;
+	size_t			hdr_len = da->encode.hdr_len;
+	size_t			len = vp->vp_length;
+	uint8_t			*p;
+	uint32_t		lvalue;
+	uint64_t		lvalue64;
+
+	if (!hdr_len || !len) return 0;
+
+	if (outlen > UINT8_MAX) outlen = UINT8_MAX;
+	if ((hdr_len + len) > outlen) return 0;
+
+	memcpy(out, da->encode.hdr, hdr_len);
+	p = out + hdr_len;
+
+	switch (da->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+		memcpy(p, vp->vp_ptr, len);
+		break;
+
+	default:
+		/*
+		 *	Leave anything odd to the full encoder, so
+		 *	that the output is always the same.
+		 */
+		if (len != dict_attr_sizes[da->type][0]) return 0;
+
+		switch (da->type) {
+		case PW_TYPE_IPV4_ADDR:
+		case PW_TYPE_IPV6_ADDR:
+		case PW_TYPE_IFID:
+		case PW_TYPE_ETHERNET:
+			memcpy(p, &vp->data.datum, len);
+			break;
+
+		case PW_TYPE_BYTE:
+			p[0] = vp->vp_byte;
+			break;
+
+		case PW_TYPE_SHORT:
+			p[0] = (vp->vp_short >> 8) & 0xff;
+			p[1] = vp->vp_short & 0xff;
+			break;
+
+		case PW_TYPE_INTEGER:
+			lvalue = htonl(vp->vp_integer);
+			memcpy(p, &lvalue, sizeof(lvalue));
+			break;
+
+		case PW_TYPE_DATE:
+			lvalue = htonl(vp->vp_date);
+			memcpy(p, &lvalue, sizeof(lvalue));
+			break;
+
+		case PW_TYPE_SIGNED:
+			lvalue = htonl(vp->vp_signed);
+			memcpy(p, &lvalue, sizeof(lvalue));
+			break;
+
+		case PW_TYPE_INTEGER64:
+			lvalue64 = htonll(vp->vp_integer64);
+			memcpy(p, &lvalue64, sizeof(lvalue64));
+			break;
+
+		default:
+			return 0;
+		}
+		break;
+	}
+
+	out[1] += len;
+	if (hdr_len > 2) out[hdr_len - 1] += len;	/* vendor attribute length */
+
+	FR_PROTO_HEX_DUMP("Done pre-built header", out, hdr_len + len);
+
+	return hdr_len + len;
+}
+
 /** Encode a data structure into a RADIUS attribute
  *
  * This is the main entry point into the encoder.  It sets up the encoder array
@@ -1608,6 +1703,17 @@ int fr_radius_encode_pair(uint8_t *out, size_t outlen, vp_cursor_t *cursor, void
 	 */
 	attr_len = (outlen > UINT8_MAX) ? UINT8_MAX : outlen;
 
+	/*
+	 *	Fastest path, for flat RFC attributes and VSAs.
+	 */
+	if (vp->da->encode.hdr_len) {
+		ret = fr_radius_encode_pair_plan(out, attr_len, vp);
+		if (ret > 0) {
+			next_encodable(cursor);
+			return ret;
+		}
+	}
+
 	/*
 	 *	Fast path for the common case.
 	 */
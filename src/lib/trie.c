@@ -0,0 +1,380 @@
+/*
+ * trie.c	Path compressed binary tries.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ *  Copyright 2017  The FreeRADIUS server project
+ */
+
+/*
+ *	A PATRICIA style trie, keyed by bit strings of up to "max_bits"
+ *	bits.  Each node holds the complete key prefix which leads to
+ *	it, so runs of nodes with only one child are compressed into a
+ *	single edge, and a lookup touches at most one node per bit
+ *	which actually distinguishes two stored prefixes.
+ *
+ *	Lookups are lock-free.  Writers are serialised by a mutex, and
+ *	only ever publish fully initialised nodes, so a reader racing
+ *	a writer sees either the old or the new shape of the trie.
+ *	Nodes are never freed until the trie itself is freed, which
+ *	means removal just clears the data pointer.
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#define aquire(_var)		atomic_load_explicit(&(_var), memory_order_acquire)
+#define store(_store, _var)	atomic_store_explicit(&(_store), _var, memory_order_release)
+
+typedef struct fr_trie_node_t fr_trie_node_t;
+
+struct fr_trie_node_t {
+	_Atomic(fr_trie_node_t *)	child[2];	//!< Next node if the following bit is 0 or 1.
+	_Atomic(void *)			data;		//!< User data, or NULL for internal nodes.
+	size_t				bits;		//!< Length of the prefix leading to this node.
+	uint8_t				key[];		//!< The prefix itself.
+};
+
+struct fr_trie_t {
+	fr_trie_node_t		*root;			//!< Zero length prefix, always present.
+	size_t			max_bits;		//!< Longest key we accept.
+	size_t			key_len;		//!< Bytes needed to store max_bits.
+	uint32_t		num_elements;		//!< Number of prefixes with data.
+	pthread_mutex_t		mutex;			//!< Serialises writers.
+};
+
+/** Return bit "num" of a key, MSB first
+ *
+ */
+static inline int trie_bit(uint8_t const *key, size_t num)
+{
+	return (key[num >> 3] >> (7 - (num & 0x07))) & 0x01;
+}
+
+/** Return the number of leading bits which are identical in two keys
+ *
+ * @param[in] a		first key.
+ * @param[in] b		second key.
+ * @param[in] max	number of bits to compare.
+ * @return the length of the common prefix, which is at most max.
+ */
+static size_t trie_common_bits(uint8_t const *a, uint8_t const *b, size_t max)
+{
+	size_t	i, bits = 0;
+	uint8_t	diff;
+
+	for (i = 0; bits < max; i++, bits += 8) {
+		diff = a[i] ^ b[i];
+		if (!diff) continue;
+
+		while (!(diff & 0x80)) {
+			diff <<= 1;
+			bits++;
+		}
+		break;
+	}
+
+	if (bits > max) return max;
+
+	return bits;
+}
+
+static fr_trie_node_t *trie_node_alloc(fr_trie_t *ft, uint8_t const *key, size_t bits, void *data)
+{
+	fr_trie_node_t *node;
+
+	node = talloc_zero_size(ft, sizeof(*node) + ft->key_len);
+	if (!node) return NULL;
+	talloc_set_name_const(node, "fr_trie_node_t");
+
+	memcpy(node->key, key, (bits + 7) >> 3);
+	node->bits = bits;
+	atomic_init(&node->child[0], NULL);
+	atomic_init(&node->child[1], NULL);
+	atomic_init(&node->data, data);
+
+	return node;
+}
+
+static int _trie_free(fr_trie_t *ft)
+{
+	pthread_mutex_destroy(&ft->mutex);
+
+	return 0;
+}
+
+/** Create a new trie
+ *
+ * @param[in] ctx	to allocate the trie in.
+ * @param[in] max_bits	the length of the longest key, e.g. 32 for IPv4 prefixes.
+ * @return
+ *	- New trie on success.
+ *	- NULL on error.
+ */
+fr_trie_t *fr_trie_create(TALLOC_CTX *ctx, size_t max_bits)
+{
+	fr_trie_t	*ft;
+	uint8_t		zero = 0;
+
+	if (!max_bits) return NULL;
+
+	ft = talloc_zero(ctx, fr_trie_t);
+	if (!ft) return NULL;
+
+	ft->max_bits = max_bits;
+	ft->key_len = (max_bits + 7) >> 3;
+
+	ft->root = trie_node_alloc(ft, &zero, 0, NULL);
+	if (!ft->root) {
+		talloc_free(ft);
+		return NULL;
+	}
+
+	pthread_mutex_init(&ft->mutex, NULL);
+	talloc_set_destructor(ft, _trie_free);
+
+	return ft;
+}
+
+/** Insert data against a prefix
+ *
+ * @param[in] ft	to insert into.
+ * @param[in] key	the prefix, MSB first.  Bits after "bits" are ignored.
+ * @param[in] bits	the length of the prefix.
+ * @param[in] data	to store.  Must not be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the prefix already has data, or on error.
+ */
+int fr_trie_insert(fr_trie_t *ft, void const *key, size_t bits, void *data)
+{
+	fr_trie_node_t	*node, *next, *split, *leaf;
+	uint8_t const	*k = key;
+	size_t		common;
+	int		rcode = -1;
+
+	if (bits > ft->max_bits) {
+		fr_strerror_printf("Prefix length %zu exceeds maximum of %zu", bits, ft->max_bits);
+		return -1;
+	}
+
+	pthread_mutex_lock(&ft->mutex);
+
+	node = ft->root;
+	for (;;) {
+		int b;
+
+		/*
+		 *	Invariant: node->key is a prefix of key.
+		 */
+		if (node->bits == bits) {
+			if (aquire(node->data)) {
+				fr_strerror_printf("Prefix already exists");
+				goto done;
+			}
+			store(node->data, data);
+			break;
+		}
+
+		b = trie_bit(k, node->bits);
+		next = aquire(node->child[b]);
+
+		/*
+		 *	Nothing below us, hang a new leaf here.
+		 */
+		if (!next) {
+			leaf = trie_node_alloc(ft, k, bits, data);
+			if (!leaf) goto done;
+
+			store(node->child[b], leaf);
+			break;
+		}
+
+		common = trie_common_bits(next->key, k, next->bits < bits ? next->bits : bits);
+		if (common == next->bits) {
+			node = next;
+			continue;
+		}
+
+		/*
+		 *	The new prefix sits part way along the edge
+		 *	to "next".  Insert a node at the split point,
+		 *	and only then link it into the trie.
+		 */
+		if (common == bits) {
+			split = trie_node_alloc(ft, k, bits, data);
+			if (!split) goto done;
+
+			atomic_init(&split->child[trie_bit(next->key, bits)], next);
+			store(node->child[b], split);
+			break;
+		}
+
+		split = trie_node_alloc(ft, k, common, NULL);
+		if (!split) goto done;
+
+		leaf = trie_node_alloc(ft, k, bits, data);
+		if (!leaf) {
+			talloc_free(split);
+			goto done;
+		}
+
+		atomic_init(&split->child[trie_bit(next->key, common)], next);
+		atomic_init(&split->child[trie_bit(k, common)], leaf);
+		store(node->child[b], split);
+		break;
+	}
+
+	ft->num_elements++;
+	rcode = 0;
+
+done:
+	pthread_mutex_unlock(&ft->mutex);
+
+	return rcode;
+}
+
+/** Find the node holding exactly the given prefix
+ *
+ */
+static fr_trie_node_t *trie_node_find(fr_trie_t *ft, uint8_t const *key, size_t bits)
+{
+	fr_trie_node_t *node = ft->root;
+
+	while (node && (node->bits < bits)) {
+		node = aquire(node->child[trie_bit(key, node->bits)]);
+	}
+
+	if (!node || (node->bits != bits)) return NULL;
+
+	if (trie_common_bits(node->key, key, bits) != bits) return NULL;
+
+	return node;
+}
+
+/** Find data stored against an exact prefix
+ *
+ * @param[in] ft	to search in.
+ * @param[in] key	the prefix, MSB first.
+ * @param[in] bits	the length of the prefix.
+ * @return
+ *	- The data stored against the prefix.
+ *	- NULL if there is no such prefix.
+ */
+void *fr_trie_find(fr_trie_t *ft, void const *key, size_t bits)
+{
+	fr_trie_node_t *node;
+
+	if (bits > ft->max_bits) return NULL;
+
+	node = trie_node_find(ft, key, bits);
+	if (!node) return NULL;
+
+	return aquire(node->data);
+}
+
+/** Find the data stored against the longest prefix of a key
+ *
+ * Every prefix of the key which has data is a candidate.  If a
+ * match callback is provided, candidates it rejects are skipped,
+ * and the next shortest prefix is tried.
+ *
+ * @param[in] ft	to search in.
+ * @param[in] key	to look up, MSB first.
+ * @param[in] bits	the length of the key.
+ * @param[in] match	optional callback to filter candidates.
+ * @param[in] uctx	passed to the callback.
+ * @return
+ *	- The data stored against the longest acceptable prefix.
+ *	- NULL if no prefix matched.
+ */
+void *fr_trie_match(fr_trie_t *ft, void const *key, size_t bits, fr_trie_match_t match, void *uctx)
+{
+	fr_trie_node_t	*node = ft->root;
+	uint8_t const	*k = key;
+	void		*data, *found = NULL;
+
+	if (bits > ft->max_bits) bits = ft->max_bits;
+
+	/*
+	 *	Walk down the trie.  Nodes further down have longer
+	 *	prefixes, so the last acceptable one wins.
+	 */
+	while (node) {
+		if (node->bits > bits) break;
+
+		if (trie_common_bits(node->key, k, node->bits) != node->bits) break;
+
+		data = aquire(node->data);
+		if (data && (!match || match(uctx, data))) found = data;
+
+		if (node->bits == bits) break;
+
+		node = aquire(node->child[trie_bit(k, node->bits)]);
+	}
+
+	return found;
+}
+
+/** Remove the data stored against an exact prefix
+ *
+ * @note The node is left in the trie, so that concurrent readers
+ *	never follow a pointer to freed memory.  Any memory used by
+ *	the data must not be freed until those readers are done with it.
+ *
+ * @param[in] ft	to remove from.
+ * @param[in] key	the prefix, MSB first.
+ * @param[in] bits	the length of the prefix.
+ * @return
+ *	- The data which was stored against the prefix.
+ *	- NULL if there was no such prefix.
+ */
+void *fr_trie_remove(fr_trie_t *ft, void const *key, size_t bits)
+{
+	fr_trie_node_t	*node;
+	void		*data = NULL;
+
+	if (bits > ft->max_bits) return NULL;
+
+	pthread_mutex_lock(&ft->mutex);
+	node = trie_node_find(ft, key, bits);
+	if (node) {
+		data = aquire(node->data);
+		if (data) {
+			store(node->data, NULL);
+			ft->num_elements--;
+		}
+	}
+	pthread_mutex_unlock(&ft->mutex);
+
+	return data;
+}
+
+/** Return the number of prefixes which have data
+ *
+ */
+uint32_t fr_trie_num_elements(fr_trie_t *ft)
+{
+	return ft->num_elements;
+}
@@ -239,3 +239,137 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 
 	return received;
 }
+
+#define UDP_CMSG_SIZE	(128)
+
+/** Read many UDP packets with one system call
+ *
+ * Where recvmmsg() is available, this blocks (if the socket is
+ * blocking) until one packet arrives, and then returns any others
+ * which are already waiting, up to "num".  Otherwise it reads one
+ * packet.
+ *
+ * The destination address of each packet is the one the client sent
+ * it to, as with udp_recv(), provided udpfromto_init() was called on
+ * the socket.  Otherwise it's the address the socket is bound to.
+ * The caller passes that in, as it's the same for every batch, and
+ * the kernel doesn't give us the destination port.
+ *
+ * @param[in] sockfd we're reading from.
+ * @param[in,out] packets buffers to read into.  On return, the first
+ *	packets are filled in.  A packet with an unknown source address
+ *	family has data_len set to zero, and should be ignored.
+ * @param[in] num the number of buffers.  At most UDP_MMSG_MAX are used.
+ * @param[in] flags for things.  UDP_FLAGS_PEEK is not supported.
+ * @param[in] ipaddr the socket is bound to.
+ * @param[in] port the socket is bound to.
+ * @return
+ *	- > 0 the number of packets read.
+ *	- 0 if there were no packets.
+ *	- < 0 on failure.
+ */
+int udp_recv_mmsg(int sockfd, udp_mmsg_t *packets, int num, int flags,
+		  fr_ipaddr_t const *ipaddr, uint16_t port)
+{
+#ifdef __linux__
+	int			i, received;
+	struct mmsghdr		msgs[UDP_MMSG_MAX];
+	struct iovec		iov[UDP_MMSG_MAX];
+	struct sockaddr_storage	src[UDP_MMSG_MAX];
+#  ifdef WITH_UDPFROMTO
+	char			cbuf[UDP_MMSG_MAX][UDP_CMSG_SIZE];
+#  else
+	struct timeval		now;
+#  endif
+	struct sockaddr_storage	bound;
+	socklen_t		sizeof_bound;
+
+	if ((flags & UDP_FLAGS_PEEK) != 0) {
+		fr_strerror_printf("Cannot peek at multiple packets");
+		return -1;
+	}
+
+	if (num <= 0) return 0;
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	if (!fr_ipaddr_to_sockaddr(ipaddr, port, &bound, &sizeof_bound)) {
+		fr_strerror_printf("Invalid socket address");
+		return -1;
+	}
+
+	memset(msgs, 0, sizeof(msgs[0]) * num);
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = packets[i].data;
+		iov[i].iov_len = packets[i].data_len;
+
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &src[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(src[i]);
+#  ifdef WITH_UDPFROMTO
+		msgs[i].msg_hdr.msg_control = cbuf[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+#  endif
+	}
+
+	received = recvmmsg(sockfd, msgs, num, MSG_WAITFORONE, NULL);
+	if (received < 0) {
+		if ((errno == EAGAIN) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("Failed reading packets: %s", fr_syserror(errno));
+		return -1;
+	}
+
+#  ifndef WITH_UDPFROMTO
+	gettimeofday(&now, NULL);
+#  endif
+
+	for (i = 0; i < received; i++) {
+		udp_mmsg_t		*packet = &packets[i];
+		struct sockaddr_storage	dst = bound;
+		socklen_t		sizeof_dst = sizeof_bound;
+
+		packet->data_len = msgs[i].msg_len;
+
+		if (!fr_ipaddr_from_sockaddr(&src[i], msgs[i].msg_hdr.msg_namelen,
+					     &packet->src_ipaddr, &packet->src_port)) {
+			packet->data_len = 0;
+			continue;
+		}
+
+#  ifdef WITH_UDPFROMTO
+		udpfromto_recv_cmsg(&msgs[i].msg_hdr, (struct sockaddr *) &dst, &sizeof_dst,
+				    &packet->if_index, &packet->when);
+#  else
+		packet->if_index = 0;
+		packet->when = now;
+#  endif
+
+		fr_ipaddr_from_sockaddr(&dst, sizeof_dst, &packet->dst_ipaddr, &packet->dst_port);
+	}
+
+	return received;
+#else
+	ssize_t received;
+
+	if (num <= 0) return 0;
+
+	(void) ipaddr;
+	(void) port;
+
+	received = udp_recv(sockfd, packets[0].data, packets[0].data_len, flags,
+			    &packets[0].src_ipaddr, &packets[0].src_port,
+			    &packets[0].dst_ipaddr, &packets[0].dst_port,
+			    &packets[0].if_index, &packets[0].when);
+	if (received < 0) {
+		if ((errno == EAGAIN) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("Failed reading packet: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	packets[0].data_len = received;
+
+	return 1;
+#endif
+}
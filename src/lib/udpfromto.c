@@ -190,7 +190,6 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	       int *if_index, struct timeval *when)
 {
 	struct msghdr		msgh;
-	struct cmsghdr		*cmsg;
 	struct iovec		iov;
 	char			cbuf[256];
 	int			ret;
@@ -293,6 +292,30 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 
 	if (from_len) *from_len = msgh.msg_namelen;
 
+	udpfromto_recv_cmsg(&msgh, to, to_len, if_index, when);
+
+	return ret;
+}
+
+/** Get the destination address, interface, and timestamp from a received message
+ *
+ * Used by recvfromto(), and by callers which read many messages at
+ * once with recvmmsg().
+ *
+ * @param[in] msgh	as filled in by recvmsg().
+ * @param[in,out] to	The destination address.  Should be initialised to the
+ *			address the socket is bound to, as it is only updated if
+ *			the kernel provided a more specific address.
+ * @param[out] to_len	Length of the structure pointed to by to.
+ * @param[out] if_index	The interface which received the datagram (may be NULL).
+ * @param[out] when	the packet was received (may be NULL).  If SO_TIMESTAMP is
+ *			not available, gettimeofday will be used instead.
+ */
+void udpfromto_recv_cmsg(struct msghdr *msgh, struct sockaddr *to, socklen_t *to_len,
+			 int *if_index, struct timeval *when)
+{
+	struct cmsghdr *cmsg;
+
 	if (if_index) *if_index = 0;
 	if (when) {
 		when->tv_sec = 0;
@@ -300,9 +323,9 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	}
 
 	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
+	for (cmsg = CMSG_FIRSTHDR(msgh);
 	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
 
 #ifdef IP_PKTINFO
 		if ((cmsg->cmsg_level == SOL_IP) &&
@@ -353,8 +376,6 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	}
 
 	if (when && !when->tv_sec) gettimeofday(when, NULL);
-
-	return ret;
 }
 
 /** Send packet via a file descriptor, setting the src address and outbound interface
@@ -33,6 +33,13 @@ RCSID("$Id$")
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
 
 #ifdef WITH_DYNAMIC_CLIENTS
 #ifdef HAVE_DIRENT_H
@@ -40,15 +47,46 @@ RCSID("$Id$")
 #endif
 #endif
 
+typedef struct client_entry_t client_entry_t;
+
+/** One client in a prefix bucket
+ *
+ * Allocated as a child of the client, so it lives exactly as long as
+ * the client does, including any deferred free of dynamic clients.
+ */
+struct client_entry_t {
+	RADCLIENT			*client;
+	_Atomic(client_entry_t *)	next;
+};
+
+/** All clients sharing one address and prefix
+ *
+ * They differ by protocol, or by IPv6 zone.  Buckets are never freed
+ * before the list itself, so lookups can run without locks.
+ */
+typedef struct client_bucket_t {
+	_Atomic(client_entry_t *)	head;
+} client_bucket_t;
+
 /** Group of clients
  *
  */
 struct radclient_list {
 	char const	*name;			//!< Name of the client list.
-	rbtree_t	*trees[129];		//!< For 0..128, inclusive.
-	uint32_t       	min_prefix;
+	fr_trie_t	*v4;			//!< IPv4 prefixes -> client_bucket_t.
+	fr_trie_t	*v6;			//!< IPv6 prefixes -> client_bucket_t.
+	pthread_mutex_t	mutex;			//!< Serialises client_add() and client_delete().
 };
 
+/** Lookup context for client_find()
+ *
+ */
+typedef struct client_match_t {
+	fr_ipaddr_t const	*ipaddr;	//!< Source address of the packet.
+	int			proto;		//!< Transport protocol, or IPPROTO_IP for any.
+	RADCLIENT		*found;		//!< Client for the longest acceptable prefix.
+} client_match_t;
+
 #ifdef WITH_STATS
 static rbtree_t		*tree_num = NULL;	//!< client numbers 0..N.
 static int		tree_num_max = 0;
@@ -146,6 +184,62 @@ static int client_num_cmp(void const *one, void const *two)
 }
 #endif
 
+static int _client_list_free(RADCLIENT_LIST *clients)
+{
+	pthread_mutex_destroy(&clients->mutex);
+
+	return 0;
+}
+
+/** Return the prefix trie for an address family
+ *
+ */
+static fr_trie_t *client_trie(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, uint8_t const **key)
+{
+	switch (ipaddr->af) {
+	case AF_INET:
+		*key = (uint8_t const *) &ipaddr->ipaddr.ip4addr;
+		return clients->v4;
+
+	case AF_INET6:
+		*key = (uint8_t const *) &ipaddr->ipaddr.ip6addr;
+		return clients->v6;
+
+	default:
+		return NULL;
+	}
+}
+
+/** Find a client in a bucket which matches the packet
+ *
+ * Called by fr_trie_match() for every prefix of the packet's source
+ * address, shortest first.
+ */
+static bool client_match(void *uctx, void const *data)
+{
+	client_match_t		*m = uctx;
+	client_bucket_t const	*bucket = data;
+	client_entry_t		*entry;
+
+	for (entry = atomic_load_explicit(&bucket->head, memory_order_acquire);
+	     entry;
+	     entry = atomic_load_explicit(&entry->next, memory_order_acquire)) {
+		RADCLIENT *client = entry->client;
+
+		if ((client->ipaddr.af == AF_INET6) && (client->ipaddr.zone_id != m->ipaddr->zone_id)) continue;
+
+#ifdef WITH_TCP
+		if ((m->proto != IPPROTO_IP) && (client->proto != IPPROTO_IP) &&
+		    (client->proto != m->proto)) continue;
+#endif
+
+		m->found = client;
+		return true;
+	}
+
+	return false;
+}
+
 /** Return a new client list
  *
  * @note The container won't contain any clients.
@@ -161,7 +255,16 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 	if (!clients) return NULL;
 
 	clients->name = talloc_strdup(clients, cs ? cf_section_name1(cs) : "root");
-	clients->min_prefix = 128;
+
+	clients->v4 = fr_trie_create(clients, 32);
+	clients->v6 = fr_trie_create(clients, 128);
+	if (!clients->v4 || !clients->v6) {
+		talloc_free(clients);
+		return NULL;
+	}
+
+	pthread_mutex_init(&clients->mutex, NULL);
+	talloc_set_destructor(clients, _client_list_free);
 
 	return clients;
 }
@@ -176,8 +279,12 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
  */
 bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
-	RADCLIENT *old;
-	char buffer[FR_IPADDR_PREFIX_STRLEN];
+	RADCLIENT		*old;
+	fr_trie_t		*trie;
+	uint8_t const		*key;
+	client_bucket_t		*bucket;
+	client_entry_t		*entry;
+	char			buffer[FR_IPADDR_PREFIX_STRLEN];
 
 	if (!client) return false;
 
@@ -203,7 +310,7 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	}
 
 	fr_inet_ntop_prefix(buffer, sizeof(buffer), &client->ipaddr);
-	DEBUG3("Adding client %s (%s) to prefix tree %i", buffer, client->longname, client->ipaddr.prefix);
+	DEBUG3("Adding client %s (%s) to prefix trie, prefix %i", buffer, client->longname, client->ipaddr.prefix);
 
 	/*
 	 *	If the client also defines a server, do that now.
@@ -264,14 +371,35 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 		}
 	}
 
+#ifdef WITH_STATS
+	/*
+	 *	If this fails, the client just has no latency histogram.
+	 */
+	if (!client->latency) client->latency = fr_stats_latency_alloc(client);
+#endif
+
+	trie = client_trie(clients, &client->ipaddr, &key);
+	if (!trie) return false;
+
+	pthread_mutex_lock(&clients->mutex);
+
 	/*
-	 *	Create a tree for it.
+	 *	Create a bucket for the prefix.
 	 */
-	if (!clients->trees[client->ipaddr.prefix]) {
-		clients->trees[client->ipaddr.prefix] = rbtree_create(clients, client_ipaddr_cmp, NULL, 0);
-		if (!clients->trees[client->ipaddr.prefix]) {
+	bucket = fr_trie_find(trie, key, client->ipaddr.prefix);
+	if (!bucket) {
+		bucket = talloc_zero(clients, client_bucket_t);
+		if (!bucket) {
+		error:
+			pthread_mutex_unlock(&clients->mutex);
 			return false;
 		}
+		atomic_init(&bucket->head, NULL);
+
+		if (fr_trie_insert(trie, key, client->ipaddr.prefix, bucket) < 0) {
+			talloc_free(bucket);
+			goto error;
+		}
 	}
 
 #define namecmp(a) ((!old->a && !client->a) || (old->a && client->a && (strcmp(old->a, client->a) == 0)))
@@ -279,8 +407,15 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	/*
 	 *	Cannot insert the same client twice.
 	 */
-	old = rbtree_finddata(clients->trees[client->ipaddr.prefix], client);
-	if (old) {
+	for (entry = atomic_load_explicit(&bucket->head, memory_order_relaxed);
+	     entry;
+	     entry = atomic_load_explicit(&entry->next, memory_order_relaxed)) {
+		if (client_ipaddr_cmp(entry->client, client) == 0) break;
+	}
+	if (entry) {
+		old = entry->client;
+		pthread_mutex_unlock(&clients->mutex);
+
 		/*
 		 *	If it's a complete duplicate, then free the new
 		 *	one, and return "OK".
@@ -311,11 +446,18 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 #undef namecmp
 
 	/*
-	 *	Other error adding client: likely is fatal.
+	 *	Link the client in.  The entry is fully initialised
+	 *	before it's published, so concurrent lookups see
+	 *	either the old list, or the new one.
 	 */
-	if (!rbtree_insert(clients->trees[client->ipaddr.prefix], client)) {
-		return false;
-	}
+	entry = talloc_zero(client, client_entry_t);
+	if (!entry) goto error;
+
+	entry->client = client;
+	atomic_init(&entry->next, atomic_load_explicit(&bucket->head, memory_order_relaxed));
+	atomic_store_explicit(&bucket->head, entry, memory_order_release);
+
+	pthread_mutex_unlock(&clients->mutex);
 
 #ifdef WITH_STATS
 	if (!tree_num) {
@@ -349,10 +491,6 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	if (tree_num) rbtree_insert(tree_num, client);
 #endif
 
-	if (client->ipaddr.prefix < clients->min_prefix) {
-		clients->min_prefix = client->ipaddr.prefix;
-	}
-
 	(void) talloc_steal(clients, client); /* reparent it */
 
 	return true;
@@ -362,6 +500,12 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_DYNAMIC_CLIENTS
 void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
+	fr_trie_t			*trie;
+	uint8_t const			*key;
+	client_bucket_t			*bucket;
+	_Atomic(client_entry_t *)	*prev;
+	client_entry_t			*entry;
+
 	if (!client) return;
 
 	if (!clients) clients = root_clients;
@@ -375,7 +519,30 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_STATS
 	rbtree_deletebydata(tree_num, client);
 #endif
-	rbtree_deletebydata(clients->trees[client->ipaddr.prefix], client);
+
+	trie = client_trie(clients, &client->ipaddr, &key);
+	if (!trie) return;
+
+	pthread_mutex_lock(&clients->mutex);
+	bucket = fr_trie_find(trie, key, client->ipaddr.prefix);
+	if (bucket) {
+		/*
+		 *	Unlink the entry, but leave its "next" pointer
+		 *	alone.  Lookups which are currently looking at
+		 *	it can still continue down the list.  The entry
+		 *	is freed along with the client.
+		 */
+		for (prev = &bucket->head;
+		     (entry = atomic_load_explicit(prev, memory_order_relaxed)) != NULL;
+		     prev = &entry->next) {
+			if (entry->client != client) continue;
+
+			atomic_store_explicit(prev, atomic_load_explicit(&entry->next, memory_order_relaxed),
+					      memory_order_release);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&clients->mutex);
 }
 #endif
 
@@ -410,45 +577,38 @@ RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int
 #endif
 
 
-/*
- *	Find a client in the RADCLIENTS list.
+/** Find a client in the RADCLIENTS list
+ *
+ * Performs a longest prefix match on the address, skipping prefixes
+ * which only have clients for a different protocol.
+ *
+ * @param[in] clients	to search, or NULL for the global list.
+ * @param[in] ipaddr	source address of the packet.
+ * @param[in] proto	transport protocol, or IPPROTO_IP to match any.
+ * @return
+ *	- The client with the longest matching prefix.
+ *	- NULL if no client matched.
  */
 RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
-	int32_t i, max_prefix;
-	RADCLIENT myclient;
+	fr_trie_t	*trie;
+	uint8_t const	*key;
+	client_match_t	m;
 
 	if (!clients) clients = root_clients;
 
 	if (!clients || !ipaddr) return NULL;
 
-	switch (ipaddr->af) {
-	case AF_INET:
-		max_prefix = 32;
-		break;
-
-	case AF_INET6:
-		max_prefix = 128;
-		break;
-
-	default :
-		return NULL;
-	}
-
-	for (i = max_prefix; i >= (int32_t) clients->min_prefix; i--) {
-		void *data;
+	trie = client_trie(clients, ipaddr, &key);
+	if (!trie) return NULL;
 
-		if (!clients->trees[i]) continue;
+	m.ipaddr = ipaddr;
+	m.proto = proto;
+	m.found = NULL;
 
-		myclient.ipaddr = *ipaddr;
-		myclient.proto = proto;
-		fr_ipaddr_mask(&myclient.ipaddr, i);
+	if (!fr_trie_match(trie, key, (ipaddr->af == AF_INET) ? 32 : 128, client_match, &m)) return NULL;
 
-		data = rbtree_finddata(clients->trees[i], &myclient);
-		if (data) return data;
-	}
-
-	return NULL;
+	return m.found;
 }
 
 /*
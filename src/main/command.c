@@ -2670,12 +2670,113 @@ static int command_print_stats(rad_listen_t *listener, fr_stats_t *stats,
 	return CMD_OK;
 }
 
-static int command_stats_state(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+/*
+ *	Latency percentiles, in microseconds.
+ */
+static int command_print_latency(rad_listen_t *listener, fr_stats_hist_t const *hist)
+{
+	cprintf(listener, "latency.count\t" PU "\n", hist->count);
+	cprintf(listener, "latency.mean\t%" PRIu64 "\n", hist->count ? (hist->total_usec / hist->count) : 0);
+	cprintf(listener, "latency.p50\t%u\n", fr_stats_hist_percentile(hist, 50));
+	cprintf(listener, "latency.p90\t%u\n", fr_stats_hist_percentile(hist, 90));
+	cprintf(listener, "latency.p99\t%u\n", fr_stats_hist_percentile(hist, 99));
+	cprintf(listener, "latency.p99.9\t%u\n", fr_stats_hist_percentile(hist, 99.9));
+	cprintf(listener, "latency.max\t%u\n", hist->max_usec);
+
+	return CMD_OK;
+}
+
+static int command_stats_state(rad_listen_t *listener, int argc, char *argv[])
 {
+	uint32_t		i, num_shards;
+	fr_state_shard_stats_t	stats;
+
+	if ((argc > 0) && (strcmp(argv[0], "shards") != 0)) {
+		cprintf_error(listener, "Must use 'stats state [shards]'\n");
+		return CMD_FAIL;
+	}
+
 	cprintf(listener, "states_created\t\t%" PRIu64 "\n", fr_state_entries_created(global_state));
 	cprintf(listener, "states_timeout\t\t%" PRIu64 "\n", fr_state_entries_timeout(global_state));
 	cprintf(listener, "states_tracked\t\t%" PRIu32 "\n", fr_state_entries_tracked(global_state));
 
+	num_shards = fr_state_num_shards(global_state);
+	cprintf(listener, "states_shards\t\t%" PRIu32 "\n", num_shards);
+
+	if (argc == 0) return CMD_OK;
+
+	/*
+	 *	One line per shard, so uneven distribution
+	 *	or hot locks are easy to spot.
+	 */
+	for (i = 0; i < num_shards; i++) {
+		if (fr_state_shard_stats(&stats, global_state, i) < 0) break;
+
+		cprintf(listener, "shard %" PRIu32 "\ttracked %" PRIu32 "\ttimeout %" PRIu64
+			"\tlocked %" PRIu64 "\tcontended %" PRIu64 "\n",
+			i, stats.tracked, stats.timed_out, stats.locked, stats.contended);
+	}
+
+	return CMD_OK;
+}
+
+static int command_stats_requests(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	request_pool_stats_t stats;
+
+	request_pool_stats(&stats);
+
+	cprintf(listener, "requests		%" PRIu64 "\n", stats.requests);
+	cprintf(listener, "sampled			%" PRIu64 "\n", stats.samples);
+	cprintf(listener, "allocations_per_request	%" PRIu64 "\n", stats.blocks);
+	cprintf(listener, "bytes_per_request	%" PRIu64 "\n", stats.bytes);
+	cprintf(listener, "pool_size		%zu\n", stats.pool_size);
+
+	return CMD_OK;
+}
+
+typedef struct {
+	rad_listen_t	*listener;
+	char const	*name;		//!< Only print this one.
+	bool		found;
+} command_latency_ctx_t;
+
+static int command_stats_latency_print(char const *name, fr_stats_hist_t const *hist, void *uctx)
+{
+	command_latency_ctx_t *ctx = uctx;
+
+	if (ctx->name) {
+		if (strcmp(ctx->name, name) != 0) return 0;
+
+		ctx->found = true;
+		command_print_latency(ctx->listener, hist);
+		return 1;
+	}
+
+	cprintf(ctx->listener, "%s\tcount " PU "\tmean %" PRIu64 "\tp50 %u\tp90 %u\tp99 %u\tp99.9 %u\tmax %u\n",
+		name, hist->count, hist->count ? (hist->total_usec / hist->count) : 0,
+		fr_stats_hist_percentile(hist, 50), fr_stats_hist_percentile(hist, 90),
+		fr_stats_hist_percentile(hist, 99), fr_stats_hist_percentile(hist, 99.9), hist->max_usec);
+
+	return 0;
+}
+
+static int command_stats_latency(rad_listen_t *listener, int argc, char *argv[])
+{
+	command_latency_ctx_t ctx = { .listener = listener };
+
+	if (argc > 0) ctx.name = argv[0];
+
+	if (fr_stats_latency_walk(command_stats_latency_print, &ctx) < 0) {
+		cprintf_error(listener, "Out of memory\n");
+		return CMD_FAIL;
+	}
+
+	if (ctx.name && !ctx.found) {
+		cprintf_error(listener, "No such section or module '%s'\n", ctx.name);
+		return CMD_FAIL;
+	}
+
 	return CMD_OK;
 }
 
@@ -2779,7 +2880,9 @@ static int command_stats_detail(rad_listen_t *listener, int argc, char *argv[])
 #ifdef WITH_PROXY
 static int command_stats_home_server(rad_listen_t *listener, int argc, char *argv[])
 {
-	home_server_t *home;
+	home_server_t		*home;
+	fr_stats_shard_t	sum;
+	fr_stats_hist_t		latency;
 
 	if (argc == 0) {
 		cprintf_error(listener, "Must specify [auth|acct|coa|disconnect] OR <ipaddr> <port>\n");
@@ -2787,29 +2890,31 @@ static int command_stats_home_server(rad_listen_t *listener, int argc, char *arg
 	}
 
 	if (argc == 1) {
+		radius_stats_sum(&sum);
+
 		if (strcmp(argv[0], "auth") == 0) {
 			return command_print_stats(listener,
-						   &proxy_auth_stats, 1, 1);
+						   &sum.proxy_auth, 1, 1);
 		}
 
 #ifdef WITH_ACCOUNTING
 		if (strcmp(argv[0], "acct") == 0) {
 			return command_print_stats(listener,
-						   &proxy_acct_stats, 0, 1);
+						   &sum.proxy_acct, 0, 1);
 		}
 #endif
 
 #ifdef WITH_ACCOUNTING
 		if (strcmp(argv[0], "coa") == 0) {
 			return command_print_stats(listener,
-						   &proxy_coa_stats, 0, 1);
+						   &sum.proxy_coa, 0, 1);
 		}
 #endif
 
 #ifdef WITH_ACCOUNTING
 		if (strcmp(argv[0], "disconnect") == 0) {
 			return command_print_stats(listener,
-						   &proxy_dsc_stats, 0, 1);
+						   &sum.proxy_dsc, 0, 1);
 		}
 #endif
 
@@ -2822,6 +2927,8 @@ static int command_stats_home_server(rad_listen_t *listener, int argc, char *arg
 
 	command_print_stats(listener, &home->stats,
 			    (home->type == HOME_TYPE_AUTH), 1);
+	fr_stats_latency_sum(&latency, home->latency);
+	command_print_latency(listener, &latency);
 	cprintf(listener, "outstanding\t%d\n", home->currently_outstanding);
 	return CMD_OK;
 }
@@ -2832,6 +2939,8 @@ static int command_stats_client(rad_listen_t *listener, int argc, char *argv[])
 	bool auth = true;
 	fr_stats_t *stats;
 	RADCLIENT *client, fake;
+	fr_stats_shard_t sum;
+	fr_stats_hist_t latency;
 
 	if (argc < 1) {
 		cprintf_error(listener, "Must specify [auth/acct]\n");
@@ -2842,13 +2951,15 @@ static int command_stats_client(rad_listen_t *listener, int argc, char *argv[])
 		/*
 		 *	Global statistics.
 		 */
-		fake.auth = radius_auth_stats;
+		radius_stats_sum(&sum);
+
+		fake.auth = sum.auth;
 #ifdef WITH_ACCOUNTING
-		fake.acct = radius_acct_stats;
+		fake.acct = sum.acct;
 #endif
 #ifdef WITH_COA
-		fake.coa = radius_coa_stats;
-		fake.dsc = radius_dsc_stats;
+		fake.coa = sum.coa;
+		fake.dsc = sum.dsc;
 #endif
 		client = &fake;
 
@@ -2903,13 +3014,15 @@ static int command_stats_client(rad_listen_t *listener, int argc, char *argv[])
 #ifdef WITH_ACCOUNTING
 		if (!auth) {
 			return command_print_stats(listener,
-						   &radius_acct_stats, auth, 0);
+						   &sum.acct, auth, 0);
 		}
 #endif
-		return command_print_stats(listener, &radius_auth_stats, auth, 0);
+		return command_print_stats(listener, &sum.auth, auth, 0);
 	}
 
-	return command_print_stats(listener, stats, auth, 0);
+	command_print_stats(listener, stats, auth, 0);
+	fr_stats_latency_sum(&latency, client->latency);
+	return command_print_latency(listener, &latency);
 }
 
 
@@ -3093,8 +3206,16 @@ static fr_command_table_t command_table_stats[] = {
 	  command_stats_home_server, NULL },
 #endif
 
+	{ "latency", FR_READ,
+	  "stats latency [<name>] - show latency percentiles for every virtual server section and module, or for one of them",
+	  command_stats_latency, NULL },
+
+	{ "requests", FR_READ,
+	  "stats requests - show the memory used by each request",
+	  command_stats_requests, NULL },
+
 	{ "state", FR_READ,
-	  "stats state - show statistics for states",
+	  "stats state [shards] - show statistics for states, optionally for each shard",
 	  command_stats_state, NULL },
 
 	{ "socket", FR_READ,
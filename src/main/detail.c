@@ -0,0 +1,211 @@
+/*
+ * detail.c	Read and write records in binary detail files.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+
+/*
+ *	The text detail format is easy to read, but every entry has to
+ *	be printed by rlm_detail, and parsed again by proto_detail.
+ *	Binary records hold the RADIUS packet itself, so writing one is
+ *	a copy, and reading one is a normal packet decode.
+ */
+
+/*
+ *	The CRC covers everything after the done flag.
+ */
+#define DETAIL_BINARY_CRC_START	(12)
+
+/** Build the header of a binary detail record
+ *
+ * @param[out] out where to write the header.
+ * @param[in] timestamp of the request the packet belongs to.
+ * @param[in] packet the data came from, for the source address and port.
+ * @param[in] data of the RADIUS packet, which is written after the header.
+ * @param[in] data_len length of the data.
+ */
+void detail_binary_header(uint8_t out[DETAIL_BINARY_HDR_LEN], struct timeval const *timestamp,
+			  RADIUS_PACKET const *packet, uint8_t const *data, size_t data_len)
+{
+	uint32_t	crc;
+
+	memset(out, 0, DETAIL_BINARY_HDR_LEN);
+	memcpy(out, DETAIL_BINARY_MAGIC, 4);
+
+	out[12] = (data_len >> 24) & 0xff;
+	out[13] = (data_len >> 16) & 0xff;
+	out[14] = (data_len >> 8) & 0xff;
+	out[15] = data_len & 0xff;
+
+	out[16] = (timestamp->tv_sec >> 24) & 0xff;
+	out[17] = (timestamp->tv_sec >> 16) & 0xff;
+	out[18] = (timestamp->tv_sec >> 8) & 0xff;
+	out[19] = timestamp->tv_sec & 0xff;
+
+	out[20] = (timestamp->tv_usec >> 24) & 0xff;
+	out[21] = (timestamp->tv_usec >> 16) & 0xff;
+	out[22] = (timestamp->tv_usec >> 8) & 0xff;
+	out[23] = timestamp->tv_usec & 0xff;
+
+	out[26] = (packet->src_port >> 8) & 0xff;
+	out[27] = packet->src_port & 0xff;
+
+	switch (packet->src_ipaddr.af) {
+	case AF_INET:
+		out[24] = 4;
+		memcpy(out + 28, &packet->src_ipaddr.ipaddr.ip4addr, 4);
+		break;
+
+	case AF_INET6:
+		out[24] = 6;
+		memcpy(out + 28, &packet->src_ipaddr.ipaddr.ip6addr, 16);
+		break;
+
+	default:
+		break;
+	}
+
+	crc = fr_crc32c(out + DETAIL_BINARY_CRC_START, DETAIL_BINARY_HDR_LEN - DETAIL_BINARY_CRC_START);
+	crc = fr_crc32c_update(data, data_len, crc);
+
+	out[4] = (crc >> 24) & 0xff;
+	out[5] = (crc >> 16) & 0xff;
+	out[6] = (crc >> 8) & 0xff;
+	out[7] = crc & 0xff;
+}
+
+/** Check whether a file holds binary detail records
+ *
+ * @param[in] in the start of the file.
+ * @param[in] inlen how much of the file there is.
+ * @return true if the file starts with a binary record.
+ */
+bool detail_binary_is(uint8_t const *in, size_t inlen)
+{
+	return (inlen >= 4) && (memcmp(in, DETAIL_BINARY_MAGIC, 4) == 0);
+}
+
+/*
+ *	Header fields are in network byte order.
+ */
+static inline uint32_t detail_uint32(uint8_t const *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/** Find the next record in a binary detail file
+ *
+ * If the header is damaged, the next record is found by searching for
+ * its magic.  Everyone who walks the file must use this function, so
+ * that they all agree on where the records start.
+ *
+ * @param[in] in where the current record starts.
+ * @param[in] inlen how much data there is.
+ * @return the offset from "in" of the next record, or inlen if there
+ *	isn't one.
+ */
+size_t detail_binary_next(uint8_t const *in, size_t inlen)
+{
+	uint8_t const	*next;
+	size_t		len;
+
+	if ((inlen >= DETAIL_BINARY_HDR_LEN) && (memcmp(in, DETAIL_BINARY_MAGIC, 4) == 0)) {
+		len = detail_uint32(in + 12);
+		if ((len >= 20 /* RADIUS_HDR_LEN */) && (len <= MAX_PACKET_LEN) &&
+		    ((DETAIL_BINARY_HDR_LEN + len) <= inlen)) return DETAIL_BINARY_HDR_LEN + len;
+	}
+
+	if (inlen <= 1) return inlen;
+
+	next = memmem(in + 1, inlen - 1, DETAIL_BINARY_MAGIC, 4);
+	if (!next) return inlen;
+
+	return next - in;
+}
+
+/** Decode one record from a binary detail file
+ *
+ * @param[out] out the record.  The data points into the input.
+ * @param[in] in where the record starts.
+ * @param[in] inlen how much data there is.
+ * @return
+ *	- The length of the record.
+ *	- 0 if the record is incomplete.
+ *	- -1 if the record is corrupt.
+ */
+ssize_t detail_binary_decode(detail_binary_t *out, uint8_t const *in, size_t inlen)
+{
+	size_t		len;
+	uint32_t	crc;
+
+	if (inlen < DETAIL_BINARY_HDR_LEN) return 0;
+
+	if (memcmp(in, DETAIL_BINARY_MAGIC, 4) != 0) {
+		fr_strerror_printf("Invalid magic");
+		return -1;
+	}
+
+	len = detail_uint32(in + 12);
+	if ((len < 20 /* RADIUS_HDR_LEN */) || (len > MAX_PACKET_LEN)) {
+		fr_strerror_printf("Invalid packet length %zu", len);
+		return -1;
+	}
+
+	if (inlen < (DETAIL_BINARY_HDR_LEN + len)) return 0;
+
+	crc = fr_crc32c(in + DETAIL_BINARY_CRC_START, (DETAIL_BINARY_HDR_LEN - DETAIL_BINARY_CRC_START) + len);
+	if (crc != detail_uint32(in + 4)) {
+		fr_strerror_printf("CRC mismatch");
+		return -1;
+	}
+
+	memset(out, 0, sizeof(*out));
+	out->done = (in[DETAIL_BINARY_DONE_OFFSET] != 0);
+	out->timestamp.tv_sec = detail_uint32(in + 16);
+	out->timestamp.tv_usec = detail_uint32(in + 20);
+	out->src_port = (in[26] << 8) | in[27];
+
+	switch (in[24]) {
+	case 4:
+		out->src_ipaddr.af = AF_INET;
+		out->src_ipaddr.prefix = 32;
+		memcpy(&out->src_ipaddr.ipaddr.ip4addr, in + 28, 4);
+		break;
+
+	case 6:
+		out->src_ipaddr.af = AF_INET6;
+		out->src_ipaddr.prefix = 128;
+		memcpy(&out->src_ipaddr.ipaddr.ip6addr, in + 28, 16);
+		break;
+
+	default:
+		out->src_ipaddr.af = AF_UNSPEC;
+		break;
+	}
+
+	out->data = in + DETAIL_BINARY_HDR_LEN;
+	out->data_len = len;
+
+	return DETAIL_BINARY_HDR_LEN + len;
+}
@@ -28,8 +28,15 @@
 #include <freeradius-devel/exfile.h>
 
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 typedef struct exfile_entry_t {
 	int			fd;			//!< File descriptor associated with an entry.
 	int			dup;
@@ -39,6 +46,55 @@ typedef struct exfile_entry_t {
 } exfile_entry_t;
 
 
+/** One record waiting to be written
+ *
+ */
+typedef struct exfile_record_t {
+	struct exfile_record_t	*next;
+	size_t			len;
+	uint8_t			data[];
+} exfile_record_t;
+
+/** The records waiting to be written to one file
+ *
+ * Any thread can push records onto head without locking.  Only the
+ * flusher takes them off.
+ */
+typedef struct exfile_queue_t {
+	_Atomic(exfile_record_t *) head;		//!< Newest record first.
+	exfile_record_t		*retry;			//!< Oldest first.  Records we failed to write.
+	size_t			retry_offset;		//!< How much of the first retry record was written.
+	char			*filename;
+	uint32_t		hash;			//!< Hash for cheap comparison.
+	mode_t			permissions;
+	gid_t			gid;			//!< Group to give the file, or -1.
+	time_t			last_used;		//!< Last time the flusher wrote to the file.
+	struct exfile_queue_t	*next;
+	struct exfile_queue_t	*flush_next;		//!< Next queue the flusher is writing out.
+} exfile_queue_t;
+
+/** State for buffered writes
+ *
+ */
+typedef struct exfile_buffer_t {
+	struct timeval		interval;		//!< Longest time a record waits to be written.
+	size_t			max_bytes;		//!< Write early when this much is waiting.
+	bool			sync;			//!< fdatasync() after each write.
+
+	pthread_rwlock_t	lock;			//!< Read lock to find a queue, write lock to
+							//!< add or remove one.
+	exfile_queue_t		*queues;
+	atomic_uint_fast64_t	pending;		//!< Bytes waiting to be written.
+
+	pthread_mutex_t		flush_mutex;		//!< Only one flush at a time.
+
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	pthread_cond_t		cond;			//!< Wakes the flusher.
+	pthread_t		flusher;
+	bool			running;		//!< Whether the flusher has been started.
+	bool			stop;			//!< Tell the flusher to exit.
+} exfile_buffer_t;
+
 struct exfile_t {
 	uint32_t		max_entries;		//!< How many file descriptors we keep track of.
 	uint32_t		max_idle;		//!< Maximum idle time for a descriptor.
@@ -49,6 +105,7 @@ struct exfile_t {
 	CONF_SECTION		*conf;			//!< Conf section to search for triggers.
 	char const		*trigger_prefix;	//!< Trigger path in the global trigger section.
 	VALUE_PAIR		*trigger_args;		//!< Arguments to pass to trigger.
+	exfile_buffer_t		*buffer;		//!< For exfile_append(), if buffered writes are enabled.
 };
 
 #define MAX_TRY_LOCK 4			//!< How many times we attempt to acquire a lock
@@ -111,10 +168,18 @@ static void exfile_cleanup_entry(exfile_t *ef, REQUEST *request, exfile_entry_t
 }
 
 
+static void exfile_buffer_free(exfile_t *ef);
+
 static int _exfile_free(exfile_t *ef)
 {
 	uint32_t i;
 
+	/*
+	 *	Write out anything which is still buffered, before
+	 *	closing the files.
+	 */
+	if (ef->buffer) exfile_buffer_free(ef);
+
 	pthread_mutex_lock(&ef->mutex);
 
 	for (i = 0; i < ef->max_entries; i++) {
@@ -500,3 +565,479 @@ int exfile_unlock(exfile_t *ef, REQUEST *request, int fd)
 	fr_strerror_printf("Attempt to unlock file which does not exist");
 	return -1;
 }
+
+/*
+ *	More than this many times max_bytes waiting, and we refuse new
+ *	records, rather than using unbounded memory when the disk
+ *	can't keep up.
+ */
+#define EXFILE_BUFFER_MAX_PENDING	(16)
+
+/*
+ *	Records written by one writev() call.
+ */
+#define EXFILE_BUFFER_IOV	(256)
+
+/** Enable buffered writes with exfile_append()
+ *
+ * Records are queued in memory, and written out by a flusher thread
+ * every "interval", or sooner if "max_bytes" are waiting.  All of the
+ * records for one file are written with one open, lock and writev(),
+ * and optionally one fdatasync().  This is much cheaper than locking
+ * the file for every record, at the cost of records being lost if the
+ * server exits before they're written.
+ *
+ * The flusher is started by the first call to exfile_append(), so
+ * that it's created after the server has forked.
+ *
+ * @param[in] ef to enable buffered writes for.
+ * @param[in] interval longest time a record is buffered for.
+ * @param[in] max_bytes write sooner if this many bytes are waiting.
+ * @param[in] sync call fdatasync() after every write, so that the
+ *	records are on disk, not just in the page cache.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int exfile_buffer_init(exfile_t *ef, struct timeval const *interval, size_t max_bytes, bool sync)
+{
+	exfile_buffer_t *buf;
+
+	if (ef->buffer) {
+		fr_strerror_printf("Buffered writes are already enabled");
+		return -1;
+	}
+
+	buf = talloc_zero(ef, exfile_buffer_t);
+	if (!buf) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	buf->interval = *interval;
+	buf->max_bytes = max_bytes ? max_bytes : 1;
+	buf->sync = sync;
+	atomic_init(&buf->pending, 0);
+
+	if (pthread_rwlock_init(&buf->lock, NULL) != 0) {
+	error:
+		fr_strerror_printf("Failed initialising locks: %s", fr_syserror(errno));
+		talloc_free(buf);
+		return -1;
+	}
+
+	if (pthread_mutex_init(&buf->flush_mutex, NULL) != 0) {
+		pthread_rwlock_destroy(&buf->lock);
+		goto error;
+	}
+
+	if (pthread_mutex_init(&buf->mutex, NULL) != 0) {
+		pthread_mutex_destroy(&buf->flush_mutex);
+		pthread_rwlock_destroy(&buf->lock);
+		goto error;
+	}
+
+	if (pthread_cond_init(&buf->cond, NULL) != 0) {
+		pthread_mutex_destroy(&buf->mutex);
+		pthread_mutex_destroy(&buf->flush_mutex);
+		pthread_rwlock_destroy(&buf->lock);
+		goto error;
+	}
+
+	ef->buffer = buf;
+
+	return 0;
+}
+
+/** Write out the records for one file
+ *
+ * @param[in] ef the file belongs to.
+ * @param[in] q queue of records, with q->retry holding everything to
+ *	write, oldest first.  Whatever couldn't be written is left there.
+ * @param[out] written the number of bytes written, even if we then
+ *	failed to write the rest.
+ * @return
+ *	- 0 if everything was written.
+ *	- -1 on error.
+ */
+static int exfile_queue_write(exfile_t *ef, exfile_queue_t *q, size_t *written)
+{
+	exfile_buffer_t	*buf = ef->buffer;
+	struct iovec	iov[EXFILE_BUFFER_IOV];
+	exfile_record_t	*rec;
+	int		fd, i, rcode = 0;
+
+	*written = 0;
+
+	fd = exfile_open(ef, NULL, q->filename, q->permissions, true);
+	if (fd < 0) {
+		ERROR("Failed opening %s: %s", q->filename, fr_strerror());
+		return -1;
+	}
+
+	if ((q->gid != (gid_t) -1) && (fchown(fd, -1, q->gid) < 0)) {
+		DEBUG2("Unable to change system group of '%s': %s", q->filename, fr_syserror(errno));
+	}
+
+	while (q->retry) {
+		ssize_t len;
+
+		for (rec = q->retry, i = 0; rec && (i < EXFILE_BUFFER_IOV); rec = rec->next, i++) {
+			iov[i].iov_base = rec->data;
+			iov[i].iov_len = rec->len;
+		}
+		iov[0].iov_base = q->retry->data + q->retry_offset;
+		iov[0].iov_len = q->retry->len - q->retry_offset;
+
+		len = writev(fd, iov, i);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+
+			ERROR("Failed writing to %s: %s", q->filename, fr_syserror(errno));
+			rcode = -1;
+			break;
+		}
+		*written += len;
+
+		/*
+		 *	Free the records which were written, and
+		 *	remember how much of the last one was.
+		 */
+		len += q->retry_offset;
+		q->retry_offset = 0;
+		while (q->retry && (len >= (ssize_t) q->retry->len)) {
+			rec = q->retry;
+			len -= rec->len;
+			q->retry = rec->next;
+			free(rec);
+		}
+		if (q->retry) q->retry_offset = len;
+	}
+
+	/*
+	 *	Group commit.  One sync for everything we wrote.
+	 */
+	if (buf->sync && (*written > 0) && (fdatasync(fd) < 0)) {
+		ERROR("Failed syncing %s: %s", q->filename, fr_syserror(errno));
+		rcode = -1;
+	}
+
+	exfile_close(ef, NULL, fd);
+
+	return rcode;
+}
+
+/** Write out everything which has been buffered by exfile_append()
+ *
+ * Called by the flusher.  May also be called by anyone who wants the
+ * records written now.
+ *
+ * @param[in] ef to flush.
+ * @return the number of bytes written.
+ */
+size_t exfile_flush(exfile_t *ef)
+{
+	exfile_buffer_t	*buf = ef->buffer;
+	exfile_queue_t	*q, **last, *flush = NULL;
+	time_t		now = time(NULL);
+	size_t		total = 0;
+
+	if (!buf) return 0;
+
+	pthread_mutex_lock(&buf->flush_mutex);
+
+	/*
+	 *	Take the records off every queue, and make a list of
+	 *	the queues which have something to write.
+	 */
+	pthread_rwlock_rdlock(&buf->lock);
+	for (q = buf->queues; q != NULL; q = q->next) {
+		exfile_record_t	*rec, *next, *list = NULL, **tail;
+
+		/*
+		 *	Take everything, and reverse it so that the
+		 *	records are written in the order they were
+		 *	added.  Anything we failed to write last time
+		 *	goes first.
+		 */
+		rec = atomic_exchange_explicit(&q->head, NULL, memory_order_acquire);
+		while (rec) {
+			next = rec->next;
+			rec->next = list;
+			list = rec;
+			rec = next;
+		}
+
+		for (tail = &q->retry; *tail; tail = &(*tail)->next);
+		*tail = list;
+
+		if (!q->retry) continue;
+
+		q->flush_next = flush;
+		flush = q;
+	}
+	pthread_rwlock_unlock(&buf->lock);
+
+	/*
+	 *	Write them without holding the lock, so that appenders
+	 *	which need to add a queue aren't blocked on the disk.
+	 *	Queues are only freed below, while holding flush_mutex,
+	 *	and only we touch q->retry, so this is safe.
+	 */
+	for (q = flush; q != NULL; q = q->flush_next) {
+		size_t written;
+
+		(void) exfile_queue_write(ef, q, &written);
+		if (written > 0) {
+			atomic_fetch_sub_explicit(&buf->pending, written, memory_order_relaxed);
+			q->last_used = now;
+			total += written;
+		}
+	}
+
+	/*
+	 *	Forget about files which haven't been written to for a
+	 *	while.  New records can only be added to a queue with
+	 *	the read lock held, so it's safe to free them.
+	 */
+	pthread_rwlock_wrlock(&buf->lock);
+	last = &buf->queues;
+	while ((q = *last) != NULL) {
+		if (!q->retry && !atomic_load_explicit(&q->head, memory_order_relaxed) &&
+		    ((q->last_used + (time_t) ef->max_idle) < now)) {
+			*last = q->next;
+			talloc_free(q);
+			continue;
+		}
+		last = &q->next;
+	}
+	pthread_rwlock_unlock(&buf->lock);
+
+	pthread_mutex_unlock(&buf->flush_mutex);
+
+	return total;
+}
+
+/** Write records out every interval, or when enough are waiting
+ *
+ * If the last flush couldn't write anything, e.g. because the disk
+ * is full, we wait for the whole interval before trying again, no
+ * matter how much is waiting.
+ */
+static void *exfile_flusher(void *arg)
+{
+	exfile_t	*ef = arg;
+	exfile_buffer_t	*buf = ef->buffer;
+	bool		stalled = false;
+
+	pthread_mutex_lock(&buf->mutex);
+	while (!buf->stop) {
+		struct timeval	now, when;
+		struct timespec	ts;
+
+		gettimeofday(&now, NULL);
+		fr_timeval_add(&when, &now, &buf->interval);
+		ts.tv_sec = when.tv_sec;
+		ts.tv_nsec = when.tv_usec * 1000;
+
+		while (!buf->stop &&
+		       (stalled || (atomic_load_explicit(&buf->pending, memory_order_relaxed) < buf->max_bytes))) {
+			if (pthread_cond_timedwait(&buf->cond, &buf->mutex, &ts) == ETIMEDOUT) break;
+		}
+		pthread_mutex_unlock(&buf->mutex);
+
+		stalled = (exfile_flush(ef) == 0) &&
+			  (atomic_load_explicit(&buf->pending, memory_order_relaxed) > 0);
+
+		pthread_mutex_lock(&buf->mutex);
+	}
+	pthread_mutex_unlock(&buf->mutex);
+
+	return NULL;
+}
+
+/** Stop the flusher, and write out anything which is left
+ *
+ */
+static void exfile_buffer_free(exfile_t *ef)
+{
+	exfile_buffer_t	*buf = ef->buffer;
+	exfile_queue_t	*q;
+
+	pthread_mutex_lock(&buf->mutex);
+	buf->stop = true;
+	pthread_cond_signal(&buf->cond);
+	pthread_mutex_unlock(&buf->mutex);
+
+	if (buf->running) pthread_join(buf->flusher, NULL);
+
+	exfile_flush(ef);
+
+	/*
+	 *	Anything still here couldn't be written.
+	 */
+	for (q = buf->queues; q != NULL; q = q->next) {
+		exfile_record_t *rec, *next;
+
+		for (rec = q->retry; rec != NULL; rec = next) {
+			next = rec->next;
+			free(rec);
+		}
+		for (rec = atomic_load(&q->head); rec != NULL; rec = next) {
+			next = rec->next;
+			free(rec);
+		}
+	}
+
+	pthread_cond_destroy(&buf->cond);
+	pthread_mutex_destroy(&buf->mutex);
+	pthread_mutex_destroy(&buf->flush_mutex);
+	pthread_rwlock_destroy(&buf->lock);
+
+	TALLOC_FREE(ef->buffer);
+}
+
+/** Find the queue for a file, creating it if it doesn't exist
+ *
+ * Returns with the read lock held.
+ */
+static exfile_queue_t *exfile_queue_find(exfile_buffer_t *buf, char const *filename,
+					 mode_t permissions, gid_t gid)
+{
+	exfile_queue_t	*q;
+	uint32_t	hash = fr_hash_string(filename);
+
+	for (;;) {
+		pthread_rwlock_rdlock(&buf->lock);
+		for (q = buf->queues; q != NULL; q = q->next) {
+			if ((q->hash == hash) && (strcmp(q->filename, filename) == 0)) return q;
+		}
+		pthread_rwlock_unlock(&buf->lock);
+
+		/*
+		 *	Someone else may have added it while we
+		 *	weren't holding the lock.
+		 */
+		pthread_rwlock_wrlock(&buf->lock);
+		for (q = buf->queues; q != NULL; q = q->next) {
+			if ((q->hash == hash) && (strcmp(q->filename, filename) == 0)) break;
+		}
+
+		if (!q) {
+			q = talloc_zero(buf, exfile_queue_t);
+			if (!q) {
+				pthread_rwlock_unlock(&buf->lock);
+				fr_strerror_printf("Out of memory");
+				return NULL;
+			}
+			atomic_init(&q->head, NULL);
+			q->filename = talloc_typed_strdup(q, filename);
+			q->hash = hash;
+			q->permissions = permissions;
+			q->gid = gid;
+			q->last_used = time(NULL);
+			q->next = buf->queues;
+			buf->queues = q;
+		}
+		pthread_rwlock_unlock(&buf->lock);
+
+		/*
+		 *	Go back and get the read lock.  The flusher may
+		 *	have freed the queue in between, in which case
+		 *	we create it again.
+		 */
+	}
+}
+
+/** Queue a record to be written to a file
+ *
+ * Never blocks on file I/O, or on other threads writing to the
+ * same file.  The record is written by the flusher thread started by
+ * exfile_buffer_init().
+ *
+ * @param[in] ef The logfile context returned from exfile_init().
+ * @param[in] request The current request.
+ * @param[in] filename the file to write to.
+ * @param[in] permissions to use if the file is created.
+ * @param[in] gid to give the file, or -1 to leave it alone.
+ * @param[in] data to write.  Is copied.
+ * @param[in] len of data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int exfile_append(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions, gid_t gid,
+		  void const *data, size_t len)
+{
+	exfile_buffer_t	*buf = ef->buffer;
+	exfile_queue_t	*q;
+	exfile_record_t	*rec;
+	uint64_t	pending;
+
+	if (!buf) {
+		fr_strerror_printf("Buffered writes are not enabled");
+		return -1;
+	}
+
+	/*
+	 *	Start the flusher.  This is done here rather than in
+	 *	exfile_buffer_init() so that the thread is created
+	 *	after the server has daemonized.
+	 */
+	if (!buf->running) {
+		pthread_mutex_lock(&buf->mutex);
+		if (!buf->running && !buf->stop) {
+			int rcode;
+
+			rcode = pthread_create(&buf->flusher, NULL, exfile_flusher, ef);
+			if (rcode != 0) {
+				pthread_mutex_unlock(&buf->mutex);
+				fr_strerror_printf("Failed creating flusher thread: %s", fr_syserror(rcode));
+				return -1;
+			}
+			buf->running = true;
+		}
+		pthread_mutex_unlock(&buf->mutex);
+	}
+
+	if (atomic_load_explicit(&buf->pending, memory_order_relaxed) >
+	    (buf->max_bytes * EXFILE_BUFFER_MAX_PENDING)) {
+		fr_strerror_printf("Too much data waiting to be written to disk");
+		return -1;
+	}
+
+	rec = malloc(sizeof(*rec) + len);
+	if (!rec) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	rec->len = len;
+	memcpy(rec->data, data, len);
+
+	q = exfile_queue_find(buf, filename, permissions, gid);
+	if (!q) {
+		free(rec);
+		return -1;
+	}
+
+	rec->next = atomic_load_explicit(&q->head, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&q->head, &rec->next, rec,
+						      memory_order_release, memory_order_relaxed));
+	pthread_rwlock_unlock(&buf->lock);
+
+	pending = atomic_fetch_add_explicit(&buf->pending, len, memory_order_relaxed);
+
+	/*
+	 *	Only wake the flusher when we're the one who pushed it
+	 *	over the limit.
+	 */
+	if ((pending < buf->max_bytes) && ((pending + len) >= buf->max_bytes)) {
+		pthread_mutex_lock(&buf->mutex);
+		pthread_cond_signal(&buf->cond);
+		pthread_mutex_unlock(&buf->mutex);
+	}
+
+	ROPTIONAL(RDEBUG3, DEBUG3, "Queued %zu bytes for %s", len, filename);
+
+	return 0;
+}
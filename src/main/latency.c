@@ -0,0 +1,453 @@
+/*
+ * latency.c	Latency histograms for sections, modules, clients and home servers.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef WITH_STATS
+
+#define USEC (1000000)
+
+/** A latency histogram
+ *
+ * The histogram itself lives in the per-thread shards, at index "id".
+ */
+struct fr_stats_latency {
+	char const		*name;		//!< What is being timed, e.g. "default.authorize".
+						//!< NULL for the histograms of clients and home servers.
+	int			id;		//!< Index into the per-thread histograms.
+};
+
+/*
+ *	The histograms of one thread.  As with the global statistics,
+ *	shards are never freed, and are handed to the next thread
+ *	which needs one.
+ */
+typedef struct latency_shard {
+	fr_stats_hist_t		**hist;		//!< Indexed by fr_stats_latency_t id, allocated on first use.
+	int			num;		//!< Number of entries in hist.
+	bool			in_use;		//!< Whether a thread owns this shard.
+	struct latency_shard	*next;		//!< Next in the list of all shards.
+} latency_shard_t;
+
+/*
+ *	The mutex protects the registry, the list of shards, and the
+ *	size of each shard's array.  Counts are updated without it.
+ *
+ *	Entries in the registry are NULL once the histogram of a client
+ *	or home server has been freed, and are reused.
+ */
+static fr_stats_latency_t	**latency_registry;
+static int			latency_num;
+static latency_shard_t		*latency_shards;
+static pthread_mutex_t		latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+fr_thread_local_setup(latency_shard_t *, latency_shard)	/* macro */
+
+/** Return the bucket a latency falls into
+ *
+ */
+static inline int stats_hist_bucket(uint32_t usec)
+{
+	int msb;
+
+	if (usec < FR_STATS_HIST_SUB) return usec;
+
+	msb = 31 - __builtin_clz(usec);
+
+	return ((msb - FR_STATS_HIST_SUB_BITS + 1) * FR_STATS_HIST_SUB) +
+		((usec >> (msb - FR_STATS_HIST_SUB_BITS)) & (FR_STATS_HIST_SUB - 1));
+}
+
+/** Return the largest latency which falls into a bucket
+ *
+ */
+static inline uint32_t stats_hist_bucket_max(int bucket)
+{
+	int	shift;
+
+	if (bucket < FR_STATS_HIST_SUB) return bucket;
+
+	shift = (bucket / FR_STATS_HIST_SUB) - 1;
+
+	return ((((uint64_t) FR_STATS_HIST_SUB + (bucket & (FR_STATS_HIST_SUB - 1))) << shift) +
+		((uint64_t) 1 << shift) - 1) & 0xffffffff;
+}
+
+/** Record a latency in a histogram
+ *
+ * @param[in,out] hist to update.
+ * @param[in] start of the request.
+ * @param[in] end of the request.
+ */
+void fr_stats_hist_add(fr_stats_hist_t *hist, struct timeval *start, struct timeval *end)
+{
+	struct timeval	diff;
+	uint32_t	usec;
+
+	if ((start->tv_sec == 0) || (end->tv_sec == 0) || (fr_timeval_cmp(end, start) < 0)) return;
+
+	fr_timeval_subtract(&diff, end, start);
+	if (diff.tv_sec >= 4294) {
+		usec = UINT32_MAX;
+	} else {
+		usec = (diff.tv_sec * USEC) + diff.tv_usec;
+	}
+
+	hist->bucket[stats_hist_bucket(usec)]++;
+	hist->count++;
+	hist->total_usec += usec;
+	if (usec > hist->max_usec) hist->max_usec = usec;
+}
+
+/** Add one histogram to another
+ *
+ * @param[in,out] out histogram to add to.
+ * @param[in] in histogram to add.
+ */
+void fr_stats_hist_merge(fr_stats_hist_t *out, fr_stats_hist_t const *in)
+{
+	int i;
+
+	out->count += in->count;
+	out->total_usec += in->total_usec;
+	if (in->max_usec > out->max_usec) out->max_usec = in->max_usec;
+
+	for (i = 0; i < FR_STATS_HIST_BUCKETS; i++) out->bucket[i] += in->bucket[i];
+}
+
+/** Return a percentile of the latencies in a histogram
+ *
+ * @param[in] hist to examine.
+ * @param[in] percentile to return, from 0 to 100.
+ * @return the latency in microseconds, to within the width of one
+ *	bucket, or 0 if the histogram is empty.
+ */
+uint32_t fr_stats_hist_percentile(fr_stats_hist_t const *hist, double percentile)
+{
+	uint64_t	rank, seen = 0;
+	int		i;
+
+	if (!hist->count) return 0;
+
+	rank = (uint64_t) ((percentile * hist->count) / 100.0);
+	if (rank == 0) rank = 1;
+	if (rank > hist->count) rank = hist->count;
+
+	for (i = 0; i < FR_STATS_HIST_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= rank) {
+			uint32_t usec = stats_hist_bucket_max(i);
+
+			return (usec < hist->max_usec) ? usec : hist->max_usec;
+		}
+	}
+
+	return hist->max_usec;
+}
+
+/** Register something to be timed
+ *
+ * Registering the same name twice returns the same histogram, so
+ * that the counts carry over when the configuration is re-read.
+ *
+ * @param[in] name of what is being timed.
+ * @return
+ *	- The latency handle to pass to fr_stats_latency_add().
+ *	- NULL on error.
+ */
+fr_stats_latency_t *fr_stats_latency_register(char const *name)
+{
+	fr_stats_latency_t	*lat, **registry;
+	int			i;
+
+	pthread_mutex_lock(&latency_mutex);
+	for (i = 0; i < latency_num; i++) {
+		if (!latency_registry[i] || !latency_registry[i]->name) continue;
+
+		if (strcmp(latency_registry[i]->name, name) == 0) {
+			lat = latency_registry[i];
+			pthread_mutex_unlock(&latency_mutex);
+			return lat;
+		}
+	}
+
+	/*
+	 *	Not parented, the histograms outlive any one
+	 *	configuration.
+	 */
+	registry = talloc_realloc(NULL, latency_registry, fr_stats_latency_t *, latency_num + 1);
+	if (!registry) {
+	oom:
+		pthread_mutex_unlock(&latency_mutex);
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+	latency_registry = registry;
+
+	lat = talloc_zero(latency_registry, fr_stats_latency_t);
+	if (!lat) goto oom;
+
+	lat->name = talloc_typed_strdup(lat, name);
+	lat->id = latency_num;
+	latency_registry[latency_num++] = lat;
+	pthread_mutex_unlock(&latency_mutex);
+
+	return lat;
+}
+
+/** Release the id of a histogram, and clear every thread's copy of it
+ *
+ * The owner is being freed, so no one is recording into it.
+ */
+static int _latency_free(fr_stats_latency_t *lat)
+{
+	latency_shard_t	*shard;
+
+	pthread_mutex_lock(&latency_mutex);
+	for (shard = latency_shards; shard != NULL; shard = shard->next) {
+		if ((lat->id < shard->num) && shard->hist[lat->id]) {
+			memset(shard->hist[lat->id], 0, sizeof(*shard->hist[lat->id]));
+		}
+	}
+	latency_registry[lat->id] = NULL;
+	pthread_mutex_unlock(&latency_mutex);
+
+	return 0;
+}
+
+/** Allocate a histogram for a client or home server
+ *
+ * Unlike fr_stats_latency_register(), the histogram has no name, so
+ * it's not passed to fr_stats_latency_walk().  Read it with
+ * fr_stats_latency_sum().
+ *
+ * @param[in] ctx to allocate the handle in.  The histogram is freed
+ *	with it.
+ * @return
+ *	- The latency handle to pass to fr_stats_latency_add().
+ *	- NULL on error.
+ */
+fr_stats_latency_t *fr_stats_latency_alloc(TALLOC_CTX *ctx)
+{
+	fr_stats_latency_t	*lat, **registry;
+	int			i;
+
+	lat = talloc_zero(ctx, fr_stats_latency_t);
+	if (!lat) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&latency_mutex);
+	for (i = 0; i < latency_num; i++) {
+		if (!latency_registry[i]) break;
+	}
+
+	if (i == latency_num) {
+		registry = talloc_realloc(NULL, latency_registry, fr_stats_latency_t *, latency_num + 1);
+		if (!registry) {
+			pthread_mutex_unlock(&latency_mutex);
+			talloc_free(lat);
+			fr_strerror_printf("Out of memory");
+			return NULL;
+		}
+		latency_registry = registry;
+		latency_num++;
+	}
+
+	lat->id = i;
+	latency_registry[i] = lat;
+	talloc_set_destructor(lat, _latency_free);
+	pthread_mutex_unlock(&latency_mutex);
+
+	return lat;
+}
+
+/** Give a shard back when its thread exits
+ *
+ */
+static void _latency_shard_release(void *arg)
+{
+	latency_shard_t *shard = arg;
+
+	pthread_mutex_lock(&latency_mutex);
+	shard->in_use = false;
+	pthread_mutex_unlock(&latency_mutex);
+}
+
+/** Find or allocate this thread's histogram for a latency
+ *
+ * Called the first time a thread records a particular latency.
+ */
+static fr_stats_hist_t *latency_hist_alloc(fr_stats_latency_t const *lat)
+{
+	latency_shard_t	*shard = latency_shard;
+	fr_stats_hist_t	*hist = NULL;
+
+	pthread_mutex_lock(&latency_mutex);
+
+	if (!shard) {
+		for (shard = latency_shards; shard != NULL; shard = shard->next) {
+			if (!shard->in_use) break;
+		}
+
+		if (!shard) {
+			shard = talloc_zero(NULL, latency_shard_t);
+			if (!shard) goto done;
+
+			shard->next = latency_shards;
+			latency_shards = shard;
+		}
+		shard->in_use = true;
+
+		fr_thread_local_set_destructor(latency_shard, _latency_shard_release, shard);
+	}
+
+	if (lat->id >= shard->num) {
+		fr_stats_hist_t **array;
+
+		array = talloc_realloc(shard, shard->hist, fr_stats_hist_t *, latency_num);
+		if (!array) goto done;
+
+		memset(array + shard->num, 0, sizeof(array[0]) * (latency_num - shard->num));
+		shard->hist = array;
+		shard->num = latency_num;
+	}
+
+	if (!shard->hist[lat->id]) {
+		void *mem;
+
+		/*
+		 *	Cache line aligned, so that the histograms of
+		 *	two threads never share a line.
+		 */
+		if (posix_memalign(&mem, 64, sizeof(*hist)) != 0) goto done;
+		memset(mem, 0, sizeof(*hist));
+
+		shard->hist[lat->id] = mem;
+	}
+	hist = shard->hist[lat->id];
+
+done:
+	pthread_mutex_unlock(&latency_mutex);
+
+	return hist;
+}
+
+/** Record a latency
+ *
+ * Lock free, except for the first time each thread records each
+ * latency.
+ *
+ * @param[in] lat handle from fr_stats_latency_register() or fr_stats_latency_alloc().
+ *	May be NULL if the histogram couldn't be allocated.
+ * @param[in] start of the operation.
+ * @param[in] end of the operation.
+ */
+void fr_stats_latency_add(fr_stats_latency_t const *lat, struct timeval *start, struct timeval *end)
+{
+	latency_shard_t	*shard = latency_shard;
+	fr_stats_hist_t	*hist;
+
+	if (!lat) return;
+
+	if (shard && (lat->id < shard->num) && shard->hist[lat->id]) {
+		hist = shard->hist[lat->id];
+	} else {
+		hist = latency_hist_alloc(lat);
+		if (!hist) return;
+	}
+
+	fr_stats_hist_add(hist, start, end);
+}
+
+/** Sum one histogram over all threads
+ *
+ * Threads carry on recording while we read, so the histogram may be
+ * a request or two behind.
+ *
+ * @param[out] out where to write the sum.
+ * @param[in] lat handle from fr_stats_latency_register() or fr_stats_latency_alloc().
+ *	May be NULL, in which case the sum is empty.
+ */
+void fr_stats_latency_sum(fr_stats_hist_t *out, fr_stats_latency_t const *lat)
+{
+	latency_shard_t	*shard;
+
+	memset(out, 0, sizeof(*out));
+	if (!lat) return;
+
+	pthread_mutex_lock(&latency_mutex);
+	for (shard = latency_shards; shard != NULL; shard = shard->next) {
+		if ((lat->id >= shard->num) || !shard->hist[lat->id]) continue;
+
+		fr_stats_hist_merge(out, shard->hist[lat->id]);
+	}
+	pthread_mutex_unlock(&latency_mutex);
+}
+
+/** Call a function for each registered latency, with its histogram summed over all threads
+ *
+ * Threads carry on recording while we read, so the histograms may be
+ * a request or two behind.
+ *
+ * @param[in] callback to call.  Must not call any other fr_stats_latency_*
+ *	function.
+ * @param[in] ctx to pass to the callback.
+ * @return
+ *	- 0 if the callback was called for every latency.
+ *	- The value returned by the callback, if it wasn't 0.
+ */
+int fr_stats_latency_walk(fr_stats_latency_walk_t callback, void *ctx)
+{
+	fr_stats_hist_t	*sum;
+	latency_shard_t	*shard;
+	int		i, rcode = 0;
+
+	sum = talloc(NULL, fr_stats_hist_t);
+	if (!sum) return -1;
+
+	pthread_mutex_lock(&latency_mutex);
+	for (i = 0; i < latency_num; i++) {
+		if (!latency_registry[i] || !latency_registry[i]->name) continue;
+
+		memset(sum, 0, sizeof(*sum));
+
+		for (shard = latency_shards; shard != NULL; shard = shard->next) {
+			if ((i >= shard->num) || !shard->hist[i]) continue;
+
+			fr_stats_hist_merge(sum, shard->hist[i]);
+		}
+
+		rcode = callback(latency_registry[i]->name, sum, ctx);
+		if (rcode != 0) break;
+	}
+	pthread_mutex_unlock(&latency_mutex);
+
+	talloc_free(sum);
+
+	return rcode;
+}
+#endif /* WITH_STATS */
@@ -6,7 +6,9 @@ SOURCES	:=	cond_eval.c \
 		connection.c \
 		dl.c \
 		exec.c \
+		detail.c \
 		exfile.c \
+		latency.c \
 		log.c \
 		map_proc.c \
 		map.c \
@@ -1810,25 +1810,193 @@ static int stats_socket_recv(rad_listen_t *listener)
 #endif
 
 
+/*
+ *	How many packets a UDP listener reads with one system call.
+ */
+#define LISTEN_MMSG_NUM		(16)
+
+/** Read a batch of packets from a UDP listener
+ *
+ *  The buffers belong to the listener, and are reused for every
+ *  batch.  The caller has to copy anything it wants to keep.
+ *
+ * @param[in] listener to read from.
+ * @param[out] out the packets which were read.
+ * @return the number of packets read.
+ */
+static int udp_socket_read(rad_listen_t *listener, udp_mmsg_t **out)
+{
+	int		i, num;
+	listen_socket_t	*sock = listener->data;
+
+	if (!sock->mmsg) {
+		uint8_t *buffer;
+
+		MEM(sock->mmsg = talloc_zero_array(sock, udp_mmsg_t, LISTEN_MMSG_NUM));
+		MEM(buffer = talloc_array(sock->mmsg, uint8_t, LISTEN_MMSG_NUM * MAX_PACKET_LEN));
+
+		for (i = 0; i < LISTEN_MMSG_NUM; i++) sock->mmsg[i].data = buffer + (i * MAX_PACKET_LEN);
+	}
+
+	for (i = 0; i < LISTEN_MMSG_NUM; i++) sock->mmsg[i].data_len = MAX_PACKET_LEN;
+
+	num = udp_recv_mmsg(listener->fd, sock->mmsg, LISTEN_MMSG_NUM, 0, &sock->my_ipaddr, sock->my_port);
+	if (num < 0) {
+		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
+		return 0;
+	}
+
+	*out = sock->mmsg;
+	return num;
+}
+
+/** Check the header of a packet read by udp_socket_read()
+ *
+ *  Does the same checks as fr_radius_recv_header().
+ *
+ * @param[in] in the packet.
+ * @param[out] code of the packet.
+ * @return
+ *	- 0 if the packet should be silently ignored.
+ *	- 1 if the packet is malformed.
+ *	- >= RADIUS_HDR_LEN the length of the packet, according to its header.
+ */
+static ssize_t udp_socket_header(udp_mmsg_t const *in, unsigned int *code)
+{
+	size_t packet_len;
+
+	if (in->data_len == 0) return 0;	/* unknown address family */
+
+	if (in->data_len < 4) {
+		fr_strerror_printf("Expected at least 4 bytes of header data, got %zu bytes", in->data_len);
+		return 1;
+	}
+
+	packet_len = (in->data[2] * 256) + in->data[3];
+	if ((packet_len < RADIUS_HDR_LEN) || (packet_len > MAX_PACKET_LEN)) {
+		fr_strerror_printf("Invalid length field value %zu", packet_len);
+		return 1;
+	}
+
+	*code = in->data[0];
+
+	return packet_len;
+}
+
+/** Turn a packet read by udp_socket_read() into a RADIUS_PACKET
+ *
+ *  Does the same checks as fr_radius_recv().
+ *
+ * @param[in] ctx to allocate the packet in.
+ * @param[in] listener the packet was read from.
+ * @param[in] in the packet.
+ * @param[in] packet_len from the RADIUS header.
+ * @param[in] require_ma whether the packet must have a Message-Authenticator.
+ * @return
+ *	- NULL if the packet is malformed.
+ *	- the packet.
+ */
+static RADIUS_PACKET *udp_socket_packet(TALLOC_CTX *ctx, rad_listen_t *listener, udp_mmsg_t const *in,
+					size_t packet_len, bool require_ma)
+{
+	RADIUS_PACKET *packet;
+
+	packet = fr_radius_alloc(ctx, false);
+	if (!packet) return NULL;
+
+	/*
+	 *	Anything after the length in the header is ignored.
+	 *	A datagram which is too short is caught below.
+	 */
+	packet->data_len = (in->data_len < packet_len) ? in->data_len : packet_len;
+	packet->data = talloc_memdup(packet, in->data, packet->data_len);
+	if (!packet->data) {
+		fr_radius_free(&packet);
+		return NULL;
+	}
+
+	packet->src_ipaddr = in->src_ipaddr;
+	packet->src_port = in->src_port;
+	packet->dst_ipaddr = in->dst_ipaddr;
+	packet->dst_port = in->dst_port;
+	packet->if_index = in->if_index;
+	packet->timestamp = in->when;
+
+	if (!fr_radius_ok(packet, require_ma, NULL)) {
+		fr_radius_free(&packet);
+		return NULL;
+	}
+
+	packet->sockfd = listener->fd;
+
+#ifndef NDEBUG
+	if ((fr_debug_lvl > 3) && fr_log_fp) fr_radius_print_hex(packet);
+#endif
+
+	return packet;
+}
+
+/** A packet from a batch, which is waiting to be verified
+ *
+ */
+typedef struct {
+	TALLOC_CTX		*ctx;		//!< the request will be allocated in.
+	rad_listen_t		*listener;	//!< the request will be associated with.
+	RADIUS_PACKET		*packet;	//!< which was received.
+	RADCLIENT		*client;	//!< which sent the packet.
+	RAD_REQUEST_FUNP	fun;		//!< to process the request with.
+	int			rcode;		//!< from fr_radius_verify_batch().
+} udp_socket_pending_t;
+
+/** Verify the authenticators of a batch of packets from clients
+ *
+ *  This is done here, rather than in client_socket_decode(), so the
+ *  MD5 operations for the batch can be done together.
+ *
+ * @param[in,out] pending packets, with the result written to their rcode.
+ * @param[in] num the number of packets.
+ */
+static void udp_socket_verify(udp_socket_pending_t pending[], int num)
+{
+	int		i;
+	RADIUS_PACKET	*packets[LISTEN_MMSG_NUM];
+	char const	*secrets[LISTEN_MMSG_NUM];
+	size_t		secret_lens[LISTEN_MMSG_NUM];
+	int		rcodes[LISTEN_MMSG_NUM];
+
+	rad_assert(num <= LISTEN_MMSG_NUM);
+
+	for (i = 0; i < num; i++) {
+		packets[i] = pending[i].packet;
+		secrets[i] = pending[i].client->secret;
+		secret_lens[i] = talloc_array_length(pending[i].client->secret) - 1;
+	}
+
+	(void) fr_radius_verify_batch(packets, NULL, secrets, secret_lens, rcodes, num);
+
+	for (i = 0; i < num; i++) pending[i].rcode = rcodes[i];
+}
+
 /*
  *	Check if an incoming request is "ok"
  *
  *	It takes packets, not requests.  It sees if the packet looks
  *	OK.  If so, it does a number of sanity checks on it.
+ *
+ *	The packet is verified, and the request created, once the
+ *	whole batch has been read.
   */
-static int auth_socket_recv(rad_listen_t *listener)
+static int auth_packet_recv(rad_listen_t *listener, udp_mmsg_t *in, udp_socket_pending_t *pending)
 {
 	ssize_t		rcode;
 	unsigned int	code;
-	uint16_t	src_port;
 	RADIUS_PACKET	*packet;
 	RAD_REQUEST_FUNP fun = NULL;
 	RADCLIENT	*client = NULL;
-	fr_ipaddr_t	src_ipaddr;
 	TALLOC_CTX	*ctx;
 
-	rcode = fr_radius_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
-	if (rcode < 0) return 0;
+	rcode = udp_socket_header(in, &code);
+	if (rcode == 0) return 0;
 
 	FR_STATS_INC(auth, total_requests);
 
@@ -1838,9 +2006,8 @@ static int auth_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	client = client_listener_find(listener, &src_ipaddr, src_port);
+	client = client_listener_find(listener, &in->src_ipaddr, in->src_port);
 	if (!client) {
-		udp_recv_discard(listener->fd);
 		FR_STATS_INC(auth, total_invalid_requests);
 		return 0;
 	}
@@ -1857,7 +2024,6 @@ static int auth_socket_recv(rad_listen_t *listener)
 
 	case PW_CODE_STATUS_SERVER:
 		if (!main_config.status_server) {
-			udp_recv_discard(listener->fd);
 			FR_STATS_INC(auth, total_unknown_types);
 			WARN("Ignoring Status-Server request due to security configuration");
 			return 0;
@@ -1866,27 +2032,24 @@ static int auth_socket_recv(rad_listen_t *listener)
 		break;
 
 	default:
-		udp_recv_discard(listener->fd);
 		FR_STATS_INC(auth, total_unknown_types);
 
 		if (DEBUG_ENABLED) ERROR("Receive - Invalid packet code %d sent to authentication port from "
-					 "client %s port %d", code, client->shortname, src_port);
+					 "client %s port %d", code, client->shortname, in->src_port);
 		return 0;
 	} /* switch over packet types */
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("auth_listener_pool");
 	if (!ctx) {
-		udp_recv_discard(listener->fd);
 		FR_STATS_INC(auth, total_packets_dropped);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "auth_listener_pool");
 
 	/*
-	 *	Now that we've sanity checked everything, receive the
-	 *	packet.
+	 *	Now that we've sanity checked everything, turn it
+	 *	into a packet.
 	 */
-	packet = fr_radius_recv(ctx, listener->fd, UDP_FLAGS_NONE, client->message_authenticator);
+	packet = udp_socket_packet(ctx, listener, in, rcode, client->message_authenticator);
 	if (!packet) {
 		FR_STATS_INC(auth, total_malformed_requests);
 		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
@@ -1916,33 +2079,69 @@ static int auth_socket_recv(rad_listen_t *listener)
 	}
 #endif
 
-	if (!request_receive(ctx, listener, packet, client, fun)) {
-		FR_STATS_INC(auth, total_packets_dropped);
-		talloc_free(ctx);
-		return 0;
-	}
+	pending->ctx = ctx;
+	pending->listener = listener;
+	pending->packet = packet;
+	pending->client = client;
+	pending->fun = fun;
 
 	return 1;
 }
 
+static int auth_socket_recv(rad_listen_t *listener)
+{
+	int			i, num, rcode = 0, n = 0;
+	udp_mmsg_t		*in;
+	udp_socket_pending_t	pending[LISTEN_MMSG_NUM];
+
+	num = udp_socket_read(listener, &in);
+	for (i = 0; i < num; i++) n += auth_packet_recv(listener, &in[i], &pending[n]);
+	if (n == 0) return 0;
+
+	udp_socket_verify(pending, n);
+
+	for (i = 0; i < n; i++) {
+		RADCLIENT *client = pending[i].client;
+
+		listener = pending[i].listener;
+
+		if (pending[i].rcode < 0) {
+			FR_STATS_INC(auth, total_bad_authenticators);
+			RATE_LIMIT(INFO("Dropping packet from client %s port %d without response: invalid "
+					"Request-Authenticator or Message-Authenticator (Shared secret is incorrect)",
+					client->shortname, pending[i].packet->src_port));
+			talloc_free(pending[i].ctx);
+			continue;
+		}
+
+		if (!request_receive(pending[i].ctx, listener, pending[i].packet, client, pending[i].fun)) {
+			FR_STATS_INC(auth, total_packets_dropped);
+			talloc_free(pending[i].ctx);
+			continue;
+		}
+
+		rcode++;
+	}
+
+	return rcode;
+}
+
 
 #ifdef WITH_ACCOUNTING
 /*
  *	Receive packets from an accounting socket
  */
-static int acct_socket_recv(rad_listen_t *listener)
+static int acct_packet_recv(rad_listen_t *listener, udp_mmsg_t *in, udp_socket_pending_t *pending)
 {
 	ssize_t		rcode;
 	unsigned int	code;
-	uint16_t	src_port;
 	RADIUS_PACKET	*packet;
 	RAD_REQUEST_FUNP fun = NULL;
 	RADCLIENT	*client = NULL;
-	fr_ipaddr_t	src_ipaddr;
 	TALLOC_CTX	*ctx;
 
-	rcode = fr_radius_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
-	if (rcode < 0) return 0;
+	rcode = udp_socket_header(in, &code);
+	if (rcode == 0) return 0;
 
 	FR_STATS_INC(acct, total_requests);
 
@@ -1953,8 +2152,7 @@ static int acct_socket_recv(rad_listen_t *listener)
 	}
 
 	if ((client = client_listener_find(listener,
-					   &src_ipaddr, src_port)) == NULL) {
-		udp_recv_discard(listener->fd);
+					   &in->src_ipaddr, in->src_port)) == NULL) {
 		FR_STATS_INC(acct, total_invalid_requests);
 		return 0;
 	}
@@ -1971,7 +2169,6 @@ static int acct_socket_recv(rad_listen_t *listener)
 
 	case PW_CODE_STATUS_SERVER:
 		if (!main_config.status_server) {
-			udp_recv_discard(listener->fd);
 			FR_STATS_INC(acct, total_unknown_types);
 
 			WARN("Ignoring Status-Server request due to security configuration");
@@ -1981,27 +2178,24 @@ static int acct_socket_recv(rad_listen_t *listener)
 		break;
 
 	default:
-		udp_recv_discard(listener->fd);
 		FR_STATS_INC(acct, total_unknown_types);
 
 		DEBUG("Invalid packet code %d sent to a accounting port from client %s port %d : IGNORED",
-		      code, client->shortname, src_port);
+		      code, client->shortname, in->src_port);
 		return 0;
 	} /* switch over packet types */
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("acct_listener_pool");
 	if (!ctx) {
-		udp_recv_discard(listener->fd);
 		FR_STATS_INC(acct, total_packets_dropped);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "acct_listener_pool");
 
 	/*
-	 *	Now that we've sanity checked everything, receive the
-	 *	packet.
+	 *	Now that we've sanity checked everything, turn it
+	 *	into a packet.
 	 */
-	packet = fr_radius_recv(ctx, listener->fd, UDP_FLAGS_NONE, false);
+	packet = udp_socket_packet(ctx, listener, in, rcode, false);
 	if (!packet) {
 		FR_STATS_INC(acct, total_malformed_requests);
 		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
@@ -2009,18 +2203,53 @@ static int acct_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	/*
-	 *	There can be no duplicate accounting packets.
-	 */
-	if (!request_receive(ctx, listener, packet, client, fun)) {
-		FR_STATS_INC(acct, total_packets_dropped);
-		fr_radius_free(&packet);
-		talloc_free(ctx);
-		return 0;
-	}
+	pending->ctx = ctx;
+	pending->listener = listener;
+	pending->packet = packet;
+	pending->client = client;
+	pending->fun = fun;
 
 	return 1;
 }
+
+static int acct_socket_recv(rad_listen_t *listener)
+{
+	int			i, num, rcode = 0, n = 0;
+	udp_mmsg_t		*in;
+	udp_socket_pending_t	pending[LISTEN_MMSG_NUM];
+
+	num = udp_socket_read(listener, &in);
+	for (i = 0; i < num; i++) n += acct_packet_recv(listener, &in[i], &pending[n]);
+	if (n == 0) return 0;
+
+	udp_socket_verify(pending, n);
+
+	for (i = 0; i < n; i++) {
+		RADCLIENT *client = pending[i].client;
+
+		if (pending[i].rcode < 0) {
+			FR_STATS_INC(acct, total_bad_authenticators);
+			RATE_LIMIT(INFO("Dropping packet from client %s port %d without response: invalid "
+					"Request-Authenticator (Shared secret is incorrect)",
+					client->shortname, pending[i].packet->src_port));
+			talloc_free(pending[i].ctx);
+			continue;
+		}
+
+		/*
+		 *	There can be no duplicate accounting packets.
+		 */
+		if (!request_receive(pending[i].ctx, listener, pending[i].packet, client, pending[i].fun)) {
+			FR_STATS_INC(acct, total_packets_dropped);
+			talloc_free(pending[i].ctx);
+			continue;
+		}
+
+		rcode++;
+	}
+
+	return rcode;
+}
 #endif
 
 
@@ -2266,13 +2495,12 @@ static int coa_socket_recv(rad_listen_t *listener)
 		return 0;
 	} /* switch over packet types */
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("coa_socket_recv_pool");
 	if (!ctx) {
 		udp_recv_discard(listener->fd);
 		FR_STATS_INC(coa, total_packets_dropped);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "coa_socket_recv_pool");
 
 	/*
 	 *	Now that we've sanity checked everything, receive the
@@ -2461,14 +2689,21 @@ static int client_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 }
 
 
-static int client_socket_decode(UNUSED rad_listen_t *listener, REQUEST *request)
+static int client_socket_decode(rad_listen_t *listener, REQUEST *request)
 {
 #ifdef WITH_TLS
 	listen_socket_t *sock;
 #endif
 
-	if (fr_radius_verify(request->packet, NULL,
-			     request->client->secret) < 0) {
+	/*
+	 *	Packets read from UDP authentication and accounting
+	 *	sockets have already been verified, in batches.
+	 */
+	if ((listener->recv != auth_socket_recv)
+#ifdef WITH_ACCOUNTING
+	    && (listener->recv != acct_socket_recv)
+#endif
+	    && (fr_radius_verify(request->packet, NULL, request->client->secret) < 0)) {
 		return -1;
 	}
 
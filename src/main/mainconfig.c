@@ -213,6 +213,7 @@ static const CONF_PARSER server_config[] = {
 	{ FR_CONF_POINTER("cleanup_delay", PW_TYPE_INTEGER, &main_config.cleanup_delay), .dflt = STRINGIFY(CLEANUP_DELAY) },
 	{ FR_CONF_POINTER("continuation_timeout", PW_TYPE_INTEGER, &main_config.continuation_timeout), .dflt = "15" },
 	{ FR_CONF_POINTER("max_requests", PW_TYPE_INTEGER, &main_config.max_requests), .dflt = STRINGIFY(MAX_REQUESTS) },
+	{ FR_CONF_POINTER("timer_resolution", PW_TYPE_INTEGER, &main_config.timer_resolution), .dflt = "0" },
 	{ FR_CONF_POINTER("pidfile", PW_TYPE_STRING, &main_config.pid_file), .dflt = "${run_dir}/radiusd.pid"},
 	{ FR_CONF_POINTER("checkrad", PW_TYPE_STRING, &main_config.checkrad), .dflt = "${sbindir}/checkrad" },
 
@@ -719,9 +720,10 @@ int main_config_init(void)
 	if (!main_config.dictionary_dir) main_config.dictionary_dir = talloc_typed_strdup(NULL, DICTDIR);
 
 	/*
-	 *	About sizeof(REQUEST) + sizeof(RADIUS_PACKET) * 2 + sizeof(VALUE_PAIR) * 400
+	 *	About sizeof(REQUEST) + sizeof(RADIUS_PACKET) * 2 + sizeof(VALUE_PAIR) * 40
 	 *
-	 *	Which should be enough for many configurations.
+	 *	This is the minimum.  request_pool_alloc() makes the
+	 *	pools bigger if the requests need more.
 	 */
 	main_config.talloc_pool_size = 8 * 1024; /* default */
 
@@ -921,6 +923,8 @@ do {\
 
 	FR_INTEGER_BOUND_CHECK("cleanup_delay", main_config.cleanup_delay, <=, 10);
 
+	FR_INTEGER_BOUND_CHECK("timer_resolution", main_config.timer_resolution, <=, 1000);
+
 	FR_TIMEVAL_BOUND_CHECK("reject_delay", &main_config.reject_delay, <=, main_config.cleanup_delay, 0);
 
 	FR_SIZE_BOUND_CHECK("resources.talloc_pool_size", main_config.talloc_pool_size, >=, (size_t)(2 * 1024));
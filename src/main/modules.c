@@ -912,6 +912,15 @@ static module_instance_t *module_bootstrap(CONF_SECTION *modules, CONF_SECTION *
 		return NULL;
 	}
 
+#ifdef WITH_STATS
+	{
+		char buffer[256];
+
+		snprintf(buffer, sizeof(buffer), "module.%s", instance->name);
+		instance->latency = fr_stats_latency_register(buffer);
+	}
+#endif
+
 	/*
 	 *	Remember the module for later.
 	 */
@@ -489,6 +489,7 @@ void request_free(REQUEST *request)
 
 	ptr = talloc_parent(request);
 	rad_assert(ptr != NULL);
+	request_pool_account(ptr);
 	talloc_free(ptr);
 }
 
@@ -1690,9 +1691,8 @@ int request_receive(TALLOC_CTX *ctx, rad_listen_t *listener, RADIUS_PACKET *pack
 	 *	Allocate a pool for the request.
 	 */
 	if (!ctx) {
-		ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+		ctx = request_pool_alloc("request_receive_pool");
 		if (!ctx) return 0;
-		talloc_set_name_const(ctx, "request_receive_pool");
 
 		/*
 		 *	The packet is still allocated from a different
@@ -1779,11 +1779,11 @@ REQUEST *request_setup(TALLOC_CTX *ctx, rad_listen_t *listener, RADIUS_PACKET *p
 	request->listener->stats.last_packet = request->packet->timestamp.tv_sec;
 	if (packet->code == PW_CODE_ACCESS_REQUEST) {
 		request->client->auth.last_packet = request->packet->timestamp.tv_sec;
-		radius_auth_stats.last_packet = request->packet->timestamp.tv_sec;
+		radius_stats_shard()->auth.last_packet = request->packet->timestamp.tv_sec;
 #ifdef WITH_ACCOUNTING
 	} else if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
 		request->client->acct.last_packet = request->packet->timestamp.tv_sec;
-		radius_acct_stats.last_packet = request->packet->timestamp.tv_sec;
+		radius_stats_shard()->acct.last_packet = request->packet->timestamp.tv_sec;
 #endif
 	}
 #endif	/* WITH_STATS */
@@ -2496,23 +2496,23 @@ global_stats:
 
 	switch (proxy->packet->code) {
 	case PW_CODE_ACCESS_REQUEST:
-		proxy_auth_stats.last_packet = reply->timestamp.tv_sec;
+		radius_stats_shard()->proxy_auth.last_packet = reply->timestamp.tv_sec;
 		break;
 
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_REQUEST:
-		proxy_acct_stats.last_packet = reply->timestamp.tv_sec;
+		radius_stats_shard()->proxy_acct.last_packet = reply->timestamp.tv_sec;
 		break;
 
 #endif
 
 #ifdef WITH_COA
 	case PW_CODE_COA_REQUEST:
-		proxy_coa_stats.last_packet = reply->timestamp.tv_sec;
+		radius_stats_shard()->proxy_coa.last_packet = reply->timestamp.tv_sec;
 		break;
 
 	case PW_CODE_DISCONNECT_REQUEST:
-		proxy_dsc_stats.last_packet = reply->timestamp.tv_sec;
+		radius_stats_shard()->proxy_dsc.last_packet = reply->timestamp.tv_sec;
 		break;
 
 #endif
@@ -3901,12 +3901,12 @@ static bool proxy_keep_waiting(REQUEST *request, struct timeval *now)
 	FR_STATS_TYPE_INC(home->stats.total_timeouts);
 	if (home->type == HOME_TYPE_AUTH) {
 		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats.total_timeouts);
-		FR_STATS_TYPE_INC(proxy_auth_stats.total_timeouts);
+		FR_STATS_TYPE_INC(radius_stats_shard()->proxy_auth.total_timeouts);
 	}
 #ifdef WITH_ACCT
 	else if (home->type == HOME_TYPE_ACCT) {
 		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats.total_timeouts);
-		FR_STATS_TYPE_INC(proxy_acct_stats.total_timeouts);
+		FR_STATS_TYPE_INC(radius_stats_shard()->proxy_acct.total_timeouts);
 	}
 #endif
 #ifdef WITH_COA
@@ -3914,9 +3914,9 @@ static bool proxy_keep_waiting(REQUEST *request, struct timeval *now)
 		if (request->proxy->listener) FR_STATS_TYPE_INC(request->proxy->listener->stats.total_timeouts);
 
 		if (request->packet->code == PW_CODE_COA_REQUEST) {
-			FR_STATS_TYPE_INC(proxy_coa_stats.total_timeouts);
+			FR_STATS_TYPE_INC(radius_stats_shard()->proxy_coa.total_timeouts);
 		} else {
-			FR_STATS_TYPE_INC(proxy_dsc_stats.total_timeouts);
+			FR_STATS_TYPE_INC(radius_stats_shard()->proxy_dsc.total_timeouts);
 		}
 	}
 #endif
@@ -5187,6 +5187,12 @@ int radius_event_init(TALLOC_CTX *ctx) {
 	el = fr_event_list_create(ctx, event_status, NULL);
 	if (!el) return 0;
 
+	if (main_config.timer_resolution &&
+	    (fr_event_list_timer_wheel(el, main_config.timer_resolution * 1000) < 0)) {
+		ERROR("Failed creating timer wheel: %s", fr_strerror());
+		return 0;
+	}
+
 #ifdef HAVE_SYSTEMD_WATCHDOG
 	if ( (int) sd_watchdog_interval > 0 ) sd_watchdog_event(NULL, ctx);
 #endif
@@ -0,0 +1,277 @@
+/*
+ * raddetail.c	Print binary detail files as text.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static char const	*progname = "raddetail";
+static char const	*secret;
+static bool		check_only = false;
+
+static void NEVER_RETURNS usage(int status)
+{
+	FILE *output = status ? stderr : stdout;
+
+	fprintf(output, "Usage: %s [options] file ...\n", progname);
+	fprintf(output, "Print binary detail files in the text detail format.\n");
+	fprintf(output, "options:\n");
+	fprintf(output, "  -c                Only check the records, and print a summary.\n");
+	fprintf(output, "  -d <raddb_dir>    Set configuration directory (defaults to " RADDBDIR ").\n");
+	fprintf(output, "  -D <dictdir>      Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(output, "  -h                Print this help message.\n");
+
+	exit(status);
+}
+
+/** Print one record, as rlm_detail would have written it in the text format
+ *
+ */
+static int record_print(TALLOC_CTX *ctx, detail_binary_t const *entry)
+{
+	RADIUS_PACKET	*packet;
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	struct tm	tm;
+	time_t		when = entry->timestamp.tv_sec;
+	char		buffer[128];
+
+	packet = fr_radius_alloc(ctx, false);
+	if (!packet) return -1;
+
+	packet->src_ipaddr = entry->src_ipaddr;
+	packet->data = talloc_memdup(packet, entry->data, entry->data_len);
+	packet->data_len = entry->data_len;
+	packet->code = packet->data[0];
+	packet->id = packet->data[1];
+	memcpy(packet->vector, packet->data + 4, sizeof(packet->vector));
+
+	if (!fr_radius_ok(packet, false, NULL) || (fr_radius_decode(packet, NULL, secret) < 0)) {
+		talloc_free(packet);
+		return -1;
+	}
+
+	if (check_only) {
+		talloc_free(packet);
+		return 0;
+	}
+
+	strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Y", localtime_r(&when, &tm));
+	printf("%s\n", buffer);
+
+	if (is_radius_code(packet->code)) {
+		printf("\tPacket-Type = %s\n", fr_packet_codes[packet->code]);
+	} else {
+		printf("\tPacket-Type = %u\n", packet->code);
+	}
+
+	switch (entry->src_ipaddr.af) {
+	case AF_INET:
+	case AF_INET6:
+		inet_ntop(entry->src_ipaddr.af, &entry->src_ipaddr.ipaddr, buffer, sizeof(buffer));
+		printf("\tPacket-Src-%s-Address = %s\n",
+		       (entry->src_ipaddr.af == AF_INET) ? "IP" : "IPv6", buffer);
+		printf("\tPacket-Src-Port = %u\n", entry->src_port);
+		break;
+
+	default:
+		break;
+	}
+
+	for (vp = fr_pair_cursor_init(&cursor, &packet->vps);
+	     vp;
+	     vp = fr_pair_cursor_next(&cursor)) {
+		fr_pair_fprint(stdout, vp);
+	}
+
+	/*
+	 *	proto_detail skips entries which it has marked as
+	 *	done, so tell the text reader to do the same.
+	 */
+	printf("\t%s = %lu\n\n", entry->done ? "Donestamp" : "Timestamp", (unsigned long) when);
+
+	talloc_free(packet);
+
+	return 0;
+}
+
+static int file_print(TALLOC_CTX *ctx, char const *filename)
+{
+	int		fd;
+	struct stat	buf;
+	uint8_t		*data;
+	size_t		size, offset = 0;
+	ssize_t		len;
+	int		records = 0, done = 0, errors = 0;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: Failed opening %s: %s\n", progname, filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &buf) < 0) {
+		fprintf(stderr, "%s: Failed reading %s: %s\n", progname, filename, fr_syserror(errno));
+		close(fd);
+		return -1;
+	}
+	size = buf.st_size;
+
+	data = talloc_array(ctx, uint8_t, size ? size : 1);
+	while (offset < size) {
+		len = read(fd, data + offset, size - offset);
+		if (len <= 0) {
+			if ((len < 0) && (errno == EINTR)) continue;
+
+			fprintf(stderr, "%s: Failed reading %s: %s\n", progname, filename,
+				len ? fr_syserror(errno) : "Unexpected end of file");
+			close(fd);
+			talloc_free(data);
+			return -1;
+		}
+		offset += len;
+	}
+	close(fd);
+
+	if (size && !detail_binary_is(data, size)) {
+		fprintf(stderr, "%s: %s is not a binary detail file\n", progname, filename);
+		talloc_free(data);
+		return -1;
+	}
+
+	for (offset = 0; offset < size; offset += detail_binary_next(data + offset, size - offset)) {
+		detail_binary_t entry;
+
+		len = detail_binary_decode(&entry, data + offset, size - offset);
+		if (len == 0) {
+			fprintf(stderr, "%s: %s: Truncated record at offset %zu\n", progname, filename, offset);
+			errors++;
+			continue;
+		}
+
+		if (len < 0) {
+			fprintf(stderr, "%s: %s: Skipping record at offset %zu: %s\n",
+				progname, filename, offset, fr_strerror());
+			errors++;
+			continue;
+		}
+
+		if (record_print(ctx, &entry) < 0) {
+			fprintf(stderr, "%s: %s: Failed decoding record at offset %zu: %s\n",
+				progname, filename, offset, fr_strerror());
+			errors++;
+			continue;
+		}
+
+		records++;
+		if (entry.done) done++;
+	}
+	talloc_free(data);
+
+	if (check_only) {
+		printf("%s: %d records, %d marked as done, %d errors\n", filename, records, done, errors);
+	}
+
+	return errors ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i, rcode = 0;
+	char const	*raddb_dir = RADDBDIR;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+#ifndef NDEBUG
+	if (fr_fault_setup(getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("raddetail");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	talloc_set_log_stderr();
+
+	while ((c = getopt(argc, argv, "cd:D:h")) != EOF) switch (c) {
+		case 'c':
+			check_only = true;
+			break;
+
+		case 'd':
+			raddb_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'h':
+			usage(0);	/* never returns */
+
+		default:
+			usage(1);	/* never returns */
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0) usage(1);
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (fr_dict_read(dict, raddb_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("raddetail");
+		return 1;
+	}
+	fr_strerror();	/* Clear the error buffer */
+
+	/*
+	 *	The decoder wants a talloced secret.
+	 */
+	secret = talloc_typed_strdup(autofree, DETAIL_BINARY_SECRET);
+
+	for (i = 0; i < argc; i++) {
+		if (file_print(autofree, argv[i]) < 0) rcode = 1;
+	}
+
+	talloc_free(autofree);
+
+	return rcode;
+}
@@ -1393,7 +1393,12 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			FILE *log_fp = fr_log_fp;
 
 			fr_log_fp = NULL;
-			ret = fr_radius_decode(current, original ? original->expect : NULL, conf->radius_secret);
+			if (conf->decode_da) {
+				ret = fr_radius_decode_only(current, original ? original->expect : NULL,
+							    conf->radius_secret, conf->decode_da, conf->decode_da_num);
+			} else {
+				ret = fr_radius_decode(current, original ? original->expect : NULL, conf->radius_secret);
+			}
 			fr_log_fp = log_fp;
 			if (ret != 0) {
 				fr_radius_free(&current);
@@ -1499,7 +1504,12 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			FILE *log_fp = fr_log_fp;
 
 			fr_log_fp = NULL;
-			ret = fr_radius_decode(current, NULL, conf->radius_secret);
+			if (conf->decode_da) {
+				ret = fr_radius_decode_only(current, NULL, conf->radius_secret,
+							    conf->decode_da, conf->decode_da_num);
+			} else {
+				ret = fr_radius_decode(current, NULL, conf->radius_secret);
+			}
 			fr_log_fp = log_fp;
 
 			if (ret != 0) {
@@ -1951,6 +1961,47 @@ static int rs_build_filter(VALUE_PAIR **out, char const *filter)
 	return 0;
 }
 
+/** Build the list of attributes to decode, when we're not printing packets
+ *
+ * Everything we list, link on or filter on.  If we can't build the
+ * list, we fall back to decoding all attributes.
+ */
+static void rs_build_decode_list(void)
+{
+	int		num;
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	num = conf->list_da_num + conf->link_da_num;
+
+	for (vp = fr_pair_cursor_init(&cursor, &conf->filter_request_vps);
+	     vp;
+	     vp = fr_pair_cursor_next(&cursor)) num++;
+
+	for (vp = fr_pair_cursor_init(&cursor, &conf->filter_response_vps);
+	     vp;
+	     vp = fr_pair_cursor_next(&cursor)) num++;
+
+	if (!num) return;
+
+	conf->decode_da = talloc_array(conf, fr_dict_attr_t const *, num);
+	if (!conf->decode_da) return;
+
+	memcpy(conf->decode_da, conf->list_da, conf->list_da_num * sizeof(conf->decode_da[0]));
+	conf->decode_da_num = conf->list_da_num;
+
+	memcpy(conf->decode_da + conf->decode_da_num, conf->link_da, conf->link_da_num * sizeof(conf->decode_da[0]));
+	conf->decode_da_num += conf->link_da_num;
+
+	for (vp = fr_pair_cursor_init(&cursor, &conf->filter_request_vps);
+	     vp;
+	     vp = fr_pair_cursor_next(&cursor)) conf->decode_da[conf->decode_da_num++] = vp->da;
+
+	for (vp = fr_pair_cursor_init(&cursor, &conf->filter_response_vps);
+	     vp;
+	     vp = fr_pair_cursor_next(&cursor)) conf->decode_da[conf->decode_da_num++] = vp->da;
+}
+
 static int rs_build_event_flags(int *flags, FR_NAME_NUMBER const *map, char *list)
 {
 	size_t i = 0;
@@ -2582,6 +2633,14 @@ int main(int argc, char *argv[])
 		conf->decode_attrs = true;
 	}
 
+	/*
+	 *	If we're not printing the packet contents, there's no
+	 *	point in decoding attributes nobody will look at.
+	 */
+	if (conf->decode_attrs && !conf->print_packet) {
+		rs_build_decode_list();
+	}
+
 	/*
 	 *	Setup the request tree
 	 */
@@ -498,6 +498,11 @@ static bool home_server_insert(home_server_t *home, CONF_SECTION *cs)
 	}
 
 #ifdef WITH_STATS
+	/*
+	 *	Always a new histogram, as the accounting server of a
+	 *	dual home server is a copy of the authentication one.
+	 */
+	home->latency = fr_stats_latency_alloc(home);
 	home->number = home_server_max_number++;
 	if (!rbtree_insert(home_servers_bynumber, home)) {
 		rbtree_deletebydata(home_servers_byname, home);
@@ -1561,6 +1566,7 @@ static int old_server_add(realm_config_t *rc, CONF_SECTION *cs,
 		}
 
 #ifdef WITH_STATS
+		home->latency = fr_stats_latency_alloc(home);
 		home->number = home_server_max_number++;
 		if (!rbtree_insert(home_servers_bynumber, home)) {
 			rbtree_deletebydata(home_servers_byname, home);
@@ -2443,12 +2449,12 @@ home_server_t *home_server_ldb(char const *realmname,
 	case HOME_POOL_CLIENT_BALANCE:
 		switch (request->packet->src_ipaddr.af) {
 		case AF_INET:
-			hash = fr_hash(&request->packet->src_ipaddr.ipaddr.ip4addr,
+			hash = fr_hash_fnv(&request->packet->src_ipaddr.ipaddr.ip4addr,
 					 sizeof(request->packet->src_ipaddr.ipaddr.ip4addr));
 			break;
 
 		case AF_INET6:
-			hash = fr_hash(&request->packet->src_ipaddr.ipaddr.ip6addr,
+			hash = fr_hash_fnv(&request->packet->src_ipaddr.ipaddr.ip6addr,
 					 sizeof(request->packet->src_ipaddr.ipaddr.ip6addr));
 			break;
 
@@ -2462,12 +2468,12 @@ home_server_t *home_server_ldb(char const *realmname,
 	case HOME_POOL_CLIENT_PORT_BALANCE:
 		switch (request->packet->src_ipaddr.af) {
 		case AF_INET:
-			hash = fr_hash(&request->packet->src_ipaddr.ipaddr.ip4addr,
+			hash = fr_hash_fnv(&request->packet->src_ipaddr.ipaddr.ip4addr,
 					 sizeof(request->packet->src_ipaddr.ipaddr.ip4addr));
 			break;
 
 		case AF_INET6:
-			hash = fr_hash(&request->packet->src_ipaddr.ipaddr.ip6addr,
+			hash = fr_hash_fnv(&request->packet->src_ipaddr.ipaddr.ip6addr,
 					 sizeof(request->packet->src_ipaddr.ipaddr.ip6addr));
 			break;
 
@@ -2475,14 +2481,14 @@ home_server_t *home_server_ldb(char const *realmname,
 			hash = 0;
 			break;
 		}
-		fr_hash_update(&request->packet->src_port,
+		fr_hash_fnv_update(&request->packet->src_port,
 				 sizeof(request->packet->src_port), hash);
 		start = hash % pool->num_home_servers;
 		break;
 
 	case HOME_POOL_KEYED_BALANCE:
 		if ((vp = fr_pair_find_by_num(request->control, 0, PW_LOAD_BALANCE_KEY, TAG_ANY)) != NULL) {
-			hash = fr_hash(vp->vp_strvalue, vp->vp_length);
+			hash = fr_hash_fnv(vp->vp_strvalue, vp->vp_length);
 			start = hash % pool->num_home_servers;
 			break;
 		}
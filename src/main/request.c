@@ -44,6 +44,103 @@ struct request_data_t {
 						//!< after we're done processing this request.
 };
 
+/*
+ *	Every request, its packets, and all of their attributes are
+ *	allocated from one talloc pool.  The attributes are the bulk
+ *	of it, and if they don't fit, each one becomes a separate
+ *	malloc().  So we measure how much the requests actually use,
+ *	and size new pools to fit.
+ *
+ *	These are statistics, so like the other server statistics they
+ *	aren't locked.  A race costs us one sample.
+ */
+#define REQUEST_MEMORY_SAMPLE	(16)		//!< Measure one request in this many.
+#define REQUEST_MEMORY_RESIZE	(256)		//!< Resize the pool after this many samples.
+#define REQUEST_CHUNK_OVERHEAD	(112)		//!< Approximate size of a talloc chunk header.
+#define REQUEST_POOL_MAX	(1024 * 1024)
+
+static uint64_t	request_memory_seq;		//!< Number of pools freed.
+static uint64_t	request_memory_samples;		//!< Number of pools measured.
+static uint64_t	request_memory_blocks;		//!< Total talloc chunks in the measured pools.
+static uint64_t	request_memory_bytes;		//!< Total bytes in the measured pools.
+static size_t	request_pool_size;		//!< Size of new pools.  0 for the configured size.
+
+/** Allocate a talloc pool to hold a request, its packets, and their attributes
+ *
+ * Freeing the pool frees everything in it with one free().
+ * Attributes can still be moved to other contexts with fr_pair_steal() or
+ * fr_pair_list_move(), but anything stolen from the pool keeps the whole pool
+ * allocated until it is itself freed.  Data which outlives the request
+ * should therefore be copied, not stolen.
+ *
+ * @param[in] name	of the pool, for talloc reports.
+ * @return
+ *	- The new pool.
+ *	- NULL on error.
+ */
+TALLOC_CTX *request_pool_alloc(char const *name)
+{
+	TALLOC_CTX	*ctx;
+	size_t		size = request_pool_size;
+
+	if (size < main_config.talloc_pool_size) size = main_config.talloc_pool_size;
+
+	ctx = talloc_pool(NULL, size);
+	if (!ctx) return NULL;
+
+	talloc_set_name_const(ctx, name);
+
+	return ctx;
+}
+
+/** Record how much memory a request pool holds, just before it is freed
+ *
+ * Only a sample of pools is measured, as walking the talloc tree
+ * costs about as much as freeing it.
+ *
+ * @param[in] ctx	allocated by request_pool_alloc().
+ */
+void request_pool_account(TALLOC_CTX *ctx)
+{
+	uint64_t blocks, bytes, size;
+
+	if ((request_memory_seq++ % REQUEST_MEMORY_SAMPLE) != 0) return;
+
+	request_memory_samples++;
+	request_memory_blocks += talloc_total_blocks(ctx);
+	request_memory_bytes += talloc_total_size(ctx);
+
+	if ((request_memory_samples % REQUEST_MEMORY_RESIZE) != 0) return;
+
+	/*
+	 *	Leave 25% headroom over the average, so that most
+	 *	requests fit.
+	 */
+	blocks = request_memory_blocks / request_memory_samples;
+	bytes = request_memory_bytes / request_memory_samples;
+	size = bytes + (blocks * REQUEST_CHUNK_OVERHEAD);
+	size += size / 4;
+	size = (size + 1023) & ~((uint64_t) 1023);
+
+	if (size > REQUEST_POOL_MAX) size = REQUEST_POOL_MAX;
+
+	request_pool_size = size;
+}
+
+/** Return the memory statistics for request pools
+ *
+ * @param[out] stats	to write the statistics to.
+ */
+void request_pool_stats(request_pool_stats_t *stats)
+{
+	stats->requests = request_memory_seq;
+	stats->samples = request_memory_samples;
+	stats->blocks = request_memory_samples ? request_memory_blocks / request_memory_samples : 0;
+	stats->bytes = request_memory_samples ? request_memory_bytes / request_memory_samples : 0;
+	stats->pool_size = (request_pool_size > main_config.talloc_pool_size) ?
+			   request_pool_size : main_config.talloc_pool_size;
+}
+
 /** Callback for freeing a request struct
  *
  */
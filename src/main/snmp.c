@@ -155,9 +155,12 @@ static int snmp_config_reset_set(NDEBUG_UNUSED fr_snmp_map_t const *map, UNUSED
 static int snmp_auth_stats_offset_get(UNUSED TALLOC_CTX *ctx, value_box_t *out,
 				      fr_snmp_map_t const *map, UNUSED void *snmp_ctx)
 {
+	fr_stats_shard_t sum;
+
 	rad_assert(map->da->type == PW_TYPE_INTEGER);
 
-	out->datum.integer = *(uint32_t *)((uint8_t *)(&radius_auth_stats) + map->offset);
+	radius_stats_sum(&sum);
+	out->datum.integer = *(uint32_t *)((uint8_t *)(&sum.auth) + map->offset);
 	out->length = dict_attr_sizes[PW_TYPE_INTEGER][0];
 
 	return 0;
@@ -42,6 +42,11 @@
           \-> reply                 \-> reply                 \-> access-reject/access-accept
  * @endverbatim
  *
+ * Entries are spread over a number of shards by the hash of their State
+ * value.  Each shard has its own mutex, lookup tree, and expiry list, so
+ * threads working on different authentication sessions rarely contend.
+ * No code path ever holds more than one shard mutex at a time.
+ *
  * @copyright 2014 The FreeRADIUS server project
  */
 RCSID("$Id$")
@@ -50,6 +55,18 @@ RCSID("$Id$")
 #include <freeradius-devel/state.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+/** Number of independently locked shards when running with worker threads
+ *
+ * Must be a power of 2.
+ */
+#define STATE_TREE_SHARDS	32
+
 /** Holds a state value, and associated VALUE_PAIRs and data
  *
  */
@@ -93,6 +110,7 @@ typedef struct state_entry {
 	};
 
 	uint64_t		seq_start;			//!< Number of first request in this sequence.
+	uint32_t		shard;				//!< Shard the entry is stored in.
 	time_t			cleanup;			//!< When this entry should be cleaned up.
 	struct state_entry	*prev;				//!< Previous entry in the cleanup list.
 	struct state_entry	*next;				//!< Next entry in the cleanup list.
@@ -106,16 +124,30 @@ typedef struct state_entry {
 	request_data_t		*data;				//!< Persistable request data, also parented ctx.
 } fr_state_entry_t;
 
-struct fr_state_tree_t {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
-								//!< timeout.
-	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
+/** A subset of the state entries, protected by its own mutex
+ *
+ */
+typedef struct state_shard {
 	rbtree_t		*tree;				//!< rbtree used to lookup state value.
 
 	fr_state_entry_t	*head, *tail;			//!< Entries to expire.
-	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+
+	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
+								//!< timeout.
+	uint64_t		locked;				//!< Number of times the mutex was acquired.
+	uint64_t		contended;			//!< Number of times the mutex was already held
+								//!< by another thread.
+} fr_state_shard_t;
+
+struct fr_state_tree_t {
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
+	atomic_uint_fast32_t	tracked;			//!< Number of entries in all shards.
+	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
+	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
+
+	uint32_t		num_shards;			//!< Number of shards, a power of 2.
+	fr_state_shard_t	*shards;			//!< Array of shards.
 };
 
 fr_state_tree_t *global_state = NULL;
@@ -136,34 +168,60 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
+/** Return the shard a state value belongs in
+ *
+ * @note The state value must already have been XOR'd with the server hash.
+ */
+static inline uint32_t state_shard_num(fr_state_tree_t *state, uint8_t const *value, size_t len)
+{
+	return fr_hash(value, len) & (state->num_shards - 1);
+}
+
+/** Lock a shard, recording whether we had to wait for it
+ *
+ */
+static inline void state_shard_lock(fr_state_shard_t *shard)
+{
+	if (!main_config.spawn_workers) return;
+
+	if (pthread_mutex_trylock(&shard->mutex) != 0) {
+		pthread_mutex_lock(&shard->mutex);
+		shard->contended++;
+	}
+	shard->locked++;
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *this;
-
-	if (main_config.spawn_workers) pthread_mutex_destroy(&state->mutex);
+	uint32_t		i;
+	fr_state_entry_t	*this;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while (state->head) {
-		this = state->head;
-		state_entry_unlink(state, this);
-		talloc_free(this);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	for (this = state->head; this; this = this->next) DEBUG4("State %" PRIu64 " needs freeing prev was %" PRIu64 "", this->id, this->prev ? this->prev->id : 100000);
+		if (main_config.spawn_workers) pthread_mutex_destroy(&shard->mutex);
 
-	/*
-	 *	Ensure we got *all* the entries
-	 */
-	rad_assert(!state->head);
+		while (shard->head) {
+			this = shard->head;
+			state_entry_unlink(state, this);
+			talloc_free(this);
+		}
 
-	/*
-	 *	Free the rbtree
-	 */
-	rbtree_free(state->tree);
+		/*
+		 *	Ensure we got *all* the entries
+		 */
+		rad_assert(!shard->head);
+
+		/*
+		 *	Free the rbtree
+		 */
+		rbtree_free(shard->tree);
+	}
 
 	if (state == global_state) global_state = NULL;
 
@@ -179,6 +237,7 @@ static int _state_tree_free(fr_state_tree_t *state)
  */
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint32_t timeout)
 {
+	uint32_t	i;
 	fr_state_tree_t *state;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
@@ -186,6 +245,19 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	atomic_init(&state->id, 0);
+	atomic_init(&state->tracked, 0);
+
+	/*
+	 *	Without worker threads there's nothing to
+	 *	contend with, so one shard is enough.
+	 */
+	state->num_shards = main_config.spawn_workers ? STATE_TREE_SHARDS : 1;
+	state->shards = talloc_zero_array(state, fr_state_shard_t, state->num_shards);
+	if (!state->shards) {
+		talloc_free(state);
+		return NULL;
+	}
 
 	/*
 	 *	Create a break in the contexts.
@@ -196,60 +268,127 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint
 	 */
 	fr_talloc_link_ctx(ctx, state);
 
-	if (main_config.spawn_workers && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		if (main_config.spawn_workers && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+		error:
+			/*
+			 *	Only tear down the shards we set up.
+			 */
+			state->num_shards = i;
+			talloc_set_destructor(state, _state_tree_free);
+			talloc_free(state);
+			return NULL;
+		}
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
+		if (!shard->tree) {
+			if (main_config.spawn_workers) pthread_mutex_destroy(&shard->mutex);
+			goto error;
+		}
 	}
 	talloc_set_destructor(state, _state_tree_free);
 
 	return state;
 }
 
-/** Unlink an entry and remove if from the tree
+/** Unlink an entry and remove if from its shard
  *
+ * @note Called with the shard's mutex held.
  */
 static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
 {
+	fr_state_shard_t *shard = &state->shards[entry->shard];
 	fr_state_entry_t *prev, *next;
 
 	prev = entry->prev;
 	next = entry->next;
 
 	if (prev) {
-		rad_assert(state->head != entry);
+		rad_assert(shard->head != entry);
 		prev->next = next;
-	} else if (state->head) {
-		rad_assert(state->head == entry);
-		state->head = next;
+	} else if (shard->head) {
+		rad_assert(shard->head == entry);
+		shard->head = next;
 	}
 
 	if (next) {
-		rad_assert(state->tail != entry);
+		rad_assert(shard->tail != entry);
 		next->prev = prev;
-	} else if (state->tail) {
-		rad_assert(state->tail == entry);
-		state->tail = prev;
+	} else if (shard->tail) {
+		rad_assert(shard->tail == entry);
+		shard->tail = prev;
 	}
 	entry->next = NULL;
 	entry->prev = NULL;
 
-	rbtree_deletebydata(state->tree, entry);
+	if (rbtree_deletebydata(shard->tree, entry)) {
+		atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+	}
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
 
+/** Unlink any expired entries from the head of a shard's cleanup list
+ *
+ * @note Called with the shard's mutex held.
+ *
+ * @param[in] state		tree the shard belongs to.
+ * @param[in] shard		to expire entries in.
+ * @param[in] now		the current time.
+ * @param[in,out] free_next	where to append the unlinked entries, so that
+ *				they can be freed once the mutex is released.
+ * @return where to append any further entries.
+ */
+static fr_state_entry_t **state_shard_expire(fr_state_tree_t *state, fr_state_shard_t *shard,
+					     time_t now, fr_state_entry_t **free_next)
+{
+	fr_state_entry_t *entry, *next;
+
+	for (entry = shard->head; entry != NULL; entry = next) {
+		next = entry->next;
+
+		/*
+		 *	The list is ordered by cleanup time, so
+		 *	the first live entry ends the scan.
+		 */
+		if (entry->cleanup >= now) break;
+
+		state_entry_unlink(state, entry);
+		*free_next = entry;
+		free_next = &(entry->next);
+		shard->timed_out++;
+	}
+
+	return free_next;
+}
+
+/** Free a list of entries which were unlinked with a shard's mutex held
+ *
+ * We do it outside of the mutex as freeing may involve significantly more
+ * work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed also,
+ * and it may have complex destructors associated with it.
+ */
+static void state_entry_list_free(fr_state_entry_t *head)
+{
+	fr_state_entry_t *entry, *next;
+
+	for (next = head; next;) {
+		entry = next;
+		next = entry->next;
+		talloc_free(entry);
+	}
+}
+
 /** Frees any data associated with a state
  *
  */
@@ -288,47 +427,74 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
+/** Find the entry, based on the State attribute
+ *
+ * On success the mutex of the shard holding the entry is held, and
+ * must be released by the caller.
+ *
+ * @param[in] state	tree to search in.
+ * @param[in] request	the current request.
+ * @param[in] packet	containing the State attribute.
+ * @return
+ *	- The entry, with its shard locked.
+ *	- NULL if no entry matched.  No mutex is held.
+ */
+static fr_state_entry_t *state_entry_find_and_lock(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet)
+{
+	VALUE_PAIR *vp;
+	fr_state_shard_t *shard;
+	fr_state_entry_t *entry, my_entry;
+
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_STATE, TAG_ANY);
+	if (!vp) return NULL;
+
+	if (vp->vp_length != sizeof(my_entry.state)) return NULL;
+
+	memcpy(my_entry.state, vp->vp_octets, sizeof(my_entry.state));
+
+	/*
+	 *	Make it unique for different virtual servers handling the same request
+	 */
+	my_entry.state_comp.server_hash ^= fr_hash_string(request->server);
+
+	shard = &state->shards[state_shard_num(state, my_entry.state, sizeof(my_entry.state))];
+
+	state_shard_lock(shard);
+	entry = rbtree_finddata(shard->tree, &my_entry);
+	if (!entry) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+		return NULL;
+	}
+
+#ifdef WITH_VERIFY_PTR
+	(void) talloc_get_type_abort(entry, fr_state_entry_t);
+#endif
+
+	return entry;
+}
+
 /** Create a new state entry
  *
- * @note Called with the mutex held.
+ * If there's an existing entry for the original packet, the new state is
+ * derived from it, and the existing entry is removed.
+ *
+ * @note Called with no mutex held.  The new entry must be inserted
+ *	with #state_entry_insert.
  */
 static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
-					    RADIUS_PACKET *packet, fr_state_entry_t *old)
+					    RADIUS_PACKET *packet, RADIUS_PACKET *original)
 {
 	size_t			i;
 	uint32_t		x;
 	time_t			now = time(NULL);
 	VALUE_PAIR		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_shard_t	*shard;
+	fr_state_entry_t	*entry, *old = NULL;
 	fr_state_entry_t	*free_head = NULL, **free_next = &free_head;
 
 	uint8_t			old_state[sizeof(old->state)];
 	int			old_tries = 0;
 
-	/*
-	 *	Clean up old entries.
-	 */
-	for (entry = state->head; entry != NULL; entry = next) {
-		next = entry->next;
-
-		if (entry == old) continue;
-
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
-			*free_next = entry;
-			free_next = &(entry->next);
-			state->timed_out++;
-			continue;
-		}
-
-		break;
-	}
-
-	if (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions) return NULL;
-
 	/*
 	 *	Record the information from the old state, we may base the
 	 *	new state off the old one.
@@ -336,7 +502,10 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 *	Once we release the mutex, the state of old becomes indeterminate
 	 *	so we have to grab the values now.
 	 */
+	if (original) old = state_entry_find_and_lock(state, request, original);
 	if (old) {
+		shard = &state->shards[old->shard];
+
 		old_tries = old->tries;
 
 		memcpy(old_state, old->state, sizeof(old_state));
@@ -347,40 +516,28 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		if (!old->data) {
 			state_entry_unlink(state, old);
 			*free_next = old;
+			free_next = &(old->next);
 		}
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	for (next = free_head; next;) {
-		entry = next;
-		next = entry->next;
-		talloc_free(entry);
+		/*
+		 *	Clean up old entries while we have the shard.
+		 */
+		free_next = state_shard_expire(state, shard, now, free_next);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+		state_entry_list_free(free_head);
 	}
 
+	if (atomic_load_explicit(&state->tracked, memory_order_relaxed) >= state->max_sessions) return NULL;
+
 	/*
 	 *	Allocation doesn't need to occur inside the critical region
 	 *	and would add significantly to contention.
-	 *
-	 *	We reparent the talloc chunk later (when we hold the mutex again)
-	 *	we can't do it now due to thread safety issues with talloc.
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
-	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
+	if (!entry) return NULL;
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -452,12 +609,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		       entry->id, hex, (uint64_t)entry->cleanup - now);
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (rbtree_num_elements(state->tree) >= (uint32_t)state->max_sessions) {
-		talloc_free(entry);
-		return NULL;
-	}
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -466,58 +617,66 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(request->server);
 
-	if (!rbtree_insert(state->tree, entry)) {
-		talloc_free(entry);
-		return NULL;
-	}
-
-	/*
-	 *	Link it to the end of the list, which is implicitely
-	 *	ordered by cleanup time.
-	 */
-	if (!state->head) {
-		entry->prev = entry->next = NULL;
-		state->head = state->tail = entry;
-	} else {
-		rad_assert(state->tail != NULL);
-
-		entry->prev = state->tail;
-		state->tail->next = entry;
-
-		entry->next = NULL;
-		state->tail = entry;
-	}
-
 	return entry;
 }
 
-/** Find the entry, based on the State attribute
+/** Insert a new entry into its shard, expiring any old entries there
  *
+ * @note Called with no mutex held.
+ *
+ * @param[in] state	tree to insert into.
+ * @param[in] entry	created by #state_entry_create.
+ * @return
+ *	- 0 on success.
+ *	- -1 if we're tracking too many sessions, or the state value is a duplicate.
+ *	  The entry is not freed.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet)
+static int state_entry_insert(fr_state_tree_t *state, fr_state_entry_t *entry)
 {
-	VALUE_PAIR *vp;
-	fr_state_entry_t *entry, my_entry;
+	fr_state_shard_t	*shard;
+	fr_state_entry_t	*free_head = NULL;
+	int			rcode = -1;
 
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_STATE, TAG_ANY);
-	if (!vp) return NULL;
+	entry->shard = state_shard_num(state, entry->state, sizeof(entry->state));
+	shard = &state->shards[entry->shard];
 
-	if (vp->vp_length != sizeof(my_entry.state)) return NULL;
+	state_shard_lock(shard);
+	(void) state_shard_expire(state, shard, time(NULL), &free_head);
 
-	memcpy(my_entry.state, vp->vp_octets, sizeof(my_entry.state));
+	if (atomic_fetch_add_explicit(&state->tracked, 1, memory_order_relaxed) >= state->max_sessions) {
+		atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+		goto done;
+	}
+
+	if (!rbtree_insert(shard->tree, entry)) {
+		atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+		goto done;
+	}
 
 	/*
-	 *	Make it unique for different virtual servers handling the same request
+	 *	Link it to the end of the list, which is implicitely
+	 *	ordered by cleanup time.
 	 */
-	my_entry.state_comp.server_hash ^= fr_hash_string(request->server);
+	if (!shard->head) {
+		entry->prev = entry->next = NULL;
+		shard->head = shard->tail = entry;
+	} else {
+		rad_assert(shard->tail != NULL);
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+		entry->prev = shard->tail;
+		shard->tail->next = entry;
 
-#ifdef WITH_VERIFY_PTR
-	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
-#endif
+		entry->next = NULL;
+		shard->tail = entry;
+	}
+	rcode = 0;
 
-	return entry;
+done:
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	state_entry_list_free(free_head);
+
+	return rcode;
 }
 
 /** Called when sending an Access-Accept/Access-Reject to discard state information
@@ -527,14 +686,11 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *o
 {
 	fr_state_entry_t *entry;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, original);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return;
-	}
+	entry = state_entry_find_and_lock(state, request, original);
+	if (!entry) return;
+
 	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&state->shards[entry->shard].mutex);
 
 	/*
 	 *	The state and request must be in the same state
@@ -575,9 +731,7 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
-	entry = state_entry_find(state, request, packet);
+	entry = state_entry_find_and_lock(state, request, packet);
 	if (entry) {
 		if (request->state_ctx) old_ctx = request->state_ctx;
 
@@ -589,9 +743,9 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		entry->ctx = NULL;
 		entry->vps = NULL;
 		entry->data = NULL;
-	}
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&state->shards[entry->shard].mutex);
+	}
 
 	if (request->state) {
 		RDEBUG2("Restored &session-state");
@@ -619,7 +773,7 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
  */
 bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *original, RADIUS_PACKET *packet)
 {
-	fr_state_entry_t *entry, *old;
+	fr_state_entry_t *entry;
 	request_data_t *data;
 
 	request_data_by_persistance(&data, request, true);
@@ -631,30 +785,41 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		rdebug_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
-	old = original ? state_entry_find(state, request, original) :
-			 NULL;
-
-	entry = state_entry_create(state, request, packet, old);
+	entry = state_entry_create(state, request, packet, original);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		request_data_restore(request, data);
 		return false;
 	}
 
 	rad_assert(entry->ctx == NULL);
 	rad_assert(request->state_ctx);
 
+	/*
+	 *	Nothing else can see the entry until it's inserted,
+	 *	so it's safe to populate it without a mutex.
+	 */
 	entry->seq_start = request->seq_start;
 	entry->ctx = request->state_ctx;
 	entry->vps = request->state;
 	entry->data = data;
 
+	if (state_entry_insert(state, entry) < 0) {
+		/*
+		 *	Give everything back, so it's freed
+		 *	along with the request.
+		 */
+		entry->ctx = NULL;
+		entry->vps = NULL;
+		entry->data = NULL;
+		talloc_free(entry);
+
+		request_data_restore(request, data);
+		return false;
+	}
+
 	request->state_ctx = NULL;
 	request->state = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
 	rad_assert(request->state == NULL);
 	VERIFY_REQUEST(request);
 	return true;
@@ -665,7 +830,7 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -673,7 +838,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint32_t	i;
+	uint64_t	timed_out = 0;
+
+	for (i = 0; i < state->num_shards; i++) timed_out += state->shards[i].timed_out;
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -681,5 +851,44 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	return atomic_load_explicit(&state->tracked, memory_order_relaxed);
+}
+
+/** Return the number of shards the state entries are spread over
+ *
+ */
+uint32_t fr_state_num_shards(fr_state_tree_t *state)
+{
+	return state->num_shards;
+}
+
+/** Return a snapshot of the statistics for one shard
+ *
+ * @param[out] stats	to populate.
+ * @param[in] state	tree to get statistics for.
+ * @param[in] shard	number, from 0 to #fr_state_num_shards - 1.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the shard number is invalid.
+ */
+int fr_state_shard_stats(fr_state_shard_stats_t *stats, fr_state_tree_t *state, uint32_t shard)
+{
+	fr_state_shard_t *this;
+
+	if (shard >= state->num_shards) return -1;
+
+	this = &state->shards[shard];
+
+	/*
+	 *	Plain lock, we don't want radmin
+	 *	inflating the counters.
+	 */
+	PTHREAD_MUTEX_LOCK(&this->mutex);
+	stats->tracked = rbtree_num_elements(this->tree);
+	stats->timed_out = this->timed_out;
+	stats->locked = this->locked;
+	stats->contended = this->contended;
+	PTHREAD_MUTEX_UNLOCK(&this->mutex);
+
+	return 0;
 }
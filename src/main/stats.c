@@ -35,31 +35,148 @@ RCSID("$Id$")
 static struct timeval	start_time;
 static struct timeval	hup_time;
 
-#define FR_STATS_INIT { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 	\
-				 { 0, 0, 0, 0, 0, 0, 0, 0 }}
+/*
+ *	Every shard ever handed out.  Shards are never freed, so that
+ *	the counts of threads which have exited aren't lost.  Instead,
+ *	they're handed to the next thread which needs one.
+ */
+static fr_stats_shard_t	*stats_shards;
+static pthread_mutex_t	stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+fr_thread_local_setup(fr_stats_shard_t *, stats_shard)	/* macro */
+
+/** Give a shard back when its thread exits
+ *
+ */
+static void _stats_shard_release(void *arg)
+{
+	fr_stats_shard_t *shard = arg;
+
+	pthread_mutex_lock(&stats_mutex);
+	shard->in_use = false;
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+/** Find or allocate a shard for this thread
+ *
+ */
+static fr_stats_shard_t *stats_shard_alloc(void)
+{
+	fr_stats_shard_t *shard;
+
+	pthread_mutex_lock(&stats_mutex);
+	for (shard = stats_shards; shard != NULL; shard = shard->next) {
+		if (!shard->in_use) break;
+	}
+
+	if (!shard) {
+		void *mem;
+
+		/*
+		 *	Cache line aligned, so that the shards of
+		 *	two threads never share a line.
+		 */
+		if (posix_memalign(&mem, 64, sizeof(*shard)) != 0) {
+			pthread_mutex_unlock(&stats_mutex);
+			ERROR("Failed allocating statistics");
+			fr_exit_now(1);
+		}
+		shard = mem;
+		memset(shard, 0, sizeof(*shard));
+
+		shard->next = stats_shards;
+		stats_shards = shard;
+	}
+	shard->in_use = true;
+	pthread_mutex_unlock(&stats_mutex);
+
+	fr_thread_local_set_destructor(stats_shard, _stats_shard_release, shard);
 
-fr_stats_t radius_auth_stats = FR_STATS_INIT;
+	return shard;
+}
+
+/** Return this thread's copy of the global statistics
+ *
+ * @return the shard the calling thread should update.
+ */
+fr_stats_shard_t *radius_stats_shard(void)
+{
+	fr_stats_shard_t *shard = stats_shard;
+
+	if (shard) return shard;
+
+	return stats_shard_alloc();
+}
+
+/** Add one set of statistics to another
+ *
+ * @param[in,out] out statistics to add to.
+ * @param[in] in statistics to add.
+ */
+void fr_stats_add(fr_stats_t *out, fr_stats_t const *in)
+{
+	int i;
+
+	out->total_requests += in->total_requests;
+	out->total_invalid_requests += in->total_invalid_requests;
+	out->total_dup_requests += in->total_dup_requests;
+	out->total_responses += in->total_responses;
+	out->total_access_accepts += in->total_access_accepts;
+	out->total_access_rejects += in->total_access_rejects;
+	out->total_access_challenges += in->total_access_challenges;
+	out->total_malformed_requests += in->total_malformed_requests;
+	out->total_bad_authenticators += in->total_bad_authenticators;
+	out->total_packets_dropped += in->total_packets_dropped;
+	out->total_no_records += in->total_no_records;
+	out->total_unknown_types += in->total_unknown_types;
+	out->total_timeouts += in->total_timeouts;
+	if (in->last_packet > out->last_packet) out->last_packet = in->last_packet;
+
+	for (i = 0; i < 8; i++) out->elapsed[i] += in->elapsed[i];
+}
+
+/** Sum the per-thread shards
+ *
+ * Threads carry on updating their shards while we read them, so the
+ * totals may be a packet or two behind.  The writers never lock.
+ *
+ * @param[out] out where the totals are written.  Owned by the caller,
+ *	so that readers never see each other's partial sums.
+ */
+void radius_stats_sum(fr_stats_shard_t *out)
+{
+	fr_stats_shard_t *shard;
+
+	memset(out, 0, sizeof(*out));
+
+	pthread_mutex_lock(&stats_mutex);
+	for (shard = stats_shards; shard != NULL; shard = shard->next) {
+		fr_stats_add(&out->auth, &shard->auth);
 #ifdef WITH_ACCOUNTING
-fr_stats_t radius_acct_stats = FR_STATS_INIT;
+		fr_stats_add(&out->acct, &shard->acct);
 #endif
 #ifdef WITH_COA
-fr_stats_t radius_coa_stats = FR_STATS_INIT;
-fr_stats_t radius_dsc_stats = FR_STATS_INIT;
+		fr_stats_add(&out->coa, &shard->coa);
+		fr_stats_add(&out->dsc, &shard->dsc);
 #endif
-
 #ifdef WITH_PROXY
-fr_stats_t proxy_auth_stats = FR_STATS_INIT;
+		fr_stats_add(&out->proxy_auth, &shard->proxy_auth);
 #ifdef WITH_ACCOUNTING
-fr_stats_t proxy_acct_stats = FR_STATS_INIT;
+		fr_stats_add(&out->proxy_acct, &shard->proxy_acct);
 #endif
 #ifdef WITH_COA
-fr_stats_t proxy_coa_stats = FR_STATS_INIT;
-fr_stats_t proxy_dsc_stats = FR_STATS_INIT;
+		fr_stats_add(&out->proxy_coa, &shard->proxy_coa);
+		fr_stats_add(&out->proxy_dsc, &shard->proxy_dsc);
 #endif
 #endif
+	}
+	pthread_mutex_unlock(&stats_mutex);
+}
 
 void request_stats_final(REQUEST *request)
 {
+	fr_stats_shard_t *shard;
+
 	if (request->master_state == REQUEST_COUNTED) return;
 
 	if (!request->listener) return;
@@ -78,26 +195,28 @@ void request_stats_final(REQUEST *request)
 	if (request->packet->code == PW_CODE_STATUS_SERVER)
 		return;
 
+	shard = radius_stats_shard();
+
 #undef INC_AUTH
-#define INC_AUTH(_x) radius_auth_stats._x++;request->listener->stats._x++;request->client->auth._x++;
+#define INC_AUTH(_x) shard->auth._x++;request->listener->stats._x++;request->client->auth._x++;
 
 #undef INC_ACCT
 #ifdef WITH_ACCOUNTING
-#define INC_ACCT(_x) radius_acct_stats._x++;request->listener->stats._x++;request->client->acct._x++
+#define INC_ACCT(_x) shard->acct._x++;request->listener->stats._x++;request->client->acct._x++
 #else
 #define INC_ACCT(_x)
 #endif
 
 #undef INC_COA
 #ifdef WITH_COA
-#define INC_COA(_x) radius_coa_stats._x++;request->listener->stats._x++;request->client->coa._x++
+#define INC_COA(_x) shard->coa._x++;request->listener->stats._x++;request->client->coa._x++
 #else
 #define INC_COA(_x)
 #endif
 
 #undef INC_DSC
 #ifdef WITH_DSC
-#define INC_DSC(_x) radius_dsc_stats._x++;request->listener->stats._x++;request->client->dsc._x++
+#define INC_DSC(_x) shard->dsc._x++;request->listener->stats._x++;request->client->dsc._x++
 #else
 #define INC_DSC(_x)
 #endif
@@ -120,7 +239,7 @@ void request_stats_final(REQUEST *request)
 		/*
 		 *	FIXME: Do the time calculations once...
 		 */
-		fr_stats_bins(&radius_auth_stats,
+		fr_stats_bins(&shard->auth,
 			      &request->packet->timestamp,
 			      &request->reply->timestamp);
 		fr_stats_bins(&request->client->auth,
@@ -129,6 +248,9 @@ void request_stats_final(REQUEST *request)
 		fr_stats_bins(&request->listener->stats,
 			      &request->packet->timestamp,
 			      &request->reply->timestamp);
+		fr_stats_latency_add(request->client->latency,
+				     &request->packet->timestamp,
+				     &request->reply->timestamp);
 		break;
 
 	case PW_CODE_ACCESS_REJECT:
@@ -142,12 +264,15 @@ void request_stats_final(REQUEST *request)
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_RESPONSE:
 		INC_ACCT(total_responses);
-		fr_stats_bins(&radius_acct_stats,
+		fr_stats_bins(&shard->acct,
 			      &request->packet->timestamp,
 			      &request->reply->timestamp);
 		fr_stats_bins(&request->client->acct,
 			      &request->packet->timestamp,
 			      &request->reply->timestamp);
+		fr_stats_latency_add(request->client->latency,
+				     &request->packet->timestamp,
+				     &request->reply->timestamp);
 		break;
 #endif
 
@@ -159,6 +284,9 @@ void request_stats_final(REQUEST *request)
 		fr_stats_bins(&request->client->coa,
 			      &request->packet->timestamp,
 			      &request->reply->timestamp);
+		fr_stats_latency_add(request->client->latency,
+				     &request->packet->timestamp,
+				     &request->reply->timestamp);
 		break;
 
 	case PW_CODE_COA_NAK:
@@ -172,6 +300,9 @@ void request_stats_final(REQUEST *request)
 		fr_stats_bins(&request->client->dsc,
 			      &request->packet->timestamp,
 			      &request->reply->timestamp);
+		fr_stats_latency_add(request->client->latency,
+				     &request->packet->timestamp,
+				     &request->reply->timestamp);
 		break;
 
 	case PW_CODE_DISCONNECT_NAK:
@@ -208,25 +339,25 @@ void request_stats_final(REQUEST *request)
 
 	switch (request->proxy->packet->code) {
 	case PW_CODE_ACCESS_REQUEST:
-		proxy_auth_stats.total_requests += request->proxy->packet->count;
+		shard->proxy_auth.total_requests += request->proxy->packet->count;
 		request->proxy->home_server->stats.total_requests += request->proxy->packet->count;
 		break;
 
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_REQUEST:
-		proxy_acct_stats.total_requests += request->proxy->packet->count;
+		shard->proxy_acct.total_requests += request->proxy->packet->count;
 		request->proxy->home_server->stats.total_requests += request->proxy->packet->count;
 		break;
 #endif
 
 #ifdef WITH_COA
 	case PW_CODE_COA_REQUEST:
-		proxy_coa_stats.total_requests += request->proxy->packet->count;
+		shard->proxy_coa.total_requests += request->proxy->packet->count;
 		request->proxy->home_server->stats.total_requests += request->proxy->packet->count;
 		break;
 
 	case PW_CODE_DISCONNECT_REQUEST:
-		proxy_dsc_stats.total_requests += request->proxy->packet->count;
+		shard->proxy_dsc.total_requests += request->proxy->packet->count;
 		request->proxy->home_server->stats.total_requests += request->proxy->packet->count;
 		break;
 #endif
@@ -238,19 +369,22 @@ void request_stats_final(REQUEST *request)
 	if (!request->proxy->reply) goto done;	/* simplifies formatting */
 
 #undef INC
-#define INC(_x) proxy_auth_stats._x += request->proxy->reply->count; request->proxy->home_server->stats._x += request->proxy->reply->count;
+#define INC(_x) shard->proxy_auth._x += request->proxy->reply->count; request->proxy->home_server->stats._x += request->proxy->reply->count;
 
 	switch (request->proxy->reply->code) {
 	case PW_CODE_ACCESS_ACCEPT:
 		INC(total_access_accepts);
 	proxy_stats:
 		INC(total_responses);
-		fr_stats_bins(&proxy_auth_stats,
+		fr_stats_bins(&shard->proxy_auth,
 			      &request->proxy->packet->timestamp,
 			      &request->proxy->reply->timestamp);
 		fr_stats_bins(&request->proxy->home_server->stats,
 			      &request->proxy->packet->timestamp,
 			      &request->proxy->reply->timestamp);
+		fr_stats_latency_add(request->proxy->home_server->latency,
+				     &request->proxy->packet->timestamp,
+				     &request->proxy->reply->timestamp);
 		break;
 
 	case PW_CODE_ACCESS_REJECT:
@@ -263,45 +397,54 @@ void request_stats_final(REQUEST *request)
 
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_RESPONSE:
-		proxy_acct_stats.total_responses++;
+		shard->proxy_acct.total_responses++;
 		request->proxy->home_server->stats.total_responses++;
-		fr_stats_bins(&proxy_acct_stats,
+		fr_stats_bins(&shard->proxy_acct,
 			      &request->proxy->packet->timestamp,
 			      &request->proxy->reply->timestamp);
 		fr_stats_bins(&request->proxy->home_server->stats,
 			      &request->proxy->packet->timestamp,
 			      &request->proxy->reply->timestamp);
+		fr_stats_latency_add(request->proxy->home_server->latency,
+				     &request->proxy->packet->timestamp,
+				     &request->proxy->reply->timestamp);
 		break;
 #endif
 
 #ifdef WITH_COA
 	case PW_CODE_COA_ACK:
 	case PW_CODE_COA_NAK:
-		proxy_coa_stats.total_responses++;
+		shard->proxy_coa.total_responses++;
 		request->proxy->home_server->stats.total_responses++;
-		fr_stats_bins(&proxy_coa_stats,
+		fr_stats_bins(&shard->proxy_coa,
 			      &request->proxy->packet->timestamp,
 			      &request->proxy->reply->timestamp);
 		fr_stats_bins(&request->proxy->home_server->stats,
 			      &request->proxy->packet->timestamp,
 			      &request->proxy->reply->timestamp);
+		fr_stats_latency_add(request->proxy->home_server->latency,
+				     &request->proxy->packet->timestamp,
+				     &request->proxy->reply->timestamp);
 		break;
 
 	case PW_CODE_DISCONNECT_ACK:
 	case PW_CODE_DISCONNECT_NAK:
-		proxy_dsc_stats.total_responses++;
+		shard->proxy_dsc.total_responses++;
 		request->proxy->home_server->stats.total_responses++;
-		fr_stats_bins(&proxy_dsc_stats,
+		fr_stats_bins(&shard->proxy_dsc,
 			      &request->proxy->packet->timestamp,
 			      &request->proxy->reply->timestamp);
 		fr_stats_bins(&request->proxy->home_server->stats,
 			      &request->proxy->packet->timestamp,
 			      &request->proxy->reply->timestamp);
+		fr_stats_latency_add(request->proxy->home_server->latency,
+				     &request->proxy->packet->timestamp,
+				     &request->proxy->reply->timestamp);
 		break;
 #endif
 
 	default:
-		proxy_auth_stats.total_unknown_types++;
+		shard->proxy_auth.total_unknown_types++;
 		request->proxy->home_server->stats.total_unknown_types++;
 		break;
 	}
@@ -428,10 +571,99 @@ static void request_stats_addvp(REQUEST *request,
 	}
 }
 
+/** Add the percentiles of a latency histogram to the reply
+ *
+ */
+static void request_stats_addhist(REQUEST *request, fr_stats_hist_t const *hist)
+{
+	VALUE_PAIR *vp;
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+				PW_FREERADIUS_STATS_LATENCY_COUNT, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = hist->count;
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+				PW_FREERADIUS_STATS_LATENCY_USEC_MEAN, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = hist->count ? (hist->total_usec / hist->count) : 0;
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+				PW_FREERADIUS_STATS_LATENCY_USEC_P50, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = fr_stats_hist_percentile(hist, 50);
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+				PW_FREERADIUS_STATS_LATENCY_USEC_P90, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = fr_stats_hist_percentile(hist, 90);
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+				PW_FREERADIUS_STATS_LATENCY_USEC_P99, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = fr_stats_hist_percentile(hist, 99);
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+				PW_FREERADIUS_STATS_LATENCY_USEC_P99_9, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = fr_stats_hist_percentile(hist, 99.9);
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+				PW_FREERADIUS_STATS_LATENCY_USEC_MAX, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = hist->max_usec;
+}
+
+/*
+ *	Room in the reply for latency histograms, leaving space for the
+ *	other statistics.  Each one is a Stats-Latency-Name, and seven
+ *	integer VSAs.
+ */
+#define STATS_LATENCY_ROOM	(MAX_PACKET_LEN / 2)
+#define STATS_LATENCY_SIZE(_name) ((8 + strlen(_name)) + (7 * 12))
+
+typedef struct request_stats_latency_ctx {
+	REQUEST		*request;
+	bool		filtered;	//!< Whether the request selected histograms by name.
+	size_t		room;		//!< Bytes left for histograms.
+	int		skipped;	//!< Histograms which didn't fit.
+} request_stats_latency_ctx_t;
+
+static int request_stats_addlatency(char const *name, fr_stats_hist_t const *hist, void *uctx)
+{
+	request_stats_latency_ctx_t	*ctx = uctx;
+	REQUEST				*request = ctx->request;
+	VALUE_PAIR			*vp;
+	size_t				size;
+
+	/*
+	 *	Only the histograms the client asked for.
+	 */
+	if (ctx->filtered) {
+		vp_cursor_t cursor;
+
+		fr_pair_cursor_init(&cursor, &request->packet->vps);
+		while ((vp = fr_pair_cursor_next_by_num(&cursor, VENDORPEC_FREERADIUS,
+							PW_FREERADIUS_STATS_LATENCY_NAME, TAG_ANY))) {
+			if (strcmp(vp->vp_strvalue, name) == 0) break;
+		}
+		if (!vp) return 0;
+	}
+
+	size = STATS_LATENCY_SIZE(name);
+	if (size > ctx->room) {
+		ctx->skipped++;
+		return 0;
+	}
+	ctx->room -= size;
+
+	vp = radius_pair_create(request->reply, &request->reply->vps,
+				PW_FREERADIUS_STATS_LATENCY_NAME, VENDORPEC_FREERADIUS);
+	if (vp) fr_pair_value_strcpy(vp, name);
+
+	request_stats_addhist(request, hist);
+
+	return 0;
+}
+
 
 void request_stats_reply(REQUEST *request)
 {
-	VALUE_PAIR *flag, *vp;
+	VALUE_PAIR		*flag, *vp;
+	fr_stats_shard_t	sum;
 
 	/*
 	 *	Statistics are available ONLY on a "status" port.
@@ -442,12 +674,14 @@ void request_stats_reply(REQUEST *request)
 	flag = fr_pair_find_by_num(request->packet->vps, VENDORPEC_FREERADIUS, PW_FREERADIUS_STATISTICS_TYPE, TAG_ANY);
 	if (!flag || (flag->vp_integer == 0)) return;
 
+	radius_stats_sum(&sum);
+
 	/*
 	 *	Authentication.
 	 */
 	if (((flag->vp_integer & 0x01) != 0) &&
 	    ((flag->vp_integer & 0xc0) == 0)) {
-		request_stats_addvp(request, authvp, &radius_auth_stats);
+		request_stats_addvp(request, authvp, &sum.auth);
 	}
 
 #ifdef WITH_ACCOUNTING
@@ -456,7 +690,7 @@ void request_stats_reply(REQUEST *request)
 	 */
 	if (((flag->vp_integer & 0x02) != 0) &&
 	    ((flag->vp_integer & 0xc0) == 0)) {
-		request_stats_addvp(request, acctvp, &radius_acct_stats);
+		request_stats_addvp(request, acctvp, &sum.acct);
 	}
 #endif
 
@@ -466,7 +700,7 @@ void request_stats_reply(REQUEST *request)
 	 */
 	if (((flag->vp_integer & 0x04) != 0) &&
 	    ((flag->vp_integer & 0x20) == 0)) {
-		request_stats_addvp(request, proxy_authvp, &proxy_auth_stats);
+		request_stats_addvp(request, proxy_authvp, &sum.proxy_auth);
 	}
 
 #ifdef WITH_ACCOUNTING
@@ -475,7 +709,7 @@ void request_stats_reply(REQUEST *request)
 	 */
 	if (((flag->vp_integer & 0x08) != 0) &&
 	    ((flag->vp_integer & 0x20) == 0)) {
-		request_stats_addvp(request, proxy_acctvp, &proxy_acct_stats);
+		request_stats_addvp(request, proxy_acctvp, &sum.proxy_acct);
 	}
 #endif
 #endif
@@ -492,6 +726,27 @@ void request_stats_reply(REQUEST *request)
 		if (vp) vp->vp_date = hup_time.tv_sec;
 	}
 
+	/*
+	 *	Latency of each virtual server section and module.
+	 */
+	if (((flag->vp_integer & 0x100) != 0) &&
+	    ((flag->vp_integer & 0xe0) == 0)) {
+		request_stats_latency_ctx_t ctx;
+
+		ctx.request = request;
+		ctx.filtered = (fr_pair_find_by_num(request->packet->vps, VENDORPEC_FREERADIUS,
+						    PW_FREERADIUS_STATS_LATENCY_NAME, TAG_ANY) != NULL);
+		ctx.room = STATS_LATENCY_ROOM;
+		ctx.skipped = 0;
+
+		(void) fr_stats_latency_walk(request_stats_addlatency, &ctx);
+
+		if (ctx.skipped > 0) {
+			RWDEBUG("%d latency histograms didn't fit in the reply.  Select them with "
+				"FreeRADIUS-Stats-Latency-Name", ctx.skipped);
+		}
+	}
+
 	/*
 	 *	For a particular client.
 	 */
@@ -740,6 +995,13 @@ void request_stats_reply(REQUEST *request)
 				       PW_FREERADIUS_STATS_LAST_PACKET_SENT, VENDORPEC_FREERADIUS);
 		if (vp) vp->vp_date = home->last_packet_sent;
 
+		if ((flag->vp_integer & 0x100) != 0) {
+			fr_stats_hist_t latency;
+
+			fr_stats_latency_sum(&latency, home->latency);
+			request_stats_addhist(request, &latency);
+		}
+
 		if (((flag->vp_integer & 0x01) != 0) &&
 		    (home->type == HOME_TYPE_AUTH)) {
 			request_stats_addvp(request, proxy_authvp,
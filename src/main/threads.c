@@ -133,6 +133,10 @@ typedef struct THREAD_POOL {
 
 	char const	*queue_priority;
 
+	char const	*cpu_affinity;
+	fr_cpu_set_t	cpus;		//!< parsed from cpu_affinity, threads are bound round-robin.
+	int		num_cpus;
+
 	/*
 	 *	To ensure only one thread at a time touches the scheduler.
 	 *
@@ -179,6 +183,7 @@ static const CONF_PARSER thread_config[] = {
 	{ FR_CONF_POINTER("cleanup_delay", PW_TYPE_INTEGER, &thread_pool.cleanup_delay), .dflt = "5" },
 	{ FR_CONF_POINTER("max_queue_size", PW_TYPE_INTEGER, &thread_pool.max_queue_size), .dflt = "65536" },
 	{ FR_CONF_POINTER("queue_priority", PW_TYPE_STRING, &thread_pool.queue_priority), .dflt = NULL },
+	{ FR_CONF_POINTER("cpu_affinity", PW_TYPE_STRING, &thread_pool.cpu_affinity), .dflt = NULL },
 #ifdef WITH_STATS
 #ifdef WITH_ACCOUNTING
 	{ FR_CONF_POINTER("auto_limit_acct", PW_TYPE_BOOLEAN, &thread_pool.auto_limit_acct) },
@@ -453,6 +458,20 @@ static void *thread_handler(void *arg)
 	ProfilerRegisterThread();
 #endif
 
+	/*
+	 *	Bind to a CPU before allocating anything, so that our
+	 *	memory comes from the same NUMA node as the CPU.
+	 */
+	if (thread_pool.num_cpus > 0) {
+		int cpu = fr_cpu_set_nth(&thread_pool.cpus, thread->thread_num - 1);
+
+		if (fr_cpu_pin(cpu) < 0) {
+			WARN("Thread %d: %s", thread->thread_num, fr_strerror());
+		} else {
+			DEBUG2("Thread %d bound to CPU %d (NUMA node %d)", thread->thread_num, cpu, fr_cpu_node(cpu));
+		}
+	}
+
 	ctx = talloc_init("thread");
 
 	el = fr_event_list_create(ctx, NULL, NULL);
@@ -800,6 +819,25 @@ int thread_pool_bootstrap(CONF_SECTION *cs, bool *spawn_workers)
 	FR_INTEGER_BOUND_CHECK("max_servers", thread_pool.max_threads, >=, 1);
 	FR_INTEGER_BOUND_CHECK("start_servers", thread_pool.start_threads, <=, thread_pool.max_threads);
 
+	if (thread_pool.cpu_affinity) {
+		thread_pool.num_cpus = fr_cpu_set_parse(&thread_pool.cpus, thread_pool.cpu_affinity);
+		if (thread_pool.num_cpus < 0) {
+			cf_log_err_cs(pool_cf, "Invalid value for cpu_affinity: %s", fr_strerror());
+			return -1;
+		}
+
+		/*
+		 *	The main thread reads the sockets and allocates
+		 *	the requests.  It's bound to the whole set, and
+		 *	the threads it creates start out that way, too.
+		 */
+		if (fr_cpu_set_pin(&thread_pool.cpus) < 0) {
+			WARN("Main thread: %s", fr_strerror());
+		} else {
+			DEBUG2("Main thread bound to CPUs %s", thread_pool.cpu_affinity);
+		}
+	}
+
 #ifdef WITH_TLS
 	/*
 	 *	So TLS knows what to do.
@@ -1024,6 +1024,14 @@ int main(int argc, char *argv[])
 	INFO("Exiting normally");
 
 finish:
+	/*
+	 *	So that changes to how attributes are allocated can
+	 *	be measured.
+	 */
+	if (talloc_memory_report && request) {
+		INFO("Request used %zu allocations, %zu bytes", talloc_total_blocks(request),
+		     talloc_total_size(request));
+	}
 	talloc_free(request);
 	talloc_free(state);
 
@@ -1079,6 +1087,7 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -h            Print this help message.\n");
 	fprintf(output, "  -i file       File containing request attributes.\n");
 	fprintf(output, "  -m            On SIGINT or SIGQUIT exit cleanly instead of immediately.\n");
+	fprintf(output, "  -M            Print the memory used by the request, and a talloc report on exit.\n");
 	fprintf(output, "  -n name       Read raddb/name.conf instead of raddb/radiusd.conf.\n");
 	fprintf(output, "  -X            Turn on full debugging.\n");
 	fprintf(output, "  -x            Turn on additional debugging. (-xx gives more debugging).\n");
@@ -3060,6 +3060,27 @@ int unlang_compile(CONF_SECTION *cs, rlm_components_t component)
 		c->debug_name = talloc_asprintf(c, "%s %s", name1, name2);
 	}
 
+#ifdef WITH_STATS
+	/*
+	 *	Time the section as "<virtual server>.<section>", so
+	 *	that the same section in two servers is kept apart.
+	 */
+	{
+		CONF_SECTION	*server;
+		char		*name;
+
+		for (server = cf_item_parent(cf_section_to_item(cs));
+		     server != NULL;
+		     server = cf_item_parent(cf_section_to_item(server))) {
+			if ((strcmp(cf_section_name1(server), "server") == 0) && cf_section_name2(server)) break;
+		}
+
+		name = talloc_asprintf(NULL, "%s.%s", server ? cf_section_name2(server) : "global", c->debug_name);
+		unlang_group_to_module_call(c)->latency = fr_stats_latency_register(name);
+		talloc_free(name);
+	}
+#endif
+
 	if (rad_debug_lvl > 3) {
 		unlang_dump(c, 2);
 	}
@@ -81,6 +81,9 @@ static void unlang_push(unlang_stack_t *stack, unlang_t *program, rlm_rcode_t re
 	next->was_if = false;
 	next->if_taken = false;
 	next->resume = false;
+#ifdef WITH_STATS
+	next->latency = NULL;
+#endif
 }
 
 static void unlang_pop(unlang_stack_t *stack)
@@ -173,7 +176,7 @@ static unlang_action_t unlang_load_balance(REQUEST *request, unlang_stack_t *sta
 					goto randomly_choose;
 				}
 
-				hash = fr_hash(p, slen);
+				hash = fr_hash_fnv(p, slen);
 
 				start = hash % g->num_children;;
 			}
@@ -707,12 +710,29 @@ static unlang_action_t unlang_module_call(REQUEST *request, unlang_stack_t *stac
 	 */
 	request->module = sp->module_instance->name;
 
+#ifdef WITH_STATS
+	if (sp->module_instance->latency) gettimeofday(&frame->start, NULL);
+#endif
+
 	safe_lock(sp->module_instance);
 	request->rcode = sp->method(sp->module_instance->data, frame->modcall.thread, request);
 	safe_unlock(sp->module_instance);
 
 	request->module = NULL;
 
+#ifdef WITH_STATS
+	/*
+	 *	If the module yielded, the time is recorded when it's
+	 *	done, in unlang_resumption().
+	 */
+	if (sp->module_instance->latency && (request->rcode != RLM_MODULE_YIELD)) {
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		fr_stats_latency_add(sp->module_instance->latency, &frame->start, &now);
+	}
+#endif
+
 	/*
 	 *	Is now marked as "stop" when it wasn't before, we must have been blocked.
 	 */
@@ -862,6 +882,18 @@ static unlang_action_t unlang_resumption(REQUEST *request, unlang_stack_t *stack
 	*presult = mr->callback(request, mr->module.module_instance->data, mr->thread, mutable);
 	safe_unlock(sp->module_instance);
 
+#ifdef WITH_STATS
+	/*
+	 *	Includes the time spent waiting to be resumed.
+	 */
+	if (sp->module_instance->latency && (*presult != RLM_MODULE_YIELD)) {
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		fr_stats_latency_add(sp->module_instance->latency, &frame->start, &now);
+	}
+#endif
+
 	RDEBUG2("%s (%s)", instruction->name ? instruction->name : "",
 		fr_int2str(mod_rcode_table, *presult, "<invalid>"));
 
@@ -1234,14 +1266,45 @@ void unlang_push_section(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t action)
 	 *	stack into segments.
 	 */
 	stack->frame[stack->depth].top_frame = true;
+
+#ifdef WITH_STATS
+	stack->frame[stack->depth].latency = unlang_group_to_module_call(instruction)->latency;
+	if (stack->frame[stack->depth].latency) gettimeofday(&stack->frame[stack->depth].start, NULL);
+#endif
 }
 
+#ifdef WITH_STATS
+/** Record how long a section took, once it's done
+ *
+ * The section's instruction may be gone by now, so the histogram
+ * comes from the top frame.
+ */
+static void unlang_section_latency(unlang_stack_t *stack)
+{
+	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];
+	struct timeval		now;
+
+	if (!frame->top_frame || !frame->latency) return;
+
+	gettimeofday(&now, NULL);
+	fr_stats_latency_add(frame->latency, &frame->start, &now);
+	frame->latency = NULL;
+}
+#else
+#define unlang_section_latency(_x)
+#endif
+
 /** Continue interpreting after a previous push or yield.
  *
  */
 rlm_rcode_t unlang_interpret_continue(REQUEST *request)
 {
-	return unlang_run(request, request->stack);
+	rlm_rcode_t rcode;
+
+	rcode = unlang_run(request, request->stack);
+	if (rcode != RLM_MODULE_YIELD) unlang_section_latency(request->stack);
+
+	return rcode;
 }
 
 /** Call a module, iteratively, with a local stack, rather than recursively
@@ -1262,6 +1325,8 @@ rlm_rcode_t unlang_interpret(REQUEST *request, CONF_SECTION *cs, rlm_rcode_t act
 	rcode = unlang_run(request, stack);
 	if (rcode != RLM_MODULE_YIELD) {
 		rad_assert(stack->frame[stack->depth].top_frame);
+		unlang_section_latency(stack);
+
 		rad_assert(!stack->frame[stack->depth].instruction || /* processed the whole section */
 			    stack->frame[stack->depth].instruction->type == UNLANG_TYPE_GROUP); /* sections are groups */
 		rad_assert(stack->depth > 0);
@@ -41,6 +41,10 @@ RCSID("$Id$")
 #include <pthread.h>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "proto_detail.h"
 
 #define USEC (1000000)
 
@@ -60,6 +64,92 @@ static FR_NAME_NUMBER state_names[] = {
 };
 
 
+/*
+ *	Acknowledgement for a packet, sent by the replay reader's
+ *	listener to its thread.
+ */
+typedef struct detail_ack {
+	int		id;		//!< Of the packet, which is its slot in the window.
+	bool		replied;	//!< Whether the record is finished with.
+	int		rtt;		//!< Microseconds, or -1 if there's no RTT to account for.
+} detail_ack_t;
+
+/*
+ *	Update the smoothed RTT, and from it, the time we wait before
+ *	sending the next packet.
+ */
+static void detail_rtt_update(listen_detail_t *data, int rtt, struct timeval *now)
+{
+	/*
+	 *	If we haven't sent a packet in the last second, reset
+	 *	the RTT.
+	 */
+	now->tv_sec -= 1;
+	if (fr_timeval_cmp(&data->last_packet, now) < 0) {
+		data->has_rtt = false;
+	}
+	now->tv_sec += 1;
+
+	/*
+	 *	We keep smoothed round trip time (SRTT), but not round
+	 *	trip timeout (RTO).  We use SRTT to calculate a rough
+	 *	load factor.
+	 *
+	 *	If we're proxying, the RTT is our processing time,
+	 *	plus the network delay there and back, plus the time
+	 *	on the other end to process the packet.  Ideally, we
+	 *	should remove the network delays from the RTT, but we
+	 *	don't know what they are.
+	 *
+	 *	So, to be safe, we over-estimate the total cost of
+	 *	processing the packet.
+	 */
+	if (!data->has_rtt) {
+		data->has_rtt = true;
+		data->srtt = rtt;
+		data->rttvar = rtt / 2;
+
+	} else {
+		data->rttvar -= data->rttvar >> 2;
+		data->rttvar += (data->srtt - rtt);
+		data->srtt -= data->srtt >> 3;
+		data->srtt += rtt >> 3;
+	}
+
+	/*
+	 *	Calculate the time we wait before sending the next
+	 *	packet.
+	 *
+	 *	rtt / (rtt + delay) = load_factor / 100
+	 */
+	data->delay_time = (data->srtt * (100 - data->load_factor)) / (data->load_factor);
+
+	/*
+	 *	Cap delay at no less than 4 packets/s.  If the
+	 *	end system can't handle this, then it's very
+	 *	broken.
+	 */
+	if (data->delay_time > (USEC / 4)) data->delay_time= USEC / 4;
+
+	data->last_packet = *now;
+}
+
+/*
+ *	Tell the replay reader that we're done with a packet.
+ */
+void proto_detail_ack(listen_detail_t *data, RADIUS_PACKET *packet, bool replied, int rtt)
+{
+	detail_ack_t ack;
+
+	ack.id = packet->id;
+	ack.replied = replied;
+	ack.rtt = rtt;
+
+	if (write(data->child_pipe[1], &ack, sizeof(ack)) < 0) {
+		ERROR("detail (%s): Failed writing ack to reader thread: %s", data->name, fr_syserror(errno));
+	}
+}
+
 /*
  *	If we're limiting outstanding packets, then mark the response
  *	as being sent.
@@ -72,6 +162,25 @@ static int detail_send(rad_listen_t *listener, REQUEST *request)
 	rad_assert(request->listener == listener);
 	rad_assert(listener->send == detail_send);
 
+	/*
+	 *	Many packets may be outstanding, so leave all of the
+	 *	bookkeeping to the reader thread.
+	 */
+	if (data->use_mmap) {
+		int rtt = -1;
+
+		if (request->reply->code != 0) {
+			struct timeval now, diff;
+
+			gettimeofday(&now, NULL);
+			fr_timeval_subtract(&diff, &now, &request->packet->timestamp);
+			rtt = (diff.tv_sec * USEC) + diff.tv_usec;
+		}
+
+		proto_detail_ack(data, request->packet, (request->reply->code != 0), rtt);
+		return 0;
+	}
+
 	/*
 	 *	This request timed out.  Remember that, and tell the
 	 *	caller it's OK to read more "detail" file stuff.
@@ -92,72 +201,22 @@ static int detail_send(rad_listen_t *listener, REQUEST *request)
 		 */
 		gettimeofday(&now, NULL);
 
-		/*
-		 *	If we haven't sent a packet in the last second, reset
-		 *	the RTT.
-		 */
-		now.tv_sec -= 1;
-		if (fr_timeval_cmp(&data->last_packet, &now) < 0) {
-			data->has_rtt = false;
-		}
-		now.tv_sec += 1;
-
 		/*
 		 *	Only one detail packet may be outstanding at a time,
 		 *	so it's safe to update some entries in the detail
 		 *	structure.
-		 *
-		 *	We keep smoothed round trip time (SRTT), but not round
-		 *	trip timeout (RTO).  We use SRTT to calculate a rough
-		 *	load factor.
 		 */
 		rtt = now.tv_sec - request->packet->timestamp.tv_sec;
 		rtt *= USEC;
 		rtt += now.tv_usec;
 		rtt -= request->packet->timestamp.tv_usec;
 
-		/*
-		 *	If we're proxying, the RTT is our processing time,
-		 *	plus the network delay there and back, plus the time
-		 *	on the other end to process the packet.  Ideally, we
-		 *	should remove the network delays from the RTT, but we
-		 *	don't know what they are.
-		 *
-		 *	So, to be safe, we over-estimate the total cost of
-		 *	processing the packet.
-		 */
-		if (!data->has_rtt) {
-			data->has_rtt = true;
-			data->srtt = rtt;
-			data->rttvar = rtt / 2;
-
-		} else {
-			data->rttvar -= data->rttvar >> 2;
-			data->rttvar += (data->srtt - rtt);
-			data->srtt -= data->srtt >> 3;
-			data->srtt += rtt >> 3;
-		}
-
-		/*
-		 *	Calculate the time we wait before sending the next
-		 *	packet.
-		 *
-		 *	rtt / (rtt + delay) = load_factor / 100
-		 */
-		data->delay_time = (data->srtt * (100 - data->load_factor)) / (data->load_factor);
-
-		/*
-		 *	Cap delay at no less than 4 packets/s.  If the
-		 *	end system can't handle this, then it's very
-		 *	broken.
-		 */
-		if (data->delay_time > (USEC / 4)) data->delay_time= USEC / 4;
+		detail_rtt_update(data, rtt, &now);
 
 		RDEBUG3("detail (%s): Received response for request %" PRIu64 ".  "
 			"Will read the next packet in %d seconds",
 			data->name, request->number, data->delay_time / USEC);
 
-		data->last_packet = now;
 		data->signal = 1;
 		data->entry_state = STATE_REPLIED;
 		data->counter++;
@@ -346,11 +405,23 @@ static int detail_recv(rad_listen_t *listener)
 		break;
 
 	default:
+		if (data->use_mmap) {
+			proto_detail_ack(data, packet, true, -1);
+			fr_radius_free(&packet);
+			return 0;
+		}
+
 		data->entry_state = STATE_REPLIED;
 		goto signal_thread;
 	}
 
 	if (!request_receive(NULL, listener, packet, &data->detail_client, fun)) {
+		if (data->use_mmap) {
+			proto_detail_ack(data, packet, false, -1);
+			fr_radius_free(&packet);
+			return 0;
+		}
+
 		data->entry_state = STATE_NO_REPLY;	/* try again later */
 
 	signal_thread:
@@ -367,11 +438,225 @@ static int detail_recv(rad_listen_t *listener)
 	return 0;
 }
 
-static RADIUS_PACKET *detail_poll(rad_listen_t *listener)
+/*
+ *	Parse one line of a detail file entry.
+ *
+ *	Returns 1 for the Timestamp line, 0 if the line was parsed or
+ *	skipped, and -1 if the file is broken.
+ */
+static int detail_line_parse(TALLOC_CTX *ctx, char const *name, char const *buffer, vp_cursor_t *cursor,
+			     fr_ipaddr_t *client_ip, time_t *timestamp, bool *done)
 {
 	char		key[256], op[8], value[1024];
-	vp_cursor_t	cursor;
 	VALUE_PAIR	*vp;
+
+	/*
+	 *	We have a full "attribute = value" line.
+	 *	If it doesn't look reasonable, skip it.
+	 *
+	 *	FIXME: print an error for badly formatted attributes?
+	 */
+	if (sscanf(buffer, "%255s %7s %1023s", key, op, value) != 3) {
+		WARN("detail (%s): Skipping badly formatted line %s", name, buffer);
+		return 0;
+	}
+
+	/*
+	 *	Should be =, :=, +=, ...
+	 */
+	if (!strchr(op, '=')) return 0;
+
+	/*
+	 *	Skip non-protocol attributes.
+	 */
+	if (!strcasecmp(key, "Request-Authenticator")) return 0;
+
+	/*
+	 *	Set the original client IP address, based on
+	 *	what's in the detail file.
+	 *
+	 *	Hmm... we don't set the server IP address.
+	 *	or port.  Oh well.
+	 */
+	if (!strcasecmp(key, "Client-IP-Address")) {
+		client_ip->af = AF_INET;
+		if (fr_inet_hton(client_ip, AF_INET, value, false) < 0) {
+			ERROR("detail (%s): Failed parsing Client-IP-Address", name);
+			return -1;
+		}
+		return 0;
+	}
+
+	/*
+	 *	The original time at which we received the
+	 *	packet.  We need this to properly calculate
+	 *	Acct-Delay-Time.
+	 */
+	if (!strcasecmp(key, "Timestamp")) {
+		*timestamp = atoi(value);
+
+		vp = fr_pair_afrom_num(ctx, 0, PW_PACKET_ORIGINAL_TIMESTAMP);
+		if (vp) {
+			vp->vp_date = (uint32_t) *timestamp;
+			vp->type = VT_DATA;
+			fr_pair_cursor_append(cursor, vp);
+		}
+		return 1;
+	}
+
+	if (!strcasecmp(key, "Donestamp")) {
+		*timestamp = atoi(value);
+		*done = true;
+		return 0;
+	}
+
+	/*
+	 *	Read one VP.
+	 *
+	 *	FIXME: do we want to check for non-protocol
+	 *	attributes like radsqlrelay does?
+	 */
+	vp = NULL;
+	if ((fr_pair_list_afrom_str(ctx, buffer, &vp) > 0) &&
+	    (vp != NULL)) {
+		fr_pair_cursor_merge(cursor, vp);
+	}
+
+	return 0;
+}
+
+/*
+ *	Turn the attributes of a detail file entry into a packet.
+ */
+static RADIUS_PACKET *detail_packet_alloc(listen_detail_t *data, VALUE_PAIR *vps, fr_ipaddr_t const *client_ip,
+					  time_t timestamp, int tries)
+{
+	VALUE_PAIR	*vp;
+	RADIUS_PACKET	*packet;
+
+	/*
+	 *	Allocate the packet.  If we fail, it's a serious
+	 *	problem.
+	 */
+	packet = fr_radius_alloc(NULL, true);
+	if (!packet) {
+		ERROR("detail (%s): FATAL: Failed allocating memory for detail", data->name);
+		fr_exit(1);
+	}
+
+	memset(packet, 0, sizeof(*packet));
+	packet->sockfd = -1;
+	packet->src_ipaddr.af = AF_INET;
+	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_NONE);
+
+	/*
+	 *	If everything's OK, this is a waste of memory.
+	 *	Otherwise, it lets us re-send the original packet
+	 *	contents, unmolested.
+	 */
+	packet->vps = fr_pair_list_copy(packet, vps);
+
+	packet->code = PW_CODE_ACCOUNTING_REQUEST;
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TYPE, TAG_ANY);
+	if (vp) packet->code = vp->vp_integer;
+
+	gettimeofday(&packet->timestamp, NULL);
+
+	/*
+	 *	Remember where it came from, so that we don't
+	 *	proxy it to the place it came from...
+	 */
+	if (client_ip->af != AF_UNSPEC) {
+		packet->src_ipaddr = *client_ip;
+	}
+
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		packet->src_ipaddr.af = AF_INET;
+		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		packet->src_ipaddr.prefix = 32;
+	} else {
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IPV6_ADDRESS, TAG_ANY);
+		if (vp) {
+			packet->src_ipaddr.af = AF_INET6;
+			memcpy(&packet->src_ipaddr.ipaddr.ip6addr,
+			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			packet->src_ipaddr.prefix = 128;
+		}
+	}
+
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		packet->dst_ipaddr.af = AF_INET;
+		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		packet->dst_ipaddr.prefix = 32;
+	} else {
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IPV6_ADDRESS, TAG_ANY);
+		if (vp) {
+			packet->dst_ipaddr.af = AF_INET6;
+			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr,
+			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			packet->dst_ipaddr.prefix = 128;
+		}
+	}
+
+	/*
+	 *	Generate packet ID, ports, IP via a counter.
+	 */
+	packet->id = data->counter & 0xff;
+	packet->src_port = 1024 + ((data->counter >> 8) & 0xff);
+	packet->dst_port = 1024 + ((data->counter >> 16) & 0xff);
+
+	packet->dst_ipaddr.af = AF_INET;
+	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((data->counter >> 24) & 0xff));
+
+	/*
+	 *	Create / update accounting attributes.
+	 */
+	if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
+		/*
+		 *	Prefer the Event-Timestamp in the packet, if it
+		 *	exists.  That is when the event occurred, whereas the
+		 *	"Timestamp" field is when we wrote the packet to the
+		 *	detail file, which could have been much later.
+		 */
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_EVENT_TIMESTAMP, TAG_ANY);
+		if (vp) {
+			timestamp = vp->vp_integer;
+		}
+
+		/*
+		 *	Look for Acct-Delay-Time, and update
+		 *	based on Acct-Delay-Time += (time(NULL) - timestamp)
+		 */
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_ACCT_DELAY_TIME, TAG_ANY);
+		if (!vp) {
+			vp = fr_pair_afrom_num(packet, 0, PW_ACCT_DELAY_TIME);
+			rad_assert(vp != NULL);
+			fr_pair_add(&packet->vps, vp);
+		}
+		if (timestamp != 0) {
+			vp->vp_integer += time(NULL) - timestamp;
+		}
+	}
+
+	/*
+	 *	Set the transmission count.
+	 */
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TRANSMIT_COUNTER, TAG_ANY);
+	if (!vp) {
+		vp = fr_pair_afrom_num(packet, 0, PW_PACKET_TRANSMIT_COUNTER);
+		rad_assert(vp != NULL);
+		fr_pair_add(&packet->vps, vp);
+	}
+	vp->vp_integer = tries;
+
+	return packet;
+}
+
+static RADIUS_PACKET *detail_poll(rad_listen_t *listener)
+{
+	vp_cursor_t	cursor;
 	RADIUS_PACKET	*packet;
 	char		buffer[2048];
 	listen_detail_t *data = listener->data;
@@ -419,6 +704,24 @@ open_file:
 			return NULL;
 		}
 
+		/*
+		 *	Binary files are only read by the replay
+		 *	reader.  Leave the file for that.
+		 */
+		{
+			uint8_t magic[4];
+
+			if ((pread(data->work_fd, magic, sizeof(magic), 0) == sizeof(magic)) &&
+			    detail_binary_is(magic, sizeof(magic))) {
+				ERROR("detail (%s): %s holds binary records, which need \"mmap = yes\"",
+				      data->name, data->filename_work);
+				close(data->work_fd);
+				data->work_fd = -1;
+				data->file_state = STATE_UNOPENED;
+				return NULL;
+			}
+		}
+
 		/*
 		 *	Only open for writing if we're
 		 *	marking requests as completed.
@@ -609,79 +912,18 @@ open_file:
 			continue;
 		}
 
-		/*
-		 *	We have a full "attribute = value" line.
-		 *	If it doesn't look reasonable, skip it.
-		 *
-		 *	FIXME: print an error for badly formatted attributes?
-		 */
-		if (sscanf(buffer, "%255s %7s %1023s", key, op, value) != 3) {
-			WARN("detail (%s): Skipping badly formatted line %s", data->name, buffer);
-			continue;
-		}
-
-		/*
-		 *	Should be =, :=, +=, ...
-		 */
-		if (!strchr(op, '=')) continue;
+		switch (detail_line_parse(data, data->name, buffer, &cursor,
+					  &data->client_ip, &data->timestamp, &data->done_entry)) {
+		case 1:
+			data->timestamp_offset = data->last_offset;
+			break;
 
-		/*
-		 *	Skip non-protocol attributes.
-		 */
-		if (!strcasecmp(key, "Request-Authenticator")) continue;
+		case 0:
+			break;
 
-		/*
-		 *	Set the original client IP address, based on
-		 *	what's in the detail file.
-		 *
-		 *	Hmm... we don't set the server IP address.
-		 *	or port.  Oh well.
-		 */
-		if (!strcasecmp(key, "Client-IP-Address")) {
-			data->client_ip.af = AF_INET;
-			if (fr_inet_hton(&data->client_ip, AF_INET, value, false) < 0) {
-				ERROR("detail (%s): Failed parsing Client-IP-Address", data->name);
-
-				fr_pair_list_free(&data->vps);
-				goto cleanup;
-			}
-			continue;
-		}
-
-		/*
-		 *	The original time at which we received the
-		 *	packet.  We need this to properly calculate
-		 *	Acct-Delay-Time.
-		 */
-		if (!strcasecmp(key, "Timestamp")) {
-			data->timestamp = atoi(value);
-			data->timestamp_offset = data->last_offset;
-
-			vp = fr_pair_afrom_num(data, 0, PW_PACKET_ORIGINAL_TIMESTAMP);
-			if (vp) {
-				vp->vp_date = (uint32_t) data->timestamp;
-				vp->type = VT_DATA;
-				fr_pair_cursor_append(&cursor, vp);
-			}
-			continue;
-		}
-
-		if (!strcasecmp(key, "Donestamp")) {
-			data->timestamp = atoi(value);
-			data->done_entry = true;
-			continue;
-		}
-
-		/*
-		 *	Read one VP.
-		 *
-		 *	FIXME: do we want to check for non-protocol
-		 *	attributes like radsqlrelay does?
-		 */
-		vp = NULL;
-		if ((fr_pair_list_afrom_str(data, buffer, &vp) > 0) &&
-		    (vp != NULL)) {
-			fr_pair_cursor_merge(&cursor, vp);
+		default:
+			fr_pair_list_free(&data->vps);
+			goto cleanup;
 		}
 	}
 
@@ -732,122 +974,7 @@ open_file:
 		return NULL;
 	}
 
-	/*
-	 *	Allocate the packet.  If we fail, it's a serious
-	 *	problem.
-	 */
-	packet = fr_radius_alloc(NULL, true);
-	if (!packet) {
-		ERROR("detail (%s): FATAL: Failed allocating memory for detail", data->name);
-		fr_exit(1);
-	}
-
-	memset(packet, 0, sizeof(*packet));
-	packet->sockfd = -1;
-	packet->src_ipaddr.af = AF_INET;
-	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_NONE);
-
-	/*
-	 *	If everything's OK, this is a waste of memory.
-	 *	Otherwise, it lets us re-send the original packet
-	 *	contents, unmolested.
-	 */
-	packet->vps = fr_pair_list_copy(packet, data->vps);
-
-	packet->code = PW_CODE_ACCOUNTING_REQUEST;
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TYPE, TAG_ANY);
-	if (vp) packet->code = vp->vp_integer;
-
-	gettimeofday(&packet->timestamp, NULL);
-
-	/*
-	 *	Remember where it came from, so that we don't
-	 *	proxy it to the place it came from...
-	 */
-	if (data->client_ip.af != AF_UNSPEC) {
-		packet->src_ipaddr = data->client_ip;
-	}
-
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
-	if (vp) {
-		packet->src_ipaddr.af = AF_INET;
-		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
-		packet->src_ipaddr.prefix = 32;
-	} else {
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IPV6_ADDRESS, TAG_ANY);
-		if (vp) {
-			packet->src_ipaddr.af = AF_INET6;
-			memcpy(&packet->src_ipaddr.ipaddr.ip6addr,
-			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
-			packet->src_ipaddr.prefix = 128;
-		}
-	}
-
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IP_ADDRESS, TAG_ANY);
-	if (vp) {
-		packet->dst_ipaddr.af = AF_INET;
-		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
-		packet->dst_ipaddr.prefix = 32;
-	} else {
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IPV6_ADDRESS, TAG_ANY);
-		if (vp) {
-			packet->dst_ipaddr.af = AF_INET6;
-			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr,
-			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
-			packet->dst_ipaddr.prefix = 128;
-		}
-	}
-
-	/*
-	 *	Generate packet ID, ports, IP via a counter.
-	 */
-	packet->id = data->counter & 0xff;
-	packet->src_port = 1024 + ((data->counter >> 8) & 0xff);
-	packet->dst_port = 1024 + ((data->counter >> 16) & 0xff);
-
-	packet->dst_ipaddr.af = AF_INET;
-	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((data->counter >> 24) & 0xff));
-
-	/*
-	 *	Create / update accounting attributes.
-	 */
-	if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
-		/*
-		 *	Prefer the Event-Timestamp in the packet, if it
-		 *	exists.  That is when the event occurred, whereas the
-		 *	"Timestamp" field is when we wrote the packet to the
-		 *	detail file, which could have been much later.
-		 */
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_EVENT_TIMESTAMP, TAG_ANY);
-		if (vp) {
-			data->timestamp = vp->vp_integer;
-		}
-
-		/*
-		 *	Look for Acct-Delay-Time, and update
-		 *	based on Acct-Delay-Time += (time(NULL) - timestamp)
-		 */
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_ACCT_DELAY_TIME, TAG_ANY);
-		if (!vp) {
-			vp = fr_pair_afrom_num(packet, 0, PW_ACCT_DELAY_TIME);
-			rad_assert(vp != NULL);
-			fr_pair_add(&packet->vps, vp);
-		}
-		if (data->timestamp != 0) {
-			vp->vp_integer += time(NULL) - data->timestamp;
-		}
-	}
-
-	/*
-	 *	Set the transmission count.
-	 */
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TRANSMIT_COUNTER, TAG_ANY);
-	if (!vp) {
-		vp = fr_pair_afrom_num(packet, 0, PW_PACKET_TRANSMIT_COUNTER);
-		rad_assert(vp != NULL);
-		fr_pair_add(&packet->vps, vp);
-	}
-	vp->vp_integer = data->tries;
+	packet = detail_packet_alloc(data, data->vps, &data->client_ip, data->timestamp, data->tries);
 
 	data->entry_state = STATE_RUNNING;
 	data->running = packet->timestamp.tv_sec;
@@ -858,7 +985,7 @@ open_file:
 /*
  *	Free detail-specific stuff.
  */
-static int _detail_free(listen_detail_t *data)
+int proto_detail_free(listen_detail_t *data)
 {
 	if (!check_config) {
 		ssize_t ret;
@@ -1003,6 +1130,931 @@ static void *detail_handler_thread(void *arg)
 }
 
 
+/*
+ *	The replay reader.
+ *
+ *	Instead of reading the work file a line at a time, and
+ *	waiting for each packet to be replied to before reading the
+ *	next, map the whole file, parse it in chunks on several
+ *	threads, and keep up to "max_outstanding" packets in flight.
+ *
+ *	The offset of the oldest entry which hasn't been replied to
+ *	is saved in "<work file>.offset", so that a restarted server
+ *	carries on from there, instead of re-sending the whole file.
+ */
+#define DETAIL_CHUNK_SIZE	(1024 * 1024)
+
+/*
+ *	An entry from the work file, ready to be sent.
+ */
+typedef struct detail_record {
+	off_t			offset;			//!< Of the header line.
+	off_t			timestamp_offset;	//!< Of the Timestamp line, or 0 if there isn't one.
+							//!< In binary files, of the done flag.
+	time_t			timestamp;
+	fr_ipaddr_t		client_ip;
+	VALUE_PAIR		*vps;
+	int			tries;
+	bool			done;			//!< Replied to.
+	struct timeval		sent;			//!< When it was last sent.
+	time_t			retry;			//!< When to send it again.
+	struct detail_record	*next_retry;		//!< Next entry waiting to be re-sent.
+} detail_record_t;
+
+/*
+ *	The entries whose header lines are in one chunk of the file.
+ *	The attributes are parented by the chunk.
+ */
+typedef struct detail_chunk {
+	listen_detail_t		*data;
+	uint8_t const		*map;			//!< Of the whole file.
+	off_t			start;			//!< Where parsing starts.
+	off_t			limit;			//!< Entries starting at or after this belong to the next chunk.
+	off_t			size;			//!< Of the whole file.
+	off_t			end;			//!< Where the next chunk starts.
+
+	detail_record_t		*records;
+	int			num;
+	int			alloced;
+	int			low;			//!< Oldest entry which hasn't been replied to.
+
+	pthread_t		pthread_id;
+	struct detail_chunk	*next;
+} detail_chunk_t;
+
+struct detail_replay {
+	uint8_t			*map;			//!< Of the work file.
+	off_t			size;			//!< Of the work file.
+	ino_t			inode;			//!< Of the work file, to check the checkpoint is for it.
+	off_t			parsed;			//!< Where the next chunk starts.
+	bool			binary;			//!< The work file holds binary records.
+	char const		*secret;		//!< To decode binary records with.
+
+	char			*checkpoint_file;
+	int			checkpoint_fd;
+	off_t			checkpoint;		//!< Offset of the oldest entry which hasn't been replied to.
+	off_t			checkpoint_saved;	//!< The checkpoint which is in the file.
+	time_t			checkpoint_time;	//!< When we last saved the checkpoint.
+
+	detail_chunk_t		*head;			//!< Oldest chunk.
+	detail_chunk_t		*tail;			//!< Newest chunk.
+	detail_chunk_t		*send;			//!< Chunk we're sending entries from.
+	int			send_index;		//!< Next entry to send from that chunk.
+
+	detail_record_t		*retry_head;		//!< Entries to re-send, oldest first.
+	detail_record_t		*retry_tail;
+
+	detail_record_t		**slots;		//!< Entries in flight, indexed by packet ID.
+	int			*free_ids;		//!< Unused packet IDs.
+	int			num_free;
+	uint32_t		outstanding;		//!< Number of entries in flight.
+
+	struct timeval		next_send;		//!< When we may send the next packet.
+	struct timeval		last_reply;		//!< When we last got a reply.
+};
+
+/*
+ *	Add an entry to a chunk.
+ */
+static detail_record_t *detail_chunk_record_alloc(detail_chunk_t *chunk)
+{
+	detail_record_t *record;
+
+	if (chunk->num == chunk->alloced) {
+		detail_record_t *records;
+
+		records = talloc_realloc(chunk, chunk->records, detail_record_t,
+					 chunk->alloced ? (chunk->alloced * 2) : 256);
+		if (!records) return NULL;
+
+		chunk->records = records;
+		chunk->alloced = talloc_array_length(records);
+	}
+
+	record = &chunk->records[chunk->num];
+	memset(record, 0, sizeof(*record));
+	record->client_ip.af = AF_UNSPEC;
+
+	return record;
+}
+
+/*
+ *	Parse the entries in one chunk of the file.
+ *
+ *	Entries are separated by a blank line.  Each chunk takes the
+ *	entries whose header line starts before its limit, so the
+ *	chunks can be parsed independently.
+ */
+static void *detail_chunk_parse(void *arg)
+{
+	detail_chunk_t		*chunk = arg;
+	listen_detail_t		*data = chunk->data;
+	char			buffer[2048];
+	off_t			p = chunk->start;
+	detail_record_t		*record = NULL;
+	vp_cursor_t		cursor;
+	bool			bad = false, done = false;
+
+	while (p < chunk->size) {
+		uint8_t const	*eol;
+		size_t		len;
+
+		eol = memchr(chunk->map + p, '\n', chunk->size - p);
+		len = eol ? (size_t) ((eol + 1) - (chunk->map + p)) : (size_t) (chunk->size - p);
+
+		/*
+		 *	Between entries.  Skip blank lines, and stop if
+		 *	the next entry belongs to the next chunk.
+		 */
+		if (!record) {
+			if (p >= chunk->limit) break;
+
+			if (chunk->map[p] == '\n') {
+				p += len;
+				continue;
+			}
+
+			record = detail_chunk_record_alloc(chunk);
+			if (!record) {
+				ERROR("detail (%s): Out of memory", data->name);
+				break;
+			}
+			record->offset = p;
+			fr_pair_cursor_init(&cursor, &record->vps);
+			bad = done = false;
+			p += len;
+			continue;
+		}
+
+		/*
+		 *	A blank line ends the entry.
+		 */
+		if (chunk->map[p] == '\n') {
+			p += len;
+
+			if (bad || done || !record->vps) {
+				if (done) DEBUG2("detail (%s): Skipping record for timestamp %lu",
+						 data->name, record->timestamp);
+				fr_pair_list_free(&record->vps);
+			} else {
+				chunk->num++;
+			}
+			record = NULL;
+			continue;
+		}
+
+		if (len >= sizeof(buffer)) {
+			if (!bad) WARN("detail (%s): Skipping record at offset %" PRIu64 " with over-long line",
+				       data->name, (uint64_t) record->offset);
+			bad = true;
+			p += len;
+			continue;
+		}
+
+		memcpy(buffer, chunk->map + p, len);
+		buffer[len] = '\0';
+
+		switch (detail_line_parse(chunk, data->name, buffer, &cursor,
+					  &record->client_ip, &record->timestamp, &done)) {
+		case 1:
+			record->timestamp_offset = p;
+			break;
+
+		case 0:
+			break;
+
+		default:
+			bad = true;
+			break;
+		}
+
+		p += len;
+	}
+
+	/*
+	 *	The last entry in the file was never finished.  The
+	 *	writer doesn't check that the record was completely
+	 *	written, so this is what a full disk looks like.
+	 */
+	if (record) {
+		ERROR("detail (%s): Truncated record: treating it as EOF for detail file %s",
+		      data->name, data->filename_work);
+		fr_pair_list_free(&record->vps);
+	}
+
+	chunk->end = p;
+
+	return NULL;
+}
+
+/*
+ *	Decode the binary records in one chunk of the file.
+ *
+ *	Each record is the packet as it was received, so this is the
+ *	same work as receiving it from the network, without checking
+ *	the authenticator.
+ */
+static void *detail_chunk_decode(void *arg)
+{
+	detail_chunk_t		*chunk = arg;
+	listen_detail_t		*data = chunk->data;
+	char const		*secret = data->replay->secret;
+	off_t			p = chunk->start;
+
+	while (p < chunk->limit) {
+		detail_binary_t	entry;
+		detail_record_t	*record;
+		RADIUS_PACKET	*packet;
+		VALUE_PAIR	*vp;
+		vp_cursor_t	cursor;
+		ssize_t		slen;
+		off_t		next;
+
+		slen = detail_binary_decode(&entry, chunk->map + p, chunk->size - p);
+		next = p + detail_binary_next(chunk->map + p, chunk->size - p);
+
+		/*
+		 *	The last record in the file was never finished.
+		 *	See detail_chunk_parse().
+		 */
+		if ((slen == 0) && (next == chunk->size)) {
+			ERROR("detail (%s): Truncated record: treating it as EOF for detail file %s",
+			      data->name, data->filename_work);
+			p = chunk->size;
+			break;
+		}
+
+		if (slen <= 0) {
+			if (slen == 0) fr_strerror_printf("Invalid length");
+			WARN("detail (%s): Skipping record at offset %" PRIu64 ": %s",
+			     data->name, (uint64_t) p, fr_strerror());
+			p = next;
+			continue;
+		}
+
+		if (entry.done) {
+			DEBUG2("detail (%s): Skipping record for timestamp %lu",
+			       data->name, (unsigned long) entry.timestamp.tv_sec);
+			p = next;
+			continue;
+		}
+
+		record = detail_chunk_record_alloc(chunk);
+		if (!record) {
+			ERROR("detail (%s): Out of memory", data->name);
+			break;
+		}
+		record->offset = p;
+		record->timestamp_offset = p + DETAIL_BINARY_DONE_OFFSET;
+		record->timestamp = entry.timestamp.tv_sec;
+		record->client_ip = entry.src_ipaddr;
+
+		/*
+		 *	The map may be read-only, and the decoder
+		 *	wants to own the data.
+		 */
+		packet = fr_radius_alloc(chunk, false);
+		if (!packet) {
+			ERROR("detail (%s): Out of memory", data->name);
+			break;
+		}
+		packet->src_ipaddr = entry.src_ipaddr;
+		packet->data = talloc_memdup(packet, entry.data, entry.data_len);
+		packet->data_len = entry.data_len;
+		packet->code = packet->data[0];
+		packet->id = packet->data[1];
+		memcpy(packet->vector, packet->data + 4, sizeof(packet->vector));
+
+		if (!fr_radius_ok(packet, false, NULL) || (fr_radius_decode(packet, NULL, secret) < 0)) {
+			WARN("detail (%s): Skipping record at offset %" PRIu64 ": %s",
+			     data->name, (uint64_t) p, fr_strerror());
+			talloc_free(packet);
+			p = next;
+			continue;
+		}
+
+		record->vps = packet->vps;
+		packet->vps = NULL;
+		for (vp = fr_pair_cursor_init(&cursor, &record->vps);
+		     vp;
+		     vp = fr_pair_cursor_next(&cursor)) {
+			fr_pair_steal(chunk, vp);
+		}
+		talloc_free(packet);
+
+		/*
+		 *	What the text reader gets from the
+		 *	Packet-Type and Timestamp lines.
+		 */
+		vp = fr_pair_afrom_num(chunk, 0, PW_PACKET_TYPE);
+		if (vp) {
+			vp->vp_integer = entry.data[0];
+			fr_pair_add(&record->vps, vp);
+		}
+
+		vp = fr_pair_afrom_num(chunk, 0, PW_PACKET_ORIGINAL_TIMESTAMP);
+		if (vp) {
+			vp->vp_date = (uint32_t) entry.timestamp.tv_sec;
+			fr_pair_add(&record->vps, vp);
+		}
+
+		chunk->num++;
+		p = next;
+	}
+
+	chunk->end = p;
+
+	return NULL;
+}
+
+/*
+ *	Parse the next part of the file, one chunk per thread.
+ */
+static int detail_replay_parse(listen_detail_t *data)
+{
+	detail_replay_t	*replay = data->replay;
+	detail_chunk_t	*chunks[64];
+	uint32_t	i, num = 0;
+	off_t		start = replay->parsed;
+	void		*(*parse)(void *);
+
+	rad_assert(data->parse_threads <= (sizeof(chunks) / sizeof(chunks[0])));
+
+	for (i = 0; (i < data->parse_threads) && (start < replay->size); i++) {
+		detail_chunk_t *chunk;
+
+		chunk = talloc_zero(NULL, detail_chunk_t);
+		if (!chunk) break;
+
+		chunk->data = data;
+		chunk->map = replay->map;
+		chunk->size = replay->size;
+
+		/*
+		 *	Every chunk but the first starts at the first
+		 *	entry after its nominal start.
+		 */
+		if ((i > 0) && !replay->binary) {
+			uint8_t const *sep;
+
+			sep = memmem(replay->map + start - 2, replay->size - (start - 2), "\n\n", 2);
+			start = sep ? ((sep + 2) - replay->map) : replay->size;
+		}
+
+		chunk->start = start;
+		chunk->limit = start + DETAIL_CHUNK_SIZE;
+		if (chunk->limit > replay->size) chunk->limit = replay->size;
+
+		/*
+		 *	Binary records can't be found from an arbitrary
+		 *	offset, but walking their headers is cheap.
+		 *	End the chunk at a record boundary.
+		 */
+		if (replay->binary) {
+			off_t p = start;
+
+			while (p < chunk->limit) p += detail_binary_next(replay->map + p, replay->size - p);
+			chunk->limit = p;
+		}
+		start = chunk->limit;
+
+		chunks[num++] = chunk;
+	}
+	if (num == 0) return -1;
+
+	/*
+	 *	Parse the first chunk ourselves, and the rest on
+	 *	their own threads.  If we can't start a thread, we
+	 *	parse that chunk too.
+	 */
+	parse = replay->binary ? detail_chunk_decode : detail_chunk_parse;
+
+	for (i = 1; i < num; i++) {
+		if (pthread_create(&chunks[i]->pthread_id, NULL, parse, chunks[i]) != 0) {
+			chunks[i]->pthread_id = pthread_self();
+			parse(chunks[i]);
+		}
+	}
+	parse(chunks[0]);
+
+	for (i = 1; i < num; i++) {
+		if (!pthread_equal(chunks[i]->pthread_id, pthread_self())) pthread_join(chunks[i]->pthread_id, NULL);
+	}
+
+	/*
+	 *	Append the chunks to the list.  Entries which straddle
+	 *	two chunks were parsed by the earlier one, so the file
+	 *	has been parsed up to the end of the last chunk.
+	 */
+	for (i = 0; i < num; i++) {
+		if (!replay->head) {
+			replay->head = chunks[i];
+		} else {
+			replay->tail->next = chunks[i];
+		}
+		replay->tail = chunks[i];
+		if (!replay->send) {
+			replay->send = chunks[i];
+			replay->send_index = 0;
+		}
+	}
+	replay->parsed = chunks[num - 1]->end;
+
+	return 0;
+}
+
+/*
+ *	Return the next entry to send for the first time, parsing
+ *	more of the file if we have to.
+ */
+static detail_record_t *detail_replay_next(listen_detail_t *data)
+{
+	detail_replay_t *replay = data->replay;
+
+	while (true) {
+		while (replay->send && (replay->send_index >= replay->send->num)) {
+			replay->send = replay->send->next;
+			replay->send_index = 0;
+		}
+		if (replay->send) return &replay->send->records[replay->send_index++];
+
+		if (replay->parsed >= replay->size) return NULL;
+		if (detail_replay_parse(data) < 0) return NULL;
+	}
+}
+
+/*
+ *	Save the offset of the oldest entry which hasn't been replied
+ *	to.  The fields are fixed width, so that we can overwrite
+ *	them in place.
+ */
+static void detail_replay_checkpoint(listen_detail_t *data, bool force)
+{
+	detail_replay_t	*replay = data->replay;
+	char		buffer[64];
+	int		len;
+	time_t		now;
+
+	data->offset = replay->checkpoint;
+
+	if ((replay->checkpoint_fd < 0) || (replay->checkpoint == replay->checkpoint_saved)) return;
+
+	now = time(NULL);
+	if (!force && (now == replay->checkpoint_time)) return;
+
+	len = snprintf(buffer, sizeof(buffer), "%020" PRIu64 " %020" PRIu64 "\n",
+		       (uint64_t) replay->checkpoint, (uint64_t) replay->inode);
+	if (pwrite(replay->checkpoint_fd, buffer, len, 0) != len) {
+		WARN("detail (%s): Failed writing %s: %s", data->name, replay->checkpoint_file, fr_syserror(errno));
+		return;
+	}
+
+	replay->checkpoint_saved = replay->checkpoint;
+	replay->checkpoint_time = now;
+}
+
+/*
+ *	Read the checkpoint, and check it's for this file, and points
+ *	to the start of an entry.
+ */
+static off_t detail_replay_resume(listen_detail_t *data)
+{
+	detail_replay_t	*replay = data->replay;
+	char		buffer[64];
+	ssize_t		len;
+	uint64_t	offset, inode;
+
+	len = pread(replay->checkpoint_fd, buffer, sizeof(buffer) - 1, 0);
+	if (len <= 0) return 0;
+	buffer[len] = '\0';
+
+	if (sscanf(buffer, "%" SCNu64 " %" SCNu64, &offset, &inode) != 2) return 0;
+
+	if ((inode != (uint64_t) replay->inode) || (offset > (uint64_t) replay->size)) {
+		WARN("detail (%s): Ignoring checkpoint for a different file", data->name);
+		return 0;
+	}
+
+	if ((offset > 0) && (offset < (uint64_t) replay->size) &&
+	    (replay->binary ? !detail_binary_is(replay->map + offset, replay->size - offset) :
+	     ((offset < 2) || (replay->map[offset - 2] != '\n') || (replay->map[offset - 1] != '\n')))) {
+		WARN("detail (%s): Ignoring checkpoint which isn't at the start of a record", data->name);
+		return 0;
+	}
+
+	if (offset > 0) INFO("detail (%s): Resuming %s at offset %" PRIu64 " of %" PRIu64,
+			     data->name, data->filename_work, offset, (uint64_t) replay->size);
+
+	return offset;
+}
+
+/*
+ *	Map the work file, if there is one.
+ */
+static int detail_replay_open(rad_listen_t *this)
+{
+	listen_detail_t	*data = this->data;
+	detail_replay_t	*replay = data->replay;
+	struct stat	buf;
+
+	if (!detail_open(this)) return -1;
+
+	/*
+	 *	See detail_poll() for why we don't block.
+	 */
+	if (rad_lockfd_nonblock(data->work_fd, 0) < 0) {
+	error:
+		close(data->work_fd);
+		data->work_fd = -1;
+		data->file_state = STATE_UNOPENED;
+		return -1;
+	}
+
+	if (fstat(data->work_fd, &buf) < 0) {
+		ERROR("detail (%s): Failed to stat detail file: %s", data->name, fr_syserror(errno));
+		goto error;
+	}
+
+	replay->size = buf.st_size;
+	replay->inode = buf.st_ino;
+	replay->parsed = replay->checkpoint = replay->checkpoint_saved = 0;
+	replay->checkpoint_time = 0;
+
+	/*
+	 *	Nothing to map.  Finish with it now.
+	 */
+	if (replay->size == 0) {
+		data->file_state = STATE_PROCESSING;
+		return 0;
+	}
+
+	/*
+	 *	Only map it for writing if we're marking requests as
+	 *	completed.
+	 */
+	replay->map = mmap(NULL, replay->size, PROT_READ | (data->track ? PROT_WRITE : 0), MAP_SHARED,
+			   data->work_fd, 0);
+	if (replay->map == MAP_FAILED) {
+		replay->map = NULL;
+		ERROR("detail (%s): Failed mapping %s: %s", data->name, data->filename_work, fr_syserror(errno));
+		goto error;
+	}
+#ifdef MADV_SEQUENTIAL
+	(void) madvise(replay->map, replay->size, MADV_SEQUENTIAL);
+#endif
+	replay->binary = detail_binary_is(replay->map, replay->size);
+
+	replay->checkpoint_file = talloc_asprintf(replay, "%s.offset", data->filename_work);
+	replay->checkpoint_fd = open(replay->checkpoint_file, O_RDWR | O_CREAT, 0600);
+	if (replay->checkpoint_fd < 0) {
+		WARN("detail (%s): Failed opening %s, progress through the file will not be saved: %s",
+		     data->name, replay->checkpoint_file, fr_syserror(errno));
+	} else {
+		replay->parsed = replay->checkpoint = replay->checkpoint_saved = detail_replay_resume(data);
+	}
+
+	data->offset = replay->checkpoint;
+	data->file_state = STATE_PROCESSING;
+
+	return 0;
+}
+
+/*
+ *	Unmap the work file.  If we've finished with it, delete it.
+ */
+static void detail_replay_close(listen_detail_t *data, bool finished)
+{
+	detail_replay_t	*replay = data->replay;
+	detail_chunk_t	*chunk, *next;
+
+	for (chunk = replay->head; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		talloc_free(chunk);
+	}
+	replay->head = replay->tail = replay->send = NULL;
+	replay->retry_head = replay->retry_tail = NULL;
+
+	if (replay->map) {
+		munmap(replay->map, replay->size);
+		replay->map = NULL;
+	}
+
+	if (replay->checkpoint_fd >= 0) {
+		if (!finished) detail_replay_checkpoint(data, true);
+
+		close(replay->checkpoint_fd);
+		replay->checkpoint_fd = -1;
+	}
+
+	if (finished) {
+		DEBUG("detail (%s): Unlinking %s", data->name, data->filename_work);
+		unlink(data->filename_work);
+		if (replay->checkpoint_file) unlink(replay->checkpoint_file);
+	}
+	TALLOC_FREE(replay->checkpoint_file);
+
+	close(data->work_fd);
+	data->work_fd = -1;
+	data->file_state = STATE_UNOPENED;
+
+	if (finished && data->one_shot) {
+		INFO("detail (%s): Finished reading \"one shot\" detail file - Exiting", data->name);
+		radius_signal_self(RADIUS_SIGNAL_SELF_EXIT);
+	}
+}
+
+/*
+ *	Queue an entry to be sent again.
+ */
+static void detail_replay_retry(detail_replay_t *replay, detail_record_t *record, time_t when)
+{
+	record->retry = when;
+	record->next_retry = NULL;
+
+	if (!replay->retry_tail) {
+		replay->retry_head = record;
+	} else {
+		replay->retry_tail->next_retry = record;
+	}
+	replay->retry_tail = record;
+}
+
+/*
+ *	Send entries until the window is full.
+ *
+ *	Returns the number of milliseconds until we next want to send
+ *	something, or -1 if we're waiting for replies.
+ */
+static int detail_replay_send(listen_detail_t *data)
+{
+	detail_replay_t	*replay = data->replay;
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+
+	while (replay->outstanding < data->max_outstanding) {
+		detail_record_t	*record;
+		RADIUS_PACKET	*packet;
+		int		id;
+
+		if (fr_timeval_cmp(&now, &replay->next_send) < 0) {
+			struct timeval diff;
+
+			fr_timeval_subtract(&diff, &replay->next_send, &now);
+			return (diff.tv_sec * 1000) + (diff.tv_usec / 1000) + 1;
+		}
+
+		/*
+		 *	Entries which failed go first, so that the
+		 *	checkpoint keeps moving.
+		 */
+		if (replay->retry_head && (replay->retry_head->retry <= now.tv_sec)) {
+			record = replay->retry_head;
+			replay->retry_head = record->next_retry;
+			if (!replay->retry_head) replay->retry_tail = NULL;
+		} else {
+			record = detail_replay_next(data);
+			if (!record) {
+				if (replay->retry_head) return ((replay->retry_head->retry - now.tv_sec) * 1000) + 1;
+				return -1;
+			}
+			data->packets++;
+		}
+
+		record->tries++;
+		data->tries = record->tries;
+
+		packet = detail_packet_alloc(data, record->vps, &record->client_ip, record->timestamp,
+					     record->tries);
+		data->counter++;
+
+		id = replay->free_ids[--replay->num_free];
+		packet->id = id;
+		replay->slots[id] = record;
+		replay->outstanding++;
+		record->sent = now;
+
+		if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+			ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
+			      data->name, fr_syserror(errno));
+			fr_radius_free(&packet);
+
+			replay->slots[id] = NULL;
+			replay->free_ids[replay->num_free++] = id;
+			replay->outstanding--;
+
+			detail_replay_retry(replay, record, now.tv_sec + data->retry_interval);
+			return data->retry_interval * 1000;
+		}
+
+		/*
+		 *	Spread the load factor delay over the window.
+		 */
+		replay->next_send = now;
+		replay->next_send.tv_usec += data->delay_time / data->max_outstanding;
+		replay->next_send.tv_sec += replay->next_send.tv_usec / USEC;
+		replay->next_send.tv_usec %= USEC;
+	}
+
+	return -1;
+}
+
+/*
+ *	A packet has been replied to, or has failed.
+ */
+static void detail_replay_ack(listen_detail_t *data, detail_ack_t const *ack)
+{
+	detail_replay_t	*replay = data->replay;
+	detail_record_t	*record;
+	struct timeval	now;
+
+	if ((ack->id < 0) || (ack->id >= (int) data->max_outstanding) || !replay->slots[ack->id]) {
+		ERROR("detail (%s): Received ack for unknown packet %d", data->name, ack->id);
+		return;
+	}
+
+	record = replay->slots[ack->id];
+	replay->slots[ack->id] = NULL;
+	replay->free_ids[replay->num_free++] = ack->id;
+	replay->outstanding--;
+
+	gettimeofday(&now, NULL);
+
+	/*
+	 *	No response.  Re-send it later.  If nothing else has
+	 *	been replied to since it was sent, the other end is
+	 *	probably down, so give it time to recover before
+	 *	sending anything else.  Otherwise only this packet
+	 *	was lost, and the rest of the window carries on.
+	 */
+	if (!ack->replied) {
+		DEBUG("detail (%s): No response to request.  Will retry in %d seconds",
+		      data->name, data->retry_interval);
+
+		detail_replay_retry(replay, record, now.tv_sec + data->retry_interval);
+
+		if (fr_timeval_cmp(&replay->last_reply, &record->sent) < 0) {
+			replay->next_send = now;
+			replay->next_send.tv_sec += data->retry_interval;
+		}
+		return;
+	}
+
+	replay->last_reply = now;
+
+	if (ack->rtt >= 0) detail_rtt_update(data, ack->rtt, &now);
+
+	if (data->track && record->timestamp_offset) {
+		if (replay->binary) {
+			replay->map[record->timestamp_offset] = 1;
+		} else {
+			memcpy(replay->map + record->timestamp_offset, "\tDone", 5);
+		}
+	}
+
+	record->done = true;
+	fr_pair_list_free(&record->vps);
+
+	/*
+	 *	Move the checkpoint past everything which has been
+	 *	replied to, and free the chunks we're done with.
+	 */
+	while (replay->head) {
+		detail_chunk_t *chunk = replay->head;
+
+		while ((chunk->low < chunk->num) && chunk->records[chunk->low].done) chunk->low++;
+
+		if (chunk->low < chunk->num) {
+			replay->checkpoint = chunk->records[chunk->low].offset;
+			break;
+		}
+
+		/*
+		 *	Everything in the chunk has been replied to,
+		 *	so everything in it has been sent.
+		 */
+		replay->checkpoint = chunk->end;
+		if (replay->send == chunk) {
+			replay->send = chunk->next;
+			replay->send_index = 0;
+		}
+
+		replay->head = chunk->next;
+		if (!replay->head) replay->tail = NULL;
+		talloc_free(chunk);
+	}
+
+	detail_replay_checkpoint(data, false);
+}
+
+void *proto_detail_replay_thread(void *arg)
+{
+	rad_listen_t	*this = arg;
+	listen_detail_t	*data = this->data;
+	detail_replay_t	*replay;
+	RADIUS_PACKET	*packet = NULL;
+	uint32_t	i;
+
+	replay = talloc_zero(NULL, detail_replay_t);
+	if (!replay) {
+	oom:
+		ERROR("detail (%s): Out of memory", data->name);
+		talloc_free(replay);
+		goto done;
+	}
+	replay->checkpoint_fd = -1;
+	replay->secret = talloc_typed_strdup(replay, DETAIL_BINARY_SECRET);
+	replay->slots = talloc_zero_array(replay, detail_record_t *, data->max_outstanding);
+	replay->free_ids = talloc_array(replay, int, data->max_outstanding);
+	if (!replay->secret || !replay->slots || !replay->free_ids) goto oom;
+
+	for (i = 0; i < data->max_outstanding; i++) replay->free_ids[i] = data->max_outstanding - i - 1;
+	replay->num_free = data->max_outstanding;
+	data->replay = replay;
+
+	while (data->child_pipe[0] >= 0) {
+		struct pollfd	fds;
+		detail_ack_t	acks[64];
+		ssize_t		len;
+		int		timeout;
+
+		if (data->file_state != STATE_PROCESSING) {
+			if (detail_replay_open(this) < 0) {
+				usleep(detail_delay(data));
+				continue;
+			}
+		}
+
+		timeout = detail_replay_send(data);
+
+		/*
+		 *	Everything has been sent and replied to.
+		 */
+		if ((replay->outstanding == 0) && (timeout < 0)) {
+			detail_replay_close(data, true);
+			continue;
+		}
+
+		/*
+		 *	Wake up at least once a second to save the
+		 *	checkpoint, and to check if we should exit.
+		 */
+		if ((timeout < 0) || (timeout > 1000)) timeout = 1000;
+
+		fds.fd = data->child_pipe[0];
+		fds.events = POLLIN;
+		fds.revents = 0;
+		if (poll(&fds, 1, timeout) <= 0) {
+			detail_replay_checkpoint(data, false);
+			continue;
+		}
+
+		len = read(data->child_pipe[0], acks, sizeof(acks));
+		if (len <= 0) {
+			if ((len < 0) && (errno == EINTR)) continue;
+			if (data->child_pipe[0] < 0) break;
+
+			ERROR("detail (%s): Failed getting detail packet ack from master: %s",
+			      data->name, fr_syserror(errno));
+			break;
+		}
+
+		/*
+		 *	Acks are written atomically, but may be read
+		 *	in pieces.
+		 */
+		while ((len % sizeof(acks[0])) != 0) {
+			ssize_t more;
+
+			more = read(data->child_pipe[0], ((uint8_t *) acks) + len,
+				    sizeof(acks[0]) - (len % sizeof(acks[0])));
+			if (more <= 0) break;
+			len += more;
+		}
+
+		for (i = 0; i < (len / sizeof(acks[0])); i++) detail_replay_ack(data, &acks[i]);
+	}
+
+	/*
+	 *	Leave the file, and the checkpoint, for next time.
+	 */
+	if (data->file_state == STATE_PROCESSING) detail_replay_close(data, false);
+
+	data->replay = NULL;
+	talloc_free(replay);
+
+	/*
+	 *	Tell the master thread we've exited.
+	 */
+done:
+	if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+		ERROR("detail (%s): Failed writing exit status to master: %s",
+		      data->name, fr_syserror(errno));
+	}
+
+	return NULL;
+}
+
 static const CONF_PARSER detail_config[] = {
 	{ FR_CONF_OFFSET("detail", PW_TYPE_FILE_OUTPUT | PW_TYPE_DEPRECATED, listen_detail_t, filename) },
 	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_OUTPUT | PW_TYPE_REQUIRED, listen_detail_t, filename) },
@@ -1011,6 +2063,9 @@ static const CONF_PARSER detail_config[] = {
 	{ FR_CONF_OFFSET("retry_interval", PW_TYPE_INTEGER, listen_detail_t, retry_interval), .dflt = STRINGIFY(30) },
 	{ FR_CONF_OFFSET("one_shot", PW_TYPE_BOOLEAN, listen_detail_t, one_shot), .dflt = "no" },
 	{ FR_CONF_OFFSET("track", PW_TYPE_BOOLEAN, listen_detail_t, track), .dflt = "no" },
+	{ FR_CONF_OFFSET("mmap", PW_TYPE_BOOLEAN, listen_detail_t, use_mmap), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_outstanding", PW_TYPE_INTEGER, listen_detail_t, max_outstanding), .dflt = STRINGIFY(1) },
+	{ FR_CONF_OFFSET("parse_threads", PW_TYPE_INTEGER, listen_detail_t, parse_threads), .dflt = STRINGIFY(4) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -1054,6 +2109,17 @@ static int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, >=, 4);
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, <=, 3600);
 
+	FR_INTEGER_BOUND_CHECK("max_outstanding", data->max_outstanding, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_outstanding", data->max_outstanding, <=, 1024);
+
+	FR_INTEGER_BOUND_CHECK("parse_threads", data->parse_threads, >=, 1);
+	FR_INTEGER_BOUND_CHECK("parse_threads", data->parse_threads, <=, 64);
+
+	if ((data->max_outstanding > 1) && !data->use_mmap) {
+		cf_log_err_cs(cs, "\"max_outstanding\" can only be used with \"mmap = yes\"");
+		return -1;
+	}
+
 	/*
 	 *	Only checking the config.  Don't start threads or anything else.
 	 */
@@ -1131,7 +2197,7 @@ static int detail_socket_open(UNUSED CONF_SECTION *cs, rad_listen_t *this)
 	listen_detail_t *data;
 
 	data = this->data;
-	talloc_set_destructor(data, _detail_free);
+	talloc_set_destructor(data, proto_detail_free);
 
 	/*
 	 *	Create the communication pipes.
@@ -1146,7 +2212,7 @@ static int detail_socket_open(UNUSED CONF_SECTION *cs, rad_listen_t *this)
 		fr_exit(1);
 	}
 
-	pthread_create(&data->pthread_id, NULL, detail_handler_thread, this);
+	pthread_create(&data->pthread_id, NULL, data->use_mmap ? proto_detail_replay_thread : detail_handler_thread, this);
 
 	this->fd = data->master_pipe[0];
 
@@ -0,0 +1,30 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ * @file proto_detail.h
+ * @brief The memory-mapped replay reader, for the listener and its tests.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSIDH(proto_detail_h, "$Id$")
+
+#include <freeradius-devel/detail.h>
+
+void	*proto_detail_replay_thread(void *arg);
+void	proto_detail_ack(listen_detail_t *data, RADIUS_PACKET *packet, bool replied, int rtt);
+int	proto_detail_free(listen_detail_t *data);
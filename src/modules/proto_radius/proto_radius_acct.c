@@ -280,12 +280,11 @@ static int acct_socket_recv(rad_listen_t *listener)
 	TALLOC_CTX	*ctx;
 	REQUEST		*request;
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("acct_listener_pool");
 	if (!ctx) {
 		udp_recv_discard(listener->fd);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "acct_listener_pool");
 
 	packet = fr_radius_recv(ctx, listener->fd, 0, false);
 	if (!packet) {
@@ -911,12 +911,11 @@ static int auth_socket_recv(rad_listen_t *listener)
 	REQUEST		*request;
 	listen_socket_t *sock = listener->data;
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("auth_listener_pool");
 	if (!ctx) {
 		udp_recv_discard(listener->fd);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "auth_listener_pool");
 
 	packet = fr_radius_recv(ctx, listener->fd, 0, false);
 	if (!packet) {
@@ -286,12 +286,11 @@ static int status_socket_recv(rad_listen_t *listener)
 	TALLOC_CTX	*ctx;
 	REQUEST		*request;
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("status_listener_pool");
 	if (!ctx) {
 		udp_recv_discard(listener->fd);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "status_listener_pool");
 
 	packet = fr_radius_recv(ctx, listener->fd, 0, false);
 	if (!packet) {
@@ -194,12 +194,11 @@ static int vqp_socket_recv(rad_listen_t *listener)
 	TALLOC_CTX	*ctx;
 	REQUEST		*request;
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("vmps_listener_pool");
 	if (!ctx) {
 		udp_recv_discard(listener->fd);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "vmps_listener_pool");
 
 	packet = vqp_recv(ctx, listener->fd);
 	if (!packet) {
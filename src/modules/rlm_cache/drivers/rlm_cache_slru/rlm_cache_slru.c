@@ -0,0 +1,773 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_slru.c
+ * @brief Sharded in memory cache, with segmented LRU eviction.
+ *
+ * Entries are spread over a number of shards by the hash of their key.
+ * Each shard has an rbtree for lookups, a heap for expiry, and a
+ * read/write lock.  Lookups only take the read lock, everything else
+ * takes the write lock.
+ *
+ * Entries are reference counted.  The shard holds one reference, and
+ * every successful lookup takes another, which rlm_cache drops by
+ * calling the driver's free callback.  The lock is therefore only held
+ * for the duration of each callback, not between acquire and release.
+ *
+ * Lookups return a private copy of the entry, which rlm_cache may modify
+ * (it counts hits, and sets the expiry time before updating the TTL).
+ * The copy holds the reference to the shared entry.  Hits are counted
+ * on the shared entry atomically, and TTL updates are applied to it with
+ * the write lock held.
+ *
+ * Eviction uses a segmented LRU.  New entries go into the probationary
+ * segment.  A hit can't move an entry between lists under the read
+ * lock, so it only marks the entry as referenced.  When a writer needs
+ * to evict, referenced entries at the tail of the probationary segment
+ * are promoted to the protected segment instead, and referenced entries
+ * at the tail of the protected segment get a second chance.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/heap.h>
+#include <freeradius-devel/rad_assert.h>
+#include "../../rlm_cache.h"
+
+#include <ctype.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+typedef enum {
+	CACHE_SLRU_NONE = 0,				//!< Not in any segment.
+	CACHE_SLRU_PROBATION,				//!< Inserted, not yet hit while being considered
+							//!< for eviction.
+	CACHE_SLRU_PROTECTED				//!< Promoted after being hit.
+} rlm_cache_slru_segment_t;
+
+typedef struct rlm_cache_slru_entry rlm_cache_slru_entry_t;
+
+struct rlm_cache_slru_entry {
+	rlm_cache_entry_t	fields;		//!< Entry data.  Must come first.
+	size_t			offset;		//!< Offset used for heap.
+
+	time_t			expires;	//!< Copy of fields.expires used by the heap, only changed
+						//!< with the write lock held.
+	rlm_cache_slru_segment_t segment;	//!< Which list the entry is in.
+	rlm_cache_slru_entry_t	*prev;		//!< Towards the head (most recently inserted) of the segment.
+	rlm_cache_slru_entry_t	*next;		//!< Towards the tail of the segment.
+
+	atomic_uint_fast32_t	refs;		//!< Number of references held.
+	atomic_uint_fast64_t	hits;		//!< Number of times the entry has been found.
+	atomic_bool		referenced;	//!< Entry was hit since it was last considered for eviction.
+
+	rlm_cache_slru_entry_t	*shared;	//!< Entry in the shard, if this is a copy returned
+						//!< by a lookup.
+};
+
+typedef struct rlm_cache_slru_list {
+	rlm_cache_slru_entry_t	*head;
+	rlm_cache_slru_entry_t	*tail;
+	uint32_t		count;
+} rlm_cache_slru_list_t;
+
+typedef struct rlm_cache_slru_shard {
+	pthread_rwlock_t	lock;		//!< Read lock for lookups, write lock for everything else.
+
+	rbtree_t		*cache;		//!< Tree for looking up cache keys.
+	fr_heap_t		*heap;		//!< For managing entry expiry.
+
+	rlm_cache_slru_list_t	probation;	//!< Probationary segment.
+	rlm_cache_slru_list_t	protected;	//!< Protected segment.
+
+	atomic_uint_fast64_t	hits;		//!< Lookups which found a live entry.
+	atomic_uint_fast64_t	misses;		//!< Lookups which didn't.
+	uint64_t		inserts;	//!< Entries added.
+	uint64_t		evictions;	//!< Entries removed to stay within max_entries.
+	uint64_t		expired;	//!< Entries removed because their TTL passed.
+} rlm_cache_slru_shard_t;
+
+typedef struct rlm_cache_slru {
+	uint32_t		num_shards;	//!< Number of shards, rounded up to a power of 2.
+	uint32_t		protected_pct;	//!< Percentage of each shard reserved for protected entries.
+
+	uint32_t		max_entries;	//!< Maximum entries per shard, or 0 for no limit.
+	uint32_t		max_protected;	//!< Maximum entries in the protected segment of each shard.
+
+	rlm_cache_slru_shard_t	*shards;	//!< Array of shards.
+} rlm_cache_slru_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", PW_TYPE_INTEGER, rlm_cache_slru_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("protected", PW_TYPE_INTEGER, rlm_cache_slru_t, protected_pct), .dflt = "80" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one;
+	rlm_cache_entry_t const *b = two;
+
+	if (a->key_len < b->key_len) return -1;
+	if (a->key_len > b->key_len) return +1;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_slru_entry_t const *a = one;
+	rlm_cache_slru_entry_t const *b = two;
+
+	if (a->expires < b->expires) return -1;
+	if (a->expires > b->expires) return +1;
+
+	return 0;
+}
+
+static inline rlm_cache_slru_shard_t *cache_shard(rlm_cache_slru_t *driver, uint8_t const *key, size_t key_len)
+{
+	return &driver->shards[fr_hash(key, key_len) & (driver->num_shards - 1)];
+}
+
+/** Drop a reference to an entry, freeing it if it was the last one
+ *
+ */
+static void cache_entry_unref(rlm_cache_slru_entry_t *c)
+{
+	if (atomic_fetch_sub_explicit(&c->refs, 1, memory_order_acq_rel) == 1) talloc_free(c);
+}
+
+/** Add an entry to the head of a segment
+ *
+ */
+static void cache_list_push(rlm_cache_slru_shard_t *shard, rlm_cache_slru_entry_t *c, rlm_cache_slru_segment_t segment)
+{
+	rlm_cache_slru_list_t *list = (segment == CACHE_SLRU_PROTECTED) ? &shard->protected : &shard->probation;
+
+	c->segment = segment;
+	c->prev = NULL;
+	c->next = list->head;
+	if (list->head) {
+		list->head->prev = c;
+	} else {
+		list->tail = c;
+	}
+	list->head = c;
+	list->count++;
+}
+
+/** Remove an entry from whichever segment it's in
+ *
+ */
+static void cache_list_remove(rlm_cache_slru_shard_t *shard, rlm_cache_slru_entry_t *c)
+{
+	rlm_cache_slru_list_t *list;
+
+	switch (c->segment) {
+	case CACHE_SLRU_PROBATION:
+		list = &shard->probation;
+		break;
+
+	case CACHE_SLRU_PROTECTED:
+		list = &shard->protected;
+		break;
+
+	default:
+		return;
+	}
+
+	if (c->prev) {
+		c->prev->next = c->next;
+	} else {
+		list->head = c->next;
+	}
+
+	if (c->next) {
+		c->next->prev = c->prev;
+	} else {
+		list->tail = c->prev;
+	}
+
+	c->prev = c->next = NULL;
+	c->segment = CACHE_SLRU_NONE;
+	list->count--;
+}
+
+/** Remove an entry from a shard
+ *
+ * @note Called with the write lock held.  The shard's reference is passed
+ *	to the caller by adding the entry to the free list, so that the
+ *	entry can be freed once the lock is released.
+ */
+static void cache_entry_unlink(rlm_cache_slru_shard_t *shard, rlm_cache_slru_entry_t *c,
+			       rlm_cache_slru_entry_t **free_list)
+{
+	fr_heap_extract(shard->heap, c);
+	rbtree_deletebydata(shard->cache, c);
+	cache_list_remove(shard, c);
+
+	c->next = *free_list;
+	*free_list = c;
+}
+
+/** Drop the shard's reference to every entry in a free list
+ *
+ */
+static void cache_entry_list_free(rlm_cache_slru_entry_t *free_list)
+{
+	rlm_cache_slru_entry_t *c, *next;
+
+	for (c = free_list; c; c = next) {
+		next = c->next;
+		cache_entry_unref(c);
+	}
+}
+
+/** Remove entries until the shard is within its limits
+ *
+ * Expired entries go first.  After that the tail of the probationary
+ * segment is evicted, unless it was referenced, in which case it's
+ * promoted.  Only if the probationary segment is empty do we evict
+ * from the protected segment.
+ *
+ * @note Called with the write lock held.
+ */
+static void cache_shard_evict(rlm_cache_slru_t *driver, rlm_cache_slru_shard_t *shard, time_t now,
+			      rlm_cache_slru_entry_t **free_list)
+{
+	rlm_cache_slru_entry_t *c;
+
+	while ((c = fr_heap_peek(shard->heap)) && (c->expires < now)) {
+		cache_entry_unlink(shard, c, free_list);
+		shard->expired++;
+	}
+
+	if (!driver->max_entries) return;
+
+	/*
+	 *	Every pass either clears a referenced flag or
+	 *	evicts an entry, so this terminates.
+	 */
+	while (rbtree_num_elements(shard->cache) > driver->max_entries) {
+		c = shard->probation.tail;
+		if (c) {
+			if (atomic_load_explicit(&c->referenced, memory_order_relaxed)) {
+				atomic_store_explicit(&c->referenced, false, memory_order_relaxed);
+				cache_list_remove(shard, c);
+				cache_list_push(shard, c, CACHE_SLRU_PROTECTED);
+
+				/*
+				 *	Make room by demoting the least recently
+				 *	promoted entry.
+				 */
+				if (shard->protected.count > driver->max_protected) {
+					c = shard->protected.tail;
+					cache_list_remove(shard, c);
+					cache_list_push(shard, c, CACHE_SLRU_PROBATION);
+				}
+				continue;
+			}
+		} else {
+			c = shard->protected.tail;
+			rad_assert(c);
+
+			if (atomic_load_explicit(&c->referenced, memory_order_relaxed)) {
+				atomic_store_explicit(&c->referenced, false, memory_order_relaxed);
+				cache_list_remove(shard, c);
+				cache_list_push(shard, c, CACHE_SLRU_PROTECTED);
+				continue;
+			}
+		}
+
+		cache_entry_unlink(shard, c, free_list);
+		shard->evictions++;
+	}
+}
+
+/** Walk over a shard's rbtree
+ *
+ * Used to free any entries left in the tree on detach.
+ *
+ * @param ctx unused.
+ * @param data to free.
+ * @return 2
+ */
+static int _cache_entry_free(UNUSED void *ctx, void *data)
+{
+	cache_entry_unref(data);
+
+	return 2;
+}
+
+/** Cleanup a cache_slru instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_slru_t	*driver = instance;
+	uint32_t		i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_slru_shard_t *shard = &driver->shards[i];
+
+		if (shard->heap) fr_heap_delete(shard->heap);
+		if (shard->cache) {
+			rbtree_walk(shard->cache, RBTREE_DELETE_ORDER, _cache_entry_free, NULL);
+			rbtree_free(shard->cache);
+		}
+
+		pthread_rwlock_destroy(&shard->lock);
+	}
+
+	talloc_free(driver->shards);
+
+	return 0;
+}
+
+/** Print statistics for one shard, or the sum over all shards
+ *
+ * Format is "<counter> [<shard>]", where counter is one of "hits", "misses",
+ * "inserts", "evictions", "expired" or "entries".  "shards" returns the
+ * number of shards.
+ */
+static ssize_t cache_stats_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
+				void const *mod_inst, UNUSED void const *xlat_inst,
+				REQUEST *request, char const *fmt)
+{
+	rlm_cache_slru_t const	*driver = mod_inst;
+	char const		*p;
+	char			*q;
+	size_t			len;
+	uint32_t		i, start = 0, end = driver->num_shards;
+	uint64_t		total = 0;
+
+	while (isspace((int) *fmt)) fmt++;
+	for (p = fmt; *p && !isspace((int) *p); p++);
+	len = p - fmt;
+
+	while (isspace((int) *p)) p++;
+	if (*p) {
+		unsigned long num;
+
+		num = strtoul(p, &q, 10);
+		if ((q == p) || *q || (num >= driver->num_shards)) {
+			REDEBUG("Invalid shard \"%s\", must be between 0 and %u", p, driver->num_shards - 1);
+			return -1;
+		}
+		start = num;
+		end = num + 1;
+	}
+
+#define COUNTER(_name) ((len == sizeof(_name) - 1) && (strncmp(fmt, _name, len) == 0))
+	if (COUNTER("shards")) return snprintf(*out, outlen, "%u", driver->num_shards);
+
+	for (i = start; i < end; i++) {
+		rlm_cache_slru_shard_t *shard = &driver->shards[i];
+
+		if (COUNTER("hits")) {
+			total += atomic_load_explicit(&shard->hits, memory_order_relaxed);
+
+		} else if (COUNTER("misses")) {
+			total += atomic_load_explicit(&shard->misses, memory_order_relaxed);
+
+		} else {
+			pthread_rwlock_rdlock(&shard->lock);
+			if (COUNTER("inserts")) {
+				total += shard->inserts;
+
+			} else if (COUNTER("evictions")) {
+				total += shard->evictions;
+
+			} else if (COUNTER("expired")) {
+				total += shard->expired;
+
+			} else if (COUNTER("entries")) {
+				total += rbtree_num_elements(shard->cache);
+
+			} else {
+				pthread_rwlock_unlock(&shard->lock);
+				REDEBUG("Unknown counter \"%.*s\"", (int) len, fmt);
+				return -1;
+			}
+			pthread_rwlock_unlock(&shard->lock);
+		}
+	}
+#undef COUNTER
+
+	return snprintf(*out, outlen, "%" PRIu64, total);
+}
+
+/** Create a new cache_slru instance
+ *
+ * @copydetails cache_instantiate_t
+ */
+static int mod_instantiate(rlm_cache_config_t const *config, void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_slru_t	*driver = instance;
+	uint32_t		i, num_shards;
+	char			buffer[256];
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 1024);
+	FR_INTEGER_BOUND_CHECK("protected", driver->protected_pct, <=, 100);
+
+	for (num_shards = 1; num_shards < driver->num_shards; num_shards <<= 1);
+	if (num_shards != driver->num_shards) {
+		cf_log_info(conf, "Rounding shards up to %u", num_shards);
+		driver->num_shards = num_shards;
+	}
+
+	/*
+	 *	The budget is split evenly, keys are hashed so
+	 *	the shards should fill at about the same rate.
+	 */
+	if (config->max_entries > 0) {
+		driver->max_entries = (config->max_entries + num_shards - 1) / num_shards;
+		driver->max_protected = ((uint64_t) driver->max_entries * driver->protected_pct) / 100;
+	}
+
+	/*
+	 *	The instance data is read only once we're
+	 *	instantiated, so the shards are parented
+	 *	from the NULL ctx.
+	 */
+	driver->shards = talloc_zero_array(NULL, rlm_cache_slru_shard_t, num_shards);
+	if (!driver->shards) {
+		ERROR("Failed to allocate shards");
+		return -1;
+	}
+
+	for (i = 0; i < num_shards; i++) {
+		rlm_cache_slru_shard_t *shard = &driver->shards[i];
+
+		if (pthread_rwlock_init(&shard->lock, NULL) != 0) {
+			ERROR("Failed initializing lock: %s", fr_syserror(errno));
+		error:
+			driver->num_shards = i;
+			mod_detach(driver);
+			driver->shards = NULL;
+			return -1;
+		}
+
+		shard->cache = rbtree_create(NULL, cache_entry_cmp, NULL, 0);
+		if (!shard->cache) {
+			ERROR("Failed to create cache");
+			pthread_rwlock_destroy(&shard->lock);
+			goto error;
+		}
+
+		shard->heap = fr_heap_create(cache_heap_cmp, offsetof(rlm_cache_slru_entry_t, offset));
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			rbtree_free(shard->cache);
+			pthread_rwlock_destroy(&shard->lock);
+			goto error;
+		}
+
+		atomic_init(&shard->hits, 0);
+		atomic_init(&shard->misses, 0);
+	}
+
+	/*
+	 *	Register the stats xlat
+	 */
+	snprintf(buffer, sizeof(buffer), "%s_stats", config->name);
+	xlat_register(driver, buffer, cache_stats_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN);
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    REQUEST *request)
+{
+	rlm_cache_slru_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_slru_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+	atomic_init(&c->refs, 1);		/* The caller's */
+	atomic_init(&c->hits, 0);
+	atomic_init(&c->referenced, false);
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Release the caller's reference to an entry
+ *
+ * @copydetails cache_entry_free_t
+ */
+static void cache_entry_free(rlm_cache_entry_t *c)
+{
+	rlm_cache_slru_entry_t *my_c = (rlm_cache_slru_entry_t *)c;
+
+	if (my_c->shared) {
+		cache_entry_unref(my_c->shared);
+		talloc_free(my_c);
+		return;
+	}
+
+	cache_entry_unref(my_c);
+}
+
+/** Locate a cache entry
+ *
+ * The returned entry is a copy, which holds a reference to the shared
+ * entry.  The reference is released by rlm_cache calling #cache_entry_free.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       REQUEST *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_slru_t	*driver = instance;
+	rlm_cache_slru_shard_t	*shard = cache_shard(driver, key, key_len);
+	rlm_cache_slru_entry_t	*c, *copy;
+	rlm_cache_entry_t	my_c;
+
+	my_c.key = key;
+	my_c.key_len = key_len;
+
+	/*
+	 *	Allocated before taking the lock, as it's
+	 *	usually a hit.
+	 */
+	copy = talloc_zero(NULL, rlm_cache_slru_entry_t);
+	if (!copy) {
+		RERROR("Failed allocating cache entry");
+		return CACHE_ERROR;
+	}
+
+	pthread_rwlock_rdlock(&shard->lock);
+	c = rbtree_finddata(shard->cache, &my_c);
+
+	/*
+	 *	Expired entries are left for the next writer
+	 *	to clean up.
+	 */
+	if (!c || (c->expires < request->packet->timestamp.tv_sec)) {
+		pthread_rwlock_unlock(&shard->lock);
+		talloc_free(copy);
+		atomic_fetch_add_explicit(&shard->misses, 1, memory_order_relaxed);
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	atomic_fetch_add_explicit(&c->refs, 1, memory_order_relaxed);
+	copy->shared = c;
+
+	/*
+	 *	The expiry time is only changed with the write
+	 *	lock held, the rest of the fields never change.
+	 *	rlm_cache counts this hit on the copy.
+	 */
+	copy->fields = c->fields;
+	copy->fields.hits = atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+
+	/*
+	 *	Avoid writing to the entry's cache line if the
+	 *	flag is already set, hot keys are hit by many
+	 *	threads at once.
+	 */
+	if (!atomic_load_explicit(&c->referenced, memory_order_relaxed)) {
+		atomic_store_explicit(&c->referenced, true, memory_order_relaxed);
+	}
+	pthread_rwlock_unlock(&shard->lock);
+
+	atomic_fetch_add_explicit(&shard->hits, 1, memory_order_relaxed);
+	*out = &copy->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, UNUSED void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_slru_t	*driver = instance;
+	rlm_cache_slru_shard_t	*shard = cache_shard(driver, key, key_len);
+	rlm_cache_slru_entry_t	*c, *free_list = NULL;
+	rlm_cache_entry_t	my_c;
+
+	if (!request) return CACHE_ERROR;
+
+	my_c.key = key;
+	my_c.key_len = key_len;
+
+	pthread_rwlock_wrlock(&shard->lock);
+	c = rbtree_finddata(shard->cache, &my_c);
+	if (c) cache_entry_unlink(shard, c, &free_list);
+	pthread_rwlock_unlock(&shard->lock);
+
+	if (!c) return CACHE_MISS;
+
+	cache_entry_list_free(free_list);
+
+	return CACHE_OK;
+}
+
+/** Link an entry into its shard, replacing any existing entry with the same key
+ *
+ * @note Called with the write lock held.
+ */
+static int cache_entry_link(rlm_cache_slru_shard_t *shard, rlm_cache_slru_entry_t *c,
+			    rlm_cache_slru_entry_t **free_list)
+{
+	rlm_cache_slru_entry_t *old;
+
+	old = rbtree_finddata(shard->cache, c);
+	if (old) cache_entry_unlink(shard, old, free_list);
+
+	if (!rbtree_insert(shard->cache, c)) return -1;
+
+	c->expires = c->fields.expires;
+	if (!fr_heap_insert(shard->heap, c)) {
+		rbtree_deletebydata(shard->cache, c);
+		return -1;
+	}
+
+	cache_list_push(shard, c, CACHE_SLRU_PROBATION);
+	atomic_fetch_add_explicit(&c->refs, 1, memory_order_relaxed);	/* The shard's */
+	shard->inserts++;
+
+	return 0;
+}
+
+/** Insert a new entry into the data store
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, UNUSED void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_slru_t	*driver = instance;
+	rlm_cache_slru_shard_t	*shard = cache_shard(driver, c->key, c->key_len);
+	rlm_cache_slru_entry_t	*my_c, *free_list = NULL;
+	int			ret;
+
+	if (!request) return CACHE_ERROR;
+
+	memcpy(&my_c, &c, sizeof(my_c));
+
+	pthread_rwlock_wrlock(&shard->lock);
+	ret = cache_entry_link(shard, my_c, &free_list);
+	if (ret == 0) cache_shard_evict(driver, shard, request->packet->timestamp.tv_sec, &free_list);
+	pthread_rwlock_unlock(&shard->lock);
+
+	cache_entry_list_free(free_list);
+
+	if (ret < 0) {
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * The new expiry time is copied from the entry returned by the lookup
+ * to the shared entry.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  REQUEST *request, UNUSED void *handle,
+					  rlm_cache_entry_t *c)
+{
+	rlm_cache_slru_t	*driver = instance;
+	rlm_cache_slru_shard_t	*shard = cache_shard(driver, c->key, c->key_len);
+	rlm_cache_slru_entry_t	*my_c = (rlm_cache_slru_entry_t *)c, *free_list = NULL;
+	cache_status_t		status = CACHE_OK;
+
+	if (!request) return CACHE_ERROR;
+
+	if (my_c->shared) my_c = my_c->shared;
+
+	pthread_rwlock_wrlock(&shard->lock);
+
+	/*
+	 *	Another thread removed the entry after we found it.
+	 *	It can't be linked again, as it may still be on that
+	 *	thread's free list.
+	 */
+	if (my_c->segment == CACHE_SLRU_NONE) {
+		status = CACHE_MISS;
+
+	} else {
+		fr_heap_extract(shard->heap, my_c);
+		my_c->fields.expires = my_c->expires = c->expires;
+		if (!fr_heap_insert(shard->heap, my_c)) {
+			cache_entry_unlink(shard, my_c, &free_list);	/* make sure we don't leak entries... */
+			status = CACHE_ERROR;
+		}
+	}
+	pthread_rwlock_unlock(&shard->lock);
+
+	cache_entry_list_free(free_list);
+
+	if (status == CACHE_ERROR) RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+
+	return status;
+}
+
+extern cache_driver_t rlm_cache_slru;
+cache_driver_t rlm_cache_slru = {
+	.name		= "rlm_cache_slru",
+	.magic		= RLM_MODULE_INIT,
+	.inst_size	= sizeof(rlm_cache_slru_t),
+	.config		= driver_config,
+
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.alloc		= cache_entry_alloc,
+	.free		= cache_entry_free,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+};
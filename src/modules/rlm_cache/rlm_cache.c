@@ -463,6 +463,7 @@ static rlm_rcode_t cache_insert(rlm_cache_t const *inst, REQUEST *request, rlm_c
  *
  * @return
  *	- #RLM_MODULE_OK on success.
+ *	- #RLM_MODULE_NOTFOUND if the entry no longer exists.
  *	- #RLM_MODULE_FAIL on failure.
  */
 static rlm_rcode_t cache_set_ttl(rlm_cache_t const *inst, REQUEST *request,
@@ -506,6 +507,10 @@ static rlm_rcode_t cache_set_ttl(rlm_cache_t const *inst, REQUEST *request,
 			RDEBUG("Updated entry TTL");
 			return RLM_MODULE_OK;
 
+		case CACHE_MISS:
+			RDEBUG("Entry was removed before its TTL could be updated");
+			return RLM_MODULE_NOTFOUND;
+
 		default:
 			return RLM_MODULE_FAIL;
 		}
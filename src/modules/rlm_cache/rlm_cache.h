@@ -214,6 +214,7 @@ typedef cache_status_t	(*cache_entry_expire_t)(rlm_cache_config_t const *config,
  *	- #CACHE_RECONNECT - If handle needs to be reinitialised/reconnected.
  *	- #CACHE_ERROR - If the entry TTL couldn't be updated.
  *	- #CACHE_OK - If the entry's TTL was updated.
+ *	- #CACHE_MISS - If the entry was removed from the cache after it was found.
  */
 typedef cache_status_t	(*cache_entry_set_ttl_t)(rlm_cache_config_t const *config, void *instance,
 						 REQUEST *request, void *handle,
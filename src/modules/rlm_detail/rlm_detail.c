@@ -67,6 +67,17 @@ typedef struct detail_instance {
 
 	bool		escape;		//!< do filename escaping, yes / no
 
+	char const	*format;	//!< "text" or "binary".
+	bool		binary;		//!< Write binary records instead of text.
+	char const	*secret;	//!< To encode binary records with, see #DETAIL_BINARY_SECRET.
+	bool		received;	//!< Write binary records as the packet was received.
+
+	bool		buffered;	//!< Queue entries, and have a separate thread write them.
+	struct timeval	flush_interval;	//!< Longest time an entry is queued for.
+	uint32_t	flush_bytes;	//!< Write sooner when this much is queued.
+	bool		fsync;		//!< Sync the file after each write of queued entries.
+	gid_t		gid;		//!< Resolved group, for buffered writes.
+
 	xlat_escape_t	escape_func; //!< escape function
 
 	exfile_t    	*ef;		//!< Log file handler
@@ -82,6 +93,12 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("locking", PW_TYPE_BOOLEAN, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", PW_TYPE_BOOLEAN, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", PW_TYPE_BOOLEAN, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("format", PW_TYPE_STRING, rlm_detail_t, format), .dflt = "text" },
+	{ FR_CONF_OFFSET("binary_received", PW_TYPE_BOOLEAN, rlm_detail_t, received), .dflt = "no" },
+	{ FR_CONF_OFFSET("buffered", PW_TYPE_BOOLEAN, rlm_detail_t, buffered), .dflt = "no" },
+	{ FR_CONF_OFFSET("flush_interval", PW_TYPE_TIMEVAL, rlm_detail_t, flush_interval), .dflt = "0.1" },
+	{ FR_CONF_OFFSET("flush_bytes", PW_TYPE_INTEGER, rlm_detail_t, flush_bytes), .dflt = "262144" },
+	{ FR_CONF_OFFSET("fsync", PW_TYPE_BOOLEAN, rlm_detail_t, fsync), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -132,12 +149,43 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		inst->escape_func = rad_filename_make_safe;
 	}
 
+	if (strcmp(inst->format, "binary") == 0) {
+		inst->binary = true;
+		inst->secret = talloc_typed_strdup(inst, DETAIL_BINARY_SECRET);
+
+	} else if (strcmp(inst->format, "text") != 0) {
+		cf_log_err_cs(conf, "Invalid value '%s' for 'format', must be 'text' or 'binary'", inst->format);
+		return -1;
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, inst->locking, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err_cs(conf, "Failed creating log file context");
 		return -1;
 	}
 
+	if (inst->buffered) {
+		if (exfile_buffer_init(inst->ef, &inst->flush_interval, inst->flush_bytes, inst->fsync) < 0) {
+			cf_log_err_cs(conf, "Failed enabling buffered writes: %s", fr_strerror());
+			return -1;
+		}
+
+		/*
+		 *	The file is written by another thread, so
+		 *	resolve the group now.
+		 */
+		inst->gid = (gid_t) -1;
+		if (inst->group) {
+			char *endptr;
+
+			inst->gid = strtol(inst->group, &endptr, 10);
+			if ((*endptr != '\0') && (rad_getgid(inst, &inst->gid, inst->group) < 0)) {
+				cf_log_err_cs(conf, "Unable to find system group '%s'", inst->group);
+				return -1;
+			}
+		}
+	}
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -145,6 +193,15 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	if (cs) {
 		CONF_ITEM	*ci;
 
+		/*
+		 *	Binary records are the packet as it was
+		 *	received, so there's nothing to leave out.
+		 */
+		if (inst->binary) {
+			cf_log_err_cs(conf, "'suppress' cannot be used with 'format = binary'");
+			return -1;
+		}
+
 		inst->ht = fr_hash_table_create(NULL, detail_hash, detail_cmp, NULL);
 
 		for (ci = cf_item_find_next(cs, NULL);
@@ -193,44 +250,87 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/** Append one attribute to a detail entry
+ *
+ * The same format as fr_pair_fprint().
+ */
+static char *detail_fr_pair_print(char *out, VALUE_PAIR const *vp)
+{
+	char	buffer[1024];
+	size_t	len;
+
+	len = fr_pair_snprint(buffer, sizeof(buffer) - 2, vp);
+	if (!len) return out;
+
+	/*
+	 *	Deal with truncation gracefully
+	 */
+	if (len >= (sizeof(buffer) - 2)) len = sizeof(buffer) - 3;
+
+	return talloc_asprintf_append_buffer(out, "\t%.*s\n", (int) len, buffer);
+}
+
 /*
  *	Wrapper for VPs allocated on the stack.
  */
-static void detail_fr_pair_fprint(TALLOC_CTX *ctx, FILE *out, VALUE_PAIR const *stacked)
+static char *detail_fr_pair_print_stacked(TALLOC_CTX *ctx, char *out, VALUE_PAIR const *stacked)
 {
 	VALUE_PAIR *vp;
 
 	vp = talloc(ctx, VALUE_PAIR);
-	if (!vp) return;
+	if (!vp) return NULL;
 
 	memcpy(vp, stacked, sizeof(*vp));
 	vp->op = T_OP_EQ;
-	fr_pair_fprint(out, vp);
+	out = detail_fr_pair_print(out, vp);
 	talloc_free(vp);
+
+	return out;
 }
 
 
-/** Write a single detail entry to file pointer
+/** Format a single detail entry
+ *
+ * The entry is built in memory before anything is written, so that
+ * the file is locked only for the time it takes to write it, and so
+ * that it can be queued for buffered writes.
  *
- * @param[in] out Where to write entry.
+ * @param[in] ctx to allocate the entry in.
  * @param[in] inst Instance of rlm_detail.
  * @param[in] request The current request.
  * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
  * @param[in] compat Write out entry in compatibility mode.
+ * @return
+ *	- The entry, as a talloced string.
+ *	- NULL on error.
  */
-static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, RADIUS_PACKET *packet, bool compat)
+static char *detail_format(TALLOC_CTX *ctx, rlm_detail_t const *inst, REQUEST *request, RADIUS_PACKET *packet,
+			   bool compat)
 {
 	VALUE_PAIR *vp;
 	char timestamp[256];
+	char *out;
 
 	if (xlat_eval(timestamp, sizeof(timestamp), request, inst->header, NULL, NULL) < 0) {
-		return -1;
+		return NULL;
 	}
 
+	out = talloc_strdup(ctx, "");
+	if (!out) return NULL;
+
 #define WRITE(fmt, ...) do {\
-	if (fprintf(out, fmt, ## __VA_ARGS__) < 0) {\
-		RERROR("Failed writing to detail file: %s", fr_syserror(errno));\
-		return -1;\
+	out = talloc_asprintf_append_buffer(out, fmt, ## __VA_ARGS__);\
+	if (!out) {\
+		RERROR("Failed formatting detail entry: Out of memory");\
+		return NULL;\
+	}\
+} while(0)
+
+#define WRITE_STACKED_VP(_vp) do {\
+	out = detail_fr_pair_print_stacked(request, out, _vp);\
+	if (!out) {\
+		RERROR("Failed formatting detail entry: Out of memory");\
+		return NULL;\
 	}\
 } while(0)
 
@@ -279,16 +379,16 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 			break;
 		}
 
-		detail_fr_pair_fprint(request, out, &src_vp);
-		detail_fr_pair_fprint(request, out, &dst_vp);
+		WRITE_STACKED_VP(&src_vp);
+		WRITE_STACKED_VP(&dst_vp);
 
 		src_vp.da = fr_dict_attr_by_num(NULL, 0, PW_PACKET_SRC_PORT);
 		src_vp.vp_integer = packet->src_port;
 		dst_vp.da = fr_dict_attr_by_num(NULL, 0, PW_PACKET_DST_PORT);
 		dst_vp.vp_integer = packet->dst_port;
 
-		detail_fr_pair_fprint(request, out, &src_vp);
-		detail_fr_pair_fprint(request, out, &dst_vp);
+		WRITE_STACKED_VP(&src_vp);
+		WRITE_STACKED_VP(&dst_vp);
 	}
 
 	{
@@ -311,8 +411,12 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 			 */
 			op = vp->op;
 			vp->op = T_OP_EQ;
-			fr_pair_fprint(out, vp);
+			out = detail_fr_pair_print(out, vp);
 			vp->op = op;
+			if (!out) {
+				RERROR("Failed formatting detail entry: Out of memory");
+				return NULL;
+			}
 		}
 	}
 
@@ -334,7 +438,88 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 
 	WRITE("\n");
 
-	return 0;
+	return out;
+}
+
+/** Format a single binary detail entry
+ *
+ * The attributes of the packet are encoded with #DETAIL_BINARY_SECRET,
+ * as the reader doesn't know the client's secret, so the entry holds
+ * any changes made by the policies.
+ *
+ * With "binary_received", the packet is written as it was received,
+ * unless it has no data, or it contains encrypted attributes.
+ *
+ * @param[in] ctx to allocate the entry in.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
+ * @return
+ *	- The entry, as a talloced buffer.
+ *	- NULL on error.
+ */
+static uint8_t *detail_format_binary(TALLOC_CTX *ctx, rlm_detail_t const *inst, REQUEST *request,
+				     RADIUS_PACKET *packet)
+{
+	RADIUS_PACKET	*encoded = NULL;
+	uint8_t const	*data = inst->received ? packet->data : NULL;
+	size_t		data_len = packet->data_len;
+	uint8_t		*out;
+
+	if (data) {
+		vp_cursor_t	cursor;
+		VALUE_PAIR	*vp;
+
+		for (vp = fr_pair_cursor_init(&cursor, &packet->vps);
+		     vp;
+		     vp = fr_pair_cursor_next(&cursor)) {
+			if (vp->da->flags.encrypt != FLAG_ENCRYPT_NONE) {
+				data = NULL;
+				break;
+			}
+		}
+	}
+
+	if (!data) {
+		RADIUS_PACKET const *original = NULL;
+
+		/*
+		 *	Replies need the request authenticator.
+		 */
+#ifdef WITH_PROXY
+		if (request->proxy && (packet == request->proxy->reply)) {
+			original = request->proxy->packet;
+		} else
+#endif
+		if (packet == request->reply) original = request->packet;
+
+		encoded = fr_radius_copy(ctx, packet);
+		if (!encoded) {
+			RERROR("Failed formatting detail entry: Out of memory");
+			return NULL;
+		}
+
+		if (fr_radius_encode(encoded, original, inst->secret) < 0) {
+			RERROR("Failed encoding detail entry: %s", fr_strerror());
+			talloc_free(encoded);
+			return NULL;
+		}
+		data = encoded->data;
+		data_len = encoded->data_len;
+	}
+
+	out = talloc_array(ctx, uint8_t, DETAIL_BINARY_HDR_LEN + data_len);
+	if (!out) {
+		RERROR("Failed formatting detail entry: Out of memory");
+		talloc_free(encoded);
+		return NULL;
+	}
+
+	detail_binary_header(out, &request->packet->timestamp, packet, data, data_len);
+	memcpy(out + DETAIL_BINARY_HDR_LEN, data, data_len);
+	talloc_free(encoded);
+
+	return out;
 }
 
 /*
@@ -345,8 +530,10 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 {
 	int		outfd;
 	char		buffer[DIRLEN];
-
-	FILE		*outfp;
+	char		*entry;
+	uint8_t const	*p;
+	size_t		len;
+	ssize_t		slen;
 
 #ifdef HAVE_GRP_H
 	gid_t		gid;
@@ -383,9 +570,34 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 #endif
 #endif
 
+	if (inst->binary) {
+		entry = (char *) detail_format_binary(request, inst, request, packet);
+		if (!entry) return RLM_MODULE_FAIL;
+		len = talloc_array_length(entry);
+	} else {
+		entry = detail_format(request, inst, request, packet, compat);
+		if (!entry) return RLM_MODULE_FAIL;
+		len = talloc_array_length(entry) - 1;
+	}
+
+	/*
+	 *	Let the flusher write it, along with everything else
+	 *	queued for the same file.
+	 */
+	if (inst->buffered) {
+		if (exfile_append(inst->ef, request, buffer, inst->perm, inst->gid, entry, len) < 0) {
+			RERROR("Couldn't queue entry for %s: %s", buffer, fr_strerror());
+			talloc_free(entry);
+			return RLM_MODULE_FAIL;
+		}
+		talloc_free(entry);
+		return RLM_MODULE_OK;
+	}
+
 	outfd = exfile_open(inst->ef, request, buffer, inst->perm, true);
 	if (outfd < 0) {
 		RERROR("Couldn't open file %s: %s", buffer, fr_strerror());
+		talloc_free(entry);
 		return RLM_MODULE_FAIL;
 	}
 
@@ -404,24 +616,23 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 	}
 
 skip_group:
-	/*
-	 *	Open the output fp for buffering.
-	 */
-	if ((outfp = fdopen(outfd, "a")) == NULL) {
-		RERROR("Couldn't open file %s: %s", buffer, fr_syserror(errno));
-	fail:
-		if (outfp) fclose(outfp);
-		exfile_unlock(inst->ef, request, outfd);
-		return RLM_MODULE_FAIL;
-	}
+	for (p = (uint8_t const *) entry; len > 0; p += slen, len -= slen) {
+		slen = write(outfd, p, len);
+		if (slen < 0) {
+			if (errno == EINTR) {
+				slen = 0;
+				continue;
+			}
 
-	if (detail_write(outfp, inst, request, packet, compat) < 0) goto fail;
+			RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+			exfile_close(inst->ef, request, outfd);
+			talloc_free(entry);
+			return RLM_MODULE_FAIL;
+		}
+	}
 
-	/*
-	 *	Flush everything
-	 */
-	fclose(outfp);
-	exfile_unlock(inst->ef, request, outfd); /* do NOT close outfp */
+	exfile_close(inst->ef, request, outfd);
+	talloc_free(entry);
 
 	/*
 	 *	And everything is fine.
@@ -0,0 +1,986 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file src/modules/rlm_ldap/async.c
+ * @brief Searches which share a per-thread connection, and binds.
+ *
+ * Each thread opens one connection, bound as the admin user.  Searches are
+ * sent on it without waiting for the ones before them to complete, and the
+ * requests which sent them yield.  When the connection becomes readable we
+ * read whatever has arrived, match it to the searches by msgid, and mark the
+ * requests waiting for completed searches as resumable.
+ *
+ * Binds are sent the same way, but as only one bind can be in progress on a
+ * connection, each thread opens a few connections for them.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#define LOG_PREFIX "rlm_ldap (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_ldap.h"
+
+static int ldap_query_cmp(void const *one, void const *two)
+{
+	ldap_query_t const *a = one;
+	ldap_query_t const *b = two;
+
+	return (a->msgid > b->msgid) - (a->msgid < b->msgid);
+}
+
+/** Mark the request waiting for a query as resumable
+ *
+ * @param[in] query	which is done.
+ * @param[in] timer	whether we were called from the query's timeout.
+ */
+static void ldap_query_resume(ldap_query_t *query, bool timer)
+{
+	if (query->done) return;
+
+	query->done = true;
+
+	/*
+	 *	The timer event is freed after its callback
+	 *	returns, so only delete it if it didn't fire.
+	 */
+	if (!timer) (void) unlang_event_timeout_delete(query->request, query);
+
+	unlang_resumable(query->request);
+}
+
+/** Fail a query because the connection it was sent on has gone
+ *
+ * Queries which are done, but have not been resumed yet, also lose
+ * their entry, as it can no longer be parsed.
+ */
+static int _ldap_query_fail(void *ctx, void *data)
+{
+	ldap_query_t	*query = data;
+	char const	*error = ctx;
+
+	query->thread = NULL;
+
+	if (!query->done || (query->status == LDAP_PROC_SUCCESS)) {
+		if (query->entry) {
+			ldap_msgfree(query->entry);
+			query->entry = NULL;
+		}
+		query->count = 0;
+
+		TALLOC_FREE(query->extra);
+		query->status = LDAP_PROC_ERROR;
+		query->error = error;
+	}
+
+	ldap_query_resume(query, false);
+
+	return 2;	/* Delete, and continue */
+}
+
+/** Forget about queries without resuming the requests waiting for them
+ *
+ */
+static int _ldap_query_unlink(UNUSED void *ctx, void *data)
+{
+	ldap_query_t *query = data;
+
+	query->thread = NULL;
+
+	return 2;	/* Delete, and continue */
+}
+
+/** Close the thread's connection, failing all the queries sent on it
+ *
+ * @param[in] t		thread specific data.
+ * @param[in] error	to give as the reason the queries failed.  Must not be freed.
+ */
+static void ldap_async_disconnect(rlm_ldap_thread_t *t, char const *error)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	void			*mutable;
+
+	if (!t->conn) return;
+
+	ERROR("Closing connection used for asynchronous searches (fd %i): %s", t->fd, error);
+
+	(void) fr_event_fd_delete(t->el, t->fd);
+
+	memcpy(&mutable, &error, sizeof(mutable));
+	rbtree_walk(t->queries, RBTREE_DELETE_ORDER, _ldap_query_fail, mutable);
+
+	TALLOC_FREE(t->conn);
+	t->fd = -1;
+}
+
+/** Remove a bind from the list of those waiting for a connection
+ *
+ * @param[in] t		thread specific data.
+ * @param[in] query	to remove.  Nothing happens if it's not in the list.
+ */
+static void ldap_bind_unqueue(rlm_ldap_thread_t *t, ldap_query_t *query)
+{
+	ldap_query_t **last, *prev = NULL;
+
+	for (last = &t->binds_head; *last; prev = *last, last = &(*last)->next) {
+		if (*last != query) continue;
+
+		*last = query->next;
+		if (t->binds_tail == query) t->binds_tail = prev;
+		query->next = NULL;
+		return;
+	}
+}
+
+/** Close a connection used for binds
+ *
+ * If a bind is still in progress on the connection, it fails.
+ *
+ * @param[in] bconn	to close.
+ * @param[in] error	to give as the reason the bind failed.  Must not be freed.
+ */
+static void ldap_bind_conn_close(ldap_bind_conn_t *bconn, char const *error)
+{
+	rlm_ldap_thread_t	*t = bconn->thread;
+	rlm_ldap_t const	*inst = t->inst;
+	ldap_query_t		*query = bconn->query;
+	ldap_bind_conn_t	**last;
+
+	if (query) {
+		ERROR("Closing connection used for binds (fd %i): %s", bconn->fd, error);
+	} else {
+		DEBUG("Closing connection used for binds (fd %i): %s", bconn->fd, error);
+	}
+
+	for (last = &t->binds; *last; last = &(*last)->next) {
+		if (*last != bconn) continue;
+
+		*last = bconn->next;
+		t->binds_open--;
+		break;
+	}
+
+	(void) fr_event_fd_delete(t->el, bconn->fd);
+	talloc_free(bconn);
+
+	if (!query) return;
+
+	query->bind_conn = NULL;
+	query->status = LDAP_PROC_ERROR;
+	query->error = error;
+
+	ldap_query_resume(query, false);
+}
+
+static void _ldap_bind_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx);
+static void _ldap_bind_errored(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx);
+
+/** Open a connection for binds, and start watching it
+ *
+ * @param[in] t		thread specific data.
+ * @return
+ *	- The new connection.
+ *	- NULL on failure.
+ */
+static ldap_bind_conn_t *ldap_bind_conn_open(rlm_ldap_thread_t *t)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	struct timeval		timeout = { inst->res_timeout, 0 };
+	ldap_bind_conn_t	*bconn;
+	void			*mutable;
+	int			fd = -1;
+
+	memcpy(&mutable, &inst, sizeof(mutable));
+
+	MEM(bconn = talloc_zero(t, ldap_bind_conn_t));
+	bconn->thread = t;
+	bconn->fd = -1;
+
+	bconn->conn = mod_conn_create(bconn, mutable, &timeout);
+	if (!bconn->conn) goto error;
+
+	if (ldap_set_option(bconn->conn->handle, LDAP_OPT_REFERRALS, LDAP_OPT_OFF) != LDAP_OPT_SUCCESS) {
+		ERROR("Failed disabling referrals for binds");
+		goto error;
+	}
+
+	if ((ldap_get_option(bconn->conn->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) || (fd < 0)) {
+		ERROR("Failed retrieving file descriptor for binds");
+		goto error;
+	}
+
+	if (fr_event_fd_insert(t->el, fd, _ldap_bind_readable, NULL, _ldap_bind_errored, bconn) < 0) {
+		ERROR("Failed registering file descriptor %i for binds: %s", fd, fr_strerror());
+		goto error;
+	}
+	bconn->fd = fd;
+
+	bconn->next = t->binds;
+	t->binds = bconn;
+	t->binds_open++;
+
+	DEBUG("Opened connection for binds (fd %i)", fd);
+
+	return bconn;
+
+error:
+	talloc_free(bconn);
+
+	return NULL;
+}
+
+/** Send a bind on a free connection
+ *
+ * @param[in] bconn	to send the bind on.
+ * @param[in] query	the bind.
+ * @return The result of ldap_sasl_bind().
+ */
+static int ldap_bind_send(ldap_bind_conn_t *bconn, ldap_query_t *query)
+{
+	struct berval	cred;
+	int		ret;
+
+	memcpy(&cred.bv_val, &query->password, sizeof(cred.bv_val));
+	cred.bv_len = talloc_array_length(query->password) - 1;
+
+	/*
+	 *	The simple version of the SASL bind function.
+	 */
+	ret = ldap_sasl_bind(bconn->conn->handle, query->dn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, &query->msgid);
+	if (ret != LDAP_SUCCESS) return ret;
+
+	bconn->query = query;
+	query->bind_conn = bconn;
+
+	return LDAP_SUCCESS;
+}
+
+/** Find a connection for a bind, opening one if they're all busy
+ *
+ * @param[in] t		thread specific data.
+ * @return
+ *	- A free connection.
+ *	- NULL if there are as many connections as we're allowed, or a new one
+ *	  couldn't be opened.
+ */
+static ldap_bind_conn_t *ldap_bind_conn_get(rlm_ldap_thread_t *t)
+{
+	ldap_bind_conn_t *bconn;
+
+	for (bconn = t->binds; bconn; bconn = bconn->next) if (!bconn->query) return bconn;
+
+	if (t->binds_open >= t->inst->async_binds) return NULL;
+
+	return ldap_bind_conn_open(t);
+}
+
+/** Send the binds which are waiting, while there are connections for them
+ *
+ * Binds which can't be sent fail.  As they're waiting, the requests which
+ * sent them have yielded, and can be marked as resumable.
+ *
+ * @param[in] t		thread specific data.
+ */
+static void ldap_bind_dispatch(rlm_ldap_thread_t *t)
+{
+	ldap_query_t *retried = NULL;
+
+	while (t->binds_head) {
+		ldap_query_t		*query = t->binds_head;
+		ldap_bind_conn_t	*bconn;
+		int			ret;
+
+		/*
+		 *	Wait for a connection to become free, unless
+		 *	there aren't any.
+		 */
+		bconn = ldap_bind_conn_get(t);
+		if (!bconn) {
+			if (t->binds_open) return;
+
+			ldap_bind_unqueue(t, query);
+			query->status = LDAP_PROC_ERROR;
+			query->error = "No connection available for binds";
+			ldap_query_resume(query, false);
+			continue;
+		}
+
+		ret = ldap_bind_send(bconn, query);
+		if (ret == LDAP_SUCCESS) {
+			ldap_bind_unqueue(t, query);
+			continue;
+		}
+
+		/*
+		 *	If the server closed the connection while it
+		 *	was idle, we'll only find out now.  Try once
+		 *	more on a new one.
+		 */
+		ldap_bind_conn_close(bconn, ldap_err2string(ret));
+		if ((ret == LDAP_SERVER_DOWN) && (retried != query)) {
+			retried = query;
+			continue;
+		}
+
+		ldap_bind_unqueue(t, query);
+		query->status = LDAP_PROC_ERROR;
+		query->error = ldap_err2string(ret);
+		ldap_query_resume(query, false);
+	}
+}
+
+/** The bind sent on a connection has completed
+ *
+ * @param[in] el	fd was registered with.
+ * @param[in] fd	of the connection.
+ * @param[in] ctx	The ldap_bind_conn_t the fd belongs to.
+ */
+static void _ldap_bind_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	ldap_bind_conn_t	*bconn = ctx;
+	rlm_ldap_thread_t	*t = bconn->thread;
+	rlm_ldap_t const	*inst = t->inst;
+	ldap_query_t		*query = bconn->query;
+	struct timeval		poll = { 0, 0 };
+	LDAPMessage		*msg = NULL;
+	int			type;
+
+	type = ldap_result(bconn->conn->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &poll, &msg);
+	if (type == 0) return;
+
+	if (type < 0) {
+		int ldap_errno;
+
+		ldap_get_option(bconn->conn->handle, LDAP_OPT_ERROR_NUMBER, &ldap_errno);
+		ldap_bind_conn_close(bconn, ldap_err2string(ldap_errno));
+		ldap_bind_dispatch(t);
+		return;
+	}
+
+	/*
+	 *	Nothing but binds is sent on the connection, and
+	 *	only one at a time.
+	 */
+	if (!query || (type != LDAP_RES_BIND) || (ldap_msgid(msg) != query->msgid)) {
+		ldap_msgfree(msg);
+		return;
+	}
+
+	query->status = rlm_ldap_result_status(inst, bconn->conn, LDAP_SUCCESS, query->dn, &msg, true,
+					       &query->error, &query->extra);
+	if (query->extra) talloc_steal(query, query->extra);
+
+	bconn->query = NULL;
+	query->bind_conn = NULL;
+
+	ldap_query_resume(query, false);
+
+	ldap_bind_dispatch(t);
+}
+
+/** A connection used for binds errored
+ *
+ * @param[in] el	fd was registered with.
+ * @param[in] fd	of the connection.
+ * @param[in] ctx	The ldap_bind_conn_t the fd belongs to.
+ */
+static void _ldap_bind_errored(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	ldap_bind_conn_t *bconn = ctx;
+	rlm_ldap_thread_t *t = bconn->thread;
+
+	ldap_bind_conn_close(bconn, "Connection failed");
+	ldap_bind_dispatch(t);
+}
+
+/** Add a bind to the list of those waiting for a connection
+ *
+ */
+static void ldap_bind_enqueue(rlm_ldap_thread_t *t, ldap_query_t *query)
+{
+	query->next = NULL;
+	if (t->binds_tail) {
+		t->binds_tail->next = query;
+	} else {
+		t->binds_head = query;
+	}
+	t->binds_tail = query;
+}
+
+/** Stop waiting for a bind
+ *
+ * A bind can't be abandoned, so if it's been sent, the connection it was
+ * sent on is closed.
+ *
+ * @param[in] query	the bind.
+ * @param[in] reason	to log when closing the connection.
+ */
+static void ldap_bind_stop(ldap_query_t *query, char const *reason)
+{
+	rlm_ldap_thread_t	*t = query->thread;
+	ldap_bind_conn_t	*bconn = query->bind_conn;
+
+	if (!t) return;
+
+	if (!bconn) {
+		ldap_bind_unqueue(t, query);
+		return;
+	}
+
+	bconn->query = NULL;
+	query->bind_conn = NULL;
+
+	ldap_bind_conn_close(bconn, reason);
+	ldap_bind_dispatch(t);
+}
+
+/** Bind as the user whose object a search found
+ *
+ * Called instead of resuming the request, when the search was sent by
+ * #rlm_ldap_find_user_bind_async.
+ *
+ * @param[in] t		thread specific data.
+ * @param[in] query	whose search found the user object.
+ */
+static void ldap_query_bind_found(rlm_ldap_thread_t *t, ldap_query_t *query)
+{
+	char *dn;
+
+	dn = ldap_get_dn(t->conn->handle, query->entry);
+	if (!dn) {
+		int ldap_errno;
+
+		ldap_get_option(t->conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		query->status = LDAP_PROC_ERROR;
+		query->error = ldap_err2string(ldap_errno);
+		ldap_query_resume(query, false);
+		return;
+	}
+	rlm_ldap_normalise_dn(dn, dn);
+
+	rbtree_deletebydata(t->queries, query);
+
+	ldap_msgfree(query->entry);
+	query->entry = NULL;
+
+	talloc_const_free(query->dn);
+	query->dn = talloc_typed_strdup(query, dn);
+	ldap_memfree(dn);
+
+	query->is_bind = true;
+	ldap_bind_enqueue(t, query);
+	ldap_bind_dispatch(t);
+}
+
+/** Read any results which have arrived, and wake up the requests waiting for them
+ *
+ * @param[in] el	fd was registered with.
+ * @param[in] fd	of the thread's connection.
+ * @param[in] ctx	The rlm_ldap_thread_t specific to this thread.
+ */
+static void _ldap_async_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	rlm_ldap_thread_t	*t = ctx;
+	rlm_ldap_t const	*inst = t->inst;
+	struct timeval		poll = { 0, 0 };
+
+	/*
+	 *	libldap buffers anything it has read from the socket
+	 *	but not yet returned, so keep going until it says
+	 *	there's nothing left.  Otherwise we may not be called
+	 *	again.
+	 */
+	while (t->conn) {
+		LDAPMessage	*msg = NULL;
+		ldap_query_t	find, *query;
+		int		type;
+
+		type = ldap_result(t->conn->handle, LDAP_RES_ANY, LDAP_MSG_ONE, &poll, &msg);
+		if (type == 0) return;
+
+		if (type < 0) {
+			int ldap_errno;
+
+			ldap_get_option(t->conn->handle, LDAP_OPT_ERROR_NUMBER, &ldap_errno);
+			ldap_async_disconnect(t, ldap_err2string(ldap_errno));
+			return;
+		}
+
+		find.msgid = ldap_msgid(msg);
+		query = rbtree_finddata(t->queries, &find);
+		if (!query || query->done) {
+			ldap_msgfree(msg);
+			continue;
+		}
+
+		switch (type) {
+		/*
+		 *	We only need the first entry.  Callers which
+		 *	want a single object check the count.
+		 */
+		case LDAP_RES_SEARCH_ENTRY:
+			if (!query->entry) {
+				query->entry = msg;
+			} else {
+				ldap_msgfree(msg);
+			}
+			query->count++;
+			continue;
+
+		case LDAP_RES_SEARCH_RESULT:
+			break;
+
+		/*
+		 *	Referrals aren't chased on this connection.
+		 */
+		default:
+			ldap_msgfree(msg);
+			continue;
+		}
+
+		query->status = rlm_ldap_result_status(inst, t->conn, LDAP_SUCCESS, query->dn, &msg, true,
+						       &query->error, &query->extra);
+		if (query->extra) talloc_steal(query, query->extra);
+
+		if ((query->status == LDAP_PROC_SUCCESS) && (query->count == 0)) query->status = LDAP_PROC_NO_RESULT;
+
+		if ((query->status != LDAP_PROC_SUCCESS) && query->entry) {
+			ldap_msgfree(query->entry);
+			query->entry = NULL;
+		}
+
+		/*
+		 *	Only bind if the user object is the one
+		 *	rlm_ldap_find_user_async_result would pick.
+		 */
+		if (query->password && (query->status == LDAP_PROC_SUCCESS) &&
+		    (inst->userobj_sort_ctrl || (query->count == 1))) {
+			ldap_query_bind_found(t, query);
+			continue;
+		}
+
+		ldap_query_resume(query, false);
+	}
+}
+
+/** The thread's connection errored
+ *
+ * @param[in] el	fd was registered with.
+ * @param[in] fd	of the thread's connection.
+ * @param[in] ctx	The rlm_ldap_thread_t specific to this thread.
+ */
+static void _ldap_async_errored(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	ldap_async_disconnect(ctx, "Connection failed");
+}
+
+/** Open the thread's connection, and start watching it
+ *
+ * @param[in] t		thread specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ldap_async_connect(rlm_ldap_thread_t *t)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	struct timeval		timeout = { inst->res_timeout, 0 };
+	void			*mutable;
+	int			fd = -1;
+
+	memcpy(&mutable, &inst, sizeof(mutable));
+
+	t->conn = mod_conn_create(t, mutable, &timeout);
+	if (!t->conn) return -1;
+
+	/*
+	 *	libldap chases referrals synchronously, on connections
+	 *	we can't see, so don't let it.
+	 */
+	if (ldap_set_option(t->conn->handle, LDAP_OPT_REFERRALS, LDAP_OPT_OFF) != LDAP_OPT_SUCCESS) {
+		ERROR("Failed disabling referrals for asynchronous searches");
+		goto error;
+	}
+
+	if ((ldap_get_option(t->conn->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) || (fd < 0)) {
+		ERROR("Failed retrieving file descriptor for asynchronous searches");
+		goto error;
+	}
+
+	if (fr_event_fd_insert(t->el, fd, _ldap_async_readable, NULL, _ldap_async_errored, t) < 0) {
+		ERROR("Failed registering file descriptor %i for asynchronous searches: %s", fd, fr_strerror());
+		goto error;
+	}
+	t->fd = fd;
+
+	DEBUG("Opened connection for asynchronous searches (fd %i)", fd);
+
+	return 0;
+
+error:
+	TALLOC_FREE(t->conn);
+
+	return -1;
+}
+
+/** A query took longer than res_timeout
+ *
+ */
+static void _ldap_query_timeout(REQUEST *request, void *instance, UNUSED void *thread, void *ctx,
+				UNUSED struct timeval *fired)
+{
+	rlm_ldap_t const	*inst = instance;
+	ldap_query_t		*query = talloc_get_type_abort(ctx, ldap_query_t);
+
+	trigger_exec(NULL, inst->cs, "modules.ldap.timeout", true, NULL);
+
+	if (query->is_bind) {
+		ldap_bind_stop(query, "Timed out while waiting for bind result");
+	} else if (query->thread) {
+		RDEBUG2("Abandoning search %i", query->msgid);
+		ldap_abandon_ext(query->thread->conn->handle, query->msgid, NULL, NULL);
+	}
+
+	if (query->entry) {
+		ldap_msgfree(query->entry);
+		query->entry = NULL;
+	}
+	query->count = 0;
+
+	query->status = LDAP_PROC_RETRY;
+	query->error = "Timed out while waiting for server to respond";
+
+	ldap_query_resume(query, true);
+}
+
+static int _ldap_query_free(ldap_query_t *query)
+{
+	rlm_ldap_thread_t *t = query->thread;
+
+	if (query->is_bind) {
+		ldap_bind_stop(query, "Bind cancelled");
+	} else if (t) {
+		if (!query->done && t->conn) ldap_abandon_ext(t->conn->handle, query->msgid, NULL, NULL);
+
+		rbtree_deletebydata(t->queries, query);
+	}
+
+	if (query->entry) ldap_msgfree(query->entry);
+
+	return 0;
+}
+
+/** Send a search on the thread's connection
+ *
+ * The caller should yield after this returns.  The request is marked as
+ * resumable when the search completes, fails, or takes longer than
+ * res_timeout.  The outcome is then in query->status.
+ *
+ * @note Must be called from a module method, as it sets a timeout for the request.
+ *
+ * @param[in] ctx		to allocate the query in.  Freeing the query abandons the search.
+ * @param[in] t			thread specific data.
+ * @param[in] request		Current request.
+ * @param[in] dn		to use as base for the search.
+ * @param[in] scope		to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter		to use, should be pre-escaped.
+ * @param[in] attrs		to retrieve.
+ * @param[in] serverctrls	Search controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Search controls for ldap_search.  May be NULL.
+ * @return
+ *	- The query.
+ *	- NULL if the search could not be sent.
+ */
+ldap_query_t *rlm_ldap_search_async(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				    char const *dn, int scope, char const *filter, char const * const *attrs,
+				    LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	ldap_query_t		*query;
+	struct timeval		tv, now, when;
+	int			ret = LDAP_SERVER_DOWN;
+	int			msgid = -1;
+	int			i;
+
+	LDAPControl		*our_serverctrls[LDAP_MAX_CONTROLS];
+	LDAPControl		*our_clientctrls[LDAP_MAX_CONTROLS];
+
+	/*
+	 *	OpenLDAP library doesn't declare attrs array as const, but
+	 *	it really should be *sigh*.
+	 */
+	char **search_attrs;
+	memcpy(&search_attrs, &attrs, sizeof(attrs));
+
+	if (filter) {
+		RDEBUG("Performing search in \"%s\" with filter \"%s\", scope \"%s\"", dn, filter,
+		       fr_int2str(ldap_scope, scope, "<INVALID>"));
+	} else {
+		RDEBUG("Performing unfiltered search in \"%s\", scope \"%s\"", dn,
+		       fr_int2str(ldap_scope, scope, "<INVALID>"));
+	}
+
+	tv.tv_sec = inst->res_timeout;
+	tv.tv_usec = 0;
+
+	/*
+	 *	If the server closed the connection while it was
+	 *	idle, we'll only find out now.  Try once more on a
+	 *	new one.
+	 */
+	for (i = 0; i < 2; i++) {
+		if (!t->conn && (ldap_async_connect(t) < 0)) {
+			REDEBUG("No connection available for asynchronous searches");
+			return NULL;
+		}
+
+		rlm_ldap_control_merge(our_serverctrls, our_clientctrls,
+				       sizeof(our_serverctrls) / sizeof(*our_serverctrls),
+				       sizeof(our_clientctrls) / sizeof(*our_clientctrls),
+				       t->conn, serverctrls, clientctrls);
+
+		ret = ldap_search_ext(t->conn->handle, dn, scope, filter, search_attrs,
+				      0, our_serverctrls, our_clientctrls, &tv, 0, &msgid);
+		if (ret != LDAP_SERVER_DOWN) break;
+
+		RWDEBUG("Search failed: %s.  Reconnecting...", ldap_err2string(ret));
+		ldap_async_disconnect(t, ldap_err2string(ret));
+	}
+
+	if (ret != LDAP_SUCCESS) {
+		REDEBUG("Failed sending search: %s", ldap_err2string(ret));
+		return NULL;
+	}
+
+	MEM(query = talloc_zero(ctx, ldap_query_t));
+	query->thread = t;
+	query->request = request;
+	query->msgid = msgid;
+	query->dn = talloc_typed_strdup(query, dn);
+
+	if (!rbtree_insert(t->queries, query)) {
+		REDEBUG("Failed tracking search %i", msgid);
+		ldap_abandon_ext(t->conn->handle, msgid, NULL, NULL);
+		talloc_free(query);
+		return NULL;
+	}
+	talloc_set_destructor(query, _ldap_query_free);
+
+	gettimeofday(&now, NULL);
+	fr_timeval_add(&when, &now, &tv);
+
+	if (unlang_event_timeout_add(request, _ldap_query_timeout, query, &when) < 0) {
+		REDEBUG("Failed setting timeout for search");
+		talloc_free(query);
+		return NULL;
+	}
+
+	RDEBUG("Waiting for search result...");
+
+	return query;
+}
+
+/** Send a simple bind on one of the thread's connections for binds
+ *
+ * The caller should yield after this returns.  The request is marked as
+ * resumable when the bind completes, fails, or takes longer than
+ * res_timeout.  The outcome is then in query->status.
+ *
+ * If all the connections are busy, and no more can be opened, the bind is
+ * sent when one becomes free.
+ *
+ * @note Must be called from a module method, as it sets a timeout for the request.
+ *
+ * @param[in] ctx		to allocate the query in.  Freeing the query stops waiting for the bind.
+ * @param[in] t			thread specific data.
+ * @param[in] request		Current request.
+ * @param[in] dn		to bind as.
+ * @param[in] password		to bind with.  Must be talloced, and outlive the query.
+ * @return
+ *	- The query.
+ *	- NULL if the bind could not be sent.
+ */
+ldap_query_t *rlm_ldap_bind_async(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				  char const *dn, char const *password)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	ldap_query_t		*query;
+	ldap_bind_conn_t	*bconn;
+	struct timeval		tv, now, when;
+	int			ret = LDAP_SERVER_DOWN;
+	int			i;
+
+	MEM(query = talloc_zero(ctx, ldap_query_t));
+	query->thread = t;
+	query->request = request;
+	query->msgid = -1;
+	query->dn = talloc_typed_strdup(query, dn);
+	query->is_bind = true;
+	query->password = password;
+	talloc_set_destructor(query, _ldap_query_free);
+
+	/*
+	 *	Binds which are already waiting go first.
+	 */
+	if (t->binds_head) {
+		RDEBUG("Waiting for a connection to bind as \"%s\"...", dn);
+		ldap_bind_enqueue(t, query);
+		goto wait;
+	}
+
+	/*
+	 *	As with searches, try once more on a new connection
+	 *	if the server closed an idle one.
+	 */
+	for (i = 0; i < 2; i++) {
+		bconn = ldap_bind_conn_get(t);
+		if (!bconn) {
+			if (!t->binds_open) {
+				REDEBUG("No connection available for binds");
+				talloc_free(query);
+				return NULL;
+			}
+
+			RDEBUG("Waiting for a connection to bind as \"%s\"...", dn);
+			ldap_bind_enqueue(t, query);
+			goto wait;
+		}
+
+		ret = ldap_bind_send(bconn, query);
+		if (ret != LDAP_SERVER_DOWN) break;
+
+		RWDEBUG("Bind failed: %s.  Reconnecting...", ldap_err2string(ret));
+		ldap_bind_conn_close(bconn, ldap_err2string(ret));
+	}
+
+	if (ret != LDAP_SUCCESS) {
+		REDEBUG("Failed sending bind: %s", ldap_err2string(ret));
+		talloc_free(query);
+		return NULL;
+	}
+
+	RDEBUG("Waiting for bind result...");
+
+wait:
+	tv.tv_sec = inst->res_timeout;
+	tv.tv_usec = 0;
+
+	gettimeofday(&now, NULL);
+	fr_timeval_add(&when, &now, &tv);
+
+	if (unlang_event_timeout_add(request, _ldap_query_timeout, query, &when) < 0) {
+		REDEBUG("Failed setting timeout for bind");
+		talloc_free(query);
+		return NULL;
+	}
+
+	return query;
+}
+
+/** Stop waiting for a query
+ *
+ * Abandons the search, if it's still outstanding.  The request waiting for it
+ * will not be marked as resumable.
+ *
+ * @param[in] query	to cancel.
+ */
+void rlm_ldap_query_cancel(ldap_query_t *query)
+{
+	if (query->done) return;
+
+	query->done = true;
+
+	(void) unlang_event_timeout_delete(query->request, query);
+
+	if (query->is_bind) {
+		ldap_bind_stop(query, "Bind cancelled");
+	} else if (query->thread && query->thread->conn) {
+		ldap_abandon_ext(query->thread->conn->handle, query->msgid, NULL, NULL);
+	}
+}
+
+/** Set up asynchronous searches for a thread
+ *
+ * @param[in] t		thread specific data.  inst and el must be set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_ldap_async_init(rlm_ldap_thread_t *t)
+{
+	rlm_ldap_t const *inst = t->inst;
+
+	rad_assert(t->inst && t->el);
+
+	t->fd = -1;
+	t->queries = rbtree_create(t, ldap_query_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!t->queries) {
+		ERROR("Failed creating search tree");
+		return -1;
+	}
+
+	/*
+	 *	As with a pool which starts with no connections, this
+	 *	isn't fatal.  We'll try again on the first search.
+	 */
+	if (ldap_async_connect(t) < 0) WARN("Failed opening connection for asynchronous searches");
+
+	return 0;
+}
+
+/** Close the thread's connection
+ *
+ * Requests can't be resumed after this, so any queries still outstanding are
+ * just forgotten.
+ *
+ * @param[in] t		thread specific data.
+ */
+void rlm_ldap_async_free(rlm_ldap_thread_t *t)
+{
+	while (t->binds_head) {
+		ldap_query_t *query = t->binds_head;
+
+		t->binds_head = query->next;
+		query->next = NULL;
+		query->thread = NULL;
+	}
+	t->binds_tail = NULL;
+
+	while (t->binds) {
+		ldap_query_t *query = t->binds->query;
+
+		if (query) {
+			query->bind_conn = NULL;
+			query->thread = NULL;
+			t->binds->query = NULL;
+		}
+		ldap_bind_conn_close(t->binds, "Thread exiting");
+	}
+
+	if (!t->queries) return;
+
+	rbtree_walk(t->queries, RBTREE_DELETE_ORDER, _ldap_query_unlink, NULL);
+	TALLOC_FREE(t->queries);
+
+	if (t->conn) {
+		(void) fr_event_fd_delete(t->el, t->fd);
+		TALLOC_FREE(t->conn);
+		t->fd = -1;
+	}
+}
@@ -550,38 +550,33 @@ char const *rlm_ldap_error_str(ldap_handle_t const *conn)
 	return ldap_err2string(lib_errno);
 }
 
-/** Parse response from LDAP server dealing with any errors
+/** Convert the outcome of an LDAP operation into one of our status codes
  *
- * Should be called after an LDAP operation. Will check result of operation
- * and if it was successful, then attempt to retrieve and parse the result.
+ * If the operation itself succeeded, the result message is parsed for
+ * any error the server sent.
  *
  * Will also produce extended error output including any messages the server
  * sent, and information about partial DN matches.
  *
  * @param[in] inst	of LDAP module.
- * @param[in] conn	Current connection.
- * @param[in] msgid	returned from last operation. May be -1 if no result
- *			processing is required.
+ * @param[in] conn	the operation was performed on.
+ * @param[in] lib_errno	returned by the library when sending the operation, or
+ *			waiting for its result.
  * @param[in] dn	Last search or bind DN.
- * @param[in] timeout	Override the default result timeout.
- * @param[out] result	Where to write result, if NULL result will be freed.
- * @param[out] error	Where to write the error string, may be NULL, must
- *			not be freed.
+ * @param[in,out] result to parse.  Freed, and set to NULL, if freeit is true
+ *			or the operation failed.
+ * @param[in] freeit	Whether the result should be freed after being parsed.
+ * @param[out] error	Where to write the error string, must not be freed.
  * @param[out] extra	Where to write additional error string to, may be NULL
  *			(faster) or must be freed (with talloc_free).
  * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
  */
-ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst,
-			     ldap_handle_t const *conn,
-			     int msgid,
-			     char const *dn,
-			     struct timeval const *timeout,
-			     LDAPMessage **result,
-			     char const **error, char **extra)
+ldap_rcode_t rlm_ldap_result_status(rlm_ldap_t const *inst, ldap_handle_t const *conn, int lib_errno,
+				    char const *dn, LDAPMessage **result, bool freeit,
+				    char const **error, char **extra)
 {
 	ldap_rcode_t status = LDAP_PROC_SUCCESS;
 
-	int lib_errno = LDAP_SUCCESS;	// errno returned by the library.
 	int srv_errno = LDAP_SUCCESS;	// errno in the result message.
 
 	char *part_dn = NULL;		// Partial DN match.
@@ -589,59 +584,12 @@ ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst,
 	char *srv_err = NULL;		// Server's extended error message.
 	char *p, *a;
 
-	bool freeit = false;		// Whether the message should be freed after being processed.
 	int len;
 
-	struct timeval tv;		// Holds timeout values.
-
-	LDAPMessage *tmp_msg = NULL;	// Temporary message pointer storage if we weren't provided with one.
-
-	char const *tmp_err;		// Temporary error pointer storage if we weren't provided with one.
-
-	if (!error) error = &tmp_err;
 	*error = NULL;
-
 	if (extra) *extra = NULL;
-	if (result) *result = NULL;
 
-	/*
-	 *	We always need the result, but our caller may not
-	 */
-	if (!result) {
-		result = &tmp_msg;
-		freeit = true;
-	}
-
-	/*
-	 *	Check if there was an error sending the request
-	 */
-	ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
 	if (lib_errno != LDAP_SUCCESS) goto process_error;
-	if (msgid < 0) return LDAP_SUCCESS;	/* No msgid and no error, return now */
-
-	if (!timeout) {
-		tv.tv_sec = inst->res_timeout;
-		tv.tv_usec = 0;
-	} else {
-		tv = *timeout;
-	}
-
-	/*
-	 *	Now retrieve the result and check for errors
-	 *	ldap_result returns -1 on failure, and 0 on timeout
-	 */
-	lib_errno = ldap_result(conn->handle, msgid, 1, &tv, result);
-	if (lib_errno == 0) {
-		lib_errno = LDAP_TIMEOUT;
-
-		goto process_error;
-	}
-
-	if (lib_errno == -1) {
-		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
-
-		goto process_error;
-	}
 
 	/*
 	 *	Parse the result and check for errors sent by the server
@@ -798,6 +746,90 @@ process_error:
 	return status;
 }
 
+/** Parse response from LDAP server dealing with any errors
+ *
+ * Should be called after an LDAP operation. Will check result of operation
+ * and if it was successful, then attempt to retrieve and parse the result.
+ *
+ * Will also produce extended error output including any messages the server
+ * sent, and information about partial DN matches.
+ *
+ * @param[in] inst	of LDAP module.
+ * @param[in] conn	Current connection.
+ * @param[in] msgid	returned from last operation. May be -1 if no result
+ *			processing is required.
+ * @param[in] dn	Last search or bind DN.
+ * @param[in] timeout	Override the default result timeout.
+ * @param[out] result	Where to write result, if NULL result will be freed.
+ * @param[out] error	Where to write the error string, may be NULL, must
+ *			not be freed.
+ * @param[out] extra	Where to write additional error string to, may be NULL
+ *			(faster) or must be freed (with talloc_free).
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst,
+			     ldap_handle_t const *conn,
+			     int msgid,
+			     char const *dn,
+			     struct timeval const *timeout,
+			     LDAPMessage **result,
+			     char const **error, char **extra)
+{
+	int lib_errno = LDAP_SUCCESS;	// errno returned by the library.
+
+	bool freeit = false;		// Whether the message should be freed after being processed.
+
+	struct timeval tv;		// Holds timeout values.
+
+	LDAPMessage *tmp_msg = NULL;	// Temporary message pointer storage if we weren't provided with one.
+
+	char const *tmp_err;		// Temporary error pointer storage if we weren't provided with one.
+
+	if (!error) error = &tmp_err;
+	*error = NULL;
+
+	if (extra) *extra = NULL;
+	if (result) *result = NULL;
+
+	/*
+	 *	We always need the result, but our caller may not
+	 */
+	if (!result) {
+		result = &tmp_msg;
+		freeit = true;
+	}
+
+	/*
+	 *	Check if there was an error sending the request
+	 */
+	ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+	if (lib_errno != LDAP_SUCCESS) goto finish;
+	if (msgid < 0) return LDAP_SUCCESS;	/* No msgid and no error, return now */
+
+	if (!timeout) {
+		tv.tv_sec = inst->res_timeout;
+		tv.tv_usec = 0;
+	} else {
+		tv = *timeout;
+	}
+
+	/*
+	 *	Now retrieve the result and check for errors
+	 *	ldap_result returns -1 on failure, and 0 on timeout
+	 */
+	lib_errno = ldap_result(conn->handle, msgid, 1, &tv, result);
+	if (lib_errno == 0) {
+		lib_errno = LDAP_TIMEOUT;
+	} else if (lib_errno == -1) {
+		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+	} else {
+		lib_errno = LDAP_SUCCESS;
+	}
+
+finish:
+	return rlm_ldap_result_status(inst, conn, lib_errno, dn, result, freeit, error, extra);
+}
+
 /** Bind to the LDAP directory as a user
  *
  * Performs a simple bind to the LDAP directory, and handles any errors that occur.
@@ -1249,6 +1281,79 @@ finish:
 	return status;
 }
 
+/** Expand the filter and base DN used to find user objects
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[out] filter Where to write the filter, NULL if there isn't one.
+ * @param[in] filter_buff of LDAP_MAX_FILTER_STR_LEN bytes, to expand the filter into.
+ * @param[out] base_dn Where to write the base DN.
+ * @param[in] base_dn_buff of LDAP_MAX_DN_STR_LEN bytes, to expand the base DN into.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rlm_ldap_user_search_args(rlm_ldap_t const *inst, REQUEST *request,
+				     char const **filter, char *filter_buff,
+				     char const **base_dn, char *base_dn_buff)
+{
+	*filter = NULL;
+
+	if (inst->userobj_filter) {
+		if (tmpl_expand(filter, filter_buff, LDAP_MAX_FILTER_STR_LEN, request, inst->userobj_filter,
+				rlm_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			return -1;
+		}
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, LDAP_MAX_DN_STR_LEN, request,
+			inst->userobj_base_dn, rlm_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Add the DN of a user object to the control list as LDAP-UserDN
+ *
+ * @param[in] request Current request.
+ * @param[in] handle the entry was retrieved with.
+ * @param[in] entry the user object.
+ * @return The user's DN or NULL on error.
+ */
+static char const *rlm_ldap_user_dn_add(REQUEST *request, LDAP *handle, LDAPMessage *entry)
+{
+	VALUE_PAIR	*vp;
+	char		*dn;
+	int		ldap_errno;
+
+	dn = ldap_get_dn(handle, entry);
+	if (!dn) {
+		ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+		return NULL;
+	}
+	rlm_ldap_normalise_dn(dn, dn);
+
+	/*
+	 *	We can't use fr_pair_make here to copy the value into the
+	 *	attribute, as the dn must be copied into the attribute
+	 *	verbatim (without de-escaping).
+	 *
+	 *	Special chars are pre-escaped by libldap, and because
+	 *	we pass the string back to libldap we must not alter it.
+	 */
+	RDEBUG("User object found at DN \"%s\"", dn);
+	vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
+	if (vp) fr_pair_value_strcpy(vp, dn);
+	ldap_memfree(dn);
+
+	return vp ? vp->vp_strvalue : NULL;
+}
+
 /** Retrieve the DN of a user object
  *
  * Retrieves the DN of a user and adds it to the control list as LDAP-UserDN. Will also retrieve any
@@ -1278,6 +1383,7 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_ha
 	int		ldap_errno;
 	int		cnt;
 	char		*dn = NULL;
+	char const	*user_dn = NULL;
 	char const	*filter = NULL;
 	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
 	char const	*base_dn;
@@ -1328,19 +1434,7 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_ha
 		(*pconn)->rebound = false;
 	}
 
-	if (inst->userobj_filter) {
-		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
-				rlm_ldap_escape_func, NULL) < 0) {
-			REDEBUG("Unable to create filter");
-			*rcode = RLM_MODULE_INVALID;
-
-			return NULL;
-		}
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->userobj_base_dn, rlm_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Unable to create base_dn");
+	if (rlm_ldap_user_search_args(inst, request, &filter, filter_buff, &base_dn, base_dn_buff) < 0) {
 		*rcode = RLM_MODULE_INVALID;
 
 		return NULL;
@@ -1398,38 +1492,151 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_ha
 		goto finish;
 	}
 
-	dn = ldap_get_dn((*pconn)->handle, entry);
-	if (!dn) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+	user_dn = rlm_ldap_user_dn_add(request, (*pconn)->handle, entry);
+	if (user_dn) *rcode = RLM_MODULE_OK;
 
-		goto finish;
+finish:
+	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
+		ldap_msgfree(*result);
+		*result = NULL;
+	}
+
+	return user_dn;
+}
+
+/** Start an asynchronous search for a user object
+ *
+ * The asynchronous version of #rlm_ldap_find_user.  The search is sent on the
+ * thread's shared connection, and the caller should yield until the request is
+ * resumed, then call #rlm_ldap_find_user_async_result.
+ *
+ * @param[in] ctx to allocate the query in.
+ * @param[in] t thread specific data.
+ * @param[in] request Current request.
+ * @param[in] attrs Additional attributes to retrieve, may be NULL.
+ * @param[out] rcode The status of the operation, if the search could not be sent.
+ * @return The query, or NULL on error.
+ */
+ldap_query_t *rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				       char const *attrs[], rlm_rcode_t *rcode)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	char const		*filter = NULL;
+	char			filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const		*base_dn;
+	char			base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	LDAPControl		*serverctrls[] = { inst->userobj_sort_ctrl, NULL };
+	ldap_query_t		*query;
+
+	if (rlm_ldap_user_search_args(inst, request, &filter, filter_buff, &base_dn, base_dn_buff) < 0) {
+		*rcode = RLM_MODULE_INVALID;
+
+		return NULL;
+	}
+
+	query = rlm_ldap_search_async(ctx, t, request, base_dn, inst->userobj_scope, filter, attrs, serverctrls, NULL);
+	if (!query) {
+		*rcode = RLM_MODULE_FAIL;
+
+		return NULL;
+	}
+
+	*rcode = RLM_MODULE_OK;
+
+	return query;
+}
+
+/** Search for a user object, and bind as it, without blocking the thread
+ *
+ * Sends the same search as #rlm_ldap_find_user_async.  When it completes,
+ * a simple bind as the user object is sent, and the request is only marked
+ * as resumable when the bind completes.  If the search fails, no bind is
+ * sent, and query->is_bind is false.  Otherwise query->dn is the DN of the
+ * user object.
+ *
+ * @param[in] ctx to allocate the query in.
+ * @param[in] t thread specific data.
+ * @param[in] request Current request.
+ * @param[in] password to bind with.  Must be talloced, and outlive the query.
+ * @param[out] rcode The status of the operation, if the search could not be sent.
+ * @return The query, or NULL on error.
+ */
+ldap_query_t *rlm_ldap_find_user_bind_async(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+					    char const *password, rlm_rcode_t *rcode)
+{
+	static char const	*attrs[] = { LDAP_NO_ATTRS, NULL };
+	ldap_query_t		*query;
+
+	query = rlm_ldap_find_user_async(ctx, t, request, attrs, rcode);
+	if (!query) return NULL;
+
+	query->password = password;
+
+	return query;
+}
+
+/** Retrieve the DN of a user object from a completed asynchronous search
+ *
+ * Adds the DN to the control list as LDAP-UserDN, as #rlm_ldap_find_user does.
+ *
+ * @param[in] t thread specific data.
+ * @param[in] request Current request.
+ * @param[in] query returned by #rlm_ldap_find_user_async.
+ * @param[out] entry Where to write the user object.  Remains owned by the query.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+char const *rlm_ldap_find_user_async_result(rlm_ldap_thread_t *t, REQUEST *request, ldap_query_t *query,
+					    LDAPMessage **entry, rlm_rcode_t *rcode)
+{
+	rlm_ldap_t const	*inst = t->inst;
+	char const		*user_dn;
+
+	*entry = NULL;
+
+	switch (query->status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_BAD_DN:
+		RDEBUG("%s", query->error);
+		if (query->extra) RDEBUG("%s", query->extra);
+		*rcode = RLM_MODULE_NOTFOUND;
+		return NULL;
+
+	case LDAP_PROC_NO_RESULT:
+		RDEBUG("Search returned no results");
+		*rcode = RLM_MODULE_NOTFOUND;
+		return NULL;
+
+	default:
+		REDEBUG("Failed performing search: %s", query->error);
+		if (query->extra) REDEBUG("%s", query->extra);
+		*rcode = RLM_MODULE_FAIL;
+		return NULL;
 	}
-	rlm_ldap_normalise_dn(dn, dn);
 
 	/*
-	 *	We can't use fr_pair_make here to copy the value into the
-	 *	attribute, as the dn must be copied into the attribute
-	 *	verbatim (without de-escaping).
-	 *
-	 *	Special chars are pre-escaped by libldap, and because
-	 *	we pass the string back to libldap we must not alter it.
+	 *	Same rule as rlm_ldap_find_user.  We only keep
+	 *	the first entry, so can't list the others.
 	 */
-	RDEBUG("User object found at DN \"%s\"", dn);
-	vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
-	if (vp) {
-		fr_pair_value_strcpy(vp, dn);
-		*rcode = RLM_MODULE_OK;
+	if (!inst->userobj_sort_ctrl && (query->count > 1)) {
+		REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
+			"Enable sorting, or specify a more restrictive base_dn, filter or scope", query->count);
+		*rcode = RLM_MODULE_INVALID;
+		return NULL;
 	}
-	ldap_memfree(dn);
 
-finish:
-	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
-		ldap_msgfree(*result);
-		*result = NULL;
+	user_dn = rlm_ldap_user_dn_add(request, t->conn->handle, query->entry);
+	if (!user_dn) {
+		*rcode = RLM_MODULE_FAIL;
+		return NULL;
 	}
 
-	return vp ? vp->vp_strvalue : NULL;
+	*entry = query->entry;
+	*rcode = RLM_MODULE_OK;
+
+	return user_dn;
 }
 
 /** Check for presence of access attribute in result
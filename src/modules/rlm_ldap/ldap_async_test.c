@@ -0,0 +1,1105 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ldap_async_test.c
+ * @brief Test asynchronous searches and binds against a slow, fake directory.
+ *
+ * The directory runs in a thread of its own, and answers every search and
+ * bind after a delay (20ms by default), so that many are outstanding at
+ * once.  It understands just enough LDAP for async.c:
+ *
+ *  - The first bind on a connection is the admin bind from mod_conn_create,
+ *    and is answered immediately.
+ *  - Binds with the password "bad" are rejected, and binds with the
+ *    password "hang" are never answered.
+ *  - Searches return one entry, "uid=user<msgid>,ou=people,dc=example,dc=com",
+ *    so we can tell which search a result was sent for.  Searches under
+ *    "ou=hang,dc=example,dc=com" are never answered.
+ *  - Abandon requests are counted.
+ *
+ * We play the part of a worker thread, with an event list, and the timeouts
+ * and resumption which the interpreter provides for module methods.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_ldap.h"
+
+#include <pthread.h>
+#include <poll.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define FAKE_MAX_CONNS		64
+#define FAKE_MAX_REPLIES	4096
+#define FAKE_BASE		"dc=example,dc=com"
+#define FAKE_HANG_BASE		"ou=hang," FAKE_BASE
+
+/** A connection to the fake directory
+ *
+ */
+typedef struct fake_conn {
+	int			fd;			//!< -1 if the slot is free.
+	uint64_t		id;			//!< So replies aren't sent to a reused slot.
+	bool			bound;			//!< Whether the admin bind has been seen.
+	uint8_t			buff[8192];		//!< Partially read messages.
+	size_t			used;			//!< Bytes in buff.
+} fake_conn_t;
+
+/** A reply waiting to be sent
+ *
+ */
+typedef struct fake_reply {
+	struct timeval		when;			//!< When to send it.
+	uint64_t		conn_id;		//!< Connection to send it on.
+	uint8_t			data[256];
+	size_t			len;			//!< 0 if the slot is free.
+} fake_reply_t;
+
+/** What the fake directory has seen
+ *
+ */
+typedef struct fake_stats {
+	int			open;			//!< Connections open now.
+	int			opened;			//!< Connections ever opened.
+	int			searches;		//!< Searches received.
+	int			max_outstanding;	//!< Most searches waiting for replies on one connection.
+	int			abandons;		//!< Abandon requests received.
+	int			last_abandoned;		//!< msgid of the last abandoned operation.
+} fake_stats_t;
+
+/** The fake directory
+ *
+ * stats are protected by mutex, everything else is private to the
+ * directory's thread.
+ */
+typedef struct fake_dir {
+	int			sockfd;			//!< Listening socket.
+	uint16_t		port;			//!< Bound to on 127.0.0.1.
+	struct timeval		delay;			//!< Before answering searches and binds.
+
+	fake_conn_t		conns[FAKE_MAX_CONNS];
+	uint64_t		next_id;
+	fake_reply_t		replies[FAKE_MAX_REPLIES];
+
+	pthread_mutex_t		mutex;
+	fake_stats_t		stats;
+} fake_dir_t;
+
+static fake_dir_t	dir;
+
+static size_t ber_len(uint8_t const *p, size_t avail, size_t *len)
+{
+	size_t i, n;
+
+	if (avail < 1) return 0;
+	if (!(p[0] & 0x80)) {
+		*len = p[0];
+		return 1;
+	}
+
+	n = p[0] & 0x7f;
+	if ((n == 0) || (n > 4) || (avail < (n + 1))) return 0;
+
+	*len = 0;
+	for (i = 0; i < n; i++) *len = (*len << 8) | p[i + 1];
+
+	return n + 1;
+}
+
+/** Split a BER TLV, returning the bytes it used, or 0 if it's incomplete
+ *
+ */
+static size_t ber_tlv(uint8_t const *p, size_t avail, uint8_t *tag, uint8_t const **value, size_t *len)
+{
+	size_t hdr;
+
+	if (avail < 2) return 0;
+
+	hdr = ber_len(p + 1, avail - 1, len);
+	if (!hdr || ((1 + hdr + *len) > avail)) return 0;
+
+	*tag = p[0];
+	*value = p + 1 + hdr;
+
+	return 1 + hdr + *len;
+}
+
+static int ber_int(uint8_t const *p, size_t len)
+{
+	int	i, out = 0;
+
+	for (i = 0; i < (int)len; i++) out = (out << 8) | p[i];
+
+	return out;
+}
+
+/*
+ *	Everything we send is short enough for single byte lengths.
+ */
+static uint8_t *ber_add(uint8_t *p, uint8_t tag, void const *value, size_t len)
+{
+	rad_assert(len < 0x80);
+
+	*p++ = tag;
+	*p++ = len;
+	memcpy(p, value, len);
+
+	return p + len;
+}
+
+static void fake_queue(fake_conn_t *conn, int msgid, uint8_t op, uint8_t const *body, size_t body_len, bool now)
+{
+	fake_reply_t	*reply = NULL;
+	uint8_t		id[4], op_buff[200], *p;
+	size_t		id_len = 0;
+	int		i;
+
+	for (i = 0; i < FAKE_MAX_REPLIES; i++) if (!dir.replies[i].len) {
+		reply = &dir.replies[i];
+		break;
+	}
+	if (!reply) {
+		fprintf(stderr, "fake directory: Too many replies waiting\n");
+		exit(1);
+	}
+
+	/*
+	 *	Minimal two's complement encoding of the msgid.
+	 */
+	if (msgid > 0x7fffff) id[id_len++] = msgid >> 24;
+	if (msgid > 0x7fff) id[id_len++] = msgid >> 16;
+	if (msgid > 0x7f) id[id_len++] = msgid >> 8;
+	id[id_len++] = msgid;
+
+	p = ber_add(op_buff, 0x02, id, id_len);
+	p = ber_add(p, op, body, body_len);
+
+	p = ber_add(reply->data, 0x30, op_buff, p - op_buff);
+	reply->len = p - reply->data;
+	reply->conn_id = conn->id;
+
+	gettimeofday(&reply->when, NULL);
+	if (!now) fr_timeval_add(&reply->when, &reply->when, &dir.delay);
+}
+
+static void fake_queue_result(fake_conn_t *conn, int msgid, uint8_t op, uint8_t code, bool now)
+{
+	uint8_t		body[16], *p;
+
+	p = ber_add(body, 0x0a, &code, 1);	/* resultCode */
+	p = ber_add(p, 0x04, "", 0);		/* matchedDN */
+	p = ber_add(p, 0x04, "", 0);		/* diagnosticMessage */
+
+	fake_queue(conn, msgid, op, body, p - body, now);
+}
+
+static void fake_search(fake_conn_t *conn, int msgid, uint8_t const *body, size_t len)
+{
+	uint8_t		tag, entry[128], *p;
+	uint8_t const	*base;
+	size_t		base_len;
+	char		dn[64];
+	int		i, outstanding = 0;
+
+	if (!ber_tlv(body, len, &tag, &base, &base_len)) return;
+
+	pthread_mutex_lock(&dir.mutex);
+	dir.stats.searches++;
+	pthread_mutex_unlock(&dir.mutex);
+
+	if ((base_len == strlen(FAKE_HANG_BASE)) && (memcmp(base, FAKE_HANG_BASE, base_len) == 0)) return;
+
+	snprintf(dn, sizeof(dn), "uid=user%i,ou=people," FAKE_BASE, msgid);
+	p = ber_add(entry, 0x04, dn, strlen(dn));
+	p = ber_add(p, 0x30, "", 0);		/* No attributes */
+
+	fake_queue(conn, msgid, 0x64, entry, p - entry, false);
+	fake_queue_result(conn, msgid, 0x65, 0, false);
+
+	for (i = 0; i < FAKE_MAX_REPLIES; i++) {
+		if (dir.replies[i].len && (dir.replies[i].conn_id == conn->id)) outstanding++;
+	}
+
+	pthread_mutex_lock(&dir.mutex);
+	if ((outstanding / 2) > dir.stats.max_outstanding) dir.stats.max_outstanding = outstanding / 2;
+	pthread_mutex_unlock(&dir.mutex);
+}
+
+static void fake_bind(fake_conn_t *conn, int msgid, uint8_t const *body, size_t len)
+{
+	uint8_t		tag;
+	uint8_t const	*value, *password = NULL;
+	size_t		used, value_len, password_len = 0;
+
+	/*
+	 *	version, name, then the simple password.
+	 */
+	while ((used = ber_tlv(body, len, &tag, &value, &value_len)) > 0) {
+		if (tag == 0x80) {
+			password = value;
+			password_len = value_len;
+		}
+		body += used;
+		len -= used;
+	}
+
+	if (!conn->bound) {
+		conn->bound = true;
+		fake_queue_result(conn, msgid, 0x61, 0, true);
+		return;
+	}
+
+	if (password && (password_len == 4) && (memcmp(password, "hang", 4) == 0)) return;
+
+	fake_queue_result(conn, msgid, 0x61,
+			  (password && (password_len == 3) && (memcmp(password, "bad", 3) == 0)) ?
+			  LDAP_INVALID_CREDENTIALS : 0, false);
+}
+
+static void fake_close(fake_conn_t *conn)
+{
+	close(conn->fd);
+	conn->fd = -1;
+
+	pthread_mutex_lock(&dir.mutex);
+	dir.stats.open--;
+	pthread_mutex_unlock(&dir.mutex);
+}
+
+/** Process every complete message the client has sent
+ *
+ */
+static void fake_read(fake_conn_t *conn)
+{
+	ssize_t		slen;
+	size_t		used;
+
+	slen = read(conn->fd, conn->buff + conn->used, sizeof(conn->buff) - conn->used);
+	if (slen <= 0) {
+		fake_close(conn);
+		return;
+	}
+	conn->used += slen;
+
+	for (;;) {
+		uint8_t		tag, op;
+		uint8_t const	*msg, *value, *body;
+		size_t		msg_len, value_len, body_len, id_used;
+		int		msgid;
+
+		used = ber_tlv(conn->buff, conn->used, &tag, &msg, &msg_len);
+		if (!used) break;
+
+		id_used = ber_tlv(msg, msg_len, &tag, &value, &value_len);
+		if (!id_used || (tag != 0x02)) {
+			fake_close(conn);
+			return;
+		}
+		msgid = ber_int(value, value_len);
+
+		if (!ber_tlv(msg + id_used, msg_len - id_used, &op, &body, &body_len)) {
+			fake_close(conn);
+			return;
+		}
+
+		switch (op) {
+		case 0x60:	/* BindRequest */
+			fake_bind(conn, msgid, body, body_len);
+			break;
+
+		case 0x63:	/* SearchRequest */
+			fake_search(conn, msgid, body, body_len);
+			break;
+
+		case 0x50:	/* AbandonRequest */
+			pthread_mutex_lock(&dir.mutex);
+			dir.stats.abandons++;
+			dir.stats.last_abandoned = ber_int(body, body_len);
+			pthread_mutex_unlock(&dir.mutex);
+			break;
+
+		case 0x42:	/* UnbindRequest */
+			fake_close(conn);
+			return;
+
+		default:
+			break;
+		}
+
+		memmove(conn->buff, conn->buff + used, conn->used - used);
+		conn->used -= used;
+	}
+}
+
+static void *fake_dir_thread(UNUSED void *arg)
+{
+	for (;;) {
+		struct pollfd	fds[FAKE_MAX_CONNS + 1];
+		fake_conn_t	*polled[FAKE_MAX_CONNS + 1];
+		struct timeval	now;
+		int		i, num = 0;
+
+		fds[num].fd = dir.sockfd;
+		fds[num].events = POLLIN;
+		polled[num++] = NULL;
+
+		for (i = 0; i < FAKE_MAX_CONNS; i++) {
+			if (dir.conns[i].fd < 0) continue;
+
+			fds[num].fd = dir.conns[i].fd;
+			fds[num].events = POLLIN;
+			polled[num++] = &dir.conns[i];
+		}
+
+		/*
+		 *	Good enough resolution for replies delayed by
+		 *	tens of milliseconds.
+		 */
+		if (poll(fds, num, 1) < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "fake directory: poll failed: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(dir.sockfd, NULL, NULL);
+
+			for (i = 0; (fd >= 0) && (i < FAKE_MAX_CONNS); i++) if (dir.conns[i].fd < 0) {
+				dir.conns[i].fd = fd;
+				dir.conns[i].id = ++dir.next_id;
+				dir.conns[i].bound = false;
+				dir.conns[i].used = 0;
+
+				pthread_mutex_lock(&dir.mutex);
+				dir.stats.open++;
+				dir.stats.opened++;
+				pthread_mutex_unlock(&dir.mutex);
+				fd = -1;
+			}
+			if (fd >= 0) close(fd);
+		}
+
+		for (i = 1; i < num; i++) {
+			if (fds[i].revents && (polled[i]->fd == fds[i].fd)) fake_read(polled[i]);
+		}
+
+		gettimeofday(&now, NULL);
+		for (i = 0; i < FAKE_MAX_REPLIES; i++) {
+			fake_reply_t	*reply = &dir.replies[i];
+			int		j;
+
+			if (!reply->len || timercmp(&now, &reply->when, <)) continue;
+
+			for (j = 0; j < FAKE_MAX_CONNS; j++) {
+				if ((dir.conns[j].fd >= 0) && (dir.conns[j].id == reply->conn_id)) {
+					if (write(dir.conns[j].fd, reply->data, reply->len) < 0) fake_close(&dir.conns[j]);
+					break;
+				}
+			}
+			reply->len = 0;
+		}
+	}
+
+	return NULL;
+}
+
+static int fake_dir_start(uint32_t delay_ms)
+{
+	struct sockaddr_in	sin;
+	socklen_t		sin_len = sizeof(sin);
+	pthread_t		thread;
+	int			i;
+
+	for (i = 0; i < FAKE_MAX_CONNS; i++) dir.conns[i].fd = -1;
+	dir.delay.tv_sec = delay_ms / 1000;
+	dir.delay.tv_usec = (delay_ms % 1000) * 1000;
+	pthread_mutex_init(&dir.mutex, NULL);
+
+	dir.sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (dir.sockfd < 0) return -1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((bind(dir.sockfd, (struct sockaddr *)&sin, sizeof(sin)) < 0) ||
+	    (getsockname(dir.sockfd, (struct sockaddr *)&sin, &sin_len) < 0) ||
+	    (listen(dir.sockfd, FAKE_MAX_CONNS) < 0)) return -1;
+	dir.port = ntohs(sin.sin_port);
+
+	if (pthread_create(&thread, NULL, fake_dir_thread, NULL) != 0) return -1;
+	pthread_detach(thread);
+
+	return 0;
+}
+
+static void fake_dir_stats(fake_stats_t *out)
+{
+	pthread_mutex_lock(&dir.mutex);
+	*out = dir.stats;
+	pthread_mutex_unlock(&dir.mutex);
+}
+
+/*
+ *	The parts of rlm_ldap async.c uses, without the connection pool
+ *	or the configuration.
+ */
+FR_NAME_NUMBER const ldap_scope[] = {
+	{ "sub",	LDAP_SCOPE_SUB	},
+	{ "one",	LDAP_SCOPE_ONE	},
+	{ "base",	LDAP_SCOPE_BASE },
+	{  NULL , -1 }
+};
+
+static int _mod_conn_free(ldap_handle_t *conn)
+{
+	ldap_unbind_ext_s(conn->handle, NULL, NULL);
+
+	return 0;
+}
+
+void *mod_conn_create(TALLOC_CTX *ctx, UNUSED void *instance, struct timeval const *timeout)
+{
+	ldap_handle_t	*conn;
+	char		url[64];
+	int		version = LDAP_VERSION3, msgid;
+	struct berval	cred = { 0, NULL };
+	struct timeval	tv = *timeout;
+	LDAPMessage	*result;
+
+	MEM(conn = talloc_zero(ctx, ldap_handle_t));
+
+	snprintf(url, sizeof(url), "ldap://127.0.0.1:%u", dir.port);
+	if (ldap_initialize(&conn->handle, url) != LDAP_SUCCESS) goto error;
+	ldap_set_option(conn->handle, LDAP_OPT_PROTOCOL_VERSION, &version);
+
+	if ((ldap_sasl_bind(conn->handle, "", LDAP_SASL_SIMPLE, &cred, NULL, NULL, &msgid) != LDAP_SUCCESS) ||
+	    (ldap_result(conn->handle, msgid, LDAP_MSG_ALL, &tv, &result) <= 0)) goto error;
+	ldap_msgfree(result);
+
+	talloc_set_destructor(conn, _mod_conn_free);
+
+	return conn;
+
+error:
+	if (conn->handle) ldap_unbind_ext_s(conn->handle, NULL, NULL);
+	talloc_free(conn);
+	return NULL;
+}
+
+ldap_rcode_t rlm_ldap_result_status(UNUSED rlm_ldap_t const *inst, ldap_handle_t const *conn, UNUSED int lib_errno,
+				    UNUSED char const *dn, LDAPMessage **result, bool freeit,
+				    char const **error, char **extra)
+{
+	int	code = LDAP_OTHER;
+
+	ldap_parse_result(conn->handle, *result, &code, NULL, NULL, NULL, NULL, freeit);
+	if (freeit) *result = NULL;
+
+	*error = ldap_err2string(code);
+	if (extra) *extra = NULL;
+
+	switch (code) {
+	case LDAP_SUCCESS:
+		return LDAP_PROC_SUCCESS;
+
+	case LDAP_INVALID_CREDENTIALS:
+		return LDAP_PROC_REJECT;
+
+	default:
+		return LDAP_PROC_ERROR;
+	}
+}
+
+size_t rlm_ldap_normalise_dn(char *out, char const *in)
+{
+	size_t len = strlen(in);
+
+	if (out != in) memcpy(out, in, len + 1);
+
+	return len;
+}
+
+void rlm_ldap_control_merge(LDAPControl *serverctrls_out[], LDAPControl *clientctrls_out[],
+			    UNUSED size_t serverctrls_len, UNUSED size_t clientctrls_len,
+			    UNUSED ldap_handle_t *conn,
+			    UNUSED LDAPControl *serverctrls_in[], UNUSED LDAPControl *clientctrls_in[])
+{
+	serverctrls_out[0] = NULL;
+	clientctrls_out[0] = NULL;
+}
+
+/*
+ *	The parts of the interpreter module methods use.
+ */
+main_config_t main_config;
+
+#define MAX_TIMEOUTS	1024
+
+typedef struct test_timeout {
+	REQUEST				*request;
+	fr_unlang_timeout_callback_t	callback;
+	void const			*ctx;
+	fr_event_timer_t		*ev;
+} test_timeout_t;
+
+static rlm_ldap_t		inst;
+static rlm_ldap_thread_t	thread;
+static fr_event_list_t		*el;
+static test_timeout_t		timeouts[MAX_TIMEOUTS];
+
+static int			*resumed;	//!< Times each request was resumed, by request number.
+static int			num_resumed;
+static int			errors;
+
+static void _test_timeout(struct timeval *now, void *ctx)
+{
+	test_timeout_t	*timeout = ctx;
+	void		*mutable_inst, *mutable_ctx;
+
+	memcpy(&mutable_inst, &thread.inst, sizeof(mutable_inst));
+	memcpy(&mutable_ctx, &timeout->ctx, sizeof(mutable_ctx));
+
+	timeout->ctx = NULL;
+	timeout->ev = NULL;
+	timeout->callback(timeout->request, mutable_inst, &thread, mutable_ctx, now);
+}
+
+int unlang_event_timeout_add(REQUEST *request, fr_unlang_timeout_callback_t callback,
+			     void const *ctx, struct timeval *when)
+{
+	int i;
+
+	for (i = 0; i < MAX_TIMEOUTS; i++) {
+		test_timeout_t *timeout = &timeouts[i];
+
+		if (timeout->ctx) continue;
+
+		timeout->request = request;
+		timeout->callback = callback;
+		timeout->ctx = ctx;
+
+		return fr_event_timer_insert(el, _test_timeout, timeout, when, &timeout->ev);
+	}
+
+	fr_strerror_printf("Too many timeouts");
+	return -1;
+}
+
+int unlang_event_timeout_delete(UNUSED REQUEST *request, void const *ctx)
+{
+	int i;
+
+	for (i = 0; i < MAX_TIMEOUTS; i++) {
+		test_timeout_t *timeout = &timeouts[i];
+
+		if (timeout->ctx != ctx) continue;
+
+		timeout->ctx = NULL;
+		return fr_event_timer_delete(el, &timeout->ev);
+	}
+
+	return -1;
+}
+
+void unlang_resumable(REQUEST *request)
+{
+	resumed[request->number]++;
+	num_resumed++;
+}
+
+static bool	deadline;
+
+static void _test_deadline(UNUSED struct timeval *now, UNUSED void *ctx)
+{
+	deadline = true;
+}
+
+/*
+ *	Service the event list until num requests have been resumed,
+ *	or until seconds have passed.
+ */
+static void wait_for(char const *test, int num, int seconds)
+{
+	struct timeval		when;
+	fr_event_timer_t	*ev = NULL;
+
+	deadline = false;
+	gettimeofday(&when, NULL);
+	when.tv_sec += seconds;
+	if (fr_event_timer_insert(el, _test_deadline, NULL, &when, &ev) < 0) {
+		fprintf(stderr, "%s: Failed inserting deadline: %s\n", test, fr_strerror());
+		exit(1);
+	}
+
+	while ((num_resumed < num) && !deadline) {
+		if (fr_event_corral(el, true) < 0) {
+			fprintf(stderr, "%s: Failed waiting for events: %s\n", test, fr_strerror());
+			exit(1);
+		}
+		fr_event_service(el);
+	}
+
+	if (ev) fr_event_timer_delete(el, &ev);
+
+	if (num_resumed < num) {
+		fprintf(stderr, "%s: Only %i of %i requests resumed\n", test, num_resumed, num);
+		errors++;
+	}
+}
+
+static void reset(int num)
+{
+	memset(resumed, 0, sizeof(*resumed) * num);
+	num_resumed = 0;
+}
+
+static double elapsed(struct timeval const *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) + ((now.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+#define CHECK(_test, _cond) do { \
+	if (!(_cond)) { \
+		fprintf(stderr, "%s: Failed %s\n", _test, #_cond); \
+		errors++; \
+	} \
+} while (0)
+
+static char const *attrs[] = { LDAP_NO_ATTRS, NULL };
+
+/*
+ *	Searches all share the thread's one connection, and each result
+ *	goes back to the search with its msgid.  If they didn't overlap,
+ *	num searches would take num * delay.
+ */
+static void test_multiplex(REQUEST **requests, int num, uint32_t delay_ms)
+{
+	static char const	*test = "multiplex";
+	ldap_query_t		**queries;
+	struct timeval		start;
+	double			took;
+	fake_stats_t		before, after;
+	int			i;
+
+	MEM(queries = talloc_zero_array(NULL, ldap_query_t *, num));
+	fake_dir_stats(&before);
+	reset(num);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		queries[i] = rlm_ldap_search_async(requests[i], &thread, requests[i], "ou=people," FAKE_BASE,
+						   LDAP_SCOPE_SUB, "(uid=user)", attrs, NULL, NULL);
+		CHECK(test, queries[i] != NULL);
+	}
+	CHECK(test, (int)rbtree_num_elements(thread.queries) == num);
+
+	wait_for(test, num, 10);
+	took = elapsed(&start);
+
+	fake_dir_stats(&after);
+	CHECK(test, after.opened == before.opened);
+	CHECK(test, (after.searches - before.searches) == num);
+	CHECK(test, after.max_outstanding > 1);
+	CHECK(test, took < ((num * delay_ms) / 1000.0));
+
+	for (i = 0; i < num; i++) {
+		char	want[64], *dn;
+
+		if (!queries[i]) continue;
+
+		CHECK(test, resumed[i] == 1);
+		CHECK(test, queries[i]->status == LDAP_PROC_SUCCESS);
+		CHECK(test, queries[i]->count == 1);
+		if (!queries[i]->entry) {
+			errors++;
+			talloc_free(queries[i]);
+			continue;
+		}
+
+		snprintf(want, sizeof(want), "uid=user%i,ou=people," FAKE_BASE, queries[i]->msgid);
+		dn = ldap_get_dn(thread.conn->handle, queries[i]->entry);
+		if (!dn || (strcmp(dn, want) != 0)) {
+			fprintf(stderr, "%s: Search %i got the entry for \"%s\"\n", test, queries[i]->msgid, dn);
+			errors++;
+		}
+		ldap_memfree(dn);
+		talloc_free(queries[i]);
+	}
+	CHECK(test, rbtree_num_elements(thread.queries) == 0);
+
+	printf("%s: %i searches in %.3fs on one connection, at most %i outstanding\n",
+	       test, num, took, after.max_outstanding);
+
+	talloc_free(queries);
+}
+
+/*
+ *	A search which gets no answer times out, and is abandoned so the
+ *	server stops working on it.  Searches sent alongside it still
+ *	complete.
+ */
+static void test_abandon(REQUEST **requests)
+{
+	static char const	*test = "abandon";
+	ldap_query_t		*hung, *ok;
+	struct timeval		start;
+	fake_stats_t		before, after;
+	int			i;
+
+	reset(2);
+	fake_dir_stats(&before);
+
+	gettimeofday(&start, NULL);
+	hung = rlm_ldap_search_async(requests[0], &thread, requests[0], FAKE_HANG_BASE,
+				     LDAP_SCOPE_SUB, "(uid=user)", attrs, NULL, NULL);
+	ok = rlm_ldap_search_async(requests[1], &thread, requests[1], "ou=people," FAKE_BASE,
+				   LDAP_SCOPE_SUB, "(uid=user)", attrs, NULL, NULL);
+	if (!hung || !ok) {
+		fprintf(stderr, "%s: Failed sending searches\n", test);
+		errors++;
+		return;
+	}
+
+	wait_for(test, 2, 5);
+	CHECK(test, elapsed(&start) >= inst.res_timeout);
+	CHECK(test, hung->status == LDAP_PROC_RETRY);
+	CHECK(test, ok->status == LDAP_PROC_SUCCESS);
+	CHECK(test, resumed[0] == 1);
+	CHECK(test, resumed[1] == 1);
+
+	/*
+	 *	The abandon is sent as the search times out, give the
+	 *	directory a moment to read it.
+	 */
+	for (i = 0; i < 100; i++) {
+		fake_dir_stats(&after);
+		if (after.abandons > before.abandons) break;
+		usleep(10000);
+	}
+	CHECK(test, after.abandons == (before.abandons + 1));
+	CHECK(test, after.last_abandoned == hung->msgid);
+
+	/*
+	 *	Freeing queries which completed doesn't abandon them again.
+	 */
+	talloc_free(hung);
+	talloc_free(ok);
+	usleep(50000);
+
+	fake_dir_stats(&before);
+	CHECK(test, before.abandons == after.abandons);
+
+	printf("%s: timed out search %i abandoned\n", test, after.last_abandoned);
+}
+
+/*
+ *	Binds get their own connections.  Bad passwords are rejected, and
+ *	we never open more than async_binds connections, however many
+ *	binds are waiting.
+ */
+static void test_binds(REQUEST **requests, int num)
+{
+	static char const	*test = "binds";
+	ldap_query_t		**queries;
+	struct timeval		start;
+	int			i, ok = 0, rejected = 0;
+
+	MEM(queries = talloc_zero_array(NULL, ldap_query_t *, num));
+	reset(num);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		queries[i] = rlm_ldap_bind_async(requests[i], &thread, requests[i], "uid=user,ou=people," FAKE_BASE,
+						 talloc_typed_strdup(requests[i], (i % 10) ? "good" : "bad"));
+		CHECK(test, queries[i] != NULL);
+	}
+	CHECK(test, thread.binds_open <= inst.async_binds);
+
+	wait_for(test, num, 20);
+	CHECK(test, thread.binds_open <= inst.async_binds);
+
+	for (i = 0; i < num; i++) {
+		if (!queries[i]) continue;
+
+		CHECK(test, resumed[i] == 1);
+		if (queries[i]->status == LDAP_PROC_SUCCESS) ok++;
+		if (queries[i]->status == LDAP_PROC_REJECT) rejected++;
+		CHECK(test, queries[i]->status == ((i % 10) ? LDAP_PROC_SUCCESS : LDAP_PROC_REJECT));
+		talloc_free(queries[i]);
+	}
+
+	printf("%s: %i accepted, %i rejected in %.3fs, on %u connections\n",
+	       test, ok, rejected, elapsed(&start), thread.binds_open);
+
+	talloc_free(queries);
+}
+
+/*
+ *	A search for the user, then a bind as the DN it found.
+ */
+static void test_search_bind(REQUEST **requests, int num)
+{
+	static char const	*test = "search then bind";
+	ldap_query_t		**queries;
+	int			i;
+
+	MEM(queries = talloc_zero_array(NULL, ldap_query_t *, num));
+	reset(num);
+
+	for (i = 0; i < num; i++) {
+		queries[i] = rlm_ldap_search_async(requests[i], &thread, requests[i], "ou=people," FAKE_BASE,
+						   LDAP_SCOPE_SUB, "(uid=user)", attrs, NULL, NULL);
+		CHECK(test, queries[i] != NULL);
+		if (queries[i]) queries[i]->password = talloc_typed_strdup(requests[i], "good");
+	}
+
+	wait_for(test, num, 10);
+
+	for (i = 0; i < num; i++) {
+		if (!queries[i]) continue;
+
+		CHECK(test, resumed[i] == 1);
+		CHECK(test, queries[i]->is_bind);
+		CHECK(test, queries[i]->status == LDAP_PROC_SUCCESS);
+		CHECK(test, strncmp(queries[i]->dn, "uid=user", 8) == 0);
+		talloc_free(queries[i]);
+	}
+	CHECK(test, rbtree_num_elements(thread.queries) == 0);
+
+	printf("%s: %i users found and bound\n", test, num);
+
+	talloc_free(queries);
+}
+
+/*
+ *	A bind which gets no answer leaves its connection bound as nobody
+ *	knows who.  The connection is closed when the bind times out, and
+ *	the next bind opens another.
+ */
+static void test_bind_timeout(REQUEST **requests)
+{
+	static char const	*test = "bind timeout";
+	ldap_query_t		*queries[8];
+	fake_stats_t		before, after;
+	int			i;
+
+	reset(8);
+
+	for (i = 0; i < 8; i++) {
+		queries[i] = rlm_ldap_bind_async(requests[i], &thread, requests[i], "uid=user,ou=people," FAKE_BASE,
+						 talloc_typed_strdup(requests[i], (i < 2) ? "hang" : "good"));
+		CHECK(test, queries[i] != NULL);
+	}
+
+	wait_for(test, 8, 5);
+
+	for (i = 0; i < 8; i++) {
+		if (!queries[i]) continue;
+
+		CHECK(test, resumed[i] == 1);
+		CHECK(test, queries[i]->status == ((i < 2) ? LDAP_PROC_RETRY : LDAP_PROC_SUCCESS));
+		talloc_free(queries[i]);
+	}
+	CHECK(test, thread.binds_open == (inst.async_binds - 2));
+
+	/*
+	 *	The directory sees the two connections close.
+	 */
+	usleep(100000);
+	fake_dir_stats(&before);
+	CHECK(test, before.open == (int)(thread.binds_open + 1));
+
+	/*
+	 *	And a full set of binds still get connections.
+	 */
+	reset(8);
+	for (i = 0; i < 8; i++) {
+		queries[i] = rlm_ldap_bind_async(requests[i], &thread, requests[i], "uid=user,ou=people," FAKE_BASE,
+						 talloc_typed_strdup(requests[i], "good"));
+		CHECK(test, queries[i] != NULL);
+	}
+
+	wait_for(test, 8, 5);
+
+	for (i = 0; i < 8; i++) {
+		if (!queries[i]) continue;
+
+		CHECK(test, resumed[i] == 1);
+		CHECK(test, queries[i]->status == LDAP_PROC_SUCCESS);
+		talloc_free(queries[i]);
+	}
+	CHECK(test, thread.binds_open == inst.async_binds);
+
+	fake_dir_stats(&after);
+	CHECK(test, (after.opened - before.opened) == 2);
+
+	printf("%s: %i connections replaced, %u bind connections open\n",
+	       test, after.opened - before.opened, thread.binds_open);
+}
+
+/*
+ *	Cancelled binds are never resumed, whether they'd been sent or were
+ *	waiting for a connection.
+ */
+static void test_cancel(REQUEST **requests)
+{
+	static char const	*test = "cancel";
+	ldap_query_t		*queries[8];
+	int			i;
+
+	reset(8);
+
+	for (i = 0; i < 8; i++) {
+		queries[i] = rlm_ldap_bind_async(requests[i], &thread, requests[i], "uid=user,ou=people," FAKE_BASE,
+						 talloc_typed_strdup(requests[i], "good"));
+		if (!queries[i]) {
+			fprintf(stderr, "%s: Failed sending bind\n", test);
+			errors++;
+			return;
+		}
+	}
+	CHECK(test, queries[0]->bind_conn != NULL);
+	CHECK(test, queries[7]->bind_conn == NULL);
+
+	rlm_ldap_query_cancel(queries[0]);
+	talloc_free(queries[0]);
+	rlm_ldap_query_cancel(queries[7]);
+	talloc_free(queries[7]);
+
+	wait_for(test, 6, 5);
+
+	for (i = 1; i < 7; i++) {
+		CHECK(test, resumed[i] == 1);
+		CHECK(test, queries[i]->status == LDAP_PROC_SUCCESS);
+		talloc_free(queries[i]);
+	}
+	CHECK(test, resumed[0] == 0);
+	CHECK(test, resumed[7] == 0);
+	CHECK(test, thread.binds_head == NULL);
+
+	printf("%s: 6 binds completed, 2 cancelled\n", test);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: ldap_async_test [OPTS]\n");
+	fprintf(stderr, "  -d <ms>                How long the directory waits before answering.\n");
+	fprintf(stderr, "  -n <num>               Number of searches and binds to send at once.\n");
+	fprintf(stderr, "  -x                     Debug output.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i, num = 200;
+	fake_stats_t	stats;
+	uint32_t	delay_ms = 20;
+	TALLOC_CTX	*autofree = talloc_init("main");
+	REQUEST		**requests;
+
+	while ((c = getopt(argc, argv, "d:hn:x")) != EOF) switch (c) {
+		case 'd':
+			delay_ms = atoi(optarg);
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			if ((num < 8) || (num > (MAX_TIMEOUTS / 2))) usage();
+			break;
+
+		case 'x':
+			fr_debug_lvl++;
+			rad_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fake_dir_start(delay_ms) < 0) {
+		fprintf(stderr, "Failed starting fake directory: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	el = fr_event_list_create(autofree, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "Failed creating event list: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	inst.name = "ldap";
+	inst.res_timeout = 10;
+	inst.async_binds = 4;
+
+	thread.inst = &inst;
+	thread.el = el;
+	if (rlm_ldap_async_init(&thread) < 0) {
+		fprintf(stderr, "Failed initialising thread: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	MEM(requests = talloc_zero_array(autofree, REQUEST *, num));
+	MEM(resumed = talloc_zero_array(autofree, int, num));
+	for (i = 0; i < num; i++) {
+		MEM(requests[i] = request_alloc(requests));
+		requests[i]->number = i;
+	}
+
+	/*
+	 *	Binds queued behind num others mustn't time out.
+	 */
+	test_multiplex(requests, num, delay_ms);
+	test_binds(requests, num);
+	test_search_bind(requests, num);
+	test_cancel(requests);
+
+	inst.res_timeout = 1;
+	test_abandon(requests);
+	test_bind_timeout(requests);
+
+	rlm_ldap_async_free(&thread);
+	CHECK("free", thread.binds_open == 0);
+	CHECK("free", fr_event_list_num_fds(el) == 0);
+
+	usleep(100000);
+	fake_dir_stats(&stats);
+	CHECK("free", stats.open == 0);
+
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,8 @@
+TARGET		:= ldap_async_test
+SOURCES		:= ldap_async_test.c
+
+SRC_CFLAGS	:= $(rlm_ldap_CFLAGS)
+
+TGT_PREREQS	:= rlm_ldap.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS) $(rlm_ldap_LDLIBS)
+TGT_INSTALLDIR	:=
@@ -214,6 +214,12 @@ static CONF_PARSER option_config[] = {
 	/* timeout for search results */
 	{ FR_CONF_OFFSET("res_timeout", PW_TYPE_INTEGER, rlm_ldap_t, res_timeout), .dflt = "20" },
 
+	/* user object searches share a per-thread connection */
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_ldap_t, async), .dflt = "no" },
+
+	/* most connections each thread opens for binds */
+	{ FR_CONF_OFFSET("async_binds", PW_TYPE_INTEGER, rlm_ldap_t, async_binds), .dflt = "8" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -679,13 +685,113 @@ finish:
 	return 0;
 }
 
-static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+/** Turn the outcome of a bind as the user into a module code
+ *
+ */
+static rlm_rcode_t rlm_ldap_bind_rcode(REQUEST *request, ldap_rcode_t status, char const *dn)
+{
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		RDEBUG("Bind as user \"%s\" was successful", dn);
+		return RLM_MODULE_OK;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		return RLM_MODULE_USERLOCK;
+
+	case LDAP_PROC_REJECT:
+		return RLM_MODULE_REJECT;
+
+	case LDAP_PROC_BAD_DN:
+		return RLM_MODULE_INVALID;
+
+	case LDAP_PROC_NO_RESULT:
+		return RLM_MODULE_NOTFOUND;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+}
+
+/** Process the result of the bind as the user, or the search for them
+ *
+ */
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+	ldap_query_t		*query = talloc_get_type_abort(ctx, ldap_query_t);
+	LDAPMessage		*entry;
+	VALUE_PAIR		*vp;
+	rlm_rcode_t		rcode;
+
+	/*
+	 *	The search for the user object failed, so there
+	 *	was no bind.
+	 */
+	if (!query->is_bind) {
+		if (rlm_ldap_find_user_async_result(t, request, query, &entry, &rcode)) rcode = RLM_MODULE_FAIL;
+		talloc_free(query);
+		return rcode;
+	}
+
+	/*
+	 *	Same as rlm_ldap_find_user, if we found the user
+	 *	object.  The DN is already normalised.
+	 */
+	if (!fr_pair_find_by_num(request->control, 0, PW_LDAP_USERDN, TAG_ANY)) {
+		RDEBUG("User object found at DN \"%s\"", query->dn);
+		vp = fr_pair_make(request, &request->control, "LDAP-UserDN", NULL, T_OP_EQ);
+		if (vp) fr_pair_value_strcpy(vp, query->dn);
+	}
+
+	switch (query->status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		REDEBUG("Bind was not permitted: %s", query->error);
+		break;
+
+	case LDAP_PROC_REJECT:
+		REDEBUG("Bind credentials incorrect: %s", query->error);
+		break;
+
+	default:
+		REDEBUG("Bind with %s to %s failed: %s", query->dn, inst->pool_inst.server, query->error);
+		break;
+	}
+	if (query->extra) REDEBUG("%s", query->extra);
+
+	rcode = rlm_ldap_bind_rcode(request, query->status, query->dn);
+	talloc_free(query);
+
+	return rcode;
+}
+
+/** Stop waiting for the bind if the request is cancelled
+ *
+ */
+static void mod_authenticate_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				    fr_state_action_t action)
+{
+	ldap_query_t *query = talloc_get_type_abort(ctx, ldap_query_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending LDAP %s", query->is_bind ? "bind" : "search");
+
+	rlm_ldap_query_cancel(query);
+	talloc_free(query);
+}
+
+static rlm_rcode_t mod_authenticate(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rcode_t		rcode;
 	ldap_rcode_t		status;
 	char const		*dn;
 	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
 	ldap_handle_t		*conn;
 
 	char			sasl_mech_buff[LDAP_MAX_DN_STR_LEN];
@@ -723,6 +829,33 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 		return RLM_MODULE_INVALID;
 	}
 
+	/*
+	 *	Bind on one of this thread's connections, and let
+	 *	the worker get on with other requests until the
+	 *	result arrives.  If authorize didn't find the user
+	 *	object, search for it first, in the same way.
+	 */
+	if (inst->async && t->queries && !inst->user_sasl.mech) {
+		ldap_query_t	*query;
+		VALUE_PAIR	*vp;
+
+		RDEBUG("Login attempt by \"%s\"", request->username->vp_strvalue);
+
+		vp = fr_pair_find_by_num(request->control, 0, PW_LDAP_USERDN, TAG_ANY);
+		if (vp) {
+			RDEBUG("Using user DN from request \"%s\"", vp->vp_strvalue);
+			query = rlm_ldap_bind_async(request, t, request, vp->vp_strvalue,
+						    request->password->vp_strvalue);
+			rcode = RLM_MODULE_FAIL;
+		} else {
+			query = rlm_ldap_find_user_bind_async(request, t, request, request->password->vp_strvalue,
+							      &rcode);
+		}
+		if (!query) return rcode;
+
+		return unlang_yield(request, mod_authenticate_resume, mod_authenticate_action, query);
+	}
+
 	conn = mod_conn_get(inst, request);
 	if (!conn) return RLM_MODULE_FAIL;
 
@@ -772,32 +905,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 	conn->rebound = true;
 	status = rlm_ldap_bind(inst, request, &conn, dn, request->password->vp_strvalue,
 			       inst->user_sasl.mech ? &sasl : NULL, true, NULL, NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		rcode = RLM_MODULE_OK;
-		RDEBUG("Bind as user \"%s\" was successful", dn);
-		break;
-
-	case LDAP_PROC_NOT_PERMITTED:
-		rcode = RLM_MODULE_USERLOCK;
-		break;
-
-	case LDAP_PROC_REJECT:
-		rcode = RLM_MODULE_REJECT;
-		break;
-
-	case LDAP_PROC_BAD_DN:
-		rcode = RLM_MODULE_INVALID;
-		break;
-
-	case LDAP_PROC_NO_RESULT:
-		rcode = RLM_MODULE_NOTFOUND;
-		break;
-
-	default:
-		rcode = RLM_MODULE_FAIL;
-		break;
-	};
+	rcode = rlm_ldap_bind_rcode(request, status, dn);
 
 finish:
 	mod_conn_release(inst, request, conn);
@@ -879,73 +987,37 @@ free_result:
 	return rcode;
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+/** Apply a user object to the request
+ *
+ * Checks access, caches group memberships, retrieves eDirectory passwords,
+ * applies profiles, and maps the object's attributes.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dn of the user object.
+ * @param[in] entry the user object.
+ * @param[in] expanded attributes that were retrieved.
+ * @return one of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t rlm_ldap_authorize_entry(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
+					    char const *dn, LDAPMessage *entry, rlm_ldap_map_exp_t *expanded)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
-	ldap_rcode_t		status;
-	int			ldap_errno;
 	int			i;
-	rlm_ldap_t const	*inst = instance;
 	struct berval		**values;
+#ifdef WITH_EDIR
+	ldap_rcode_t		status;
 	VALUE_PAIR		*vp;
-	ldap_handle_t		*conn;
-	LDAPMessage		*result, *entry;
-	char const 		*dn = NULL;
-	rlm_ldap_map_exp_t	expanded; /* faster than allocing every time */
-
-	/*
-	 *	Don't be tempted to add a check for request->username
-	 *	or request->password here. rlm_ldap.authorize can be used for
-	 *	many things besides searching for users.
-	 */
-
-	if (rlm_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
-
-	conn = mod_conn_get(inst, request);
-	if (!conn) return RLM_MODULE_FAIL;
-
-	/*
-	 *	Add any additional attributes we need for checking access, memberships, and profiles
-	 */
-	if (inst->userobj_access_attr) {
-		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
-	}
-
-	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
-		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
-	}
-
-	if (inst->profile_attr) {
-		expanded.attrs[expanded.count++] = inst->profile_attr;
-	}
-
-	if (inst->valuepair_attr) {
-		expanded.attrs[expanded.count++] = inst->valuepair_attr;
-	}
-
-	expanded.attrs[expanded.count] = NULL;
-
-	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
-	if (!dn) {
-		goto finish;
-	}
-
-	entry = ldap_first_entry(conn->handle, result);
-	if (!entry) {
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
-
-		goto finish;
-	}
+#endif
 
 	/*
 	 *	Check for access.
 	 */
 	if (inst->userobj_access_attr) {
-		rcode = rlm_ldap_check_access(inst, request, conn, entry);
+		rcode = rlm_ldap_check_access(inst, request, *pconn, entry);
 		if (rcode != RLM_MODULE_OK) {
-			goto finish;
+			return rcode;
 		}
 	}
 
@@ -954,15 +1026,15 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 	 */
 	if (inst->cacheable_group_dn || inst->cacheable_group_name) {
 		if (inst->userobj_membership_attr) {
-			rcode = rlm_ldap_cacheable_userobj(inst, request, &conn, entry, inst->userobj_membership_attr);
+			rcode = rlm_ldap_cacheable_userobj(inst, request, pconn, entry, inst->userobj_membership_attr);
 			if (rcode != RLM_MODULE_OK) {
-				goto finish;
+				return rcode;
 			}
 		}
 
-		rcode = rlm_ldap_cacheable_groupobj(inst, request, &conn);
+		rcode = rlm_ldap_cacheable_groupobj(inst, request, pconn);
 		if (rcode != RLM_MODULE_OK) {
-			goto finish;
+			return rcode;
 		}
 	}
 
@@ -985,12 +1057,11 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 		/*
 		 *	Retrive universal password
 		 */
-		res = nmasldap_get_password(conn->handle, dn, password, &pass_size);
+		res = nmasldap_get_password((*pconn)->handle, dn, password, &pass_size);
 		if (res != 0) {
 			REDEBUG("Failed to retrieve eDirectory password: (%i) %s", res, edir_errstr(res));
-			rcode = RLM_MODULE_FAIL;
 
-			goto finish;
+			return RLM_MODULE_FAIL;
 		}
 
 		/*
@@ -1011,8 +1082,8 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 			/*
 			 *	Bind as the user
 			 */
-			conn->rebound = true;
-			status = rlm_ldap_bind(inst, request, &conn, dn, vp->vp_strvalue, NULL, true, NULL, NULL, NULL);
+			(*pconn)->rebound = true;
+			status = rlm_ldap_bind(inst, request, pconn, dn, vp->vp_strvalue, NULL, true, NULL, NULL, NULL);
 			switch (status) {
 			case LDAP_PROC_SUCCESS:
 				rcode = RLM_MODULE_OK;
@@ -1020,24 +1091,19 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 				break;
 
 			case LDAP_PROC_NOT_PERMITTED:
-				rcode = RLM_MODULE_USERLOCK;
-				goto finish;
+				return RLM_MODULE_USERLOCK;
 
 			case LDAP_PROC_REJECT:
-				rcode = RLM_MODULE_REJECT;
-				goto finish;
+				return RLM_MODULE_REJECT;
 
 			case LDAP_PROC_BAD_DN:
-				rcode = RLM_MODULE_INVALID;
-				goto finish;
+				return RLM_MODULE_INVALID;
 
 			case LDAP_PROC_NO_RESULT:
-				rcode = RLM_MODULE_NOTFOUND;
-				goto finish;
+				return RLM_MODULE_NOTFOUND;
 
 			default:
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
+				return RLM_MODULE_FAIL;
 			};
 		}
 	}
@@ -1055,19 +1121,15 @@ skip_edir:
 		if (tmpl_expand(&profile, profile_buff, sizeof(profile_buff),
 				request, inst->default_profile, NULL, NULL) < 0) {
 			REDEBUG("Failed creating default profile string");
-
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+			return RLM_MODULE_INVALID;
 		}
 
-		switch (rlm_ldap_map_profile(inst, request, &conn, profile, &expanded)) {
+		switch (rlm_ldap_map_profile(inst, request, pconn, profile, expanded)) {
 		case RLM_MODULE_INVALID:
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+			return RLM_MODULE_INVALID;
 
 		case RLM_MODULE_FAIL:
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
+			return RLM_MODULE_FAIL;
 
 		case RLM_MODULE_UPDATED:
 			rcode = RLM_MODULE_UPDATED;
@@ -1081,19 +1143,18 @@ skip_edir:
 	 *	Apply a SET of user profiles.
 	 */
 	if (inst->profile_attr) {
-		values = ldap_get_values_len(conn->handle, entry, inst->profile_attr);
+		values = ldap_get_values_len((*pconn)->handle, entry, inst->profile_attr);
 		if (values != NULL) {
 			for (i = 0; values[i] != NULL; i++) {
 				rlm_rcode_t ret;
 				char *value;
 
 				value = rlm_ldap_berval_to_string(request, values[i]);
-				ret = rlm_ldap_map_profile(inst, request, &conn, value, &expanded);
+				ret = rlm_ldap_map_profile(inst, request, pconn, value, expanded);
 				talloc_free(value);
 				if (ret == RLM_MODULE_FAIL) {
 					ldap_value_free_len(values);
-					rcode = ret;
-					goto finish;
+					return ret;
 				}
 
 			}
@@ -1104,11 +1165,170 @@ skip_edir:
 	if (inst->user_map || inst->valuepair_attr) {
 		RDEBUG("Processing user attributes");
 		RINDENT();
-		if (rlm_ldap_map_do(inst, request, conn->handle, &expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+		if (rlm_ldap_map_do(inst, request, (*pconn)->handle, expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
 		REXDENT();
-		rlm_ldap_check_reply(inst, request, conn);
+		rlm_ldap_check_reply(inst, request, *pconn);
+	}
+
+	return rcode;
+}
+
+/** State kept while authorize waits for the user object
+ *
+ */
+typedef struct {
+	rlm_ldap_map_exp_t	expanded;		//!< Attributes being retrieved.
+	ldap_query_t		*query;			//!< Search for the user object.
+} ldap_autz_ctx_t;
+
+/** Process the user object, once the search for it is done
+ *
+ */
+static rlm_rcode_t mod_authorize_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+	ldap_autz_ctx_t		*autz_ctx = talloc_get_type_abort(ctx, ldap_autz_ctx_t);
+	ldap_handle_t		*conn;
+	LDAPMessage		*entry;
+	char const		*dn;
+	rlm_rcode_t		rcode;
+
+	dn = rlm_ldap_find_user_async_result(t, request, autz_ctx->query, &entry, &rcode);
+	if (!dn) goto finish;
+
+	/*
+	 *	Groups, profiles and eDirectory passwords are still
+	 *	retrieved synchronously, on a pooled connection.
+	 *	Without them, the entry can be processed using the
+	 *	handle it was read with.
+	 */
+	if (inst->cacheable_group_dn || inst->cacheable_group_name || inst->default_profile || inst->profile_attr
+#ifdef WITH_EDIR
+	    || inst->edir
+#endif
+	    ) {
+		conn = mod_conn_get(inst, request);
+		if (!conn) {
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		rcode = rlm_ldap_authorize_entry(inst, request, &conn, dn, entry, &autz_ctx->expanded);
+		mod_conn_release(inst, request, conn);
+	} else {
+		conn = t->conn;
+		rcode = rlm_ldap_authorize_entry(inst, request, &conn, dn, entry, &autz_ctx->expanded);
+	}
+
+finish:
+	talloc_free(autz_ctx->expanded.ctx);
+	talloc_free(autz_ctx);
+
+	return rcode;
+}
+
+/** Stop waiting for the user object if the request is cancelled
+ *
+ */
+static void mod_authorize_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				 fr_state_action_t action)
+{
+	ldap_autz_ctx_t *autz_ctx = talloc_get_type_abort(ctx, ldap_autz_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending LDAP search");
+
+	rlm_ldap_query_cancel(autz_ctx->query);
+
+	talloc_free(autz_ctx->expanded.ctx);
+	talloc_free(autz_ctx);
+}
+
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	int			ldap_errno;
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+	ldap_handle_t		*conn;
+	LDAPMessage		*result, *entry;
+	char const 		*dn = NULL;
+	rlm_ldap_map_exp_t	expanded; /* faster than allocing every time */
+
+	/*
+	 *	Don't be tempted to add a check for request->username
+	 *	or request->password here. rlm_ldap.authorize can be used for
+	 *	many things besides searching for users.
+	 */
+
+	if (rlm_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
+
+	/*
+	 *	Add any additional attributes we need for checking access, memberships, and profiles
+	 */
+	if (inst->userobj_access_attr) {
+		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
+	}
+
+	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
+		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
+	}
+
+	if (inst->profile_attr) {
+		expanded.attrs[expanded.count++] = inst->profile_attr;
+	}
+
+	if (inst->valuepair_attr) {
+		expanded.attrs[expanded.count++] = inst->valuepair_attr;
+	}
+
+	expanded.attrs[expanded.count] = NULL;
+
+	/*
+	 *	Send the search on this thread's connection, and
+	 *	let the worker get on with other requests until
+	 *	the result arrives.
+	 */
+	if (inst->async && t->queries) {
+		ldap_autz_ctx_t *autz_ctx;
+
+		MEM(autz_ctx = talloc_zero(request, ldap_autz_ctx_t));
+		autz_ctx->expanded = expanded;
+
+		autz_ctx->query = rlm_ldap_find_user_async(autz_ctx, t, request, autz_ctx->expanded.attrs, &rcode);
+		if (!autz_ctx->query) {
+			talloc_free(expanded.ctx);
+			talloc_free(autz_ctx);
+			return rcode;
+		}
+
+		return unlang_yield(request, mod_authorize_resume, mod_authorize_action, autz_ctx);
 	}
 
+	conn = mod_conn_get(inst, request);
+	if (!conn) {
+		talloc_free(expanded.ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
+	if (!dn) {
+		goto finish;
+	}
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+
+	rcode = rlm_ldap_authorize_entry(inst, request, &conn, dn, entry, &expanded);
+
 finish:
 	talloc_free(expanded.ctx);
 	if (result) ldap_msgfree(result);
@@ -1523,6 +1743,8 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		goto error;
 	}
 
+	FR_INTEGER_BOUND_CHECK("async_binds", inst->async_binds, >=, 1);
+
 	/*
 	 *	Sanity checks for cacheable groups code.
 	 */
@@ -1973,6 +2195,43 @@ error:
 	return -1;
 }
 
+/** Open the connection this thread's asynchronous searches share
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_ldap_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+
+	t->inst = inst;
+	t->el = el;
+	t->fd = -1;
+
+	if (!inst->async) return 0;
+
+	return rlm_ldap_async_init(t);
+}
+
+/** Close the connection this thread's asynchronous searches share
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_ldap_async_free(thread);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	static LDAPAPIInfo info = { .ldapai_info_version = LDAP_API_INFO_VERSION };	/* static to quiet valgrind about this being uninitialised */
@@ -2042,16 +2301,19 @@ static void mod_unload(void)
 /* globally exported name */
 extern rad_module_t rlm_ldap;
 rad_module_t rlm_ldap = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "ldap",
-	.type		= 0,
-	.inst_size	= sizeof(rlm_ldap_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.unload		= mod_unload,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "ldap",
+	.type			= 0,
+	.inst_size		= sizeof(rlm_ldap_t),
+	.thread_inst_size	= sizeof(rlm_ldap_thread_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.unload			= mod_unload,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
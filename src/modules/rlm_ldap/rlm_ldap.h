@@ -376,6 +376,11 @@ struct rlm_ldap_s {
 	ldap_acct_section_t *postauth;			//!< Modify mappings for post-auth.
 	ldap_acct_section_t *accounting;		//!< Modify mappings for accounting.
 
+	bool		async;				//!< If true, user object searches, and the binds in
+							//!< authenticate, are sent on per-thread connections, and
+							//!< the request yields until the result arrives.
+	uint32_t	async_binds;			//!< Most connections each thread opens for binds.
+
 #ifdef WITH_EDIR
 	/*
 	 *	eDir support
@@ -421,6 +426,34 @@ typedef struct ldap_handle {
 	rlm_ldap_t	 const *inst;			//!< rlm_ldap pool inst.
 } ldap_handle_t;
 
+typedef struct ldap_query ldap_query_t;
+typedef struct ldap_bind_conn ldap_bind_conn_t;
+
+/** Thread specific data for asynchronous searches and binds
+ *
+ * Each thread has one connection, bound as the admin user, which all of
+ * the thread's outstanding searches share.  Results are matched back to
+ * their searches by msgid.
+ *
+ * A bind changes the identity of the connection it's sent on, and nothing
+ * else may be sent until it completes, so binds have connections of their
+ * own.  When they're all busy, binds wait for one to become free.
+ */
+typedef struct rlm_ldap_thread {
+	rlm_ldap_t const	*inst;			//!< Instance of rlm_ldap.
+	fr_event_list_t		*el;			//!< Event list serviced by this thread.
+
+	ldap_handle_t		*conn;			//!< Connection shared by this thread's searches.
+							//!< NULL if we're not connected.
+	int			fd;			//!< File descriptor of the connection.
+	rbtree_t		*queries;		//!< Searches sent on the connection, keyed by msgid.
+
+	ldap_bind_conn_t	*binds;			//!< Connections used for binds.
+	uint32_t		binds_open;		//!< Number of connections in binds.
+	ldap_query_t		*binds_head;		//!< First bind waiting for a connection.
+	ldap_query_t		*binds_tail;		//!< Last bind waiting for a connection.
+} rlm_ldap_thread_t;
+
 /** Result of expanding the RHS of a set of maps
  *
  * Used to store the array of attributes we'll be querying for.
@@ -465,6 +498,42 @@ typedef enum {
 	LDAP_PROC_NO_RESULT = -6			//!< Got no results.
 } ldap_rcode_t;
 
+/** A connection used for asynchronous binds
+ *
+ */
+struct ldap_bind_conn {
+	rlm_ldap_thread_t	*thread;		//!< Thread which opened the connection.
+	ldap_handle_t		*conn;			//!< Handle of the connection.
+	int			fd;			//!< File descriptor of the connection.
+	ldap_query_t		*query;			//!< Bind in progress, NULL if the connection is free.
+	ldap_bind_conn_t	*next;			//!< Next connection used for binds.
+};
+
+/** An asynchronous search or bind
+ *
+ */
+struct ldap_query {
+	rlm_ldap_thread_t	*thread;		//!< Thread the search was sent by.  NULL if the
+							//!< connection it was sent on has gone.
+	REQUEST			*request;		//!< Request waiting for the search.
+	int			msgid;			//!< Returned by ldap_search_ext or ldap_sasl_bind.
+	char const		*dn;			//!< Base DN of the search, or DN to bind as.
+
+	bool			is_bind;		//!< Whether this is a bind.
+	char const		*password;		//!< To bind with.  Must outlive the query.
+	ldap_bind_conn_t	*bind_conn;		//!< Connection the bind was sent on.  NULL if
+							//!< it's waiting for one.
+	ldap_query_t		*next;			//!< Next bind waiting for a connection.
+
+	LDAPMessage		*entry;			//!< First entry returned.
+	int			count;			//!< Number of entries returned.
+
+	bool			done;			//!< Whether the request has been marked as resumable.
+	ldap_rcode_t		status;			//!< Outcome of the search.
+	char const		*error;			//!< Why the search failed.  Must not be freed.
+	char			*extra;			//!< Additional error information, may be NULL.
+};
+
 /*
  *	Some functions may be called with a NULL request structure, this
  *	simplifies switching certain messages from the request log to
@@ -509,6 +578,15 @@ ldap_rcode_t rlm_ldap_modify(rlm_ldap_t const *inst, REQUEST *request, ldap_hand
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
+ldap_query_t *rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				       char const *attrs[], rlm_rcode_t *rcode);
+
+ldap_query_t *rlm_ldap_find_user_bind_async(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+					    char const *password, rlm_rcode_t *rcode);
+
+char const *rlm_ldap_find_user_async_result(rlm_ldap_thread_t *t, REQUEST *request, ldap_query_t *query,
+					    LDAPMessage **entry, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t const *conn,
 				  LDAPMessage *entry);
 
@@ -521,6 +599,10 @@ ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst, ldap_handle_t const *conn,
 			     struct timeval const *timeout,
 			     LDAPMessage **result, char const **error, char **extra);
 
+ldap_rcode_t rlm_ldap_result_status(rlm_ldap_t const *inst, ldap_handle_t const *conn, int lib_errno,
+				    char const *dn, LDAPMessage **result, bool freeit,
+				    char const **error, char **extra);
+
 char *rlm_ldap_berval_to_string(TALLOC_CTX *ctx, struct berval const *in);
 
 int rlm_ldap_global_init(rlm_ldap_t *inst) CC_HINT(nonnull);
@@ -531,6 +613,22 @@ ldap_handle_t *mod_conn_get(rlm_ldap_t const *inst, REQUEST *request);
 
 void mod_conn_release(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t *conn);
 
+/*
+ *	async.c - Searches which share a per-thread connection, and binds.
+ */
+int rlm_ldap_async_init(rlm_ldap_thread_t *t) CC_HINT(nonnull);
+
+void rlm_ldap_async_free(rlm_ldap_thread_t *t) CC_HINT(nonnull);
+
+ldap_query_t *rlm_ldap_search_async(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				    char const *dn, int scope, char const *filter, char const * const *attrs,
+				    LDAPControl **serverctrls, LDAPControl **clientctrls);
+
+ldap_query_t *rlm_ldap_bind_async(TALLOC_CTX *ctx, rlm_ldap_thread_t *t, REQUEST *request,
+				  char const *dn, char const *password);
+
+void rlm_ldap_query_cancel(ldap_query_t *query) CC_HINT(nonnull);
+
 /*
  *	groups.c - Group membership functions.
  */
@@ -0,0 +1,5 @@
+TARGET		:= rlm_ldap.a
+SOURCES		:= rlm_ldap.c async.c attrmap.c ldap.c clients.c groups.c edir.c control.c directory.c $(rlm_ldap_SASL)
+
+SRC_CFLAGS	:= $(rlm_ldap_CFLAGS)
+TGT_LDLIBS	:= $(rlm_ldap_LDLIBS)
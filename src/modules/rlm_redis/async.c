@@ -0,0 +1,940 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file async.c
+ * @brief Commands which share per-thread connections to each cluster node.
+ *
+ * Each thread opens at most one connection to each node in the cluster, using
+ * the hiredis asynchronous API, driven by the thread's event list.  Commands
+ * are sent without waiting for the replies to the ones before them, and the
+ * requests which sent them yield.
+ *
+ * Hiredis buffers commands until the connection is writable, so commands from
+ * all the requests a thread processes in one pass of its event loop are written
+ * to each node together, as a single pipeline.  Replies arrive in the order
+ * the commands were sent, and are passed to the callback of each command.
+ *
+ * Redirects and -TRYAGAIN are dealt with here, without blocking.  A command is
+ * sent again on the connection to the node we were redirected to (preceded by
+ * ASKING, for -ASK), or after retry_delay for -TRYAGAIN.  Key slots we receive
+ * -MOVED for are remembered by the thread, until the cluster is remapped.  The
+ * remap is done without blocking too: 'cluster slots' is sent to the node which
+ * issued the -MOVED, and the cluster is remapped when the response arrives.
+ *
+ * A command can't be recalled once it has been sent.  If its request stops
+ * waiting for it, the command is freed when its reply arrives.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "redis.h"
+#include "cluster.h"
+#include "async.h"
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/rad_assert.h>
+#include <hiredis/async.h>
+
+/** A thread's connection to a single cluster node
+ *
+ */
+typedef struct redis_async_conn {
+	fr_redis_thread_t	*thread;		//!< Thread this connection belongs to.
+
+	fr_socket_addr_t	addr;			//!< Address of the node.
+	char			name[INET6_ADDRSTRLEN];	//!< Buffer to hold IP string.
+
+	redisAsyncContext	*ac;			//!< Hiredis context, or NULL if we're not connected.
+	int			fd;			//!< File descriptor of the hiredis context.
+	bool			reading;		//!< Hiredis wants to know when fd is readable.
+	bool			writing;		//!< Hiredis wants to know when fd is writable.
+} redis_async_conn_t;
+
+struct fr_redis_thread {
+	fr_event_list_t		*el;			//!< Event list servicing the connections.
+	fr_redis_cluster_t	*cluster;		//!< Cluster we use to find the node for a key.
+	fr_redis_conf_t const	*conf;			//!< Database number, password, limits.
+	char const		*log_prefix;		//!< What to prepend to log messages.
+
+	rbtree_t		*conns;			//!< Connections, by node address.
+	redis_async_conn_t	**moved;		//!< Key slots we've received -MOVED for, and the
+							//!< connections to the nodes they moved to.
+	uint32_t		map_version;		//!< Version of the cluster map moved is relative to.
+	bool			remapping;		//!< We've sent 'cluster slots', and are waiting
+							//!< for the response.
+
+	uint32_t		in_flight;		//!< Commands waiting for a reply.
+	bool			freeing;		//!< The thread's connections are being closed.
+};
+
+struct fr_redis_command {
+	fr_redis_thread_t	*thread;		//!< Thread the command was sent by.
+	REQUEST			*request;		//!< Request waiting for the reply.
+							//!< NULL if it has stopped waiting.
+
+	int			argc;			//!< Number of arguments.
+	char const		**argv;			//!< Our copy of the arguments, as we may need
+							//!< to send them again.
+	size_t			*argv_len;		//!< Length of each argument.
+
+	uint8_t const		*key;			//!< Key the command operates on.
+	size_t			key_len;		//!< Length of the key.
+	uint16_t		key_slot;		//!< Key slot the key hashed to.
+
+	redis_async_conn_t	*conn;			//!< Connection the command was last sent on.
+	fr_event_timer_t	*retry_ev;		//!< Timer for sending the command again.
+
+	uint32_t		redirects;		//!< How many redirects have we followed.
+	uint32_t		retries;		//!< How many times we've received TRYAGAIN.
+	uint32_t		reconnects;		//!< How many times the connection failed.
+
+	bool			done;			//!< The command won't be sent again.
+	fr_redis_rcode_t	status;			//!< Of the command.
+	redisReply		*reply;			//!< Our copy of the reply.
+};
+
+/** Copy a reply, so it can outlive the callback hiredis passed it to
+ *
+ * The copy is allocated in the same way hiredis allocates replies, so it can be
+ * freed with #fr_redis_reply_free.
+ *
+ * @param[in] in	reply to copy.
+ * @return
+ *	- The copy.
+ *	- NULL if we ran out of memory.
+ */
+static redisReply *redis_reply_dup(redisReply const *in)
+{
+	redisReply	*out;
+	size_t		i;
+
+	out = malloc(sizeof(*out));
+	if (!out) return NULL;
+
+	memcpy(out, in, sizeof(*out));
+	out->str = NULL;
+	out->element = NULL;
+
+	if (in->str) {
+		out->str = malloc(in->len + 1);
+		if (!out->str) goto error;
+		memcpy(out->str, in->str, in->len + 1);
+	}
+
+	if (in->element) {
+		out->element = calloc(in->elements, sizeof(out->element[0]));
+		if (!out->element) goto error;
+
+		for (i = 0; i < in->elements; i++) {
+			if (!in->element[i]) continue;
+
+			out->element[i] = redis_reply_dup(in->element[i]);
+			if (!out->element[i]) goto error;
+		}
+	}
+
+	return out;
+
+error:
+	fr_redis_reply_free(out);
+	return NULL;
+}
+
+static int _redis_conn_cmp(void const *a, void const *b)
+{
+	int ret;
+
+	redis_async_conn_t const *my_a = a;
+	redis_async_conn_t const *my_b = b;
+
+	ret = fr_ipaddr_cmp(&my_a->addr.ipaddr, &my_b->addr.ipaddr);
+	if (ret != 0) return ret;
+
+	if (my_a->addr.port < my_b->addr.port) return -1;
+	if (my_a->addr.port > my_b->addr.port) return +1;
+
+	return 0;
+}
+
+static void _redis_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	redis_async_conn_t *conn = ctx;
+
+	redisAsyncHandleRead(conn->ac);
+}
+
+static void _redis_conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	redis_async_conn_t *conn = ctx;
+
+	redisAsyncHandleWrite(conn->ac);
+}
+
+/** The connection errored
+ *
+ * Freeing the context fails any commands waiting for replies on it.
+ */
+static void _redis_conn_errored(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	redis_async_conn_t	*conn = ctx;
+	fr_redis_thread_t	*thread = conn->thread;
+
+	ERROR("%s [%s:%i]: Connection failed", thread->log_prefix, conn->name, conn->addr.port);
+
+	if (conn->ac) redisAsyncFree(conn->ac);
+}
+
+/** Tell the event list which events hiredis is interested in
+ *
+ * @param[in] conn	to update the registration of.
+ */
+static void redis_conn_events(redis_async_conn_t *conn)
+{
+	fr_redis_thread_t *thread = conn->thread;
+
+	if (!conn->reading && !conn->writing) {
+		(void) fr_event_fd_delete(thread->el, conn->fd);
+		return;
+	}
+
+	if (fr_event_fd_insert(thread->el, conn->fd,
+			       conn->reading ? _redis_conn_readable : NULL,
+			       conn->writing ? _redis_conn_writable : NULL,
+			       _redis_conn_errored, conn) < 0) {
+		ERROR("%s [%s:%i]: Failed registering file descriptor %i: %s", thread->log_prefix,
+		      conn->name, conn->addr.port, conn->fd, fr_strerror());
+	}
+}
+
+/*
+ *	Hooks hiredis calls to start and stop watching the
+ *	connection's file descriptor.
+ */
+static void _redis_ev_add_read(void *privdata)
+{
+	redis_async_conn_t *conn = privdata;
+
+	if (conn->reading) return;
+	conn->reading = true;
+	redis_conn_events(conn);
+}
+
+static void _redis_ev_del_read(void *privdata)
+{
+	redis_async_conn_t *conn = privdata;
+
+	if (!conn->reading) return;
+	conn->reading = false;
+	redis_conn_events(conn);
+}
+
+static void _redis_ev_add_write(void *privdata)
+{
+	redis_async_conn_t *conn = privdata;
+
+	if (conn->writing) return;
+	conn->writing = true;
+	redis_conn_events(conn);
+}
+
+static void _redis_ev_del_write(void *privdata)
+{
+	redis_async_conn_t *conn = privdata;
+
+	if (!conn->writing) return;
+	conn->writing = false;
+	redis_conn_events(conn);
+}
+
+/** Hiredis is freeing the context
+ *
+ * Called after any commands waiting for replies have been failed.
+ */
+static void _redis_ev_cleanup(void *privdata)
+{
+	redis_async_conn_t *conn = privdata;
+
+	if (conn->reading || conn->writing) (void) fr_event_fd_delete(conn->thread->el, conn->fd);
+
+	conn->reading = false;
+	conn->writing = false;
+	conn->ac = NULL;
+	conn->fd = -1;
+}
+
+static void _redis_conn_connected(redisAsyncContext const *ac, int status)
+{
+	redis_async_conn_t	*conn = ac->data;
+	fr_redis_thread_t	*thread = conn->thread;
+
+	if (status != REDIS_OK) {
+		ERROR("%s [%s:%i]: Connection failed: %s", thread->log_prefix, conn->name, conn->addr.port,
+		      ac->errstr);
+		return;
+	}
+
+	DEBUG2("%s [%s:%i]: Connected (fd %i)", thread->log_prefix, conn->name, conn->addr.port, conn->fd);
+}
+
+static void _redis_conn_disconnected(redisAsyncContext const *ac, int status)
+{
+	redis_async_conn_t	*conn = ac->data;
+	fr_redis_thread_t	*thread = conn->thread;
+
+	if (status != REDIS_OK) {
+		ERROR("%s [%s:%i]: Connection lost: %s", thread->log_prefix, conn->name, conn->addr.port,
+		      ac->errstr);
+		return;
+	}
+
+	DEBUG2("%s [%s:%i]: Disconnected", thread->log_prefix, conn->name, conn->addr.port);
+}
+
+/** Check the reply to AUTH or SELECT
+ *
+ * If either fails, the connection is closed once the replies to the commands
+ * already sent on it have arrived.
+ */
+static void _redis_conn_setup(redisAsyncContext *ac, void *r, UNUSED void *privdata)
+{
+	redis_async_conn_t	*conn = ac->data;
+	fr_redis_thread_t	*thread = conn->thread;
+	redisReply		*reply = r;
+
+	if (!reply || (reply->type != REDIS_REPLY_ERROR)) return;
+
+	ERROR("%s [%s:%i]: Failed setting up connection: %s", thread->log_prefix, conn->name, conn->addr.port,
+	      reply->str);
+
+	redisAsyncDisconnect(ac);
+}
+
+/** Open a connection to a node
+ *
+ * The connection completes in the background.  Commands may be sent on it
+ * straight away, hiredis will write them once it's connected.
+ *
+ * @param[in] conn	to open.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int redis_conn_connect(redis_async_conn_t *conn)
+{
+	fr_redis_thread_t	*thread = conn->thread;
+	redisAsyncContext	*ac;
+
+	DEBUG2("%s [%s:%i]: Connecting", thread->log_prefix, conn->name, conn->addr.port);
+
+	ac = redisAsyncConnect(conn->name, conn->addr.port);
+	if (!ac) {
+		ERROR("%s [%s:%i]: Connection failed", thread->log_prefix, conn->name, conn->addr.port);
+		return -1;
+	}
+
+	if (ac->err) {
+		ERROR("%s [%s:%i]: Connection failed: %s", thread->log_prefix, conn->name, conn->addr.port,
+		      ac->errstr);
+		redisAsyncFree(ac);
+		return -1;
+	}
+
+	conn->ac = ac;
+	conn->fd = ac->c.fd;
+
+	ac->data = conn;
+	ac->ev.data = conn;
+	ac->ev.addRead = _redis_ev_add_read;
+	ac->ev.delRead = _redis_ev_del_read;
+	ac->ev.addWrite = _redis_ev_add_write;
+	ac->ev.delWrite = _redis_ev_del_write;
+	ac->ev.cleanup = _redis_ev_cleanup;
+
+	redisAsyncSetConnectCallback(ac, _redis_conn_connected);
+	redisAsyncSetDisconnectCallback(ac, _redis_conn_disconnected);
+
+	/*
+	 *	The socket becomes writable when the
+	 *	connection completes, or fails.
+	 */
+	_redis_ev_add_write(conn);
+
+	if (thread->conf->password) {
+		(void) redisAsyncCommand(ac, _redis_conn_setup, NULL, "AUTH %s", thread->conf->password);
+	}
+
+	if (thread->conf->database) {
+		(void) redisAsyncCommand(ac, _redis_conn_setup, NULL, "SELECT %i", thread->conf->database);
+	}
+
+	return 0;
+}
+
+/** Return the thread's connection to a node, opening it if necessary
+ *
+ * @param[in] thread	the connection belongs to.
+ * @param[in] addr	of the node.
+ * @return
+ *	- The connection.
+ *	- NULL if we couldn't connect.
+ */
+static redis_async_conn_t *redis_conn_get(fr_redis_thread_t *thread, fr_socket_addr_t const *addr)
+{
+	redis_async_conn_t	*conn, find;
+
+	memset(&find, 0, sizeof(find));
+	find.addr = *addr;
+
+	conn = rbtree_finddata(thread->conns, &find);
+	if (!conn) {
+		MEM(conn = talloc_zero(thread, redis_async_conn_t));
+		conn->thread = thread;
+		conn->addr = *addr;
+		conn->fd = -1;
+
+		if (!inet_ntop(addr->ipaddr.af, &addr->ipaddr.ipaddr, conn->name, sizeof(conn->name))) {
+			ERROR("%s: Invalid node address", thread->log_prefix);
+			talloc_free(conn);
+			return NULL;
+		}
+
+		if (!rbtree_insert(thread->conns, conn)) {
+			talloc_free(conn);
+			return NULL;
+		}
+	}
+
+	if (!conn->ac && (redis_conn_connect(conn) < 0)) return NULL;
+
+	return conn;
+}
+
+/** Forget where key slots moved to, if the cluster has been remapped since
+ *
+ * The new map already has the nodes the key slots moved to, and newer
+ * redirects than the ones we remember.
+ *
+ * @param[in] thread	to check.
+ */
+static void redis_thread_moved_check(fr_redis_thread_t *thread)
+{
+	uint32_t version = fr_redis_cluster_map_version(thread->cluster);
+
+	if (version == thread->map_version) return;
+
+	thread->map_version = version;
+	if (thread->moved) memset(thread->moved, 0, sizeof(*thread->moved) * KEY_SLOTS);
+}
+
+/** Process the response to 'cluster slots'
+ *
+ * @param[in] ac	'cluster slots' was sent on.
+ * @param[in] r		response.  NULL if the connection failed.
+ * @param[in] privdata	the #fr_redis_thread_t.
+ */
+static void _redis_thread_remap(redisAsyncContext *ac, void *r, void *privdata)
+{
+	fr_redis_thread_t	*thread = talloc_get_type_abort(privdata, fr_redis_thread_t);
+	redisReply		*reply = r;
+
+	thread->remapping = false;
+
+	if (thread->freeing) return;
+
+	if (!reply) {
+		ERROR("%s: Failed remapping cluster: %s", thread->log_prefix,
+		      ac->err ? ac->errstr : "Connection closed");
+		return;
+	}
+
+	switch (fr_redis_cluster_remap_apply(thread->cluster, reply)) {
+	case 1:
+		INFO("%s: Cluster remapped, map consists of %zu key ranges", thread->log_prefix, reply->elements);
+		redis_thread_moved_check(thread);
+		break;
+
+	case 0:
+		DEBUG2("%s: Ignoring cluster map, the cluster is being, or was just, remapped", thread->log_prefix);
+		break;
+
+	default:
+		ERROR("%s: Failed remapping cluster: %s", thread->log_prefix, fr_strerror());
+		break;
+	}
+}
+
+/** Remap the cluster, if it needs it, using a connection to one of its nodes
+ *
+ * @param[in] thread	remapping the cluster.
+ * @param[in] conn	to send 'cluster slots' on.
+ */
+static void redis_thread_remap(fr_redis_thread_t *thread, redis_async_conn_t *conn)
+{
+	if (thread->remapping || !conn->ac || !fr_redis_cluster_remap_due(thread->cluster)) return;
+
+	DEBUG("%s: Initiating cluster remap using %s:%i", thread->log_prefix, conn->name, conn->addr.port);
+
+	if (redisAsyncCommand(conn->ac, _redis_thread_remap, thread, "CLUSTER SLOTS") != REDIS_OK) {
+		ERROR("%s: Failed sending \"cluster slots\" to %s:%i", thread->log_prefix,
+		      conn->name, conn->addr.port);
+		return;
+	}
+	thread->remapping = true;
+}
+
+/** Find the connection to the node responsible for a command's key
+ *
+ * @param[in] cmd	to find the connection for.
+ * @return
+ *	- The connection.
+ *	- NULL if we couldn't connect.
+ */
+static redis_async_conn_t *redis_command_route(fr_redis_command_t *cmd)
+{
+	fr_redis_thread_t	*thread = cmd->thread;
+	REQUEST			*request = cmd->request;
+	fr_socket_addr_t	addr;
+
+	if (fr_redis_cluster_addr_by_key(&cmd->key_slot, &addr, thread->cluster, request,
+					 cmd->key, cmd->key_len) < 0) {
+		REDEBUG("%s", fr_strerror());
+		return NULL;
+	}
+
+	redis_thread_moved_check(thread);
+	if (thread->moved && thread->moved[cmd->key_slot]) {
+		redis_async_conn_t *conn = thread->moved[cmd->key_slot];
+
+		if (conn->ac || (redis_conn_connect(conn) == 0)) return conn;
+
+		thread->moved[cmd->key_slot] = NULL;
+	}
+
+	return redis_conn_get(thread, &addr);
+}
+
+static void _redis_command_reply(redisAsyncContext *ac, void *r, void *privdata);
+
+/** Queue a command on a connection
+ *
+ * @param[in] cmd	to send.
+ * @param[in] conn	to send it on.
+ * @param[in] asking	whether the command should be preceded by ASKING.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int redis_command_write(fr_redis_command_t *cmd, redis_async_conn_t *conn, bool asking)
+{
+	REQUEST *request = cmd->request;
+
+	if (!conn->ac && (redis_conn_connect(conn) < 0)) return -1;
+
+	RDEBUG2("[%s:%i] >>> Sending command", conn->name, conn->addr.port);
+
+	if (asking && (redisAsyncCommand(conn->ac, NULL, NULL, "ASKING") != REDIS_OK)) return -1;
+
+	if (redisAsyncCommandArgv(conn->ac, _redis_command_reply, cmd,
+				  cmd->argc, cmd->argv, cmd->argv_len) != REDIS_OK) return -1;
+
+	cmd->conn = conn;
+
+	return 0;
+}
+
+/** Hiredis has no further use for a command
+ *
+ * @param[in] cmd	which is done.
+ * @param[in] status	of the command.
+ * @param[in] reply	to the command.  Copied if the request is still waiting for it.
+ */
+static void redis_command_done(fr_redis_command_t *cmd, fr_redis_rcode_t status, redisReply *reply)
+{
+	fr_redis_thread_t *thread = cmd->thread;
+
+	cmd->done = true;
+	cmd->status = status;
+	thread->in_flight--;
+
+	if (!cmd->request) {
+		talloc_free(cmd);
+		return;
+	}
+
+	if (reply) {
+		cmd->reply = redis_reply_dup(reply);
+		if (!cmd->reply) {
+			fr_strerror_printf("Out of memory");
+			cmd->status = REDIS_RCODE_ERROR;
+		}
+	}
+
+	if (!thread->freeing) unlang_resumable(cmd->request);
+}
+
+/** Send a command again, after -TRYAGAIN or a connection failure
+ *
+ */
+static void _redis_command_retry(UNUSED struct timeval *now, void *ctx)
+{
+	fr_redis_command_t	*cmd = talloc_get_type_abort(ctx, fr_redis_command_t);
+	REQUEST			*request = cmd->request;
+	redis_async_conn_t	*conn;
+
+	cmd->retry_ev = NULL;
+
+	if (!request) {
+		redis_command_done(cmd, REDIS_RCODE_ERROR, NULL);
+		return;
+	}
+
+	conn = redis_command_route(cmd);
+	if (!conn || (redis_command_write(cmd, conn, false) < 0)) {
+		REDEBUG("Failed sending command again");
+		redis_command_done(cmd, REDIS_RCODE_RECONNECT, NULL);
+	}
+}
+
+/** Schedule a command to be sent again
+ *
+ * @param[in] cmd	to send again.
+ * @param[in] delay	before sending it.
+ */
+static void redis_command_retry(fr_redis_command_t *cmd, struct timeval const *delay)
+{
+	fr_redis_thread_t	*thread = cmd->thread;
+	REQUEST			*request = cmd->request;
+	struct timeval		now, when;
+
+	gettimeofday(&now, NULL);
+	fr_timeval_add(&when, &now, delay);
+
+	if (fr_event_timer_insert(thread->el, _redis_command_retry, cmd, &when, &cmd->retry_ev) < 0) {
+		REDEBUG("Failed scheduling retry: %s", fr_strerror());
+		redis_command_done(cmd, REDIS_RCODE_RECONNECT, NULL);
+	}
+}
+
+/** Follow a -MOVED or -ASK redirect
+ *
+ * @param[in] cmd	which was redirected.
+ * @param[in] status	#REDIS_RCODE_MOVE or #REDIS_RCODE_ASK.
+ * @param[in] reply	containing the redirect.
+ * @return
+ *	- 0 if the command was sent to the node we were redirected to.
+ *	- -1 on failure.
+ */
+static int redis_command_redirect(fr_redis_command_t *cmd, fr_redis_rcode_t status, redisReply *reply)
+{
+	fr_redis_thread_t	*thread = cmd->thread;
+	REQUEST			*request = cmd->request;
+	redis_async_conn_t	*conn;
+	fr_socket_addr_t	addr;
+	uint16_t		key_slot;
+
+	RDEBUG("Processing redirect \"%s\"", reply->str);
+	if (cmd->redirects++ >= thread->conf->max_redirects) {
+		REDEBUG("Reached max_redirects (%i)", cmd->redirects);
+		return -1;
+	}
+
+	if ((fr_redis_cluster_addr_by_redirect(&key_slot, &addr, thread->cluster, reply) < 0) ||
+	    (key_slot >= KEY_SLOTS)) {
+		REDEBUG("Invalid redirect: %s", fr_strerror());
+		return -1;
+	}
+
+	conn = redis_conn_get(thread, &addr);
+	if (!conn) return -1;
+
+	if (conn == cmd->conn) {
+		REDEBUG("%s:%i issued redirect to itself", conn->name, conn->addr.port);
+		return -1;
+	}
+
+	RDEBUG("Redirected from %s:%i to %s:%i", cmd->conn->name, cmd->conn->addr.port,
+	       conn->name, conn->addr.port);
+
+	/*
+	 *	Send commands for this key slot straight to
+	 *	the new node, until the cluster is remapped.
+	 */
+	if (status == REDIS_RCODE_MOVE) {
+		redis_thread_moved_check(thread);
+		if (!thread->moved) MEM(thread->moved = talloc_zero_array(thread, redis_async_conn_t *, KEY_SLOTS));
+		thread->moved[key_slot] = conn;
+
+		redis_thread_remap(thread, cmd->conn);
+	}
+
+	return redis_command_write(cmd, conn, (status == REDIS_RCODE_ASK));
+}
+
+/** Process the reply to a command
+ *
+ * @param[in] ac	the command was sent on.
+ * @param[in] r		reply to the command.  NULL if the connection failed.
+ * @param[in] privdata	the #fr_redis_command_t.
+ */
+static void _redis_command_reply(redisAsyncContext *ac, void *r, void *privdata)
+{
+	fr_redis_command_t	*cmd = talloc_get_type_abort(privdata, fr_redis_command_t);
+	fr_redis_thread_t	*thread = cmd->thread;
+	REQUEST			*request = cmd->request;
+	redisReply		*reply = r;
+	redis_async_conn_t	*conn = cmd->conn;
+	fr_redis_rcode_t	status;
+
+	if (!reply) {
+		fr_strerror_printf("Connection error: %s", ac->err ? ac->errstr : "Connection closed");
+		status = REDIS_RCODE_RECONNECT;
+	} else {
+		fr_redis_conn_t handle = { .handle = &ac->c };
+
+		status = fr_redis_command_status(&handle, reply);
+	}
+
+	if (!request || thread->freeing) {
+		redis_command_done(cmd, status, NULL);
+		return;
+	}
+
+	fr_redis_reply_print(L_DBG_LVL_3, reply, request, 0);
+	RDEBUG2("[%s:%i] <<< Returned: %s", conn->name, conn->addr.port,
+		fr_int2str(redis_rcodes, status, "<UNKNOWN>"));
+
+	switch (status) {
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		if (redis_command_redirect(cmd, status, reply) < 0) redis_command_done(cmd, REDIS_RCODE_ERROR, reply);
+		return;
+
+	/*
+	 *	Cluster's unstable, try again after retry_delay.
+	 */
+	case REDIS_RCODE_TRY_AGAIN:
+		if (cmd->retries++ >= thread->conf->max_retries) {
+			REDEBUG("Hit maximum retry attempts");
+			redis_command_done(cmd, REDIS_RCODE_ERROR, reply);
+			return;
+		}
+		redis_command_retry(cmd, &thread->conf->retry_delay);
+		return;
+
+	/*
+	 *	Connection's dead.  Try once more on a new
+	 *	connection, to whichever node is responsible
+	 *	for the key by then.  We can't send the command
+	 *	from here, as hiredis is still freeing the old one.
+	 */
+	case REDIS_RCODE_RECONNECT:
+	{
+		struct timeval now = { 0, 0 };
+
+		RERROR("Failed communicating with %s:%i: %s", conn->name, conn->addr.port, fr_strerror());
+
+		if (thread->moved) thread->moved[cmd->key_slot] = NULL;
+
+		if (cmd->reconnects++ > 0) {
+			REDEBUG("Hit maximum reconnect attempts");
+			redis_command_done(cmd, REDIS_RCODE_RECONNECT, NULL);
+			return;
+		}
+		redis_command_retry(cmd, &now);
+	}
+		return;
+
+	case REDIS_RCODE_NO_SCRIPT:
+	case REDIS_RCODE_ERROR:
+		REDEBUG("Command failed: %s", fr_strerror());
+		/* FALL-THROUGH */
+
+	default:
+		redis_command_done(cmd, status, reply);
+		return;
+	}
+}
+
+/** Stop the timer for sending a command again, if there is one
+ *
+ */
+static int _redis_command_free(fr_redis_command_t *cmd)
+{
+	if (cmd->retry_ev) (void) fr_event_timer_delete(cmd->thread->el, &cmd->retry_ev);
+
+	fr_redis_reply_free(cmd->reply);
+
+	return 0;
+}
+
+/** Send a command on the thread's connection to the node responsible for its key
+ *
+ * The caller should yield after this returns.  The request is marked as
+ * resumable when the command is done, and the outcome can be retrieved with
+ * #fr_redis_command_result.
+ *
+ * @param[in] thread	sending the command.
+ * @param[in] request	Current request.
+ * @param[in] key	the command operates on.  If NULL, the command is sent to a random node.
+ * @param[in] key_len	Length of the key.
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Command and arguments.  Copied, so may be freed once this returns.
+ * @param[in] argv_len	Length of each argument.  If NULL, the arguments must be \0 terminated.
+ * @return
+ *	- The command.  Must be released with #fr_redis_command_release.
+ *	- NULL if the command could not be sent.
+ */
+fr_redis_command_t *fr_redis_command_send(fr_redis_thread_t *thread, REQUEST *request,
+					  uint8_t const *key, size_t key_len,
+					  int argc, char const **argv, size_t const *argv_len)
+{
+	fr_redis_command_t	*cmd;
+	redis_async_conn_t	*conn;
+	int			i;
+
+	if (thread->in_flight >= REDIS_ASYNC_MAX_COMMANDS) {
+		REDEBUG("Too many commands in flight");
+		return NULL;
+	}
+
+	/*
+	 *	Commands belong to the thread, as they may
+	 *	have to outlive the request.
+	 */
+	MEM(cmd = talloc_zero(thread, fr_redis_command_t));
+	talloc_set_destructor(cmd, _redis_command_free);
+	cmd->thread = thread;
+	cmd->request = request;
+
+	cmd->argc = argc;
+	MEM(cmd->argv = talloc_array(cmd, char const *, argc));
+	MEM(cmd->argv_len = talloc_array(cmd, size_t, argc));
+	for (i = 0; i < argc; i++) {
+		cmd->argv_len[i] = argv_len ? argv_len[i] : strlen(argv[i]);
+		MEM(cmd->argv[i] = talloc_memdup(cmd->argv, argv[i], cmd->argv_len[i]));
+	}
+
+	if (key) {
+		MEM(cmd->key = talloc_memdup(cmd, key, key_len));
+		cmd->key_len = key_len;
+	}
+
+	conn = redis_command_route(cmd);
+	if (!conn || (redis_command_write(cmd, conn, false) < 0)) {
+		REDEBUG("Failed sending command");
+		talloc_free(cmd);
+		return NULL;
+	}
+	thread->in_flight++;
+
+	return cmd;
+}
+
+/** Return the outcome of a command
+ *
+ * @param[out] reply	to the command, or NULL if there was none.  Must be freed
+ *			with #fr_redis_reply_free.
+ * @param[in] cmd	which is done.
+ * @return the status of the command, as #fr_redis_cluster_state_next would.
+ */
+fr_redis_rcode_t fr_redis_command_result(redisReply **reply, fr_redis_command_t *cmd)
+{
+	rad_assert(cmd->done);
+
+	*reply = cmd->reply;
+	cmd->reply = NULL;
+
+	return cmd->status;
+}
+
+/** Stop waiting for a command, or free it once its outcome has been used
+ *
+ * If the command isn't done yet, it's left for the thread to free.  The request
+ * waiting for it will not be marked as resumable.
+ *
+ * @param[in] cmd	to release.
+ */
+void fr_redis_command_release(fr_redis_command_t *cmd)
+{
+	if (cmd->done) {
+		talloc_free(cmd);
+		return;
+	}
+
+	cmd->request = NULL;
+}
+
+static int _redis_conn_close(UNUSED void *ctx, void *data)
+{
+	redis_async_conn_t *conn = data;
+
+	if (conn->ac) redisAsyncFree(conn->ac);
+
+	return 0;
+}
+
+/** Close the thread's connections
+ *
+ * Requests can't be resumed after this, so any commands still outstanding are
+ * just forgotten.
+ */
+static int _redis_thread_free(fr_redis_thread_t *thread)
+{
+	thread->freeing = true;
+
+	rbtree_walk(thread->conns, RBTREE_IN_ORDER, _redis_conn_close, NULL);
+
+	return 0;
+}
+
+/** Set up asynchronous commands for a thread
+ *
+ * Connections to the cluster nodes are opened when the first command is sent
+ * to them.
+ *
+ * @param[in] ctx	to allocate the thread specific data in.
+ * @param[in] el	to service the connections with.
+ * @param[in] cluster	to send commands to.
+ * @param[in] conf	the cluster was allocated with.
+ * @return
+ *	- Thread specific data.  Free it to close the connections.
+ *	- NULL on failure.
+ */
+fr_redis_thread_t *fr_redis_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+					 fr_redis_cluster_t *cluster, fr_redis_conf_t const *conf)
+{
+	fr_redis_thread_t *thread;
+
+	thread = talloc_zero(ctx, fr_redis_thread_t);
+	if (!thread) return NULL;
+
+	thread->el = el;
+	thread->cluster = cluster;
+	thread->conf = conf;
+	thread->log_prefix = fr_redis_cluster_log_prefix(cluster);
+	thread->map_version = fr_redis_cluster_map_version(cluster);
+
+	thread->conns = rbtree_create(thread, _redis_conn_cmp, NULL, 0);
+	if (!thread->conns) {
+		talloc_free(thread);
+		return NULL;
+	}
+	talloc_set_destructor(thread, _redis_thread_free);
+
+	return thread;
+}
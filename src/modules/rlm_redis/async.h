@@ -0,0 +1,53 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file async.h
+ * @brief Commands which share per-thread connections to each cluster node.
+ *
+ * Only rlm_rediswho sends its commands this way.  rlm_redis, rlm_redis_ippool
+ * and rlm_cache_redis still reserve a pooled connection for each request.
+ * The latter two send MULTI/EXEC transactions, and ippool loads its scripts
+ * again on NOSCRIPT, none of which fit a single command per key.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+
+#ifndef LIBFREERADIUS_REDIS_ASYNC_H
+#define	LIBFREERADIUS_REDIS_ASYNC_H
+
+RCSIDH(async_h, "$Id$")
+
+#include <freeradius-devel/event.h>
+
+#define REDIS_ASYNC_MAX_COMMANDS	4096	//!< Maximum number of commands a thread may have in flight.
+
+typedef struct fr_redis_thread fr_redis_thread_t;
+typedef struct fr_redis_command fr_redis_command_t;
+
+fr_redis_thread_t	*fr_redis_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+					       fr_redis_cluster_t *cluster, fr_redis_conf_t const *conf);
+
+fr_redis_command_t	*fr_redis_command_send(fr_redis_thread_t *thread, REQUEST *request,
+					       uint8_t const *key, size_t key_len,
+					       int argc, char const **argv, size_t const *argv_len);
+
+fr_redis_rcode_t	fr_redis_command_result(redisReply **reply, fr_redis_command_t *cmd);
+
+void			fr_redis_command_release(fr_redis_command_t *cmd);
+
+#endif	/* LIBFREERADIUS_REDIS_ASYNC_H */
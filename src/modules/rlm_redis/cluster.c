@@ -150,8 +150,6 @@
 #include "crc16.h"
 #include <freeradius-devel/rad_assert.h>
 
-#define KEY_SLOTS		16384			//!< Maximum number of keyslots (should not change).
-
 #define MAX_SLAVES		5			//!< Maximum number of slaves associated
 							//!< with a keyslot.
 
@@ -248,6 +246,7 @@ struct fr_redis_cluster {
 	bool			remap_needed;		//!< Set true if at least one cluster node is definitely
 							//!< unreachable. Set false on successful remap.
 	time_t			last_updated;		//!< Last time the cluster mappings were updated.
+	uint32_t		map_version;		//!< Incremented each time a new map is applied.
 	CONF_SECTION		*module;		//!< Module configuration.
 
 	fr_redis_conf_t		*conf;			//!< Base configuration data such as the database number
@@ -740,6 +739,7 @@ do { \
 		}
 	}
 
+	cluster->map_version++;
 	cluster->remapping = false;
 	cluster->last_updated = time(NULL);
 
@@ -814,49 +814,20 @@ static int cluster_map_node_validate(redisReply *node, int map_idx, int node_idx
 	return CLUSTER_OP_SUCCESS;
 }
 
-/** Learn a new cluster layout by querying the node that issued the -MOVE
+/** Validate the response to a 'cluster slots' command
  *
- * Also validates the response from the Redis cluster, so we can be sure that
- * it's well formed, before doing more expensive operations.
+ * Checks the response is well formed, before doing more expensive operations.
  *
  * @note Errors may be retrieved with fr_strerror().
  *
- * @param[out] out Where to write cluster map.
- * @param[in] conn to use for learning the new cluster map.
+ * @param[in] reply to 'cluster slots'.
  * @return
- *	- CLUSTER_OP_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
  *	- CLUSTER_OP_SUCCESS on success.
- *	- CLUSTER_OP_FAILED if issuing the command resulted in an error.
- *	- CLUSTER_OP_NO_CONNECTION connection failure.
  *	- CLUSTER_OP_BAD_INPUT on validation failure (bad data returned from Redis).
  */
-static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
+static cluster_rcode_t cluster_map_validate(redisReply *reply)
 {
-	redisReply	*reply;
-	size_t		i = 0;
-
-	*out = NULL;
-
-	reply = redisCommand(conn->handle, "cluster slots");
-	switch (fr_redis_command_status(conn, reply)) {
-	case REDIS_RCODE_RECONNECT:
-		fr_redis_reply_free(reply);
-		fr_strerror_printf("No connections available");
-		return CLUSTER_OP_NO_CONNECTION;
-
-	case REDIS_RCODE_ERROR:
-	default:
-		if (reply && reply->type == REDIS_REPLY_ERROR) {
-			fr_redis_reply_free(reply);
-			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
-			return CLUSTER_OP_IGNORED;
-		}
-		fr_strerror_printf("Unknown client error");
-		return CLUSTER_OP_FAILED;
-
-	case REDIS_RCODE_SUCCESS:
-		break;
-	}
+	size_t		i;
 
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		fr_strerror_printf("Bad response to \"cluster slots\" command, expected array got %s",
@@ -884,7 +855,6 @@ static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
 			fr_strerror_printf("Cluster map %zu is wrong type, expected array got %s",
 				   	   i, fr_int2str(redis_reply_types, map->type, "<UNKNOWN>"));
 		error:
-			fr_redis_reply_free(reply);
 			return CLUSTER_OP_BAD_INPUT;
 		}
 
@@ -955,6 +925,57 @@ static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
 			if (cluster_map_node_validate(map->element[j], i, j - 2) < 0) goto error;
 		}
 	}
+
+	return CLUSTER_OP_SUCCESS;
+}
+
+/** Learn a new cluster layout by querying the node that issued the -MOVE
+ *
+ * Also validates the response from the Redis cluster, so we can be sure that
+ * it's well formed, before doing more expensive operations.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ *
+ * @param[out] out Where to write cluster map.
+ * @param[in] conn to use for learning the new cluster map.
+ * @return
+ *	- CLUSTER_OP_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
+ *	- CLUSTER_OP_SUCCESS on success.
+ *	- CLUSTER_OP_FAILED if issuing the command resulted in an error.
+ *	- CLUSTER_OP_NO_CONNECTION connection failure.
+ *	- CLUSTER_OP_BAD_INPUT on validation failure (bad data returned from Redis).
+ */
+static cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
+{
+	redisReply	*reply;
+
+	*out = NULL;
+
+	reply = redisCommand(conn->handle, "cluster slots");
+	switch (fr_redis_command_status(conn, reply)) {
+	case REDIS_RCODE_RECONNECT:
+		fr_redis_reply_free(reply);
+		fr_strerror_printf("No connections available");
+		return CLUSTER_OP_NO_CONNECTION;
+
+	case REDIS_RCODE_ERROR:
+	default:
+		if (reply && reply->type == REDIS_REPLY_ERROR) {
+			fr_redis_reply_free(reply);
+			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
+			return CLUSTER_OP_IGNORED;
+		}
+		fr_strerror_printf("Unknown client error");
+		return CLUSTER_OP_FAILED;
+
+	case REDIS_RCODE_SUCCESS:
+		break;
+	}
+
+	if (cluster_map_validate(reply) < 0) {
+		fr_redis_reply_free(reply);
+		return CLUSTER_OP_BAD_INPUT;
+	}
 	*out = reply;
 
 	return CLUSTER_OP_SUCCESS;
@@ -2085,6 +2106,150 @@ ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_addr_t *ou
 	return context.count;
 }
 
+/** Return the address of the master responsible for a key
+ *
+ * For clients which manage their own connections to the cluster nodes,
+ * and only need to know where to send a command.
+ *
+ * @note We return the IP address, as it's safe to use across cluster remaps.
+ *
+ * @param[out] key_slot		the key hashed to.
+ * @param[out] out		Where to write the address of the master.
+ * @param[in] cluster		to search for the key slot in.
+ * @param[in] request		The current request.
+ * @param[in] key		to hash.  If NULL, a random key slot is used.
+ * @param[in] key_len		Length of the key.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there are no nodes in the cluster.
+ */
+int fr_redis_cluster_addr_by_key(uint16_t *key_slot, fr_socket_addr_t *out, fr_redis_cluster_t *cluster,
+				 REQUEST *request, uint8_t const *key, size_t key_len)
+{
+	cluster_key_slot_t *slot;
+
+	if (rbtree_num_elements(cluster->used_nodes) == 0) {
+		fr_strerror_printf("No nodes in cluster");
+		return -1;
+	}
+
+	slot = cluster_slot_by_key(cluster, request, key, key_len);
+
+	pthread_mutex_lock(&cluster->mutex);
+	*out = cluster->node[slot->master].addr;
+	pthread_mutex_unlock(&cluster->mutex);
+
+	*key_slot = slot - cluster->key_slot;
+
+	return 0;
+}
+
+/** Return the address a -MOVED or -ASK redirect points to
+ *
+ * For clients which manage their own connections to the cluster nodes.
+ *
+ * A -MOVED redirect means our key slot map is out of date, so the cluster is
+ * marked as needing a remap.  It's performed by the next caller of
+ * #fr_redis_cluster_state_init, or by #fr_redis_cluster_remap_apply.
+ *
+ * @param[out] key_slot		the redirect is for.
+ * @param[out] out		Where to write the address of the node we were redirected to.
+ * @param[in] cluster		the redirect came from.
+ * @param[in] reply		containing the redirect.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the redirect couldn't be parsed.
+ */
+int fr_redis_cluster_addr_by_redirect(uint16_t *key_slot, fr_socket_addr_t *out, fr_redis_cluster_t *cluster,
+				      redisReply *reply)
+{
+	if (cluster_node_conf_from_redirect(key_slot, out, reply) != CLUSTER_OP_SUCCESS) return -1;
+
+	if (strncmp(REDIS_ERROR_MOVED_STR, reply->str, sizeof(REDIS_ERROR_MOVED_STR) - 1) == 0) {
+		cluster->remap_needed = true;
+	}
+
+	return 0;
+}
+
+/** Return the version of the key slot map
+ *
+ * The version changes each time the cluster is remapped, so clients which
+ * remember where key slots have moved to know when to forget them.
+ *
+ * @param[in] cluster to return the map version for.
+ * @return the map version.
+ */
+uint32_t fr_redis_cluster_map_version(fr_redis_cluster_t const *cluster)
+{
+	return cluster->map_version;
+}
+
+/** Check whether the cluster should be remapped now
+ *
+ * For clients which send 'cluster slots' themselves, and apply the
+ * response with #fr_redis_cluster_remap_apply.
+ *
+ * @param[in] cluster to check.
+ * @return
+ *	- true if a remap is needed, and none is in progress or was performed
+ *	  in the last second.
+ *	- false otherwise.
+ */
+bool fr_redis_cluster_remap_due(fr_redis_cluster_t const *cluster)
+{
+	return cluster->remap_needed && !cluster->remapping && (cluster->last_updated != time(NULL));
+}
+
+/** Remap the cluster using a response to 'cluster slots' the caller received
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ * @note Connection pools for nodes which are new to the cluster are created
+ *	 here, in the same way as for #fr_redis_cluster_state_init.
+ *
+ * @param[in,out] cluster	to remap.
+ * @param[in] reply		to 'cluster slots'.  Not freed.
+ * @return
+ *	- 1 if the cluster was remapped.
+ *	- 0 if the remap was ignored, because another is in progress, the cluster was
+ *	  remapped in the last second, or clustering isn't supported.
+ *	- -1 on failure.
+ */
+int fr_redis_cluster_remap_apply(fr_redis_cluster_t *cluster, redisReply *reply)
+{
+	cluster_rcode_t	ret;
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		cluster->remap_needed = false;
+		return 0;
+	}
+
+	if (cluster_map_validate(reply) < 0) return -1;
+
+	pthread_mutex_lock(&cluster->mutex);
+	if (cluster->remapping || (cluster->last_updated == time(NULL))) {
+		pthread_mutex_unlock(&cluster->mutex);
+		return 0;
+	}
+	ret = cluster_map_apply(cluster, reply);
+	if (ret == CLUSTER_OP_SUCCESS) cluster->remap_needed = false;	/* Change on successful remap */
+	pthread_mutex_unlock(&cluster->mutex);
+
+	if (ret < 0) return -1;
+
+	return 1;
+}
+
+/** Return the prefix to use for log messages about the cluster
+ *
+ * @param[in] cluster to return the log prefix for.
+ * @return the log prefix.
+ */
+char const *fr_redis_cluster_log_prefix(fr_redis_cluster_t const *cluster)
+{
+	return cluster->log_prefix;
+}
+
 /** Destroy mutex associated with cluster slots structure
  *
  * @param cluster being freed.
@@ -33,6 +33,8 @@ RCSIDH(cluster_h, "$Id$")
 
 #include <freeradius-devel/connection.h>
 
+#define KEY_SLOTS		16384			//!< Maximum number of keyslots (should not change).
+
 typedef struct fr_redis_cluster fr_redis_cluster_t;
 
 /** Redis connection sequence state
@@ -84,6 +86,19 @@ int fr_redis_cluster_pool_by_node_addr(fr_connection_pool_t **pool, fr_redis_clu
 ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_addr_t *out[],
 					   fr_redis_cluster_t *cluster, bool is_master, bool is_slave);
 
+/*
+ *	For clients which manage their own connections to
+ *	the cluster nodes.
+ */
+int fr_redis_cluster_addr_by_key(uint16_t *key_slot, fr_socket_addr_t *out, fr_redis_cluster_t *cluster,
+				 REQUEST *request, uint8_t const *key, size_t key_len);
+int fr_redis_cluster_addr_by_redirect(uint16_t *key_slot, fr_socket_addr_t *out, fr_redis_cluster_t *cluster,
+				      redisReply *reply);
+uint32_t fr_redis_cluster_map_version(fr_redis_cluster_t const *cluster);
+bool fr_redis_cluster_remap_due(fr_redis_cluster_t const *cluster);
+int fr_redis_cluster_remap_apply(fr_redis_cluster_t *cluster, redisReply *reply);
+char const *fr_redis_cluster_log_prefix(fr_redis_cluster_t const *cluster);
+
 /*
  *	Initialise a new cluster connection, and perform initial mapping.
  */
@@ -0,0 +1,550 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rediswho_async_test.c
+ * @brief Checks and benchmarks for rlm_rediswho's asynchronous commands.
+ *
+ * Runs against the test cluster used by src/tests/modules/redis, i.e. three
+ * masters, the first on port 30001.  Requests are sent through the module,
+ * and we play the part of the interpreter, resuming them when their commands
+ * are done.
+ *
+ * Key slots are migrated between the masters, to check -ASK and -MOVED
+ * redirects are followed, that the cluster is remapped after a -MOVED, and
+ * that the thread forgets where key slots moved to once it has been.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_rediswho.h"
+#include "crc16.h"
+
+#include <hiredis/hiredis.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Things the server library uses from radiusd.
+ */
+main_config_t main_config;
+
+/** A request we're sending through the module
+ *
+ */
+typedef struct {
+	REQUEST			*request;
+	fr_unlang_resume_t	resume;		//!< What the module said to call when the request's resumed.
+	void			*rctx;		//!< Passed to resume.
+	bool			resumable;	//!< unlang_resumable() was called.
+	rlm_rcode_t		rcode;		//!< What the module returned, once it's done.
+} test_request_t;
+
+static test_request_t	*requests;
+static int		num_requests = 10000;
+static int		errors;
+
+static char const	*server = "127.0.0.1";
+static int		port = 30001;
+
+/*
+ *	Stand in for the interpreter.  The module only yields from
+ *	mod_accounting, and its resume function returns YIELD when
+ *	it has sent another command.
+ */
+rlm_rcode_t unlang_yield(REQUEST *request, fr_unlang_resume_t callback, UNUSED fr_unlang_action_t action_callback,
+			 void const *ctx)
+{
+	test_request_t *t = &requests[request->number];
+
+	t->resume = callback;
+	memcpy(&t->rctx, &ctx, sizeof(t->rctx));
+
+	return RLM_MODULE_YIELD;
+}
+
+void unlang_resumable(REQUEST *request)
+{
+	test_request_t *t = &requests[request->number];
+
+	if (t->resumable) {
+		fprintf(stderr, "Request %" PRIu64 " was marked resumable twice\n", request->number);
+		errors++;
+	}
+	t->resumable = true;
+}
+
+/*
+ *	Send a command to a node, with a blocking connection.
+ */
+static redisReply *node_command(int node_port, char const *fmt, ...)
+{
+	redisContext	*ctx;
+	redisReply	*reply;
+	va_list		ap;
+
+	ctx = redisConnect(server, node_port);
+	if (!ctx || ctx->err) {
+		fprintf(stderr, "Failed connecting to %s:%i: %s\n", server, node_port,
+			ctx ? ctx->errstr : "Out of memory");
+		exit(1);
+	}
+
+	va_start(ap, fmt);
+	reply = redisvCommand(ctx, fmt, ap);
+	va_end(ap);
+	redisFree(ctx);
+
+	if (!reply) {
+		fprintf(stderr, "No reply from %s:%i\n", server, node_port);
+		exit(1);
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		fprintf(stderr, "%s:%i returned %s\n", server, node_port, reply->str);
+		exit(1);
+	}
+
+	return reply;
+}
+
+/*
+ *	Return the ports of the masters, and which one serves a key slot.
+ */
+static int cluster_masters(int masters[], int max, uint16_t key_slot, int *owner)
+{
+	redisReply	*reply;
+	size_t		i;
+	int		num = 0, j;
+
+	reply = node_command(port, "CLUSTER SLOTS");
+	for (i = 0; i < reply->elements; i++) {
+		redisReply	*map = reply->element[i];
+		int		master = map->element[2]->element[1]->integer;
+
+		if ((key_slot >= map->element[0]->integer) && (key_slot <= map->element[1]->integer)) *owner = master;
+
+		for (j = 0; j < num; j++) if (masters[j] == master) break;
+		if ((j == num) && (num < max)) masters[num++] = master;
+	}
+	freeReplyObject(reply);
+
+	return num;
+}
+
+/*
+ *	Move a key slot from one master to another.  If finish is false,
+ *	the slot is left half migrated, so the source node replies -ASK
+ *	for keys it doesn't have.
+ */
+static void slot_migrate(uint16_t key_slot, int from, int to, int masters[], int num_masters, bool finish)
+{
+	redisReply	*reply;
+	char		from_id[64], to_id[64];
+	int		i;
+
+	reply = node_command(from, "CLUSTER MYID");
+	strlcpy(from_id, reply->str, sizeof(from_id));
+	freeReplyObject(reply);
+
+	reply = node_command(to, "CLUSTER MYID");
+	strlcpy(to_id, reply->str, sizeof(to_id));
+	freeReplyObject(reply);
+
+	freeReplyObject(node_command(to, "CLUSTER SETSLOT %u IMPORTING %s", key_slot, from_id));
+	freeReplyObject(node_command(from, "CLUSTER SETSLOT %u MIGRATING %s", key_slot, to_id));
+
+	if (!finish) return;
+
+	for (i = 0; i < num_masters; i++) {
+		freeReplyObject(node_command(masters[i], "CLUSTER SETSLOT %u NODE %s", key_slot, to_id));
+	}
+}
+
+/*
+ *	Length of a user's session list, on the node which has it.
+ */
+static long long list_len(int node_port, char const *user, bool asking)
+{
+	redisContext	*ctx;
+	redisReply	*reply;
+	long long	len = -1;
+
+	ctx = redisConnect(server, node_port);
+	if (!ctx || ctx->err) {
+		fprintf(stderr, "Failed connecting to %s:%i\n", server, node_port);
+		exit(1);
+	}
+
+	if (asking) freeReplyObject(redisCommand(ctx, "ASKING"));
+
+	reply = redisCommand(ctx, "LLEN %s", user);
+	if (reply && (reply->type == REDIS_REPLY_INTEGER)) len = reply->integer;
+	if (reply) freeReplyObject(reply);
+	redisFree(ctx);
+
+	return len;
+}
+
+/*
+ *	Send num requests through the module, and process the events
+ *	until they're all done.
+ */
+static double run(rlm_rediswho_t *inst, rlm_rediswho_thread_t *thread, fr_event_list_t *el,
+		  char const *user, int num)
+{
+	int		i, pending = 0;
+	struct timeval	start, end;
+
+	MEM(requests = talloc_zero_array(NULL, test_request_t, num));
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < num; i++) {
+		test_request_t	*t = &requests[i];
+		REQUEST		*request;
+		char		buffer[64];
+
+		MEM(request = request_alloc(requests));
+		request->number = i;
+		MEM(request->packet = fr_radius_alloc(request, false));
+
+		if (user) {
+			strlcpy(buffer, user, sizeof(buffer));
+		} else {
+			snprintf(buffer, sizeof(buffer), "user%i", i);
+		}
+		fr_pair_make(request->packet, &request->packet->vps, "User-Name", buffer, T_OP_EQ);
+		snprintf(buffer, sizeof(buffer), "%08x", i);
+		fr_pair_make(request->packet, &request->packet->vps, "Acct-Session-Id", buffer, T_OP_EQ);
+		fr_pair_make(request->packet, &request->packet->vps, "Acct-Status-Type", "Start", T_OP_EQ);
+
+		t->request = request;
+		t->rcode = rlm_rediswho.methods[MOD_ACCOUNTING](inst, thread, request);
+		if (t->rcode == RLM_MODULE_YIELD) pending++;
+	}
+
+	while (pending > 0) {
+		if (fr_event_corral(el, true) < 0) {
+			fprintf(stderr, "Failed corralling events: %s\n", fr_strerror());
+			exit(1);
+		}
+		fr_event_service(el);
+
+		for (i = 0; i < num; i++) {
+			test_request_t *t = &requests[i];
+
+			if (!t->resumable) continue;
+
+			t->resumable = false;
+			t->rcode = t->resume(t->request, inst, thread, t->rctx);
+			if (t->rcode != RLM_MODULE_YIELD) pending--;
+		}
+	}
+
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < num; i++) {
+		if (requests[i].rcode == RLM_MODULE_OK) continue;
+
+		fprintf(stderr, "Request %i returned rcode %i\n", i, requests[i].rcode);
+		errors++;
+	}
+
+	TALLOC_FREE(requests);
+
+	return (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+}
+
+/*
+ *	Process events until the cluster map changes.
+ */
+static bool wait_for_remap(fr_event_list_t *el, fr_redis_cluster_t *cluster, uint32_t version)
+{
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		if (fr_redis_cluster_map_version(cluster) != version) return true;
+
+		if (fr_event_corral(el, false) > 0) fr_event_service(el);
+		usleep(10000);
+	}
+
+	return false;
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: rediswho_async_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <requests>          Number of requests to send at once.\n");
+	fprintf(stderr, "  -p <port>              Port of the first cluster node (defaults to 30001).\n");
+	fprintf(stderr, "  -s <server>            Address of the cluster nodes (defaults to $REDIS_TEST_SERVER, or 127.0.0.1).\n");
+	fprintf(stderr, "  -x                     Increase debugging level.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	char			filename[] = "/tmp/rediswho_async_test.XXXXXX";
+	int			fd;
+	FILE			*fp;
+	CONF_SECTION		*maincs, *cs;
+	rlm_rediswho_t		*inst;
+	rlm_rediswho_thread_t	*thread;
+	fr_event_list_t		*el;
+
+	char const		*user = "rediswho_async_test";
+	uint16_t		key_slot;
+	int			masters[16], num_masters, from, to;
+	uint32_t		version;
+	double			elapsed;
+	fr_redis_conn_t		*conn;
+	fr_connection_pool_t	*pool;
+	fr_socket_addr_t	addr;
+	redisReply		*reply;
+	REQUEST			*request;
+
+	if (getenv("REDIS_TEST_SERVER")) server = getenv("REDIS_TEST_SERVER");
+
+	while ((c = getopt(argc, argv, "D:hn:p:s:x")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num_requests = atoi(optarg);
+			if (num_requests <= 0) usage();
+			break;
+
+		case 'p':
+			port = atoi(optarg);
+			if ((port <= 0) || (port > UINT16_MAX)) usage();
+			break;
+
+		case 's':
+			server = optarg;
+			break;
+
+		case 'x':
+			fr_debug_lvl++;
+			rad_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fprintf(stderr, "Failed reading dictionaries: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	/*
+	 *	Keep three sessions per user, so the trim is sent too.
+	 */
+	fd = mkstemp(filename);
+	if ((fd < 0) || !(fp = fdopen(fd, "w"))) {
+		fprintf(stderr, "Failed creating %s: %s\n", filename, fr_syserror(errno));
+		exit(1);
+	}
+	fprintf(fp,
+		"rediswho {\n"
+		"	server = %s:%i\n"
+		"	trim_count = 2\n"
+		"	async = yes\n"
+		"	pool {\n"
+		"		start = 0\n"
+		"		min = 0\n"
+		"		max = 4\n"
+		"		retry_delay = 0\n"
+		"	}\n"
+		"	Start {\n"
+		"		insert = \"LPUSH %%{User-Name} %%{Acct-Session-Id}\"\n"
+		"		trim = \"LTRIM %%{User-Name} 0 2\"\n"
+		"		expire = \"EXPIRE %%{User-Name} 600\"\n"
+		"	}\n"
+		"}\n", server, port);
+	fclose(fp);
+
+	maincs = cf_section_alloc(autofree, "main", NULL);
+	if (cf_file_read(maincs, filename) < 0) {
+		fprintf(stderr, "Failed reading %s\n", filename);
+		unlink(filename);
+		exit(1);
+	}
+	unlink(filename);
+	cs = cf_section_sub_find(maincs, "rediswho");
+
+	MEM(inst = talloc_zero(autofree, rlm_rediswho_t));
+	if (cf_section_parse(cs, inst, rlm_rediswho.config) < 0) {
+		fprintf(stderr, "Failed parsing configuration\n");
+		exit(1);
+	}
+
+	el = fr_event_list_create(autofree, NULL, NULL);
+	MEM(thread = talloc_zero(autofree, rlm_rediswho_thread_t));
+
+	if ((rlm_rediswho.bootstrap(cs, inst) < 0) || (rlm_rediswho.instantiate(cs, inst) < 0) ||
+	    (rlm_rediswho.thread_instantiate(cs, inst, el, thread) < 0)) {
+		fprintf(stderr, "Failed instantiating rediswho: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	/*
+	 *	Many requests at once, for different users, so their
+	 *	commands are pipelined to every node.  Each user gets
+	 *	four sessions, so the later ones are trimmed.
+	 */
+	for (c = 0; c < 4; c++) {
+		elapsed = run(inst, thread, el, NULL, num_requests);
+		printf("%i requests in %.3fs, %.0f requests/s\n", num_requests, elapsed, num_requests / elapsed);
+	}
+
+	/*
+	 *	Check the lists were trimmed, on whichever node has them.
+	 */
+	for (c = 0; c < num_requests; c += (num_requests / 10) + 1) {
+		char		buffer[64];
+		uint16_t	slot;
+
+		snprintf(buffer, sizeof(buffer), "user%i", c);
+		slot = fr_crc16_xmodem((uint8_t const *)buffer, strlen(buffer)) & (KEY_SLOTS - 1);
+		num_masters = cluster_masters(masters, sizeof(masters) / sizeof(*masters), slot, &from);
+		if (list_len(from, buffer, false) != 3) {
+			fprintf(stderr, "%s has %lli sessions, expected 3\n", buffer, list_len(from, buffer, false));
+			errors++;
+		}
+	}
+
+	/*
+	 *	Move one key slot between masters.
+	 */
+	key_slot = fr_crc16_xmodem((uint8_t const *)user, strlen(user)) & (KEY_SLOTS - 1);
+	num_masters = cluster_masters(masters, sizeof(masters) / sizeof(*masters), key_slot, &from);
+	if (num_masters < 2) {
+		fprintf(stderr, "Need at least two masters, found %i\n", num_masters);
+		exit(1);
+	}
+	to = (masters[0] == from) ? masters[1] : masters[0];
+
+	freeReplyObject(node_command(from, "DEL %s", user));
+
+	/*
+	 *	Half way through the migration the source node
+	 *	replies -ASK, as it doesn't have the key.
+	 */
+	slot_migrate(key_slot, from, to, masters, num_masters, false);
+
+	run(inst, thread, el, user, 1);
+	if (list_len(to, user, true) != 1) {
+		fprintf(stderr, "-ASK wasn't followed to %i\n", to);
+		errors++;
+	}
+	printf("-ASK from %i to %i followed\n", from, to);
+
+	/*
+	 *	Finish the migration.  Our map still says the key slot
+	 *	is on the old node, which replies -MOVED, and the
+	 *	cluster is remapped.  Remaps are limited to one a
+	 *	second.
+	 */
+	slot_migrate(key_slot, from, to, masters, num_masters, true);
+	sleep(1);
+
+	version = fr_redis_cluster_map_version(inst->cluster);
+	run(inst, thread, el, user, 1);
+	if (list_len(to, user, false) != 2) {
+		fprintf(stderr, "-MOVED wasn't followed to %i\n", to);
+		errors++;
+	}
+
+	if (!wait_for_remap(el, inst->cluster, version)) {
+		fprintf(stderr, "Cluster wasn't remapped after -MOVED\n");
+		errors++;
+	}
+
+	MEM(request = request_alloc(autofree));
+	fr_redis_cluster_addr_by_key(&key_slot, &addr, inst->cluster, request, (uint8_t const *)user, strlen(user));
+	if (addr.port != to) {
+		fprintf(stderr, "Remapped cluster has key slot %u on %i, expected %i\n", key_slot, addr.port, to);
+		errors++;
+	}
+	printf("-MOVED from %i to %i followed, cluster remapped\n", from, to);
+
+	/*
+	 *	Move the key slot back, and remap the cluster without
+	 *	the thread seeing a -MOVED, as another thread would.
+	 *	The thread has to forget the key slot moved, as it's
+	 *	not allowed to follow any redirects.
+	 */
+	freeReplyObject(node_command(to, "DEL %s", user));
+	slot_migrate(key_slot, to, from, masters, num_masters, true);
+	sleep(1);
+
+	if (fr_redis_cluster_pool_by_node_addr(&pool, inst->cluster, &addr, false) < 0) {
+		fprintf(stderr, "No pool for %i\n", to);
+		exit(1);
+	}
+	conn = fr_connection_get(pool, NULL);
+	if (!conn) {
+		fprintf(stderr, "No connection to %i\n", to);
+		exit(1);
+	}
+	reply = redisCommand(conn->handle, "CLUSTER SLOTS");
+	fr_connection_release(pool, NULL, conn);
+
+	if (!reply || (fr_redis_cluster_remap_apply(inst->cluster, reply) != 1)) {
+		fprintf(stderr, "Failed remapping cluster: %s\n", fr_strerror());
+		exit(1);
+	}
+	fr_redis_reply_free(reply);
+
+	inst->conf.max_redirects = 0;
+	run(inst, thread, el, user, 1);
+	if (list_len(from, user, false) != 1) {
+		fprintf(stderr, "Command wasn't sent to %i after the cluster was remapped\n", from);
+		errors++;
+	}
+	printf("Key slot moved back to %i, thread followed the new map\n", from);
+
+	freeReplyObject(node_command(from, "DEL %s", user));
+
+	rlm_rediswho.thread_detach(thread);
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
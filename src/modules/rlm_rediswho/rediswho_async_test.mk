@@ -0,0 +1,17 @@
+#  This needs to be cleared explicitly, as the libfreeradius-redis.mk
+#  might not always be available, and the TARGETNAME from the previous
+#  target may stick around.
+TARGETNAME	:=
+-include $(top_builddir)/src/modules/rlm_redis/libfreeradius-redis.mk
+
+ifneq "${TARGETNAME}" ""
+  TARGETNAME	:= rediswho_async_test
+  TARGET	:= $(TARGETNAME)
+endif
+
+SOURCES		:= $(TARGETNAME).c
+SRC_CFLAGS	+= -I$(top_builddir)/src/modules/rlm_redis
+
+TGT_PREREQS	:= rlm_rediswho.a libfreeradius-redis.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	+= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -33,25 +33,7 @@ RCSID("$Id$")
 #include <freeradius-devel/modpriv.h>
 #include <freeradius-devel/rad_assert.h>
 
-#include "../rlm_redis/redis.h"
-#include "../rlm_redis/cluster.h"
-
-typedef struct rlm_rediswho {
-	fr_redis_conf_t		*conf;		//!< Connection parameters for the Redis server.
-						//!< Must be first field in this struct.
-
-	char const		*name;		//!< Instance name.
-	CONF_SECTION		*cs;
-	fr_redis_cluster_t	*cluster;	//!< Pool O pools
-
-	int			expiry_time;	//!< Expiry time in seconds if no updates are received for a user
-
-	int			trim_count;	//!< How many session updates to keep track of per user.
-
-	char const		*insert;	//!< Command for inserting session data
-	char const		*trim;		//!< Command for trimming the session list.
-	char const		*expire;	//!< Command for expiring entries.
-} rlm_rediswho_t;
+#include "rlm_rediswho.h"
 
 static CONF_PARSER section_config[] = {
 	{ FR_CONF_OFFSET("insert", PW_TYPE_STRING | PW_TYPE_REQUIRED | PW_TYPE_XLAT, rlm_rediswho_t, insert) },
@@ -65,6 +47,8 @@ static CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("trim_count", PW_TYPE_SIGNED, rlm_rediswho_t, trim_count), .dflt = "-1" },
 
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_rediswho_t, async), .dflt = "no" },
+
 	/*
 	 *	These all smash the same variables, because we don't care about them right now.
 	 *	In 3.1, we should have a way of saying "parse a set of sub-sections according to a template"
@@ -76,6 +60,64 @@ static CONF_PARSER module_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Expand a command, and find the key it operates on
+ */
+static int rediswho_command_expand(REQUEST *request, char const *fmt, char const *argv[], char *argv_buf,
+				   uint8_t const **key, size_t *key_len)
+{
+	int argc;
+
+	argc = rad_expand_xlat(request, fmt, MAX_REDIS_ARGS, argv, false, MAX_REDIS_COMMAND_LEN, argv_buf);
+ 	if (argc < 0) return -1;
+
+	/*
+	 *	If we've got multiple arguments, the second one is usually the key.
+	 *	The Redis docs say commands should be analysed first to get key
+	 *	positions, but this involves sending them to the server, which is
+	 *	just as expensive as sending them to the wrong server and receiving
+	 *	a redirect.
+	 */
+	if (argc > 1) {
+		*key = (uint8_t const *)argv[1];
+	 	*key_len = strlen((char const *)*key);
+	}
+
+	return argc;
+}
+
+/*
+ *	Get the number of sessions from the reply to a command
+ */
+static int rediswho_command_reply(REQUEST *request, redisReply *reply)
+{
+	int ret = -1;
+
+	switch (reply->type) {
+	case REDIS_REPLY_INTEGER:
+		RDEBUG2("Query response %lld", reply->integer);
+		if (reply->integer >= 0) ret = reply->integer;
+		break;
+
+	/*
+	 *	LTRIM replies +OK
+	 */
+	case REDIS_REPLY_STATUS:
+		RDEBUG2("Query response %s", reply->str);
+		ret = 0;
+		break;
+
+	case REDIS_REPLY_STRING:
+		REDEBUG2("Query response %s", reply->str);
+		break;
+
+	default:
+		break;
+	}
+
+	return ret;
+}
+
 /*
  *	Query the database executing a command with no result rows
  */
@@ -83,7 +125,7 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 {
 	fr_redis_conn_t		*conn;
 
-	int 			ret = -1;
+	int 			ret;
 
 	fr_redis_cluster_state_t	state;
 	fr_redis_rcode_t		status;
@@ -99,21 +141,9 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 
 	if (!fmt || !*fmt) return 0;
 
-	argc = rad_expand_xlat(request, fmt, MAX_REDIS_ARGS, argv, false, sizeof(argv_buf), argv_buf);
+	argc = rediswho_command_expand(request, fmt, argv, argv_buf, &key, &key_len);
  	if (argc < 0) return -1;
 
-	/*
-	 *	If we've got multiple arguments, the second one is usually the key.
-	 *	The Redis docs say commands should be analysed first to get key
-	 *	positions, but this involves sending them to the server, which is
-	 *	just as expensive as sending them to the wrong server and receiving
-	 *	a redirect.
-	 */
-	if (argc > 1) {
-		key = (uint8_t const *)argv[1];
-	 	key_len = strlen((char const *)key);
-	}
-
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, false);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
@@ -128,19 +158,7 @@ static int rediswho_command(rlm_rediswho_t const *inst, REQUEST *request, char c
 	}
 	if (!rad_cond_assert(reply)) goto error;
 
-	switch (reply->type) {
-	case REDIS_REPLY_INTEGER:
-		RDEBUG2("Query response %lld", reply->integer);
-		if (reply->integer > 0) ret = reply->integer;
-		break;
-
-	case REDIS_REPLY_STRING:
-		REDEBUG2("Query response %s", reply->str);
-		break;
-
-	default:
-		break;
-	}
+	ret = rediswho_command_reply(request, reply);
 	fr_redis_reply_free(reply);
 
 	return ret;
@@ -165,7 +183,159 @@ static rlm_rcode_t mod_accounting_all(rlm_rediswho_t const *inst, REQUEST *reque
 	return RLM_MODULE_OK;
 }
 
-static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+/** Which command of a section a request is waiting for
+ *
+ */
+typedef enum {
+	REDISWHO_INSERT = 0,
+	REDISWHO_TRIM,
+	REDISWHO_EXPIRE,
+	REDISWHO_DONE
+} rediswho_stage_t;
+
+/** State kept while a request's commands are in flight
+ *
+ */
+typedef struct {
+	char const		*insert;	//!< Command for inserting session data.
+	char const		*trim;		//!< Command for trimming the session list.
+	char const		*expire;	//!< Command for expiring entries.
+
+	rediswho_stage_t	stage;		//!< Command we're waiting for.
+	int			sessions;	//!< Returned by the insert command.
+	fr_redis_command_t	*cmd;		//!< Command in flight.
+} rediswho_async_ctx_t;
+
+/** Send the next command for a request
+ *
+ * Commands which aren't configured are skipped, as are trims which aren't needed.
+ *
+ * @return
+ *	- RLM_MODULE_YIELD if a command was sent.
+ *	- RLM_MODULE_OK if there are no more commands to send.
+ *	- RLM_MODULE_FAIL if the command could not be sent.
+ */
+static rlm_rcode_t rediswho_async_next(rlm_rediswho_t const *inst, rlm_rediswho_thread_t *t, REQUEST *request,
+				       rediswho_async_ctx_t *ctx)
+{
+	uint8_t	const		*key = NULL;
+	size_t			key_len = 0;
+
+	int			argc;
+	char const		*argv[MAX_REDIS_ARGS];
+	char			argv_buf[MAX_REDIS_COMMAND_LEN];
+
+	char const		*fmt;
+
+	for (; ctx->stage < REDISWHO_DONE; ctx->stage++) {
+		switch (ctx->stage) {
+		case REDISWHO_INSERT:
+			fmt = ctx->insert;
+			break;
+
+		/* Only trim if necessary */
+		case REDISWHO_TRIM:
+			if ((inst->trim_count < 0) || (ctx->sessions <= inst->trim_count)) continue;
+			fmt = ctx->trim;
+			break;
+
+		default:
+			fmt = ctx->expire;
+			break;
+		}
+		if (!fmt || !*fmt) continue;
+
+		argc = rediswho_command_expand(request, fmt, argv, argv_buf, &key, &key_len);
+		if (argc < 0) return RLM_MODULE_FAIL;
+
+		ctx->cmd = fr_redis_command_send(t->redis, request, key, key_len, argc, argv, NULL);
+		if (!ctx->cmd) return RLM_MODULE_FAIL;
+
+		return RLM_MODULE_YIELD;
+	}
+
+	return RLM_MODULE_OK;
+}
+
+/** Process the reply to a command, and send the next one
+ *
+ */
+static rlm_rcode_t mod_accounting_resume(REQUEST *request, void *instance, void *thread, void *rctx)
+{
+	rlm_rediswho_t const	*inst = instance;
+	rediswho_async_ctx_t	*ctx = talloc_get_type_abort(rctx, rediswho_async_ctx_t);
+	fr_redis_rcode_t	status;
+	redisReply		*reply;
+	rlm_rcode_t		rcode;
+	int			ret = -1;
+
+	status = fr_redis_command_result(&reply, ctx->cmd);
+	fr_redis_command_release(ctx->cmd);
+	ctx->cmd = NULL;
+
+	if (status != REDIS_RCODE_SUCCESS) {
+		RERROR("Failed inserting accounting data");
+	} else if (rad_cond_assert(reply)) {
+		ret = rediswho_command_reply(request, reply);
+	}
+	fr_redis_reply_free(reply);
+
+	if (ret < 0) {
+		talloc_free(ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	if (ctx->stage == REDISWHO_INSERT) ctx->sessions = ret;
+	ctx->stage++;
+
+	rcode = rediswho_async_next(inst, thread, request, ctx);
+	if (rcode != RLM_MODULE_YIELD) talloc_free(ctx);
+
+	return rcode;
+}
+
+/** Stop waiting for the command if the request is cancelled
+ *
+ */
+static void mod_accounting_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx,
+				  fr_state_action_t action)
+{
+	rediswho_async_ctx_t *ctx = talloc_get_type_abort(rctx, rediswho_async_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending Redis command");
+
+	if (ctx->cmd) fr_redis_command_release(ctx->cmd);
+	talloc_free(ctx);
+}
+
+/** Send the commands for a section on the thread's connections, yielding while they're in flight
+ *
+ */
+static rlm_rcode_t mod_accounting_async(rlm_rediswho_t const *inst, rlm_rediswho_thread_t *t, REQUEST *request,
+					char const *insert,
+					char const *trim,
+					char const *expire)
+{
+	rediswho_async_ctx_t	*ctx;
+	rlm_rcode_t		rcode;
+
+	MEM(ctx = talloc_zero(request, rediswho_async_ctx_t));
+	ctx->insert = insert;
+	ctx->trim = trim;
+	ctx->expire = expire;
+
+	rcode = rediswho_async_next(inst, t, request, ctx);
+	if (rcode != RLM_MODULE_YIELD) {
+		talloc_free(ctx);
+		return rcode;
+	}
+
+	return unlang_yield(request, mod_accounting_resume, mod_accounting_action, ctx);
+}
+
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_rediswho_t const	*inst = instance;
 	rlm_rcode_t		rcode;
@@ -196,6 +366,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *
 	trim = cf_pair_value(cf_pair_find(cs, "trim"));
 	expire = cf_pair_value(cf_pair_find(cs, "expire"));
 
+	if (inst->async) return mod_accounting_async(inst, thread, request, insert, trim, expire);
+
 	rcode = mod_accounting_all(inst, request, insert, trim, expire);
 
 	return rcode;
@@ -216,12 +388,53 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 {
 	rlm_rediswho_t *inst = instance;
 
-	inst->cluster = fr_redis_cluster_alloc(inst, conf, inst->conf, true, NULL, NULL, NULL);
+	inst->cluster = fr_redis_cluster_alloc(inst, conf, &inst->conf, true, NULL, NULL, NULL);
 	if (!inst->cluster) return -1;
 
 	return 0;
 }
 
+/** Set up the connections this thread's commands share
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_rediswho_t.
+ * @param[in] el	the thread's event list.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_rediswho_t		*inst = instance;
+	rlm_rediswho_thread_t	*t = thread;
+
+	if (!inst->async) return 0;
+
+	t->redis = fr_redis_thread_alloc(t, el, inst->cluster, &inst->conf);
+	if (!t->redis) {
+		ERROR("rlm_rediswho (%s) - Failed setting up asynchronous commands", inst->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Close the connections this thread's commands share
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_rediswho_thread_t *t = thread;
+
+	TALLOC_FREE(t->redis);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -231,14 +444,17 @@ static int mod_load(void)
 
 extern rad_module_t rlm_rediswho;
 rad_module_t rlm_rediswho = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "rediswho",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_rediswho_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.instantiate	= mod_instantiate,
-	.bootstrap	= mod_bootstrap,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "rediswho",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_rediswho_t),
+	.thread_inst_size	= sizeof(rlm_rediswho_thread_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.bootstrap		= mod_bootstrap,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting
 	},
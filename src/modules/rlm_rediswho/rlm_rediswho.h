@@ -0,0 +1,60 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_rediswho.h
+ * @brief Instance data for the rediswho module, for the module and its tests.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+#ifndef _RLM_REDISWHO_H
+#define _RLM_REDISWHO_H
+
+RCSIDH(rlm_rediswho_h, "$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+
+#include "../rlm_redis/redis.h"
+#include "../rlm_redis/cluster.h"
+#include "../rlm_redis/async.h"
+
+typedef struct rlm_rediswho {
+	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
+						//!< Must be first field in this struct.
+
+	char const		*name;		//!< Instance name.
+	CONF_SECTION		*cs;
+	fr_redis_cluster_t	*cluster;	//!< Pool O pools
+
+	int			expiry_time;	//!< Expiry time in seconds if no updates are received for a user
+
+	int			trim_count;	//!< How many session updates to keep track of per user.
+
+	bool			async;		//!< Send commands on connections shared by each thread.
+
+	char const		*insert;	//!< Command for inserting session data
+	char const		*trim;		//!< Command for trimming the session list.
+	char const		*expire;	//!< Command for expiring entries.
+} rlm_rediswho_t;
+
+typedef struct rlm_rediswho_thread {
+	fr_redis_thread_t	*redis;		//!< This thread's connections to the cluster nodes.
+} rlm_rediswho_thread_t;
+
+extern rad_module_t rlm_rediswho;
+#endif
@@ -0,0 +1,451 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file src/modules/rlm_sql/async.c
+ * @brief Queries which share a per-thread connection.
+ *
+ * Each thread opens one connection.  Queries are sent on it without waiting
+ * for the results of the ones before them, and the requests which sent them
+ * yield.  The driver returns results in the order the queries were sent, so
+ * when the connection becomes readable, we hand each result to the oldest
+ * query still waiting, and mark its request as resumable.
+ *
+ * A query can't be recalled once it has been sent.  If its request stops
+ * waiting for it, the query is left in the queue, and freed when its result
+ * arrives.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#define LOG_PREFIX "rlm_sql (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_sql.h"
+
+/** Mark the request waiting for a query as resumable
+ *
+ * @param[in] query	which is done.
+ * @param[in] timer	whether we were called from the query's timeout.
+ */
+static void sql_query_resume(rlm_sql_query_t *query, bool timer)
+{
+	if (query->resumed) return;
+
+	query->resumed = true;
+
+	/*
+	 *	The timer event is freed after its callback
+	 *	returns, so only delete it if it didn't fire.
+	 */
+	if (!timer) (void) unlang_event_timeout_delete(query->request, query);
+
+	unlang_resumable(query->request);
+}
+
+/** The thread has finished with a query
+ *
+ * If the request has already stopped waiting for it, nothing else needs it.
+ */
+static void sql_query_done(rlm_sql_query_t *query)
+{
+	query->done = true;
+
+	if (!query->request) {
+		talloc_free(query);
+		return;
+	}
+
+	sql_query_resume(query, false);
+}
+
+/** Close the thread's connection, failing all the queries sent on it
+ *
+ * @param[in] t		thread specific data.
+ * @param[in] error	to give as the reason the queries failed.
+ */
+static void sql_async_disconnect(rlm_sql_thread_t *t, char const *error)
+{
+	rlm_sql_t const	*inst = t->inst;
+	rlm_sql_query_t	*query;
+
+	if (!t->handle) return;
+
+	ERROR("Closing connection used for asynchronous queries (fd %i): %s", t->fd, error);
+
+	(void) fr_event_fd_delete(t->el, t->fd);
+
+	while ((query = fr_fifo_pop(t->queries))) {
+		query->rcode = RLM_SQL_RECONNECT;
+		query->error = talloc_typed_strdup(query, error);
+
+		sql_query_done(query);
+	}
+
+	TALLOC_FREE(t->handle);
+	t->fd = -1;
+	t->flushing = false;
+}
+
+static void _sql_async_readable(fr_event_list_t *el, int fd, void *ctx);
+static void _sql_async_writable(fr_event_list_t *el, int fd, void *ctx);
+static void _sql_async_errored(fr_event_list_t *el, int fd, void *ctx);
+
+/** Write any queries the driver is holding, and watch for writability if some are left
+ *
+ * @param[in] t		thread specific data.
+ */
+static void sql_async_flush(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const *inst = t->inst;
+
+	switch ((inst->driver->sql_async_flush)(t->handle, inst->config)) {
+	case 0:
+		if (!t->flushing) return;
+
+		if (fr_event_fd_insert(t->el, t->fd, _sql_async_readable, NULL, _sql_async_errored, t) < 0) {
+			sql_async_disconnect(t, fr_strerror());
+			return;
+		}
+		t->flushing = false;
+		return;
+
+	case 1:
+		if (t->flushing) return;
+
+		if (fr_event_fd_insert(t->el, t->fd, _sql_async_readable, _sql_async_writable,
+				       _sql_async_errored, t) < 0) {
+			sql_async_disconnect(t, fr_strerror());
+			return;
+		}
+		t->flushing = true;
+		return;
+
+	default:
+		sql_async_disconnect(t, "Failed sending queries");
+		return;
+	}
+}
+
+/** Read any results which have arrived, and wake up the requests waiting for them
+ *
+ * @param[in] el	fd was registered with.
+ * @param[in] fd	of the thread's connection.
+ * @param[in] ctx	The rlm_sql_thread_t specific to this thread.
+ */
+static void _sql_async_readable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	rlm_sql_thread_t	*t = ctx;
+	rlm_sql_t const		*inst = t->inst;
+	rlm_sql_query_t		*query;
+
+	if ((inst->driver->sql_async_read)(t->handle, inst->config) != RLM_SQL_OK) {
+		sql_async_disconnect(t, "Failed reading from server");
+		return;
+	}
+
+	/*
+	 *	Reading may have made room for the
+	 *	driver to write more.
+	 */
+	if (t->flushing) {
+		sql_async_flush(t);
+		if (!t->handle) return;
+	}
+
+	while ((query = fr_fifo_peek(t->queries))) {
+		int ret;
+
+		ret = (inst->driver->sql_async_result)(query, &query->rcode, &query->affected_rows, &query->error,
+						       t->handle, inst->config);
+		if (ret == 0) return;
+
+		if (ret < 0) {
+			sql_async_disconnect(t, "Failed reading result");
+			return;
+		}
+
+		(void) fr_fifo_pop(t->queries);
+
+		/*
+		 *	As with rlm_sql_query(), drivers which can't
+		 *	tell constraint violations apart from other
+		 *	errors get the alternative query.
+		 */
+		if ((query->rcode == RLM_SQL_ERROR) && !(inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY)) {
+			query->rcode = RLM_SQL_ALT_QUERY;
+		}
+
+		sql_query_done(query);
+	}
+}
+
+/** The thread's connection can take more data
+ *
+ * @param[in] el	fd was registered with.
+ * @param[in] fd	of the thread's connection.
+ * @param[in] ctx	The rlm_sql_thread_t specific to this thread.
+ */
+static void _sql_async_writable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	sql_async_flush(ctx);
+}
+
+/** The thread's connection errored
+ *
+ * @param[in] el	fd was registered with.
+ * @param[in] fd	of the thread's connection.
+ * @param[in] ctx	The rlm_sql_thread_t specific to this thread.
+ */
+static void _sql_async_errored(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	sql_async_disconnect(ctx, "Connection failed");
+}
+
+/** Open the thread's connection, and start watching it
+ *
+ * @param[in] t		thread specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int sql_async_connect(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const	*inst = t->inst;
+	struct timeval	timeout;
+	void		*mutable;
+	int		fd = -1;
+
+	memcpy(&mutable, &inst, sizeof(mutable));
+
+	timeout = fr_connection_pool_timeout(inst->pool);
+
+	t->handle = mod_conn_create(t, mutable, &timeout);
+	if (!t->handle) return -1;
+
+	if (((inst->driver->sql_async_init)(&fd, t->handle, inst->config) != RLM_SQL_OK) || (fd < 0)) {
+		ERROR("Failed setting up connection for asynchronous queries");
+		goto error;
+	}
+
+	if (fr_event_fd_insert(t->el, fd, _sql_async_readable, NULL, _sql_async_errored, t) < 0) {
+		ERROR("Failed registering file descriptor %i for asynchronous queries: %s", fd, fr_strerror());
+		goto error;
+	}
+	t->fd = fd;
+
+	DEBUG("Opened connection for asynchronous queries (fd %i)", fd);
+
+	return 0;
+
+error:
+	TALLOC_FREE(t->handle);
+
+	return -1;
+}
+
+/** A query took longer than query_timeout
+ *
+ * The query stays in the queue, as its result will still arrive.
+ */
+static void _sql_query_timeout(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			       UNUSED struct timeval *fired)
+{
+	rlm_sql_query_t *query = talloc_get_type_abort(ctx, rlm_sql_query_t);
+
+	RDEBUG2("Timed out waiting for query result");
+
+	query->rcode = RLM_SQL_ERROR;
+	query->error = talloc_typed_strdup(query, "Timed out while waiting for server to respond");
+
+	sql_query_resume(query, true);
+}
+
+/** Return the thread's connection, opening it if necessary
+ *
+ * Should be used to escape values for queries sent with #rlm_sql_query_async.
+ *
+ * @param[in] t		thread specific data.
+ * @return
+ *	- The connection.
+ *	- NULL if we couldn't connect.
+ */
+rlm_sql_handle_t *rlm_sql_async_handle(rlm_sql_thread_t *t)
+{
+	if (!t->handle) (void) sql_async_connect(t);
+
+	return t->handle;
+}
+
+/** Send a query on the thread's connection
+ *
+ * The caller should yield after this returns.  The request is marked as
+ * resumable when the result arrives, the connection fails, or the query
+ * takes longer than query_timeout.  The outcome is then in query->rcode.
+ *
+ * @note Must be called from a module method, as it sets a timeout for the request.
+ *
+ * @param[in] t		thread specific data.
+ * @param[in] request	Current request.
+ * @param[in] query_str	to send.  Should not be zero length.
+ * @return
+ *	- The query.  Must be released with #rlm_sql_query_release.
+ *	- NULL if the query could not be sent.
+ */
+rlm_sql_query_t *rlm_sql_query_async(rlm_sql_thread_t *t, REQUEST *request, char const *query_str)
+{
+	rlm_sql_t const	*inst = t->inst;
+	rlm_sql_query_t	*query;
+	sql_rcode_t	ret = RLM_SQL_RECONNECT;
+	int		i;
+
+	if (fr_fifo_num_elements(t->queries) >= SQL_ASYNC_MAX_QUERIES) {
+		REDEBUG("Too many queries in flight");
+		return NULL;
+	}
+
+	/*
+	 *	If the server closed the connection while it was
+	 *	idle, we may only find out now.  Try once more on a
+	 *	new one.
+	 */
+	for (i = 0; i < 2; i++) {
+		if (!rlm_sql_async_handle(t)) {
+			REDEBUG("No connection available for asynchronous queries");
+			return NULL;
+		}
+
+		RDEBUG2("Executing query: %s", query_str);
+
+		ret = (inst->driver->sql_async_send)(t->handle, inst->config, query_str);
+		if (ret != RLM_SQL_RECONNECT) break;
+
+		RWDEBUG("Failed sending query.  Reconnecting...");
+		sql_async_disconnect(t, "Failed sending query");
+	}
+
+	if (ret == RLM_SQL_OK) sql_async_flush(t);
+
+	if ((ret != RLM_SQL_OK) || !t->handle) {
+		REDEBUG("Failed sending query");
+		return NULL;
+	}
+
+	/*
+	 *	Queries belong to the thread, as they may have to
+	 *	outlive the request.
+	 */
+	MEM(query = talloc_zero(t, rlm_sql_query_t));
+	query->request = request;
+
+	(void) fr_fifo_push(t->queries, query);
+
+	if (inst->config->query_timeout) {
+		struct timeval now, when, timeout = { inst->config->query_timeout, 0 };
+
+		gettimeofday(&now, NULL);
+		fr_timeval_add(&when, &now, &timeout);
+
+		if (unlang_event_timeout_add(request, _sql_query_timeout, query, &when) < 0) {
+			REDEBUG("Failed setting timeout for query");
+			query->request = NULL;
+			return NULL;
+		}
+	}
+
+	RDEBUG("Waiting for query result...");
+
+	return query;
+}
+
+/** Stop waiting for a query, or free it once its result has been used
+ *
+ * If the result hasn't arrived yet, the query is left for the thread to free.
+ * The request waiting for it will not be marked as resumable.
+ *
+ * @param[in] query	to release.
+ */
+void rlm_sql_query_release(rlm_sql_query_t *query)
+{
+	if (!query->resumed) {
+		query->resumed = true;
+		(void) unlang_event_timeout_delete(query->request, query);
+	}
+
+	if (query->done) {
+		talloc_free(query);
+		return;
+	}
+
+	query->request = NULL;
+}
+
+/** Set up asynchronous queries for a thread
+ *
+ * @param[in] t		thread specific data.  inst and el must be set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_sql_async_init(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const *inst = t->inst;
+
+	rad_assert(t->inst && t->el);
+
+	t->fd = -1;
+	t->queries = fr_fifo_create(t, SQL_ASYNC_MAX_QUERIES, NULL);
+	if (!t->queries) {
+		ERROR("Failed creating query queue");
+		return -1;
+	}
+
+	/*
+	 *	As with a pool which starts with no connections, this
+	 *	isn't fatal.  We'll try again on the first query.
+	 */
+	if (sql_async_connect(t) < 0) WARN("Failed opening connection for asynchronous queries");
+
+	return 0;
+}
+
+/** Close the thread's connection
+ *
+ * Requests can't be resumed after this, so any queries still outstanding are
+ * just forgotten.
+ *
+ * @param[in] t		thread specific data.
+ */
+void rlm_sql_async_free(rlm_sql_thread_t *t)
+{
+	rlm_sql_query_t *query;
+
+	if (!t->queries) return;
+
+	while ((query = fr_fifo_pop(t->queries))) {
+		query->done = true;
+		if (!query->request) talloc_free(query);
+	}
+	TALLOC_FREE(t->queries);
+
+	if (t->handle) {
+		(void) fr_event_fd_delete(t->el, t->fd);
+		TALLOC_FREE(t->handle);
+		t->fd = -1;
+	}
+}
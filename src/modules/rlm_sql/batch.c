@@ -0,0 +1,812 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file src/modules/rlm_sql/batch.c
+ * @brief Accounting queries written in batches.
+ *
+ * Each thread queues the expanded accounting queries of its requests, and
+ * writes them in a single transaction when batch.size requests are queued,
+ * or when the oldest has waited batch.interval.  Consecutive INSERTs of a
+ * single row into the same columns are combined into one multi-row INSERT.
+ *
+ * Batches are handed to a writer thread through a pipe, so the worker's event
+ * loop doesn't wait for the database, and handed back the same way once
+ * they've been written.  If the writer is so far behind that the pipe is
+ * full, batches are queued until the event loop says it has room.
+ *
+ * If any query in the transaction fails, it's rolled back, and each request's
+ * queries are run on their own, trying the alternatives as acct_redundant()
+ * would.  Requests whose queries still can't be written have them all
+ * appended to batch.spool, in the same format as the query log, so they can
+ * be replayed later.
+ *
+ * Requests either wait for the transaction to be committed, or carry on as
+ * soon as their queries are queued.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#define LOG_PREFIX "rlm_sql (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include <freeradius-devel/rad_assert.h>
+
+#include <ctype.h>
+
+#include "rlm_sql.h"
+
+/** Entries handed to the writer thread together
+ *
+ */
+typedef struct sql_batch {
+	rlm_sql_batch_entry_t	**entries;	//!< Entries whose queries are written in one transaction.
+	uint32_t		num;		//!< Number of entries.
+} sql_batch_t;
+
+/** Find the part of an INSERT which other single row INSERTs may share
+ *
+ * @param[in] query	to examine.
+ * @return
+ *	- Length of query up to and including VALUES, if it's of the form
+ *	  "INSERT ... VALUES (...)", with nothing after the row.
+ *	- 0 otherwise.
+ */
+static size_t sql_batch_insert_prefix(char const *query)
+{
+	char const	*p = query, *values = NULL, *end;
+	char		quote = '\0';
+	int		depth = 0;
+
+	while (isspace((uint8_t) *p)) p++;
+	if (strncasecmp(p, "INSERT", 6) != 0) return 0;
+
+	/*
+	 *	Find VALUES, outside of any column list
+	 *	or quoted identifier.
+	 */
+	for (p += 6; *p; p++) {
+		if (quote) {
+			if (*p == quote) quote = '\0';
+			continue;
+		}
+
+		switch (*p) {
+		case '"':
+		case '`':
+			quote = *p;
+			continue;
+
+		case '\'':
+		case ';':
+			return 0;
+
+		case '(':
+			depth++;
+			continue;
+
+		case ')':
+			depth--;
+			continue;
+
+		default:
+			break;
+		}
+
+		if ((depth == 0) && isspace((uint8_t) p[-1]) && (strncasecmp(p, "VALUES", 6) == 0) &&
+		    (isspace((uint8_t) p[6]) || (p[6] == '('))) {
+			values = p + 6;
+			break;
+		}
+	}
+	if (!values) return 0;
+
+	/*
+	 *	The row must be the rest of the query, so there's
+	 *	no ON CONFLICT, RETURNING etc. which would apply to
+	 *	every row.
+	 */
+	p = values;
+	while (isspace((uint8_t) *p)) p++;
+	if (*p != '(') return 0;
+
+	for (depth = 0; *p; p++) {
+		if (quote) {
+			if (*p == '\\') {
+				if (p[1]) p++;
+				continue;
+			}
+			if (*p == quote) quote = '\0';
+			continue;
+		}
+
+		switch (*p) {
+		case '\'':
+		case '"':
+		case '`':
+			quote = *p;
+			continue;
+
+		case '(':
+			depth++;
+			continue;
+
+		case ')':
+			if (--depth == 0) goto row_end;
+			continue;
+
+		default:
+			continue;
+		}
+	}
+	return 0;
+
+row_end:
+	for (end = p + 1; *end; end++) if (!isspace((uint8_t) *end)) return 0;
+
+	return values - query;
+}
+
+/** We've finished with an entry
+ *
+ * If its request is waiting, mark it as resumable.  If nothing needs the entry, free it.
+ */
+static void sql_batch_done(rlm_sql_batch_entry_t *entry)
+{
+	entry->done = true;
+
+	if (!entry->request) {
+		talloc_free(entry);
+		return;
+	}
+
+	if (entry->yielded) unlang_resumable(entry->request);
+}
+
+/** Run a query which doesn't return rows
+ *
+ * @param[in] inst		of rlm_sql.
+ * @param[in,out] handle	to run the query on.  May be replaced if we reconnect.
+ * @param[in] query		to run.
+ * @param[out] affected		number of rows the query changed.
+ * @return the outcome of the query.
+ */
+static sql_rcode_t sql_batch_query(rlm_sql_t const *inst, rlm_sql_handle_t **handle, char const *query,
+				   int *affected)
+{
+	sql_rcode_t ret;
+
+	ret = rlm_sql_query(inst, NULL, handle, query);
+	if (ret != RLM_SQL_OK) return ret;
+
+	*affected = (inst->driver->sql_affected_rows)(*handle, inst->config);
+	(inst->driver->sql_finish_query)(*handle, inst->config);
+
+	return RLM_SQL_OK;
+}
+
+/** Run an entry's queries on their own
+ *
+ * As with acct_redundant(), if a query fails with a constraint violation,
+ * or changes no rows, the next alternative is tried.
+ */
+static rlm_rcode_t sql_batch_write(rlm_sql_t const *inst, rlm_sql_handle_t **handle, rlm_sql_batch_entry_t *entry)
+{
+	size_t	i;
+	int	affected = 0;
+
+	if (!*handle) *handle = fr_connection_get(inst->pool, NULL);
+	if (!*handle) return RLM_MODULE_FAIL;
+
+	for (i = 0; i < talloc_array_length(entry->queries); i++) {
+		switch (sql_batch_query(inst, handle, entry->queries[i], &affected)) {
+		case RLM_SQL_OK:
+			if (affected > 0) return RLM_MODULE_OK;
+			break;
+
+		case RLM_SQL_ALT_QUERY:
+			break;
+
+		case RLM_SQL_QUERY_INVALID:
+			return RLM_MODULE_INVALID;
+
+		default:
+			return RLM_MODULE_FAIL;
+		}
+	}
+
+	return RLM_MODULE_NOOP;
+}
+
+/** Write the queries of several entries in one transaction
+ *
+ * Entries are marked as written if they were committed.  If the connection
+ * was re-established part way through, the query which was run on the new
+ * connection was committed on its own, and everything before it was lost.
+ *
+ * @param[in] inst		of rlm_sql.
+ * @param[in,out] handle	to run the queries on.  May be replaced if we reconnect.
+ * @param[in] entries		to write.
+ * @param[in] num		number of entries.
+ * @return
+ *	- 0 if every entry was committed.
+ *	- -1 if the transaction failed.
+ */
+static int sql_batch_commit(rlm_sql_t const *inst, rlm_sql_handle_t **handle,
+			    rlm_sql_batch_entry_t **entries, uint32_t num)
+{
+	rlm_sql_handle_t	*conn;
+	uint32_t		i, j, k;
+	int			affected = 0;
+	char			*query;
+	sql_rcode_t		ret = RLM_SQL_OK;
+
+	if (rlm_sql_query(inst, NULL, handle, "BEGIN") != RLM_SQL_OK) return -1;
+	(inst->driver->sql_finish_query)(*handle, inst->config);
+	conn = *handle;
+
+	for (i = 0; i < num; i = j) {
+		rlm_sql_batch_entry_t *entry = entries[i];
+		size_t prefix_len = entry->prefix_len;
+
+		/*
+		 *	Find the INSERTs which can be combined with this one.
+		 */
+		j = i + 1;
+		if (prefix_len) {
+			while ((j < num) && (entries[j]->prefix_len == prefix_len) &&
+			       (memcmp(entries[j]->queries[0], entry->queries[0], prefix_len) == 0)) j++;
+		}
+
+		if ((j - i) > 1) {
+			MEM(query = talloc_strndup(NULL, entry->queries[0], prefix_len));
+			for (k = i; k < j; k++) {
+				if (k > i) MEM(query = talloc_strdup_append_buffer(query, ","));
+				MEM(query = talloc_strdup_append_buffer(query, entries[k]->queries[0] + prefix_len));
+			}
+
+			ret = sql_batch_query(inst, handle, query, &affected);
+			talloc_free(query);
+		} else {
+			size_t q;
+
+			/*
+			 *	Try the alternatives, as
+			 *	sql_batch_write() would.
+			 */
+			for (q = 0; q < talloc_array_length(entry->queries); q++) {
+				ret = sql_batch_query(inst, handle, entry->queries[q], &affected);
+				if ((ret != RLM_SQL_OK) || (affected > 0) || (*handle != conn)) break;
+			}
+		}
+
+		if (*handle != conn) {
+			/*
+			 *	The query ran on its own, on a new
+			 *	connection.  The transaction is gone.
+			 */
+			if ((ret == RLM_SQL_OK) && (affected > 0)) {
+				for (k = i; k < j; k++) {
+					entries[k]->written = true;
+					entries[k]->rcode = RLM_MODULE_OK;
+				}
+			}
+			return -1;
+		}
+
+		/*
+		 *	Some databases won't run anything else in the
+		 *	transaction after an error, and we can't tell
+		 *	which rows of a combined INSERT failed, so
+		 *	start again, one request at a time.
+		 */
+		if ((ret != RLM_SQL_OK) || ((j - i) > 1 && ((uint32_t) affected != (j - i)))) goto rollback;
+
+		for (k = i; k < j; k++) entries[k]->rcode = (affected > 0) ? RLM_MODULE_OK : RLM_MODULE_NOOP;
+	}
+
+	if (rlm_sql_query(inst, NULL, handle, "COMMIT") != RLM_SQL_OK) {
+		if (*handle != conn) return -1;
+		goto rollback;
+	}
+	(inst->driver->sql_finish_query)(*handle, inst->config);
+
+	for (i = 0; i < num; i++) entries[i]->written = true;
+
+	return 0;
+
+rollback:
+	if (rlm_sql_query(inst, NULL, handle, "ROLLBACK") == RLM_SQL_OK) {
+		(inst->driver->sql_finish_query)(*handle, inst->config);
+	}
+
+	return -1;
+}
+
+/** Append an entry's query, and its alternatives, to the spool file
+ *
+ * @return
+ *	- 0 if the queries were written.
+ *	- -1 if there's no spool file, or we couldn't write to it.
+ */
+static int sql_batch_spool(rlm_sql_t const *inst, rlm_sql_batch_entry_t *entry)
+{
+	char const	*filename = inst->config->batch.spool;
+	size_t		i, num = talloc_array_length(entry->queries);
+	char const	*end = ";\n";
+	struct iovec	*vector;
+	int		fd, ret = 0;
+
+	if (!filename || !*filename) return -1;
+
+	/*
+	 *	writev() only reads the buffers.
+	 */
+	MEM(vector = talloc_array(NULL, struct iovec, num * 2));
+	for (i = 0; i < num; i++) {
+		memcpy(&vector[i * 2].iov_base, &entry->queries[i], sizeof(vector[i * 2].iov_base));
+		vector[i * 2].iov_len = strlen(entry->queries[i]);
+		memcpy(&vector[(i * 2) + 1].iov_base, &end, sizeof(vector[(i * 2) + 1].iov_base));
+		vector[(i * 2) + 1].iov_len = 2;
+	}
+
+	fd = exfile_open(inst->ef, NULL, filename, 0640, true);
+	if (fd < 0) {
+		ERROR("Couldn't open spool file '%s': %s", filename, fr_syserror(errno));
+		talloc_free(vector);
+		return -1;
+	}
+
+	/*
+	 *	Loops over partial writes.
+	 */
+	if (fr_writev(fd, vector, num * 2, NULL) < 0) {
+		ERROR("Failed writing to spool file '%s': %s", filename, fr_syserror(errno));
+		ret = -1;
+	}
+
+	exfile_close(inst->ef, NULL, fd);
+	talloc_free(vector);
+
+	return ret;
+}
+
+/** An entry's queries couldn't be written to the database
+ *
+ * @param[in] inst	of rlm_sql.
+ * @param[in] entry	whose queries failed.
+ */
+static void sql_batch_failed(rlm_sql_t const *inst, rlm_sql_batch_entry_t *entry)
+{
+	entry->rcode = RLM_MODULE_FAIL;
+
+	if (sql_batch_spool(inst, entry) == 0) {
+		WARN("Spooled query: %s", entry->queries[0]);
+	} else {
+		ERROR("Lost query: %s", entry->queries[0]);
+	}
+}
+
+/** Write a batch
+ *
+ * Runs in the writer thread, or in the worker once the writer has stopped.
+ * Only the outcome of each entry is changed, as everything else belongs to
+ * the worker thread.
+ *
+ * @param[in] inst	of rlm_sql.
+ * @param[in] batch	to write.
+ */
+static void sql_batch_write_batch(rlm_sql_t const *inst, sql_batch_t *batch)
+{
+	rlm_sql_handle_t	*handle;
+	uint32_t		i, num = batch->num;
+
+	handle = fr_connection_get(inst->pool, NULL);
+	if (handle && ((num == 1) || (sql_batch_commit(inst, &handle, batch->entries, num) < 0))) {
+		if (num > 1) WARN("Failed writing batch of %u request(s) in one transaction, "
+				  "writing them individually", num);
+
+		for (i = 0; i < num; i++) {
+			if (batch->entries[i]->written) continue;
+
+			batch->entries[i]->rcode = sql_batch_write(inst, &handle, batch->entries[i]);
+		}
+	} else if (!handle) {
+		for (i = 0; i < num; i++) batch->entries[i]->rcode = RLM_MODULE_FAIL;
+	}
+	if (handle) fr_connection_release(inst->pool, NULL, handle);
+
+	/*
+	 *	The request still fails if it's waiting, so
+	 *	the policy can fall back to something else.
+	 */
+	for (i = 0; i < num; i++) {
+		if (batch->entries[i]->rcode == RLM_MODULE_FAIL) sql_batch_failed(inst, batch->entries[i]);
+	}
+}
+
+/** Write batches handed over by a worker thread, and hand them back
+ *
+ * Runs until the worker closes its end of the pipe, then hands back a
+ * NULL batch.
+ *
+ * @param[in] arg	thread specific data of the worker thread.
+ */
+static void *sql_batch_writer(void *arg)
+{
+	rlm_sql_thread_t	*t = arg;
+	rlm_sql_t const		*inst = t->inst;
+	sql_batch_t		*batch = NULL;
+	ssize_t			len;
+
+	for (;;) {
+		len = read(t->to_writer[0], &batch, sizeof(batch));
+		if ((len < 0) && (errno == EINTR)) continue;
+		if (len == 0) break;
+		if (len != sizeof(batch)) {
+			ERROR("Failed reading batch from worker: %s", (len < 0) ? fr_syserror(errno) : "Short read");
+			break;
+		}
+
+		sql_batch_write_batch(inst, batch);
+
+		while ((write(t->from_writer[1], &batch, sizeof(batch)) < 0) && (errno == EINTR));
+	}
+
+	batch = NULL;
+	while ((write(t->from_writer[1], &batch, sizeof(batch)) < 0) && (errno == EINTR));
+
+	return NULL;
+}
+
+/** Tell the requests in a batch that it's been written, and free it
+ *
+ * @param[in] batch	which was written.
+ */
+static void sql_batch_written(sql_batch_t *batch)
+{
+	uint32_t i;
+
+	for (i = 0; i < batch->num; i++) sql_batch_done(batch->entries[i]);
+
+	talloc_free(batch);
+}
+
+/** The writer has handed back batches
+ *
+ * @param[in] el	the thread's event list.
+ * @param[in] fd	of the pipe from the writer.
+ * @param[in] ctx	thread specific data.
+ */
+static void _sql_batch_readable(UNUSED fr_event_list_t *el, int fd, UNUSED void *ctx)
+{
+	sql_batch_t	*batch;
+
+	/*
+	 *	The NULL batch only arrives once we've stopped
+	 *	listening.
+	 */
+	while (read(fd, &batch, sizeof(batch)) == sizeof(batch)) {
+		if (batch) sql_batch_written(batch);
+	}
+}
+
+static void _sql_batch_writable(fr_event_list_t *el, int fd, void *ctx);
+
+/** Hand queued batches to the writer, and watch for room in the pipe if some are left
+ *
+ * The pipe is non-blocking, so the worker never waits for the writer.
+ *
+ * @param[in] t		thread specific data.
+ */
+static void sql_batch_handover(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const	*inst = t->inst;
+	sql_batch_t	*batch;
+	uint32_t	i;
+
+	while ((batch = fr_fifo_peek(t->pending))) {
+		ssize_t len;
+
+		len = write(t->to_writer[1], &batch, sizeof(batch));
+		if (len == sizeof(batch)) {
+			(void) fr_fifo_pop(t->pending);
+			continue;
+		}
+
+		if ((len < 0) && (errno == EINTR)) continue;
+		if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) break;
+
+		/*
+		 *	Pointers are written atomically, so anything
+		 *	else means the writer has gone.
+		 */
+		ERROR("Failed handing batch to writer: %s", (len < 0) ? fr_syserror(errno) : "Short write");
+		(void) fr_fifo_pop(t->pending);
+		for (i = 0; i < batch->num; i++) sql_batch_failed(inst, batch->entries[i]);
+		sql_batch_written(batch);
+	}
+
+	if (!batch) {
+		if (!t->handing_over) return;
+
+		(void) fr_event_fd_delete(t->el, t->to_writer[1]);
+		t->handing_over = false;
+		return;
+	}
+
+	if (t->handing_over) return;
+
+	/*
+	 *	If we can't watch the pipe, the batches stay
+	 *	queued until the next one is flushed.
+	 */
+	if (fr_event_fd_insert(t->el, t->to_writer[1], NULL, _sql_batch_writable, NULL, t) < 0) {
+		ERROR("Failed inserting pipe to writer into event loop: %s", fr_strerror());
+		return;
+	}
+	t->handing_over = true;
+}
+
+/** The writer has made room for more batches
+ *
+ * @param[in] el	the thread's event list.
+ * @param[in] fd	of the pipe to the writer.
+ * @param[in] ctx	thread specific data.
+ */
+static void _sql_batch_writable(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	sql_batch_handover(ctx);
+}
+
+/** Queue the thread's batch for the writer
+ *
+ * @param[in] t		thread specific data.
+ */
+static void sql_batch_flush(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const		*inst = t->inst;
+	sql_batch_t		*batch;
+	uint32_t		i, num = t->num_batched;
+
+	if (num == 0) return;
+
+	t->num_batched = 0;
+	if (t->flush_ev) (void) fr_event_timer_delete(t->el, &t->flush_ev);
+
+	DEBUG2("Writing batch of %u accounting request(s)", num);
+
+	MEM(batch = talloc_zero(t, sql_batch_t));
+	MEM(batch->entries = talloc_memdup(batch, t->batch, sizeof(t->batch[0]) * num));
+	batch->num = num;
+	memset(t->batch, 0, sizeof(t->batch[0]) * num);
+
+	if (fr_fifo_push(t->pending, batch) < 0) {
+		ERROR("Too many batches waiting for the writer");
+		for (i = 0; i < num; i++) sql_batch_failed(inst, batch->entries[i]);
+		sql_batch_written(batch);
+		return;
+	}
+
+	sql_batch_handover(t);
+}
+
+/** The oldest entry has waited long enough
+ *
+ * @param[in] now	The current time.
+ * @param[in] ctx	The rlm_sql_thread_t specific to this thread.
+ */
+static void _sql_batch_timeout(UNUSED struct timeval *now, void *ctx)
+{
+	sql_batch_flush(ctx);
+}
+
+/** Queue an accounting request's queries
+ *
+ * If the batch is full, it's written straight away.  Otherwise it's written
+ * when the first entry in it has waited for batch.interval.
+ *
+ * If batch.wait is set, the caller should check whether the entry is done.
+ * If it isn't, it should set entry->yielded, and yield.  The request is
+ * marked as resumable when the entry's queries have been written, and the
+ * outcome is then in entry->rcode.
+ *
+ * @param[in] t		thread specific data.
+ * @param[in] request	Current request.
+ * @param[in] queries	The query, followed by its alternatives.  Array and
+ *			strings are parented by the entry.
+ * @return
+ *	- The entry, if the request is waiting.  Must be released with
+ *	  #rlm_sql_batch_release.
+ *	- NULL if the request isn't waiting.
+ */
+rlm_sql_batch_entry_t *rlm_sql_batch_add(rlm_sql_thread_t *t, REQUEST *request, char **queries)
+{
+	rlm_sql_t const		*inst = t->inst;
+	rlm_sql_batch_entry_t	*entry;
+
+	/*
+	 *	Entries belong to the thread, as they may
+	 *	have to outlive the request.
+	 */
+	MEM(entry = talloc_zero(t, rlm_sql_batch_entry_t));
+	entry->queries = talloc_steal(entry, queries);
+	entry->prefix_len = sql_batch_insert_prefix(queries[0]);
+	if (inst->config->batch.wait) entry->request = request;
+
+	t->batch[t->num_batched++] = entry;
+
+	RDEBUG2("Queued query (%u in batch)", t->num_batched);
+
+	if (t->num_batched == 1) {
+		struct timeval now, when;
+
+		gettimeofday(&now, NULL);
+		fr_timeval_add(&when, &now, &inst->config->batch.interval);
+
+		if (fr_event_timer_insert(t->el, _sql_batch_timeout, t, &when, &t->flush_ev) < 0) {
+			RWDEBUG("Failed setting timer to write batch, writing it now");
+			sql_batch_flush(t);
+		}
+	}
+
+	if (t->num_batched >= inst->config->batch.size) sql_batch_flush(t);
+
+	return inst->config->batch.wait ? entry : NULL;
+}
+
+/** Stop waiting for an entry, or free it once its outcome has been used
+ *
+ * If the entry hasn't been written yet, it stays in the batch, and is
+ * freed once it has.
+ *
+ * @param[in] entry	to release.
+ */
+void rlm_sql_batch_release(rlm_sql_batch_entry_t *entry)
+{
+	if (entry->done) {
+		talloc_free(entry);
+		return;
+	}
+
+	entry->request = NULL;
+	entry->yielded = false;
+}
+
+/** Set up batching for a thread, and start its writer
+ *
+ * @param[in] t		thread specific data.  inst and el must be set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_sql_batch_init(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const *inst = t->inst;
+
+	rad_assert(t->inst && t->el);
+
+	t->to_writer[0] = t->to_writer[1] = -1;
+	t->from_writer[0] = t->from_writer[1] = -1;
+
+	t->batch = talloc_zero_array(t, rlm_sql_batch_entry_t *, inst->config->batch.size);
+	t->pending = fr_fifo_create(t, SQL_BATCH_MAX_PENDING, NULL);
+	if (!t->batch || !t->pending) {
+		ERROR("Failed allocating batch");
+		goto error;
+	}
+
+	if ((pipe(t->to_writer) < 0) || (pipe(t->from_writer) < 0)) {
+		ERROR("Failed creating pipes for writer: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if (fr_nonblock(t->to_writer[1]) < 0) {
+		ERROR("Failed setting pipe to writer to non-blocking: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if (fr_nonblock(t->from_writer[0]) < 0) {
+		ERROR("Failed setting pipe from writer to non-blocking: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if (fr_event_fd_insert(t->el, t->from_writer[0], _sql_batch_readable, NULL, NULL, t) < 0) {
+		ERROR("Failed inserting pipe from writer into event loop: %s", fr_strerror());
+		goto error;
+	}
+
+	if (pthread_create(&t->writer, NULL, sql_batch_writer, t) != 0) {
+		ERROR("Failed starting writer: %s", fr_syserror(errno));
+		fr_event_fd_delete(t->el, t->from_writer[0]);
+		goto error;
+	}
+
+	return 0;
+
+error:
+	if (t->to_writer[0] >= 0) close(t->to_writer[0]);
+	if (t->to_writer[1] >= 0) close(t->to_writer[1]);
+	if (t->from_writer[0] >= 0) close(t->from_writer[0]);
+	if (t->from_writer[1] >= 0) close(t->from_writer[1]);
+	TALLOC_FREE(t->batch);
+	TALLOC_FREE(t->pending);
+
+	return -1;
+}
+
+/** Write anything left in the thread's batch, and stop its writer
+ *
+ * Requests can't be resumed after this, so the ones waiting are forgotten.
+ *
+ * @param[in] t		thread specific data.
+ */
+void rlm_sql_batch_free(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const	*inst = t->inst;
+	sql_batch_t	*batch;
+	uint32_t	i;
+
+	if (!t->batch) return;
+
+	for (i = 0; i < t->num_batched; i++) rlm_sql_batch_release(t->batch[i]);
+
+	sql_batch_flush(t);
+
+	if (t->handing_over) {
+		(void) fr_event_fd_delete(t->el, t->to_writer[1]);
+		t->handing_over = false;
+	}
+
+	/*
+	 *	Stop the writer, and wait for everything it
+	 *	still has.  The requests of those entries are
+	 *	forgotten too.
+	 */
+	fr_event_fd_delete(t->el, t->from_writer[0]);
+	close(t->to_writer[1]);
+	fr_blocking(t->from_writer[0]);
+
+	for (;;) {
+		ssize_t len;
+
+		len = read(t->from_writer[0], &batch, sizeof(batch));
+		if ((len < 0) && (errno == EINTR)) continue;
+		if ((len != sizeof(batch)) || !batch) break;
+
+		for (i = 0; i < batch->num; i++) rlm_sql_batch_release(batch->entries[i]);
+		sql_batch_written(batch);
+	}
+
+	pthread_join(t->writer, NULL);
+
+	/*
+	 *	Batches the writer never got are written here,
+	 *	after the ones it had, so they stay in order.
+	 */
+	while ((batch = fr_fifo_pop(t->pending))) {
+		for (i = 0; i < batch->num; i++) rlm_sql_batch_release(batch->entries[i]);
+		sql_batch_write_batch(inst, batch);
+		sql_batch_written(batch);
+	}
+
+	close(t->to_writer[0]);
+	close(t->from_writer[0]);
+	close(t->from_writer[1]);
+
+	TALLOC_FREE(t->batch);
+	TALLOC_FREE(t->pending);
+}
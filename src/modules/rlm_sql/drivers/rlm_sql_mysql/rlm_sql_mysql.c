@@ -49,6 +49,16 @@ RCSID("$Id$")
 
 #include "rlm_sql.h"
 
+/*
+ *	MySQL 8 uses bool in MYSQL_BIND, and no longer defines my_bool.
+ */
+#if defined(MYSQL_VERSION_ID) && (MYSQL_VERSION_ID >= 80001) && !defined(MARIADB_BASE_VERSION)
+typedef bool my_bool;
+#endif
+
+#define MYSQL_STMT_COLUMN_SIZE	64	//!< Initial size of the buffer for each column of a prepared
+					//!< statement's result.  They grow to fit larger values.
+
 typedef enum {
 	SERVER_WARNINGS_AUTO = 0,
 	SERVER_WARNINGS_YES,
@@ -65,10 +75,19 @@ static const FR_NAME_NUMBER server_warnings_table[] = {
 typedef struct rlm_sql_mysql_conn {
 	MYSQL		db;
 	MYSQL		*sock;
-	MYSQL_RES	*result;
+	MYSQL_RES	*result;	//!< Result, or the result metadata of stmt.
 	rlm_sql_row_t	row;
+
+	MYSQL_STMT	*stmt;		//!< Prepared statement the current result came from.
+	MYSQL_BIND	*bind;		//!< Columns of stmt's result.  Parent of the buffers below.
+	unsigned long	*lengths;	//!< Length of each column in the current row.
+	my_bool		*is_null;	//!< Whether each column in the current row is NULL.
 } rlm_sql_mysql_conn_t;
 
+typedef struct rlm_sql_mysql_stmt {
+	MYSQL_STMT	*stmt;
+} rlm_sql_mysql_stmt_t;
+
 typedef struct rlm_sql_mysql_config {
 	char const *tls_ca_file;		//!< Path to the CA used to validate the server's certificate.
 	char const *tls_ca_path;		//!< Directory containing CAs that may be used to validate the
@@ -109,6 +128,12 @@ static int _sql_socket_destructor(rlm_sql_mysql_conn_t *conn)
 {
 	DEBUG2("Socket destructor called, closing socket");
 
+	/*
+	 *	Close any prepared statements before the
+	 *	connection they belong to.
+	 */
+	talloc_free_children(conn);
+
 	if (conn->sock){
 		mysql_close(conn->sock);
 	}
@@ -321,6 +346,25 @@ static sql_rcode_t sql_check_error(MYSQL *server, int client_errno)
 	return RLM_SQL_OK;
 }
 
+/** Analyse the error from a failed prepared statement call
+ *
+ * Errors from the server are recorded against the connection, errors
+ * found by the client library only against the statement.
+ *
+ * @param conn the statement belongs to.
+ * @param stmt which failed.
+ * @return an action for #rlm_sql_t to take.
+ */
+static sql_rcode_t sql_stmt_check_error(rlm_sql_mysql_conn_t *conn, MYSQL_STMT *stmt)
+{
+	sql_rcode_t rcode;
+
+	rcode = sql_check_error(conn->sock, mysql_stmt_errno(stmt));
+	if (rcode == RLM_SQL_OK) return RLM_SQL_ERROR;	/* It did fail */
+
+	return rcode;
+}
+
 static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
@@ -376,6 +420,8 @@ static int sql_num_fields(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *con
 	int num = 0;
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+	if (conn->stmt) return mysql_stmt_field_count(conn->stmt);
+
 #if MYSQL_VERSION_ID >= 32224
 	/*
 	 *	Count takes a connection handle
@@ -418,6 +464,8 @@ static int sql_num_rows(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *confi
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+	if (conn->stmt) return mysql_stmt_num_rows(conn->stmt);
+
 	if (conn->result) {
 		return mysql_num_rows(conn->result);
 	}
@@ -456,6 +504,60 @@ static sql_rcode_t sql_fields(char const **out[], rlm_sql_handle_t *handle, rlm_
 	return RLM_SQL_OK;
 }
 
+/** Fetch a row of a prepared statement's result
+ *
+ * Columns which didn't fit in their buffers are fetched again, into larger
+ * buffers, which are bound for the rows which follow.
+ */
+static sql_rcode_t sql_stmt_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	unsigned int		fields, i;
+	bool			rebind = false;
+
+	switch (mysql_stmt_fetch(conn->stmt)) {
+	case 0:
+	case MYSQL_DATA_TRUNCATED:
+		break;
+
+	case MYSQL_NO_DATA:
+		return RLM_SQL_OK;
+
+	default:
+		return sql_stmt_check_error(conn, conn->stmt);
+	}
+
+	fields = mysql_stmt_field_count(conn->stmt);
+	for (i = 0; i < fields; i++) {
+		MYSQL_BIND *bind = &conn->bind[i];
+
+		if (conn->is_null[i]) {
+			conn->row[i] = NULL;
+			continue;
+		}
+
+		if (conn->lengths[i] >= bind->buffer_length) {
+			bind->buffer_length = conn->lengths[i] + 1;
+			MEM(bind->buffer = talloc_realloc(conn->bind, bind->buffer, char, bind->buffer_length));
+			if (mysql_stmt_fetch_column(conn->stmt, bind, i, 0) != 0) {
+				return sql_stmt_check_error(conn, conn->stmt);
+			}
+			rebind = true;
+		}
+
+		conn->row[i] = bind->buffer;
+		conn->row[i][conn->lengths[i]] = '\0';
+	}
+
+	if (rebind && (mysql_stmt_bind_result(conn->stmt, conn->bind) != 0)) {
+		return sql_stmt_check_error(conn, conn->stmt);
+	}
+
+	*out = handle->row = conn->row;
+
+	return RLM_SQL_OK;
+}
+
 static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, rlm_sql_config_t *config)
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
@@ -464,6 +566,8 @@ static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, r
 
 	*out = NULL;
 
+	if (conn->stmt) return sql_stmt_fetch_row(out, handle);
+
 	/*
 	 *  Check pointer before de-referencing it.
 	 */
@@ -499,6 +603,16 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_conf
 		conn->result = NULL;
 	}
 
+	if (conn->stmt) {
+		mysql_stmt_free_result(conn->stmt);
+		conn->stmt = NULL;
+
+		TALLOC_FREE(conn->bind);
+		conn->lengths = NULL;
+		conn->is_null = NULL;
+		conn->row = NULL;
+	}
+
 	return RLM_SQL_OK;
 }
 
@@ -595,14 +709,23 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 	rad_assert(conn && conn->sock);
 	rad_assert(outlen > 0);
 
-	error = mysql_error(conn->sock);
-
 	/*
-	 *	Grab the error now in case it gets cleared on the next operation.
+	 *	Errors the client library found with a prepared
+	 *	statement are only recorded against the statement.
 	 */
-	if (error && (error[0] != '\0')) {
-		error = talloc_asprintf(ctx, "ERROR %u (%s): %s", mysql_errno(conn->sock), error,
-					mysql_sqlstate(conn->sock));
+	if (conn->stmt && (mysql_errno(conn->sock) == 0) && (mysql_stmt_errno(conn->stmt) != 0)) {
+		error = talloc_asprintf(ctx, "ERROR %u (%s): %s", mysql_stmt_errno(conn->stmt),
+					mysql_stmt_error(conn->stmt), mysql_stmt_sqlstate(conn->stmt));
+	} else {
+		error = mysql_error(conn->sock);
+
+		/*
+		 *	Grab the error now in case it gets cleared on the next operation.
+		 */
+		if (error && (error[0] != '\0')) {
+			error = talloc_asprintf(ctx, "ERROR %u (%s): %s", mysql_errno(conn->sock), error,
+						mysql_sqlstate(conn->sock));
+		}
 	}
 
 	/*
@@ -656,10 +779,18 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
  */
 static sql_rcode_t sql_finish_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config)
 {
-#if (MYSQL_VERSION_ID >= 40100)
 	rlm_sql_mysql_conn_t	*conn = handle->conn;
+#if (MYSQL_VERSION_ID >= 40100)
 	int			ret;
 	MYSQL_RES		*result;
+#endif
+
+	/*
+	 *	Prepared statements only ever produce one result.
+	 */
+	if (conn->stmt) return sql_free_result(handle, config);
+
+#if (MYSQL_VERSION_ID >= 40100)
 
 	/*
 	 *	If there's no result associated with the
@@ -704,9 +835,165 @@ static int sql_affected_rows(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+	if (conn->stmt) return mysql_stmt_affected_rows(conn->stmt);
+
 	return mysql_affected_rows(conn->sock);
 }
 
+static int _sql_stmt_destructor(rlm_sql_mysql_stmt_t *stmt)
+{
+	mysql_stmt_close(stmt->stmt);
+
+	return 0;
+}
+
+static sql_rcode_t sql_prepare(void **out, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+			       char const *query, UNUSED int num_params)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	rlm_sql_mysql_stmt_t	*stmt;
+	sql_rcode_t		rcode;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	MEM(stmt = talloc_zero(conn, rlm_sql_mysql_stmt_t));
+	stmt->stmt = mysql_stmt_init(conn->sock);
+	if (!stmt->stmt) {
+		talloc_free(stmt);
+		return sql_check_error(conn->sock, CR_OUT_OF_MEMORY);
+	}
+	talloc_set_destructor(stmt, _sql_stmt_destructor);
+
+	if (mysql_stmt_prepare(stmt->stmt, query, strlen(query)) != 0) {
+		rcode = sql_stmt_check_error(conn, stmt->stmt);
+		talloc_free(stmt);
+		return rcode;
+	}
+
+	*out = stmt;
+
+	return RLM_SQL_OK;
+}
+
+/** Bind params to a prepared statement, and execute it
+ *
+ * The statement is recorded in the connection, so the other callbacks
+ * use it in place of the connection, until the result is freed.
+ */
+static sql_rcode_t sql_stmt_execute(rlm_sql_handle_t *handle, rlm_sql_config_t *config, rlm_sql_mysql_stmt_t *stmt,
+				    value_box_t const *params[], int num_params)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	MYSQL_BIND		*bind;
+	int			i;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	sql_free_result(handle, config);
+
+	MEM(bind = talloc_zero_array(conn, MYSQL_BIND, num_params));
+	for (i = 0; i < num_params; i++) {
+		value_box_t const	*param = params[i];
+		void const		*value;
+
+		if (!param) {
+			bind[i].buffer_type = MYSQL_TYPE_NULL;
+			continue;
+		}
+
+		switch (param->type) {
+		case PW_TYPE_STRING:
+			bind[i].buffer_type = MYSQL_TYPE_STRING;
+			bind[i].buffer_length = param->length;
+			value = param->datum.strvalue;
+			break;
+
+		case PW_TYPE_INTEGER64:
+			bind[i].buffer_type = MYSQL_TYPE_LONGLONG;
+			bind[i].is_unsigned = 1;
+			value = &param->datum.integer64;
+			break;
+
+		case PW_TYPE_SIGNED:
+			bind[i].buffer_type = MYSQL_TYPE_LONG;
+			value = &param->datum.sinteger;
+			break;
+
+		default:
+			rad_assert(0);
+			talloc_free(bind);
+			return RLM_SQL_ERROR;
+		}
+
+		/*
+		 *	MySQL only reads input buffers.
+		 */
+		memcpy(&bind[i].buffer, &value, sizeof(bind[i].buffer));
+	}
+
+	conn->stmt = stmt->stmt;
+	if ((mysql_stmt_bind_param(conn->stmt, bind) != 0) || (mysql_stmt_execute(conn->stmt) != 0)) {
+		talloc_free(bind);
+		return sql_stmt_check_error(conn, conn->stmt);
+	}
+	talloc_free(bind);
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t sql_execute(rlm_sql_handle_t *handle, rlm_sql_config_t *config, void *stmt,
+			       value_box_t const *params[], int num_params)
+{
+	return sql_stmt_execute(handle, config, stmt, params, num_params);
+}
+
+/** Execute a prepared select, and bind buffers for the columns of its result
+ *
+ */
+static sql_rcode_t sql_select_execute(rlm_sql_handle_t *handle, rlm_sql_config_t *config, void *stmt,
+				      value_box_t const *params[], int num_params)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	sql_rcode_t		rcode;
+	unsigned int		fields, i;
+
+	rcode = sql_stmt_execute(handle, config, stmt, params, num_params);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	if (mysql_stmt_store_result(conn->stmt) != 0) return sql_stmt_check_error(conn, conn->stmt);
+
+	/*
+	 *	Column names, for sql_fields.
+	 */
+	conn->result = mysql_stmt_result_metadata(conn->stmt);
+	if (!conn->result) return RLM_SQL_OK;
+
+	fields = mysql_num_fields(conn->result);
+
+	MEM(conn->bind = talloc_zero_array(conn, MYSQL_BIND, fields));
+	MEM(conn->lengths = talloc_zero_array(conn->bind, unsigned long, fields));
+	MEM(conn->is_null = talloc_zero_array(conn->bind, my_bool, fields));
+	MEM(conn->row = talloc_zero_array(conn->bind, char *, fields));
+
+	for (i = 0; i < fields; i++) {
+		conn->bind[i].buffer_type = MYSQL_TYPE_STRING;
+		conn->bind[i].buffer_length = MYSQL_STMT_COLUMN_SIZE;
+		MEM(conn->bind[i].buffer = talloc_array(conn->bind, char, MYSQL_STMT_COLUMN_SIZE));
+		conn->bind[i].length = &conn->lengths[i];
+		conn->bind[i].is_null = &conn->is_null[i];
+	}
+
+	if (mysql_stmt_bind_result(conn->stmt, conn->bind) != 0) return sql_stmt_check_error(conn, conn->stmt);
+
+	return RLM_SQL_OK;
+}
+
 static size_t sql_escape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, void *arg)
 {
 	size_t			inlen;
@@ -747,5 +1034,8 @@ rlm_sql_driver_t rlm_sql_mysql = {
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
 	.sql_finish_select_query	= sql_finish_query,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+	.sql_prepare			= sql_prepare,
+	.sql_execute			= sql_execute,
+	.sql_select_execute		= sql_select_execute
 };
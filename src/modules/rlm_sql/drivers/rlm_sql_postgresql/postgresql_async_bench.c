@@ -0,0 +1,767 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file postgresql_async_bench.c
+ * @brief Compare blocking and pipelined accounting inserts, using the PostgreSQL driver.
+ *
+ * We play the part of a worker thread.  First each request's insert is run
+ * on a pooled connection with rlm_sql_query(), which blocks the worker until
+ * the result arrives.  Then the inserts are sent with rlm_sql_query_async(),
+ * and the worker services its event list while up to -q of them are in
+ * flight on one connection.
+ *
+ * 1 in 10 inserts is made to fail, and each result is checked against the
+ * request it was sent for, so a result handed to the wrong request, or a
+ * failure affecting the queries around it, is an error.
+ *
+ * With -s, the inserts are sent to a real server, which must have an empty
+ * radacct table with a unique acctsessionid.  The inserts meant to fail all
+ * reuse one session ID.  Otherwise a fake server is started in a thread of
+ * its own.  It speaks just enough of protocol version 3 for libpq, and models
+ * a round trip (-r) for each batch of messages it reads, and the cost of each
+ * statement (-c).
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+#include <pthread.h>
+#include <poll.h>
+
+#include "rlm_sql.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define FAKE_MAX_CONNS	16
+#define USEC		1000000
+
+/** Messages waiting to be written to a client
+ *
+ */
+typedef struct fake_out {
+	struct timeval		when;		//!< When the server would have finished with them.
+	uint8_t			*data;
+	size_t			len;
+	struct fake_out		*next;
+} fake_out_t;
+
+/** A client of the fake server
+ *
+ */
+typedef struct fake_conn {
+	int			fd;		//!< -1 if the slot is free.
+	bool			started;	//!< Whether we've seen the startup message.
+	bool			failed;		//!< Skip messages until the next Sync.
+	char			query[256];	//!< From the last Parse message.
+
+	uint8_t			buff[65536];	//!< Partially read messages.
+	size_t			used;		//!< Bytes in buff.
+
+	struct timeval		busy_until;	//!< When the server finishes with what it has read.
+	fake_out_t		*head;
+	fake_out_t		*tail;
+} fake_conn_t;
+
+static int		fake_fd = -1;
+static uint16_t		fake_port;
+static struct timeval	fake_rtt = { 0, 1000 };
+static uint32_t		fake_cost_usec = 20;
+static fake_conn_t	fake_conns[FAKE_MAX_CONNS];
+
+/*
+ *	Output built up while processing one read.
+ */
+static uint8_t		*out;
+static size_t		out_len;
+static size_t		out_size;
+
+static void fake_add(char type, void const *payload, size_t len)
+{
+	uint32_t	msg_len = htonl(len + 4);
+
+	if ((out_len + len + 5) > out_size) {
+		out_size = (out_len + len + 5) * 2;
+		out = realloc(out, out_size);
+		if (!out) {
+			fprintf(stderr, "fake server: Out of memory\n");
+			exit(1);
+		}
+	}
+
+	out[out_len++] = type;
+	memcpy(out + out_len, &msg_len, 4);
+	memcpy(out + out_len + 4, payload, len);
+	out_len += len + 4;
+}
+
+static void fake_add_str(char type, char const *str)
+{
+	fake_add(type, str, strlen(str) + 1);
+}
+
+static void fake_complete(char const *query)
+{
+	if (strncasecmp(query, "INSERT", 6) == 0) {
+		fake_add_str('C', "INSERT 0 1");
+	} else if (strncasecmp(query, "UPDATE", 6) == 0) {
+		fake_add_str('C', "UPDATE 1");
+	} else {
+		fake_add_str('C', "SELECT 0");
+	}
+}
+
+static void fake_error(void)
+{
+	static char const error[] = "SERROR\0VERROR\0C23505\0Mduplicate key value violates unique constraint\0";
+
+	fake_add('E', error, sizeof(error));
+}
+
+static void fake_startup(fake_conn_t *conn, uint8_t const *body, size_t len)
+{
+	uint32_t	code, zero = 0;
+	uint32_t	key[2] = { htonl(1234), htonl(5678) };
+
+	if (len < 4) return;
+	memcpy(&code, body, 4);
+	code = ntohl(code);
+
+	/*
+	 *	SSLRequest and GSSENCRequest.  We support neither.
+	 */
+	if ((code == 80877103) || (code == 80877104)) {
+		if (write(conn->fd, "N", 1) < 0) return;
+		return;
+	}
+
+	conn->started = true;
+	fake_add('R', &zero, 4);
+	fake_add('S', "server_version\00015.0", 20);
+	fake_add('S', "client_encoding\000UTF8", 21);
+	fake_add('S', "standard_conforming_strings\000on", 31);
+	fake_add('S', "integer_datetimes\000on", 21);
+	fake_add('K', key, sizeof(key));
+	fake_add('Z', "I", 1);
+}
+
+/** Handle a message, returning the number of statements run
+ *
+ */
+static int fake_message(fake_conn_t *conn, char type, uint8_t const *body, size_t len)
+{
+	switch (type) {
+	case 'Q':	/* Query */
+		if (strstr((char const *)body, "FAIL")) {
+			fake_error();
+		} else {
+			fake_complete((char const *)body);
+		}
+		fake_add('Z', "I", 1);
+		return 1;
+
+	case 'P':	/* Parse */
+		if (conn->failed) break;
+		strlcpy(conn->query, (char const *)body + strlen((char const *)body) + 1, sizeof(conn->query));
+		fake_add('1', NULL, 0);
+		break;
+
+	case 'B':	/* Bind */
+		if (!conn->failed) fake_add('2', NULL, 0);
+		break;
+
+	case 'D':	/* Describe */
+		if (!conn->failed) fake_add('n', NULL, 0);
+		break;
+
+	case 'E':	/* Execute */
+		if (conn->failed) break;
+		if (strstr(conn->query, "FAIL")) {
+			fake_error();
+			conn->failed = true;
+		} else {
+			fake_complete(conn->query);
+		}
+		return 1;
+
+	case 'S':	/* Sync */
+		conn->failed = false;
+		fake_add('Z', "I", 1);
+		break;
+
+	default:
+		break;
+	}
+
+	(void) len;
+	return 0;
+}
+
+static void fake_close(fake_conn_t *conn)
+{
+	fake_out_t *o, *next;
+
+	for (o = conn->head; o; o = next) {
+		next = o->next;
+		free(o->data);
+		free(o);
+	}
+	close(conn->fd);
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = -1;
+}
+
+/** Process every complete message the client has sent
+ *
+ * The replies are held back until the server would have finished with
+ * them, after any it's already working on.
+ */
+static void fake_read(fake_conn_t *conn)
+{
+	ssize_t		slen;
+	size_t		offset = 0;
+	int		stmts = 0;
+
+	slen = read(conn->fd, conn->buff + conn->used, sizeof(conn->buff) - conn->used);
+	if (slen <= 0) {
+		fake_close(conn);
+		return;
+	}
+	conn->used += slen;
+
+	for (;;) {
+		uint8_t const	*p = conn->buff + offset;
+		size_t		avail = conn->used - offset;
+		uint32_t	len;
+
+		if (!conn->started) {
+			if (avail < 4) break;
+			memcpy(&len, p, 4);
+			len = ntohl(len);
+			if (avail < len) break;
+
+			fake_startup(conn, p + 4, len - 4);
+			offset += len;
+			continue;
+		}
+
+		if (avail < 5) break;
+		memcpy(&len, p + 1, 4);
+		len = ntohl(len);
+		if (avail < (len + 1)) break;
+
+		if (p[0] == 'X') {
+			fake_close(conn);
+			return;
+		}
+
+		stmts += fake_message(conn, p[0], p + 5, len - 4);
+		offset += len + 1;
+	}
+
+	memmove(conn->buff, conn->buff + offset, conn->used - offset);
+	conn->used -= offset;
+
+	if (out_len) {
+		fake_out_t	*o;
+		struct timeval	now, cost = { 0, 0 };
+
+		o = malloc(sizeof(*o));
+		if (!o) {
+			fprintf(stderr, "fake server: Out of memory\n");
+			exit(1);
+		}
+		o->data = out;
+		o->len = out_len;
+		o->next = NULL;
+		out = NULL;
+		out_len = out_size = 0;
+
+		gettimeofday(&now, NULL);
+		if (timercmp(&conn->busy_until, &now, <)) conn->busy_until = now;
+
+		cost.tv_sec = (stmts * fake_cost_usec) / USEC;
+		cost.tv_usec = (stmts * fake_cost_usec) % USEC;
+		fr_timeval_add(&conn->busy_until, &conn->busy_until, &fake_rtt);
+		fr_timeval_add(&conn->busy_until, &conn->busy_until, &cost);
+		o->when = conn->busy_until;
+
+		if (conn->tail) {
+			conn->tail->next = o;
+		} else {
+			conn->head = o;
+		}
+		conn->tail = o;
+	}
+}
+
+static void *fake_server(UNUSED void *arg)
+{
+	for (;;) {
+		struct pollfd	fds[FAKE_MAX_CONNS + 1];
+		fake_conn_t	*polled[FAKE_MAX_CONNS + 1];
+		struct timeval	now;
+		int		i, num = 0;
+
+		fds[num].fd = fake_fd;
+		fds[num].events = POLLIN;
+		polled[num++] = NULL;
+
+		for (i = 0; i < FAKE_MAX_CONNS; i++) {
+			if (fake_conns[i].fd < 0) continue;
+
+			fds[num].fd = fake_conns[i].fd;
+			fds[num].events = POLLIN;
+			polled[num++] = &fake_conns[i];
+		}
+
+		/*
+		 *	With nothing to send, wait for something to
+		 *	read.  Otherwise check for input, and sleep a
+		 *	little if there's none, as poll() only has
+		 *	millisecond resolution.
+		 */
+		for (i = 0; i < FAKE_MAX_CONNS; i++) if ((fake_conns[i].fd >= 0) && fake_conns[i].head) break;
+
+		if (poll(fds, num, (i == FAKE_MAX_CONNS) ? -1 : 0) == 0) {
+			struct timespec ts = { 0, 50000 };
+
+			nanosleep(&ts, NULL);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(fake_fd, NULL, NULL);
+
+			for (i = 0; (fd >= 0) && (i < FAKE_MAX_CONNS); i++) if (fake_conns[i].fd < 0) {
+				fake_conns[i].fd = fd;
+				fd = -1;
+			}
+			if (fd >= 0) close(fd);
+		}
+
+		for (i = 1; i < num; i++) {
+			if (fds[i].revents && (polled[i]->fd == fds[i].fd)) fake_read(polled[i]);
+		}
+
+		gettimeofday(&now, NULL);
+		for (i = 0; i < FAKE_MAX_CONNS; i++) {
+			fake_conn_t *conn = &fake_conns[i];
+
+			while ((conn->fd >= 0) && conn->head && !timercmp(&now, &conn->head->when, <)) {
+				fake_out_t *o = conn->head;
+
+				if (write(conn->fd, o->data, o->len) != (ssize_t)o->len) {
+					fake_close(conn);
+					break;
+				}
+
+				conn->head = o->next;
+				if (!conn->head) conn->tail = NULL;
+				free(o->data);
+				free(o);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int fake_server_start(void)
+{
+	struct sockaddr_in	sin;
+	socklen_t		sin_len = sizeof(sin);
+	pthread_t		thread;
+	int			i;
+
+	for (i = 0; i < FAKE_MAX_CONNS; i++) fake_conns[i].fd = -1;
+
+	fake_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fake_fd < 0) return -1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((bind(fake_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) ||
+	    (getsockname(fake_fd, (struct sockaddr *)&sin, &sin_len) < 0) ||
+	    (listen(fake_fd, FAKE_MAX_CONNS) < 0)) return -1;
+	fake_port = ntohs(sin.sin_port);
+
+	if (pthread_create(&thread, NULL, fake_server, NULL) != 0) return -1;
+	pthread_detach(thread);
+
+	return 0;
+}
+
+/*
+ *	Things the driver and the connection pool use from radiusd.
+ */
+main_config_t main_config;
+
+char const *get_radius_dir(void)
+{
+	return RADDBDIR;
+}
+
+/*
+ *	Things async.c uses from the interpreter.  We don't set a
+ *	query_timeout, so there are never any timeouts to add.
+ */
+int unlang_event_timeout_add(UNUSED REQUEST *request, UNUSED fr_unlang_timeout_callback_t callback,
+			     UNUSED void const *ctx, UNUSED struct timeval *when)
+{
+	fr_strerror_printf("Timeouts not supported");
+	return -1;
+}
+
+int unlang_event_timeout_delete(UNUSED REQUEST *request, UNUSED void const *ctx)
+{
+	return -1;
+}
+
+static int		*ready;		//!< Requests which have been resumed, in order.
+static int		num_ready;
+
+void unlang_resumable(REQUEST *request)
+{
+	ready[num_ready++] = request->number;
+}
+
+#define INSERT_FMT	"INSERT INTO radacct (acctsessionid, username, nasipaddress, acctstarttime, " \
+			"acctinputoctets, acctoutputoctets) VALUES ('%08x', 'user%i@example.com', " \
+			"'192.0.2.%i', %i, 0, 0)"
+
+/*
+ *	Fails against the fake server, because of "FAIL", and against a
+ *	real one, because session 0 already exists.
+ */
+#define FAIL_FMT	"INSERT INTO radacct (acctsessionid, username, nasipaddress, acctstarttime, " \
+			"acctinputoctets, acctoutputoctets) VALUES ('%08x', 'FAIL', '192.0.2.1', 0, 0, 0)"
+
+extern rlm_sql_driver_t	rlm_sql_postgresql;
+
+static int		num_requests = 20000;
+static int		max_queries = 256;
+static int		sent;
+static rlm_sql_config_t	config;
+static rlm_sql_t	*inst;
+static fr_event_list_t	*el;
+static int		errors;
+
+static double elapsed(struct timeval const *start, struct timeval const *end)
+{
+	return (end->tv_sec - start->tv_sec) + ((end->tv_usec - start->tv_usec) / 1000000.0);
+}
+
+/*
+ *	The insert for a request, 1 in 10 of which fail.
+ */
+static char *insert(TALLOC_CTX *ctx, int i, bool *fail)
+{
+	int id = sent++;
+
+	*fail = ((i % 10) == 0);
+	if (*fail) return talloc_asprintf(ctx, FAIL_FMT, 0);
+
+	return talloc_asprintf(ctx, INSERT_FMT, id + 1, id % 1000, id % 250, 1500000000 + id);
+}
+
+static bool check(char const *name, int i, bool fail, sql_rcode_t rcode, int affected_rows)
+{
+	bool ok = (rcode == RLM_SQL_OK) && (affected_rows == 1);
+
+	if (ok != !fail) {
+		fprintf(stderr, "%s: Request %i got rcode %i, %i rows, it should have %s\n", name, i,
+			rcode, affected_rows, fail ? "failed" : "succeeded");
+		errors++;
+	}
+
+	return ok;
+}
+
+/*
+ *	Each insert blocks the worker until its result arrives.
+ */
+static void run_blocking(REQUEST **requests, int num)
+{
+	rlm_sql_handle_t	*handle;
+	struct timeval		start, end;
+	int			i;
+
+	gettimeofday(&start, NULL);
+
+	handle = fr_connection_get(inst->pool, requests[0]);
+	if (!handle) {
+		fprintf(stderr, "blocking: No connection\n");
+		errors++;
+		return;
+	}
+
+	/*
+	 *	So the inserts meant to fail do, against a real server.
+	 */
+	{
+		char *query;
+
+		MEM(query = talloc_asprintf(NULL, FAIL_FMT, 0));
+		(void) rlm_sql_query(inst, requests[0], &handle, query);
+		if (handle) (inst->driver->sql_finish_query)(handle, inst->config);
+		talloc_free(query);
+	}
+
+	for (i = 0; i < num; i++) {
+		char		*query;
+		bool		fail;
+		sql_rcode_t	rcode;
+		int		affected_rows = 0;
+
+		MEM(query = insert(NULL, i, &fail));
+
+		rcode = rlm_sql_query(inst, requests[i], &handle, query);
+		if (!handle) {
+			fprintf(stderr, "blocking: Lost connection\n");
+			errors++;
+			talloc_free(query);
+			return;
+		}
+		if (rcode == RLM_SQL_OK) affected_rows = (inst->driver->sql_affected_rows)(handle, inst->config);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+
+		check("blocking", i, fail, rcode, affected_rows);
+		talloc_free(query);
+	}
+
+	fr_connection_release(inst->pool, requests[0], handle);
+
+	gettimeofday(&end, NULL);
+
+	printf("blocking:  %6d inserts in %.3fs, %6.0f inserts/s\n",
+	       num, elapsed(&start, &end), num / elapsed(&start, &end));
+}
+
+/*
+ *	Up to max_queries inserts are in flight on the thread's
+ *	connection, and the worker sends another as each request is
+ *	resumed.
+ */
+static void run_async(REQUEST **requests, int num)
+{
+	rlm_sql_thread_t	*t;
+	rlm_sql_query_t		**queries;
+	bool			*fail;
+	struct timeval		start, end;
+	int			i, next = 0, done = 0, failed = 0;
+
+	MEM(t = talloc_zero(NULL, rlm_sql_thread_t));
+	t->inst = inst;
+	t->el = el;
+	if (rlm_sql_async_init(t) < 0) exit(1);
+
+	MEM(queries = talloc_zero_array(t, rlm_sql_query_t *, num));
+	MEM(fail = talloc_zero_array(t, bool, num));
+	num_ready = 0;
+
+	gettimeofday(&start, NULL);
+
+	while (done < num) {
+		while ((next < num) && ((next - done) < max_queries)) {
+			char *query;
+
+			MEM(query = insert(NULL, next, &fail[next]));
+			queries[next] = rlm_sql_query_async(t, requests[next], query);
+			talloc_free(query);
+
+			if (!queries[next]) {
+				fprintf(stderr, "async: Failed sending query %i\n", next);
+				errors++;
+				goto finish;
+			}
+			next++;
+		}
+
+		if (fr_event_corral(el, true) < 0) {
+			fprintf(stderr, "async: Failed waiting for events: %s\n", fr_strerror());
+			errors++;
+			break;
+		}
+		fr_event_service(el);
+
+		for (i = 0; i < num_ready; i++) {
+			rlm_sql_query_t *query = queries[ready[i]];
+
+			if (!check("async", ready[i], fail[ready[i]], query->rcode, query->affected_rows)) failed++;
+			rlm_sql_query_release(query);
+			done++;
+		}
+		num_ready = 0;
+	}
+
+finish:
+	gettimeofday(&end, NULL);
+
+	printf("async:     %6d inserts in %.3fs, %6.0f inserts/s, %d failed as they should, up to %d in flight\n",
+	       done, elapsed(&start, &end), done / elapsed(&start, &end), failed, max_queries);
+
+	rlm_sql_async_free(t);
+	talloc_free(t);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: postgresql_async_bench [OPTS]\n");
+	fprintf(stderr, "  -c <usec>              Fake server's cost per statement (default 20).\n");
+	fprintf(stderr, "  -d <db>                Database, or connection string, of a real server.\n");
+	fprintf(stderr, "  -n <requests>          Number of requests to insert for.\n");
+	fprintf(stderr, "  -q <num>               Most queries to have in flight at once.\n");
+	fprintf(stderr, "  -r <usec>              Fake server's round trip time (default 1000).\n");
+	fprintf(stderr, "  -s <server>            Use a real server.\n");
+	fprintf(stderr, "  -u <user>              Login for the real server.\n");
+	fprintf(stderr, "  -w <password>          Password for the real server.\n");
+	fprintf(stderr, "  -x                     Debug output.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	CONF_SECTION		*cs, *pool_cs;
+	REQUEST			**requests;
+
+	config.sql_server = "";
+	config.sql_login = "";
+	config.sql_password = "";
+	config.sql_db = "radius";
+
+	while ((c = getopt(argc, argv, "c:d:hn:q:r:s:u:w:x")) != EOF) switch (c) {
+		case 'c':
+			fake_cost_usec = atoi(optarg);
+			break;
+
+		case 'd':
+			config.sql_db = optarg;
+			break;
+
+		case 'n':
+			num_requests = atoi(optarg);
+			if (num_requests <= 0) usage();
+			break;
+
+		case 'q':
+			max_queries = atoi(optarg);
+			if ((max_queries <= 0) || (max_queries > SQL_ASYNC_MAX_QUERIES)) usage();
+			break;
+
+		case 'r':
+			fake_rtt.tv_sec = atoi(optarg) / USEC;
+			fake_rtt.tv_usec = atoi(optarg) % USEC;
+			break;
+
+		case 's':
+			config.sql_server = optarg;
+			break;
+
+		case 'u':
+			config.sql_login = optarg;
+			break;
+
+		case 'w':
+			config.sql_password = optarg;
+			break;
+
+		case 'x':
+			fr_debug_lvl++;
+			rad_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (!config.sql_server[0]) {
+		if (fake_server_start() < 0) {
+			fprintf(stderr, "Failed starting fake server: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+		config.sql_server = "127.0.0.1";
+		config.sql_port = fake_port;
+		config.sql_login = "radius";
+		printf("fake server: %u usec round trip, %u usec per statement\n",
+		       (unsigned int)(fake_rtt.tv_sec * USEC + fake_rtt.tv_usec), fake_cost_usec);
+	}
+
+	MEM(inst = talloc_zero(autofree, rlm_sql_t));
+	inst->name = "bench";
+	inst->config = &config;
+	inst->driver = &rlm_sql_postgresql;
+
+	/*
+	 *	As rlm_sql sets up the driver and its connections.
+	 */
+	MEM(cs = cf_section_alloc(NULL, "postgresql", NULL));
+	MEM(inst->driver_inst = talloc_zero_array(inst, uint8_t, inst->driver->inst_size));
+	if ((cf_section_parse(cs, inst->driver_inst, inst->driver->config) < 0) ||
+	    (inst->driver->mod_instantiate(&config, inst->driver_inst, cs) < 0)) {
+		fprintf(stderr, "Failed instantiating driver\n");
+		exit(1);
+	}
+	config.driver = inst->driver_inst;
+
+	MEM(pool_cs = cf_section_alloc(NULL, "pool", NULL));
+	inst->pool = fr_connection_pool_init(autofree, pool_cs, inst, mod_conn_create, NULL, "bench");
+	if (!inst->pool) {
+		fprintf(stderr, "Failed creating connection pool\n");
+		exit(1);
+	}
+
+	el = fr_event_list_create(autofree, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "Failed creating event list: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	MEM(requests = talloc_zero_array(autofree, REQUEST *, num_requests));
+	MEM(ready = talloc_zero_array(autofree, int, num_requests));
+	for (i = 0; i < num_requests; i++) {
+		MEM(requests[i] = request_alloc(requests));
+		requests[i]->number = i;
+	}
+
+	/*
+	 *	Blocking inserts are much slower, so there are fewer of them.
+	 */
+	run_blocking(requests, (num_requests / 10) ? (num_requests / 10) : 1);
+	run_async(requests, num_requests);
+
+	talloc_free(inst->pool);
+	talloc_free(pool_cs);
+	talloc_free(cs);
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,9 @@
+TARGET		:= postgresql_async_bench
+SOURCES		:= postgresql_async_bench.c
+
+SRC_CFLAGS	:= $(rlm_sql_postgresql_CFLAGS)
+SRC_CFLAGS	+= -I${top_srcdir}/src/modules/rlm_sql
+
+TGT_PREREQS	:= rlm_sql_postgresql.a rlm_sql.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS) $(rlm_sql_postgresql_LDLIBS)
+TGT_INSTALLDIR	:=
@@ -69,6 +69,13 @@ typedef struct rlm_sql_postgres_conn {
 	int		num_fields;
 	int		affected_rows;
 	char		**row;
+	int		num_stmts;		//!< Number of statements prepared, used to name them.
+
+#ifdef HAVE_PQENTERPIPELINEMODE
+	sql_rcode_t	async_rcode;		//!< Outcome of the oldest query in the pipeline.
+	int		async_affected_rows;	//!< Rows changed by the oldest query in the pipeline.
+	char		*async_error;		//!< Error from the oldest query in the pipeline.
+#endif
 } rlm_sql_postgres_conn_t;
 
 static CONF_PARSER driver_config[] = {
@@ -192,28 +199,14 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
-static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
-					      char const *query)
+/** Process the result of a query, or of executing a prepared statement
+ *
+ */
+static sql_rcode_t sql_result(rlm_sql_postgres_conn_t *conn)
 {
-	rlm_sql_postgres_conn_t *conn = handle->conn;
 	ExecStatusType status;
 	int numfields = 0;
 
-	if (!conn->db) {
-		ERROR("Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	/*
-	 *  Returns a PGresult pointer or possibly a null pointer.
-	 *  A non-null pointer will generally be returned except in
-	 *  out-of-memory conditions or serious errors such as inability
-	 *  to send the command to the server. If a null pointer is
-	 *  returned, it should be treated like a PGRES_FATAL_ERROR
-	 *  result.
-	 */
-	conn->result = PQexec(conn->db, query);
-
 	/*
 	 *  As this error COULD be a connection error OR an out-of-memory
 	 *  condition return value WILL be wrong SOME of the time
@@ -278,16 +271,130 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED r
 	case PGRES_NONFATAL_ERROR:
 	case PGRES_FATAL_ERROR:
 		return sql_classify_error(conn->result);
+
+#ifdef HAVE_PQENTERPIPELINEMODE
+	/*
+	 *  Only seen in pipeline mode, which is only used for
+	 *  asynchronous queries.
+	 */
+	case PGRES_PIPELINE_SYNC:
+	case PGRES_PIPELINE_ABORTED:
+		break;
+#endif
 	}
 
 	return RLM_SQL_ERROR;
 }
 
+static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+					      char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	/*
+	 *  Returns a PGresult pointer or possibly a null pointer.
+	 *  A non-null pointer will generally be returned except in
+	 *  out-of-memory conditions or serious errors such as inability
+	 *  to send the command to the server. If a null pointer is
+	 *  returned, it should be treated like a PGRES_FATAL_ERROR
+	 *  result.
+	 */
+	conn->result = PQexec(conn->db, query);
+
+	return sql_result(conn);
+}
+
 static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t *config, char const *query)
 {
 	return sql_query(handle, config, query);
 }
 
+/** Prepare a named statement on the server
+ *
+ * The server works out the type of each parameter from the query.
+ */
+static sql_rcode_t sql_prepare(void **out, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+			       char const *query, int num_params)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	sql_rcode_t rcode;
+	char *name;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	MEM(name = talloc_typed_asprintf(conn, "rlm_sql_%i", conn->num_stmts));
+
+	conn->result = PQprepare(conn->db, name, query, num_params, NULL);
+	rcode = sql_result(conn);
+	if (conn->result) {
+		PQclear(conn->result);
+		conn->result = NULL;
+	}
+	if (rcode != RLM_SQL_OK) {
+		talloc_free(name);
+		return rcode;
+	}
+
+	conn->num_stmts++;
+	*out = name;
+
+	return RLM_SQL_OK;
+}
+
+/** Execute a named statement
+ *
+ * Parameters are sent as text, as the server already knows their types.
+ */
+static sql_rcode_t sql_execute(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *stmt,
+			       value_box_t const *params[], int num_params)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	char const	**values;
+	char		*buff;
+	int		i;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	MEM(values = talloc_zero_array(conn, char const *, num_params));
+
+	for (i = 0; i < num_params; i++) {
+		if (!params[i]) continue;
+
+		switch (params[i]->type) {
+		case PW_TYPE_INTEGER64:
+			MEM(buff = talloc_typed_asprintf(values, "%" PRIu64, params[i]->datum.integer64));
+			values[i] = buff;
+			break;
+
+		case PW_TYPE_SIGNED:
+			MEM(buff = talloc_typed_asprintf(values, "%" PRId32, params[i]->datum.sinteger));
+			values[i] = buff;
+			break;
+
+		default:
+			rad_assert(params[i]->type == PW_TYPE_STRING);
+			values[i] = params[i]->datum.strvalue;
+			break;
+		}
+	}
+
+	conn->result = PQexecPrepared(conn->db, stmt, num_params, values, NULL, NULL, 0);
+	talloc_free(values);
+
+	return sql_result(conn);
+}
+
 static sql_rcode_t sql_fields(char const **out[], rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_postgres_conn_t *conn = handle->conn;
@@ -425,6 +532,149 @@ static size_t sql_escape_func(REQUEST *request, char *out, size_t outlen, char c
 	return ret;
 }
 
+#ifdef HAVE_PQENTERPIPELINEMODE
+/** Put a connection into pipeline mode, for rlm_sql's asynchronous queries
+ *
+ * @param[out] fd to watch for results.
+ * @param[in] handle rlm_sql connection handle.
+ * @param[in] config rlm_sql config.
+ * @return
+ *	- #RLM_SQL_OK on success.
+ *	- #RLM_SQL_ERROR on failure.
+ */
+static sql_rcode_t sql_async_init(int *fd, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (PQsetnonblocking(conn->db, 1) != 0) {
+		ERROR("Failed making connection non-blocking: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_ERROR;
+	}
+
+	if (!PQenterPipelineMode(conn->db)) {
+		ERROR("Failed entering pipeline mode: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_ERROR;
+	}
+
+	conn->async_rcode = RLM_SQL_OK;
+	*fd = PQsocket(conn->db);
+
+	return RLM_SQL_OK;
+}
+
+/** Add a query to the pipeline
+ *
+ * Each query is followed by its own sync point.  So it's run in its own
+ * implicit transaction, and if it fails, the queries sent after it are
+ * still run.
+ *
+ * @note As with any query sent using the extended protocol, the query
+ *	must be a single statement.
+ */
+static sql_rcode_t sql_async_send(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!PQsendQueryParams(conn->db, query, 0, NULL, NULL, NULL, NULL, 0) || !PQpipelineSync(conn->db)) {
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return RLM_SQL_OK;
+}
+
+static int sql_async_flush(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	return PQflush(conn->db);
+}
+
+static sql_rcode_t sql_async_read(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!PQconsumeInput(conn->db)) {
+		ERROR("Failed reading from server: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return RLM_SQL_OK;
+}
+
+/** Return the outcome of the oldest query in the pipeline, if it has arrived
+ *
+ * The results of a query are followed by NULL, and then by the result
+ * for its sync point.  We only know the query is done once we've seen
+ * that.
+ */
+static int sql_async_result(TALLOC_CTX *ctx, sql_rcode_t *rcode, int *affected, char **error,
+			    rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	PGresult		*result;
+	char const		*msg;
+	bool			ended = false;
+
+	while (!PQisBusy(conn->db)) {
+		result = PQgetResult(conn->db);
+		if (!result) {
+			/*
+			 *	Two in a row means there's nothing
+			 *	left in the pipeline.
+			 */
+			if (ended) return 0;
+			ended = true;
+			continue;
+		}
+		ended = false;
+
+		switch (PQresultStatus(result)) {
+		case PGRES_PIPELINE_SYNC:
+			PQclear(result);
+
+			*rcode = conn->async_rcode;
+			*affected = conn->async_affected_rows;
+			*error = conn->async_error ? talloc_steal(ctx, conn->async_error) : NULL;
+
+			conn->async_rcode = RLM_SQL_OK;
+			conn->async_affected_rows = 0;
+			conn->async_error = NULL;
+			return 1;
+
+		case PGRES_COMMAND_OK:
+			conn->async_affected_rows = affected_rows(result);
+			break;
+
+#ifdef HAVE_PGRES_SINGLE_TUPLE
+		case PGRES_SINGLE_TUPLE:
+#endif
+		case PGRES_TUPLES_OK:
+			conn->async_affected_rows = PQntuples(result);
+			break;
+
+		case PGRES_NONFATAL_ERROR:
+		case PGRES_FATAL_ERROR:
+			conn->async_rcode = sql_classify_error(result);
+			msg = PQresultErrorMessage(result);
+			TALLOC_FREE(conn->async_error);
+			conn->async_error = talloc_bstrndup(conn, msg, strcspn(msg, "\n"));
+			break;
+
+		default:
+			conn->async_rcode = RLM_SQL_ERROR;
+			TALLOC_FREE(conn->async_error);
+			conn->async_error = talloc_typed_asprintf(conn, "Unexpected result status %s",
+								  PQresStatus(PQresultStatus(result)));
+			break;
+		}
+		PQclear(result);
+	}
+
+	return 0;
+}
+#endif
+
 static int mod_instantiate(rlm_sql_config_t const *config, void *instance, CONF_SECTION *conf)
 {
 	rlm_sql_postgres_t	*inst = instance;
@@ -526,6 +776,7 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.name				= "rlm_sql_postgresql",
 	.magic				= RLM_MODULE_INIT,
 //	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY,	/* Needs more testing */
+	.flags				= RLM_SQL_FLAGS_NUMBERED_PARAMS,
 	.inst_size			= sizeof(rlm_sql_postgres_t),
 	.load				= mod_load,
 	.config				= driver_config,
@@ -540,5 +791,15 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+	.sql_prepare			= sql_prepare,
+	.sql_execute			= sql_execute,
+	.sql_select_execute		= sql_execute,
+#ifdef HAVE_PQENTERPIPELINEMODE
+	.sql_async_init			= sql_async_init,
+	.sql_async_send			= sql_async_send,
+	.sql_async_flush		= sql_async_flush,
+	.sql_async_read			= sql_async_read,
+	.sql_async_result		= sql_async_result
+#endif
 };
@@ -0,0 +1,6 @@
+TARGET		:= rlm_sql_postgresql.a
+SOURCES		:= rlm_sql_postgresql.c
+
+SRC_CFLAGS	:= $(rlm_sql_postgresql_CFLAGS)
+SRC_CFLAGS	+= -I${top_srcdir}/src/modules/rlm_sql
+TGT_LDLIBS	:= $(rlm_sql_postgresql_LDLIBS)
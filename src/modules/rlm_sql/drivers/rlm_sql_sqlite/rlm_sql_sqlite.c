@@ -53,8 +53,14 @@ typedef struct rlm_sql_sqlite_conn {
 	sqlite3 *db;
 	sqlite3_stmt *statement;
 	int col_count;
+	bool prepared;		//!< statement is owned by a rlm_sql_sqlite_stmt_t, so it's reset
+				//!< rather than finalized.
 } rlm_sql_sqlite_conn_t;
 
+typedef struct rlm_sql_sqlite_stmt {
+	sqlite3_stmt *statement;
+} rlm_sql_sqlite_stmt_t;
+
 typedef struct rlm_sql_sqlite {
 	char const	*filename;
 	uint32_t	busy_timeout;
@@ -374,6 +380,12 @@ static int _sql_socket_destructor(rlm_sql_sqlite_conn_t *conn)
 
 	DEBUG2("Socket destructor called, closing socket");
 
+	/*
+	 *	Prepared statements must be finalized before
+	 *	the database can be closed.
+	 */
+	talloc_free_children(conn);
+
 	if (conn->db) {
 		status = sqlite3_close(conn->db);
 		if (status != SQLITE_OK) WARN("Got SQLite error when closing socket: %s",
@@ -490,6 +502,101 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	return sql_check_error(conn->db, status);
 }
 
+static int _sql_stmt_destructor(rlm_sql_sqlite_stmt_t *stmt)
+{
+	(void) sqlite3_finalize(stmt->statement);
+
+	return 0;
+}
+
+static sql_rcode_t sql_prepare(void **out, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+			       char const *query, UNUSED int num_params)
+{
+	rlm_sql_sqlite_conn_t	*conn = handle->conn;
+	rlm_sql_sqlite_stmt_t	*stmt;
+	sql_rcode_t		rcode;
+	char const		*z_tail;
+	int			status;
+
+	MEM(stmt = talloc_zero(conn, rlm_sql_sqlite_stmt_t));
+
+#ifdef HAVE_SQLITE3_PREPARE_V2
+	status = sqlite3_prepare_v2(conn->db, query, strlen(query), &stmt->statement, &z_tail);
+#else
+	status = sqlite3_prepare(conn->db, query, strlen(query), &stmt->statement, &z_tail);
+#endif
+	rcode = sql_check_error(conn->db, status);
+	if (rcode != RLM_SQL_OK) {
+		talloc_free(stmt);
+		return rcode;
+	}
+	talloc_set_destructor(stmt, _sql_stmt_destructor);
+
+	*out = stmt;
+
+	return RLM_SQL_OK;
+}
+
+/** Bind values to a prepared statement, and make it the current statement
+ *
+ * Strings aren't copied, as the caller keeps them until the query is finished,
+ * and we clear the bindings then.
+ */
+static sql_rcode_t sql_bind(rlm_sql_sqlite_conn_t *conn, rlm_sql_sqlite_stmt_t *stmt,
+			    value_box_t const *params[], int num_params)
+{
+	int i, status;
+
+	conn->statement = stmt->statement;
+	conn->prepared = true;
+	conn->col_count = 0;
+
+	for (i = 0; i < num_params; i++) {
+		if (!params[i]) {
+			status = sqlite3_bind_null(conn->statement, i + 1);
+
+		} else switch (params[i]->type) {
+		case PW_TYPE_INTEGER64:
+			status = sqlite3_bind_int64(conn->statement, i + 1, (sqlite3_int64) params[i]->datum.integer64);
+			break;
+
+		case PW_TYPE_SIGNED:
+			status = sqlite3_bind_int(conn->statement, i + 1, params[i]->datum.sinteger);
+			break;
+
+		default:
+			rad_assert(params[i]->type == PW_TYPE_STRING);
+			status = sqlite3_bind_text(conn->statement, i + 1, params[i]->datum.strvalue,
+						   params[i]->length, SQLITE_STATIC);
+			break;
+		}
+
+		if (status != SQLITE_OK) return sql_check_error(conn->db, status);
+	}
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t sql_select_execute(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *stmt,
+				      value_box_t const *params[], int num_params)
+{
+	return sql_bind(handle->conn, stmt, params, num_params);
+}
+
+static sql_rcode_t sql_execute(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *stmt,
+			       value_box_t const *params[], int num_params)
+{
+	sql_rcode_t		rcode;
+	rlm_sql_sqlite_conn_t	*conn = handle->conn;
+	int			status;
+
+	rcode = sql_bind(conn, stmt, params, num_params);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	status = sqlite3_step(conn->statement);
+	return sql_check_error(conn->db, status);
+}
+
 static int sql_num_fields(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_sqlite_conn_t *conn = handle->conn;
@@ -610,7 +717,16 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_conf
 	if (conn->statement) {
 		TALLOC_FREE(handle->row);
 
-		(void) sqlite3_finalize(conn->statement);
+		/*
+		 *	Prepared statements are kept for the next query.
+		 */
+		if (conn->prepared) {
+			(void) sqlite3_reset(conn->statement);
+			(void) sqlite3_clear_bindings(conn->statement);
+			conn->prepared = false;
+		} else {
+			(void) sqlite3_finalize(conn->statement);
+		}
 		conn->statement = NULL;
 		conn->col_count = 0;
 	}
@@ -809,5 +925,8 @@ rlm_sql_driver_t rlm_sql_sqlite = {
 	.sql_free_result		= sql_free_result,
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
-	.sql_finish_select_query	= sql_finish_query
+	.sql_finish_select_query	= sql_finish_query,
+	.sql_prepare			= sql_prepare,
+	.sql_execute			= sql_execute,
+	.sql_select_execute		= sql_select_execute
 };
@@ -0,0 +1,6 @@
+TARGET		:= rlm_sql_sqlite.a
+SOURCES		:= rlm_sql_sqlite.c
+
+SRC_CFLAGS	:= $(rlm_sql_sqlite_CFLAGS)
+SRC_CFLAGS	+= -I${top_srcdir}/src/modules/rlm_sql
+TGT_LDLIBS	:= $(rlm_sql_sqlite_LDLIBS)
@@ -0,0 +1,310 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file sqlite_batch_bench.c
+ * @brief Write accounting queries in batches of different sizes, using the SQLite driver.
+ *
+ * We play the part of a worker thread.  Each request's queries are queued
+ * with rlm_sql_batch_add(), as acct_batch() does, and the event loop is
+ * serviced until every request has been told its queries were written.
+ * No more than -o requests wait at once, as a NAS stops sending when it
+ * has too many unanswered.
+ *
+ * The time the worker spends queuing queries and handling written batches
+ * is reported separately, as the writer thread does everything else.
+ *
+ * The database is a file, so each commit costs what it would in production.
+ * It's created from a schema written next to it.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "rlm_sql.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Things the driver and the connection pool use from radiusd.
+ */
+main_config_t main_config;
+
+char const *get_radius_dir(void)
+{
+	return RADDBDIR;
+}
+
+static int resumed;
+
+void unlang_resumable(UNUSED REQUEST *request)
+{
+	resumed++;
+}
+
+#define INSERT_FMT	"INSERT INTO radacct (acctsessionid, username, nasipaddress, acctstarttime, " \
+			"acctinputoctets, acctoutputoctets) VALUES ('%08x', 'user%i@example.com', " \
+			"'192.0.2.%i', %i, 0, 0)"
+
+#define UPDATE_FMT	"UPDATE radacct SET acctinputoctets = 0, acctoutputoctets = 0 " \
+			"WHERE acctsessionid = '%08x'"
+
+extern rlm_sql_driver_t	rlm_sql_sqlite;
+
+static int		num_requests = 10000;
+static int		max_outstanding = 4096;
+static int		sent;
+static rlm_sql_config_t	config;
+static rlm_sql_t	*inst;
+static fr_event_list_t	*el;
+static int		errors;
+
+static double elapsed(struct timeval const *start, struct timeval const *end)
+{
+	return (end->tv_sec - start->tv_sec) + ((end->tv_usec - start->tv_usec) / 1000000.0);
+}
+
+/*
+ *	Queue num_requests requests in batches of size, and wait until
+ *	they've all been written.
+ */
+static void run(REQUEST *request, uint32_t size)
+{
+	rlm_sql_thread_t	*t;
+	rlm_sql_batch_entry_t	**entries;
+	struct timeval		start, end, busy_start, busy_end;
+	double			busy = 0;
+	int			i, done = 0;
+
+	config.batch.size = size;
+	resumed = 0;
+
+	MEM(t = talloc_zero(NULL, rlm_sql_thread_t));
+	t->inst = inst;
+	t->el = el;
+	t->fd = -1;
+	if (rlm_sql_batch_init(t) < 0) exit(1);
+
+	MEM(entries = talloc_zero_array(t, rlm_sql_batch_entry_t *, num_requests));
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < num_requests; i++, sent++) {
+		char **queries;
+
+		MEM(queries = talloc_array(NULL, char *, 2));
+		MEM(queries[0] = talloc_asprintf(queries, INSERT_FMT, sent, sent % 1000, sent % 250, 1500000000 + sent));
+		MEM(queries[1] = talloc_asprintf(queries, UPDATE_FMT, sent));
+
+		gettimeofday(&busy_start, NULL);
+
+		entries[i] = rlm_sql_batch_add(t, request, queries);
+		if (entries[i]->done) {
+			done++;
+		} else {
+			entries[i]->yielded = true;
+		}
+
+		if (fr_event_corral(el, false) > 0) fr_event_service(el);
+
+		gettimeofday(&busy_end, NULL);
+		busy += elapsed(&busy_start, &busy_end);
+
+		/*
+		 *	As the NAS would, stop sending requests while
+		 *	too many are waiting for a reply.
+		 */
+		while (((i + 1) - (done + resumed)) >= max_outstanding) {
+			if (fr_event_corral(el, true) < 0) {
+				fprintf(stderr, "Batch %u: Failed waiting for events: %s\n", size, fr_strerror());
+				exit(1);
+			}
+
+			gettimeofday(&busy_start, NULL);
+			fr_event_service(el);
+			gettimeofday(&busy_end, NULL);
+			busy += elapsed(&busy_start, &busy_end);
+		}
+	}
+
+	/*
+	 *	Wait for the last batch to be written, or for its
+	 *	timer to fire.
+	 */
+	while ((done + resumed) < num_requests) {
+		if (fr_event_corral(el, true) < 0) {
+			fprintf(stderr, "Batch %u: Failed waiting for events: %s\n", size, fr_strerror());
+			errors++;
+			break;
+		}
+
+		gettimeofday(&busy_start, NULL);
+		fr_event_service(el);
+		gettimeofday(&busy_end, NULL);
+		busy += elapsed(&busy_start, &busy_end);
+	}
+
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < num_requests; i++) {
+		if (entries[i]->rcode != RLM_MODULE_OK) {
+			fprintf(stderr, "Batch %u: Request %i failed with %i\n", size, i, entries[i]->rcode);
+			errors++;
+		}
+		rlm_sql_batch_release(entries[i]);
+	}
+
+	rlm_sql_batch_free(t);
+	talloc_free(t);
+
+	printf("batch %4u: %d requests in %.3fs, %.0f requests/s, worker busy for %.3fs\n",
+	       size, num_requests, elapsed(&start, &end), num_requests / elapsed(&start, &end), busy);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: sqlite_batch_bench [OPTS]\n");
+	fprintf(stderr, "  -b <size>              Only write batches of this size.\n");
+	fprintf(stderr, "  -d <dir>               Directory to write the database in (defaults to a temporary one).\n");
+	fprintf(stderr, "  -n <requests>          Number of requests to write with each batch size.\n");
+	fprintf(stderr, "  -o <requests>          Most requests waiting for their queries to be written.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	uint32_t		size = 0;
+	char const		*dir = NULL;
+	char			tmp[] = "/tmp/sqlite_batch_bench.XXXXXX";
+	char			*filename, *schema;
+	FILE			*fp;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	CONF_SECTION		*cs, *pool_cs;
+	REQUEST			*request;
+
+	while ((c = getopt(argc, argv, "b:d:hn:o:")) != EOF) switch (c) {
+		case 'b':
+			size = atoi(optarg);
+			if (size == 0) usage();
+			break;
+
+		case 'd':
+			dir = optarg;
+			break;
+
+		case 'n':
+			num_requests = atoi(optarg);
+			if (num_requests <= 0) usage();
+			break;
+
+		case 'o':
+			max_outstanding = atoi(optarg);
+			if (max_outstanding <= 0) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (!dir) {
+		dir = mkdtemp(tmp);
+		if (!dir) {
+			fprintf(stderr, "Failed creating temporary directory: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+	}
+	MEM(filename = talloc_asprintf(autofree, "%s/radacct.db", dir));
+	MEM(schema = talloc_asprintf(autofree, "%s/schema.sql", dir));
+
+	fp = fopen(schema, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed creating %s: %s\n", schema, fr_syserror(errno));
+		exit(1);
+	}
+	fprintf(fp, "CREATE TABLE radacct (radacctid INTEGER PRIMARY KEY, acctsessionid TEXT UNIQUE, "
+		"username TEXT, nasipaddress TEXT, acctstarttime INTEGER, acctinputoctets INTEGER, "
+		"acctoutputoctets INTEGER);\n");
+	fclose(fp);
+
+	config.batch.wait = true;
+	config.batch.interval.tv_usec = 100000;
+
+	MEM(inst = talloc_zero(autofree, rlm_sql_t));
+	inst->name = "bench";
+	inst->config = &config;
+	inst->driver = &rlm_sql_sqlite;
+
+	/*
+	 *	As rlm_sql sets up the driver and its connections.
+	 */
+	MEM(cs = cf_section_alloc(NULL, "sqlite", NULL));
+	cf_pair_add(cs, cf_pair_alloc(cs, "filename", filename, T_OP_EQ, T_BARE_WORD, T_DOUBLE_QUOTED_STRING));
+	cf_pair_add(cs, cf_pair_alloc(cs, "bootstrap", schema, T_OP_EQ, T_BARE_WORD, T_DOUBLE_QUOTED_STRING));
+	MEM(inst->driver_inst = talloc_zero_array(inst, uint8_t, inst->driver->inst_size));
+	if ((cf_section_parse(cs, inst->driver_inst, inst->driver->config) < 0) ||
+	    (inst->driver->mod_instantiate(&config, inst->driver_inst, cs) < 0)) {
+		fprintf(stderr, "Failed instantiating driver\n");
+		exit(1);
+	}
+	config.driver = inst->driver_inst;
+
+	MEM(pool_cs = cf_section_alloc(NULL, "pool", NULL));
+	inst->pool = fr_connection_pool_init(autofree, pool_cs, inst, mod_conn_create, NULL, "bench");
+	if (!inst->pool) {
+		fprintf(stderr, "Failed creating connection pool\n");
+		exit(1);
+	}
+
+	el = fr_event_list_create(autofree, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "Failed creating event list: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	MEM(request = request_alloc(autofree));
+
+	if (size) {
+		run(request, size);
+	} else {
+		run(request, 1);
+		run(request, 10);
+		run(request, 100);
+		run(request, 1000);
+	}
+
+	talloc_free(inst->pool);
+	talloc_free(pool_cs);
+	talloc_free(cs);
+
+	unlink(filename);
+	unlink(schema);
+	if (dir == tmp) rmdir(tmp);
+
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
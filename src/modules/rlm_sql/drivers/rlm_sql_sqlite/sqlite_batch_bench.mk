@@ -0,0 +1,9 @@
+TARGET		:= sqlite_batch_bench
+SOURCES		:= sqlite_batch_bench.c
+
+SRC_CFLAGS	:= $(rlm_sql_sqlite_CFLAGS)
+SRC_CFLAGS	+= -I${top_srcdir}/src/modules/rlm_sql
+
+TGT_PREREQS	:= rlm_sql_sqlite.a rlm_sql.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS) $(rlm_sql_sqlite_LDLIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,309 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file sqlite_prepare_bench.c
+ * @brief Compare expanded queries with prepared ones, using the SQLite driver.
+ *
+ * Each query is run the way rlm_sql runs it.  Expanded, the query is
+ * xlat expanded with its values escaped, and the text is handed to the
+ * driver, which parses it.  Prepared, the values are taken from the
+ * request without escaping, and bound to a statement which was parsed once.
+ *
+ * The database is in memory, so we measure the server and SQLite, not
+ * the disk.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "rlm_sql.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Things the driver uses from radiusd.
+ */
+main_config_t main_config;
+
+char const *get_radius_dir(void)
+{
+	return RADDBDIR;
+}
+
+#define USERS	10000
+
+static char const *select_fmt = "SELECT id, username, attribute, value, op FROM radcheck "
+				"WHERE username = '%{SQL-User-Name}' ORDER BY id";
+
+static char const *insert_fmt = "INSERT INTO radacct (acctsessionid, username, nasipaddress, "
+				"acctstarttime, acctinputoctets, acctoutputoctets) VALUES ("
+				"'%{Acct-Session-Id}', '%{SQL-User-Name}', '%{NAS-IP-Address}', "
+				"%{integer:Event-Timestamp}, %{%{Acct-Input-Octets}:-0}, "
+				"%{%{Acct-Output-Octets}:-0})";
+
+extern rlm_sql_driver_t	rlm_sql_sqlite;
+
+static int		num_queries = 200000;
+static rlm_sql_config_t	config;
+static rlm_sql_t	*inst;
+
+static ssize_t xlat_bench(UNUSED TALLOC_CTX *ctx, UNUSED char **out, UNUSED size_t outlen,
+			  UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
+			  UNUSED REQUEST *request, UNUSED char const *fmt)
+{
+	return 0;
+}
+
+/*
+ *	As rlm_sql escapes values with the default safe_characters.
+ */
+static size_t sql_bench_escape(UNUSED REQUEST *request, char *out, size_t outlen, char const *in,
+			       UNUSED void *arg)
+{
+	size_t len = 0;
+
+	while (*in && (outlen > 1)) {
+		if ((*in < 32) || !strchr(config.allowed_chars, *in)) {
+			if (outlen <= 3) break;
+
+			snprintf(out, outlen, "=%02X", (unsigned char) *in);
+			in++;
+			out += 3;
+			outlen -= 3;
+			len += 3;
+			continue;
+		}
+
+		*out++ = *in++;
+		outlen--;
+		len++;
+	}
+	*out = '\0';
+
+	return len;
+}
+
+static void query(rlm_sql_handle_t *handle, char const *text)
+{
+	if ((inst->driver->sql_query(handle, &config, text) != RLM_SQL_OK) ||
+	    (inst->driver->sql_finish_query(handle, &config) != RLM_SQL_OK)) {
+		fprintf(stderr, "Failed running %s\n", text);
+		exit(1);
+	}
+}
+
+static void request_fill(REQUEST *request, int i)
+{
+	VALUE_PAIR	*vps = NULL;
+	char		buffer[64];
+
+	fr_pair_list_free(&request->packet->vps);
+
+	snprintf(buffer, sizeof(buffer), "user%i@example.com", i % USERS);
+	fr_pair_make(request->packet, &vps, "SQL-User-Name", buffer, T_OP_SET);
+	snprintf(buffer, sizeof(buffer), "%08x", i);
+	fr_pair_make(request->packet, &vps, "Acct-Session-Id", buffer, T_OP_EQ);
+	snprintf(buffer, sizeof(buffer), "192.0.2.%i", i % 250);
+	fr_pair_make(request->packet, &vps, "NAS-IP-Address", buffer, T_OP_EQ);
+	snprintf(buffer, sizeof(buffer), "%i", 1500000000 + i);
+	fr_pair_make(request->packet, &vps, "Event-Timestamp", buffer, T_OP_EQ);
+	snprintf(buffer, sizeof(buffer), "%i", i * 3);
+	fr_pair_make(request->packet, &vps, "Acct-Input-Octets", buffer, T_OP_EQ);
+	request->packet->vps = vps;
+}
+
+static void run(rlm_sql_handle_t *handle, REQUEST *request, char const *name, char const *fmt,
+		bool select, bool prepared)
+{
+	rlm_sql_template_t const	*tmpl = NULL;
+	void				*stmt = NULL;
+	struct timeval			start, end;
+	double				elapsed;
+	long				rows = 0;
+	int				i;
+
+	if (prepared) {
+		tmpl = rlm_sql_template_find(inst, fmt);
+		if (!tmpl || (inst->driver->sql_prepare(&stmt, handle, &config, tmpl->query, tmpl->num_params) != RLM_SQL_OK)) {
+			fprintf(stderr, "Failed preparing %s\n", fmt);
+			exit(1);
+		}
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < num_queries; i++) {
+		TALLOC_CTX	*ctx = talloc_new(request);
+		sql_rcode_t	rcode;
+		rlm_sql_row_t	row;
+
+		request_fill(request, i);
+
+		if (prepared) {
+			value_box_t const **params;
+
+			if (rlm_sql_template_params(ctx, &params, request, tmpl) < 0) {
+			error:
+				fprintf(stderr, "%s failed: %s\n", name, fr_strerror());
+				exit(1);
+			}
+
+			rcode = select ? inst->driver->sql_select_execute(handle, &config, stmt, params, tmpl->num_params) :
+					 inst->driver->sql_execute(handle, &config, stmt, params, tmpl->num_params);
+		} else {
+			char *query;
+
+			if (xlat_aeval(ctx, &query, request, fmt, sql_bench_escape, NULL) < 0) goto error;
+
+			rcode = select ? inst->driver->sql_select_query(handle, &config, query) :
+					 inst->driver->sql_query(handle, &config, query);
+		}
+		if (rcode != RLM_SQL_OK) {
+			fprintf(stderr, "%s failed: %i\n", name, rcode);
+			exit(1);
+		}
+
+		if (select) {
+			while ((inst->driver->sql_fetch_row(&row, handle, &config) == RLM_SQL_OK) && row) rows++;
+			inst->driver->sql_finish_select_query(handle, &config);
+		} else {
+			inst->driver->sql_finish_query(handle, &config);
+		}
+
+		talloc_free(ctx);
+	}
+
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+	printf("%-16s %d queries in %.3fs, %.0f queries/s", name, num_queries, elapsed, num_queries / elapsed);
+	if (select) printf(", %ld rows", rows);
+	printf("\n");
+
+	talloc_free(stmt);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: sqlite_prepare_bench [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <queries>           Number of each query to run.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	CONF_SECTION		*cs;
+	rlm_sql_handle_t	*handle;
+	REQUEST			*request;
+	char			*text;
+
+	while ((c = getopt(argc, argv, "D:hn:")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num_queries = atoi(optarg);
+			if (num_queries <= 0) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fprintf(stderr, "Failed reading dictionaries: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	/*
+	 *	Registering an xlat sets up the built in ones, such
+	 *	as %{integer:...}.
+	 */
+	if (xlat_register(NULL, "bench", xlat_bench, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN) < 0) {
+		fprintf(stderr, "Failed registering xlat\n");
+		exit(1);
+	}
+
+	config.allowed_chars = "@abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-_: /";
+
+	MEM(inst = talloc_zero(autofree, rlm_sql_t));
+	inst->name = "bench";
+	inst->config = &config;
+	inst->driver = &rlm_sql_sqlite;
+
+	/*
+	 *	As rlm_sql sets up the driver.
+	 */
+	MEM(cs = cf_section_alloc(NULL, "sqlite", NULL));
+	cf_pair_add(cs, cf_pair_alloc(cs, "filename", ":memory:", T_OP_EQ, T_BARE_WORD, T_BARE_WORD));
+	MEM(inst->driver_inst = talloc_zero_array(inst, uint8_t, inst->driver->inst_size));
+	if ((cf_section_parse(cs, inst->driver_inst, inst->driver->config) < 0) ||
+	    (inst->driver->mod_instantiate(&config, inst->driver_inst, cs) < 0)) {
+		fprintf(stderr, "Failed instantiating driver\n");
+		exit(1);
+	}
+	config.driver = inst->driver_inst;
+
+	if ((rlm_sql_template_add(inst, select_fmt) != 1) || (rlm_sql_template_add(inst, insert_fmt) != 1)) {
+		fprintf(stderr, "Failed compiling queries\n");
+		exit(1);
+	}
+
+	MEM(handle = talloc_zero(autofree, rlm_sql_handle_t));
+	handle->inst = inst;
+	if (inst->driver->sql_socket_init(handle, &config, NULL) != RLM_SQL_OK) exit(1);
+
+	query(handle, "CREATE TABLE radcheck (id INTEGER PRIMARY KEY, username TEXT, attribute TEXT, "
+	      "op TEXT, value TEXT)");
+	query(handle, "CREATE INDEX radcheck_username ON radcheck (username)");
+	query(handle, "CREATE TABLE radacct (radacctid INTEGER PRIMARY KEY, acctsessionid TEXT, username TEXT, "
+	      "nasipaddress TEXT, acctstarttime INTEGER, acctinputoctets INTEGER, acctoutputoctets INTEGER)");
+	query(handle, "BEGIN");
+
+	for (i = 0; i < USERS; i++) {
+		text = talloc_asprintf(autofree, "INSERT INTO radcheck (username, attribute, op, value) "
+				       "VALUES ('user%i@example.com', 'Cleartext-Password', ':=', 'password%i')", i, i);
+		query(handle, text);
+		talloc_free(text);
+	}
+
+	MEM(request = request_alloc(autofree));
+	MEM(request->packet = fr_radius_alloc(request, false));
+
+	run(handle, request, "select expanded", select_fmt, true, false);
+	run(handle, request, "select prepared", select_fmt, true, true);
+	run(handle, request, "insert expanded", insert_fmt, false, false);
+	run(handle, request, "insert prepared", insert_fmt, false, true);
+
+	talloc_free(handle);
+	talloc_free(cs);
+	xlat_free();
+	talloc_free(autofree);
+
+	return 0;
+}
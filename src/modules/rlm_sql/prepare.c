@@ -0,0 +1,572 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file src/modules/rlm_sql/prepare.c
+ * @brief Queries prepared once per connection.
+ *
+ * When the module is instantiated, each query in the configuration is
+ * compiled into a template.  Single quoted strings containing expansions,
+ * and unquoted expansions of integer attributes, are replaced with
+ * placeholders.  The template is prepared the first time it's used on a
+ * connection, and the values of the expansions are bound to its placeholders
+ * each time it's executed.  The values aren't escaped, as the database never
+ * parses them as SQL.
+ *
+ * Queries which can't be written this way are left alone, and expanded
+ * as usual.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#define LOG_PREFIX "rlm_sql (%s) - "
+#define LOG_PREFIX_ARGS inst->name
+
+#include <freeradius-devel/rad_assert.h>
+
+#include <ctype.h>
+
+#include "rlm_sql.h"
+
+static int template_cmp(void const *one, void const *two)
+{
+	rlm_sql_template_t const *a = one, *b = two;
+
+	return strcmp(a->fmt, b->fmt);
+}
+
+/** Find the end of an expansion
+ *
+ * @param[in] p	pointing to the '{' after the '%'.
+ * @return the closing '}', or NULL if there isn't one.
+ */
+static char const *expansion_end(char const *p)
+{
+	int depth = 0;
+
+	for (; *p; p++) {
+		if (*p == '{') depth++;
+		if ((*p == '}') && (--depth == 0)) return p;
+	}
+
+	return NULL;
+}
+
+/** Parse a plain attribute reference
+ *
+ * @param[in] ctx	to allocate the tmpl in.
+ * @param[in] name	of the attribute, without the "%{" and "}".
+ * @param[in] len	of name.
+ * @return the tmpl, or NULL if name isn't an attribute we can look up directly.
+ */
+static vp_tmpl_t *param_attr(TALLOC_CTX *ctx, char const *name, size_t len)
+{
+	vp_tmpl_t	*vpt;
+	char		*buff;
+
+	buff = talloc_strndup(ctx, name, len);
+	if (tmpl_afrom_attr_str(ctx, &vpt, buff, REQUEST_CURRENT, PAIR_LIST_REQUEST, false, false) <= 0) {
+		talloc_free(buff);
+		return NULL;
+	}
+	talloc_free(buff);
+
+	/*
+	 *	Virtual attributes only exist as expansions.
+	 */
+	if ((vpt->type != TMPL_TYPE_ATTR) || vpt->tmpl_da->flags.virtual) {
+		talloc_free(vpt);
+		return NULL;
+	}
+
+	return vpt;
+}
+
+/** Is the attribute one we can bind as an integer
+ *
+ */
+static bool param_attr_integer(vp_tmpl_t const *vpt)
+{
+	switch (vpt->tmpl_da->type) {
+	case PW_TYPE_BYTE:
+	case PW_TYPE_SHORT:
+	case PW_TYPE_INTEGER:
+	case PW_TYPE_INTEGER64:
+	case PW_TYPE_SIGNED:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Compile the contents of a single quoted string into a param
+ *
+ * A plain attribute reference has its value bound directly.  Anything else
+ * is expanded, and the result bound as a string.  Either way, if nothing
+ * is found, we bind an empty string, as the expansion would have produced.
+ */
+static int param_quoted(TALLOC_CTX *ctx, rlm_sql_param_t *param, char const *in, size_t inlen)
+{
+	char		*fmt;
+	char const	*error;
+
+	memset(param, 0, sizeof(*param));
+	param->dflt.type = PW_TYPE_STRING;
+	param->dflt.datum.strvalue = "";
+
+	if ((inlen > 3) && (in[0] == '%') && (in[1] == '{') && (expansion_end(in + 1) == (in + inlen - 1))) {
+		param->vpt = param_attr(ctx, in + 2, inlen - 3);
+		if (param->vpt) return 0;
+	}
+
+	fmt = talloc_strndup(ctx, in, inlen);	/* modified by xlat_tokenize, and must outlive the xlat */
+	if (xlat_tokenize(ctx, fmt, &param->xlat, &error) < 0) {
+		fr_strerror_printf("%s", error);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Compile an unquoted expansion into a param
+ *
+ * Only %{Attr}, %{integer:Attr} and %{%{Attr}:-default} are accepted, where
+ * Attr is an integer (or a date, for %{integer:Attr}) and the default is an
+ * integer or NULL.  Their values are numbers, so they would have been
+ * written into the query as literals.
+ */
+static int param_unquoted(TALLOC_CTX *ctx, rlm_sql_param_t *param, char const *in, size_t inlen)
+{
+	char const	*p, *end = in + inlen - 1;
+	char		*q;
+
+	memset(param, 0, sizeof(*param));
+
+	/*
+	 *	%{%{Attr}:-default}
+	 */
+	if ((in[2] == '%') && (in[3] == '{')) {
+		p = expansion_end(in + 3);
+		if (!p || (p[1] != ':') || (p[2] != '-')) goto bad;
+
+		param->vpt = param_attr(ctx, in + 4, p - (in + 4));
+		if (!param->vpt) goto bad;
+
+		p += 3;
+		if (((end - p) == 4) && (strncasecmp(p, "NULL", 4) == 0)) goto check;
+
+		param->dflt.datum.integer64 = strtoull(p, &q, 10);
+		if ((p == end) || (q != end)) goto bad;
+
+		param->dflt.type = PW_TYPE_INTEGER64;
+		param->dflt.length = sizeof(param->dflt.datum.integer64);
+		goto check;
+	}
+
+	/*
+	 *	%{integer:Attr}
+	 */
+	if ((inlen > 11) && (strncmp(in + 2, "integer:", 8) == 0)) {
+		param->vpt = param_attr(ctx, in + 10, inlen - 11);
+		if (!param->vpt) goto bad;
+
+		param->integer = true;
+		if (param->vpt->tmpl_da->type == PW_TYPE_DATE) return 0;
+		goto check;
+	}
+
+	/*
+	 *	%{Attr}
+	 */
+	param->vpt = param_attr(ctx, in + 2, inlen - 3);
+	if (!param->vpt) goto bad;
+
+check:
+	if (param_attr_integer(param->vpt)) return 0;
+
+	fr_strerror_printf("Unquoted expansion \"%.*s\" is not an integer", (int) inlen, in);
+	TALLOC_FREE(param->vpt);
+	return -1;
+
+bad:
+	fr_strerror_printf("Unquoted expansion \"%.*s\" is not a plain attribute reference", (int) inlen, in);
+	TALLOC_FREE(param->vpt);
+	return -1;
+}
+
+/** Compile a query into a template
+ *
+ * @param[in] inst	of rlm_sql.
+ * @param[in] fmt	the query as it was configured.
+ * @return
+ *	- The template.
+ *	- NULL if the query can't be prepared.  fr_strerror() says why.
+ */
+rlm_sql_template_t *rlm_sql_template_compile(rlm_sql_t const *inst, char const *fmt)
+{
+	rlm_sql_template_t	*tmpl;
+	rlm_sql_param_t		*param;
+	char const		*p = fmt, *q;
+	char			*query;
+	bool			numbered = (inst->driver->flags & RLM_SQL_FLAGS_NUMBERED_PARAMS);
+
+	MEM(tmpl = talloc_zero(inst, rlm_sql_template_t));
+	MEM(tmpl->fmt = talloc_strdup(tmpl, fmt));
+	MEM(query = talloc_strdup(tmpl, ""));
+
+	while (*p) {
+		switch (*p) {
+		case '\'':
+		{
+			bool	expand = false, escaped = false;
+
+			for (q = p + 1; *q; q++) {
+				if (*q == '\'') {
+					if (q[1] != '\'') break;
+					escaped = true;
+					q++;
+					continue;
+				}
+				if (*q == '\\') escaped = true;
+				if (*q == '%') expand = true;
+			}
+			if (!*q) {
+				fr_strerror_printf("Unterminated string");
+				goto error;
+			}
+
+			/*
+			 *	Nothing to expand, leave it alone.
+			 */
+			if (!expand) {
+				MEM(query = talloc_strndup_append_buffer(query, p, (q - p) + 1));
+				p = q + 1;
+				continue;
+			}
+
+			/*
+			 *	We'd have to unescape the string to bind it,
+			 *	which depends on the database.
+			 */
+			if (escaped) {
+				fr_strerror_printf("Expansion in a string containing escape sequences");
+				goto error;
+			}
+
+			MEM(tmpl->params = talloc_realloc(tmpl, tmpl->params, rlm_sql_param_t, tmpl->num_params + 1));
+			param = &tmpl->params[tmpl->num_params];
+			if (param_quoted(tmpl, param, p + 1, q - (p + 1)) < 0) goto error;
+			p = q + 1;
+		}
+			break;
+
+		case '%':
+			if (p[1] == '%') {
+				MEM(query = talloc_strndup_append_buffer(query, p, 1));
+				p += 2;
+				continue;
+			}
+
+			q = (p[1] == '{') ? expansion_end(p + 1) : NULL;
+			if (!q) {
+				fr_strerror_printf("Unquoted expansion \"%.2s\" is not a plain attribute reference", p);
+				goto error;
+			}
+
+			MEM(tmpl->params = talloc_realloc(tmpl, tmpl->params, rlm_sql_param_t, tmpl->num_params + 1));
+			param = &tmpl->params[tmpl->num_params];
+			if (param_unquoted(tmpl, param, p, (q - p) + 1) < 0) goto error;
+			p = q + 1;
+			break;
+
+		/*
+		 *	Quoted identifiers can't be parameters.
+		 */
+		case '"':
+		case '`':
+			q = strchr(p + 1, *p);
+			if (!q) {
+				fr_strerror_printf("Unterminated identifier");
+				goto error;
+			}
+			if (memchr(p, '%', q - p)) {
+				fr_strerror_printf("Expansion in an identifier");
+				goto error;
+			}
+			MEM(query = talloc_strndup_append_buffer(query, p, (q - p) + 1));
+			p = q + 1;
+			continue;
+
+		/*
+		 *	Anything which looks like a placeholder
+		 *	would be confused with ours.
+		 */
+		case '?':
+			if (numbered) goto copy;
+		placeholder:
+			fr_strerror_printf("Query already contains placeholders");
+			goto error;
+
+		case '$':
+			if (numbered && isdigit((int) p[1])) goto placeholder;
+			/* FALL-THROUGH */
+
+		default:
+		copy:
+			MEM(query = talloc_strndup_append_buffer(query, p, 1));
+			p++;
+			continue;
+		}
+
+		/*
+		 *	Replace the expansion with a placeholder.
+		 */
+		tmpl->num_params++;
+		if (numbered) {
+			MEM(query = talloc_asprintf_append_buffer(query, "$%i", tmpl->num_params));
+		} else {
+			MEM(query = talloc_strdup_append_buffer(query, "?"));
+		}
+	}
+
+	tmpl->query = query;
+
+	return tmpl;
+
+error:
+	talloc_free(tmpl);
+	return NULL;
+}
+
+/** Compile a query, and add it to the instance's templates
+ *
+ * @param[in] inst	of rlm_sql.
+ * @param[in] fmt	the query as it was configured.
+ * @return
+ *	- 1 if the query was compiled.
+ *	- 0 if it'll be expanded instead.
+ *	- -1 on error.
+ */
+int rlm_sql_template_add(rlm_sql_t *inst, char const *fmt)
+{
+	rlm_sql_template_t	*tmpl;
+
+	if (!inst->templates) {
+		inst->templates = rbtree_create(inst, template_cmp, NULL, RBTREE_FLAG_NONE);
+		if (!inst->templates) {
+			ERROR("Failed creating template tree");
+			return -1;
+		}
+	}
+
+	if (rlm_sql_template_find(inst, fmt)) return 1;
+
+	tmpl = rlm_sql_template_compile(inst, fmt);
+	if (!tmpl) {
+		WARN("Query will be expanded, not prepared: %s: %s", fr_strerror(), fmt);
+		return 0;
+	}
+	tmpl->id = inst->num_templates;
+
+	if (!rbtree_insert(inst->templates, tmpl)) {
+		ERROR("Failed inserting template");
+		talloc_free(tmpl);
+		return -1;
+	}
+	inst->num_templates++;
+
+	DEBUG3("Prepared query %i: %s", tmpl->id, tmpl->query);
+
+	return 1;
+}
+
+/** Compile all the queries in a section, and its subsections
+ *
+ * Used for accounting and post-auth, where the query to run is found with
+ * a reference expanded at run time.
+ *
+ * @param[in] inst	of rlm_sql.
+ * @param[in] cs	to compile queries from.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int rlm_sql_template_add_section(rlm_sql_t *inst, CONF_SECTION *cs)
+{
+	CONF_ITEM	*ci = NULL;
+
+	while ((ci = cf_item_find_next(cs, ci))) {
+		CONF_PAIR	*cp;
+		char const	*attr, *value;
+
+		if (cf_item_is_section(ci)) {
+			if (rlm_sql_template_add_section(inst, cf_item_to_section(ci)) < 0) return -1;
+			continue;
+		}
+
+		if (!cf_item_is_pair(ci)) continue;
+
+		cp = cf_item_to_pair(ci);
+		attr = cf_pair_attr(cp);
+		value = cf_pair_value(cp);
+		if (!value || !*value || (strcmp(attr, "reference") == 0) || (strcmp(attr, "logfile") == 0)) continue;
+
+		if (rlm_sql_template_add(inst, value) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Find the template compiled from a query
+ *
+ * @param[in] inst	of rlm_sql.
+ * @param[in] fmt	the query as it was configured.
+ * @return the template, or NULL if the query wasn't compiled.
+ */
+rlm_sql_template_t const *rlm_sql_template_find(rlm_sql_t const *inst, char const *fmt)
+{
+	rlm_sql_template_t	find = { .fmt = fmt };
+
+	if (!inst->templates) return NULL;
+
+	return rbtree_finddata(inst->templates, &find);
+}
+
+/** Bind the value of an attribute
+ *
+ * Integers are bound as integers, unless they have a name, and integer
+ * is false.  Anything else is bound as the string it would have been
+ * expanded to.
+ */
+static int param_value(TALLOC_CTX *ctx, value_box_t *box, VALUE_PAIR const *vp, bool integer)
+{
+	char *value;
+
+	switch (vp->da->type) {
+	case PW_TYPE_BYTE:
+		box->datum.integer64 = vp->vp_byte;
+		goto integer;
+
+	case PW_TYPE_SHORT:
+		box->datum.integer64 = vp->vp_short;
+		goto integer;
+
+	case PW_TYPE_INTEGER:
+		box->datum.integer64 = vp->vp_integer;
+		goto integer;
+
+	case PW_TYPE_DATE:
+		if (!integer) break;
+
+		box->datum.integer64 = vp->vp_date;
+		goto integer;
+
+	case PW_TYPE_INTEGER64:
+		box->datum.integer64 = vp->vp_integer64;
+	integer:
+		if (!integer && fr_dict_enum_by_da(NULL, vp->da, box->datum.integer64)) break;
+
+		box->type = PW_TYPE_INTEGER64;
+		box->length = sizeof(box->datum.integer64);
+		return 0;
+
+	case PW_TYPE_SIGNED:
+		box->type = PW_TYPE_SIGNED;
+		box->datum.sinteger = vp->vp_signed;
+		box->length = sizeof(box->datum.sinteger);
+		return 0;
+
+	case PW_TYPE_STRING:
+		box->type = PW_TYPE_STRING;
+		box->datum.strvalue = vp->vp_strvalue;
+		box->length = vp->vp_length;
+		return 0;
+
+	default:
+		break;
+	}
+
+	value = value_box_asprint(ctx, vp->da->type, vp->da, &vp->data, '\0');
+	if (!value) return -1;
+
+	box->type = PW_TYPE_STRING;
+	box->datum.strvalue = value;
+	box->length = talloc_array_length(value) - 1;
+
+	return 0;
+}
+
+/** Get the values to bind to a template's placeholders
+ *
+ * @param[in] ctx	to allocate the values in.  Free *out to free them all.
+ * @param[out] out	where to write the values.
+ * @param[in] request	to get the values from.
+ * @param[in] tmpl	to get the values for.
+ * @return
+ *	- 0 on success.
+ *	- -1 if an expansion failed, or we ran out of memory.
+ */
+int rlm_sql_template_params(TALLOC_CTX *ctx, value_box_t const **out[], REQUEST *request,
+			    rlm_sql_template_t const *tmpl)
+{
+	value_box_t const	**params;
+	value_box_t		*boxes;
+	int			i;
+
+	params = talloc_zero_array(ctx, value_box_t const *, tmpl->num_params);
+	if (!params) return -1;
+
+	boxes = talloc_zero_array(params, value_box_t, tmpl->num_params);
+	if (!boxes) {
+	error:
+		talloc_free(params);
+		return -1;
+	}
+
+	for (i = 0; i < tmpl->num_params; i++) {
+		rlm_sql_param_t const	*param = &tmpl->params[i];
+		VALUE_PAIR		*vp;
+		char			*value = NULL;
+		ssize_t			slen;
+
+		if (param->vpt) {
+			if (tmpl_find_vp(&vp, request, param->vpt) < 0) {
+				params[i] = (param->dflt.type == PW_TYPE_INVALID) ? NULL : &param->dflt;
+				continue;
+			}
+
+			if (param_value(params, &boxes[i], vp, param->integer) < 0) goto error;
+			params[i] = &boxes[i];
+			continue;
+		}
+
+		slen = xlat_aeval_compiled(params, &value, request, param->xlat, NULL, NULL);
+		if (slen < 0) goto error;
+
+		/*
+		 *	The buffer may be longer than the string.
+		 */
+		boxes[i].type = PW_TYPE_STRING;
+		boxes[i].datum.strvalue = value;
+		boxes[i].length = slen;
+		params[i] = &boxes[i];
+	}
+
+	*out = params;
+
+	return 0;
+}
@@ -79,6 +79,14 @@ static const CONF_PARSER postauth_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER batch_config[] = {
+	{ FR_CONF_OFFSET("size", PW_TYPE_INTEGER, rlm_sql_config_t, batch.size), .dflt = "0" },
+	{ FR_CONF_OFFSET("interval", PW_TYPE_TIMEVAL, rlm_sql_config_t, batch.interval), .dflt = "0.1" },
+	{ FR_CONF_OFFSET("wait", PW_TYPE_BOOLEAN, rlm_sql_config_t, batch.wait), .dflt = "yes" },
+	{ FR_CONF_OFFSET("spool", PW_TYPE_FILE_OUTPUT, rlm_sql_config_t, batch.spool) },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("driver", PW_TYPE_STRING, rlm_sql_config_t, sql_driver_name), .dflt = "rlm_sql_null" },
 	{ FR_CONF_OFFSET("server", PW_TYPE_STRING, rlm_sql_config_t, sql_server), .dflt = "" },	/* Must be zero length so drivers can determine if it was set */
@@ -114,9 +122,17 @@ static const CONF_PARSER module_config[] = {
 	 */
 	{ FR_CONF_OFFSET("query_timeout", PW_TYPE_INTEGER, rlm_sql_config_t, query_timeout) },
 
+	/*
+	 *	So does this.
+	 */
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_sql_config_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("prepare", PW_TYPE_BOOLEAN, rlm_sql_config_t, prepare), .dflt = "no" },
+
 	{ FR_CONF_POINTER("accounting", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config },
 
 	{ FR_CONF_POINTER("post-auth", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) postauth_config },
+
+	{ FR_CONF_POINTER("batch", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) batch_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -720,6 +736,43 @@ int sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username)
  */
 #define sql_unset_user(_i, _r) fr_pair_delete_by_num(&_r->packet->vps, _i->sql_user->vendor, _i->sql_user->attr, TAG_ANY)
 
+/** Get check or reply pairs with a query from the configuration
+ *
+ * If the query was compiled into a template, it's executed with the values
+ * of its expansions bound to it.  Otherwise it's expanded.
+ */
+static int sql_getvpdata_fmt(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+			     VALUE_PAIR **pair, char const *fmt)
+{
+	rlm_sql_template_t const	*tmpl;
+	value_box_t const		**params;
+	char				*expanded;
+	int				rows;
+
+	tmpl = rlm_sql_template_find(inst, fmt);
+	if (tmpl) {
+		if (rlm_sql_template_params(request, &params, request, tmpl) < 0) {
+			REDEBUG("Failed generating query parameters");
+			return -1;
+		}
+
+		rows = sql_getvpdata_template(ctx, inst, request, handle, pair, tmpl, params);
+		talloc_free(params);
+
+		return rows;
+	}
+
+	if (xlat_aeval(request, &expanded, request, fmt, inst->sql_escape_func, *handle) < 0) {
+		REDEBUG("Failed generating query");
+		return -1;
+	}
+
+	rows = sql_getvpdata(ctx, inst, request, handle, pair, expanded);
+	talloc_free(expanded);
+
+	return rows;
+}
+
 static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, REQUEST *request,
 			     rlm_sql_grouplist_t **phead)
 {
@@ -727,6 +780,8 @@ static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, R
 	int     num_groups = 0;
 	rlm_sql_row_t row;
 	rlm_sql_grouplist_t *entry;
+	rlm_sql_template_t const *tmpl;
+	value_box_t const **params = NULL;
 	int ret;
 
 	/* NOTE: sql_set_user should have been run before calling this function */
@@ -734,12 +789,24 @@ static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, R
 	entry = *phead = NULL;
 
 	if (!inst->config->groupmemb_query || !*inst->config->groupmemb_query) return 0;
-	if (xlat_aeval(request, &expanded, request, inst->config->groupmemb_query,
-			 inst->sql_escape_func, *handle) < 0) return -1;
 
-	ret = rlm_sql_select_query(inst, request, handle, expanded);
-	talloc_free(expanded);
-	if (ret != RLM_SQL_OK) return -1;
+	tmpl = rlm_sql_template_find(inst, inst->config->groupmemb_query);
+	if (tmpl) {
+		if (rlm_sql_template_params(request, &params, request, tmpl) < 0) return -1;
+
+		ret = rlm_sql_select_query_template(inst, request, handle, tmpl, params);
+		if (ret != RLM_SQL_OK) {
+			talloc_free(params);
+			return -1;
+		}
+	} else {
+		if (xlat_aeval(request, &expanded, request, inst->config->groupmemb_query,
+				 inst->sql_escape_func, *handle) < 0) return -1;
+
+		ret = rlm_sql_select_query(inst, request, handle, expanded);
+		talloc_free(expanded);
+		if (ret != RLM_SQL_OK) return -1;
+	}
 
 	while (rlm_sql_fetch_row(&row, inst, request, handle) == 0) {
 		row = (*handle)->row;
@@ -749,6 +816,7 @@ static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, R
 		if (!row[0]){
 			RDEBUG("row[0] returned NULL");
 			(inst->driver->sql_finish_select_query)(*handle, inst->config);
+			talloc_free(params);
 			talloc_free(entry);
 			return -1;
 		}
@@ -767,6 +835,7 @@ static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, R
 	}
 
 	(inst->driver->sql_finish_select_query)(*handle, inst->config);
+	talloc_free(params);
 
 	return num_groups;
 }
@@ -854,7 +923,6 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t const *inst, REQUEST *reques
 	VALUE_PAIR		*check_tmp = NULL, *reply_tmp = NULL, *sql_group = NULL;
 	rlm_sql_grouplist_t	*head = NULL, *entry = NULL;
 
-	char			*expanded = NULL;
 	int			rows;
 
 	rad_assert(request->packet != NULL);
@@ -910,18 +978,8 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t const *inst, REQUEST *reques
 			vp_cursor_t cursor;
 			VALUE_PAIR *vp;
 
-			/*
-			 *	Expand the group query
-			 */
-			if (xlat_aeval(request, &expanded, request, inst->config->authorize_group_check_query,
-					 inst->sql_escape_func, *handle) < 0) {
-				REDEBUG("Error generating query");
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
-			}
-
-			rows = sql_getvpdata(request, inst, request, handle, &check_tmp, expanded);
-			TALLOC_FREE(expanded);
+			rows = sql_getvpdata_fmt(request, inst, request, handle, &check_tmp,
+						 inst->config->authorize_group_check_query);
 			if (rows < 0) {
 				REDEBUG("Error retrieving check pairs for group %s", entry->name);
 				rcode = RLM_MODULE_FAIL;
@@ -963,15 +1021,8 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t const *inst, REQUEST *reques
 			/*
 			 *	Now get the reply pairs since the paircompare matched
 			 */
-			if (xlat_aeval(request, &expanded, request, inst->config->authorize_group_reply_query,
-					 inst->sql_escape_func, *handle) < 0) {
-				REDEBUG("Error generating query");
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
-			}
-
-			rows = sql_getvpdata(request->reply, inst, request, handle, &reply_tmp, expanded);
-			TALLOC_FREE(expanded);
+			rows = sql_getvpdata_fmt(request->reply, inst, request, handle, &reply_tmp,
+						 inst->config->authorize_group_reply_query);
 			if (rows < 0) {
 				REDEBUG("Error retrieving reply pairs for group %s", entry->name);
 				rcode = RLM_MODULE_FAIL;
@@ -1232,6 +1283,49 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	if (inst->config->async && !inst->driver->sql_async_send) {
+		cf_log_err_cs(conf, "Driver %s does not support asynchronous queries", inst->config->sql_driver_name);
+		return -1;
+	}
+
+	if (inst->config->batch.size) {
+		FR_INTEGER_BOUND_CHECK("batch.size", inst->config->batch.size, <=, 10000);
+		FR_TIMEVAL_BOUND_CHECK("batch.interval", &inst->config->batch.interval, <=, 10, 0);
+	}
+
+	/*
+	 *	Compile the queries we run most often.  Each
+	 *	connection prepares them the first time they're used.
+	 */
+	if (inst->config->prepare) {
+		char const **queries[] = {
+			&inst->config->authorize_check_query,
+			&inst->config->authorize_reply_query,
+			&inst->config->groupmemb_query,
+			&inst->config->authorize_group_check_query,
+			&inst->config->authorize_group_reply_query
+		};
+		size_t i;
+
+		if (!inst->driver->sql_prepare) {
+			cf_log_err_cs(conf, "Driver %s does not support prepared statements",
+				      inst->config->sql_driver_name);
+			return -1;
+		}
+
+		for (i = 0; i < (sizeof(queries) / sizeof(*queries)); i++) {
+			if (!*queries[i] || !**queries[i]) continue;
+
+			if (rlm_sql_template_add(inst, *queries[i]) < 0) return -1;
+		}
+
+		if (inst->config->accounting.reference_cp &&
+		    (rlm_sql_template_add_section(inst, inst->config->accounting.cs) < 0)) return -1;
+
+		if (inst->config->postauth.reference_cp &&
+		    (rlm_sql_template_add_section(inst, inst->config->postauth.cs) < 0)) return -1;
+	}
+
 	/*
 	 *	Initialise the connection pool for this instance
 	 */
@@ -1268,8 +1362,6 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 
 	int	rows;
 
-	char	*expanded = NULL;
-
 	rad_assert(request->packet != NULL);
 	rad_assert(request->reply != NULL);
 
@@ -1306,15 +1398,8 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 		vp_cursor_t cursor;
 		VALUE_PAIR *vp;
 
-		if (xlat_aeval(request, &expanded, request, inst->config->authorize_check_query,
-				 inst->sql_escape_func, handle) < 0) {
-			REDEBUG("Failed generating query");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
-		}
-
-		rows = sql_getvpdata(request, inst, request, &handle, &check_tmp, expanded);
-		TALLOC_FREE(expanded);
+		rows = sql_getvpdata_fmt(request, inst, request, &handle, &check_tmp,
+					 inst->config->authorize_check_query);
 		if (rows < 0) {
 			REDEBUG("Failed getting check attributes");
 			rcode = RLM_MODULE_FAIL;
@@ -1354,15 +1439,8 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 		/*
 		 *	Now get the reply pairs since the paircompare matched
 		 */
-		if (xlat_aeval(request, &expanded, request, inst->config->authorize_reply_query,
-				 inst->sql_escape_func, handle) < 0) {
-			REDEBUG("Error generating query");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
-		}
-
-		rows = sql_getvpdata(request->reply, inst, request, &handle, &reply_tmp, expanded);
-		TALLOC_FREE(expanded);
+		rows = sql_getvpdata_fmt(request->reply, inst, request, &handle, &reply_tmp,
+					 inst->config->authorize_reply_query);
 		if (rows < 0) {
 			REDEBUG("SQL query error getting reply attributes");
 			rcode = RLM_MODULE_FAIL;
@@ -1501,32 +1579,23 @@ error:
 	return rcode;
 }
 
-/*
- *	Generic function for failing between a bunch of queries.
+/** Find the first query to run for an accounting or post-auth section
  *
- *	Uses the same principle as rlm_linelog, expanding the 'reference' config
- *	item using xlat to figure out what query it should execute.
- *
- *	If the reference matches multiple config items, and a query fails or
- *	doesn't update any rows, the next matching config item is used.
+ * Expands the section's 'reference' config item using xlat, to figure out
+ * which config item holds the queries.
  *
+ * @param[out] rcode	to return if no query was found.
+ * @param[in] request	Current request.
+ * @param[in] section	to find the query in.
+ * @return
+ *	- The config item holding the first query.
+ *	- NULL if there's no query to run.
  */
-static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+static CONF_PAIR *acct_query_find(rlm_rcode_t *rcode, REQUEST *request, sql_acct_section_t *section)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-
-	rlm_sql_handle_t	*handle = NULL;
-	int			sql_ret;
-	int			numaffected = 0;
-
 	CONF_ITEM		*item;
-	CONF_PAIR 		*pair;
-	char const		*attr = NULL;
-	char const		*value;
-
 	char			path[FR_MAX_STRING_LEN];
 	char			*p = path;
-	char			*expanded = NULL;
 
 	rad_assert(section);
 
@@ -1535,9 +1604,8 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	}
 
 	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+		*rcode = RLM_MODULE_FAIL;
+		return NULL;
 	}
 
 	/*
@@ -1547,18 +1615,65 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	item = cf_reference_item(NULL, section->cs, path);
 	if (!item) {
 		RWDEBUG("No such configuration item %s", path);
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		*rcode = RLM_MODULE_NOOP;
+		return NULL;
 	}
 	if (cf_item_is_section(item)){
 		RWDEBUG("Sections are not supported as references");
-		rcode = RLM_MODULE_NOOP;
+		*rcode = RLM_MODULE_NOOP;
+		return NULL;
+	}
 
-		goto finish;
+	return cf_item_to_pair(item);
+}
+
+/** Whether queries from a section are written to a log file
+ *
+ */
+static bool sql_query_logged(rlm_sql_t const *inst, sql_acct_section_t const *section)
+{
+	char const *filename = inst->config->logfile;
+
+	if (section->logfile) filename = section->logfile;
+
+	return filename && *filename;
+}
+
+/*
+ *	Generic function for failing between a bunch of queries.
+ *
+ *	Uses the same principle as rlm_linelog, expanding the 'reference' config
+ *	item using xlat to figure out what query it should execute.
+ *
+ *	If the reference matches multiple config items, and a query fails or
+ *	doesn't update any rows, the next matching config item is used.
+ *
+ *	If pair is not NULL, we start with that query, instead of the
+ *	first one the reference matches.
+ */
+static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section, CONF_PAIR *pair)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+
+	rlm_sql_handle_t	*handle = NULL;
+	int			sql_ret;
+	int			numaffected = 0;
+
+	char const		*attr = NULL;
+	char const		*value;
+
+	char			*expanded = NULL;
+
+	rlm_sql_template_t const *tmpl;
+	value_box_t const	**params = NULL;
+
+	rad_assert(section);
+
+	if (!pair) {
+		pair = acct_query_find(&rcode, request, section);
+		if (!pair) return rcode;
 	}
 
-	pair = cf_item_to_pair(item);
 	attr = cf_pair_attr(pair);
 
 	RDEBUG2("Using query template '%s'", attr);
@@ -1581,24 +1696,39 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 			goto finish;
 		}
 
-		if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
-			rcode = RLM_MODULE_FAIL;
+		/*
+		 *	Logged queries are always expanded, so the
+		 *	log has the SQL which was run.
+		 */
+		tmpl = sql_query_logged(inst, section) ? NULL : rlm_sql_template_find(inst, value);
+		if (tmpl) {
+			if (rlm_sql_template_params(request, &params, request, tmpl) < 0) {
+				rcode = RLM_MODULE_FAIL;
 
-			goto finish;
-		}
+				goto finish;
+			}
 
-		if (!*expanded) {
-			RDEBUG("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
-			talloc_free(expanded);
+			sql_ret = rlm_sql_query_template(inst, request, &handle, tmpl, params);
+		} else {
+			if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
+				rcode = RLM_MODULE_FAIL;
 
-			goto finish;
-		}
+				goto finish;
+			}
+
+			if (!*expanded) {
+				RDEBUG("Ignoring null query");
+				rcode = RLM_MODULE_NOOP;
+				talloc_free(expanded);
+
+				goto finish;
+			}
 
-		rlm_sql_query_log(inst, request, section, expanded);
+			rlm_sql_query_log(inst, request, section, expanded);
 
-		sql_ret = rlm_sql_query(inst, request, &handle, expanded);
-		TALLOC_FREE(expanded);
+			sql_ret = rlm_sql_query(inst, request, &handle, expanded);
+			TALLOC_FREE(expanded);
+		}
 		RDEBUG("SQL query returned: %s", fr_int2str(sql_rcode_table, sql_ret, "<INVALID>"));
 
 		switch (sql_ret) {
@@ -1648,6 +1778,8 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 
 		if (numaffected > 0) break;	/* A query succeeded, were done! */
 	next:
+		TALLOC_FREE(params);
+
 		/*
 		 *  We assume all entries with the same name form a redundant
 		 *  set of queries.
@@ -1667,24 +1799,302 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 
 finish:
 	talloc_free(expanded);
+	talloc_free(params);
 	fr_connection_release(inst->pool, request, handle);
 	sql_unset_user(inst, request);
 
 	return rcode;
 }
 
+/** State kept while an accounting or post-auth query is in flight
+ *
+ */
+typedef struct {
+	sql_acct_section_t	*section;		//!< Section the query came from.
+	CONF_PAIR		*pair;			//!< Config item holding the query.
+	rlm_sql_query_t		*query;			//!< The query.
+} sql_acct_ctx_t;
+
+/** Process the result of an accounting or post-auth query
+ *
+ * If the query failed with a constraint violation, or didn't update
+ * anything, the rest of the redundant set of queries is run on a pooled
+ * connection.
+ */
+static rlm_rcode_t acct_async_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_sql_t const		*inst = instance;
+	sql_acct_ctx_t		*acct_ctx = talloc_get_type_abort(ctx, sql_acct_ctx_t);
+	rlm_sql_query_t		*query = acct_ctx->query;
+	rlm_rcode_t		rcode;
+
+	RDEBUG("SQL query returned: %s", fr_int2str(sql_rcode_table, query->rcode, "<INVALID>"));
+
+	switch (query->rcode) {
+	case RLM_SQL_OK:
+		RDEBUG("%i record(s) updated", query->affected_rows);
+		if (query->affected_rows > 0) {
+			rcode = RLM_MODULE_OK;
+			break;
+		}
+		goto next;
+
+	case RLM_SQL_ALT_QUERY:
+		if (query->error) RDEBUG("%s: %s", inst->config->sql_driver_name, query->error);
+		goto next;
+
+	case RLM_SQL_QUERY_INVALID:
+		if (query->error) RERROR("%s: %s", inst->config->sql_driver_name, query->error);
+		rcode = RLM_MODULE_INVALID;
+		break;
+
+	default:
+		if (query->error) RERROR("%s: %s", inst->config->sql_driver_name, query->error);
+		rcode = RLM_MODULE_FAIL;
+		break;
+
+	next:
+		acct_ctx->pair = cf_pair_find_next(acct_ctx->section->cs, acct_ctx->pair, cf_pair_attr(acct_ctx->pair));
+		if (!acct_ctx->pair) {
+			RDEBUG("No additional queries configured");
+			rcode = RLM_MODULE_NOOP;
+			break;
+		}
+
+		RDEBUG("Trying next query...");
+		rcode = acct_redundant(inst, request, acct_ctx->section, acct_ctx->pair);
+		break;
+	}
+
+	rlm_sql_query_release(query);
+	talloc_free(acct_ctx);
+
+	return rcode;
+}
+
+/** Stop waiting for the query if the request is cancelled
+ *
+ */
+static void acct_async_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			      fr_state_action_t action)
+{
+	sql_acct_ctx_t *acct_ctx = talloc_get_type_abort(ctx, sql_acct_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("Cancelling pending SQL query");
+
+	rlm_sql_query_release(acct_ctx->query);
+	talloc_free(acct_ctx);
+}
+
+/** Send the first query of an accounting or post-auth section on the thread's connection
+ *
+ * The request yields until the result arrives, so the worker can get on
+ * with other requests, and queries from many requests can be in flight
+ * on the same connection.
+ */
+static rlm_rcode_t acct_async(rlm_sql_t const *inst, rlm_sql_thread_t *t, REQUEST *request,
+			      sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	rlm_sql_handle_t	*handle;
+	rlm_sql_query_t		*query;
+	sql_acct_ctx_t		*acct_ctx;
+	CONF_PAIR		*pair;
+	char const		*value;
+	char			*expanded = NULL;
+
+	/*
+	 *	The connection is as busy as we let it get.
+	 */
+	if (fr_fifo_num_elements(t->queries) >= SQL_ASYNC_MAX_QUERIES) {
+		RDEBUG2("Too many queries in flight, using a pooled connection");
+		return acct_redundant(inst, request, section, NULL);
+	}
+
+	pair = acct_query_find(&rcode, request, section);
+	if (!pair) return rcode;
+
+	RDEBUG2("Using query template '%s'", cf_pair_attr(pair));
+
+	value = cf_pair_value(pair);
+	if (!value) {
+		RDEBUG("Ignoring null query");
+		return RLM_MODULE_NOOP;
+	}
+
+	handle = rlm_sql_async_handle(t);
+	if (!handle) {
+		REDEBUG("No connection available for asynchronous queries");
+		return RLM_MODULE_FAIL;
+	}
+
+	sql_set_user(inst, request, NULL);
+	if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
+		sql_unset_user(inst, request);
+		return RLM_MODULE_FAIL;
+	}
+	sql_unset_user(inst, request);
+
+	if (!*expanded) {
+		RDEBUG("Ignoring null query");
+		talloc_free(expanded);
+		return RLM_MODULE_NOOP;
+	}
+
+	rlm_sql_query_log(inst, request, section, expanded);
+
+	query = rlm_sql_query_async(t, request, expanded);
+	talloc_free(expanded);
+	if (!query) return RLM_MODULE_FAIL;
+
+	MEM(acct_ctx = talloc(request, sql_acct_ctx_t));
+	acct_ctx->section = section;
+	acct_ctx->pair = pair;
+	acct_ctx->query = query;
+
+	return unlang_yield(request, acct_async_resume, acct_async_action, acct_ctx);
+}
+
 #ifdef WITH_ACCOUNTING
 
+/** Return the outcome of writing a request's accounting queries
+ *
+ */
+static rlm_rcode_t acct_batch_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_sql_batch_entry_t	*entry = talloc_get_type_abort(ctx, rlm_sql_batch_entry_t);
+	rlm_rcode_t		rcode = entry->rcode;
+
+	RDEBUG("Batch written: %s", fr_int2str(mod_rcode_table, rcode, "<INVALID>"));
+
+	rlm_sql_batch_release(entry);
+
+	return rcode;
+}
+
+/** Stop waiting for the batch if the request is cancelled
+ *
+ * The request's queries are still written.
+ */
+static void acct_batch_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			      fr_state_action_t action)
+{
+	rlm_sql_batch_entry_t *entry = talloc_get_type_abort(ctx, rlm_sql_batch_entry_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	RDEBUG("No longer waiting for batch to be written");
+
+	rlm_sql_batch_release(entry);
+}
+
+/** Queue the queries of an accounting section, to be written with those of other requests
+ *
+ * The query the reference points to, and its alternatives, are all expanded
+ * now, as the request may be gone by the time they're written.  If batch.wait
+ * is set, the request yields until they have been.
+ */
+static rlm_rcode_t acct_batch(rlm_sql_t const *inst, rlm_sql_thread_t *t, REQUEST *request,
+			      sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	rlm_sql_handle_t	*handle;
+	rlm_sql_batch_entry_t	*entry;
+	CONF_PAIR		*pair, *next;
+	char const		*attr;
+	char			**queries;
+	size_t			i, num = 0;
+
+	pair = acct_query_find(&rcode, request, section);
+	if (!pair) return rcode;
+
+	attr = cf_pair_attr(pair);
+
+	RDEBUG2("Using query template '%s'", attr);
+
+	for (next = pair; next; next = cf_pair_find_next(section->cs, next, attr)) num++;
+	MEM(queries = talloc_zero_array(request, char *, num));
+
+	/*
+	 *	The connection is only used for escaping.
+	 */
+	handle = fr_connection_get(inst->pool, request);
+	if (!handle) {
+		talloc_free(queries);
+		return RLM_MODULE_FAIL;
+	}
+
+	sql_set_user(inst, request, NULL);
+
+	for (i = 0, next = pair; i < num; i++, next = cf_pair_find_next(section->cs, next, attr)) {
+		char const *value = cf_pair_value(next);
+
+		if (!value) break;
+
+		if (xlat_aeval(queries, &queries[i], request, value, inst->sql_escape_func, handle) < 0) {
+			rcode = RLM_MODULE_FAIL;
+			break;
+		}
+
+		if (!*queries[i]) {
+			TALLOC_FREE(queries[i]);
+			break;
+		}
+	}
+
+	sql_unset_user(inst, request);
+	fr_connection_release(inst->pool, request, handle);
+
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(queries);
+		return rcode;
+	}
+
+	if (i == 0) {
+		RDEBUG("Ignoring null query");
+		talloc_free(queries);
+		return RLM_MODULE_NOOP;
+	}
+	if (i < num) MEM(queries = talloc_realloc(request, queries, char *, i));
+
+	rlm_sql_query_log(inst, request, section, queries[0]);
+
+	entry = rlm_sql_batch_add(t, request, queries);
+	if (!entry) return RLM_MODULE_OK;
+
+	/*
+	 *	The batch was written when we added to it.
+	 */
+	if (entry->done) {
+		rcode = entry->rcode;
+		rlm_sql_batch_release(entry);
+
+		return rcode;
+	}
+
+	RDEBUG("Waiting for batch to be written...");
+
+	entry->yielded = true;
+
+	return unlang_yield(request, acct_batch_resume, acct_batch_action, entry);
+}
+
 /*
  *	Accounting: Insert or update session data in our sql table
  */
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_sql_t const *inst = instance;
 
 	if (inst->config->accounting.reference_cp) {
-		return acct_redundant(inst, request, &inst->config->accounting);
+		if (inst->config->batch.size) return acct_batch(inst, thread, request, &inst->config->accounting);
+
+		if (inst->config->async) return acct_async(inst, thread, request, &inst->config->accounting);
+
+		return acct_redundant(inst, request, &inst->config->accounting, NULL);
 	}
 
 	return RLM_MODULE_NOOP;
@@ -1903,13 +2313,15 @@ release:
 /*
  *	Postauth: Write a record of the authentication attempt
  */
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
 	rlm_sql_t const *inst = instance;
 
 	if (inst->config->postauth.reference_cp) {
-		return acct_redundant(inst, request, &inst->config->postauth);
+		if (inst->config->async) return acct_async(inst, thread, request, &inst->config->postauth);
+
+		return acct_redundant(inst, request, &inst->config->postauth, NULL);
 	}
 
 	return RLM_MODULE_NOOP;
@@ -1920,17 +2332,60 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
  */
 
 
+/** Open the connection this thread's asynchronous queries share, and set up its batch
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_sql_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el,
+				  void *thread)
+{
+	rlm_sql_t const		*inst = instance;
+	rlm_sql_thread_t	*t = thread;
+
+	t->inst = inst;
+	t->el = el;
+	t->fd = -1;
+
+	if (inst->config->batch.size && (rlm_sql_batch_init(t) < 0)) return -1;
+
+	if (!inst->config->async) return 0;
+
+	return rlm_sql_async_init(t);
+}
+
+/** Write the thread's batch, and close the connection its asynchronous queries share
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	rlm_sql_batch_free(thread);
+	rlm_sql_async_free(thread);
+
+	return 0;
+}
+
 /* globally exported name */
 extern rad_module_t rlm_sql;
 rad_module_t rlm_sql = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "sql",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_sql_t),
-	.config		= module_config,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "sql",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_sql_t),
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
+	.config			= module_config,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.detach			= mod_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 #ifdef WITH_ACCOUNTING
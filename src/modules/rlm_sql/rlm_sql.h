@@ -83,6 +83,19 @@ typedef struct sql_acct_section {
 	char const		**query;			/* for xlat parsing */
 } sql_acct_section_t;
 
+/** Write-behind of accounting queries
+ *
+ */
+typedef struct sql_batch_config {
+	uint32_t		size;				//!< Most requests whose queries are written together.
+								//!< 0 disables batching.
+	struct timeval		interval;			//!< Longest time a query waits to be written.
+	bool			wait;				//!< Whether requests wait until their queries
+								//!< have been committed.
+	char const		*spool;				//!< File to write queries to, if they can't be
+								//!< written to the database.
+} sql_batch_config_t;
+
 typedef struct sql_config {
 	char const 		*sql_driver_name;		//!< SQL driver module name e.g. rlm_sql_sqlite.
 	char const 		*sql_server;			//!< Server to connect to.
@@ -132,6 +145,14 @@ typedef struct sql_config {
 	char const		*allowed_chars;			//!< Chars which done need escaping..
 	uint32_t		query_timeout;			//!< How long to allow queries to run for.
 
+	bool			async;				//!< If true, accounting and post-auth queries
+								//!< are sent on a per-thread connection, without
+								//!< waiting for the result of the previous one.
+
+	bool			prepare;			//!< If true, queries are prepared once per connection,
+								//!< and the values of their expansions are bound
+								//!< to placeholders instead of being escaped.
+
 	char const		*connect_query;			//!< Query executed after establishing
 								//!< new connection.
 
@@ -148,6 +169,8 @@ typedef struct sql_config {
 	 */
 	sql_acct_section_t	postauth;
 	sql_acct_section_t	accounting;
+
+	sql_batch_config_t	batch;
 } rlm_sql_config_t;
 
 typedef struct sql_inst rlm_sql_t;
@@ -158,14 +181,44 @@ typedef struct rlm_sql_handle {
 	rlm_sql_t const		*inst;				//!< The rlm_sql instance this connection belongs to.
 	TALLOC_CTX		*log_ctx;			//!< Talloc pool used to avoid allocing memory
 								//!< when log strings need to be copied.
+	void			**stmts;			//!< Statements prepared on this connection,
+								//!< indexed by template id.
 } rlm_sql_handle_t;
 
+/** A value bound to a placeholder in a query template
+ *
+ */
+typedef struct sql_param {
+	vp_tmpl_t		*vpt;				//!< Attribute whose value is bound, if the
+								//!< expansion was a plain attribute reference.
+	xlat_exp_t		*xlat;				//!< Otherwise, the expansion whose result is
+								//!< bound as a string.
+	bool			integer;			//!< Bind the attribute's value as a number, as
+								//!< %{integer:...} would print it.
+	value_box_t		dflt;				//!< Bound if the attribute doesn't exist.
+								//!< #PW_TYPE_INVALID binds NULL.
+} rlm_sql_param_t;
+
+/** A query with placeholders in place of its expansions
+ *
+ * Compiled from a query in the configuration when the module is instantiated.
+ */
+typedef struct sql_template {
+	char const		*fmt;				//!< Query as it was configured.
+	char const		*query;				//!< Query with placeholders.
+	int			id;				//!< Index into rlm_sql_handle_t.stmts.
+	int			num_params;			//!< Number of placeholders.
+	rlm_sql_param_t		*params;			//!< What to bind to each placeholder.
+} rlm_sql_template_t;
+
 extern const FR_NAME_NUMBER sql_rcode_table[];
 /*
  *	Capabilities flags for drivers
  */
 #define RLM_SQL_RCODE_FLAGS_ALT_QUERY	1			//!< Can distinguish between other errors and those
 								//!< resulting from a unique key violation.
+#define RLM_SQL_FLAGS_NUMBERED_PARAMS	2			//!< Placeholders are written $1, $2 etc...
+								//!< instead of ?.
 
 /** Retrieve errors from the last query operation
  *
@@ -217,6 +270,47 @@ typedef struct rlm_sql_driver_t {
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 
 	xlat_escape_t	sql_escape_func;
+
+	/*
+	 *	Optional.  Only for drivers which can have many queries
+	 *	in flight on one connection.  See async.c.
+	 *
+	 *	sql_async_init puts a new connection into that mode, and
+	 *	writes out the fd to watch.  sql_async_send queues a query.
+	 *	sql_async_flush writes queued queries, and returns 0 if
+	 *	they've all been written, 1 if some are left, or -1 on error.
+	 *	sql_async_read reads whatever has arrived.
+	 *	sql_async_result returns 1 and the outcome of the oldest
+	 *	query if its result has arrived, 0 if it hasn't, or -1 on
+	 *	error.  Results must be returned in the order the queries
+	 *	were sent.
+	 */
+	sql_rcode_t (*sql_async_init)(int *fd, rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	sql_rcode_t (*sql_async_send)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
+	int (*sql_async_flush)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	sql_rcode_t (*sql_async_read)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	int (*sql_async_result)(TALLOC_CTX *ctx, sql_rcode_t *rcode, int *affected_rows, char **error,
+				rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+
+	/*
+	 *	Optional.  Only for drivers which can prepare statements.
+	 *	See prepare.c.
+	 *
+	 *	sql_prepare writes out a statement which stays valid for
+	 *	the life of the connection, and should be parented by
+	 *	handle->conn.  sql_execute and sql_select_execute bind
+	 *	params and run the statement, as sql_query and
+	 *	sql_select_query would run its text.  A NULL param binds
+	 *	NULL.  Others are #PW_TYPE_STRING, #PW_TYPE_INTEGER64 or
+	 *	#PW_TYPE_SIGNED, and remain valid until the query is
+	 *	finished.
+	 */
+	sql_rcode_t (*sql_prepare)(void **stmt, rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+				   char const *query, int num_params);
+	sql_rcode_t (*sql_execute)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, void *stmt,
+				   value_box_t const *params[], int num_params);
+	sql_rcode_t (*sql_select_execute)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, void *stmt,
+					  value_box_t const *params[], int num_params);
 } rlm_sql_driver_t;
 
 struct sql_inst {
@@ -241,8 +335,86 @@ struct sql_inst {
 
 	char const		*name;			//!< Module instance name.
 	fr_dict_attr_t const	*group_da;		//!< Group dictionary attribute.
+
+	rbtree_t		*templates;		//!< Compiled queries, keyed by their format string.
+							//!< NULL unless prepare is enabled.
+	int			num_templates;		//!< Number of compiled queries.
 };
 
+/** Queries which may be in flight on a thread's connection
+ *
+ * If there are more, the query is run on a pooled connection instead.
+ */
+#define SQL_ASYNC_MAX_QUERIES	1024
+
+/** Batches which may wait for room in the pipe to a thread's writer
+ *
+ * If there are more, the batch fails, and its queries are spooled.
+ */
+#define SQL_BATCH_MAX_PENDING	1024
+
+/** Accounting queries from one request, waiting to be written
+ *
+ */
+typedef struct rlm_sql_batch_entry {
+	REQUEST			*request;		//!< Request waiting for the queries to be committed.
+							//!< NULL if it isn't waiting.
+	bool			yielded;		//!< Whether the request yielded, and must be marked
+							//!< as resumable when we're done.
+	bool			done;			//!< Whether we've finished with the queries.
+
+	char			**queries;		//!< The query, and its alternatives, expanded.
+	size_t			prefix_len;		//!< Length of the first query up to and including
+							//!< VALUES, if it's an INSERT of a single row.
+							//!< Such queries may be combined.  Otherwise 0.
+	bool			written;		//!< Whether the queries have been committed.
+
+	rlm_rcode_t		rcode;			//!< Outcome, once done.
+} rlm_sql_batch_entry_t;
+
+/** Thread specific data for asynchronous queries and batches
+ *
+ */
+typedef struct rlm_sql_thread {
+	rlm_sql_t const		*inst;			//!< Instance of rlm_sql.
+	fr_event_list_t		*el;			//!< Event list serviced by this thread.
+
+	rlm_sql_handle_t	*handle;		//!< Connection shared by this thread's queries.
+							//!< NULL if we're not connected.
+	int			fd;			//!< File descriptor of the connection.
+	bool			flushing;		//!< Whether we're waiting for the connection to
+							//!< become writable.
+	fr_fifo_t		*queries;		//!< Queries sent on the connection, in the order
+							//!< their results will arrive.
+
+	rlm_sql_batch_entry_t	**batch;		//!< Accounting queries waiting to be written.
+	uint32_t		num_batched;		//!< Number of entries in batch.
+	fr_event_timer_t	*flush_ev;		//!< Writes the batch when its oldest entry has
+							//!< waited for batch.interval.
+	pthread_t		writer;			//!< Writes batches, so the event loop doesn't wait
+							//!< for the database.
+	int			to_writer[2];		//!< Pipe batches are handed to the writer on.
+	int			from_writer[2];		//!< Pipe the writer hands written batches back on.
+	fr_fifo_t		*pending;		//!< Batches waiting for room in the pipe to the writer.
+	bool			handing_over;		//!< Whether we're waiting for the pipe to the writer
+							//!< to become writable.
+} rlm_sql_thread_t;
+
+/** An asynchronous query
+ *
+ */
+typedef struct rlm_sql_query {
+	REQUEST			*request;		//!< Request waiting for the query.  NULL if it
+							//!< stopped waiting before the result arrived.
+	bool			done;			//!< Whether the result has arrived, or the connection
+							//!< the query was sent on has gone.
+	bool			resumed;		//!< Whether the request has been marked as resumable.
+
+	sql_rcode_t		rcode;			//!< Outcome of the query.
+	int			affected_rows;		//!< Number of rows the query changed.
+	char			*error;			//!< Why the query failed.  May be NULL.
+} rlm_sql_query_t;
+
 typedef struct sql_grouplist {
 	char			*name;
 	struct sql_grouplist	*next;
@@ -252,6 +424,8 @@ void		*mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *ti
 int		sql_fr_pair_list_afrom_str(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **first_pair, rlm_sql_row_t row);
 int		sql_read_realms(rlm_sql_handle_t *handle);
 int		sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, VALUE_PAIR **pair, char const *query);
+int		sql_getvpdata_template(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+				       VALUE_PAIR **pair, rlm_sql_template_t const *tmpl, value_box_t const *params[]);
 int		sql_read_clients(rlm_sql_handle_t *handle);
 int		sql_dict_init(rlm_sql_handle_t *handle);
 void 		rlm_sql_query_log(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section, char const *query) CC_HINT(nonnull (1, 2, 4));
@@ -260,4 +434,35 @@ sql_rcode_t	rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle);
 void		rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username);
+
+/*
+ *	async.c - Queries which share a per-thread connection.
+ */
+int		rlm_sql_async_init(rlm_sql_thread_t *t) CC_HINT(nonnull);
+void		rlm_sql_async_free(rlm_sql_thread_t *t) CC_HINT(nonnull);
+rlm_sql_handle_t *rlm_sql_async_handle(rlm_sql_thread_t *t) CC_HINT(nonnull);
+rlm_sql_query_t	*rlm_sql_query_async(rlm_sql_thread_t *t, REQUEST *request, char const *query) CC_HINT(nonnull);
+void		rlm_sql_query_release(rlm_sql_query_t *query) CC_HINT(nonnull);
+
+/*
+ *	batch.c - Accounting queries written in batches.
+ */
+int		rlm_sql_batch_init(rlm_sql_thread_t *t) CC_HINT(nonnull);
+void		rlm_sql_batch_free(rlm_sql_thread_t *t) CC_HINT(nonnull);
+rlm_sql_batch_entry_t *rlm_sql_batch_add(rlm_sql_thread_t *t, REQUEST *request, char **queries) CC_HINT(nonnull (1, 3));
+void		rlm_sql_batch_release(rlm_sql_batch_entry_t *entry) CC_HINT(nonnull);
+
+/*
+ *	prepare.c - Queries prepared once per connection.
+ */
+rlm_sql_template_t *rlm_sql_template_compile(rlm_sql_t const *inst, char const *fmt) CC_HINT(nonnull);
+int		rlm_sql_template_add(rlm_sql_t *inst, char const *fmt) CC_HINT(nonnull);
+int		rlm_sql_template_add_section(rlm_sql_t *inst, CONF_SECTION *cs) CC_HINT(nonnull);
+rlm_sql_template_t const *rlm_sql_template_find(rlm_sql_t const *inst, char const *fmt) CC_HINT(nonnull);
+int		rlm_sql_template_params(TALLOC_CTX *ctx, value_box_t const **out[], REQUEST *request,
+					rlm_sql_template_t const *tmpl) CC_HINT(nonnull);
+sql_rcode_t	rlm_sql_query_template(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+				       rlm_sql_template_t const *tmpl, value_box_t const *params[]) CC_HINT(nonnull (1, 3, 4));
+sql_rcode_t	rlm_sql_select_query_template(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+					      rlm_sql_template_t const *tmpl, value_box_t const *params[]) CC_HINT(nonnull (1, 3, 4));
 #endif
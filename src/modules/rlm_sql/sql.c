@@ -300,23 +300,65 @@ void rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle
 	talloc_free_children(handle->log_ctx);
 }
 
-/** Call the driver's sql_query method, reconnecting if necessary.
+/** Print the values bound to a query template's placeholders
  *
- * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
- *	after they're done with the result.
+ */
+static void sql_params_debug(REQUEST *request, rlm_sql_template_t const *tmpl, value_box_t const *params[])
+{
+	int	i;
+	char	*value;
+
+	if (!request || !RDEBUG_ENABLED3) return;
+
+	RINDENT();
+	for (i = 0; i < tmpl->num_params; i++) {
+		if (!params[i]) {
+			RDEBUG3("[%i] NULL", i + 1);
+			continue;
+		}
+
+		value = value_box_asprint(request, params[i]->type, NULL, params[i], '\'');
+		RDEBUG3("[%i] %s", i + 1, value);
+		talloc_free(value);
+	}
+	REXDENT();
+}
+
+/** Run a query, or a query template, on a connection
  *
- * @param handle to query the database with. *handle should not be NULL, as this indicates
- * 	previous reconnection attempt has failed.
- * @param request Current request.
- * @param inst #rlm_sql_t instance data.
- * @param query to execute. Should not be zero length.
- * @return
- *	- #RLM_SQL_OK on success.
- *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
- *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
- *	- #RLM_SQL_ALT_QUERY on constraints violation.
+ * If the template hasn't been prepared on this connection yet, it's
+ * prepared first.
  */
-sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query)
+static sql_rcode_t sql_query_exec(rlm_sql_t const *inst, rlm_sql_handle_t *handle, char const *query,
+				  rlm_sql_template_t const *tmpl, value_box_t const *params[], bool select)
+{
+	sql_rcode_t ret;
+
+	if (!tmpl) {
+		if (select) return (inst->driver->sql_select_query)(handle, inst->config, query);
+
+		return (inst->driver->sql_query)(handle, inst->config, query);
+	}
+
+	if (!handle->stmts) MEM(handle->stmts = talloc_zero_array(handle, void *, inst->num_templates));
+
+	if (!handle->stmts[tmpl->id]) {
+		ret = (inst->driver->sql_prepare)(&handle->stmts[tmpl->id], handle, inst->config,
+						  tmpl->query, tmpl->num_params);
+		if (ret != RLM_SQL_OK) return ret;
+	}
+
+	if (select) return (inst->driver->sql_select_execute)(handle, inst->config, handle->stmts[tmpl->id],
+							      params, tmpl->num_params);
+
+	return (inst->driver->sql_execute)(handle, inst->config, handle->stmts[tmpl->id], params, tmpl->num_params);
+}
+
+/** Run a query or query template, reconnecting if necessary
+ *
+ */
+static sql_rcode_t sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query,
+			     rlm_sql_template_t const *tmpl, value_box_t const *params[])
 {
 	int ret = RLM_SQL_ERROR;
 	int i, count;
@@ -340,9 +382,14 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 	 *  a new connection, then give up.
 	 */
 	for (i = 0; i < (count + 1); i++) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query);
+		if (tmpl) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Executing prepared query: %s", query);
+			sql_params_debug(request, tmpl, params);
+		} else {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query);
+		}
 
-		ret = (inst->driver->sql_query)(*handle, inst->config, query);
+		ret = sql_query_exec(inst, *handle, query, tmpl, params, false);
 		switch (ret) {
 		case RLM_SQL_OK:
 			break;
@@ -402,22 +449,11 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 	return RLM_SQL_ERROR;
 }
 
-/** Call the driver's sql_select_query method, reconnecting if necessary.
+/** Run a select query or query template, reconnecting if necessary
  *
- * @note Caller must call ``(inst->driver->sql_finish_select_query)(handle, inst->config);``
- *	after they're done with the result.
- *
- * @param inst #rlm_sql_t instance data.
- * @param request Current request.
- * @param handle to query the database with. *handle should not be NULL, as this indicates
- *	  previous reconnection attempt has failed.
- * @param query to execute. Should not be zero length.
- * @return
- *	- #RLM_SQL_OK on success.
- *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
- *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
  */
-sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,  char const *query)
+static sql_rcode_t sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+				    char const *query, rlm_sql_template_t const *tmpl, value_box_t const *params[])
 {
 	int ret = RLM_SQL_ERROR;
 	int i, count;
@@ -441,9 +477,14 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sq
 	 *  For sanity, for when no connections are viable, and we can't make a new one
 	 */
 	for (i = 0; i < (count + 1); i++) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "Executing select query: %s", query);
+		if (tmpl) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Executing prepared select query: %s", query);
+			sql_params_debug(request, tmpl, params);
+		} else {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Executing select query: %s", query);
+		}
 
-		ret = (inst->driver->sql_select_query)(*handle, inst->config, query);
+		ret = sql_query_exec(inst, *handle, query, tmpl, params, true);
 		switch (ret) {
 		case RLM_SQL_OK:
 			break;
@@ -475,6 +516,85 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sq
 	return RLM_SQL_ERROR;
 }
 
+/** Call the driver's sql_query method, reconnecting if necessary.
+ *
+ * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
+ *	after they're done with the result.
+ *
+ * @param handle to query the database with. *handle should not be NULL, as this indicates
+ * 	previous reconnection attempt has failed.
+ * @param request Current request.
+ * @param inst #rlm_sql_t instance data.
+ * @param query to execute. Should not be zero length.
+ * @return
+ *	- #RLM_SQL_OK on success.
+ *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
+ *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
+ *	- #RLM_SQL_ALT_QUERY on constraints violation.
+ */
+sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query)
+{
+	return sql_query(inst, request, handle, query, NULL, NULL);
+}
+
+/** Call the driver's sql_select_query method, reconnecting if necessary.
+ *
+ * @note Caller must call ``(inst->driver->sql_finish_select_query)(handle, inst->config);``
+ *	after they're done with the result.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle to query the database with. *handle should not be NULL, as this indicates
+ *	  previous reconnection attempt has failed.
+ * @param query to execute. Should not be zero length.
+ * @return
+ *	- #RLM_SQL_OK on success.
+ *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
+ *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
+ */
+sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,  char const *query)
+{
+	return sql_select_query(inst, request, handle, query, NULL, NULL);
+}
+
+/** Execute a query template, preparing it on the connection if necessary
+ *
+ * As #rlm_sql_query, but the values in params are bound to the template's
+ * placeholders.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle to query the database with.
+ * @param tmpl to execute.
+ * @param params from #rlm_sql_template_params.  Must remain valid until the
+ *	query is finished.
+ * @return as #rlm_sql_query.
+ */
+sql_rcode_t rlm_sql_query_template(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+				   rlm_sql_template_t const *tmpl, value_box_t const *params[])
+{
+	return sql_query(inst, request, handle, tmpl->query, tmpl, params);
+}
+
+/** Execute a select query template, preparing it on the connection if necessary
+ *
+ * As #rlm_sql_select_query, but the values in params are bound to the
+ * template's placeholders.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle to query the database with.
+ * @param tmpl to execute.
+ * @param params from #rlm_sql_template_params.  Must remain valid until the
+ *	query is finished.
+ * @return as #rlm_sql_select_query.
+ */
+sql_rcode_t rlm_sql_select_query_template(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+					  rlm_sql_template_t const *tmpl, value_box_t const *params[])
+{
+	return sql_select_query(inst, request, handle, tmpl->query, tmpl, params);
+}
+
 
 /*************************************************************************
  *
@@ -483,17 +603,11 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sq
  *	Purpose: Get any group check or reply pairs
  *
  *************************************************************************/
-int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
-		  VALUE_PAIR **pair, char const *query)
+static int sql_getvpdata_rows(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+			      VALUE_PAIR **pair)
 {
 	rlm_sql_row_t	row;
 	int		rows = 0;
-	sql_rcode_t	rcode;
-
-	rad_assert(request);
-
-	rcode = rlm_sql_select_query(inst, request, handle, query);
-	if (rcode != RLM_SQL_OK) return -1; /* error handled by rlm_sql_select_query */
 
 	while (rlm_sql_fetch_row(&row, inst, request, handle) == 0) {
 		if (!row) break;
@@ -511,6 +625,35 @@ int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_
 	return rows;
 }
 
+int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+		  VALUE_PAIR **pair, char const *query)
+{
+	sql_rcode_t	rcode;
+
+	rad_assert(request);
+
+	rcode = rlm_sql_select_query(inst, request, handle, query);
+	if (rcode != RLM_SQL_OK) return -1; /* error handled by rlm_sql_select_query */
+
+	return sql_getvpdata_rows(ctx, inst, request, handle, pair);
+}
+
+/** As #sql_getvpdata, but executes a query template
+ *
+ */
+int sql_getvpdata_template(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+			   VALUE_PAIR **pair, rlm_sql_template_t const *tmpl, value_box_t const *params[])
+{
+	sql_rcode_t	rcode;
+
+	rad_assert(request);
+
+	rcode = rlm_sql_select_query_template(inst, request, handle, tmpl, params);
+	if (rcode != RLM_SQL_OK) return -1; /* error handled by rlm_sql_select_query_template */
+
+	return sql_getvpdata_rows(ctx, inst, request, handle, pair);
+}
+
 /*
  *	Log the query to a file.
  */
@@ -1,4 +1,4 @@
-SUBMAKEFILES := rbmonkey.mk eapol_test/all.mk dict/all.mk unit/all.mk map/all.mk xlat/all.mk keywords/all.mk util/all.mk auth/all.mk modules/all.mk daemon/all.mk
+SUBMAKEFILES := rbmonkey.mk trie_test.mk hash_test.mk hash_table_test.mk event_timer_test.mk radius_decode_test.mk radius_encode_test.mk radius_verify_test.mk detail_write_test.mk detail_binary_test.mk detail_replay_test.mk sql_prepare_test.mk eapol_test/all.mk dict/all.mk unit/all.mk map/all.mk xlat/all.mk keywords/all.mk util/all.mk auth/all.mk modules/all.mk daemon/all.mk
 
 #
 #  Include all of the autoconf definitions into the Make variable space
@@ -0,0 +1,388 @@
+/*
+ * detail_binary_test.c	Checks and benchmarks for binary detail records, vs
+ *			the text format.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	What a typical Accounting-Request looks like.
+ */
+static char const	*acct_attrs =
+	"User-Name = \"bob@example.com\", "
+	"Acct-Status-Type = Interim-Update, "
+	"Acct-Session-Id = \"0123456789abcdef\", "
+	"NAS-IP-Address = 192.0.2.254, "
+	"NAS-Port = 1234, "
+	"Framed-IP-Address = 192.0.2.1, "
+	"Acct-Input-Octets = 123456789, "
+	"Acct-Output-Octets = 987654321, "
+	"Acct-Session-Time = 3600, "
+	"Event-Timestamp = 1500000000, "
+	"Called-Station-Id = \"00-11-22-33-44-55:ssid\", "
+	"Calling-Station-Id = \"66-77-88-99-aa-bb\"";
+
+static char const	*secret;
+static int		num_ops = 200000;
+static int		errors;
+
+/** Check the CRC against known answers
+ *
+ * From RFC 3720, section B.4.
+ */
+static void crc_check(void)
+{
+	uint8_t		data[32];
+	uint32_t	crc;
+	size_t		i;
+
+	if (fr_crc32c("123456789", 9) != 0xe3069283) {
+		fprintf(stderr, "CRC-32C of \"123456789\" is wrong\n");
+		errors++;
+	}
+
+	memset(data, 0, sizeof(data));
+	if (fr_crc32c(data, sizeof(data)) != 0x8a9136aa) {
+		fprintf(stderr, "CRC-32C of 32 zero bytes is wrong\n");
+		errors++;
+	}
+
+	memset(data, 0xff, sizeof(data));
+	if (fr_crc32c(data, sizeof(data)) != 0x62a8ab43) {
+		fprintf(stderr, "CRC-32C of 32 0xff bytes is wrong\n");
+		errors++;
+	}
+
+	for (i = 0; i < sizeof(data); i++) data[i] = i;
+	if (fr_crc32c(data, sizeof(data)) != 0x46dd794e) {
+		fprintf(stderr, "CRC-32C of 32 incrementing bytes is wrong\n");
+		errors++;
+	}
+
+	/*
+	 *	Every split must give the same answer as the whole.
+	 */
+	for (i = 0; i <= sizeof(data); i++) {
+		crc = fr_crc32c(data, i);
+		crc = fr_crc32c_update(data + i, sizeof(data) - i, crc);
+		if (crc != 0x46dd794e) {
+			fprintf(stderr, "CRC-32C split at %zu is wrong\n", i);
+			errors++;
+		}
+	}
+
+	printf("CRC-32C known answers checked\n");
+}
+
+/** Write an entry the way rlm_detail does in the text format
+ *
+ */
+static char *text_write(TALLOC_CTX *ctx, RADIUS_PACKET *packet)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	char		*out;
+	char		buffer[1024];
+
+	out = talloc_asprintf(ctx, "Fri Jul 14 02:40:00 2017\n\tPacket-Type = %s\n", fr_packet_codes[packet->code]);
+
+	for (vp = fr_pair_cursor_init(&cursor, &packet->vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		fr_pair_snprint(buffer, sizeof(buffer), vp);
+		out = talloc_asprintf_append_buffer(out, "\t%s\n", buffer);
+	}
+
+	return talloc_asprintf_append_buffer(out, "\tTimestamp = %ld\n\n", (long) packet->timestamp.tv_sec);
+}
+
+/** Read an entry the way proto_detail does in the text format
+ *
+ */
+static VALUE_PAIR *text_read(TALLOC_CTX *ctx, char const *entry)
+{
+	char const	*p = entry, *eol;
+	VALUE_PAIR	*head = NULL;
+	vp_cursor_t	cursor;
+	char		buffer[2048];
+
+	fr_pair_cursor_init(&cursor, &head);
+
+	/*
+	 *	Skip the header line.
+	 */
+	p = strchr(p, '\n') + 1;
+
+	while ((eol = strchr(p, '\n')) != NULL) {
+		VALUE_PAIR	*vp = NULL;
+		size_t		len = eol - p;
+
+		if (len == 0) break;
+
+		memcpy(buffer, p, len);
+		buffer[len] = '\0';
+		p = eol + 1;
+
+		if (strncmp(buffer, "\tTimestamp", 10) == 0) continue;
+
+		if ((fr_pair_list_afrom_str(ctx, buffer, &vp) > 0) && vp) fr_pair_cursor_merge(&cursor, vp);
+	}
+
+	return head;
+}
+
+static uint8_t *binary_write(TALLOC_CTX *ctx, RADIUS_PACKET *packet)
+{
+	uint8_t *out;
+
+	out = talloc_array(ctx, uint8_t, DETAIL_BINARY_HDR_LEN + packet->data_len);
+	detail_binary_header(out, &packet->timestamp, packet, packet->data, packet->data_len);
+	memcpy(out + DETAIL_BINARY_HDR_LEN, packet->data, packet->data_len);
+
+	return out;
+}
+
+static RADIUS_PACKET *binary_read(TALLOC_CTX *ctx, uint8_t const *entry, size_t len)
+{
+	detail_binary_t	record;
+	RADIUS_PACKET	*packet;
+
+	if (detail_binary_decode(&record, entry, len) != (ssize_t) len) {
+		fprintf(stderr, "Failed decoding binary record: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	packet = fr_radius_alloc(ctx, false);
+	packet->src_ipaddr = record.src_ipaddr;
+	packet->data = talloc_memdup(packet, record.data, record.data_len);
+	packet->data_len = record.data_len;
+	packet->code = packet->data[0];
+	packet->id = packet->data[1];
+	memcpy(packet->vector, packet->data + 4, sizeof(packet->vector));
+
+	if (!fr_radius_ok(packet, false, NULL) || (fr_radius_decode(packet, NULL, secret) < 0)) {
+		fprintf(stderr, "Failed decoding packet: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	return packet;
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return (end.tv_sec - start->tv_sec) + ((end.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+/** Print a list, without the Packet-Type which the text format adds
+ *
+ */
+static char *list_print(TALLOC_CTX *ctx, VALUE_PAIR *vps)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	char		*out = talloc_strdup(ctx, "");
+	char		buffer[1024];
+
+	for (vp = fr_pair_cursor_init(&cursor, &vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		if (!vp->da->vendor && (vp->da->attr == PW_PACKET_TYPE)) continue;
+
+		fr_pair_snprint(buffer, sizeof(buffer), vp);
+		out = talloc_asprintf_append_buffer(out, "\t%s\n", buffer);
+	}
+
+	return out;
+}
+
+/** Check that both formats give back the attributes we started with
+ *
+ */
+static void compare(char const *name, VALUE_PAIR *a, VALUE_PAIR *b)
+{
+	char *one, *two;
+
+	one = list_print(NULL, a);
+	two = list_print(NULL, b);
+
+	if (strcmp(one, two) != 0) {
+		fprintf(stderr, "%s: attributes differ after reading back\nexpected:\n%sgot:\n%s", name, one, two);
+		errors++;
+	}
+
+	talloc_free(one);
+	talloc_free(two);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: detail_binary_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <ops>               Number of records to write and read.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, op;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	RADIUS_PACKET		*packet;
+	char			*text;
+	uint8_t			*binary;
+	size_t			text_len, binary_len;
+	struct timeval		start;
+	double			text_write_time, text_read_time, binary_write_time, binary_read_time;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	secret = talloc_typed_strdup(autofree, DETAIL_BINARY_SECRET);
+
+	while ((c = getopt(argc, argv, "D:hn:")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num_ops = atoi(optarg);
+			if (num_ops <= 0) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fprintf(stderr, "Failed reading dictionaries: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	crc_check();
+
+	packet = fr_radius_alloc(autofree, true);
+	packet->code = PW_CODE_ACCOUNTING_REQUEST;
+	packet->src_ipaddr.af = AF_INET;
+	packet->src_ipaddr.prefix = 32;
+	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(0xc00002fe);
+	packet->src_port = 32768;
+	gettimeofday(&packet->timestamp, NULL);
+
+	if (fr_pair_list_afrom_str(packet, acct_attrs, &packet->vps) == T_INVALID) {
+		fprintf(stderr, "Invalid attributes: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if (fr_radius_encode(packet, NULL, secret) < 0) {
+		fprintf(stderr, "Failed encoding packet: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	/*
+	 *	Round trip both formats once, and check the results.
+	 */
+	text = text_write(autofree, packet);
+	text_len = talloc_array_length(text) - 1;
+	compare("text", packet->vps, text_read(autofree, text));
+
+	binary = binary_write(autofree, packet);
+	binary_len = talloc_array_length(binary);
+	compare("binary", packet->vps, binary_read(autofree, binary, binary_len)->vps);
+
+	/*
+	 *	A damaged record must be rejected, and must not stop
+	 *	us finding the next one.
+	 */
+	{
+		detail_binary_t	record;
+		uint8_t		*two;
+
+		two = talloc_array(autofree, uint8_t, binary_len * 2);
+		memcpy(two, binary, binary_len);
+		memcpy(two + binary_len, binary, binary_len);
+
+		two[DETAIL_BINARY_HDR_LEN + 30] ^= 0x01;
+		if (detail_binary_decode(&record, two, binary_len * 2) >= 0) {
+			fprintf(stderr, "Damaged record was accepted\n");
+			errors++;
+		}
+
+		two[14] ^= 0x10;	/* length */
+		if (detail_binary_next(two, binary_len * 2) != binary_len) {
+			fprintf(stderr, "Failed finding the record after a damaged one\n");
+			errors++;
+		}
+
+		if (detail_binary_decode(&record, binary, binary_len - 1) != 0) {
+			fprintf(stderr, "Truncated record wasn't detected\n");
+			errors++;
+		}
+
+		talloc_free(two);
+	}
+
+	printf("Text entry %zu bytes, binary entry %zu bytes (%.1fx smaller)\n",
+	       text_len, binary_len, (double) text_len / binary_len);
+
+	gettimeofday(&start, NULL);
+	for (op = 0; op < num_ops; op++) talloc_free(text_write(autofree, packet));
+	text_write_time = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (op = 0; op < num_ops; op++) {
+		VALUE_PAIR *vps = text_read(autofree, text);
+
+		fr_pair_list_free(&vps);
+	}
+	text_read_time = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (op = 0; op < num_ops; op++) talloc_free(binary_write(autofree, packet));
+	binary_write_time = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (op = 0; op < num_ops; op++) {
+		talloc_free(binary_read(autofree, binary, binary_len));
+	}
+	binary_read_time = elapsed(&start);
+
+	printf("write: text %.0f records/s, binary %.0f records/s (%.1fx)\n",
+	       num_ops / text_write_time, num_ops / binary_write_time, text_write_time / binary_write_time);
+	printf("read:  text %.0f records/s, binary %.0f records/s (%.1fx)\n",
+	       num_ops / text_read_time, num_ops / binary_read_time, text_read_time / binary_read_time);
+
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET := detail_binary_test
+
+SOURCES := detail_binary_test.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,316 @@
+/*
+ * detail_replay_test.c	Checks and benchmarks for the window of packets
+ *			kept in flight when replaying a detail file.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+/*
+ *	We play the part of the server, by reading the packets the
+ *	replay reader sends, and acknowledging them.
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/protocol.h>
+
+#include <poll.h>
+
+#include "../modules/proto_detail/proto_detail.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	Things the listener uses from radiusd, but the replay reader
+ *	doesn't.
+ */
+main_config_t main_config;
+
+int request_receive(UNUSED TALLOC_CTX *ctx, UNUSED rad_listen_t *listener, UNUSED RADIUS_PACKET *packet,
+		    UNUSED RADCLIENT *client, UNUSED RAD_REQUEST_FUNP fun)
+{
+	return 0;
+}
+
+rlm_rcode_t rad_accounting(UNUSED REQUEST *request)
+{
+	return RLM_MODULE_FAIL;
+}
+
+rlm_rcode_t rad_coa_recv(UNUSED REQUEST *request)
+{
+	return RLM_MODULE_FAIL;
+}
+
+void radius_signal_self(UNUSED int flag)
+{
+}
+
+void common_packet_debug(UNUSED REQUEST *request, UNUSED RADIUS_PACKET *packet, UNUSED bool received)
+{
+}
+
+#define RECORD	"Mon Jul 17 12:00:00 2017\n" \
+		"\tUser-Name = \"bob@example.com\"\n" \
+		"\tAcct-Status-Type = Interim-Update\n" \
+		"\tAcct-Session-Id = \"%08x\"\n" \
+		"\tNAS-IP-Address = 192.0.2.254\n" \
+		"\tAcct-Session-Time = 3600\n" \
+		"\tTimestamp = 1500292800\n" \
+		"\n"
+
+static int		num_records = 100000;
+static int		loss = 0;
+static uint32_t		threads = 2;
+static char const	*dir;
+static int		errors;
+
+static void signal_ignore(UNUSED int sig)
+{
+}
+
+/*
+ *	Replay num_records records with a window of max_outstanding
+ *	packets.  One in "loss" packets gets no reply the first time
+ *	it's sent.
+ */
+static void run(uint32_t max_outstanding)
+{
+	rad_listen_t	listener;
+	listen_detail_t	*data;
+	char		*filename, *filename_work;
+	FILE		*fp;
+	uint8_t		*seen;
+	int		i, got = 0, lost = 0;
+	struct timeval	start, end;
+	double		elapsed;
+
+	filename = talloc_asprintf(NULL, "%s/detail", dir);
+	filename_work = talloc_asprintf(filename, "%s/detail.work", dir);
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed creating %s: %s\n", filename, fr_syserror(errno));
+		exit(1);
+	}
+	for (i = 0; i < num_records; i++) fprintf(fp, RECORD, i);
+	fclose(fp);
+
+	seen = talloc_zero_array(filename, uint8_t, num_records);
+
+	memset(&listener, 0, sizeof(listener));
+	data = talloc_zero(filename, listen_detail_t);
+	listener.data = data;
+
+	data->name = "test";
+	data->filename = filename;
+	data->filename_work = filename_work;
+	data->load_factor = 100;
+	data->poll_interval = 1;
+	data->retry_interval = 1;
+	data->max_outstanding = max_outstanding;
+	data->parse_threads = threads;
+	data->use_mmap = true;
+	data->track = true;
+	data->work_fd = -1;
+	data->file_state = STATE_UNOPENED;
+
+	if ((pipe(data->master_pipe) < 0) || (pipe(data->child_pipe) < 0)) {
+		fprintf(stderr, "Failed creating pipes: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	gettimeofday(&start, NULL);
+
+	pthread_create(&data->pthread_id, NULL, proto_detail_replay_thread, &listener);
+
+	while (got < num_records) {
+		RADIUS_PACKET	*packet;
+		VALUE_PAIR	*vp;
+		struct pollfd	fds;
+		unsigned long	num;
+
+		fds.fd = data->master_pipe[0];
+		fds.events = POLLIN;
+		fds.revents = 0;
+		if (poll(&fds, 1, 5000) <= 0) {
+			fprintf(stderr, "Window %u: Stalled after %d records\n", max_outstanding, got);
+			errors++;
+			break;
+		}
+
+		if ((read(data->master_pipe[0], &packet, sizeof(packet)) != sizeof(packet)) || !packet) {
+			fprintf(stderr, "Window %u: Reader exited after %d records\n", max_outstanding, got);
+			errors++;
+			break;
+		}
+
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_ACCT_SESSION_ID, TAG_ANY);
+		num = vp ? strtoul(vp->vp_strvalue, NULL, 16) : (unsigned long) num_records;
+		if (num >= (unsigned long) num_records) {
+			fprintf(stderr, "Window %u: Received an unknown record\n", max_outstanding);
+			errors++;
+			proto_detail_ack(data, packet, true, -1);
+			fr_radius_free(&packet);
+			continue;
+		}
+
+		/*
+		 *	Lose it the first time, and check it's sent again.
+		 */
+		if (loss && ((num % loss) == 0) && !seen[num]) {
+			seen[num] = 2;
+			lost++;
+			proto_detail_ack(data, packet, false, -1);
+			fr_radius_free(&packet);
+			continue;
+		}
+
+		if (seen[num] == 1) {
+			fprintf(stderr, "Window %u: Record %lu was sent again after it was replied to\n",
+				max_outstanding, num);
+			errors++;
+		}
+		seen[num] = 1;
+		got++;
+
+		proto_detail_ack(data, packet, true, 100);
+		fr_radius_free(&packet);
+	}
+
+	gettimeofday(&end, NULL);
+
+	/*
+	 *	The reader deletes the work file once everything in
+	 *	it has been replied to.
+	 */
+	for (i = 0; (i < 100) && (access(filename_work, F_OK) == 0); i++) usleep(10000);
+	if (access(filename_work, F_OK) == 0) {
+		fprintf(stderr, "Window %u: Work file wasn't deleted\n", max_outstanding);
+		errors++;
+	}
+
+	proto_detail_free(data);
+	close(data->child_pipe[0]);
+	unlink(filename_work);
+
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("window %4u: %d records in %.3fs, %.0f records/s, %d lost\n",
+	       max_outstanding, got, elapsed, got / elapsed, lost);
+
+	talloc_free(filename);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: detail_replay_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -d <dir>               Directory to write the files in (defaults to a temporary one).\n");
+	fprintf(stderr, "  -l <num>               Lose one in <num> packets the first time they're sent.\n");
+	fprintf(stderr, "  -n <records>           Number of records to replay.\n");
+	fprintf(stderr, "  -t <threads>           Number of threads parsing the file.\n");
+	fprintf(stderr, "  -w <window>            Only run with this many packets in flight.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	uint32_t		window = 0;
+	char			tmp[] = "/tmp/detail_replay_test.XXXXXX";
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "D:d:hl:n:t:w:")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'd':
+			dir = optarg;
+			break;
+
+		case 'l':
+			loss = atoi(optarg);
+			if (loss < 0) usage();
+			break;
+
+		case 'n':
+			num_records = atoi(optarg);
+			if (num_records <= 0) usage();
+			break;
+
+		case 't':
+			threads = atoi(optarg);
+			if (threads == 0) usage();
+			break;
+
+		case 'w':
+			window = atoi(optarg);
+			if (window == 0) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fprintf(stderr, "Failed reading dictionaries: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if (!dir) {
+		dir = mkdtemp(tmp);
+		if (!dir) {
+			fprintf(stderr, "Failed creating temporary directory: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+	}
+
+	/*
+	 *	The listener interrupts the reader with SIGTERM when
+	 *	it's freed.
+	 */
+	signal(SIGTERM, signal_ignore);
+
+	if (window) {
+		run(window);
+	} else {
+		run(1);
+		run(16);
+		run(256);
+	}
+
+	if (dir == tmp) rmdir(tmp);
+
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
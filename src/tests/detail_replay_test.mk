@@ -0,0 +1,7 @@
+TARGET := detail_replay_test
+
+SOURCES := detail_replay_test.c
+
+TGT_PREREQS	:= proto_detail.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,286 @@
+/*
+ * detail_write_test.c	Benchmarks for writing accounting records to detail
+ *			files, one locked write per record vs buffered writes.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/exfile.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	What rlm_detail writes for a typical Interim-Update.
+ */
+#define RECORD_FMT \
+	"Mon Jul 17 12:00:00 2017\n" \
+	"\tUser-Name = \"bob@example.com\"\n" \
+	"\tAcct-Status-Type = Interim-Update\n" \
+	"\tAcct-Session-Id = \"%016x\"\n" \
+	"\tNAS-IP-Address = 192.0.2.254\n" \
+	"\tNAS-Port = 1234\n" \
+	"\tFramed-IP-Address = 192.0.2.1\n" \
+	"\tAcct-Input-Octets = 123456789\n" \
+	"\tAcct-Output-Octets = 987654321\n" \
+	"\tAcct-Session-Time = 3600\n" \
+	"\tEvent-Timestamp = \"Jul 17 2017 12:00:00 UTC\"\n" \
+	"\tCalled-Station-Id = \"00-11-22-33-44-55:ssid\"\n" \
+	"\tCalling-Station-Id = \"66-77-88-99-aa-bb\"\n" \
+	"\tAcct-Unique-Session-Id = \"%016x\"\n" \
+	"\tTimestamp = 1500292800\n" \
+	"\n"
+
+static int		num_ops = 200000;
+static int		num_threads = 4;
+static char const	*dir;
+static struct timeval	interval = { 0, 100000 };
+static uint32_t		flush_bytes = 262144;
+static int		errors;
+
+typedef struct {
+	exfile_t	*ef;
+	char const	*filename;
+	bool		buffered;
+	int		start;
+	int		count;
+} test_thread_t;
+
+static void *writer(void *arg)
+{
+	test_thread_t	*t = arg;
+	char		record[1024];
+	int		i;
+
+	for (i = t->start; i < (t->start + t->count); i++) {
+		size_t len;
+
+		len = snprintf(record, sizeof(record), RECORD_FMT, i, i);
+
+		if (t->buffered) {
+			/*
+			 *	Full means the flusher is behind.  Give it
+			 *	a chance to catch up.
+			 */
+			while (exfile_append(t->ef, NULL, t->filename, 0600, -1, record, len) < 0) {
+				usleep(1000);
+			}
+			continue;
+		}
+
+		{
+			int fd;
+
+			fd = exfile_open(t->ef, NULL, t->filename, 0600, true);
+			if (fd < 0) {
+				fprintf(stderr, "Failed opening %s: %s\n", t->filename, fr_strerror());
+				exit(1);
+			}
+
+			if (write(fd, record, len) != (ssize_t) len) {
+				fprintf(stderr, "Failed writing %s: %s\n", t->filename, fr_syserror(errno));
+				exit(1);
+			}
+			exfile_close(t->ef, NULL, fd);
+		}
+	}
+
+	return NULL;
+}
+
+/** Check that every record made it to the file, whole
+ *
+ */
+static void check(char const *name, char const *filename)
+{
+	FILE	*fp;
+	char	line[1024];
+	uint8_t	*seen;
+	int	records = 0;
+
+	seen = talloc_zero_array(NULL, uint8_t, num_ops);
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "%s: Failed opening %s: %s\n", name, filename, fr_syserror(errno));
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned int id;
+
+		if (sscanf(line, "\tAcct-Session-Id = \"%x\"", &id) != 1) continue;
+
+		if ((id >= (unsigned int) num_ops) || seen[id]) {
+			fprintf(stderr, "%s: Bad or duplicate record %u\n", name, id);
+			errors++;
+			continue;
+		}
+		seen[id] = 1;
+		records++;
+	}
+	fclose(fp);
+	talloc_free(seen);
+
+	if (records != num_ops) {
+		fprintf(stderr, "%s: Expected %d records, found %d\n", name, num_ops, records);
+		errors++;
+	}
+}
+
+static void run(char const *name, bool locking, bool buffered, bool sync)
+{
+	exfile_t	*ef;
+	test_thread_t	*threads;
+	pthread_t	*ids;
+	char		*filename;
+	int		i;
+	struct timeval	start, end;
+	double		elapsed;
+
+	filename = talloc_asprintf(NULL, "%s/detail-%s", dir, name);
+	unlink(filename);
+
+	ef = exfile_init(NULL, 16, 30, locking);
+	if (!ef) {
+		fprintf(stderr, "Failed creating exfile context\n");
+		exit(1);
+	}
+
+	if (buffered && (exfile_buffer_init(ef, &interval, flush_bytes, sync) < 0)) {
+		fprintf(stderr, "Failed enabling buffered writes: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	threads = talloc_zero_array(NULL, test_thread_t, num_threads);
+	ids = talloc_zero_array(threads, pthread_t, num_threads);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < num_threads; i++) {
+		threads[i].ef = ef;
+		threads[i].filename = filename;
+		threads[i].buffered = buffered;
+		threads[i].start = (num_ops / num_threads) * i;
+		threads[i].count = (i == (num_threads - 1)) ? (num_ops - threads[i].start) : (num_ops / num_threads);
+
+		pthread_create(&ids[i], NULL, writer, &threads[i]);
+	}
+
+	for (i = 0; i < num_threads; i++) pthread_join(ids[i], NULL);
+
+	/*
+	 *	Only count the records as written once they're in the
+	 *	file.  Freeing the context writes out anything left.
+	 */
+	talloc_free(ef);
+
+	gettimeofday(&end, NULL);
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("%-16s %d records from %d threads in %.3fs, %.0f records/s\n",
+	       name, num_ops, num_threads, elapsed, num_ops / elapsed);
+
+	check(name, filename);
+
+	unlink(filename);
+	talloc_free(filename);
+	talloc_free(threads);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: detail_write_test [OPTS]\n");
+	fprintf(stderr, "  -b <bytes>             Write buffered records when this many are waiting.\n");
+	fprintf(stderr, "  -d <dir>               Directory to write the files in (defaults to a temporary one).\n");
+	fprintf(stderr, "  -i <seconds>           Longest time a record is buffered for.\n");
+	fprintf(stderr, "  -n <ops>               Number of records to write.\n");
+	fprintf(stderr, "  -s                     Also run with fsync after every buffered write.\n");
+	fprintf(stderr, "  -t <threads>           Number of writer threads.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int	c;
+	bool	do_sync = false;
+	char	tmp[] = "/tmp/detail_write_test.XXXXXX";
+	bool	made_dir = false;
+
+	while ((c = getopt(argc, argv, "b:d:hi:n:st:")) != EOF) switch (c) {
+		case 'b':
+			flush_bytes = atoi(optarg);
+			break;
+
+		case 'd':
+			dir = optarg;
+			break;
+
+		case 'i':
+			if (fr_timeval_from_str(&interval, optarg) < 0) usage();
+			break;
+
+		case 'n':
+			num_ops = atoi(optarg);
+			if (num_ops <= 0) usage();
+			break;
+
+		case 's':
+			do_sync = true;
+			break;
+
+		case 't':
+			num_threads = atoi(optarg);
+			if (num_threads <= 0) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (!dir) {
+		dir = mkdtemp(tmp);
+		if (!dir) {
+			fprintf(stderr, "Failed creating temporary directory: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+		made_dir = true;
+	}
+
+	run("locked", true, false, false);
+	run("buffered", true, true, false);
+	if (do_sync) run("buffered+fsync", true, true, true);
+
+	if (made_dir) rmdir(dir);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
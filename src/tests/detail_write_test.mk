@@ -0,0 +1,7 @@
+TARGET := detail_write_test
+
+SOURCES := detail_write_test.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
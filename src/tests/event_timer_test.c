@@ -0,0 +1,211 @@
+/*
+ * event_timer_test.c	Benchmarks for event list timers, heap vs timer wheel.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/event.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define USEC (1000000)
+
+/*
+ *	One request, with the timer the server would have armed for
+ *	it: max_request_time while it's being processed, or a short
+ *	reject / response delay.
+ */
+typedef struct test_request_t {
+	struct timeval		when;		//!< When the timer should fire.
+	fr_event_timer_t	*ev;
+} test_request_t;
+
+static int		in_flight = 100000;
+static int		num_ops = 4000000;
+static uint32_t		resolution = 1000;
+
+static uint64_t		fired;
+static uint64_t		late_usec;
+static uint64_t		max_late_usec;
+static int		errors;
+
+static void timer_fired(struct timeval *now, void *ctx)
+{
+	test_request_t	*request = ctx;
+	struct timeval	late;
+
+	fired++;
+
+	if (fr_timeval_cmp(now, &request->when) < 0) {
+		fprintf(stderr, "Timer fired early\n");
+		errors++;
+		return;
+	}
+
+	fr_timeval_subtract(&late, now, &request->when);
+	late_usec += (late.tv_sec * USEC) + late.tv_usec;
+	if (((uint64_t) (late.tv_sec * USEC) + late.tv_usec) > max_late_usec) {
+		max_late_usec = (late.tv_sec * USEC) + late.tv_usec;
+	}
+}
+
+static void timeval_add_usec(struct timeval *tv, uint32_t usec)
+{
+	tv->tv_usec += usec;
+	tv->tv_sec += tv->tv_usec / USEC;
+	tv->tv_usec %= USEC;
+}
+
+static void run(bool wheel)
+{
+	int		i, op;
+	fr_event_list_t	*el;
+	test_request_t	*requests;
+	struct timeval	now, start, end;
+	double		elapsed;
+
+	el = fr_event_list_create(NULL, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "Failed creating event list\n");
+		exit(1);
+	}
+
+	if (wheel && (fr_event_list_timer_wheel(el, resolution) < 0)) {
+		fprintf(stderr, "Failed creating timer wheel: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	requests = talloc_zero_array(el, test_request_t, in_flight);
+
+	fired = late_usec = max_late_usec = 0;
+
+	/*
+	 *	Time is simulated, so that both backends see exactly
+	 *	the same timers.
+	 */
+	gettimeofday(&now, NULL);
+	fr_rand_seed(&now, sizeof(now));
+
+	gettimeofday(&start, NULL);
+
+	for (op = 0; op < num_ops; op++) {
+		test_request_t *request = &requests[op % in_flight];
+
+		/*
+		 *	Most requests finish before their timer
+		 *	fires, so the timer is deleted.
+		 */
+		if (request->ev) fr_event_timer_delete(el, &request->ev);
+
+		/*
+		 *	One in 16 gets a short delay, the rest get
+		 *	something like max_request_time.
+		 */
+		request->when = now;
+		if ((fr_rand() & 0x0f) == 0) {
+			timeval_add_usec(&request->when, fr_rand() % USEC);
+		} else {
+			request->when.tv_sec += 30;
+			timeval_add_usec(&request->when, fr_rand() % USEC);
+		}
+
+		if (fr_event_timer_insert(el, timer_fired, request, &request->when, &request->ev) < 0) {
+			fprintf(stderr, "Failed inserting timer: %s\n", fr_strerror());
+			exit(1);
+		}
+
+		/*
+		 *	Time passes, and the due timers fire.
+		 */
+		if ((op & 0x3ff) == 0) {
+			struct timeval when;
+
+			timeval_add_usec(&now, 1000);
+
+			do {
+				when = now;
+			} while (fr_event_timer_run(el, &when) == 1);
+		}
+	}
+
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < in_flight; i++) {
+		if (requests[i].ev) fr_event_timer_delete(el, &requests[i].ev);
+	}
+
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / (double) USEC);
+
+	printf("%-6s %d timers in flight, %d arm + cancel in %.3fs, %.1f ns/op, %" PRIu64 " fired, "
+	       "average %" PRIu64 "us late, max %" PRIu64 "us late\n",
+	       wheel ? "wheel" : "heap", in_flight, num_ops, elapsed, (elapsed * 1e9) / num_ops, fired,
+	       fired ? late_usec / fired : 0, max_late_usec);
+
+	talloc_free(el);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: event_timer_test [OPTS]\n");
+	fprintf(stderr, "  -n <ops>               Number of timers to arm.\n");
+	fprintf(stderr, "  -r <usec>              Resolution of the timer wheel.\n");
+	fprintf(stderr, "  -t <timers>            Number of timers in flight.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "hn:r:t:")) != EOF) switch (c) {
+		case 'n':
+			num_ops = atoi(optarg);
+			break;
+
+		case 'r':
+			resolution = atoi(optarg);
+			break;
+
+		case 't':
+			in_flight = atoi(optarg);
+			if (in_flight <= 0) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	run(false);
+	run(true);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
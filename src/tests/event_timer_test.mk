@@ -0,0 +1,7 @@
+TARGET := event_timer_test
+
+SOURCES := event_timer_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
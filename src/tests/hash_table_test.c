@@ -0,0 +1,458 @@
+/*
+ * hash_table_test.c	Benchmarks for fr_hash_table_t.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define USEC (1000000)
+
+/*
+ *	The previous fr_hash_table_t implementation, a split-ordered
+ *	list with one allocation per entry.  Kept here so the two can
+ *	be compared.
+ */
+typedef struct old_entry_t {
+	struct old_entry_t	*next;
+	uint32_t		reversed;
+	uint32_t		key;
+	void const		*data;
+} old_entry_t;
+
+typedef struct old_table_t {
+	int			num_elements;
+	int			num_buckets;
+	int			next_grow;
+	int			mask;
+	fr_hash_table_hash_t	hash;
+	fr_hash_table_cmp_t	cmp;
+	old_entry_t		null;
+	old_entry_t		**buckets;
+} old_table_t;
+
+static uint32_t old_reverse(uint32_t key)
+{
+	key = ((key >> 1) & 0x55555555) | ((key & 0x55555555) << 1);
+	key = ((key >> 2) & 0x33333333) | ((key & 0x33333333) << 2);
+	key = ((key >> 4) & 0x0f0f0f0f) | ((key & 0x0f0f0f0f) << 4);
+	key = ((key >> 8) & 0x00ff00ff) | ((key & 0x00ff00ff) << 8);
+
+	return (key >> 16) | (key << 16);
+}
+
+static uint32_t old_parent_of(uint32_t key)
+{
+	uint32_t bit;
+
+	if (!key) return 0;
+
+	for (bit = 0x80000000; !(key & bit); bit >>= 1);
+
+	return key & ~bit;
+}
+
+static old_table_t *old_create(TALLOC_CTX *ctx, fr_hash_table_hash_t hash, fr_hash_table_cmp_t cmp)
+{
+	old_table_t *ht;
+
+	ht = talloc_zero(ctx, old_table_t);
+	ht->hash = hash;
+	ht->cmp = cmp;
+	ht->num_buckets = 64;
+	ht->mask = ht->num_buckets - 1;
+	ht->next_grow = (ht->num_buckets << 1) + (ht->num_buckets >> 1);
+	ht->buckets = talloc_zero_array(ht, old_entry_t *, ht->num_buckets);
+	ht->null.reversed = ~0;
+	ht->null.key = ~0;
+	ht->null.next = &ht->null;
+	ht->buckets[0] = &ht->null;
+
+	return ht;
+}
+
+static void old_fixup(old_table_t *ht, uint32_t entry)
+{
+	uint32_t	parent_entry = old_parent_of(entry), this;
+	old_entry_t	**last, *cur;
+
+	if (!ht->buckets[parent_entry]) old_fixup(ht, parent_entry);
+
+	last = &ht->buckets[parent_entry];
+	this = parent_entry;
+
+	for (cur = *last; cur != &ht->null; cur = cur->next) {
+		uint32_t real_entry = cur->key & ht->mask;
+
+		if (real_entry != this) {
+			*last = &ht->null;
+			ht->buckets[real_entry] = cur;
+			this = real_entry;
+		}
+		last = &(cur->next);
+	}
+
+	if (!ht->buckets[entry]) ht->buckets[entry] = &ht->null;
+}
+
+static old_entry_t *old_find(old_table_t *ht, void const *data)
+{
+	uint32_t	key = ht->hash(data), entry = key & ht->mask, reversed = old_reverse(key);
+	old_entry_t	*cur;
+
+	if (!ht->buckets[entry]) old_fixup(ht, entry);
+
+	for (cur = ht->buckets[entry]; cur != &ht->null; cur = cur->next) {
+		if (cur->reversed == reversed) {
+			int cmp = ht->cmp(data, cur->data);
+
+			if (cmp > 0) break;
+			if (cmp < 0) continue;
+			return cur;
+		}
+		if (cur->reversed > reversed) break;
+	}
+
+	return NULL;
+}
+
+static int old_insert(old_table_t *ht, void const *data)
+{
+	uint32_t	key = ht->hash(data), entry = key & ht->mask;
+	old_entry_t	*node, **last, *cur;
+
+	if (!ht->buckets[entry]) old_fixup(ht, entry);
+
+	node = talloc_zero(NULL, old_entry_t);
+	node->next = &ht->null;
+	node->reversed = old_reverse(key);
+	node->key = key;
+	node->data = data;
+
+	last = &ht->buckets[entry];
+	for (cur = *last; cur != &ht->null; cur = cur->next) {
+		if (cur->reversed > node->reversed) break;
+		last = &(cur->next);
+
+		if (cur->reversed == node->reversed) {
+			int cmp = ht->cmp(node->data, cur->data);
+
+			if (cmp > 0) break;
+			if (cmp < 0) continue;
+			talloc_free(node);
+			return 0;
+		}
+	}
+	node->next = *last;
+	*last = node;
+
+	if (++ht->num_elements >= ht->next_grow) {
+		old_entry_t **buckets;
+
+		buckets = talloc_zero_array(ht, old_entry_t *, 2 * ht->num_buckets);
+		memcpy(buckets, ht->buckets, sizeof(*buckets) * ht->num_buckets);
+		talloc_free(ht->buckets);
+		ht->buckets = buckets;
+		ht->num_buckets *= 2;
+		ht->next_grow *= 2;
+		ht->mask = ht->num_buckets - 1;
+	}
+
+	return 1;
+}
+
+static int old_delete(old_table_t *ht, void const *data)
+{
+	old_entry_t	*node, **last;
+	uint32_t	entry;
+
+	node = old_find(ht, data);
+	if (!node) return 0;
+
+	entry = node->key & ht->mask;
+	for (last = &ht->buckets[entry]; *last != node; last = &(*last)->next);
+	*last = node->next;
+	ht->num_elements--;
+	talloc_free(node);
+
+	return 1;
+}
+
+/*
+ *	The keys are 16 byte authenticators, as with the proxy lists.
+ */
+typedef struct test_key_t {
+	uint8_t		vector[AUTH_VECTOR_LEN];
+} test_key_t;
+
+static uint32_t key_hash(void const *data)
+{
+	return fr_hash(data, AUTH_VECTOR_LEN);
+}
+
+static int key_cmp(void const *one, void const *two)
+{
+	return memcmp(one, two, AUTH_VECTOR_LEN);
+}
+
+static int		debug_lvl = 0;
+
+typedef struct walk_insert_t {
+	fr_hash_table_t	*ht;
+	test_key_t	*keys;
+	int		num;
+	int		failed;
+} walk_insert_t;
+
+/*
+ *	Insert everything else from inside a walk, which fills the
+ *	table long before we're done.
+ */
+static int walk_insert(void *ctx, UNUSED void *data)
+{
+	walk_insert_t	*wi = ctx;
+	int		i;
+
+	if (fr_hash_table_num_elements(wi->ht) > 1) return 0;
+
+	for (i = 1; i < wi->num; i++) {
+		if (!fr_hash_table_insert(wi->ht, &wi->keys[i])) wi->failed++;
+	}
+
+	return 0;
+}
+
+static uint64_t elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return ((end.tv_sec - start->tv_sec) * USEC) + (end.tv_usec - start->tv_usec);
+}
+
+static void report(char const *what, int num, uint64_t new_usec, uint64_t old_usec)
+{
+	printf("%-8s new %10.0f ops/s    old %10.0f ops/s\n", what,
+	       new_usec ? ((double) num * USEC) / new_usec : 0,
+	       old_usec ? ((double) num * USEC) / old_usec : 0);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: hash_table_test [OPTS]\n");
+	fprintf(stderr, "  -n <entries>           Number of entries to insert.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i, j, num = 1000000, rcode = 0;
+	test_key_t	*keys, *missing;
+	fr_hash_table_t	*ht;
+	old_table_t	*old;
+	struct timeval	start;
+	uint64_t	new_usec, old_usec;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hn:x")) != EOF) switch (c) {
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (num <= 0) usage();
+
+	keys = talloc_array(autofree, test_key_t, num);
+	missing = talloc_array(autofree, test_key_t, num);
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < AUTH_VECTOR_LEN; j += 4) {
+			uint32_t r;
+
+			r = fr_rand();
+			memcpy(&keys[i].vector[j], &r, sizeof(r));
+			r = fr_rand();
+			memcpy(&missing[i].vector[j], &r, sizeof(r));
+		}
+	}
+
+	ht = fr_hash_table_create(autofree, key_hash, key_cmp, NULL);
+	old = old_create(autofree, key_hash, key_cmp);
+
+	/*
+	 *	Insert
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (!fr_hash_table_insert(ht, &keys[i])) {
+			fprintf(stderr, "Failed inserting %d\n", i);
+			exit(1);
+		}
+	}
+	new_usec = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) old_insert(old, &keys[i]);
+	old_usec = elapsed(&start);
+	report("insert", num, new_usec, old_usec);
+
+	/*
+	 *	Successful lookups
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (fr_hash_table_finddata(ht, &keys[i]) != &keys[i]) {
+			fprintf(stderr, "Failed finding %d\n", i);
+			rcode = 1;
+			break;
+		}
+	}
+	new_usec = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) (void) old_find(old, &keys[i]);
+	old_usec = elapsed(&start);
+	report("hit", num, new_usec, old_usec);
+
+	/*
+	 *	Failed lookups
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (fr_hash_table_finddata(ht, &missing[i])) {
+			fprintf(stderr, "Found missing entry %d\n", i);
+			rcode = 1;
+			break;
+		}
+	}
+	new_usec = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) (void) old_find(old, &missing[i]);
+	old_usec = elapsed(&start);
+	report("miss", num, new_usec, old_usec);
+
+	/*
+	 *	Delete everything, which leaves the new table with lots
+	 *	of deleted slots, then fill it again.
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (!fr_hash_table_delete(ht, &keys[i])) {
+			fprintf(stderr, "Failed deleting %d\n", i);
+			rcode = 1;
+			break;
+		}
+	}
+	new_usec = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) old_delete(old, &keys[i]);
+	old_usec = elapsed(&start);
+	report("delete", num, new_usec, old_usec);
+
+	if (fr_hash_table_num_elements(ht) != 0) {
+		fprintf(stderr, "Table still has %d entries\n", fr_hash_table_num_elements(ht));
+		rcode = 1;
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (!fr_hash_table_insert(ht, &missing[i])) {
+			fprintf(stderr, "Failed re-inserting %d\n", i);
+			rcode = 1;
+			break;
+		}
+	}
+	new_usec = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) old_insert(old, &missing[i]);
+	old_usec = elapsed(&start);
+	report("refill", num, new_usec, old_usec);
+
+	for (i = 0; i < num; i++) {
+		if (fr_hash_table_finddata(ht, &missing[i]) != &missing[i]) {
+			fprintf(stderr, "Failed finding %d after refill\n", i);
+			rcode = 1;
+			break;
+		}
+		if (fr_hash_table_finddata(ht, &keys[i])) {
+			fprintf(stderr, "Found deleted entry %d\n", i);
+			rcode = 1;
+			break;
+		}
+	}
+
+	for (i = 0; i < num; i++) old_delete(old, &missing[i]);
+
+	/*
+	 *	Inserts made during a walk mustn't be lost when the
+	 *	table fills up.
+	 */
+	{
+		walk_insert_t wi = { .keys = keys, .num = num };
+
+		wi.ht = fr_hash_table_create(autofree, key_hash, key_cmp, NULL);
+		fr_hash_table_insert(wi.ht, &keys[0]);
+		fr_hash_table_walk(wi.ht, walk_insert, &wi);
+
+		if (wi.failed || (fr_hash_table_num_elements(wi.ht) != num)) {
+			fprintf(stderr, "Lost %d entries inserted during a walk\n", wi.failed);
+			rcode = 1;
+		}
+
+		for (i = 0; i < num; i++) {
+			if (fr_hash_table_finddata(wi.ht, &keys[i]) != &keys[i]) {
+				fprintf(stderr, "Failed finding %d inserted during a walk\n", i);
+				rcode = 1;
+				break;
+			}
+		}
+
+		for (i = 0; i < num; i++) {
+			if (!fr_hash_table_delete(wi.ht, &keys[i])) {
+				fprintf(stderr, "Failed deleting %d inserted during a walk\n", i);
+				rcode = 1;
+				break;
+			}
+		}
+	}
+
+	talloc_free(autofree);
+
+	return rcode;
+}
@@ -0,0 +1,7 @@
+TARGET := hash_table_test
+
+SOURCES := hash_table_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,176 @@
+/*
+ * hash_test.c	Benchmarks for the hash functions.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <sys/time.h>
+#include <math.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define USEC (1000000)
+
+typedef uint32_t (*hash_func_t)(void const *data, size_t size);
+
+typedef struct hash_key_t {
+	uint8_t		data[AUTH_VECTOR_LEN + 32];
+	size_t		len;
+} hash_key_t;
+
+static int		debug_lvl = 0;
+
+/** Hash every key "rounds" times, and print keys hashed per second
+ *
+ */
+static void hash_speed(char const *name, hash_func_t func, hash_key_t *keys, int num_keys, int rounds)
+{
+	int		i, j;
+	uint32_t	sum = 0;
+	struct timeval	start, end;
+	uint64_t	usec;
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < num_keys; i++) sum += func(keys[i].data, keys[i].len);
+	}
+	gettimeofday(&end, NULL);
+
+	usec = ((end.tv_sec - start.tv_sec) * USEC) + (end.tv_usec - start.tv_usec);
+
+	printf("\t%-8s %10.0f hashes/s (%08x)\n", name,
+	       usec ? ((double) num_keys * rounds * USEC) / usec : 0, sum);
+}
+
+/** Put the keys into buckets using the low bits, as fr_hash_table_t does
+ *
+ * Prints the number of keys which landed in an occupied bucket,
+ * against the number expected from a random function, and the
+ * longest chain.
+ */
+static void hash_quality(TALLOC_CTX *ctx, char const *name, hash_func_t func,
+			 hash_key_t *keys, int num_keys, uint32_t num_buckets)
+{
+	int		i;
+	uint32_t	*buckets, max = 0, collisions = 0;
+	double		expected;
+
+	buckets = talloc_zero_array(ctx, uint32_t, num_buckets);
+
+	for (i = 0; i < num_keys; i++) {
+		uint32_t *b = &buckets[func(keys[i].data, keys[i].len) & (num_buckets - 1)];
+
+		if (*b) collisions++;
+		(*b)++;
+		if (*b > max) max = *b;
+	}
+
+	expected = num_keys - num_buckets * (1 - pow(1 - 1.0 / num_buckets, num_keys));
+
+	printf("\t%-8s %u collisions (random %.0f), longest chain %u\n", name, collisions, expected, max);
+
+	talloc_free(buckets);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: hash_test [OPTS]\n");
+	fprintf(stderr, "  -n <keys>              Number of keys of each type.\n");
+	fprintf(stderr, "  -r <rounds>            Number of times to hash each key.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i, num_keys = 65536, rounds = 100;
+	uint32_t	num_buckets;
+	hash_key_t	*names, *vectors;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	static char const *prefixes[] = {
+		"User-Name", "Acct-Session-Id", "Vendor-Specific", "Cisco-AVPair",
+		"Framed-IP-Address", "NAS-Port-Id", "Tunnel-Private-Group-Id", "X"
+	};
+
+	while ((c = getopt(argc, argv, "hn:r:x")) != EOF) switch (c) {
+		case 'n':
+			num_keys = atoi(optarg);
+			break;
+
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if ((num_keys <= 0) || (rounds <= 0)) usage();
+
+	for (num_buckets = 1; num_buckets < (uint32_t) num_keys; num_buckets <<= 1);
+
+	names = talloc_array(autofree, hash_key_t, num_keys);
+	vectors = talloc_array(autofree, hash_key_t, num_keys);
+
+	/*
+	 *	Attribute names are short, and mostly differ only in
+	 *	the last few characters.
+	 */
+	for (i = 0; i < num_keys; i++) {
+		int j;
+
+		names[i].len = snprintf((char *) names[i].data, sizeof(names[i].data), "%s-%d",
+					prefixes[i % (sizeof(prefixes) / sizeof(*prefixes))], i);
+
+		vectors[i].len = AUTH_VECTOR_LEN;
+		for (j = 0; j < AUTH_VECTOR_LEN; j += 4) {
+			uint32_t r = fr_rand();
+
+			memcpy(vectors[i].data + j, &r, sizeof(r));
+		}
+	}
+
+	printf("Attribute names (%d keys)\n", num_keys);
+	hash_speed("fr_hash", fr_hash, names, num_keys, rounds);
+	hash_speed("fnv", fr_hash_fnv, names, num_keys, rounds);
+	hash_quality(autofree, "fr_hash", fr_hash, names, num_keys, num_buckets);
+	hash_quality(autofree, "fnv", fr_hash_fnv, names, num_keys, num_buckets);
+
+	printf("Authenticators (%d keys)\n", num_keys);
+	hash_speed("fr_hash", fr_hash, vectors, num_keys, rounds);
+	hash_speed("fnv", fr_hash_fnv, vectors, num_keys, rounds);
+	hash_quality(autofree, "fr_hash", fr_hash, vectors, num_keys, num_buckets);
+	hash_quality(autofree, "fnv", fr_hash_fnv, vectors, num_keys, num_buckets);
+
+	talloc_free(autofree);
+
+	return 0;
+}
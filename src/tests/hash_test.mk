@@ -0,0 +1,7 @@
+TARGET := hash_test
+
+SOURCES := hash_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS) -lm
+TGT_INSTALLDIR	:=
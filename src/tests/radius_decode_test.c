@@ -0,0 +1,457 @@
+/*
+ * radius_decode_test.c	Benchmarks for RADIUS decoding, eager vs lazy.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <sys/time.h>
+#include <ctype.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_PACKETS	(1024)
+#define MAX_ATTRS	(32)
+#define HDR_LEN		(20)
+
+static char const	*secret = "testing123";
+static int		num_ops = 10000;
+
+static RADIUS_PACKET	*packets[MAX_PACKETS];
+static int		num_packets;
+
+static fr_dict_attr_t const *find_da[MAX_ATTRS];
+static int		num_find_da;
+
+static int		errors;
+
+/** Wrap attributes in a RADIUS header, and add the packet to the test set
+ *
+ */
+static bool packet_add(TALLOC_CTX *ctx, uint8_t const *attrs, size_t attrs_len)
+{
+	int		i;
+	RADIUS_PACKET	*packet;
+	uint8_t		*data;
+	uint8_t const	*p, *end;
+
+	if (num_packets == MAX_PACKETS) return false;
+	if ((attrs_len == 0) || ((HDR_LEN + attrs_len) > MAX_PACKET_LEN)) return false;
+
+	/*
+	 *	The vectors include deliberately malformed data, which
+	 *	fr_radius_ok() would have rejected.
+	 */
+	end = attrs + attrs_len;
+	for (p = attrs; p < end; p += p[1]) {
+		if (((end - p) < 2) || (p[1] < 2) || (p[1] > (end - p))) return false;
+	}
+
+	packet = fr_radius_alloc(ctx, false);
+	if (!packet) exit(1);
+
+	data = talloc_zero_array(packet, uint8_t, HDR_LEN + attrs_len);
+	data[0] = PW_CODE_ACCESS_REQUEST;
+	data[1] = num_packets & 0xff;
+	data[2] = ((HDR_LEN + attrs_len) >> 8) & 0xff;
+	data[3] = (HDR_LEN + attrs_len) & 0xff;
+	for (i = 0; i < AUTH_VECTOR_LEN; i++) data[4 + i] = fr_rand();
+	memcpy(data + HDR_LEN, attrs, attrs_len);
+
+	packet->data = data;
+	packet->data_len = HDR_LEN + attrs_len;
+	packet->code = data[0];
+	packet->id = data[1];
+	memcpy(packet->vector, data + 4, AUTH_VECTOR_LEN);
+
+	/*
+	 *	Some vectors only decode in a particular context.
+	 */
+	if (fr_radius_decode(packet, NULL, secret) < 0) {
+		talloc_free(packet);
+		return false;
+	}
+	fr_pair_list_free(&packet->vps);
+
+	packets[num_packets++] = packet;
+
+	return true;
+}
+
+/** Read "decode" inputs and hex "data" outputs from a unit test file
+ *
+ * Each one becomes a packet.  We also build one large packet from
+ * all of them, which is closer to what an accounting request looks
+ * like.
+ */
+static void vectors_load(TALLOC_CTX *ctx, char const *filename, uint8_t *all, size_t *all_len)
+{
+	FILE	*fp;
+	char	buffer[8192];
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "Failed opening %s: %s\n", filename, fr_syserror(errno));
+		exit(1);
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		char		hex[sizeof(buffer)];
+		uint8_t		attrs[sizeof(buffer) / 2];
+		char		*p, *q;
+		size_t		len;
+
+		if (strncmp(buffer, "decode ", 7) == 0) {
+			p = buffer + 7;
+		} else if (strncmp(buffer, "data ", 5) == 0) {
+			p = buffer + 5;
+		} else {
+			continue;
+		}
+
+		/*
+		 *	Only space separated hex octets.
+		 */
+		q = hex;
+		while (*p && (*p != '\n')) {
+			if (*p == ' ') {
+				p++;
+				continue;
+			}
+
+			if (!isxdigit((int) p[0]) || !isxdigit((int) p[1]) || ((p[2] != ' ') && (p[2] != '\n') && p[2])) {
+				q = hex;
+				break;
+			}
+
+			*q++ = *p++;
+			*q++ = *p++;
+		}
+		if (q == hex) continue;
+
+		len = fr_hex2bin(attrs, sizeof(attrs), hex, q - hex);
+		if (!packet_add(ctx, attrs, len)) continue;
+
+		if ((*all_len + len) <= (MAX_PACKET_LEN - HDR_LEN)) {
+			memcpy(all + *all_len, attrs, len);
+			*all_len += len;
+		}
+	}
+
+	fclose(fp);
+}
+
+static int strcmp_ptr(void const *a, void const *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/** Print a pair list in a canonical order
+ *
+ * Unknown attributes get a new fr_dict_attr_t for every decode, so
+ * we can't use fr_pair_list_cmp().
+ */
+static char *vps_print(TALLOC_CTX *ctx, VALUE_PAIR *vps)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	char		**lines;
+	char		*out;
+	int		i, num = 0;
+
+	for (vp = fr_pair_cursor_init(&cursor, &vps); vp; vp = fr_pair_cursor_next(&cursor)) num++;
+
+	lines = talloc_array(ctx, char *, num + 1);
+	i = 0;
+	for (vp = fr_pair_cursor_init(&cursor, &vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		char buffer[4096];
+
+		fr_pair_snprint(buffer, sizeof(buffer), vp);
+		lines[i++] = talloc_strdup(lines, buffer);
+	}
+	qsort(lines, num, sizeof(lines[0]), strcmp_ptr);
+
+	out = talloc_strdup(ctx, "");
+	for (i = 0; i < num; i++) out = talloc_asprintf_append_buffer(out, "%s\n", lines[i]);
+	talloc_free(lines);
+
+	return out;
+}
+
+/** Check that lazy decoding gives the same pairs as eager decoding
+ *
+ */
+static void verify(RADIUS_PACKET *packet)
+{
+	fr_radius_index_t	*idx;
+	char			*eager, *lazy;
+	int			i;
+
+	if (fr_radius_decode(packet, NULL, secret) < 0) {
+		fprintf(stderr, "Failed decoding packet %d: %s\n", packet->id, fr_strerror());
+		exit(1);
+	}
+	eager = vps_print(packet, packet->vps);
+
+	/*
+	 *	Each attribute we look up must be there iff it was
+	 *	there in the eager decode.
+	 */
+	for (i = 0; i < num_find_da; i++) {
+		bool found = (fr_pair_find_by_da(packet->vps, find_da[i], TAG_ANY) != NULL);
+
+		fr_pair_list_free(&packet->vps);
+
+		idx = fr_radius_index_afrom_packet(packet, packet, NULL, secret);
+		if (!idx) {
+			fprintf(stderr, "Failed indexing packet %d: %s\n", packet->id, fr_strerror());
+			exit(1);
+		}
+
+		if ((fr_radius_index_pair_find(idx, find_da[i], TAG_ANY) != NULL) != found) {
+			fprintf(stderr, "Packet %d: lazy lookup of %s differs\n", packet->id, find_da[i]->name);
+			errors++;
+		}
+		talloc_free(idx);
+
+		fr_pair_list_free(&packet->vps);
+		if (fr_radius_decode(packet, NULL, secret) < 0) exit(1);
+	}
+	fr_pair_list_free(&packet->vps);
+
+	/*
+	 *	Touch one attribute, then decode everything else.  The
+	 *	result must be the same as an eager decode.
+	 */
+	idx = fr_radius_index_afrom_packet(packet, packet, NULL, secret);
+	if (!idx) exit(1);
+
+	if (num_find_da) (void) fr_radius_index_pair_find(idx, find_da[0], TAG_ANY);
+
+	if (fr_radius_index_decode_all(idx) < 0) {
+		fprintf(stderr, "Failed lazy decoding packet %d: %s\n", packet->id, fr_strerror());
+		exit(1);
+	}
+	talloc_free(idx);
+
+	lazy = vps_print(packet, packet->vps);
+	if (strcmp(eager, lazy) != 0) {
+		fprintf(stderr, "Packet %d: lazy decode differs\neager:\n%slazy:\n%s", packet->id, eager, lazy);
+		errors++;
+	}
+
+	fr_pair_list_free(&packet->vps);
+	talloc_free(eager);
+	talloc_free(lazy);
+}
+
+/** Make a new packet header pointing to the test packet's data
+ *
+ * Unknown attributes are allocated in the packet being decoded, so
+ * we can't keep decoding the same one over and over.  This is also
+ * what the server does, one RADIUS_PACKET per packet received.
+ */
+static RADIUS_PACKET *packet_borrow(RADIUS_PACKET const *in)
+{
+	RADIUS_PACKET *packet;
+
+	packet = fr_radius_alloc(NULL, false);
+	if (!packet) exit(1);
+
+	packet->data = in->data;
+	packet->data_len = in->data_len;
+	packet->code = in->code;
+	packet->id = in->id;
+	memcpy(packet->vector, in->vector, AUTH_VECTOR_LEN);
+
+	return packet;
+}
+
+typedef enum {
+	DECODE_EAGER = 0,
+	DECODE_LAZY,
+	DECODE_LAZY_ALL
+} decode_t;
+
+static char const *decode_names[] = { "eager", "lazy", "lazy all" };
+
+static void run(decode_t type, int first, int num)
+{
+	int		i, op;
+	struct timeval	start, end;
+	double		elapsed;
+	size_t		bytes = 0;
+
+	gettimeofday(&start, NULL);
+
+	for (op = 0; op < num_ops; op++) {
+		RADIUS_PACKET		*packet = packet_borrow(packets[first + (op % num)]);
+		fr_radius_index_t	*idx;
+
+		bytes += packet->data_len;
+
+		switch (type) {
+		case DECODE_EAGER:
+			if (fr_radius_decode(packet, NULL, secret) < 0) exit(1);
+
+			for (i = 0; i < num_find_da; i++) (void) fr_pair_find_by_da(packet->vps, find_da[i], TAG_ANY);
+			break;
+
+		case DECODE_LAZY:
+			idx = fr_radius_index_afrom_packet(packet, packet, NULL, secret);
+			if (!idx) exit(1);
+
+			for (i = 0; i < num_find_da; i++) (void) fr_radius_index_pair_find(idx, find_da[i], TAG_ANY);
+			talloc_free(idx);
+			break;
+
+		case DECODE_LAZY_ALL:
+			idx = fr_radius_index_afrom_packet(packet, packet, NULL, secret);
+			if (!idx) exit(1);
+
+			if (fr_radius_index_decode_all(idx) < 0) exit(1);
+			talloc_free(idx);
+			break;
+		}
+
+		talloc_free(packet);
+	}
+
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("  %-8s %d decodes in %.3fs, %.1f ns/packet, %.1f MB/s\n",
+	       decode_names[type], num_ops, elapsed, (elapsed * 1e9) / num_ops, (bytes / elapsed) / (1024 * 1024));
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radius_decode_test [OPTS] <file> ...\n");
+	fprintf(stderr, "  -a <attr>[,<attr>]     Attributes to look up (default User-Name).\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <ops>               Number of packets to decode.\n");
+	fprintf(stderr, "  -s <secret>            Shared secret.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Files are unit test vectors from src/tests/unit/.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i;
+	char const	*dict_dir = DICTDIR;
+	char		*attrs = NULL;
+	char		*p, *tok;
+	fr_dict_t	*dict = NULL;
+	uint8_t		all[MAX_PACKET_LEN];
+	size_t		all_len = 0;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "a:D:hn:s:")) != EOF) switch (c) {
+		case 'a':
+			attrs = talloc_strdup(autofree, optarg);
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num_ops = atoi(optarg);
+			if (num_ops <= 0) usage();
+			break;
+
+		case 's':
+			secret = optarg;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) usage();
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fprintf(stderr, "Failed reading dictionaries: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if (!attrs) attrs = talloc_strdup(autofree, "User-Name");
+
+	p = attrs;
+	while ((tok = strsep(&p, ",")) != NULL) {
+		if (!*tok) continue;
+
+		if (num_find_da == MAX_ATTRS) usage();
+
+		find_da[num_find_da] = fr_dict_attr_by_name(NULL, tok);
+		if (!find_da[num_find_da]) {
+			fprintf(stderr, "Unknown attribute \"%s\"\n", tok);
+			exit(1);
+		}
+		num_find_da++;
+	}
+
+	for (i = 0; i < argc; i++) vectors_load(autofree, argv[i], all, &all_len);
+
+	if (num_packets == 0) {
+		fprintf(stderr, "No usable vectors found\n");
+		exit(1);
+	}
+
+	/*
+	 *	The large packet goes last, so it can be benchmarked
+	 *	on its own.
+	 */
+	if (num_packets == MAX_PACKETS) num_packets--;
+	if (!packet_add(autofree, all, all_len)) {
+		fprintf(stderr, "Failed building large packet\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_packets; i++) verify(packets[i]);
+
+	printf("%d test vectors\n", num_packets - 1);
+	run(DECODE_EAGER, 0, num_packets - 1);
+	run(DECODE_LAZY, 0, num_packets - 1);
+	run(DECODE_LAZY_ALL, 0, num_packets - 1);
+
+	printf("One packet of %zu bytes\n", packets[num_packets - 1]->data_len);
+	run(DECODE_EAGER, num_packets - 1, 1);
+	run(DECODE_LAZY, num_packets - 1, 1);
+	run(DECODE_LAZY_ALL, num_packets - 1, 1);
+
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET := radius_decode_test
+
+SOURCES := radius_decode_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,233 @@
+/*
+ * radius_encode_test.c	Benchmarks for RADIUS reply encoding, with and without
+ *			the pre-built attribute headers.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/*
+ *	What a typical Access-Accept looks like, a mix of RFC
+ *	attributes and VSAs.  Add an encrypted attribute with -r to
+ *	see how much the full encoder costs.
+ */
+static char const	*reply_attrs =
+	"Framed-IP-Address = 192.0.2.1, "
+	"Framed-IP-Netmask = 255.255.255.0, "
+	"Framed-Protocol = PPP, "
+	"Service-Type = Framed-User, "
+	"Session-Timeout = 86400, "
+	"Idle-Timeout = 600, "
+	"Acct-Interim-Interval = 300, "
+	"Class = 0x0102030405060708090a0b0c0d0e0f10, "
+	"Filter-Id = \"std.ingress\", "
+	"Reply-Message = \"Welcome to the network\", "
+	"Cisco-AVPair = \"ip:addr-pool=pool1\", "
+	"Cisco-AVPair = \"subscriber:accounting-list=default\", "
+	"Cisco-AVPair = \"ip:inacl#1=permit ip any any\", "
+	"Ascend-Data-Rate = 10000000";
+
+#define HDR_LEN		(20)
+
+static char const	*secret;
+static int		num_ops = 200000;
+
+static void plan_disable(VALUE_PAIR *vps)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	/*
+	 *	The dictionary is read-only everywhere else.
+	 */
+	for (vp = fr_pair_cursor_init(&cursor, &vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		fr_dict_attr_t *da;
+
+		memcpy(&da, &vp->da, sizeof(da));
+		da->encode.hdr_len = 0;
+	}
+}
+
+static void plan_enable(VALUE_PAIR *vps, fr_dict_attr_encode_t *saved)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	int		i = 0;
+
+	for (vp = fr_pair_cursor_init(&cursor, &vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		fr_dict_attr_t *da;
+
+		memcpy(&da, &vp->da, sizeof(da));
+		da->encode = saved[i++];
+	}
+}
+
+static void run(RADIUS_PACKET *original, RADIUS_PACKET *reply, bool plan, uint8_t **out, size_t *out_len)
+{
+	int		op;
+	struct timeval	start, end;
+	double		elapsed;
+
+	gettimeofday(&start, NULL);
+
+	for (op = 0; op < num_ops; op++) {
+		if (fr_radius_encode(reply, original, secret) < 0) {
+			fprintf(stderr, "Failed encoding reply: %s\n", fr_strerror());
+			exit(1);
+		}
+
+		if (op == 0) {
+			*out = talloc_memdup(NULL, reply->data, reply->data_len);
+			*out_len = reply->data_len;
+		}
+
+		TALLOC_FREE(reply->data);
+		reply->data_len = 0;
+	}
+
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("%-8s %d replies of %zu bytes in %.3fs, %.0f packets/s\n",
+	       plan ? "plan" : "full", num_ops, *out_len, elapsed, num_ops / elapsed);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radius_encode_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <ops>               Number of replies to encode.\n");
+	fprintf(stderr, "  -r <attrs>             Reply attributes, as \"Attr = value, ...\".\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, num = 0;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	RADIUS_PACKET		*original, *reply;
+	vp_cursor_t		cursor;
+	VALUE_PAIR		*vp;
+	fr_dict_attr_encode_t	*saved;
+	uint8_t			*full, *plan;
+	size_t			full_len, plan_len;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	/*
+	 *	The Tunnel-Password encoder wants a talloced secret.
+	 */
+	secret = talloc_typed_strdup(autofree, "testing123");
+
+	while ((c = getopt(argc, argv, "D:hn:r:")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num_ops = atoi(optarg);
+			if (num_ops <= 0) usage();
+			break;
+
+		case 'r':
+			reply_attrs = optarg;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fprintf(stderr, "Failed reading dictionaries: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	original = fr_radius_alloc(autofree, true);
+	original->code = PW_CODE_ACCESS_REQUEST;
+
+	reply = fr_radius_alloc_reply(autofree, original);
+	reply->code = PW_CODE_ACCESS_ACCEPT;
+
+	if (fr_pair_list_afrom_str(reply, reply_attrs, &reply->vps) == T_INVALID) {
+		fprintf(stderr, "Invalid reply attributes: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	for (vp = fr_pair_cursor_init(&cursor, &reply->vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		if (vp->da->encode.hdr_len) num++;
+	}
+	printf("%d of the reply attributes have pre-built headers\n", num);
+
+	num = 0;
+	for (vp = fr_pair_cursor_init(&cursor, &reply->vps); vp; vp = fr_pair_cursor_next(&cursor)) num++;
+
+	saved = talloc_array(autofree, fr_dict_attr_encode_t, num);
+	i = 0;
+	for (vp = fr_pair_cursor_init(&cursor, &reply->vps); vp; vp = fr_pair_cursor_next(&cursor)) {
+		saved[i++] = vp->da->encode;
+	}
+
+	plan_disable(reply->vps);
+	run(original, reply, false, &full, &full_len);
+
+	plan_enable(reply->vps, saved);
+	run(original, reply, true, &plan, &plan_len);
+
+	/*
+	 *	The Tunnel-Password salt changes on every encode, so
+	 *	skip that.  Everything else must be identical.
+	 */
+	if (full_len != plan_len) {
+		fprintf(stderr, "Encoded length differs: full %zu, plan %zu\n", full_len, plan_len);
+		exit(1);
+	}
+
+	if (memcmp(full, plan, HDR_LEN) != 0) {
+		fprintf(stderr, "Encoded header differs\n");
+		exit(1);
+	}
+
+	for (i = HDR_LEN; i < (int) full_len; i += full[i + 1]) {
+		if (full[i] == PW_TUNNEL_PASSWORD) continue;
+
+		if ((full[i + 1] != plan[i + 1]) || (memcmp(full + i, plan + i, full[i + 1]) != 0)) {
+			fprintf(stderr, "Encoded attribute at offset %d differs\n", i);
+			exit(1);
+		}
+	}
+
+	printf("Encoded packets are identical\n");
+
+	talloc_free(full);
+	talloc_free(plan);
+	talloc_free(autofree);
+
+	return 0;
+}
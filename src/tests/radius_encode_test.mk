@@ -0,0 +1,7 @@
+TARGET := radius_encode_test
+
+SOURCES := radius_encode_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
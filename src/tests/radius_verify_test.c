@@ -0,0 +1,273 @@
+/*
+ * radius_verify_test.c	Benchmarks for verifying RADIUS packets, one at a time
+ *			vs in batches with multi-buffer MD5.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_BATCH	(64)
+
+/*
+ *	What a typical Accounting-Request looks like.
+ */
+static char const	*acct_attrs =
+	"User-Name = \"bob@example.com\", "
+	"Acct-Status-Type = Interim-Update, "
+	"Acct-Session-Id = \"0123456789abcdef\", "
+	"NAS-IP-Address = 192.0.2.254, "
+	"NAS-Port = 1234, "
+	"Framed-IP-Address = 192.0.2.1, "
+	"Acct-Input-Octets = 123456789, "
+	"Acct-Output-Octets = 987654321, "
+	"Acct-Session-Time = 3600, "
+	"Event-Timestamp = 1500000000, "
+	"Called-Station-Id = \"00-11-22-33-44-55:ssid\", "
+	"Calling-Station-Id = \"66-77-88-99-aa-bb\"";
+
+/*
+ *	And an Access-Request with a Message-Authenticator, as sent
+ *	during EAP.
+ */
+static char const	*auth_attrs =
+	"User-Name = \"bob@example.com\", "
+	"NAS-IP-Address = 192.0.2.254, "
+	"NAS-Port = 1234, "
+	"Called-Station-Id = \"00-11-22-33-44-55:ssid\", "
+	"Calling-Station-Id = \"66-77-88-99-aa-bb\", "
+	"Framed-MTU = 1400, "
+	"EAP-Message = 0x0201001401626f62406578616d706c652e636f6d, "
+	"Message-Authenticator = 0x00";
+
+static char const	*secret;
+static int		num_ops = 2000000;
+static int		batch = FR_MD5_MB_LANES;
+static int		errors;
+
+/** Check the multi-buffer MD5 against the normal one
+ *
+ * Every length up to a few blocks, split into segments in different
+ * ways, so that we hit every padding case.
+ */
+static void md5_mb_check(void)
+{
+	uint8_t		data[300];
+	uint8_t		out[FR_MD5_MB_LANES][MD5_DIGEST_LENGTH];
+	uint8_t		expected[MD5_DIGEST_LENGTH];
+	fr_md5_mb_in_t	in[FR_MD5_MB_LANES];
+	size_t		len;
+	int		i, num = 0, checked = 0;
+
+	for (i = 0; i < (int) sizeof(data); i++) data[i] = fr_rand();
+
+	for (len = 0; len <= sizeof(data); len++) {
+		size_t split = len ? (fr_rand() % len) : 0;
+
+		/*
+		 *	Vary the number of messages in each batch.
+		 */
+		memset(&in[num], 0, sizeof(in[num]));
+		in[num].data[0] = data;
+		in[num].len[0] = split;
+		in[num].data[2] = data + split;
+		in[num].len[2] = len - split;
+		num++;
+
+		if ((num < (int) ((len % FR_MD5_MB_LANES) + 1)) && (len < sizeof(data))) continue;
+
+		fr_md5_mb_calc(out, in, num);
+
+		for (i = 0; i < num; i++) {
+			size_t total = in[i].len[0] + in[i].len[2];
+
+			fr_md5_calc(expected, data, total);
+			if (memcmp(out[i], expected, sizeof(expected)) != 0) {
+				fprintf(stderr, "Multi-buffer MD5 differs for a %zu byte message\n", total);
+				errors++;
+			}
+			checked++;
+		}
+		num = 0;
+	}
+
+	printf("Checked %d multi-buffer MD5 digests\n", checked);
+}
+
+/** Build a signed packet, and turn it into what we would have received
+ *
+ */
+static RADIUS_PACKET *packet_build(TALLOC_CTX *ctx, unsigned int code, char const *attrs, int id)
+{
+	RADIUS_PACKET	*packet, *received;
+
+	packet = fr_radius_alloc(ctx, true);
+	packet->code = code;
+	packet->id = id;
+
+	if (fr_pair_list_afrom_str(packet, attrs, &packet->vps) == T_INVALID) {
+		fprintf(stderr, "Invalid attributes: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if ((fr_radius_encode(packet, NULL, secret) < 0) || (fr_radius_sign(packet, NULL, secret) < 0)) {
+		fprintf(stderr, "Failed encoding packet: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	received = fr_radius_alloc(ctx, false);
+	received->data = talloc_memdup(received, packet->data, packet->data_len);
+	received->data_len = packet->data_len;
+	received->code = packet->data[0];
+	received->id = packet->data[1];
+	memcpy(received->vector, packet->data + 4, AUTH_VECTOR_LEN);
+
+	talloc_free(packet);
+
+	return received;
+}
+
+static void run(char const *name, RADIUS_PACKET **packets, char const **secrets, size_t const *secret_lens,
+		int size)
+{
+	int		op, i;
+	int		rcodes[MAX_BATCH];
+	struct timeval	start, end;
+	double		single, batched;
+
+	gettimeofday(&start, NULL);
+	for (op = 0; op < num_ops; op += size) {
+		for (i = 0; i < size; i++) {
+			if (fr_radius_verify(packets[i], NULL, secrets[i]) < 0) {
+				fprintf(stderr, "%s failed verification: %s\n", name, fr_strerror());
+				exit(1);
+			}
+		}
+	}
+	gettimeofday(&end, NULL);
+	single = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	gettimeofday(&start, NULL);
+	for (op = 0; op < num_ops; op += size) {
+		if (fr_radius_verify_batch(packets, NULL, secrets, secret_lens, rcodes, size) != size) {
+			fprintf(stderr, "%s failed batch verification: %s\n", name, fr_strerror());
+			exit(1);
+		}
+	}
+	gettimeofday(&end, NULL);
+	batched = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("%s (%zu bytes): single %.0f verifications/s, batch of %d %.0f verifications/s (%.2fx)\n",
+	       name, packets[0]->data_len, num_ops / single, size, num_ops / batched, single / batched);
+
+	/*
+	 *	And both must reject a packet which has been tampered
+	 *	with.
+	 */
+	packets[0]->data[packets[0]->data_len - 1] ^= 0x01;
+	if (fr_radius_verify(packets[0], NULL, secrets[0]) == 0) {
+		fprintf(stderr, "%s: single verification accepted a bad packet\n", name);
+		errors++;
+	}
+	if ((fr_radius_verify_batch(packets, NULL, secrets, secret_lens, rcodes, size) != (size - 1)) || (rcodes[0] == 0)) {
+		fprintf(stderr, "%s: batch verification accepted a bad packet\n", name);
+		errors++;
+	}
+	packets[0]->data[packets[0]->data_len - 1] ^= 0x01;
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radius_verify_test [OPTS]\n");
+	fprintf(stderr, "  -b <packets>           Number of packets verified per batch.\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <ops>               Number of packets to verify.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	RADIUS_PACKET		*acct[MAX_BATCH], *auth[MAX_BATCH];
+	char const		*secrets[MAX_BATCH];
+	size_t			secret_lens[MAX_BATCH];
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	/*
+	 *	fr_radius_verify() wants a talloced secret.
+	 */
+	secret = talloc_typed_strdup(autofree, "testing123");
+
+	while ((c = getopt(argc, argv, "b:D:hn:")) != EOF) switch (c) {
+		case 'b':
+			batch = atoi(optarg);
+			if ((batch <= 0) || (batch > MAX_BATCH)) usage();
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num_ops = atoi(optarg);
+			if (num_ops <= 0) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fprintf(stderr, "Failed reading dictionaries: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	md5_mb_check();
+
+	for (i = 0; i < batch; i++) {
+		acct[i] = packet_build(autofree, PW_CODE_ACCOUNTING_REQUEST, acct_attrs, i);
+		auth[i] = packet_build(autofree, PW_CODE_ACCESS_REQUEST, auth_attrs, i);
+		secrets[i] = secret;
+		secret_lens[i] = talloc_array_length(secret) - 1;
+	}
+
+	run("Accounting-Request", acct, secrets, secret_lens, batch);
+	run("Access-Request with Message-Authenticator", auth, secrets, secret_lens, batch);
+
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
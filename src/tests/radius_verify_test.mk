@@ -0,0 +1,7 @@
+TARGET := radius_verify_test
+
+SOURCES := radius_verify_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
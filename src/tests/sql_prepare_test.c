@@ -0,0 +1,456 @@
+/*
+ * sql_prepare_test.c	Checks for the compilation of SQL queries into
+ *			templates with placeholders.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include "../modules/rlm_sql/rlm_sql.h"
+
+#include <ctype.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+main_config_t main_config;
+
+/*
+ *	What we expect a placeholder to be compiled into.
+ */
+typedef enum {
+	PARAM_ATTR = 0,			//!< Value of an attribute, bound as is.
+	PARAM_INTEGER,			//!< Value of an attribute, bound as %{integer:...} prints it.
+	PARAM_XLAT			//!< Result of an expansion, bound as a string.
+} param_type_t;
+
+typedef struct {
+	param_type_t	type;
+	char const	*attr;		//!< For PARAM_ATTR and PARAM_INTEGER.
+	int		dflt;		//!< -1 for NULL, -2 for the empty string.  Otherwise an integer.
+} param_test_t;
+
+typedef struct {
+	char const	*fmt;		//!< As configured.
+	char const	*query;		//!< Placeholders in the place of the expansions.
+					//!< NULL if the query can't be compiled.
+	char const	*error;		//!< Start of the error, if it can't.
+	param_test_t	params[4];
+} compile_test_t;
+
+#define STRING(_attr)	{ PARAM_ATTR, _attr, -2 }
+#define XLAT		{ PARAM_XLAT, NULL, -2 }
+
+static compile_test_t const compile_tests[] = {
+	/*
+	 *	Quoting
+	 */
+	{ "SELECT id FROM radcheck WHERE username = '%{User-Name}' ORDER BY id",
+	  "SELECT id FROM radcheck WHERE username = ? ORDER BY id", NULL,
+	  { STRING("User-Name") } },
+	{ "SELECT id FROM radcheck WHERE username = 'user-%{User-Name}'",
+	  "SELECT id FROM radcheck WHERE username = ?", NULL,
+	  { XLAT } },
+	{ "SELECT id FROM radcheck WHERE username = 'bob' AND op = ':='",
+	  "SELECT id FROM radcheck WHERE username = 'bob' AND op = ':='", NULL },
+	{ "SELECT id FROM radcheck WHERE username = 'it''s' AND nas = '%{NAS-Identifier}'",
+	  "SELECT id FROM radcheck WHERE username = 'it''s' AND nas = ?", NULL,
+	  { STRING("NAS-Identifier") } },
+	{ "SELECT id FROM radcheck WHERE username = 'it''s %{User-Name}'",
+	  NULL, "Expansion in a string containing escape sequences" },
+	{ "SELECT id FROM radcheck WHERE username = 'a\\b%{User-Name}'",
+	  NULL, "Expansion in a string containing escape sequences" },
+	{ "SELECT id FROM radcheck WHERE username = '%{User-Name}",
+	  NULL, "Unterminated string" },
+	{ "SELECT \"id\" FROM `radcheck` WHERE username = '%{User-Name}'",
+	  "SELECT \"id\" FROM `radcheck` WHERE username = ?", NULL,
+	  { STRING("User-Name") } },
+	{ "SELECT id FROM \"%{Called-Station-Id}\"",
+	  NULL, "Expansion in an identifier" },
+	{ "SELECT id FROM `%{Called-Station-Id}`",
+	  NULL, "Expansion in an identifier" },
+	{ "SELECT id FROM \"radcheck",
+	  NULL, "Unterminated identifier" },
+
+	/*
+	 *	Escaped %
+	 */
+	{ "SELECT id FROM radcheck WHERE username LIKE 'bob%%' AND nas = '%{NAS-Identifier}'",
+	  "SELECT id FROM radcheck WHERE username LIKE ? AND nas = ?", NULL,
+	  { XLAT, STRING("NAS-Identifier") } },
+	{ "SELECT id FROM radcheck WHERE username LIKE 'bob%'",
+	  NULL, "Invalid variable expansion" },
+	{ "SELECT id FROM radcheck WHERE username LIKE '%%bob%%'",
+	  "SELECT id FROM radcheck WHERE username LIKE ?", NULL,
+	  { XLAT } },
+	{ "SELECT id % 10 FROM radcheck",
+	  NULL, "Unquoted expansion \"% \" is not a plain attribute reference" },
+	{ "SELECT id %% 10 FROM radcheck WHERE username = '%{User-Name}'",
+	  "SELECT id % 10 FROM radcheck WHERE username = ?", NULL,
+	  { STRING("User-Name") } },
+
+	/*
+	 *	Nested expansions
+	 */
+	{ "SELECT id FROM radcheck WHERE username = '%{%{Stripped-User-Name}:-%{User-Name}}'",
+	  "SELECT id FROM radcheck WHERE username = ?", NULL,
+	  { XLAT } },
+	{ "SELECT id FROM radcheck WHERE username = '%{upper:%{User-Name}}'",
+	  "SELECT id FROM radcheck WHERE username = ?", NULL,
+	  { XLAT } },
+	{ "INSERT INTO radacct VALUES (%{%{Acct-Input-Octets}:-0}, %{%{Acct-Output-Octets}:-NULL})",
+	  "INSERT INTO radacct VALUES (?, ?)", NULL,
+	  { { PARAM_ATTR, "Acct-Input-Octets", 0 }, { PARAM_ATTR, "Acct-Output-Octets", -1 } } },
+	{ "INSERT INTO radacct VALUES (%{%{Acct-Input-Octets}:-%{Acct-Output-Octets}})",
+	  NULL, "Unquoted expansion \"%{%{Acct-Input-Octets}:-%{Acct-Output-Octets}}\" is not a plain" },
+	{ "INSERT INTO radacct VALUES (%{%{Acct-Input-Octets}:-zero})",
+	  NULL, "Unquoted expansion \"%{%{Acct-Input-Octets}:-zero}\" is not a plain" },
+	{ "INSERT INTO radacct VALUES (%{upper:%{User-Name}})",
+	  NULL, "Unquoted expansion \"%{upper:%{User-Name}}\" is not a plain" },
+	{ "SELECT id FROM radcheck WHERE username = '%{%{User-Name}'",
+	  NULL, "Expected ':' after first expansion" },
+
+	/*
+	 *	Unquoted integers
+	 */
+	{ "INSERT INTO radacct VALUES (%{Acct-Session-Time}, %{integer:Event-Timestamp}, %{integer:Acct-Status-Type})",
+	  "INSERT INTO radacct VALUES (?, ?, ?)", NULL,
+	  { { PARAM_ATTR, "Acct-Session-Time", -1 }, { PARAM_INTEGER, "Event-Timestamp", -1 },
+	    { PARAM_INTEGER, "Acct-Status-Type", -1 } } },
+	{ "INSERT INTO radacct VALUES (%{User-Name})",
+	  NULL, "Unquoted expansion \"%{User-Name}\" is not an integer" },
+	{ "INSERT INTO radacct VALUES (%{integer:User-Name})",
+	  NULL, "Unquoted expansion \"%{integer:User-Name}\" is not an integer" },
+	{ "INSERT INTO radacct VALUES (%{Event-Timestamp})",
+	  NULL, "Unquoted expansion \"%{Event-Timestamp}\" is not an integer" },
+
+	/*
+	 *	Literal ?
+	 */
+	{ "SELECT id FROM radcheck WHERE username = '?' AND nas = '%{NAS-Identifier}'",
+	  "SELECT id FROM radcheck WHERE username = '?' AND nas = ?", NULL,
+	  { STRING("NAS-Identifier") } },
+	{ "SELECT id FROM radcheck WHERE username = '%{User-Name}?'",
+	  "SELECT id FROM radcheck WHERE username = ?", NULL,
+	  { XLAT } },
+	{ "SELECT id FROM radcheck WHERE username = ?",
+	  NULL, "Query already contains placeholders" },
+	{ "SELECT id FROM radcheck WHERE username = $1",
+	  "SELECT id FROM radcheck WHERE username = $1", NULL },
+};
+
+static compile_test_t const compile_tests_numbered[] = {
+	{ "SELECT id FROM radcheck WHERE username = '%{User-Name}' AND nas = %{NAS-Port}",
+	  "SELECT id FROM radcheck WHERE username = $1 AND nas = $2", NULL,
+	  { STRING("User-Name"), { PARAM_ATTR, "NAS-Port", -1 } } },
+	{ "SELECT id FROM radcheck WHERE username = ? AND nas = '%{NAS-Identifier}'",
+	  "SELECT id FROM radcheck WHERE username = ? AND nas = $1", NULL,
+	  { STRING("NAS-Identifier") } },
+	{ "SELECT id FROM radcheck WHERE username = '$1' AND nas = '%{NAS-Identifier}'",
+	  "SELECT id FROM radcheck WHERE username = '$1' AND nas = $1", NULL,
+	  { STRING("NAS-Identifier") } },
+	{ "SELECT id FROM radcheck WHERE username = $1",
+	  NULL, "Query already contains placeholders" },
+	{ "SELECT $x FROM radcheck WHERE username = '%{User-Name}'",
+	  "SELECT $x FROM radcheck WHERE username = $1", NULL,
+	  { STRING("User-Name") } },
+};
+
+static int errors;
+
+#define FAIL(_fmt, ...) do { \
+	fprintf(stderr, "%s: " _fmt "\n", test->fmt, ## __VA_ARGS__); \
+	errors++; \
+} while (0)
+
+static ssize_t xlat_upper(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
+			  UNUSED void const *mod_inst, UNUSED void const *xlat_inst,
+			  UNUSED REQUEST *request, char const *fmt)
+{
+	size_t i;
+
+	for (i = 0; fmt[i] && (i < (outlen - 1)); i++) (*out)[i] = toupper((int) fmt[i]);
+	(*out)[i] = '\0';
+
+	return i;
+}
+
+static void check_param(compile_test_t const *test, int i, rlm_sql_param_t const *param)
+{
+	param_test_t const *expect = &test->params[i];
+
+	if (expect->type == PARAM_XLAT) {
+		if (!param->xlat || param->vpt) FAIL("param %i should be an expansion", i);
+		return;
+	}
+
+	if (!param->vpt || param->xlat) {
+		FAIL("param %i should be an attribute", i);
+		return;
+	}
+
+	if (strcmp(param->vpt->tmpl_da->name, expect->attr) != 0) {
+		FAIL("param %i is %s, not %s", i, param->vpt->tmpl_da->name, expect->attr);
+	}
+
+	if (param->integer != (expect->type == PARAM_INTEGER)) {
+		FAIL("param %i should%s be printed as an integer", i, param->integer ? " not" : "");
+	}
+
+	switch (expect->dflt) {
+	case -1:
+		if (param->dflt.type != PW_TYPE_INVALID) FAIL("param %i should default to NULL", i);
+		break;
+
+	case -2:
+		if ((param->dflt.type != PW_TYPE_STRING) || (*param->dflt.datum.strvalue != '\0')) {
+			FAIL("param %i should default to an empty string", i);
+		}
+		break;
+
+	default:
+		if ((param->dflt.type != PW_TYPE_INTEGER64) ||
+		    (param->dflt.datum.integer64 != (uint64_t) expect->dflt)) {
+			FAIL("param %i should default to %i", i, expect->dflt);
+		}
+		break;
+	}
+}
+
+static void check_compile(rlm_sql_t const *inst, compile_test_t const *tests, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		compile_test_t const	*test = &tests[i];
+		rlm_sql_template_t	*tmpl;
+		int			j, num_params = 0;
+
+		fr_strerror();	/* clear it */
+
+		tmpl = rlm_sql_template_compile(inst, test->fmt);
+		if (!test->query) {
+			char const *error;
+
+			if (tmpl) {
+				FAIL("compiled to \"%s\", expected \"%s\"", tmpl->query, test->error);
+				talloc_free(tmpl);
+				continue;
+			}
+
+			error = fr_strerror();
+			if (strncmp(error, test->error, strlen(test->error)) != 0) {
+				FAIL("failed with \"%s\", expected \"%s\"", error, test->error);
+			}
+			continue;
+		}
+
+		if (!tmpl) {
+			FAIL("failed to compile: %s", fr_strerror());
+			continue;
+		}
+
+		if (strcmp(tmpl->query, test->query) != 0) {
+			FAIL("compiled to \"%s\", expected \"%s\"", tmpl->query, test->query);
+		}
+
+		while ((num_params < (int) (sizeof(test->params) / sizeof(*test->params))) &&
+		       (test->params[num_params].attr || (test->params[num_params].type == PARAM_XLAT))) num_params++;
+		if (tmpl->num_params != num_params) {
+			FAIL("has %i params, expected %i", tmpl->num_params, num_params);
+		} else for (j = 0; j < num_params; j++) {
+			check_param(test, j, &tmpl->params[j]);
+		}
+
+		talloc_free(tmpl);
+	}
+}
+
+/*
+ *	Templates are found by the text of the query, not where it's
+ *	stored, as queries with the same text may be configured more
+ *	than once.
+ */
+static void check_add(rlm_sql_t *inst)
+{
+	compile_test_t const	t = { .fmt = "template_add" }, *test = &t;
+	char			one[] = "SELECT id FROM radcheck WHERE username = '%{User-Name}'";
+	char			two[] = "SELECT id FROM radcheck WHERE username = '%{User-Name}'";
+	char			bad[] = "SELECT id FROM radcheck WHERE username = ?";
+	rlm_sql_template_t const *tmpl;
+
+	if (rlm_sql_template_add(inst, one) != 1) FAIL("failed adding the query");
+	if (rlm_sql_template_add(inst, two) != 1) FAIL("failed adding the query again");
+	if (inst->num_templates != 1) FAIL("has %i templates, expected 1", inst->num_templates);
+
+	one[0] = 's';
+	tmpl = rlm_sql_template_find(inst, two);
+	if (!tmpl) {
+		FAIL("couldn't find the query");
+	} else if (tmpl->id != 0) {
+		FAIL("found template %i, expected 0", tmpl->id);
+	}
+	if (rlm_sql_template_find(inst, one)) FAIL("found a query which wasn't added");
+
+	if (rlm_sql_template_add(inst, bad) != 0) FAIL("added a query which can't be compiled");
+	if (rlm_sql_template_find(inst, bad)) FAIL("found a query which can't be compiled");
+	if (inst->num_templates != 1) FAIL("has %i templates, expected 1", inst->num_templates);
+}
+
+/*
+ *	The values bound are what the expansions would have written
+ *	into the query, without the escaping.
+ */
+static void check_params(rlm_sql_t *inst)
+{
+	compile_test_t const	t = { .fmt = "template_params" }, *test = &t;
+	char const		*fmt = "INSERT INTO radacct VALUES ('%{User-Name}', '%{upper:%{User-Name}}', "
+				       "'%{NAS-Identifier}', %{Acct-Session-Time}, %{%{Acct-Input-Octets}:-0}, "
+				       "%{%{Acct-Output-Octets}:-NULL}, '%{Acct-Status-Type}', "
+				       "%{integer:Acct-Status-Type}, '100%%')";
+	rlm_sql_template_t const *tmpl;
+	REQUEST			*request;
+	value_box_t const	**params;
+	int			i;
+	struct {
+		PW_TYPE		type;
+		char const	*str;
+		uint64_t	integer;
+	} const expect[] = {
+		{ PW_TYPE_STRING, "bob's", 0 },
+		{ PW_TYPE_STRING, "BOB'S", 0 },
+		{ PW_TYPE_STRING, "", 0 },
+		{ PW_TYPE_INTEGER64, NULL, 3600 },
+		{ PW_TYPE_INTEGER64, NULL, 0 },
+		{ PW_TYPE_INVALID, NULL, 0 },
+		{ PW_TYPE_STRING, "Stop", 0 },
+		{ PW_TYPE_INTEGER64, NULL, 2 },
+		{ PW_TYPE_STRING, "100%", 0 },
+	};
+
+	if (rlm_sql_template_add(inst, fmt) != 1) {
+		FAIL("failed adding the query: %s", fr_strerror());
+		return;
+	}
+	tmpl = rlm_sql_template_find(inst, fmt);
+	if (!tmpl || (tmpl->num_params != (int) (sizeof(expect) / sizeof(*expect)))) {
+		FAIL("compiled into the wrong number of params");
+		return;
+	}
+
+	MEM(request = request_alloc(NULL));
+	MEM(request->packet = fr_radius_alloc(request, false));
+	fr_pair_make(request->packet, &request->packet->vps, "User-Name", "bob's", T_OP_EQ);
+	fr_pair_make(request->packet, &request->packet->vps, "Acct-Session-Time", "3600", T_OP_EQ);
+	fr_pair_make(request->packet, &request->packet->vps, "Acct-Status-Type", "Stop", T_OP_EQ);
+
+	if (rlm_sql_template_params(request, &params, request, tmpl) < 0) {
+		FAIL("failed getting params: %s", fr_strerror());
+		talloc_free(request);
+		return;
+	}
+
+	for (i = 0; i < tmpl->num_params; i++) {
+		if (expect[i].type == PW_TYPE_INVALID) {
+			if (params[i]) FAIL("param %i should be NULL", i);
+			continue;
+		}
+
+		if (!params[i] || (params[i]->type != expect[i].type)) {
+			FAIL("param %i has the wrong type", i);
+			continue;
+		}
+
+		if (expect[i].type == PW_TYPE_STRING) {
+			if ((params[i]->length != strlen(expect[i].str)) ||
+			    (strcmp(params[i]->datum.strvalue, expect[i].str) != 0)) {
+				FAIL("param %i is \"%s\", expected \"%s\"", i, params[i]->datum.strvalue, expect[i].str);
+			}
+			continue;
+		}
+
+		if (params[i]->datum.integer64 != expect[i].integer) {
+			FAIL("param %i is %" PRIu64 ", expected %" PRIu64, i,
+			     params[i]->datum.integer64, expect[i].integer);
+		}
+	}
+
+	talloc_free(request);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: sql_prepare_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	rlm_sql_driver_t	driver = { .name = "test" };
+	rlm_sql_t		*inst;
+
+	while ((c = getopt(argc, argv, "D:h")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fprintf(stderr, "Failed reading dictionaries: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if (xlat_register(NULL, "upper", xlat_upper, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN) < 0) {
+		fprintf(stderr, "Failed registering xlat\n");
+		exit(1);
+	}
+
+	MEM(inst = talloc_zero(autofree, rlm_sql_t));
+	inst->name = "test";
+	inst->driver = &driver;
+
+	check_compile(inst, compile_tests, sizeof(compile_tests) / sizeof(*compile_tests));
+	check_add(inst);
+	check_params(inst);
+
+	driver.flags = RLM_SQL_FLAGS_NUMBERED_PARAMS;
+	check_compile(inst, compile_tests_numbered, sizeof(compile_tests_numbered) / sizeof(*compile_tests_numbered));
+
+	xlat_free();
+	talloc_free(autofree);
+
+	if (errors) {
+		fprintf(stderr, "%d errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET := sql_prepare_test
+
+SOURCES := sql_prepare_test.c
+
+TGT_PREREQS	:= rlm_sql.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
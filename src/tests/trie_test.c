@@ -0,0 +1,248 @@
+/*
+ * trie_test.c	Tests and benchmarks for longest prefix matching.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define USEC (1000000)
+
+/*
+ *	The old client lookup: one tree per prefix length, probed
+ *	from the longest prefix to the shortest.
+ */
+typedef struct prefix_t {
+	uint32_t	addr;
+	int		prefix;
+} prefix_t;
+
+static int		debug_lvl = 0;
+
+static int prefix_cmp(void const *one, void const *two)
+{
+	prefix_t const *a = one;
+	prefix_t const *b = two;
+
+	if (a->addr < b->addr) return -1;
+	if (a->addr > b->addr) return +1;
+
+	return 0;
+}
+
+static uint32_t prefix_mask(uint32_t addr, int prefix)
+{
+	if (!prefix) return 0;
+
+	return addr & (0xffffffff << (32 - prefix));
+}
+
+static prefix_t *trees_find(rbtree_t **trees, uint32_t addr)
+{
+	int		i;
+	prefix_t	my_prefix;
+
+	for (i = 32; i >= 0; i--) {
+		prefix_t *found;
+
+		if (!trees[i]) continue;
+
+		my_prefix.addr = prefix_mask(addr, i);
+		found = rbtree_finddata(trees[i], &my_prefix);
+		if (found) return found;
+	}
+
+	return NULL;
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: trie_test [OPTS]\n");
+	fprintf(stderr, "  -n <clients>           Number of prefixes to insert.\n");
+	fprintf(stderr, "  -l <lookups>           Number of addresses to look up.\n");
+	fprintf(stderr, "  -s <seed>              Random seed.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i, num_clients = 50000, num_lookups = 1000000;
+	int		rcode = 0, matched = 0;
+	unsigned int	seed = 0x5eed;
+	prefix_t	*prefixes;
+	uint32_t	*addrs;
+	void		**trie_result, **tree_result;
+	rbtree_t	*trees[33];
+	fr_trie_t	*ft;
+	struct timeval	start, end;
+	uint64_t	trie_usec, tree_usec;
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hl:n:s:x")) != EOF) switch (c) {
+		case 'l':
+			num_lookups = atoi(optarg);
+			break;
+
+		case 'n':
+			num_clients = atoi(optarg);
+			break;
+
+		case 's':
+			seed = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if ((num_clients <= 0) || (num_lookups <= 0)) usage();
+
+	srandom(seed);
+
+	prefixes = talloc_array(autofree, prefix_t, num_clients);
+	addrs = talloc_array(autofree, uint32_t, num_lookups);
+	trie_result = talloc_array(autofree, void *, num_lookups);
+	tree_result = talloc_array(autofree, void *, num_lookups);
+
+	memset(trees, 0, sizeof(trees));
+	ft = fr_trie_create(autofree, 32);
+
+	/*
+	 *	Mostly /32 hosts, with a spread of networks from /8 up.
+	 */
+	for (i = 0; i < num_clients; i++) {
+		prefix_t	*p = &prefixes[i];
+		uint8_t		key[4];
+
+		p->prefix = (random() & 1) ? 32 : 8 + (random() % 25);
+		p->addr = prefix_mask(((uint32_t) random() << 1) ^ (uint32_t) random(), p->prefix);
+
+		if (!trees[p->prefix]) trees[p->prefix] = rbtree_create(autofree, prefix_cmp, NULL, 0);
+		if (!rbtree_insert(trees[p->prefix], p)) continue;	/* duplicate */
+
+		key[0] = p->addr >> 24;
+		key[1] = p->addr >> 16;
+		key[2] = p->addr >> 8;
+		key[3] = p->addr;
+
+		if (fr_trie_insert(ft, key, p->prefix, p) < 0) {
+			fprintf(stderr, "Failed inserting prefix %d: %s\n", i, fr_strerror());
+			exit(1);
+		}
+	}
+
+	/*
+	 *	Half of the lookups are for addresses inside a
+	 *	configured prefix, the rest are random.
+	 */
+	for (i = 0; i < num_lookups; i++) {
+		if (random() & 1) {
+			prefix_t *p = &prefixes[random() % num_clients];
+
+			addrs[i] = p->addr | (((uint32_t) random()) & ~prefix_mask(0xffffffff, p->prefix));
+		} else {
+			addrs[i] = ((uint32_t) random() << 1) ^ (uint32_t) random();
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; i++) {
+		uint8_t key[4];
+
+		key[0] = addrs[i] >> 24;
+		key[1] = addrs[i] >> 16;
+		key[2] = addrs[i] >> 8;
+		key[3] = addrs[i];
+
+		trie_result[i] = fr_trie_match(ft, key, 32, NULL, NULL);
+	}
+	gettimeofday(&end, NULL);
+	trie_usec = ((end.tv_sec - start.tv_sec) * USEC) + (end.tv_usec - start.tv_usec);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; i++) {
+		tree_result[i] = trees_find(trees, addrs[i]);
+	}
+	gettimeofday(&end, NULL);
+	tree_usec = ((end.tv_sec - start.tv_sec) * USEC) + (end.tv_usec - start.tv_usec);
+
+	/*
+	 *	Both methods must agree on every lookup.
+	 */
+	for (i = 0; i < num_lookups; i++) {
+		if (trie_result[i] != tree_result[i]) {
+			fprintf(stderr, "Lookup %d mismatch for %08x: trie %p, trees %p\n",
+				i, addrs[i], trie_result[i], tree_result[i]);
+			rcode = 1;
+			break;
+		}
+		if (trie_result[i]) matched++;
+	}
+
+	printf("%u prefixes, %d lookups, %d matched\n", fr_trie_num_elements(ft), num_lookups, matched);
+	printf("trie:  %" PRIu64 " usec, %.0f lookups/s\n", trie_usec,
+	       trie_usec ? (double) num_lookups * USEC / trie_usec : 0);
+	printf("trees: %" PRIu64 " usec, %.0f lookups/s\n", tree_usec,
+	       tree_usec ? (double) num_lookups * USEC / tree_usec : 0);
+
+	/*
+	 *	Removal only clears the prefix, lookups then fall back
+	 *	to the next shortest one.
+	 */
+	for (i = 0; i < num_clients; i++) {
+		prefix_t	*p = &prefixes[i];
+		uint8_t		key[4];
+
+		key[0] = p->addr >> 24;
+		key[1] = p->addr >> 16;
+		key[2] = p->addr >> 8;
+		key[3] = p->addr;
+
+		if (fr_trie_find(ft, key, p->prefix) != p) continue;	/* duplicate */
+
+		if (fr_trie_remove(ft, key, p->prefix) != p) {
+			fprintf(stderr, "Failed removing prefix %d\n", i);
+			rcode = 1;
+			break;
+		}
+	}
+
+	if (fr_trie_num_elements(ft) != 0) {
+		fprintf(stderr, "Trie still has %u prefixes after removal\n", fr_trie_num_elements(ft));
+		rcode = 1;
+	}
+
+	talloc_free(autofree);
+
+	return rcode;
+}
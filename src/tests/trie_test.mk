@@ -0,0 +1,7 @@
+TARGET := trie_test
+
+SOURCES := trie_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
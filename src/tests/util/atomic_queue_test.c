@@ -32,14 +32,115 @@ RCSID("$Id$")
 #	include <getopt.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #define OFFSET	(1024)
+#define USEC	(1000000)
+#define MAX_BATCH (256)
 
 static int		debug_lvl = 0;
 
+#ifdef HAVE_PTHREAD_H
+static fr_atomic_queue_t *bench_aq;
+static int		bench_producers;
+static int		bench_messages;
+
+/*
+ *	Each producer pushes "bench_messages" messages.  The value
+ *	encodes the producer and the message number, so that the
+ *	consumer can check ordering.  It has to fit in a pointer, and
+ *	never be zero.
+ */
+#define BENCH_VALUE(_id, _num)	((void *) (uintptr_t) ((((uintptr_t) (_num)) * bench_producers) + (_id) + 1))
+
+static void *bench_producer(void *arg)
+{
+	int		i;
+	int		id = (int) (intptr_t) arg;
+
+	for (i = 0; i < bench_messages; i++) {
+		while (!fr_atomic_queue_push(bench_aq, BENCH_VALUE(id, i))) sched_yield();
+	}
+
+	return NULL;
+}
+
+/** Run "producers" threads into one consumer, and print messages/s
+ *
+ */
+static void bench_fan_in(TALLOC_CTX *ctx, int size, int producers, int messages, int batch)
+{
+	int		i, num, received = 0, total = producers * messages;
+	uintptr_t	*next;
+	void		*data[MAX_BATCH];
+	pthread_t	*ids;
+	struct timeval	start, end;
+	uint64_t	usec;
+
+	bench_aq = fr_atomic_queue_create(ctx, size);
+	bench_producers = producers;
+	bench_messages = messages;
+
+	next = talloc_zero_array(ctx, uintptr_t, producers);
+	ids = talloc_array(ctx, pthread_t, producers);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < producers; i++) {
+		(void) pthread_create(&ids[i], NULL, bench_producer, (void *) (intptr_t) i);
+	}
+
+	while (received < total) {
+		if (batch == 1) {
+			num = fr_atomic_queue_pop(bench_aq, &data[0]);
+		} else {
+			num = fr_atomic_queue_pop_n(bench_aq, data, batch);
+		}
+
+		if (!num) {
+			sched_yield();
+			continue;
+		}
+
+		for (i = 0; i < num; i++) {
+			uintptr_t	val = (uintptr_t) data[i] - 1;
+			int		id = val % producers;
+
+			/*
+			 *	Messages from one producer must arrive in order.
+			 */
+			if ((val / producers) != next[id]) {
+				fprintf(stderr, "Producer %d message out of order\n", id);
+				exit(1);
+			}
+			next[id]++;
+		}
+		received += num;
+	}
+
+	for (i = 0; i < producers; i++) (void) pthread_join(ids[i], NULL);
+
+	gettimeofday(&end, NULL);
+	usec = ((end.tv_sec - start.tv_sec) * USEC) + (end.tv_usec - start.tv_usec);
+
+	printf("%d producers, batch %3d: %10.0f messages/s\n", producers, batch,
+	       usec ? ((double) total * USEC) / usec : 0);
+
+	talloc_free(ids);
+	talloc_free(next);
+	talloc_free(bench_aq);
+}
+#endif
 
 static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: atomic_queue_test [OPTS]\n");
+	fprintf(stderr, "  -b <batch>             Number of pointers the benchmark pops at once.\n");
+	fprintf(stderr, "  -n <messages>          Benchmark with messages per producer.\n");
+	fprintf(stderr, "  -p <producers>         Number of producers for the benchmark.\n");
 	fprintf(stderr, "  -s size                set queue size.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
@@ -49,7 +150,8 @@ static void NEVER_RETURNS usage(void)
 int main(int argc, char *argv[])
 {
 	int c, i, rcode = 0;
-	int size;
+	int size, num, batch = 16, messages = 0, producers = 4;
+	void *batch_data[MAX_BATCH];
 	intptr_t val;
 	void *data;
 	fr_atomic_queue_t *aq;
@@ -57,7 +159,19 @@ int main(int argc, char *argv[])
 
 	size = 4;
 
-	while ((c = getopt(argc, argv, "hs:tx")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "b:hn:p:s:tx")) != EOF) switch (c) {
+		case 'b':
+			batch = atoi(optarg);
+			break;
+
+		case 'n':
+			messages = atoi(optarg);
+			break;
+
+		case 'p':
+			producers = atoi(optarg);
+			break;
+
 		case 's':
 			size = atoi(optarg);
 			break;
@@ -75,6 +189,8 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
+	if ((size <= 0) || (batch <= 0) || (batch > MAX_BATCH) || (producers <= 0) || (messages < 0)) usage();
+
 	aq = fr_atomic_queue_create(autofree, size);
 
 #ifndef NDEBUG
@@ -164,6 +280,57 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	/*
+	 *	Fill the queue again.
+	 */
+	for (i = 0; i < size; i++) {
+		val = i + OFFSET;
+		data = (void *) val;
+
+		if (!fr_atomic_queue_push(aq, data)) {
+			fprintf(stderr, "Failed pushing at %d\n", i);
+			exit(1);
+		}
+	}
+
+	/*
+	 *	And pop them all in batches, checking the order.
+	 */
+	for (i = 0; i < size; i += num) {
+		int j;
+
+		num = fr_atomic_queue_pop_n(aq, batch_data, batch);
+		if ((num <= 0) || (num > batch)) {
+			fprintf(stderr, "Failed batch popping at %d\n", i);
+			exit(1);
+		}
+
+		for (j = 0; j < num; j++) {
+			val = (intptr_t) batch_data[j];
+			if (val != (i + j + OFFSET)) {
+				fprintf(stderr, "Batch pop expected %d, got %d\n",
+					i + j + OFFSET, (int) val);
+				exit(1);
+			}
+		}
+	}
+
+	if (fr_atomic_queue_pop_n(aq, batch_data, batch) != 0) {
+		fprintf(stderr, "Batch popped an entry past the end of the queue.");
+		exit(1);
+	}
+
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Compare popping one pointer at a time with batches, for the
+	 *	same number of producers.
+	 */
+	if (messages) {
+		bench_fan_in(autofree, size, producers, messages, 1);
+		if (batch > 1) bench_fan_in(autofree, size, producers, messages, batch);
+	}
+#endif
+
 	talloc_free(autofree);
 
 	return rcode;
@@ -22,6 +22,7 @@
 
 RCSID("$Id$")
 
+#include <freeradius-devel/libradius.h>
 #include <freeradius-devel/util/channel.h>
 #include <freeradius-devel/rad_assert.h>
 
@@ -34,10 +35,12 @@ RCSID("$Id$")
 #endif
 
 #include <sys/event.h>
+#include <sys/time.h>
 
 #define MAX_MESSAGES		(2048)
 #define MAX_CONTROL_PLANE	(1024)
 #define MAX_KEVENTS		(10)
+#define USEC			(1000000)
 
 #define MPRINT1 if (debug_lvl) printf
 #define MPRINT2 if (debug_lvl > 1) printf
@@ -48,11 +51,16 @@ static fr_atomic_queue_t *aq_master, *aq_worker;
 static int		max_messages = 10;
 static int		max_control_plane = 0;
 static int		max_outstanding = 1;
+static bool		burst = false;
 static bool		touch_memory = false;
+static fr_cpu_set_t	cpus;
+static int		num_cpus = 0;
 
 static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: channel_test [OPTS]\n");
+	fprintf(stderr, "  -a <cpus>              Bind the master and worker to the first two CPUs in the list.\n");
+	fprintf(stderr, "  -b                     Send messages in bursts, waiting for all the replies.\n");
 	fprintf(stderr, "  -c <control-plane>     Size of the control plane queue.\n");
 	fprintf(stderr, "  -m <messages>	  Send number of messages.\n");
 	fprintf(stderr, "  -o <outstanding>       Keep number of messages outstanding.\n");
@@ -75,6 +83,15 @@ static void *channel_master(void *arg)
 	fr_channel_event_t ce;
 	struct kevent events[MAX_KEVENTS];
 
+	/*
+	 *	Bind before allocating the message set, so that it's
+	 *	on our NUMA node.
+	 */
+	if (num_cpus && (fr_cpu_pin(fr_cpu_set_nth(&cpus, 0)) < 0)) {
+		fprintf(stderr, "channel_test: %s\n", fr_strerror());
+		exit(1);
+	}
+
 	ctx = talloc_init("channel_master");
 	if (!ctx) _exit(1);
 
@@ -129,6 +146,12 @@ static void *channel_master(void *arg)
 			goto check_close;
 		}
 
+		/*
+		 *	In burst mode, only send when the worker has
+		 *	replied to everything.
+		 */
+		if (burst && num_outstanding) goto check_close;
+
 		num_to_send = max_outstanding - num_outstanding;
 		if ((num_messages + num_to_send) > max_messages) {
 			num_to_send = max_messages - num_messages;
@@ -291,6 +314,11 @@ static void *channel_worker(void *arg)
 	fr_channel_event_t ce;
 	struct kevent events[MAX_KEVENTS];
 
+	if (num_cpus && (fr_cpu_pin(fr_cpu_set_nth(&cpus, 1)) < 0)) {
+		fprintf(stderr, "channel_test: %s\n", fr_strerror());
+		exit(1);
+	}
+
 	ctx = talloc_init("channel_worker");
 	if (!ctx) _exit(1);
 
@@ -309,6 +337,8 @@ static void *channel_worker(void *arg)
 
 		MPRINT1("\tWorker waiting on events.\n");
 
+		(void) fr_channel_worker_sleeping(channel);
+
 		num_events = kevent(kq_worker, NULL, 0, events, MAX_KEVENTS, NULL);
 		MPRINT1("\tWorker kevent returned %d events\n", num_events);
 
@@ -460,10 +490,24 @@ int main(int argc, char *argv[])
 	TALLOC_CTX	*autofree = talloc_init("main");
 	pthread_attr_t	attr;
 	pthread_t	master_id, worker_id;
+	struct timeval	start, end;
+	uint64_t	usec;
 
 	fr_time_start();
 
-	while ((c = getopt(argc, argv, "c:hm:o:tx")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "a:bc:hm:o:tx")) != EOF) switch (c) {
+		case 'a':
+			num_cpus = fr_cpu_set_parse(&cpus, optarg);
+			if (num_cpus < 0) {
+				fprintf(stderr, "channel_test: %s\n", fr_strerror());
+				exit(1);
+			}
+			break;
+
+		case 'b':
+			burst = true;
+			break;
+
 		case 'x':
 			debug_lvl++;
 			break;
@@ -527,15 +571,29 @@ int main(int argc, char *argv[])
 	(void) pthread_attr_init(&attr);
 	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
+	gettimeofday(&start, NULL);
+
 	(void) pthread_create(&master_id, &attr, channel_master, channel);
 	(void) pthread_create(&worker_id, &attr, channel_worker, channel);
 
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
 
+	gettimeofday(&end, NULL);
+	usec = ((end.tv_sec - start.tv_sec) * USEC) + (end.tv_usec - start.tv_usec);
+
 	close(kq_master);
 	close(kq_worker);
 
+	printf("%d messages, %d %s: %.0f messages/s\n", max_messages, max_outstanding,
+	       burst ? "per burst" : "outstanding", usec ? ((double) max_messages * USEC) / usec : 0);
+
+	if (num_cpus) {
+		printf("master on CPU %d (node %d), worker on CPU %d (node %d)\n",
+		       fr_cpu_set_nth(&cpus, 0), fr_cpu_node(fr_cpu_set_nth(&cpus, 0)),
+		       fr_cpu_set_nth(&cpus, 1), fr_cpu_node(fr_cpu_set_nth(&cpus, 1)));
+	}
+
 	fr_channel_debug(channel, stdout);
 
 	talloc_free(autofree);
@@ -78,7 +78,7 @@ static void  alloc_blocks(fr_message_set_t *ms, uint32_t *seed, UNUSED int *star
 
 		index = (*end + i) & (MY_ARRAY_SIZE - 1);
 
-		hash = fr_hash_update(seed_string, seed_string_len, *seed);
+		hash = fr_hash_fnv_update(seed_string, seed_string_len, *seed);
 		*seed = hash;
 
 		hash &= allocation_mask;
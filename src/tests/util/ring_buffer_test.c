@@ -54,7 +54,7 @@ static void  alloc_blocks(fr_ring_buffer_t *rb, uint32_t *seed, UNUSED int *star
 
 		index = (*end + i) & (ARRAY_SIZE - 1);
 
-		hash = fr_hash_update(seed_string, seed_string_len, *seed);
+		hash = fr_hash_fnv_update(seed_string, seed_string_len, *seed);
 		*seed = hash;
 
 		hash &= 0x3ff;
@@ -0,0 +1,258 @@
+/*
+ * udp_mmsg_test.c	Benchmark batched UDP reads over loopback
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/udp.h>
+#include <freeradius-devel/rad_assert.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+#define PACKET_SIZE	(64)
+
+static int		debug_lvl = 0;
+static int		max_packets = 200000;
+static int		burst = 32;
+
+/*
+ *	The server side, which is what we're measuring.  It reads
+ *	packets as the UDP listeners do, and sends one reply for each
+ *	packet.
+ */
+static int server_read(int fd, fr_ipaddr_t const *ipaddr, uint16_t port, int batch, int *syscalls)
+{
+	int		i, num;
+	udp_mmsg_t	packets[UDP_MMSG_MAX];
+	uint8_t		buffer[UDP_MMSG_MAX][MAX_PACKET_LEN];
+
+	/*
+	 *	The old way, one system call for every packet.
+	 */
+	if (batch == 1) {
+		ssize_t data_len;
+
+		packets[0].data = buffer[0];
+		data_len = udp_recv(fd, buffer[0], sizeof(buffer[0]), 0,
+				    &packets[0].src_ipaddr, &packets[0].src_port,
+				    &packets[0].dst_ipaddr, &packets[0].dst_port,
+				    &packets[0].if_index, &packets[0].when);
+		(*syscalls) += 2;	/* getsockname() + recvmsg() */
+		if (data_len <= 0) return data_len;
+
+		packets[0].data_len = data_len;
+		num = 1;
+
+	} else {
+		for (i = 0; i < batch; i++) {
+			packets[i].data = buffer[i];
+			packets[i].data_len = sizeof(buffer[i]);
+		}
+
+		num = udp_recv_mmsg(fd, packets, batch, 0, ipaddr, port);
+		(*syscalls)++;
+		if (num <= 0) return num;
+	}
+
+	for (i = 0; i < num; i++) {
+		rad_assert(packets[i].data_len == PACKET_SIZE);
+		rad_assert(fr_ipaddr_cmp(&packets[i].dst_ipaddr, ipaddr) == 0);
+		rad_assert(packets[i].dst_port == port);
+
+		if (udp_send(fd, packets[i].data, packets[i].data_len, 0,
+			     &packets[i].dst_ipaddr, packets[i].dst_port, packets[i].if_index,
+			     &packets[i].src_ipaddr, packets[i].src_port) < 0) {
+			fprintf(stderr, "Failed sending reply: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+		(*syscalls)++;
+	}
+
+	return num;
+}
+
+static int socket_open(fr_ipaddr_t *ipaddr, uint16_t *port)
+{
+	int			fd;
+	struct sockaddr_in	sin;
+	socklen_t		sin_len = sizeof(sin);
+	struct timeval		tv = { 1, 0 };
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed opening socket: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0) {
+		fprintf(stderr, "Failed binding socket: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	/*
+	 *	Don't hang forever if the kernel drops a packet.
+	 */
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	(void) getsockname(fd, (struct sockaddr *) &sin, &sin_len);
+	fr_ipaddr_from_sockaddr((struct sockaddr_storage *) &sin, sin_len, ipaddr, port);
+
+	return fd;
+}
+
+static void run(int batch)
+{
+	int		i, server_fd, client_fd;
+	int		num_sent = 0, num_received = 0, syscalls = 0;
+	fr_ipaddr_t	server_ipaddr, client_ipaddr;
+	uint16_t	server_port, client_port;
+	uint8_t		buffer[UDP_MMSG_MAX][PACKET_SIZE];
+	struct timeval	start, end;
+	double		elapsed;
+
+	server_fd = socket_open(&server_ipaddr, &server_port);
+	client_fd = socket_open(&client_ipaddr, &client_port);
+
+	memset(buffer, 0, sizeof(buffer));
+	for (i = 0; i < burst; i++) {
+		buffer[i][0] = PW_CODE_ACCESS_REQUEST;
+		buffer[i][1] = i;
+		buffer[i][3] = PACKET_SIZE;
+	}
+
+	gettimeofday(&start, NULL);
+
+	while (num_received < max_packets) {
+		int got = 0;
+
+		/*
+		 *	The client sends a burst of packets.  These
+		 *	system calls aren't counted.
+		 */
+		for (i = 0; i < burst; i++) {
+			if (udp_send(client_fd, buffer[i], PACKET_SIZE, 0,
+				     &client_ipaddr, client_port, 0,
+				     &server_ipaddr, server_port) < 0) {
+				fprintf(stderr, "Failed sending packets: %s\n", fr_syserror(errno));
+				exit(1);
+			}
+		}
+		num_sent += burst;
+
+		/*
+		 *	One event loop iteration per read.
+		 */
+		while (got < burst) {
+			int rcode;
+
+			rcode = server_read(server_fd, &server_ipaddr, server_port, batch, &syscalls);
+			if (rcode <= 0) {
+				fprintf(stderr, "Lost packets after %d\n", num_sent);
+				exit(1);
+			}
+			got += rcode;
+		}
+
+		/*
+		 *	And the client reads all of the replies.
+		 */
+		got = 0;
+		while (got < burst) {
+			udp_mmsg_t	in[UDP_MMSG_MAX];
+			uint8_t		in_buffer[UDP_MMSG_MAX][PACKET_SIZE];
+			int		rcode;
+
+			for (i = 0; i < burst; i++) {
+				in[i].data = in_buffer[i];
+				in[i].data_len = sizeof(in_buffer[i]);
+			}
+
+			rcode = udp_recv_mmsg(client_fd, in, burst - got, 0, &client_ipaddr, client_port);
+			if (rcode <= 0) {
+				fprintf(stderr, "Lost replies after %d\n", num_received);
+				exit(1);
+			}
+			got += rcode;
+		}
+		num_received += burst;
+
+		MPRINT1("Round trip of %d packets, %d received\n", burst, num_received);
+	}
+
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("batch %2d: %d packets in %.3fs, %.0f packets/s, %.3f server syscalls/packet\n",
+	       batch, num_received, elapsed, num_received / elapsed, ((double) syscalls) / num_received);
+
+	close(server_fd);
+	close(client_fd);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: udp_mmsg_test [OPTS]\n");
+	fprintf(stderr, "  -b <burst>             Packets sent by the client at a time.\n");
+	fprintf(stderr, "  -n <packets>           Number of packets to send.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+
+	while ((c = getopt(argc, argv, "b:hn:x")) != EOF) switch (c) {
+		case 'b':
+			burst = atoi(optarg);
+			if ((burst <= 0) || (burst > UDP_MMSG_MAX)) usage();
+			break;
+
+		case 'n':
+			max_packets = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	run(1);
+	run(burst);
+
+	return 0;
+}
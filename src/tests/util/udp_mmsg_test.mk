@@ -0,0 +1,6 @@
+TARGET := udp_mmsg_test
+
+SOURCES		:= udp_mmsg_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
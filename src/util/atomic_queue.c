@@ -44,6 +44,7 @@ RCSID("$Id$")
 #define atomic_int64_t _Atomic(int64_t)
 
 #define cas_incr(_store, _var)    atomic_compare_exchange_strong_explicit(&_store, &_var, _var + 1, memory_order_release, memory_order_relaxed)
+#define cas_add(_store, _var, _n) atomic_compare_exchange_strong_explicit(&_store, &_var, _var + _n, memory_order_release, memory_order_relaxed)
 #define load(_var)           atomic_load_explicit(&_var, memory_order_relaxed)
 #define aquire(_var)         atomic_load_explicit(&_var, memory_order_acquire)
 #define store(_store, _var)  atomic_store_explicit(&_store, _var, memory_order_release);
@@ -241,6 +242,60 @@ bool fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data)
 	return true;
 }
 
+/** Pop multiple pointers from the atomic queue
+ *
+ *  Claims a run of full entries with a single CAS on the tail.
+ *
+ * @param[in] aq the queue
+ * @param[out] data where to write the pointers
+ * @param[in] num the maximum number of pointers to pop
+ * @return
+ *	- the number of pointers popped.
+ *	- 0 on queue empty
+ */
+int fr_atomic_queue_pop_n(fr_atomic_queue_t *aq, void **data, int num)
+{
+	int i, count;
+	int64_t tail;
+
+	if (!data || (num <= 0)) return 0;
+
+	tail = load(aq->tail);
+
+	for (;;) {
+		int64_t seq, diff = 0;
+
+		for (count = 0; count < num; count++) {
+			seq = aquire(aq->entry[ (tail + count) % aq->size ].seq);
+			diff = (seq - (tail + count + 1));
+			if (diff != 0) break;
+		}
+
+		if (count == 0) {
+			if (diff < 0) return 0;
+
+			tail = load(aq->tail);
+			continue;
+		}
+
+		if (cas_add(aq->tail, tail, count)) break;
+	}
+
+	/*
+	 *	Copy each pointer to the caller BEFORE releasing the
+	 *	queue entry.
+	 */
+	for (i = 0; i < count; i++) {
+		fr_atomic_queue_entry_t *entry;
+
+		entry = &aq->entry[ (tail + i) % aq->size ];
+		data[i] = entry->data;
+		store(entry->seq, tail + i + aq->size);
+	}
+
+	return count;
+}
+
 #ifndef NDEBUG
 
 #if 0
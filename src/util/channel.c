@@ -28,6 +28,12 @@ RCSID("$Id$")
 #include <freeradius-devel/util/control.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 /*
  *	Debugging, mainly for channel_test
  */
@@ -59,6 +65,12 @@ RCSID("$Id$")
  */
 #define ATOMIC_QUEUE_SIZE (1024)
 
+/**
+ *	The maximum number of messages we pop from an atomic queue at
+ *	once.  They are then handed to the caller one by one.
+ */
+#define CHANNEL_BATCH (16)
+
 typedef enum fr_channel_signal_t {
 	FR_CHANNEL_SIGNAL_ERROR			= FR_CHANNEL_ERROR,
 	FR_CHANNEL_SIGNAL_DATA_TO_WORKER	= FR_CHANNEL_DATA_READY_WORKER,
@@ -103,8 +115,15 @@ typedef struct fr_channel_end_t {
 
 	size_t			num_kevents;	//!< number of times we've looked at kevents
 
+	size_t			num_coalesced;	//!< number of signals we skipped, because the other end will
+						//!< be signaled when we service its DATA_DONE.
+
 	uint64_t		sequence;	//!< sequence number for this channel.
 	uint64_t		ack;		//!< sequence number of the other end
+	uint64_t		their_ack;	//!< highest of our sequence numbers which the other end has read
+	uint64_t		their_signal_ack; //!< highest ACK we've seen in a DATA_DONE or SLEEPING signal
+
+	bool			done_failed;	//!< we couldn't send DATA_DONE, and must try again
 
 	uint64_t		sequence_at_last_signal; //!< when we last signaled
 
@@ -115,6 +134,10 @@ typedef struct fr_channel_end_t {
 	fr_time_t		last_sent_signal; //!< the last time when we signaled the other end
 
 	fr_atomic_queue_t	*aq;		//!< the queue of messages - visible only to this channel
+
+	int			batch_used;	//!< number of messages in the batch
+	int			batch_next;	//!< next message in the batch to return
+	void			*batch[CHANNEL_BATCH]; //!< messages popped from the other end's queue
 } fr_channel_end_t;
 
 /**
@@ -126,6 +149,9 @@ typedef struct fr_channel_t {
 
 	bool			active;		//!< is this channel active?
 
+	atomic_uint_fast64_t	done_ack;	//!< ACK in the last DATA_DONE the worker managed to queue.
+						//!< Written by the worker, read by the master.
+
 	fr_channel_end_t	end[2];		//!< two ends of the channel
 } fr_channel_t;
 
@@ -150,6 +176,8 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, int kq_master, fr_atomic_queue_
 	ch = talloc_zero(ctx, fr_channel_t);
 	if (!ch) return NULL;
 
+	atomic_init(&ch->done_ack, 0);
+
 	ch->end[TO_WORKER].aq = fr_atomic_queue_create(ch, ATOMIC_QUEUE_SIZE);
 	if (!ch->end[TO_WORKER].aq) {
 		talloc_free(ch);
@@ -232,6 +260,29 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	return fr_control_message_send(end->control, &cc, sizeof(cc));
 }
 
+/** Pop a message from the other end's queue
+ *
+ *  Messages are popped in batches, which means one CAS for many
+ *  messages.  The batch belongs to the reading end, so only the
+ *  reading thread ever touches it.
+ *
+ * @param[in] end the reading end of the channel
+ * @param[in] aq the queue to read from
+ * @return
+ *	- NULL on no data to receive
+ *	- the message on success
+ */
+static fr_channel_data_t *fr_channel_pop(fr_channel_end_t *end, fr_atomic_queue_t *aq)
+{
+	if (end->batch_next == end->batch_used) {
+		end->batch_next = 0;
+		end->batch_used = fr_atomic_queue_pop_n(aq, end->batch, CHANNEL_BATCH);
+		if (!end->batch_used) return NULL;
+	}
+
+	return end->batch[end->batch_next++];
+}
+
 #define IALPHA (8)
 #define RTT(_old, _new) ((_old + ((IALPHA - 1) * _new)) / IALPHA)
 
@@ -308,9 +359,32 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_
 		}
 	}
 
+	/*
+	 *	The worker has replied to every message we sent
+	 *	before this one.  After its last reply, it either
+	 *	read this message, or it sent us DATA_DONE with an
+	 *	ACK of their_ack.
+	 *
+	 *	If we haven't serviced that DATA_DONE yet, then when
+	 *	we do, its ACK will be behind our sequence, and
+	 *	fr_channel_service_aq() will signal the worker.  So
+	 *	we don't need to signal it now, and the rest of a
+	 *	burst of messages costs no signals.
+	 *
+	 *	That's only true if the DATA_DONE was queued.  The
+	 *	worker publishes its ACK once it has been, so if the
+	 *	send failed (or hasn't happened yet), we signal.
+	 */
+	if ((master->their_signal_ack < master->their_ack) &&
+	    (atomic_load_explicit(&ch->done_ack, memory_order_acquire) >= master->their_ack)) {
+		master->num_coalesced++;
+		return 0;
+	}
+
 	/*
 	 *	Tell the other end that there is new data ready.
 	 */
+	master->sequence_at_last_signal = sequence;
 	return fr_channel_data_ready(ch, when, master, FR_CHANNEL_SIGNAL_DATA_TO_WORKER);
 }
 
@@ -330,7 +404,8 @@ fr_channel_data_t *fr_channel_recv_reply(fr_channel_t *ch)
 	aq = ch->end[FROM_WORKER].aq;
 	master = &(ch->end[TO_WORKER]);
 
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return NULL;
+	cd = fr_channel_pop(master, aq);
+	if (!cd) return NULL;
 
 	/*
 	 *	We want an exponential moving average for round trip
@@ -357,6 +432,7 @@ fr_channel_data_t *fr_channel_recv_reply(fr_channel_t *ch)
 
 	master->num_outstanding--;
 	master->ack = cd->live.sequence;
+	if (cd->live.ack > master->their_ack) master->their_ack = cd->live.ack;
 
 	rad_assert(master->last_read_other <= cd->m.when);
 	master->last_read_other = cd->m.when;
@@ -381,7 +457,8 @@ fr_channel_data_t *fr_channel_recv_request(fr_channel_t *ch)
 	aq = ch->end[TO_WORKER].aq;
 	worker = &(ch->end[FROM_WORKER]);
 
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return NULL;
+	cd = fr_channel_pop(worker, aq);
+	if (!cd) return NULL;
 
 	rad_assert(cd->live.sequence > worker->ack);
 	rad_assert(cd->live.sequence >= worker->sequence); /* must have more requests than replies */
@@ -395,6 +472,33 @@ fr_channel_data_t *fr_channel_recv_request(fr_channel_t *ch)
 	return cd;
 }
 
+/** Tell the master that the worker has replied to everything
+ *
+ *  The master doesn't signal us for new messages while it expects
+ *  this signal, so we remember if it couldn't be sent, and try again
+ *  before sleeping.
+ *
+ * @param[in] ch the channel
+ * @param[in] when the current time
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int fr_channel_worker_done(fr_channel_t *ch, fr_time_t when)
+{
+	fr_channel_end_t *worker = &(ch->end[FROM_WORKER]);
+
+	if (fr_channel_data_ready(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_DONE_WORKER) < 0) {
+		worker->done_failed = true;
+		return -1;
+	}
+
+	worker->done_failed = false;
+	atomic_store_explicit(&ch->done_ack, worker->ack, memory_order_release);
+
+	return 0;
+}
+
 /** Send a reply message into the channel
  *
  *  The message should be initialized, other than "sequence" and "ack".
@@ -450,10 +554,12 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_da
 
 	/*
 	 *	No packets outstanding, we HAVE to signal the master
-	 *	thread.
+	 *	thread.  The reply has been queued, so if the signal
+	 *	can't be sent, fr_channel_worker_sleeping() sends it.
 	 */
 	if (worker->num_outstanding == 0) {
-		return fr_channel_data_ready(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_DONE_WORKER);
+		(void) fr_channel_worker_done(ch, when);
+		return 0;
 	}
 
 	MPRINT("\twhen - last_read_other = %zd - %zd = %zd\n", when, worker->last_read_other, when - worker->last_read_other);
@@ -514,9 +620,14 @@ int fr_channel_worker_sleeping(fr_channel_t *ch)
 	/*
 	 *	We don't have any outstanding requests to process for
 	 *	this channel, don't signal the network thread that
-	 *	we're sleeping.  It already knows.
+	 *	we're sleeping.  It already knows, unless we couldn't
+	 *	tell it.
 	 */
-	if (worker->num_outstanding == 0) return 0;
+	if (worker->num_outstanding == 0) {
+		if (!worker->done_failed) return 0;
+
+		return fr_channel_worker_done(ch, fr_time());
+	}
 
 	worker->num_signals++;
 
@@ -597,6 +708,9 @@ fr_channel_event_t fr_channel_service_aq(fr_atomic_queue_t *aq, fr_time_t when,
 	 *	to wake up.
 	 */
 	end = &ch->end[TO_WORKER];
+	if (ack > end->their_ack) end->their_ack = ack;
+	if (ack > end->their_signal_ack) end->their_signal_ack = ack;
+
 	if (ack == end->sequence) {
 		return ce;
 	}
@@ -616,6 +730,7 @@ fr_channel_event_t fr_channel_service_aq(fr_atomic_queue_t *aq, fr_time_t when,
 	 *	The worker hasn't seen our last few packets.  Signal
 	 *	that there is data ready.
 	 */
+	end->sequence_at_last_signal = end->sequence;
 	rcode = fr_channel_data_ready(ch, when, end, FR_CHANNEL_SIGNAL_DATA_TO_WORKER);
 	if (rcode < 0) return FR_CHANNEL_ERROR;
 
@@ -769,10 +884,21 @@ int fr_channel_signal_open(fr_channel_t *ch)
 
 void fr_channel_debug(fr_channel_t *ch, FILE *fp)
 {
+	uint64_t sequence;
+
 	fprintf(fp, "to worker\n");
 	fprintf(fp, "\tnum_signals sent = %zd\n", ch->end[TO_WORKER].num_signals);
 	fprintf(fp, "\tnum_signals re-sent = %zd\n", ch->end[TO_WORKER].num_resignals);
+	fprintf(fp, "\tnum_signals coalesced = %zd\n", ch->end[TO_WORKER].num_coalesced);
 	fprintf(fp, "\tnum_kevents checked = %zd\n", ch->end[TO_WORKER].num_kevents);
+
+	sequence = ch->end[TO_WORKER].sequence;
+	if (sequence) {
+		fprintf(fp, "\tsignals per message = %.3f\n",
+			(double) ch->end[TO_WORKER].num_signals / sequence);
+		fprintf(fp, "\tworker wakeups per message = %.3f\n",
+			(double) ch->end[TO_WORKER].num_kevents / sequence);
+	}
 	fprintf(fp, "\tsequence = %zd\n", ch->end[TO_WORKER].sequence);
 	fprintf(fp, "\tack = %zd\n", ch->end[TO_WORKER].ack);
 
@@ -132,6 +132,8 @@ struct fr_schedule_t {
 	fr_heap_t	*workers;		//!< heap of workers
 	fr_heap_t	*done_workers;		//!< heap of done workers
 
+	fr_worker_pool_t *pool;			//!< workers which steal from each other
+
 	uint32_t	num_transports;		//!< how many transport layers we have
 	fr_transport_t	**transports;		//!< array of active transports.
 };
@@ -217,6 +219,16 @@ static void *fr_schedule_worker_thread(void *arg)
 		goto fail;
 	}
 
+	/*
+	 *	Let idle workers steal from this one, and this one
+	 *	steal from them.
+	 */
+	if (fr_worker_pool_add(sc->pool, sw->worker) < 0) {
+		fr_worker_destroy(sw->worker);
+		talloc_free(ctx);
+		goto fail;
+	}
+
 	/*
 	 *	@todo make this a registry
 	 */
@@ -335,6 +347,12 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, int max_inputs, int max_worke
 		return NULL;
 	}
 
+	sc->pool = fr_worker_pool_create(sc, sc->max_workers);
+	if (!sc->pool) {
+		talloc_free(sc);
+		return NULL;
+	}
+
 	memset(&sc->semaphore, 0, sizeof(sc->semaphore));
 	if (sem_init(&sc->semaphore, 0, SEMAPHORE_LOCKED) != 0) {
 		talloc_free(sc);
@@ -363,7 +381,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, int max_inputs, int max_worke
 		sw->sc = sc;
 		sw->status = FR_WORKER_INITIALIZING;
 
-		rcode = pthread_create(&sw->pthread_id, &attr, fr_schedule_worker_thread, sc);
+		rcode = pthread_create(&sw->pthread_id, &attr, fr_schedule_worker_thread, sw);
 		if (rcode != 0) {
 			fr_schedule_destroy(sc);
 			return NULL;
@@ -35,6 +35,12 @@ RCSID("$Id$")
  *  need to store the packet type, as we assume that we have a
  *  unique tracking table per packet type.
  *
+ *  There must also be one table per socket, and client source
+ *  address / port.  Each socket belongs to exactly one receiver, so
+ *  retransmissions are always checked against the table which holds
+ *  the original, and the tables never need to be shared between
+ *  receivers.
+ *
  *  @todo add a "reply" heap / list, ordered by when we need to
  *  clean up the replies.  The heap should contain nothing more than
  *  the time and the ID of the packet which needs cleaning up.
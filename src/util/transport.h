@@ -137,6 +137,7 @@ struct rad_request {
 	fr_transport_process_t	process_async;
 	fr_time_tracking_t	tracking;
 	fr_channel_t		*channel;
+	struct fr_worker_t	*owner;			//!< worker which owns the channel
 	void			*packet_ctx;
 	fr_transport_t		*transport;
 };
@@ -57,6 +57,14 @@
  *  yeilded, it is placed onto the yielded list in the worker
  *  "tracking" data structure.
  *
+ *  Workers created by the scheduler are put into a pool.  When a
+ *  worker has nothing to do, it looks for a peer which has been
+ *  stuck on one request for a while, and steals the highest
+ *  priority message from that peer's "to_decode" heap.  The thief
+ *  decodes and runs the request, and sends the reply through the
+ *  peer's channel.  The heaps and the worker side of the channels
+ *  are protected by a per-worker mutex for this reason.
+ *
  * @copyright 2016 Alan DeKok <aland@freeradius.org>
  */
 RCSID("$Id$")
@@ -67,6 +75,33 @@ RCSID("$Id$")
 #include <freeradius-devel/util/message.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#include <pthread.h>
+
+#define load(_var)           atomic_load_explicit(&(_var), memory_order_relaxed)
+#define store(_store, _var)  atomic_store_explicit(&(_store), _var, memory_order_relaxed)
+
+/**
+ *	How long a peer must have been running one request, and a
+ *	message must have been waiting, before we steal it.  Below
+ *	this, the peer is making progress, and it's better for the
+ *	message to stay where its data is already in cache.
+ */
+#define STEAL_DELAY (NANOSEC / 1000)
+
+/**
+ *	How often an idle worker wakes up to look for work to steal,
+ *	while at least one of its peers is busy.  Each time it finds
+ *	nothing to steal, the interval doubles, up to the maximum.
+ */
+#define STEAL_INTERVAL (USEC / 500)
+#define STEAL_INTERVAL_MAX (USEC / 10)
+
 /**
  *  Track things by priority and time.
  */
@@ -110,8 +145,34 @@ struct fr_worker_t {
 	fr_transport_t		**transports;	//!< array of active transports.
 
 	fr_channel_t		**channel;	//!< list of channels
+
+	pthread_mutex_t		mutex;		//!< protects the input heaps and the channels, which peers steal from.
+						//!< Our own replies skip it while no loans are outstanding.
+
+	fr_worker_pool_t	*pool;		//!< peers which we can steal from, and which can steal from us
+	int			pool_id;	//!< our entry in the pool
+	fr_event_timer_t	*steal_ev;	//!< wakes us up to look for work to steal
+	uint32_t		steal_interval;	//!< how long until steal_ev fires, in microseconds
+
+	atomic_uint_fast64_t	running_since;	//!< when we started running the current request, or 0
+	atomic_int		num_loaned;	//!< requests stolen from us, which the thieves haven't finished
+	atomic_bool		replying;	//!< we're replying without holding the mutex
+	pthread_cond_t		loans_returned;	//!< signalled when num_loaned drops to zero
+};
+
+/**
+ *  Workers which can steal work from each other.
+ */
+struct fr_worker_pool_t {
+	pthread_rwlock_t	lock;		//!< thieves read, workers write when joining or leaving
+
+	int			max_workers;	//!< size of the workers array
+	int			num_workers;	//!< number of workers in the pool
+	fr_worker_t		**workers;	//!< the workers, with NULL for free entries
 };
 
+static void fr_worker_pool_remove(fr_worker_pool_t *pool, fr_worker_t *worker);
+
 /*
  *	We need wrapper macros because we have multiple instances of
  *	the same code.
@@ -142,6 +203,8 @@ struct fr_worker_t {
 
 
 /** Drain the input channel
+ *
+ *  Must be called with the worker mutex held.
  *
  * @param[in] worker the worker
  * @param[in] ch the channel to drain
@@ -150,6 +213,7 @@ struct fr_worker_t {
 static void fr_worker_drain_input(fr_worker_t *worker, fr_channel_t *ch, fr_channel_data_t *cd)
 {
 	if (!cd) cd = fr_channel_recv_request(ch);
+	if (!cd) return;
 
 	do {
 		WORKER_HEAP_INSERT(to_decode, cd, request.list);
@@ -203,12 +267,15 @@ static void fr_worker_evfilt_user(UNUSED int kq, struct kevent const *kev, void
 
 		case FR_CHANNEL_DATA_READY_WORKER:
 			rad_assert(ch != NULL);
+			pthread_mutex_lock(&worker->mutex);
 			fr_worker_drain_input(worker, ch, NULL);
+			pthread_mutex_unlock(&worker->mutex);
 			break;
 
 		case FR_CHANNEL_OPEN:
 			rad_assert(ch != NULL);
 
+			pthread_mutex_lock(&worker->mutex);
 			ok = false;
 			for (i = 0; i < worker->max_channels; i++) {
 				if (worker->channel[i] != NULL) continue;
@@ -224,7 +291,9 @@ static void fr_worker_evfilt_user(UNUSED int kq, struct kevent const *kev, void
 
 				worker->num_channels++;
 				ok = true;
+				break;
 			}
+			pthread_mutex_unlock(&worker->mutex);
 
 			rad_cond_assert(ok);
 			break;
@@ -232,6 +301,7 @@ static void fr_worker_evfilt_user(UNUSED int kq, struct kevent const *kev, void
 		case FR_CHANNEL_CLOSE:
 			rad_assert(ch != NULL);
 
+			pthread_mutex_lock(&worker->mutex);
 			ok = false;
 			for (i = 0; i < worker->max_channels; i++) {
 				if (!worker->channel[i]) continue;
@@ -253,12 +323,20 @@ static void fr_worker_evfilt_user(UNUSED int kq, struct kevent const *kev, void
 				fr_message_set_gc(ms);
 				talloc_free(ms);
 
+				/*
+				 *	A peer may still be running a
+				 *	request it stole from this
+				 *	channel.  Tell it not to reply.
+				 */
+				fr_channel_worker_ctx_add(ch, NULL);
+
 				worker->channel[i] = NULL;
 				rad_assert(worker->num_channels > 0);
 				worker->num_channels--;
 				ok = true;
 				break;
 			}
+			pthread_mutex_unlock(&worker->mutex);
 
 			rad_cond_assert(ok);
 			break;
@@ -267,32 +345,39 @@ static void fr_worker_evfilt_user(UNUSED int kq, struct kevent const *kev, void
 }
 
 
-/** Decode a request from either the localized queue, or the to_decode queue
+/** Pop a message from either the localized queue, or the to_decode queue
  *
- *  The request returned from this function MUST be immediately runnable.
+ *  Must be called with the worker mutex held.
  *
- * @param[in] worker the worker
+ *  Thieves only take messages from the "to_decode" queue, and only
+ *  once the message has waited for STEAL_DELAY.  Localized messages
+ *  were allocated by the worker which owns them, and stay there.
+ *
+ * @param[in] worker the worker which owns the queues
  * @param[in] now the current time
+ * @param[in] steal whether we're stealing the message from a peer
  * @return
  *	- NULL on nothing to decode
- *	- REQUEST the decoded request
+ *	- the message
  */
-static REQUEST *fr_worker_decode_request(fr_worker_t *worker, fr_time_t now)
+static fr_channel_data_t *fr_worker_pop_message(fr_worker_t *worker, fr_time_t now, bool steal)
 {
-	int rcode;
 	fr_channel_data_t *cd;
-	REQUEST *request;
-#ifndef HAVE_TALLOC_POOLED_OBJECT
-	TALLOC_CTX *ctx;
-#endif
 
-	/*
-	 *	Find either a localized message, or one which is in
-	 *	the "to_decode" queue.
-	 */
 redo:
-	WORKER_HEAP_POP(localized, cd, request.list);
-	if (!cd) {
+	if (!steal) {
+		WORKER_HEAP_POP(localized, cd, request.list);
+		if (!cd) {
+			WORKER_HEAP_POP(to_decode, cd, request.list);
+		}
+	} else {
+		/*
+		 *	The heap is ordered by priority, so we always
+		 *	take the message the owner would have run next.
+		 */
+		cd = fr_heap_peek(worker->to_decode.heap);
+		if (!cd || ((now - cd->m.when) < STEAL_DELAY)) return NULL;
+
 		WORKER_HEAP_POP(to_decode, cd, request.list);
 	}
 	if (!cd) return NULL;
@@ -306,6 +391,29 @@ redo:
 		goto redo;
 	}
 
+	return cd;
+}
+
+/** Decode a message to a request
+ *
+ *  The request returned from this function MUST be immediately runnable.
+ *
+ * @param[in] worker the worker which will run the request
+ * @param[in] owner the worker which received the message, and owns its channel
+ * @param[in] cd the message to decode
+ * @param[in] now the current time
+ * @return
+ *	- NULL on error
+ *	- REQUEST the decoded request
+ */
+static REQUEST *fr_worker_decode_request(fr_worker_t *worker, fr_worker_t *owner, fr_channel_data_t *cd, fr_time_t now)
+{
+	int rcode;
+	REQUEST *request;
+#ifndef HAVE_TALLOC_POOLED_OBJECT
+	TALLOC_CTX *ctx;
+#endif
+
 #ifndef HAVE_TALLOC_POOLED_OBJECT
 	/*
 	 *	Get a talloc pool specifically for this packet.
@@ -351,6 +459,7 @@ redo:
 	 *	processing this message.
 	 */
 	request->channel = cd->channel.ch;
+	request->owner = owner;
 	request->transport = worker->transports[cd->transport];
 	request->original_recv_time = cd->request.start_time;
 	request->recv_time = cd->m.when;
@@ -385,6 +494,121 @@ redo:
 
 #define fr_ptr_to_type(TYPE, MEMBER, PTR) (TYPE *) (((char *)PTR) - offsetof(TYPE, MEMBER))
 
+/** Tell the owner of a stolen request that we're done with it
+ *
+ *  The owner may be waiting in fr_worker_destroy() for its requests
+ *  to be returned.
+ *
+ * @param[in] owner the worker we stole the request from
+ */
+static void fr_worker_loan_return(fr_worker_t *owner)
+{
+	pthread_mutex_lock(&owner->mutex);
+	if (atomic_fetch_sub(&owner->num_loaned, 1) == 1) pthread_cond_signal(&owner->loans_returned);
+	pthread_mutex_unlock(&owner->mutex);
+}
+
+/** Free a request which we're done with
+ *
+ * @param[in] worker the worker which ran the request
+ * @param[in] request to free
+ */
+static void fr_worker_request_free(fr_worker_t *worker, REQUEST *request)
+{
+	FR_DLIST_REMOVE(request->time_order);
+
+	/*
+	 *	Let the owner know that it can exit.
+	 */
+	if (request->owner != worker) fr_worker_loan_return(request->owner);
+
+	talloc_free(request);
+}
+
+/** Steal a message from a peer, and decode it
+ *
+ *  We only look at peers which have been running the same request
+ *  for longer than STEAL_DELAY.  A peer which is making progress
+ *  will get to its own messages soon enough.
+ *
+ *  While we hold the peers mutex, we also drain its channels.  A
+ *  peer which is blocked doesn't read its channels, so that's where
+ *  most of its backlog is.
+ *
+ * @param[in] worker the thief
+ * @param[in] now the current time
+ * @return
+ *	- NULL on nothing to steal
+ *	- REQUEST the decoded request
+ */
+static REQUEST *fr_worker_steal(fr_worker_t *worker, fr_time_t now)
+{
+	int i, j;
+	fr_worker_pool_t *pool = worker->pool;
+	fr_worker_t *victim = NULL;
+	fr_channel_data_t *cd = NULL;
+	REQUEST *request;
+
+	if (!pool) return NULL;
+
+	pthread_rwlock_rdlock(&pool->lock);
+
+	/*
+	 *	Start with the peer after us, so that thieves spread
+	 *	themselves over the busy peers.
+	 */
+	for (i = 1; i < pool->max_workers; i++) {
+		fr_time_t running_since;
+
+		victim = pool->workers[(worker->pool_id + i) % pool->max_workers];
+		if (!victim) continue;
+
+		running_since = load(victim->running_since);
+		if (!running_since || (running_since > now) || ((now - running_since) < STEAL_DELAY)) continue;
+
+		/*
+		 *	The peer is using its mutex, so it's not stuck.
+		 */
+		if (pthread_mutex_trylock(&victim->mutex) != 0) continue;
+
+		/*
+		 *	Take out a loan before touching the peer's
+		 *	channels, and back off if it's replying.  See
+		 *	fr_worker_run_request() for the other half.
+		 */
+		atomic_fetch_add(&victim->num_loaned, 1);
+		if (atomic_load(&victim->replying)) {
+			atomic_fetch_sub(&victim->num_loaned, 1);
+			pthread_mutex_unlock(&victim->mutex);
+			continue;
+		}
+
+		for (j = 0; j < victim->max_channels; j++) {
+			if (!victim->channel[j]) continue;
+
+			fr_worker_drain_input(victim, victim->channel[j], NULL);
+		}
+
+		cd = fr_worker_pop_message(victim, now, true);
+		if (!cd && (atomic_fetch_sub(&victim->num_loaned, 1) == 1)) {
+			pthread_cond_signal(&victim->loans_returned);
+		}
+
+		pthread_mutex_unlock(&victim->mutex);
+
+		if (cd) break;
+	}
+
+	pthread_rwlock_unlock(&pool->lock);
+
+	if (!cd) return NULL;
+
+	request = fr_worker_decode_request(worker, victim, cd, now);
+	if (!request) fr_worker_loan_return(victim);
+
+	return request;
+}
+
 /** Check timeouts on the various queues
  *
  *  This function checks and enforces timeouts on the multiple worker
@@ -400,6 +624,8 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 	fr_time_t waiting;
 	fr_dlist_t *entry;
 
+	pthread_mutex_lock(&worker->mutex);
+
 	/*
 	 *	Check the "localized" queue for old packets.
 	 *
@@ -453,6 +679,8 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 		WORKER_HEAP_INSERT(localized, cd, request.list);
 	}
 
+	pthread_mutex_unlock(&worker->mutex);
+
 	/*
 	 *	Check the "runnable" queue for old requests.
 	 */
@@ -467,13 +695,12 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 		/*
 		 *	Waiting too long, delete it.
 		 */
-		FR_DLIST_REMOVE(request->time_order);
 		(void) fr_heap_extract(worker->runnable, request);
 
 		fr_time_tracking_resume(&request->tracking, now);
 		request->process_async(request, FR_TRANSPORT_ACTION_DONE);
 		fr_time_tracking_end(&request->tracking, now, &worker->tracking);
-		talloc_free(request);
+		fr_worker_request_free(worker, request);
 	}
 }
 
@@ -489,6 +716,7 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 {
 	REQUEST *request;
+	fr_channel_data_t *cd;
 
 	/*
 	 *	Grab a runnable request, and resume it.
@@ -502,9 +730,61 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	/*
 	 *	Grab a request to decode, and start it.
 	 */
-	return fr_worker_decode_request(worker, now);
+	pthread_mutex_lock(&worker->mutex);
+	cd = fr_worker_pop_message(worker, now, false);
+	pthread_mutex_unlock(&worker->mutex);
+
+	if (cd) return fr_worker_decode_request(worker, worker, cd, now);
+
+	/*
+	 *	We have nothing to do.  See if a peer needs help.
+	 */
+	return fr_worker_steal(worker, now);
+}
+
+
+/** Start using the channels of the worker which owns a request
+ *
+ *  Peers only touch our channels and input heaps while they hold a
+ *  loan.  So when no loans are outstanding, we reply without the
+ *  mutex.  We say that we're replying, and then check for loans.  A
+ *  thief takes out a loan, and then checks if we're replying.  At
+ *  least one of us sees the other, and backs off.
+ *
+ *  Replies to stolen requests always lock the owner's mutex.
+ *
+ * @param[in] worker the worker which ran the request
+ * @param[in] owner the worker which received the request
+ * @return
+ *	- true if the owner's mutex was locked
+ *	- false if we're replying without it
+ */
+static bool fr_worker_reply_start(fr_worker_t *worker, fr_worker_t *owner)
+{
+	if (owner == worker) {
+		atomic_store(&worker->replying, true);
+		if (atomic_load(&worker->num_loaned) == 0) return false;
+		atomic_store(&worker->replying, false);
+	}
+
+	pthread_mutex_lock(&owner->mutex);
+	return true;
 }
 
+/** Stop using the channels of the worker which owns a request
+ *
+ * @param[in] owner the worker which received the request
+ * @param[in] locked what fr_worker_reply_start() returned
+ */
+static void fr_worker_reply_end(fr_worker_t *owner, bool locked)
+{
+	if (locked) {
+		pthread_mutex_unlock(&owner->mutex);
+		return;
+	}
+
+	atomic_store(&owner->replying, false);
+}
 
 /** Run a request
  *
@@ -523,6 +803,8 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 	fr_channel_t *ch;
 	fr_transport_final_t final;
 	fr_message_set_t *ms;
+	fr_worker_t *owner;
+	bool locked;
 
 	/*
 	 *	If we still have the same packet, and the channel is
@@ -548,8 +830,7 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 	switch (final) {
 	case FR_TRANSPORT_DONE:
 		fr_time_tracking_end(&request->tracking, fr_time(), &worker->tracking);
-		FR_DLIST_REMOVE(request->time_order);
-		talloc_free(request);
+		fr_worker_request_free(worker, request);
 		return;
 
 	case FR_TRANSPORT_YIELD:
@@ -566,8 +847,23 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 	ch = request->channel;
 	rad_assert(ch != NULL);
 
+	/*
+	 *	The channel and its message set belong to the worker
+	 *	which received the request.  That's usually us, but
+	 *	the request may have been stolen from a peer.
+	 */
+	owner = request->owner;
+	locked = fr_worker_reply_start(worker, owner);
+
+	/*
+	 *	The channel was closed while we were running the
+	 *	request.  There's no one to reply to.
+	 */
 	ms = fr_channel_worker_ctx_get(ch);
-	rad_assert(ms != NULL);
+	if (!ms) {
+		fr_worker_reply_end(owner, locked);
+		goto fail;
+	}
 
 	/*
 	 *	@todo make the reservation size transport-specific
@@ -581,6 +877,7 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 	size = request->transport->encode(request->packet_ctx, request, reply->m.data, reply->m.data_size);
 	if (size < 0) {
 		fr_message_done(&reply->m);
+		fr_worker_reply_end(owner, locked);
 		goto fail;
 	}
 
@@ -620,16 +917,16 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 	 *	Drain the incoming TO_WORKER queue.  We do this every
 	 *	time we're done processing a request.
 	 */
-	if (cd) fr_worker_drain_input(worker, ch, cd);
+	if (cd) fr_worker_drain_input(owner, ch, cd);
+
+	fr_worker_reply_end(owner, locked);
 
 	/*
 	 *	@todo Use a talloc pool for the request.  Clean it up,
 	 *	and insert it back into a slab allocator.
 	 */
 fail:
-	FR_DLIST_REMOVE(request->time_order);
-	talloc_free(request);
-
+	fr_worker_request_free(worker, request);
 }
 
 /** Run the event loop 'idle' callback
@@ -658,6 +955,7 @@ static int fr_worker_idle(struct timeval *wake, void *ctx)
 	 *	more to do, we need to tell the other end of the
 	 *	channels that we're sleeping.
 	 */
+	pthread_mutex_lock(&worker->mutex);
 	sleeping = (fr_heap_num_elements(worker->runnable) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->localized.heap) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->to_decode.heap) == 0);
@@ -667,7 +965,10 @@ static int fr_worker_idle(struct timeval *wake, void *ctx)
 	 *	don't want to wait for events, but instead check them,
 	 *	and start processing packets immediately.
 	 */
-	if (!sleeping) return 1;
+	if (!sleeping) {
+		pthread_mutex_unlock(&worker->mutex);
+		return 1;
+	}
 
 	/*
 	 *	Nothing more to do, and the event loop has us sleeping
@@ -676,9 +977,12 @@ static int fr_worker_idle(struct timeval *wake, void *ctx)
 	 *	will take care of skipping the signal if there are no
 	 *	outstanding requests for it.
 	 */
-	for (i = 0; i < worker->num_channels; i++) {
+	for (i = 0; i < worker->max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
 		(void) fr_channel_worker_sleeping(worker->channel[i]);
 	}
+	pthread_mutex_unlock(&worker->mutex);
 
 	return 0;
 }
@@ -724,6 +1028,37 @@ void fr_worker_destroy(fr_worker_t *worker)
 {
 	int i;
 	fr_channel_data_t *cd;
+	fr_dlist_t *entry;
+
+	/*
+	 *	Requests we stole are freed along with our talloc
+	 *	context.  Tell their owners that they no longer have
+	 *	to wait for us.
+	 */
+	for (entry = FR_DLIST_FIRST(worker->time_order);
+	     entry != NULL;
+	     entry = FR_DLIST_NEXT(worker->time_order, entry)) {
+		REQUEST *request;
+
+		request = fr_ptr_to_type(REQUEST, time_order, entry);
+		if (request->owner == worker) continue;
+
+		fr_worker_loan_return(request->owner);
+		request->owner = worker;
+	}
+
+	/*
+	 *	Stop peers from stealing from us.
+	 */
+	if (worker->pool) fr_worker_pool_remove(worker->pool, worker);
+
+	pthread_mutex_lock(&worker->mutex);
+
+	/*
+	 *	Wait for peers to finish with the requests they've
+	 *	already stolen.  Their replies use our channels.
+	 */
+	while (load(worker->num_loaned) > 0) pthread_cond_wait(&worker->loans_returned, &worker->mutex);
 
 	/*
 	 *	These messages aren't in the channel, so we have to
@@ -750,9 +1085,21 @@ void fr_worker_destroy(fr_worker_t *worker)
 	 *	the FROM_WORKER queue, as we own those.  They will be
 	 *	automatically freed when our talloc context is freed.
 	 */
-	for (i = 0; i < worker->num_channels; i++) {
+	for (i = 0; i < worker->max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
 		fr_channel_worker_ack_close(worker->channel[i]);
 	}
+
+	pthread_mutex_unlock(&worker->mutex);
+}
+
+static int _worker_free(fr_worker_t *worker)
+{
+	pthread_cond_destroy(&worker->loans_returned);
+	pthread_mutex_destroy(&worker->mutex);
+
+	return 0;
 }
 
 
@@ -775,6 +1122,16 @@ fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, uint32_t num_transports, fr_trans
 	worker = talloc_zero(ctx, fr_worker_t);
 	if (!worker) return NULL;
 
+	pthread_mutex_init(&worker->mutex, NULL);
+	pthread_cond_init(&worker->loans_returned, NULL);
+	talloc_set_destructor(worker, _worker_free);
+
+	worker->steal_interval = STEAL_INTERVAL;
+
+	atomic_init(&worker->running_since, 0);
+	atomic_init(&worker->num_loaned, 0);
+	atomic_init(&worker->replying, false);
+
 	worker->channel = talloc_zero_array(worker, fr_channel_t *, max_channels);
 	if (!worker->channel) {
 		talloc_free(worker);
@@ -833,6 +1190,149 @@ fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, uint32_t num_transports, fr_trans
 	return worker;
 }
 
+/** Wake up the event loop
+ *
+ *  fr_worker() then looks for work to steal.  If it doesn't find any,
+ *  it will wait twice as long before looking again.
+ */
+static void fr_worker_steal_timer(UNUSED struct timeval *now, void *ctx)
+{
+	fr_worker_t *worker = ctx;
+
+	worker->steal_interval *= 2;
+	if (worker->steal_interval > STEAL_INTERVAL_MAX) worker->steal_interval = STEAL_INTERVAL_MAX;
+}
+
+/** Wake up later to look for work to steal, if any peer is busy
+ *
+ *  While we're idle, and peers are busy but not stuck, the interval
+ *  backs off, so that idle workers don't keep waking up for nothing.
+ *
+ * @param[in] worker the worker
+ */
+static void fr_worker_steal_timer_insert(fr_worker_t *worker)
+{
+	int i;
+	bool busy = false;
+	struct timeval when;
+	fr_worker_pool_t *pool = worker->pool;
+
+	if (!pool || worker->steal_ev) return;
+
+	pthread_rwlock_rdlock(&pool->lock);
+	for (i = 0; i < pool->max_workers; i++) {
+		fr_worker_t *peer = pool->workers[i];
+
+		if (!peer || (peer == worker)) continue;
+
+		if (load(peer->running_since) != 0) {
+			busy = true;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&pool->lock);
+
+	if (!busy) return;
+
+	gettimeofday(&when, NULL);
+	when.tv_usec += worker->steal_interval;
+	when.tv_sec += when.tv_usec / USEC;
+	when.tv_usec %= USEC;
+
+	(void) fr_event_timer_insert(worker->el, fr_worker_steal_timer, worker, &when, &worker->steal_ev);
+}
+
+static int _worker_pool_free(fr_worker_pool_t *pool)
+{
+	pthread_rwlock_destroy(&pool->lock);
+
+	return 0;
+}
+
+/** Create a pool of workers which can steal work from each other
+ *
+ * @param[in] ctx the talloc context
+ * @param[in] max_workers the maximum number of workers in the pool
+ * @return
+ *	- NULL on error
+ *	- fr_worker_pool_t on success
+ */
+fr_worker_pool_t *fr_worker_pool_create(TALLOC_CTX *ctx, int max_workers)
+{
+	fr_worker_pool_t *pool;
+
+	if (max_workers <= 0) return NULL;
+
+	pool = talloc_zero(ctx, fr_worker_pool_t);
+	if (!pool) return NULL;
+
+	pool->workers = talloc_zero_array(pool, fr_worker_t *, max_workers);
+	if (!pool->workers) {
+		talloc_free(pool);
+		return NULL;
+	}
+	pool->max_workers = max_workers;
+
+	if (pthread_rwlock_init(&pool->lock, NULL) != 0) {
+		talloc_free(pool);
+		return NULL;
+	}
+	talloc_set_destructor(pool, _worker_pool_free);
+
+	return pool;
+}
+
+/** Add a worker to a pool
+ *
+ *  The worker leaves the pool in fr_worker_destroy().
+ *
+ * @param[in] pool the pool
+ * @param[in] worker the worker to add
+ * @return
+ *	- <0 on error, or the pool is full
+ *	- 0 on success
+ */
+int fr_worker_pool_add(fr_worker_pool_t *pool, fr_worker_t *worker)
+{
+	int i;
+
+	if (worker->pool) return -1;
+
+	pthread_rwlock_wrlock(&pool->lock);
+	for (i = 0; i < pool->max_workers; i++) {
+		if (pool->workers[i]) continue;
+
+		pool->workers[i] = worker;
+		pool->num_workers++;
+
+		worker->pool = pool;
+		worker->pool_id = i;
+		break;
+	}
+	pthread_rwlock_unlock(&pool->lock);
+
+	if (!worker->pool) return -1;
+
+	return 0;
+}
+
+/** Remove a worker from its pool
+ *
+ *  Once this function returns, no peer will steal from the worker.
+ *  Requests which were already stolen may still be running.
+ *
+ * @param[in] pool the pool
+ * @param[in] worker the worker to remove
+ */
+static void fr_worker_pool_remove(fr_worker_pool_t *pool, fr_worker_t *worker)
+{
+	pthread_rwlock_wrlock(&pool->lock);
+	rad_assert(pool->workers[worker->pool_id] == worker);
+	pool->workers[worker->pool_id] = NULL;
+	pool->num_workers--;
+	pthread_rwlock_unlock(&pool->lock);
+}
+
 /** Get the KQ for the worker
  *
  * @param[in] worker the worker data structure
@@ -903,16 +1403,28 @@ void fr_worker(fr_worker_t *worker)
 		if ((now - worker->checked_timeout) > (NANOSEC / 10)) fr_worker_check_timeouts(worker, now);
 
 		/*
-		 *	Get a runnable request.  If there isn't one, continue.
+		 *	Get a runnable request.  If there isn't one,
+		 *	make sure we wake up to check on busy peers.
 		 */
 		request = fr_worker_get_request(worker, now);
-		if (!request) continue;
+		if (!request) {
+			fr_worker_steal_timer_insert(worker);
+			continue;
+		}
+
+		/*
+		 *	We have work again.  If we go idle, look for
+		 *	work to steal soon.
+		 */
+		worker->steal_interval = STEAL_INTERVAL;
 
 		/*
 		 *	Run the request, and either track it as
 		 *	yielded, or send a reply.
 		 */
+		store(worker->running_since, now);
 		fr_worker_run_request(worker, request);
+		store(worker->running_since, 0);
 	}
 }
 
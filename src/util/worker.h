@@ -43,6 +43,11 @@ extern "C" {
  */
 typedef struct fr_worker_t fr_worker_t;
 
+/**
+ *  Workers which can steal work from each other.
+ */
+typedef struct fr_worker_pool_t fr_worker_pool_t;
+
 fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, uint32_t num_transports, fr_transport_t **transports);
 void fr_worker_destroy(fr_worker_t *worker) CC_HINT(nonnull);
 int fr_worker_kq(fr_worker_t *worker) CC_HINT(nonnull);
@@ -50,6 +55,9 @@ fr_atomic_queue_t *fr_worker_control_plane(fr_worker_t *worker) CC_HINT(nonnull)
 void fr_worker(fr_worker_t *worker) CC_HINT(nonnull);
 void fr_worker_exit(fr_worker_t *worker) CC_HINT(nonnull);
 
+fr_worker_pool_t *fr_worker_pool_create(TALLOC_CTX *ctx, int max_workers);
+int fr_worker_pool_add(fr_worker_pool_t *pool, fr_worker_t *worker) CC_HINT(nonnull);
+
 #ifdef __cplusplus
 }
 #endif